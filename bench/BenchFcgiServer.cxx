@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * A trivial FastCGI application for the HTTP load benchmark.  It
+ * accepts connections on the listener socket passed as stdin (the
+ * way beng-proxy spawns FastCGI applications) and answers each
+ * request with a fixed-size body.
+ *
+ * Usage: BenchFcgiServer [BODY_SIZE]
+ */
+
+#include "../test/fcgi_server.hxx"
+#include "../test/TestInstance.hxx"
+#include "fcgi/Protocol.hxx"
+#include "http/Status.hxx"
+#include "pool/pool.hxx"
+#include "util/PrintException.hxx"
+
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void
+HandleConnection(struct pool &parent_pool, UniqueSocketDescriptor &&fd,
+		 std::string_view body)
+{
+	FcgiServer server{std::move(fd)};
+
+	while (true) {
+		auto pool = pool_new_linear(&parent_pool, "request", 8192);
+
+		const auto request = server.ReadRequest(pool);
+		server.DiscardRequestBody(request);
+
+		server.WriteResponseHeaders(request, HttpStatus::OK, {});
+
+		/* a record payload is limited to 16 bits */
+		for (auto i = body; !i.empty();) {
+			const auto chunk = i.substr(0, 32768);
+			server.WriteStdout(request, chunk);
+			i.remove_prefix(chunk.size());
+		}
+
+		server.EndResponse(request);
+		server.FlushOutput();
+	}
+}
+
+int
+main(int argc, char **argv)
+try {
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [BODY_SIZE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::string body(argc >= 2 ? strtoul(argv[1], nullptr, 10) : 1024,
+			       'x');
+
+	TestInstance instance;
+
+	UniqueSocketDescriptor listener{STDIN_FILENO};
+	listener.SetBlocking();
+
+	while (true) {
+		UniqueSocketDescriptor fd{listener.AcceptNonBlock()};
+		if (!fd.IsDefined())
+			continue;
+
+		/* the FcgiServer class expects a blocking socket */
+		fd.SetBlocking();
+
+		try {
+			HandleConnection(instance.root_pool, std::move(fd),
+					 body);
+		} catch (...) {
+			/* the peer has closed the connection (or sent
+			   garbage); wait for the next one */
+		}
+	}
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
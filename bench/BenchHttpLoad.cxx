@@ -0,0 +1,795 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * An open-loop HTTP load generator.  Requests are scheduled at a
+ * fixed rate no matter how fast the server responds, and latencies
+ * are measured from the time a request was scheduled (not from the
+ * time it was sent), so queueing delays inside the generator are not
+ * hidden from the result.
+ *
+ * Usage: BenchHttpLoad URL RATE SECONDS [CONNECTIONS]
+ *
+ * URL schemes: http://, https://, http2:// (prior knowledge),
+ * https2:// (ALPN)
+ *
+ * The result is printed to stdout as "key=value" lines.
+ */
+
+#include "../test/TestInstance.hxx"
+#include "strmap.hxx"
+#include "http/Client.hxx"
+#include "http/CommonHeaders.hxx"
+#include "http/Method.hxx"
+#include "http/ResponseHandler.hxx"
+#include "http/Status.hxx"
+#include "lease.hxx"
+#include "istream/Sink.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "memory/GrowingBuffer.hxx"
+#include "pool/pool.hxx"
+#include "fs/FilteredSocket.hxx"
+#include "ssl/Init.hxx"
+#include "ssl/Client.hxx"
+#include "ssl/Config.hxx"
+#include "system/SetupProcess.hxx"
+#include "net/HostParser.hxx"
+#include "net/Resolver.hxx"
+#include "net/AddressInfo.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "event/net/ConnectSocket.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "event/ShutdownListener.hxx"
+#include "util/Cancellable.hxx"
+#include "util/IntrusiveList.hxx"
+#include "util/PrintException.hxx"
+#include "stopwatch.hxx"
+
+#ifdef HAVE_NGHTTP2
+#include "nghttp2/Client.hxx"
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct LoadUrl {
+	enum class Protocol {
+		HTTP,
+#ifdef HAVE_NGHTTP2
+		HTTP2,
+#endif
+	} protocol;
+
+	bool ssl = false;
+
+	std::string host;
+
+	int default_port;
+
+	const char *uri;
+};
+
+static LoadUrl
+ParseLoadUrl(const char *url)
+{
+	LoadUrl dest;
+
+	if (memcmp(url, "http://", 7) == 0) {
+		url += 7;
+		dest.protocol = LoadUrl::Protocol::HTTP;
+		dest.default_port = 80;
+	} else if (memcmp(url, "https://", 8) == 0) {
+		url += 8;
+		dest.protocol = LoadUrl::Protocol::HTTP;
+		dest.ssl = true;
+		dest.default_port = 443;
+#ifdef HAVE_NGHTTP2
+	} else if (memcmp(url, "http2://", 8) == 0) {
+		url += 8;
+		dest.protocol = LoadUrl::Protocol::HTTP2;
+		dest.default_port = 80;
+	} else if (memcmp(url, "https2://", 9) == 0) {
+		url += 9;
+		dest.protocol = LoadUrl::Protocol::HTTP2;
+		dest.ssl = true;
+		dest.default_port = 443;
+#endif
+	} else
+		throw std::runtime_error("Unsupported URL");
+
+	dest.uri = strchr(url, '/');
+	if (dest.uri == nullptr || dest.uri == url)
+		throw std::runtime_error("Missing URI path");
+
+	dest.host = std::string(url, dest.uri);
+
+	return dest;
+}
+
+class LoadGenerator;
+class LoadConnection;
+
+/**
+ * One HTTP request.  It discards the response body and reports to
+ * its #LoadConnection when it is finished.
+ */
+class LoadRequest final
+	: public IntrusiveListHook<IntrusiveHookMode::NORMAL>,
+	  public HttpResponseHandler, IstreamSink
+{
+	LoadConnection &connection;
+
+	PoolPtr pool;
+
+public:
+	/**
+	 * The time this request was scheduled by the open-loop
+	 * generator.
+	 */
+	const Event::TimePoint scheduled;
+
+	CancellablePointer cancel_ptr;
+
+	/**
+	 * False if the server has responded with an error status.
+	 */
+	bool status_ok = true;
+
+	LoadRequest(LoadConnection &_connection, struct pool &parent_pool,
+		    Event::TimePoint _scheduled) noexcept
+		:connection(_connection),
+		 pool(pool_new_linear(&parent_pool, "LoadRequest", 4096)),
+		 scheduled(_scheduled) {}
+
+	struct pool &GetPool() const noexcept {
+		return pool;
+	}
+
+	void Cancel() noexcept {
+		if (HasInput())
+			CloseInput();
+		else
+			cancel_ptr.Cancel();
+	}
+
+private:
+	void Done(bool success) noexcept;
+
+	/* virtual methods from class HttpResponseHandler */
+	void OnHttpResponse(HttpStatus status, StringMap &&headers,
+			    UnusedIstreamPtr body) noexcept override;
+	void OnHttpError(std::exception_ptr ep) noexcept override;
+
+	/* virtual methods from class IstreamHandler */
+	std::size_t OnData(std::span<const std::byte> src) noexcept override {
+		return src.size();
+	}
+
+	void OnEof() noexcept override {
+		ClearInput();
+		Done(true);
+	}
+
+	void OnError(std::exception_ptr) noexcept override {
+		ClearInput();
+		Done(false);
+	}
+};
+
+/**
+ * One connection to the server.  With HTTP/1.1, it handles one
+ * request at a time; with HTTP/2, it multiplexes up to
+ * #MAX_STREAMS requests.
+ */
+class LoadConnection final
+	: ConnectSocketHandler, Lease
+#ifdef HAVE_NGHTTP2
+	, NgHttp2::ConnectionHandler
+#endif
+{
+	static constexpr unsigned MAX_STREAMS = 128;
+
+	LoadGenerator &generator;
+
+	ConnectSocket connect;
+
+	FilteredSocket fs;
+
+	/**
+	 * Notifies the #LoadGenerator (or reconnects) after a request
+	 * has finished; deferred to avoid reentering the HTTP client
+	 * from inside its own callbacks.
+	 */
+	DeferEvent defer_available;
+
+#ifdef HAVE_NGHTTP2
+	std::unique_ptr<NgHttp2::ClientConnection> nghttp2_client;
+#endif
+
+	IntrusiveList<LoadRequest> requests;
+
+	enum class State {
+		DISCONNECTED,
+		CONNECTING,
+		READY,
+	} state = State::DISCONNECTED;
+
+	/**
+	 * Is the (HTTP/1.1) socket currently leased to the HTTP
+	 * client?
+	 */
+	bool leased = false;
+
+public:
+	explicit LoadConnection(LoadGenerator &_generator) noexcept;
+
+	~LoadConnection() noexcept {
+		Close();
+	}
+
+	void Connect() noexcept;
+
+	void Close() noexcept;
+
+	bool IsIdle() const noexcept {
+		return requests.empty() && !leased;
+	}
+
+	bool CanSend() const noexcept;
+
+	void Send(Event::TimePoint scheduled) noexcept;
+
+	void OnRequestDone(LoadRequest &request, bool success) noexcept;
+
+private:
+	void Disconnect() noexcept;
+
+	void OnDeferredAvailable() noexcept;
+
+	/* virtual methods from class ConnectSocketHandler */
+	void OnSocketConnectSuccess(UniqueSocketDescriptor fd) noexcept override;
+	void OnSocketConnectError(std::exception_ptr ep) noexcept override;
+
+	/* virtual methods from class Lease */
+	PutAction ReleaseLease(PutAction action) noexcept override;
+
+#ifdef HAVE_NGHTTP2
+	/* virtual methods from class NgHttp2::ConnectionHandler */
+	void OnNgHttp2ConnectionError(std::exception_ptr e) noexcept override;
+	void OnNgHttp2ConnectionClosed() noexcept override;
+#endif
+};
+
+class LoadGenerator final : public TestInstance {
+	static constexpr Event::Duration TICK = std::chrono::milliseconds{1};
+
+	/**
+	 * How long to wait for pending requests after the end of the
+	 * run?
+	 */
+	static constexpr Event::Duration DRAIN_TIMEOUT = std::chrono::seconds{10};
+
+	ShutdownListener shutdown_listener;
+
+	FineTimerEvent timer;
+
+	const ScopeSslGlobalInit ssl_init;
+
+public:
+	SslClientFactory ssl_client_factory{SslClientConfig{}};
+
+	PoolPtr pool;
+
+	LoadUrl url;
+	AllocatedSocketAddress address;
+
+	double rate;
+	Event::Duration duration;
+
+	std::list<LoadConnection> connections;
+
+	/**
+	 * Requests which are due but have not been sent yet because
+	 * all connections are busy.
+	 */
+	std::deque<Event::TimePoint> queue;
+
+	std::vector<Event::Duration> latencies;
+
+	Event::TimePoint start_time;
+
+	uint_least64_t n_scheduled = 0, n_errors = 0, n_status_errors = 0;
+	unsigned n_connect_errors = 0;
+
+	bool finished = false;
+
+	LoadGenerator() noexcept
+		:shutdown_listener(event_loop, BIND_THIS_METHOD(OnShutdown)),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)),
+		 pool(pool_new_linear(root_pool, "LoadGenerator", 8192)) {}
+
+	void Start(unsigned n_connections) noexcept {
+		for (unsigned i = 0; i < n_connections; ++i)
+			connections.emplace_back(*this).Connect();
+
+		latencies.reserve(rate * std::chrono::duration<double>(duration).count());
+
+		shutdown_listener.Enable();
+		start_time = event_loop.SteadyNow();
+		timer.Schedule(TICK);
+	}
+
+	bool IsRunning() const noexcept {
+		return !finished;
+	}
+
+	/**
+	 * A connection has capacity for another request.
+	 */
+	void OnConnectionAvailable(LoadConnection &connection) noexcept {
+		while (!queue.empty() && connection.CanSend()) {
+			const auto scheduled = queue.front();
+			queue.pop_front();
+			connection.Send(scheduled);
+		}
+
+		CheckDrained();
+	}
+
+	void OnResponse(Event::TimePoint scheduled, bool success,
+			bool status_ok) noexcept {
+		if (!success)
+			++n_errors;
+		else if (!status_ok)
+			++n_status_errors;
+		else
+			latencies.push_back(event_loop.SteadyNow() - scheduled);
+	}
+
+	void OnConnectError(std::exception_ptr ep) noexcept {
+		if (n_connect_errors++ == 0)
+			PrintException(ep);
+	}
+
+	void PrintResult() noexcept;
+
+private:
+	void Dispatch() noexcept {
+		for (auto &c : connections) {
+			if (queue.empty())
+				break;
+
+			while (!queue.empty() && c.CanSend()) {
+				const auto scheduled = queue.front();
+				queue.pop_front();
+				c.Send(scheduled);
+			}
+		}
+	}
+
+	void Finish() noexcept {
+		finished = true;
+		timer.Cancel();
+		shutdown_listener.Disable();
+
+		for (auto &c : connections)
+			c.Close();
+
+		event_loop.Break();
+	}
+
+	void CheckDrained() noexcept {
+		if (event_loop.SteadyNow() < start_time + duration)
+			return;
+
+		for (const auto &c : connections)
+			if (!c.IsIdle())
+				return;
+
+		Finish();
+	}
+
+	void OnTimer() noexcept {
+		const auto now = event_loop.SteadyNow();
+		const auto end_time = start_time + duration;
+
+		if (now >= end_time + DRAIN_TIMEOUT) {
+			/* give up on the remaining requests */
+			Finish();
+			return;
+		}
+
+		/* enqueue all requests which are due by now */
+		const auto until = std::min(now, end_time);
+		const auto due = uint_least64_t(std::chrono::duration<double>(until - start_time).count() * rate);
+		for (; n_scheduled < due; ++n_scheduled)
+			queue.push_back(start_time + std::chrono::duration_cast<Event::Duration>(std::chrono::duration<double>(n_scheduled / rate)));
+
+		Dispatch();
+
+		if (now >= end_time && queue.empty())
+			CheckDrained();
+
+		if (!finished)
+			timer.Schedule(TICK);
+	}
+
+	void OnShutdown() noexcept {
+		Finish();
+	}
+};
+
+/*
+ * LoadRequest
+ *
+ */
+
+inline void
+LoadRequest::Done(bool success) noexcept
+{
+	connection.OnRequestDone(*this, success);
+}
+
+void
+LoadRequest::OnHttpResponse(HttpStatus status, StringMap &&,
+			    UnusedIstreamPtr body) noexcept
+{
+	if (http_status_is_error(status))
+		status_ok = false;
+
+	if (!body) {
+		Done(true);
+		return;
+	}
+
+	SetInput(std::move(body));
+	input.Read();
+}
+
+void
+LoadRequest::OnHttpError(std::exception_ptr) noexcept
+{
+	Done(false);
+}
+
+/*
+ * LoadConnection
+ *
+ */
+
+LoadConnection::LoadConnection(LoadGenerator &_generator) noexcept
+	:generator(_generator),
+	 connect(generator.event_loop, *this),
+	 fs(generator.event_loop),
+	 defer_available(generator.event_loop,
+			 BIND_THIS_METHOD(OnDeferredAvailable)) {}
+
+void
+LoadConnection::Connect() noexcept
+{
+	assert(state == State::DISCONNECTED);
+
+	state = State::CONNECTING;
+	connect.Connect(generator.address, std::chrono::seconds{10});
+}
+
+void
+LoadConnection::Close() noexcept
+{
+	while (!requests.empty()) {
+		auto &request = requests.front();
+		requests.pop_front();
+		request.Cancel();
+		delete &request;
+	}
+
+	if (state == State::CONNECTING)
+		connect.Cancel();
+
+	defer_available.Cancel();
+	Disconnect();
+}
+
+void
+LoadConnection::Disconnect() noexcept
+{
+#ifdef HAVE_NGHTTP2
+	nghttp2_client.reset();
+#endif
+
+	if (fs.IsValid()) {
+		if (fs.IsConnected())
+			fs.Close();
+		fs.Destroy();
+	}
+
+	leased = false;
+	state = State::DISCONNECTED;
+}
+
+bool
+LoadConnection::CanSend() const noexcept
+{
+	if (state != State::READY)
+		return false;
+
+	switch (generator.url.protocol) {
+	case LoadUrl::Protocol::HTTP:
+		return IsIdle();
+
+#ifdef HAVE_NGHTTP2
+	case LoadUrl::Protocol::HTTP2:
+		return requests.size() < MAX_STREAMS;
+#endif
+	}
+
+	return false;
+}
+
+void
+LoadConnection::Send(Event::TimePoint scheduled) noexcept
+{
+	assert(CanSend());
+
+	auto *request = new LoadRequest(*this, *generator.pool, scheduled);
+	requests.push_back(*request);
+
+	auto &pool = request->GetPool();
+
+	StringMap headers;
+	headers.Add(pool, host_header, generator.url.host.c_str());
+
+	switch (generator.url.protocol) {
+	case LoadUrl::Protocol::HTTP:
+		leased = true;
+		http_client_request(pool, nullptr, fs, *this,
+				    "server",
+				    HttpMethod::GET, generator.url.uri,
+				    headers, {},
+				    nullptr, false,
+				    *request, request->cancel_ptr);
+		break;
+
+#ifdef HAVE_NGHTTP2
+	case LoadUrl::Protocol::HTTP2:
+		nghttp2_client->SendRequest(pool, nullptr,
+					    HttpMethod::GET, generator.url.uri,
+					    std::move(headers), nullptr,
+					    *request, request->cancel_ptr);
+		break;
+#endif
+	}
+}
+
+void
+LoadConnection::OnRequestDone(LoadRequest &request, bool success) noexcept
+{
+	generator.OnResponse(request.scheduled, success, request.status_ok);
+
+	requests.erase(requests.iterator_to(request));
+	delete &request;
+
+	defer_available.Schedule();
+}
+
+void
+LoadConnection::OnDeferredAvailable() noexcept
+{
+	if (!generator.IsRunning())
+		return;
+
+	if (state == State::DISCONNECTED) {
+		if (requests.empty())
+			Connect();
+	} else if (CanSend())
+		generator.OnConnectionAvailable(*this);
+}
+
+void
+LoadConnection::OnSocketConnectSuccess(UniqueSocketDescriptor new_fd) noexcept
+try {
+	SocketFilterPtr socket_filter;
+	if (generator.url.ssl) {
+		SslClientAlpn alpn = SslClientAlpn::NONE;
+#ifdef HAVE_NGHTTP2
+		if (generator.url.protocol == LoadUrl::Protocol::HTTP2)
+			alpn = SslClientAlpn::HTTP_2;
+#endif
+
+		const auto host = ExtractHost(generator.url.host.c_str());
+		socket_filter = generator.ssl_client_factory
+			.Create(generator.event_loop,
+				host.host.data() != nullptr
+				? std::string{host.host}.c_str()
+				: nullptr,
+				nullptr, alpn);
+	}
+
+	switch (generator.url.protocol) {
+	case LoadUrl::Protocol::HTTP:
+		fs.InitDummy(new_fd.Release(), FdType::FD_TCP,
+			     std::move(socket_filter));
+		break;
+
+#ifdef HAVE_NGHTTP2
+	case LoadUrl::Protocol::HTTP2:
+		nghttp2_client = std::make_unique<NgHttp2::ClientConnection>
+			(std::make_unique<FilteredSocket>(generator.event_loop,
+							  std::move(new_fd),
+							  FdType::FD_TCP,
+							  std::move(socket_filter)),
+			 *this);
+		break;
+#endif
+	}
+
+	state = State::READY;
+	generator.OnConnectionAvailable(*this);
+} catch (...) {
+	state = State::DISCONNECTED;
+	generator.OnConnectError(std::current_exception());
+}
+
+void
+LoadConnection::OnSocketConnectError(std::exception_ptr ep) noexcept
+{
+	state = State::DISCONNECTED;
+	generator.OnConnectError(std::move(ep));
+}
+
+PutAction
+LoadConnection::ReleaseLease(PutAction action) noexcept
+{
+	assert(leased);
+
+	leased = false;
+	defer_available.Schedule();
+
+	if (action != PutAction::REUSE) {
+		if (fs.IsConnected())
+			fs.Close();
+		fs.Destroy();
+		state = State::DISCONNECTED;
+		return PutAction::DESTROY;
+	}
+
+	return PutAction::REUSE;
+}
+
+#ifdef HAVE_NGHTTP2
+
+void
+LoadConnection::OnNgHttp2ConnectionError(std::exception_ptr e) noexcept
+{
+	generator.OnConnectError(std::move(e));
+	Close();
+	defer_available.Schedule();
+}
+
+void
+LoadConnection::OnNgHttp2ConnectionClosed() noexcept
+{
+	Close();
+	defer_available.Schedule();
+}
+
+#endif
+
+/*
+ * result
+ *
+ */
+
+[[gnu::pure]]
+static double
+Percentile(const std::vector<Event::Duration> &sorted, double p) noexcept
+{
+	if (sorted.empty())
+		return 0;
+
+	std::size_t i = std::min<std::size_t>(sorted.size() * p, sorted.size() - 1);
+	return std::chrono::duration<double, std::milli>(sorted[i]).count();
+}
+
+static double
+ToSeconds(const struct timeval &tv) noexcept
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void
+LoadGenerator::PrintResult() noexcept
+{
+	std::sort(latencies.begin(), latencies.end());
+
+	const double seconds = std::chrono::duration<double>(duration).count();
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("scheduled=%llu\n", (unsigned long long)n_scheduled);
+	printf("completed=%zu\n", latencies.size());
+	printf("errors=%llu\n", (unsigned long long)n_errors);
+	printf("status_errors=%llu\n", (unsigned long long)n_status_errors);
+	printf("unsent=%zu\n", queue.size());
+	printf("connect_errors=%u\n", n_connect_errors);
+	printf("requests_per_second=%.1f\n", latencies.size() / seconds);
+	printf("latency_p50_ms=%.3f\n", Percentile(latencies, 0.5));
+	printf("latency_p90_ms=%.3f\n", Percentile(latencies, 0.9));
+	printf("latency_p99_ms=%.3f\n", Percentile(latencies, 0.99));
+	printf("latency_p999_ms=%.3f\n", Percentile(latencies, 0.999));
+	printf("latency_max_ms=%.3f\n", Percentile(latencies, 1));
+	printf("client_cpu_seconds=%.3f\n",
+	       ToSeconds(ru.ru_utime) + ToSeconds(ru.ru_stime));
+}
+
+/*
+ * main
+ *
+ */
+
+int
+main(int argc, char **argv)
+try {
+	if (argc < 4 || argc > 5) {
+		fprintf(stderr, "Usage: %s URL RATE SECONDS [CONNECTIONS]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	LoadGenerator generator;
+	generator.url = ParseLoadUrl(argv[1]);
+	generator.rate = strtod(argv[2], nullptr);
+	generator.duration = std::chrono::duration_cast<Event::Duration>
+		(std::chrono::duration<double>(strtod(argv[3], nullptr)));
+
+	if (generator.rate <= 0 || generator.duration <= Event::Duration{})
+		throw std::runtime_error("Bad RATE or SECONDS");
+
+	unsigned n_connections = 64;
+#ifdef HAVE_NGHTTP2
+	if (generator.url.protocol == LoadUrl::Protocol::HTTP2)
+		n_connections = 4;
+#endif
+
+	if (argc >= 5)
+		n_connections = strtoul(argv[4], nullptr, 10);
+
+	if (n_connections == 0)
+		throw std::runtime_error("Bad CONNECTIONS");
+
+	SetupProcess();
+
+	static constexpr auto hints = MakeAddrInfo(AI_ADDRCONFIG, AF_UNSPEC,
+						   SOCK_STREAM);
+
+	const auto ail = Resolve(generator.url.host.c_str(),
+				 generator.url.default_port,
+				 &hints);
+	generator.address = ail.front();
+
+	generator.Start(n_connections);
+	generator.event_loop.Run();
+
+	generator.PrintResult();
+
+	generator.connections.clear();
+	generator.pool.reset();
+	pool_commit();
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * A trivial HTTP server for the HTTP load benchmark.  It accepts
+ * connections on the listener socket passed as stdin and answers
+ * each request with a fixed-size body.
+ *
+ * Usage: BenchHttpServer [BODY_SIZE]
+ */
+
+#include "../test/TestInstance.hxx"
+#include "http/IncomingRequest.hxx"
+#include "http/Status.hxx"
+#include "http/server/Handler.hxx"
+#include "http/server/Public.hxx"
+#include "istream/HeadIstream.hxx"
+#include "istream/ZeroIstream.hxx"
+#include "istream/sink_null.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "pool/pool.hxx"
+#include "pool/Holder.hxx"
+#include "pool/UniquePtr.hxx"
+#include "memory/SlicePool.hxx"
+#include "event/ShutdownListener.hxx"
+#include "event/net/TemplateServerSocket.hxx"
+#include "fs/FilteredSocket.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "util/PrintException.hxx"
+
+#include <memory>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Instance;
+
+class Connection final
+	: public AutoUnlinkIntrusiveListHook,
+	  PoolHolder,
+	  HttpServerConnectionHandler, HttpServerRequestHandler
+{
+	Instance &instance;
+
+	HttpServerConnection *connection;
+
+public:
+	Connection(Instance &instance,
+		   UniqueSocketDescriptor &&_fd,
+		   SocketAddress address) noexcept;
+
+	~Connection() noexcept {
+		if (connection != nullptr)
+			http_server_connection_close(connection);
+	}
+
+private:
+	/* virtual methods from class HttpServerRequestHandler */
+	void HandleHttpRequest(IncomingHttpRequest &request,
+			       const StopwatchPtr &parent_stopwatch,
+			       CancellablePointer &cancel_ptr) noexcept override;
+
+	/* virtual methods from class HttpServerConnectionHandler */
+	void HttpConnectionError(std::exception_ptr e) noexcept override;
+	void HttpConnectionClosed() noexcept override;
+};
+
+using Listener = TemplateServerSocket<Connection, Instance &>;
+
+struct Instance final : TestInstance {
+	SlicePool request_slice_pool{8192, 256, "Requests"};
+
+	ShutdownListener shutdown_listener;
+
+	std::unique_ptr<Listener> listener;
+
+	std::size_t body_size = 1024;
+
+	Instance()
+		:shutdown_listener(event_loop, BIND_THIS_METHOD(ShutdownCallback)) {}
+
+	void OnConnectionClosed() noexcept;
+
+private:
+	void ShutdownCallback() noexcept;
+};
+
+Connection::Connection(Instance &_instance,
+		       UniqueSocketDescriptor &&fd,
+		       SocketAddress address) noexcept
+	:PoolHolder(pool_new_linear(_instance.root_pool, "connection", 2048)),
+	 instance(_instance),
+	 connection(http_server_connection_new(pool,
+					       UniquePoolPtr<FilteredSocket>::Make(pool,
+										   _instance.event_loop,
+										   std::move(fd),
+										   FdType::FD_SOCKET),
+					       nullptr,
+					       address,
+					       true,
+					       _instance.request_slice_pool,
+					       *this, *this))
+{
+}
+
+void
+Connection::HandleHttpRequest(IncomingHttpRequest &request,
+			      const StopwatchPtr &,
+			      CancellablePointer &) noexcept
+{
+	if (request.body)
+		sink_null_new(request.pool, std::move(request.body));
+
+	request.SendResponse(HttpStatus::OK, {},
+			     istream_head_new(request.pool,
+					      istream_zero_new(request.pool),
+					      instance.body_size, true));
+}
+
+void
+Connection::HttpConnectionError(std::exception_ptr e) noexcept
+{
+	connection = nullptr;
+
+	PrintException(e);
+
+	instance.OnConnectionClosed();
+	delete this;
+}
+
+void
+Connection::HttpConnectionClosed() noexcept
+{
+	connection = nullptr;
+
+	instance.OnConnectionClosed();
+	delete this;
+}
+
+void
+Instance::ShutdownCallback() noexcept
+{
+	listener.reset();
+}
+
+void
+Instance::OnConnectionClosed() noexcept
+{
+	if (!listener)
+		shutdown_listener.Disable();
+}
+
+int
+main(int argc, char **argv)
+try {
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [BODY_SIZE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	Instance instance;
+	if (argc >= 2)
+		instance.body_size = strtoul(argv[1], nullptr, 10);
+
+	instance.shutdown_listener.Enable();
+
+	instance.listener = std::make_unique<Listener>(instance.event_loop,
+						       instance);
+	instance.listener->Listen(UniqueSocketDescriptor{STDIN_FILENO});
+
+	instance.event_loop.Run();
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
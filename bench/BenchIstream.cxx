@@ -0,0 +1,676 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Microbenchmark for the most important istream filters.  Each
+ * benchmark case builds a pipeline on top of an in-memory payload
+ * (synthetic or loaded from a file) and drains it with a sink which
+ * prefers the bucket API and falls back to Istream::Read().
+ *
+ * Usage: BenchIstream [CASE] [PAYLOAD_FILE]
+ */
+
+#include "../test/TestInstance.hxx"
+#include "bp/XmlProcessor.hxx"
+#include "widget/Context.hxx"
+#include "widget/Inline.hxx"
+#include "widget/Widget.hxx"
+#include "widget/Ptr.hxx"
+#include "widget/RewriteUri.hxx"
+#include "http/rl/FailingResourceLoader.hxx"
+#include "istream/Bucket.hxx"
+#include "istream/Sink.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/ChunkedIstream.hxx"
+#include "istream/ConcatIstream.hxx"
+#include "istream/DechunkIstream.hxx"
+#include "istream/GzipIstream.hxx"
+#include "istream/SubstIstream.hxx"
+#include "istream/TeeIstream.hxx"
+#include "istream/istream_iconv.hxx"
+#include "istream/istream_memory.hxx"
+#include "istream/istream_string.hxx"
+#include "pool/pool.hxx"
+#include "pool/SharedPtr.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/Loop.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "util/BindMethod.hxx"
+#include "util/PrintException.hxx"
+#include "util/SpanCast.hxx"
+#include "stopwatch.hxx"
+
+#ifdef HAVE_BROTLI
+#include "istream/BrotliEncoderIstream.hxx"
+#include "thread/Pool.hxx"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <forward_list>
+#include <new>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using std::string_view_literals::operator""sv;
+
+/*
+ * heap allocation counter
+ *
+ */
+
+static std::size_t n_heap_allocations;
+
+void *
+operator new(std::size_t size)
+{
+	++n_heap_allocations;
+
+	void *p = malloc(size);
+	if (p == nullptr)
+		throw std::bad_alloc{};
+
+	return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void
+operator delete(void *p, std::size_t) noexcept
+{
+	free(p);
+}
+
+/*
+ * emulate missing libraries
+ *
+ */
+
+UnusedIstreamPtr
+embed_inline_widget(struct pool &pool,
+		    SharedPoolPtr<WidgetContext>,
+		    const StopwatchPtr &,
+		    [[maybe_unused]] bool plain_text,
+		    Widget &widget) noexcept
+{
+	const char *s = widget.GetIdPath();
+	if (s == nullptr)
+		s = "widget";
+
+	return istream_string_new(pool, s);
+}
+
+RewriteUriMode
+parse_uri_mode(std::string_view) noexcept
+{
+	return RewriteUriMode::DIRECT;
+}
+
+UnusedIstreamPtr
+rewrite_widget_uri([[maybe_unused]] struct pool &pool,
+		   SharedPoolPtr<WidgetContext>, const StopwatchPtr &,
+		   [[maybe_unused]] Widget &widget,
+		   std::string_view,
+		   [[maybe_unused]] RewriteUriMode mode,
+		   [[maybe_unused]] bool stateful,
+		   [[maybe_unused]] const char *view,
+		   [[maybe_unused]] const struct escape_class *escape) noexcept
+{
+	return nullptr;
+}
+
+/*
+ * payloads
+ *
+ */
+
+/**
+ * Generate a HTML-like document with links, entities, non-ASCII
+ * (but Latin-1 compatible) text and the occasional widget.
+ */
+static std::string
+MakeHtmlPayload(std::size_t size)
+{
+	std::string s;
+	s.reserve(size + 512);
+	s += "<html><head><title>bench</title></head><body>\n";
+
+	for (unsigned i = 0; s.size() < size; ++i) {
+		char line[512];
+		snprintf(line, sizeof(line),
+			 "<div class=\"item\" id=\"i%u\">"
+			 "<a href=\"/page?id=%u\">foo &amp; bar</a>"
+			 "<p>Lorem ipsum dolor sit amet, \xc3\xa4\xc3\xb6\xc3\xbc "
+			 "consectetur adipiscing elit.</p></div>\n",
+			 i, i);
+		s += line;
+
+		if (i % 64 == 0)
+			s += "<c:widget id=\"w\" type=\"bench\"/>\n";
+	}
+
+	s += "</body></html>\n";
+	return s;
+}
+
+/**
+ * Apply HTTP/1.1 chunked transfer encoding to the given payload.
+ */
+static std::string
+MakeChunked(std::string_view src, std::size_t chunk_size)
+{
+	std::string s;
+	s.reserve(src.size() + src.size() / chunk_size * 16 + 16);
+
+	while (!src.empty()) {
+		const std::size_t n = std::min(src.size(), chunk_size);
+
+		char header[32];
+		snprintf(header, sizeof(header), "%zx\r\n", n);
+		s += header;
+		s += src.substr(0, n);
+		s += "\r\n";
+
+		src.remove_prefix(n);
+	}
+
+	s += "0\r\n\r\n";
+	return s;
+}
+
+static std::string
+LoadFile(const char *path)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(path))
+		throw FmtErrno("Failed to open {}", path);
+
+	std::string s;
+	char buffer[65536];
+	ssize_t nbytes;
+	while ((nbytes = fd.Read(std::as_writable_bytes(std::span{buffer}))) > 0)
+		s.append(buffer, nbytes);
+
+	if (nbytes < 0)
+		throw FmtErrno("Failed to read {}", path);
+
+	return s;
+}
+
+/*
+ * the sink
+ *
+ */
+
+class BenchRun;
+
+/**
+ * Drains an #Istream, preferring the bucket API.  Counts how many
+ * bytes were obtained through buckets and how many through
+ * IstreamHandler::OnData().
+ */
+class BenchSink final : IstreamSink {
+	BenchRun &run;
+
+	DeferEvent defer_read;
+
+public:
+	std::size_t bucket_bytes = 0, data_bytes = 0;
+
+	BenchSink(EventLoop &event_loop, BenchRun &_run,
+		  UnusedIstreamPtr &&_input) noexcept
+		:IstreamSink(std::move(_input)),
+		 run(_run),
+		 defer_read(event_loop, BIND_THIS_METHOD(OnDeferredRead)) {}
+
+	void Start() noexcept {
+		defer_read.Schedule();
+	}
+
+private:
+	std::size_t GetTotal() const noexcept {
+		return bucket_bytes + data_bytes;
+	}
+
+	void Finish() noexcept;
+	void Fail(std::exception_ptr error) noexcept;
+
+	/**
+	 * @return false if the caller shall fall back to
+	 * Istream::Read()
+	 */
+	bool ReadBuckets() noexcept;
+
+	void OnDeferredRead() noexcept;
+
+	/* virtual methods from class IstreamHandler */
+	IstreamReadyResult OnIstreamReady() noexcept override {
+		defer_read.Schedule();
+		return IstreamReadyResult::OK;
+	}
+
+	std::size_t OnData(std::span<const std::byte> src) noexcept override {
+		data_bytes += src.size();
+		defer_read.Schedule();
+		return src.size();
+	}
+
+	void OnEof() noexcept override {
+		ClearInput();
+		Finish();
+	}
+
+	void OnError(std::exception_ptr error) noexcept override {
+		ClearInput();
+		Fail(std::move(error));
+	}
+};
+
+/**
+ * One run of one benchmark case: owns all sinks and breaks the
+ * #EventLoop after all of them have finished.
+ */
+class BenchRun {
+	EventLoop &event_loop;
+
+	std::forward_list<BenchSink> sinks;
+
+	unsigned n_active = 0;
+
+public:
+	std::exception_ptr error;
+
+	explicit BenchRun(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	EventLoop &GetEventLoop() const noexcept {
+		return event_loop;
+	}
+
+	void AddSink(UnusedIstreamPtr input) noexcept {
+		sinks.emplace_front(event_loop, *this, std::move(input));
+		++n_active;
+	}
+
+	void Run() noexcept {
+		for (auto &i : sinks)
+			i.Start();
+
+		if (n_active > 0)
+			event_loop.Run();
+	}
+
+	std::size_t GetBucketBytes() const noexcept {
+		std::size_t result = 0;
+		for (const auto &i : sinks)
+			result += i.bucket_bytes;
+		return result;
+	}
+
+	std::size_t GetDataBytes() const noexcept {
+		std::size_t result = 0;
+		for (const auto &i : sinks)
+			result += i.data_bytes;
+		return result;
+	}
+
+	void OnSinkDone() noexcept {
+		if (--n_active == 0)
+			event_loop.Break();
+	}
+};
+
+inline void
+BenchSink::Finish() noexcept
+{
+	defer_read.Cancel();
+	run.OnSinkDone();
+}
+
+inline void
+BenchSink::Fail(std::exception_ptr _error) noexcept
+{
+	if (!run.error)
+		run.error = std::move(_error);
+
+	Finish();
+}
+
+bool
+BenchSink::ReadBuckets() noexcept
+{
+	IstreamBucketList list;
+
+	try {
+		input.FillBucketList(list);
+	} catch (...) {
+		ClearInput();
+		Fail(std::current_exception());
+		return true;
+	}
+
+	std::size_t nbytes = 0;
+	bool more = list.HasMore();
+
+	for (const auto &bucket : list) {
+		if (!bucket.IsBuffer()) {
+			more = true;
+			break;
+		}
+
+		nbytes += bucket.GetBuffer().size();
+	}
+
+	if (nbytes == 0) {
+		if (!more) {
+			CloseInput();
+			Finish();
+			return true;
+		}
+
+		return !list.ShouldFallback();
+	}
+
+	const auto result = input.ConsumeBucketList(nbytes);
+	bucket_bytes += result.consumed;
+
+	if (result.eof) {
+		CloseInput();
+		Finish();
+	}
+
+	return true;
+}
+
+void
+BenchSink::OnDeferredRead() noexcept
+{
+	const std::size_t before = GetTotal();
+
+	if (!ReadBuckets() && HasInput())
+		input.Read();
+
+	/* keep going as long as there is progress; if there is none,
+	   wait for the istream to invoke OnIstreamReady() or
+	   OnData() */
+	if (HasInput() && GetTotal() > before)
+		defer_read.Schedule();
+}
+
+/*
+ * benchmark cases
+ *
+ */
+
+struct BenchPayloads {
+	std::string plain, chunked;
+};
+
+struct BenchCase {
+	const char *name;
+
+	/**
+	 * Use the chunked payload as input?
+	 */
+	bool chunked_input;
+
+	/**
+	 * Build the pipeline on top of the given input and register
+	 * all outputs with BenchRun::AddSink().
+	 */
+	void (*setup)(BenchRun &run, struct pool &pool, UnusedIstreamPtr input);
+};
+
+static void
+SetupIdentity(BenchRun &run, struct pool &, UnusedIstreamPtr input)
+{
+	run.AddSink(std::move(input));
+}
+
+static void
+SetupChunked(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	run.AddSink(istream_chunked_new(pool, std::move(input)));
+}
+
+struct BenchDechunkHandler final : DechunkHandler {
+	void OnDechunkEndSeen() noexcept override {}
+
+	DechunkInputAction OnDechunkEnd() noexcept override {
+		return DechunkInputAction::CLOSE;
+	}
+};
+
+static BenchDechunkHandler bench_dechunk_handler;
+
+static void
+SetupDechunk(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	run.AddSink(istream_dechunk_new(pool, std::move(input),
+					run.GetEventLoop(),
+					bench_dechunk_handler));
+}
+
+static void
+SetupSubst(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	SubstTree tree;
+	tree.Add(pool, "foo", "FOO"sv);
+	tree.Add(pool, "Lorem", "Ipsum"sv);
+	tree.Add(pool, "&amp;", "&"sv);
+	tree.Add(pool, "class=", "klass="sv);
+
+	run.AddSink(istream_subst_new(&pool, std::move(input),
+				      std::move(tree)));
+}
+
+static FailingResourceLoader bench_resource_loader;
+
+static void
+SetupProcessor(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	auto ctx = SharedPoolPtr<WidgetContext>::Make
+		(pool, run.GetEventLoop(),
+		 bench_resource_loader, bench_resource_loader,
+		 nullptr,
+		 nullptr, nullptr,
+		 "localhost:8080",
+		 "localhost:8080",
+		 "/beng.html",
+		 "http://localhost:8080/beng.html",
+		 "/beng.html"sv,
+		 nullptr,
+		 nullptr, nullptr, SessionId{}, nullptr,
+		 nullptr);
+	auto &widget = ctx->AddRootWidget(MakeRootWidget(pool, nullptr));
+
+	run.AddSink(processor_process(pool, nullptr, std::move(input),
+				      widget, std::move(ctx),
+				      PROCESSOR_CONTAINER,
+				      nullptr, nullptr));
+}
+
+static void
+SetupGzip(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	run.AddSink(NewGzipIstream(pool, std::move(input)));
+}
+
+#ifdef HAVE_BROTLI
+
+static bool bench_thread_pool_used;
+
+static void
+SetupBrotli(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	bench_thread_pool_used = true;
+	thread_pool_set_volatile();
+
+	run.AddSink(NewBrotliEncoderIstream(pool,
+					    thread_pool_get_queue(run.GetEventLoop()),
+					    std::move(input)));
+}
+
+#endif
+
+static void
+SetupIconv(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	run.AddSink(istream_iconv_new(pool, std::move(input),
+				      "ISO-8859-1", "UTF-8"));
+}
+
+static void
+SetupTee(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	auto tee = NewTeeIstream(pool, std::move(input), run.GetEventLoop(),
+				 false);
+	auto second = AddTeeIstream(tee, false);
+
+	run.AddSink(std::move(tee));
+	run.AddSink(std::move(second));
+}
+
+static void
+SetupConcat(BenchRun &run, struct pool &pool, UnusedIstreamPtr input)
+{
+	/* a short header and footer around the payload, similar to
+	   what the widget framework produces */
+	run.AddSink(NewConcatIstream(pool,
+				     istream_string_new(pool, "<!-- header -->\n"),
+				     std::move(input),
+				     istream_string_new(pool, "<!-- footer -->\n")));
+}
+
+static constexpr BenchCase bench_cases[] = {
+	{ "identity", false, SetupIdentity },
+	{ "chunked", false, SetupChunked },
+	{ "dechunk", true, SetupDechunk },
+	{ "subst", false, SetupSubst },
+	{ "processor", false, SetupProcessor },
+	{ "gzip", false, SetupGzip },
+#ifdef HAVE_BROTLI
+	{ "brotli", false, SetupBrotli },
+#endif
+	{ "iconv", false, SetupIconv },
+	{ "tee", false, SetupTee },
+	{ "concat", false, SetupConcat },
+};
+
+/*
+ * main
+ *
+ */
+
+static constexpr std::size_t MEGA = 1024 * 1024;
+
+/**
+ * Run each case at least this long to get stable numbers.
+ */
+static constexpr std::chrono::steady_clock::duration MIN_DURATION =
+	std::chrono::milliseconds{500};
+
+static void
+RunBenchCase(TestInstance &instance, const BenchCase &c,
+	     const BenchPayloads &payloads)
+{
+	const std::string &payload = c.chunked_input
+		? payloads.chunked
+		: payloads.plain;
+
+	std::chrono::steady_clock::duration duration{};
+	std::size_t n_iterations = 0, heap_allocations = 0, pool_bytes = 0;
+	std::size_t bucket_bytes = 0, data_bytes = 0;
+
+	do {
+		auto pool = pool_new_linear(instance.root_pool, "bench", 65536);
+
+		{
+			BenchRun run{instance.event_loop};
+
+			const std::size_t allocations_before = n_heap_allocations;
+			const auto start_time = std::chrono::steady_clock::now();
+
+			c.setup(run, pool,
+				istream_memory_new(pool, AsBytes(payload)));
+			run.Run();
+
+			duration += std::chrono::steady_clock::now() - start_time;
+			heap_allocations += n_heap_allocations - allocations_before;
+
+			if (run.error)
+				std::rethrow_exception(run.error);
+
+			bucket_bytes += run.GetBucketBytes();
+			data_bytes += run.GetDataBytes();
+		}
+
+		pool_bytes += pool_brutto_size(pool);
+		++n_iterations;
+	} while (duration < MIN_DURATION);
+
+	const double seconds = std::chrono::duration<double>(duration).count();
+	const double input_mib = double(payload.size() * n_iterations) / MEGA;
+	const std::size_t output_bytes = bucket_bytes + data_bytes;
+
+	printf("%-10s %8.1f MiB/s %10.1f allocs/MiB %8.1f pool_KiB/MiB"
+	       " %6.1f%% bucket %6.1f%% read\n",
+	       c.name,
+	       input_mib / seconds,
+	       heap_allocations / input_mib,
+	       pool_bytes / 1024. / input_mib,
+	       output_bytes > 0 ? 100. * bucket_bytes / output_bytes : 0.,
+	       output_bytes > 0 ? 100. * data_bytes / output_bytes : 0.);
+}
+
+int
+main(int argc, char **argv)
+try {
+	if (argc > 3) {
+		fprintf(stderr, "Usage: %s [CASE] [PAYLOAD_FILE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *filter = argc >= 2 && strcmp(argv[1], "all") != 0
+		? argv[1]
+		: nullptr;
+
+	BenchPayloads payloads;
+	payloads.plain = argc >= 3
+		? LoadFile(argv[2])
+		: MakeHtmlPayload(4 * MEGA);
+	payloads.chunked = MakeChunked(payloads.plain, 8192);
+
+	TestInstance instance;
+
+	printf("payload: %zu bytes\n", payloads.plain.size());
+
+	for (const auto &c : bench_cases)
+		if (filter == nullptr || strcmp(filter, c.name) == 0)
+			RunBenchCase(instance, c, payloads);
+
+#ifdef HAVE_BROTLI
+	if (bench_thread_pool_used) {
+		/* invoke all pending ThreadJob::Done() calls */
+		instance.event_loop.Run();
+
+		thread_pool_stop();
+		thread_pool_join();
+		thread_pool_deinit();
+	}
+#endif
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
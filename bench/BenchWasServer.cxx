@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * A trivial WAS application for the HTTP load benchmark.  It is
+ * spawned by beng-proxy and answers each request with a fixed-size
+ * body.
+ *
+ * Usage: BenchWasServer [BODY_SIZE]
+ */
+
+#include "../test/TestInstance.hxx"
+#include "was/Server.hxx"
+#include "istream/HeadIstream.hxx"
+#include "istream/ZeroIstream.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "pool/pool.hxx"
+#include "http/Status.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "util/PrintException.hxx"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Instance final : TestInstance, WasServerHandler {
+	WasServer *server;
+
+	std::size_t body_size = 1024;
+
+	void OnWasRequest(struct pool &pool,
+			  [[maybe_unused]] HttpMethod method,
+			  [[maybe_unused]] const char *uri,
+			  [[maybe_unused]] StringMap &&headers,
+			  UnusedIstreamPtr body) noexcept override {
+		/* discard the request body */
+		body.Clear();
+
+		server->SendResponse(HttpStatus::OK, {},
+				     istream_head_new(pool,
+						      istream_zero_new(pool),
+						      body_size, true));
+	}
+
+	void OnWasClosed() noexcept override {}
+};
+
+int
+main(int argc, char **argv)
+try {
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [BODY_SIZE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	WasSocket socket{
+		UniqueSocketDescriptor(3),
+		UniqueFileDescriptor(STDIN_FILENO),
+		UniqueFileDescriptor(STDOUT_FILENO),
+	};
+
+	Instance instance;
+	if (argc >= 2)
+		instance.body_size = strtoul(argv[1], nullptr, 10);
+
+	instance.server = NewFromPool<WasServer>(instance.root_pool,
+						 instance.root_pool,
+						 instance.event_loop,
+						 std::move(socket),
+						 instance);
+
+	instance.event_loop.Run();
+
+	instance.server->Free();
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+#
+# Loopback HTTP load benchmark for beng-proxy and beng-lb.
+#
+# Starts a beng-proxy or beng-lb instance with a generated
+# configuration against a local stub backend, drives it with the
+# open-loop load generator "BenchHttpLoad" and reports requests per
+# second, latency percentiles, server CPU time per request and the
+# server's resident memory.
+#
+# Example (from the build directory):
+#
+#   ninja bench/BenchHttpLoad bench/BenchHttpServer \
+#       bench/BenchFcgiServer bench/BenchWasServer
+#   ../bench/http_load.py --server bp --backend http --protocol https2 \
+#       --rate 5000 --duration 30
+#
+# Backends:
+#   file     a static file served by beng-proxy
+#   http     "BenchHttpServer"
+#   fastcgi  "BenchFcgiServer", spawned by beng-proxy
+#   was      "BenchWasServer", spawned by beng-proxy
+#
+# beng-lb supports only the "http" backend.  The "fastcgi" and "was"
+# backends require beng-proxy's spawner to be operational, i.e. the
+# benchmark usually needs to run as root.
+#
+# Author: Max Kellermann <mk@cm4all.com>
+#
+
+import argparse
+import asyncio
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                '..', 'python'))
+
+from beng_proxy.translation import *
+
+CLK_TCK = os.sysconf('SC_CLK_TCK')
+
+def reserve_port():
+    """Find a free TCP port on the loopback interface."""
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.bind(('127.0.0.1', 0))
+        return s.getsockname()[1]
+
+def listen_socket():
+    """Create a listener socket which will be passed to a stub
+    server as stdin."""
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind(('127.0.0.1', 0))
+    s.listen(256)
+    return s
+
+def wait_port(port, process, timeout=10):
+    """Wait until the server accepts connections on the given
+    port."""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if process.poll() is not None:
+            raise RuntimeError('Server has exited with status %d' % process.returncode)
+        try:
+            with socket.create_connection(('127.0.0.1', port), timeout=1):
+                return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError('Server did not start listening on port %d' % port)
+
+def make_certificate(directory):
+    cert = os.path.join(directory, 'cert.pem')
+    key = os.path.join(directory, 'key.pem')
+    subprocess.check_call(['openssl', 'req', '-x509', '-newkey', 'rsa:2048',
+                           '-nodes', '-days', '1', '-subj', '/CN=localhost',
+                           '-keyout', key, '-out', cert],
+                          stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+class TranslationServer:
+    """A minimal translation server which answers every request with
+    the same (cacheable) response."""
+
+    def __init__(self, address, response):
+        self.__address = address
+        self.__response = response
+        self.__loop = asyncio.new_event_loop()
+        self.__thread = threading.Thread(target=self.__run, daemon=True)
+        self.__ready = threading.Event()
+
+    def start(self):
+        self.__thread.start()
+        self.__ready.wait()
+
+    def __run(self):
+        asyncio.set_event_loop(self.__loop)
+        server = self.__loop.run_until_complete(
+            asyncio.start_unix_server(self.__handle, path=self.__address))
+        self.__ready.set()
+        self.__loop.run_forever()
+
+    async def __handle(self, reader, writer):
+        data = b''
+        try:
+            while True:
+                request = Request()
+                packet = PacketReader()
+                while True:
+                    if not data:
+                        data = await reader.read(8192)
+                        if not data:
+                            return
+                    data = packet.consume(data)
+                    if packet.complete:
+                        if request.packetReceived(packet):
+                            break
+                        packet = PacketReader()
+
+                writer.write(self.__response)
+                await writer.drain()
+        finally:
+            writer.close()
+
+def make_translation_response(backend, directory, build_dir, http_port,
+                              body_size):
+    response = Response(protocol_version=2)
+    response.max_age(3600)
+
+    if backend == 'file':
+        path = os.path.join(directory, 'body.html')
+        with open(path, 'wb') as f:
+            f.write(b'x' * body_size)
+        response.path(path)
+        response.content_type('text/html')
+    elif backend == 'http':
+        response.http('http://127.0.0.1:%d/' % http_port,
+                      addresses=['127.0.0.1:%d' % http_port])
+    elif backend == 'fastcgi':
+        response.packet(TRANSLATE_FASTCGI,
+                        os.path.join(build_dir, 'bench', 'BenchFcgiServer'))
+        response.packet(TRANSLATE_APPEND, str(body_size))
+    elif backend == 'was':
+        response.packet(TRANSLATE_WAS,
+                        os.path.join(build_dir, 'bench', 'BenchWasServer'))
+        response.packet(TRANSLATE_APPEND, str(body_size))
+    else:
+        raise ValueError('Unknown backend: ' + backend)
+
+    return response.finish()
+
+def process_tree(pid):
+    """Return the given process id and the ids of all its
+    descendants."""
+    children = {}
+    for entry in os.listdir('/proc'):
+        if not entry.isdigit():
+            continue
+        try:
+            stat = read_stat(int(entry))
+        except OSError:
+            continue
+        children.setdefault(int(stat[1]), []).append(int(entry))
+
+    result = []
+    pending = [pid]
+    while pending:
+        p = pending.pop()
+        result.append(p)
+        pending.extend(children.get(p, []))
+    return result
+
+def read_stat(pid):
+    """Read /proc/PID/stat and return the fields after the command
+    name (starting with "state")."""
+    with open('/proc/%d/stat' % pid) as f:
+        data = f.read()
+    return data[data.rindex(')') + 2:].split()
+
+def cpu_seconds(pids):
+    total = 0
+    for pid in pids:
+        try:
+            stat = read_stat(pid)
+        except OSError:
+            continue
+        total += int(stat[11]) + int(stat[12])
+    return total / CLK_TCK
+
+def rss_kib(pids):
+    total = 0
+    for pid in pids:
+        try:
+            with open('/proc/%d/status' % pid) as f:
+                for line in f:
+                    if line.startswith('VmRSS:'):
+                        total += int(line.split()[1])
+        except OSError:
+            continue
+    return total
+
+def main():
+    parser = argparse.ArgumentParser(description='Loopback HTTP load benchmark')
+    parser.add_argument('--build-dir', default='.',
+                        help='the meson build directory')
+    parser.add_argument('--server', choices=('bp', 'lb'), default='bp')
+    parser.add_argument('--backend', choices=('file', 'http', 'fastcgi', 'was'),
+                        default='http')
+    parser.add_argument('--protocol', choices=('http', 'https', 'http2', 'https2'),
+                        default='http')
+    parser.add_argument('--rate', type=float, default=1000,
+                        help='requests per second')
+    parser.add_argument('--duration', type=float, default=10,
+                        help='seconds')
+    parser.add_argument('--connections', type=int,
+                        help='number of client connections')
+    parser.add_argument('--body-size', type=int, default=1024,
+                        help='response body size in bytes')
+    args = parser.parse_args()
+
+    if args.body_size < 0:
+        parser.error('--body-size must not be negative')
+
+    if args.server == 'lb' and args.backend != 'http':
+        parser.error('beng-lb supports only the "http" backend')
+
+    build_dir = os.path.abspath(args.build_dir)
+    processes = []
+
+    with tempfile.TemporaryDirectory(prefix='beng-bench-') as directory:
+        try:
+            http_port = None
+            if args.backend == 'http':
+                s = listen_socket()
+                http_port = s.getsockname()[1]
+                processes.append(subprocess.Popen([os.path.join(build_dir, 'bench', 'BenchHttpServer'),
+                                                   str(args.body_size)],
+                                                  stdin=s))
+                s.close()
+
+            port = reserve_port()
+            listener = ['listener {',
+                        '  bind "127.0.0.1:%d"' % port]
+            if args.protocol.startswith('https'):
+                cert, key = make_certificate(directory)
+                listener += ['  ssl "yes"',
+                             '  ssl_cert "%s" "%s"' % (cert, key)]
+
+            if args.server == 'bp':
+                translation_socket = '@beng-bench-%d' % os.getpid()
+                TranslationServer('\0' + translation_socket[1:],
+                                  make_translation_response(args.backend, directory,
+                                                            build_dir, http_port,
+                                                            args.body_size)).start()
+
+                config = ['translation_socket "%s"' % translation_socket] + \
+                    listener + ['}']
+                program = 'cm4all-beng-proxy'
+            else:
+                config = ['pool "backend" {',
+                          '  member "127.0.0.1:%d"' % http_port,
+                          '}'] + \
+                    listener + ['  pool "backend"', '}']
+                program = 'cm4all-beng-lb'
+
+            config_path = os.path.join(directory, 'server.conf')
+            with open(config_path, 'w') as f:
+                f.write('\n'.join(config) + '\n')
+
+            server = subprocess.Popen([os.path.join(build_dir, program),
+                                       '--config-file', config_path])
+            processes.append(server)
+            wait_port(port, server)
+
+            url = '%s://127.0.0.1:%d/bench' % (args.protocol, port)
+            command = [os.path.join(build_dir, 'bench', 'BenchHttpLoad'), url,
+                       str(args.rate), str(args.duration)]
+            if args.connections is not None:
+                command.append(str(args.connections))
+
+            pids = process_tree(server.pid)
+            cpu_before = cpu_seconds(pids)
+
+            output = subprocess.check_output(command, text=True)
+
+            pids = process_tree(server.pid)
+            cpu = cpu_seconds(pids) - cpu_before
+            rss = rss_kib(pids)
+        finally:
+            for p in reversed(processes):
+                p.terminate()
+            for p in processes:
+                p.wait()
+
+    result = dict(line.split('=', 1) for line in output.splitlines() if '=' in line)
+    completed = int(result['completed'])
+
+    print('server:            %s (%s backend, %s)' % (args.server, args.backend, args.protocol))
+    print('requests/s:        %s' % result['requests_per_second'])
+    print('completed:         %d (errors %s, error status %s, unsent %s)' %
+          (completed, result['errors'], result['status_errors'], result['unsent']))
+    print('latency ms:        p50 %s  p90 %s  p99 %s  p99.9 %s  max %s' %
+          (result['latency_p50_ms'], result['latency_p90_ms'],
+           result['latency_p99_ms'], result['latency_p999_ms'],
+           result['latency_max_ms']))
+    if completed > 0:
+        print('server CPU/req:    %.1f us' % (cpu * 1e6 / completed))
+    print('server RSS:        %d KiB' % rss)
+    print('client CPU:        %s s' % result['client_cpu_seconds'])
+
+if __name__ == '__main__':
+    main()
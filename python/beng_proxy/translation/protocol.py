@@ -272,6 +272,15 @@ TRANSLATE_ACCEPT_HTTP = 265
 TRANSLATE_CAP_SYS_RESOURCE = 266
 TRANSLATE_CHROOT = 267
 
+# multiplexing extension (see "Multiplexing" in the documentation)
+TRANSLATE_MULTIPLEX = 0xf000
+TRANSLATE_REQUEST_ID = 0xf001
+TRANSLATE_CANCEL = 0xf002
+
+# widget fragment cache extension (see "Widget fragment cache" in the
+# documentation)
+TRANSLATE_WIDGET_FRAGMENT_CACHE = 0xf003
+
 TRANSLATE_PROXY = TRANSLATE_HTTP # deprecated
 TRANSLATE_LHTTP_EXPAND_URI = TRANSLATE_EXPAND_LHTTP_URI # deprecated
 
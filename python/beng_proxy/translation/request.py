@@ -33,10 +33,19 @@ class Request:
     when created, and is completed incrementally by calling
     packetReceived() until it returns true.
 
+    If the client multiplexes requests over one connection, each
+    request has a 'request_id', which must be passed to the
+    Response constructor.  A standalone CANCEL packet also completes
+    this object; then only the 'cancel' attribute (the id of the
+    canceled request) is set.
+
     Never ever access the 'args' property."""
 
     def __init__(self):
         self.protocol_version = 0
+        self.request_id = None
+        self.multiplex = False
+        self.cancel = None
         self.host = None
         self.alt_host = None
         self.raw_uri = None
@@ -109,6 +118,15 @@ class Request:
                 self.protocol_version = struct.unpack('B', packet.payload[:1])[0]
         elif packet.command == TRANSLATE_END:
             return True
+        elif packet.command == TRANSLATE_REQUEST_ID:
+            if len(packet.payload) == 4:
+                self.request_id = struct.unpack('I', packet.payload)[0]
+        elif packet.command == TRANSLATE_MULTIPLEX:
+            self.multiplex = True
+        elif packet.command == TRANSLATE_CANCEL:
+            if len(packet.payload) == 4:
+                self.cancel = struct.unpack('I', packet.payload)[0]
+            return True
         elif packet.command == TRANSLATE_HOST:
             self.host = packet.payload.decode('ascii')
         elif packet.command == TRANSLATE_ALT_HOST:
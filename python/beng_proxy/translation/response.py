@@ -15,12 +15,16 @@ class Response:
     """Generator for a translation response.  The BEGIN and END
     packets are generated automatically.  When you are done with the
     response, call finish().  This method returns the full response
-    (all serialized packets) as a string."""
+    (all serialized packets) as a string.
 
-    def __init__(self, protocol_version=0):
+    Pass the 'request_id' of a multiplexed request to the constructor;
+    it will be echoed right after BEGIN."""
+
+    def __init__(self, protocol_version=0, request_id=None):
         assert isinstance(protocol_version, int)
         assert protocol_version >= 0
         assert protocol_version <= 0xff
+        assert request_id is None or (request_id > 0 and request_id <= 0xffffffff)
 
         self._data = b''
 
@@ -29,6 +33,9 @@ class Response:
             payload = struct.pack('B', protocol_version)
         self.packet(TRANSLATE_BEGIN, payload)
 
+        if request_id is not None:
+            self.packet(TRANSLATE_REQUEST_ID, struct.pack('I', request_id))
+
     def finish(self):
         """Finish the response, and return it as a string."""
         self._data += packet_header(TRANSLATE_END)
@@ -46,6 +53,12 @@ class Response:
         self._data += payload
         return self
 
+    def multiplex(self):
+        """Append a MULTIPLEX packet, which answers the client's
+        multiplexing probe (a request with the 'multiplex'
+        attribute)."""
+        return self.packet(TRANSLATE_MULTIPLEX)
+
     def status(self, status):
         """Append a STATUS packet."""
         assert status >= 200 and status < 600
@@ -4,6 +4,7 @@
 
 #include "Config.hxx"
 #include "CommandLine.hxx"
+#include "session/Protocol.hxx"
 #include "pg/Interval.hxx"
 #include "net/Parser.hxx"
 #include "util/StringAPI.hxx"
@@ -24,18 +25,30 @@ BpConfig::HandleSet(std::string_view name, const char *value)
 		lhttp_stock_limit = ParseUnsignedLong(value);
 	} else if (name == "lhttp_stock_max_idle"sv) {
 		lhttp_stock_max_idle = ParseUnsignedLong(value);
+	} else if (name == "lhttp_stock_prespawn"sv) {
+		lhttp_stock_prespawn = ParseUnsignedLong(value);
 	} else if (name == "fastcgi_stock_limit"sv) {
 		fcgi_stock_limit = ParseUnsignedLong(value);
 	} else if (name == "fcgi_stock_max_idle"sv) {
 		fcgi_stock_max_idle = ParseUnsignedLong(value);
+	} else if (name == "fastcgi_stock_prespawn"sv) {
+		fcgi_stock_prespawn = ParseUnsignedLong(value);
+	} else if (name == "fastcgi_multiplex"sv) {
+		fcgi_multiplex = ParseBool(value);
 	} else if (name == "was_stock_limit"sv) {
 		was_stock_limit = ParseUnsignedLong(value);
 	} else if (name == "was_stock_max_idle"sv) {
 		was_stock_max_idle = ParseUnsignedLong(value);
+	} else if (name == "was_shm"sv) {
+		was_shm = ParseBool(value);
 	} else if (name == "multi_was_stock_limit"sv) {
 		multi_was_stock_limit = ParseUnsignedLong(value);
 	} else if (name == "multi_was_stock_max_idle"sv) {
 		multi_was_stock_max_idle = ParseUnsignedLong(value);
+	} else if (name == "multi_was_stock_prespawn"sv) {
+		multi_was_stock_prespawn = ParseUnsignedLong(value);
+	} else if (name == "multi_was_max_concurrency"sv) {
+		multi_was_max_concurrency = ParseUnsignedLong(value);
 	} else if (name == "remote_was_stock_limit"sv) {
 		remote_was_stock_limit = ParseUnsignedLong(value);
 	} else if (name == "remote_was_stock_max_idle"sv) {
@@ -48,12 +61,24 @@ BpConfig::HandleSet(std::string_view name, const char *value)
 		filter_cache_size = ParseSize(value);
 	} else if (name == "encoding_cache_size"sv) {
 		encoding_cache_size = ParseSize(value);
+	} else if (name == "xml_template_cache_size"sv) {
+		xml_template_cache_size = ParseSize(value);
+	} else if (name == "widget_fragment_cache_size"sv) {
+		widget_fragment_cache_size = ParseSize(value);
 	} else if (name == "nfs_cache_size"sv) {
 		/* deprecated */
 	} else if (name == "translate_cache_size"sv) {
 		translate_cache_size = ParseUnsignedLong(value);
 	} else if (name == "translate_stock_limit"sv) {
 		translate_stock_limit = ParseUnsignedLong(value);
+	} else if (name == "translate_multiplex"sv) {
+		translate_multiplex = ParseBool(value);
+	} else if (name == "translate_cache_snapshot_path"sv) {
+		translate_cache_snapshot_path = value;
+	} else if (name == "translate_cache_snapshot_interval"sv) {
+		translate_cache_snapshot_interval = Pg::ParseIntervalS(value);
+		if (translate_cache_snapshot_interval <= std::chrono::seconds::zero())
+			throw std::runtime_error("Invalid value");
 	} else if (name == "stopwatch"sv) {
 		/* deprecated */
 	} else if (name == "dump_widget_tree"sv) {
@@ -79,6 +104,14 @@ BpConfig::HandleSet(std::string_view name, const char *value)
 		session_idle_timeout = Pg::ParseIntervalS(value);
 	} else if (name == "session_save_path"sv) {
 		session_save_path = value;
+	} else if (name == "session_replication_listen"sv) {
+		session_replication_listen.bind_address =
+			ParseSocketAddress(value, DEFAULT_SESSION_REPLICATION_PORT,
+					   true);
+	} else if (name == "session_replication_buddy"sv) {
+		session_replication_buddy =
+			ParseSocketAddress(value, DEFAULT_SESSION_REPLICATION_PORT,
+					   false);
 	} else
 		throw std::runtime_error("Unknown variable");
 }
@@ -8,6 +8,7 @@
 #include "access_log/Config.hxx"
 #include "ssl/Config.hxx"
 #include "http/CookieSameSite.hxx"
+#include "net/AllocatedSocketAddress.hxx"
 #include "net/LocalSocketAddress.hxx"
 #include "net/SocketConfig.hxx"
 #include "spawn/Config.hxx"
@@ -36,6 +37,20 @@ struct BpConfig {
 
 	std::string session_save_path;
 
+	/**
+	 * Accept session replication connections from other cluster
+	 * nodes on this address (see #SessionReplicaServer).
+	 */
+	SocketConfig session_replication_listen{
+		.listen = 16,
+	};
+
+	/**
+	 * Replicate all sessions to the cluster node at this address
+	 * (see #SessionReplicator).
+	 */
+	AllocatedSocketAddress session_replication_buddy;
+
 	struct ControlListener : SocketConfig {
 		ControlListener()
 			:SocketConfig{
@@ -66,17 +81,68 @@ struct BpConfig {
 
 	std::size_t encoding_cache_size = 0;
 
+	std::size_t xml_template_cache_size = 0;
+
+	std::size_t widget_fragment_cache_size = 0;
+
 	unsigned translate_cache_size = 131072;
 	unsigned translate_stock_limit = 32;
 
+	/**
+	 * Ask translation servers whether they support multiplexing
+	 * and if so, send all requests over one connection (see
+	 * #TranslationMultiplexClient).
+	 */
+	bool translate_multiplex = false;
+
+	/**
+	 * Save the translation cache to this file and load it on
+	 * startup (see #TranslationCacheSnapshot).  Empty if
+	 * disabled.
+	 */
+	std::string translate_cache_snapshot_path;
+
+	/**
+	 * How often is the translation cache snapshot saved?
+	 */
+	std::chrono::seconds translate_cache_snapshot_interval = std::chrono::minutes(5);
+
 	unsigned tcp_stock_limit = 0;
 	static constexpr std::size_t tcp_stock_max_idle = 16;
 
 	unsigned lhttp_stock_limit = 0, lhttp_stock_max_idle = 8;
 	unsigned fcgi_stock_limit = 0, fcgi_stock_max_idle = 8;
 
+	/**
+	 * The maximum number of child processes per key kept warm by
+	 * #ChildStockPrespawner; 0 disables it.
+	 */
+	unsigned lhttp_stock_prespawn = 0, fcgi_stock_prespawn = 0;
+	unsigned multi_was_stock_prespawn = 0;
+
+	/**
+	 * Multiplex concurrent requests to FastCGI applications which
+	 * advertise FCGI_MPXS_CONNS over one connection per child
+	 * process (see #FcgiMultiplexConnection).
+	 */
+	bool fcgi_multiplex = false;
+
 	unsigned was_stock_limit = 0, was_stock_max_idle = 16;
+
+	/**
+	 * Offer new WAS child processes transferring bodies through
+	 * shared memory (see #WasShm).
+	 */
+	bool was_shm = false;
+
 	unsigned multi_was_stock_limit = 0, multi_was_stock_max_idle = 16;
+
+	/**
+	 * The upper bound for the adaptive number of concurrent
+	 * requests per Multi-WAS child process; 0 disables adaptive
+	 * concurrency (see #AdaptiveConcurrency).
+	 */
+	unsigned multi_was_max_concurrency = 0;
 	unsigned remote_was_stock_limit = 0, remote_was_stock_max_idle = 16;
 
 	unsigned cluster_size = 0, cluster_node = 0;
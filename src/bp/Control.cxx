@@ -11,11 +11,17 @@
 #include "translation/Builder.hxx"
 #include "translation/Protocol.hxx"
 #include "translation/InvalidateParser.hxx"
+#include "TranslationCacheSnapshot.hxx"
+#include "prometheus/EventLoopStats.hxx"
+#include "stats/EventLoopMonitor.hxx"
 #include "pool/tpool.hxx"
 #include "pool/pool.hxx"
 #include "net/SocketAddress.hxx"
 #include "io/Logger.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/NumberParser.hxx"
 #include "util/SpanCast.hxx"
+#include "util/StringCompare.hxx"
 #include "AllocatorPtr.hxx"
 #include "stopwatch.hxx"
 #include "config.h"
@@ -24,6 +30,8 @@
 #include "lib/avahi/Publisher.hxx"
 #endif
 
+using std::string_view_literals::operator""sv;
+
 static void
 control_tcache_invalidate(BpInstance *instance, std::span<const std::byte> payload)
 {
@@ -54,16 +62,68 @@ control_tcache_invalidate(BpInstance *instance, std::span<const std::byte> paylo
 		->Invalidate(request,
 			     request.commands,
 			     request.site);
+
+	if (instance->translation_cache_snapshot)
+		instance->translation_cache_snapshot->Discard();
+}
+
+/**
+ * Parse the (optional) STOPWATCH_PIPE payload: a space-separated
+ * list of "binary", "sample=N" and "filter=PREFIX".
+ */
+static StopwatchOptions
+ParseStopwatchOptions(std::string_view payload)
+{
+	StopwatchOptions options;
+
+	for (std::string_view i : IterableSplitString(payload, ' ')) {
+		if (i.empty())
+			continue;
+
+		if (i == "binary"sv)
+			options.binary = true;
+		else if (SkipPrefix(i, "sample="sv)) {
+			const auto value = ParseInteger<unsigned>(i);
+			if (!value || *value == 0)
+				throw std::runtime_error("Malformed STOPWATCH_PIPE sample rate");
+
+			options.sample_rate = *value;
+		} else if (SkipPrefix(i, "filter="sv))
+			options.filter = i;
+		else
+			throw std::runtime_error("Malformed STOPWATCH_PIPE option");
+	}
+
+	return options;
 }
 
 static void
 HandleStopwatchPipe(std::span<const std::byte> payload,
 		    std::span<UniqueFileDescriptor> fds)
 {
-	if (!payload.empty() || fds.size() != 1 || !fds.front().IsPipe())
+	if (fds.size() != 1 || !fds.front().IsPipe())
 		throw std::runtime_error("Malformed STOPWATCH_PIPE packet");
 
-	stopwatch_enable(std::move(fds.front()));
+	stopwatch_enable(std::move(fds.front()),
+			 ParseStopwatchOptions(ToStringView(payload)));
+}
+
+/**
+ * Send the event loop statistics to the pipe passed with a STATS
+ * packet.  Without a pipe, the packet is ignored (the old STATS
+ * reply is deprecated).
+ */
+static void
+HandleStats(const EventLoopMonitor &monitor,
+	    std::span<UniqueFileDescriptor> fds)
+{
+	if (fds.empty())
+		return;
+
+	if (fds.size() != 1 || !fds.front().IsPipe())
+		throw std::runtime_error("Malformed STATS packet");
+
+	Prometheus::SendToPipe(fds.front(), "bp"sv, monitor.GetStats());
 }
 
 void
@@ -133,10 +193,13 @@ BpInstance::OnControlPacket(BengControl::Server &,
 		break;
 
 	case Command::FLUSH_NFS_CACHE:
-	case Command::STATS:
 		// deprecated
 		break;
 
+	case Command::STATS:
+		HandleStats(event_loop_monitor, fds);
+		break;
+
 	case Command::FLUSH_FILTER_CACHE:
 		if (filter_cache != nullptr) {
 			if (payload.empty())
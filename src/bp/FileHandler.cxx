@@ -17,6 +17,7 @@
 #include "istream/FdIstream.hxx"
 #include "pool/pool.hxx"
 #include "translation/Vary.hxx"
+#include "stats/EventLoopProfiler.hxx"
 #include "lib/fmt/SystemError.hxx"
 #include "io/uring/config.h" // for HAVE_URING
 #include "io/FileAt.hxx"
@@ -395,10 +396,14 @@ Request::MaybeEmulateModAuthEasy(const FileAddress &address,
 	return EmulateModAuthEasy(address, fd, st);
 }
 
+static EventLoopCallbackSite open_stat_site{"file_open_stat", EventLoopCallbackType::URING};
+
 inline void
 Request::OnOpenStat(UniqueFileDescriptor fd,
 		    struct statx &st) noexcept
 {
+	const EventLoopCallbackScope scope{open_stat_site};
+
 	HandleFileAddress(*handler.file.address, std::move(fd), st);
 }
 
@@ -766,6 +766,8 @@ Request::HandleChainResponse(UniquePoolPtr<TranslateResponse> _response) noexcep
 	   its filter_4xx settings etc. are used */
 	translate.response = std::move(_response);
 
+	((BpRequestLogger *)request.logger)->BeginUpstream();
+
 	rl.SendRequest(pool, stopwatch,
 		       {
 			       .sticky_hash = session_id.GetClusterHash(),
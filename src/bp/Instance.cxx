@@ -18,11 +18,15 @@
 #include "http/rl/BufferedResourceLoader.hxx"
 #include "http/cache/EncodingCache.hxx"
 #include "http/cache/FilterCache.hxx"
+#include "bp/XmlTemplateCache.hxx"
+#include "widget/FragmentCache.hxx"
 #include "http/cache/Public.hxx"
 #include "translation/Stock.hxx"
 #include "translation/Cache.hxx"
 #include "translation/Multi.hxx"
 #include "translation/Builder.hxx"
+#include "TranslationCacheSnapshot.hxx"
+#include "TextProcessor.hxx"
 #include "widget/Registry.hxx"
 #include "http/local/Stock.hxx"
 #include "fcgi/Stock.hxx"
@@ -37,12 +41,16 @@
 #include "nghttp2/Stock.hxx"
 #include "stock/MapStock.hxx"
 #include "session/Manager.hxx"
-#include "session/Save.hxx"
+#include "session/Changes.hxx"
+#include "session/Persist.hxx"
+#include "session/Replicator.hxx"
+#include "session/ReplicaServer.hxx"
 #include "spawn/CgroupWatch.hxx"
 #include "spawn/Client.hxx"
 #include "spawn/Launch.hxx"
 #include "net/ListenStreamStock.hxx"
 #include "access_log/Glue.hxx"
+#include "stats/EventLoopProfiler.hxx"
 #include "time/Cast.hxx" // for ToFloatSeconds()
 #include "util/PrintException.hxx"
 
@@ -85,20 +93,20 @@ BpInstance::BpInstance(BpConfig &&_config,
 						     spawner.cgroup.IsDefined(),
 						     true)
 	       : nullptr),
-	 spawn_service(spawn.get()),
+	 spawn_service(spawn.get())
 #ifdef HAVE_LIBSYSTEMD
-	 memory_limit(GetMemoryLimit(config.spawn.systemd_scope_properties)),
+	,memory_limit(GetMemoryLimit(config.spawn.systemd_scope_properties)),
 	 cgroup_memory_watch(spawner.cgroup.IsDefined() &&
 			     config.spawn.systemd_scope_properties.HaveMemoryLimit()
 			     ? std::make_unique<CgroupMemoryWatch>(event_loop,
 								   spawner.cgroup,
 								   BIND_THIS_METHOD(OnMemoryWarning))
-			     : nullptr),
+			     : nullptr)
 #endif
-	 session_save_timer(event_loop, BIND_THIS_METHOD(SaveSessions))
 {
 	ForkCow(false);
 	ScheduleCompress();
+	event_loop_monitor.Enable();
 }
 
 BpInstance::~BpInstance() noexcept
@@ -111,6 +119,8 @@ BpInstance::~BpInstance() noexcept
 	delete (DirectResourceLoader *)direct_resource_loader;
 
 	FreeStocksAndCaches();
+
+	text_processor_deinit();
 }
 
 void
@@ -119,6 +129,7 @@ BpInstance::FreeStocksAndCaches() noexcept
 	delete std::exchange(widget_registry, nullptr);
 	translation_service.reset();
 	cached_translation_service.reset();
+	translation_cache_snapshot.reset();
 	translation_caches.reset();
 	uncached_translation_service.reset();
 	translation_clients.reset();
@@ -137,6 +148,8 @@ BpInstance::FreeStocksAndCaches() noexcept
 	}
 
 	encoding_cache.reset();
+	xml_template_cache.reset();
+	widget_fragment_cache.reset();
 
 	lhttp_stock.reset();
 	fcgi_stock.reset();
@@ -186,6 +199,9 @@ BpInstance::ForkCow(bool inherit) noexcept
 
 	if (encoding_cache)
 		encoding_cache->ForkCow(inherit);
+
+	if (widget_fragment_cache)
+		widget_fragment_cache->ForkCow(inherit);
 }
 
 void
@@ -204,9 +220,13 @@ BpInstance::ScheduleCompress() noexcept
 	compress_timer.Schedule(COMPRESS_INTERVAL);
 }
 
+static EventLoopCallbackSite compress_site{"compress", EventLoopCallbackType::TIMER};
+
 void
 BpInstance::OnCompressTimer() noexcept
 {
+	const EventLoopCallbackScope scope{compress_site};
+
 	Compress();
 	ScheduleCompress();
 }
@@ -264,6 +284,9 @@ BpInstance::FlushTranslationCaches() noexcept
 
 	if (translation_caches)
 		translation_caches->Flush();
+
+	if (translation_cache_snapshot)
+		translation_cache_snapshot->Discard();
 }
 
 void
@@ -366,21 +389,6 @@ BpInstance::OnAvahiError(std::exception_ptr e) noexcept
 	return true;
 }
 
-void
-BpInstance::SaveSessions() noexcept
-{
-	session_save(*session_manager);
-
-	ScheduleSaveSessions();
-}
-
-void
-BpInstance::ScheduleSaveSessions() noexcept
-{
-	/* save all sessions every 2 minutes */
-	session_save_timer.Schedule(std::chrono::minutes(2));
-}
-
 BpPerSite &
 BpInstance::MakePerSite(std::string_view site) noexcept
 {
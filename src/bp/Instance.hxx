@@ -11,6 +11,7 @@
 #include "Config.hxx"
 #include "access_log/Multi.hxx"
 #include "stats/HttpStats.hxx"
+#include "stats/EventLoopMonitor.hxx"
 #include "lib/avahi/ErrorHandler.hxx"
 #ifdef HAVE_LIBWAS
 #include "was/MetricsHandler.hxx"
@@ -69,7 +70,14 @@ class FcgiStock;
 class HttpCache;
 class FilterCache;
 class EncodingCache;
+class XmlTemplateCache;
+class WidgetFragmentCache;
 class SessionManager;
+class SessionChanges;
+class SessionPersist;
+class SessionReplicator;
+class SessionReplicaServer;
+class TranslationCacheSnapshot;
 class BpListener;
 class BpPerSite;
 class BpPerSiteMap;
@@ -88,6 +96,8 @@ struct BpInstance final : PInstance, BengControl::Handler,
 
 	HttpStats http_stats;
 
+	EventLoopMonitor event_loop_monitor{event_loop};
+
 	[[no_unique_address]]
 	UringGlue uring{
 		event_loop,
@@ -143,6 +153,31 @@ struct BpInstance final : PInstance, BengControl::Handler,
 
 	std::unique_ptr<SessionManager> session_manager;
 
+	/**
+	 * Passes modified sessions to #session_persist and
+	 * #session_replicator.  Only created if at least one of them
+	 * is.
+	 */
+	std::unique_ptr<SessionChanges> session_changes;
+
+	/**
+	 * Saves the sessions to #BpConfig::session_save_path (if
+	 * configured).
+	 */
+	std::unique_ptr<SessionPersist> session_persist;
+
+	/**
+	 * Sends all sessions to
+	 * #BpConfig::session_replication_buddy (if configured).
+	 */
+	std::unique_ptr<SessionReplicator> session_replicator;
+
+	/**
+	 * Receives sessions from other cluster nodes on
+	 * #BpConfig::session_replication_listen (if configured).
+	 */
+	std::unique_ptr<SessionReplicaServer> session_replica_server;
+
 	/**
 	 * The configured control channel servers (see
 	 * BpConfig::control_listen).  May be empty if none was
@@ -162,6 +197,12 @@ struct BpInstance final : PInstance, BengControl::Handler,
 	std::shared_ptr<MultiTranslationService> uncached_translation_service;
 
 	std::unique_ptr<TranslationCacheBuilder> translation_caches;
+
+	/**
+	 * Saves #translation_caches to
+	 * #BpConfig::translate_cache_snapshot_path (if configured).
+	 */
+	std::unique_ptr<TranslationCacheSnapshot> translation_cache_snapshot;
 	std::shared_ptr<MultiTranslationService> cached_translation_service;
 
 	std::shared_ptr<TranslationService> translation_service;
@@ -186,6 +227,10 @@ struct BpInstance final : PInstance, BengControl::Handler,
 
 	std::unique_ptr<EncodingCache> encoding_cache;
 
+	std::unique_ptr<XmlTemplateCache> xml_template_cache;
+
+	std::unique_ptr<WidgetFragmentCache> widget_fragment_cache;
+
 	std::unique_ptr<BpListenStreamStockHandler> spawn_listen_stream_stock_handler;
 	std::unique_ptr<ListenStreamStock> listen_stream_stock;
 
@@ -209,9 +254,6 @@ struct BpInstance final : PInstance, BengControl::Handler,
 	ResourceLoader *filter_resource_loader = nullptr;
 	ResourceLoader *buffered_filter_resource_loader = nullptr;
 
-	/* session */
-	FarTimerEvent session_save_timer;
-
 	std::unique_ptr<BpPerSiteMap> per_site;
 
 	BpInstance(BpConfig &&_config,
@@ -232,8 +274,6 @@ struct BpInstance final : PInstance, BengControl::Handler,
 	void ScheduleCompress() noexcept;
 	void OnCompressTimer() noexcept;
 
-	void ScheduleSaveSessions() noexcept;
-
 	/**
 	 * Handler for #CONTROL_FADE_CHILDREN
 	 */
@@ -286,7 +326,5 @@ private:
 
 	bool AllocatorCompressCallback() noexcept;
 
-	void SaveSessions() noexcept;
-
 	void FreeStocksAndCaches() noexcept;
 };
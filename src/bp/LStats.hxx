@@ -20,11 +20,13 @@ struct BpListenerStats {
 			HttpStatus status,
 			uint64_t bytes_received,
 			uint64_t bytes_sent,
-			std::chrono::steady_clock::duration duration) noexcept {
+			std::chrono::steady_clock::duration duration,
+			std::chrono::steady_clock::duration ttfb,
+			std::chrono::steady_clock::duration upstream_wait) noexcept {
 		tagged.AddRequest(tag, status,
 				  bytes_received, bytes_sent,
-				  duration);
+				  duration, ttfb, upstream_wait);
 
-		per_generator.AddRequest(generator, status);
+		per_generator.AddRequest(generator, status, duration);
 	}
 };
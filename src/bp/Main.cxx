@@ -12,12 +12,16 @@
 #include "pool/pool.hxx"
 #include "memory/fb_pool.hxx"
 #include "session/Manager.hxx"
-#include "session/Save.hxx"
+#include "session/Changes.hxx"
+#include "session/Persist.hxx"
+#include "session/Replicator.hxx"
+#include "session/ReplicaServer.hxx"
 #include "tcp_stock.hxx"
 #include "translation/Stock.hxx"
 #include "translation/Cache.hxx"
 #include "translation/Multi.hxx"
 #include "translation/Builder.hxx"
+#include "TranslationCacheSnapshot.hxx"
 #include "cluster/TcpBalancer.hxx"
 #include "fs/Stock.hxx"
 #include "fs/Balancer.hxx"
@@ -38,6 +42,8 @@
 #include "thread/Pool.hxx"
 #include "pipe/Stock.hxx"
 #include "bp/Control.hxx"
+#include "bp/XmlTemplateCache.hxx"
+#include "widget/FragmentCache.hxx"
 #include "widget/Registry.hxx"
 #include "access_log/Glue.hxx"
 #include "ssl/Init.hxx"
@@ -149,6 +155,7 @@ BpInstance::ShutdownCallback() noexcept
 #endif
 
 	compress_timer.Cancel();
+	event_loop_monitor.Disable();
 
 	zombie_reaper.Disable();
 
@@ -156,8 +163,26 @@ BpInstance::ShutdownCallback() noexcept
 
 	background_manager.AbortAll();
 
-	session_save_timer.Cancel();
-	session_save_deinit(*session_manager);
+	session_replica_server.reset();
+
+	if (session_changes)
+		/* submit the last changes to the journal and to the
+		   buddy */
+		session_changes->Flush();
+
+	session_replicator.reset();
+
+	if (session_persist) {
+		session_persist->Shutdown();
+		session_persist.reset();
+	}
+
+	if (translation_cache_snapshot) {
+		translation_cache_snapshot->Shutdown();
+		translation_cache_snapshot.reset();
+	}
+
+	session_changes.reset();
 
 	session_manager.reset();
 
@@ -187,6 +212,12 @@ BpInstance::ReloadEventCallback(int) noexcept
 	if (encoding_cache)
 		encoding_cache->Flush();
 
+	if (xml_template_cache)
+		xml_template_cache->Flush();
+
+	if (widget_fragment_cache)
+		widget_fragment_cache->Flush();
+
 #ifdef HAVE_NGHTTP2
 	if (nghttp2_stock != nullptr)
 		nghttp2_stock->FadeAll();
@@ -357,9 +388,36 @@ try {
 						 instance.config.cluster_node);
 
 	if (!instance.config.session_save_path.empty()) {
-		session_save_init(*instance.session_manager,
-				  instance.config.session_save_path.c_str());
-		instance.ScheduleSaveSessions();
+		instance.session_persist =
+			std::make_unique<SessionPersist>(*instance.session_manager,
+							 thread_pool_get_queue(instance.event_loop),
+							 instance.config.session_save_path.c_str());
+	}
+
+	if (!instance.config.session_replication_listen.bind_address.IsNull())
+		instance.session_replica_server =
+			std::make_unique<SessionReplicaServer>(instance.event_loop,
+							       *instance.session_manager,
+							       instance.config.session_replication_listen.Create(SOCK_STREAM));
+
+	if (!instance.config.session_replication_buddy.IsNull())
+		instance.session_replicator =
+			std::make_unique<SessionReplicator>(instance.event_loop,
+							    *instance.session_manager,
+							    instance.config.session_replication_buddy);
+
+	if (instance.session_persist || instance.session_replicator) {
+		instance.session_changes =
+			std::make_unique<SessionChanges>(instance.event_loop,
+							 *instance.session_manager);
+
+		if (instance.session_persist)
+			instance.session_changes->AddHandler(*instance.session_persist);
+
+		if (instance.session_replicator) {
+			instance.session_changes->AddHandler(*instance.session_replicator);
+			instance.session_replicator->Start();
+		}
 	}
 
 	/* launch the access logger */
@@ -391,7 +449,8 @@ try {
 	assert(!instance.config.translation_sockets.empty());
 
 	instance.translation_clients =
-		std::make_unique<TranslationStockBuilder>(instance.config.translate_stock_limit);
+		std::make_unique<TranslationStockBuilder>(instance.config.translate_stock_limit,
+							  instance.config.translate_multiplex);
 	instance.uncached_translation_service =
 		std::make_unique<MultiTranslationService>();
 
@@ -415,6 +474,14 @@ try {
 								       instance.event_loop));
 	}
 
+	if (instance.translation_caches &&
+	    !instance.config.translate_cache_snapshot_path.empty())
+		instance.translation_cache_snapshot =
+			std::make_unique<TranslationCacheSnapshot>(*instance.translation_caches,
+								   thread_pool_get_queue(instance.event_loop),
+								   instance.config.translate_cache_snapshot_path.c_str(),
+								   instance.config.translate_cache_snapshot_interval);
+
 	instance.translation_service = instance.config.translate_cache_size > 0
 		? instance.cached_translation_service
 		: instance.uncached_translation_service;
@@ -423,7 +490,7 @@ try {
 	/* the WidgetRegistry class has its own cache and doesn't need
 	   the TranslationCache */
 	instance.widget_registry =
-		new WidgetRegistry(instance.root_pool,
+		new WidgetRegistry(instance.event_loop, instance.root_pool,
 				   *instance.uncached_translation_service);
 
 	if (instance.translation_service != nullptr) {
@@ -436,6 +503,7 @@ try {
 
 	instance.lhttp_stock = std::make_unique<LhttpStock>(instance.config.lhttp_stock_limit,
 							    instance.config.lhttp_stock_max_idle,
+							    instance.config.lhttp_stock_prespawn,
 							    instance.event_loop,
 							    *instance.spawn_service,
 							    instance.listen_stream_stock.get(),
@@ -444,6 +512,8 @@ try {
 
 	instance.fcgi_stock = std::make_unique<FcgiStock>(instance.config.fcgi_stock_limit,
 							  instance.config.fcgi_stock_max_idle,
+							  instance.config.fcgi_stock_prespawn,
+							  instance.config.fcgi_multiplex,
 							  instance.event_loop,
 							  *instance.spawn_service,
 							  instance.listen_stream_stock.get(),
@@ -455,10 +525,13 @@ try {
 					  instance.listen_stream_stock.get(),
 					  child_log_sink, child_log_options,
 					  instance.config.was_stock_limit,
-					  instance.config.was_stock_max_idle);
+					  instance.config.was_stock_max_idle,
+					  instance.config.was_shm);
 	instance.multi_was_stock =
 		new MultiWasStock(instance.config.multi_was_stock_limit,
 				  instance.config.multi_was_stock_max_idle,
+				  instance.config.multi_was_stock_prespawn,
+				  instance.config.multi_was_max_concurrency,
 				  instance.event_loop,
 				  *instance.spawn_service,
 				  child_log_sink,
@@ -535,6 +608,16 @@ try {
 		instance.encoding_cache = std::make_unique<EncodingCache>(instance.event_loop,
 									  instance.config.encoding_cache_size);
 
+	if (instance.config.xml_template_cache_size > 0)
+		instance.xml_template_cache =
+			std::make_unique<XmlTemplateCache>(instance.event_loop,
+							   instance.config.xml_template_cache_size);
+
+	if (instance.config.widget_fragment_cache_size > 0)
+		instance.widget_fragment_cache =
+			std::make_unique<WidgetFragmentCache>(instance.event_loop,
+							      instance.config.widget_fragment_cache_size);
+
 	instance.buffered_filter_resource_loader =
 		new BufferedResourceLoader(instance.event_loop,
 					   *instance.filter_resource_loader,
@@ -8,6 +8,7 @@
 #include "prometheus/Stats.hxx"
 #include "prometheus/HttpStats.hxx"
 #include "prometheus/SpawnStats.hxx"
+#include "prometheus/EventLoopStats.hxx"
 #include "http/Headers.hxx"
 #include "http/IncomingRequest.hxx"
 #include "http/ResponseHandler.hxx"
@@ -40,6 +41,7 @@ BpPrometheusExporter::HandleHttpRequest(IncomingHttpRequest &request,
 
 	constexpr auto process = "bp"sv;
 	Prometheus::Write(buffer, process, instance.GetStats());
+	Prometheus::Write(buffer, process, instance.event_loop_monitor.GetStats());
 
 	if (instance.spawn)
 		Prometheus::Write(buffer, process, instance.spawn->GetStats());
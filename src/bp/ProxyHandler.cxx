@@ -8,6 +8,7 @@
 
 #include "Request.hxx"
 #include "Instance.hxx"
+#include "RLogger.hxx"
 #include "ForwardRequest.hxx"
 #include "CsrfProtection.hxx"
 #include "http/IncomingRequest.hxx"
@@ -82,6 +83,8 @@ Request::HandleProxyAddress() noexcept
 		? *instance.direct_resource_loader
 		: *instance.cached_resource_loader;
 
+	((BpRequestLogger *)request.logger)->BeginUpstream();
+
 	rl.SendRequest(pool, stopwatch,
 		       {
 			       .sticky_hash = session_id.GetClusterHash(),
@@ -9,6 +9,8 @@
 #include "http/CommonHeaders.hxx"
 #include "http/IncomingRequest.hxx"
 
+#include <utility> // for std::exchange
+
 BpRequestLogger::BpRequestLogger(BpInstance &_instance,
 				 BpListenerStats &_http_stats,
 				 AccessLogGlue *_access_logger,
@@ -20,6 +22,31 @@ BpRequestLogger::BpRequestLogger(BpInstance &_instance,
 {
 }
 
+void
+BpRequestLogger::BeginUpstream() noexcept
+{
+	upstream_start = instance.event_loop.SteadyNow();
+}
+
+void
+BpRequestLogger::EndUpstream() noexcept
+{
+	if (upstream_start == std::chrono::steady_clock::time_point{})
+		return;
+
+	const auto d = instance.event_loop.SteadyNow() - std::exchange(upstream_start, {});
+	if (upstream_wait.count() < 0)
+		upstream_wait = d;
+	else
+		upstream_wait += d;
+}
+
+void
+BpRequestLogger::OnResponseSubmitted() noexcept
+{
+	response_time = instance.event_loop.SteadyNow();
+}
+
 void
 BpRequestLogger::LogHttpRequest(IncomingHttpRequest &request,
 				Event::Duration wait_duration,
@@ -31,16 +58,19 @@ BpRequestLogger::LogHttpRequest(IncomingHttpRequest &request,
 	const auto total_duration = GetDuration(instance.event_loop.SteadyNow());
 	assert(total_duration >= wait_duration);
 	const auto duration = total_duration - wait_duration;
+	const auto ttfb = response_time != std::chrono::steady_clock::time_point{}
+		? response_time - start_time
+		: std::chrono::steady_clock::duration{-1};
 
 	instance.http_stats.AddRequest(status,
 				       bytes_received, bytes_sent,
-				       duration);
+				       duration, ttfb, upstream_wait);
 
 	http_stats.AddRequest(stats_tag,
 			      generator != nullptr ? std::string_view{generator} : std::string_view{},
 			      status,
 			      bytes_received, bytes_sent,
-			      duration);
+			      duration, ttfb, upstream_wait);
 
 	if (access_logger != nullptr &&
 	    (!access_logger_only_errors || http_status_is_error(status)))
@@ -33,6 +33,24 @@ struct BpRequestLogger final : IncomingHttpRequestLogger {
 	 */
 	const std::chrono::steady_clock::time_point start_time;
 
+	/**
+	 * The time stamp when the response headers were submitted.
+	 * Used to calculate the "time to first byte".
+	 */
+	std::chrono::steady_clock::time_point response_time{};
+
+	/**
+	 * The time stamp when the pending upstream request was sent.
+	 * Only valid between BeginUpstream() and EndUpstream().
+	 */
+	std::chrono::steady_clock::time_point upstream_start{};
+
+	/**
+	 * The accumulated duration waiting for upstream responses;
+	 * negative if this request was never forwarded.
+	 */
+	std::chrono::steady_clock::duration upstream_wait{-1};
+
 	/**
 	 * The name of the site being accessed by the current HTTP
 	 * request (from #TRANSLATE_SITE).  It is a hack to allow the
@@ -66,7 +84,19 @@ struct BpRequestLogger final : IncomingHttpRequestLogger {
 		return now - start_time;
 	}
 
+	/**
+	 * A request is being sent to an upstream server; start
+	 * measuring the time until its response arrives.
+	 */
+	void BeginUpstream() noexcept;
+
+	/**
+	 * The upstream server has responded (or failed).
+	 */
+	void EndUpstream() noexcept;
+
 	/* virtual methods from class IncomingHttpRequestLogger */
+	void OnResponseSubmitted() noexcept override;
 	void LogHttpRequest(IncomingHttpRequest &request,
 			    Event::Duration wait_duration,
 			    HttpStatus status,
@@ -843,10 +843,15 @@ private:
 
 	SharedPoolPtr<WidgetContext> NewWidgetContext() const noexcept;
 
+	/**
+	 * @param template_tag identifies the template in the
+	 * #XmlTemplateCache; nullptr if it cannot be cached
+	 */
 	void InvokeXmlProcessor(HttpStatus status,
 				StringMap &response_headers,
 				UnusedIstreamPtr response_body,
-				const Transformation &transformation) noexcept;
+				const Transformation &transformation,
+				const char *template_tag) noexcept;
 
 	void HandleProxyWidget(UnusedIstreamPtr body,
 			       Widget &widget, const WidgetRef *proxy_ref,
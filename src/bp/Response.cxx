@@ -88,21 +88,19 @@ session_drop_widgets(RealmSession &session, const char *uri,
 	std::string_view id = uri;
 
 	while (true) {
-		auto i = map->find(id);
-		if (i == map->end())
-			/* no such widget session */
-			return;
-
-		auto &ws = i->second;
-
 		if (ref == nullptr) {
 			/* found the widget session */
-			map->erase(i);
+			WidgetSession::Erase(*map, id);
 			return;
 		}
 
-		map = &ws.children;
-		id = i->first;
+		auto *ws = WidgetSession::Find(*map, id);
+		if (ws == nullptr)
+			/* no such widget session */
+			return;
+
+		map = &ws->children;
+		id = ws->id;
 		ref = ref->next;
 	}
 }
@@ -284,6 +282,7 @@ Request::NewWidgetContext() const noexcept
 	ctx->peer_subject = connection.peer_subject;
 	ctx->peer_issuer_subject = connection.peer_issuer_subject;
 	ctx->user = user;
+	ctx->fragment_cache = instance.widget_fragment_cache.get();
 
 	return ctx;
 }
@@ -300,7 +299,8 @@ inline void
 Request::InvokeXmlProcessor(HttpStatus status,
 			    StringMap &response_headers,
 			    UnusedIstreamPtr response_body,
-			    const Transformation &transformation) noexcept
+			    const Transformation &transformation,
+			    const char *template_tag) noexcept
 {
 	assert(!response_sent);
 
@@ -401,7 +401,9 @@ Request::InvokeXmlProcessor(HttpStatus status,
 						  std::move(response_body),
 						  widget,
 						  std::move(ctx),
-						  transformation.u.processor.options);
+						  transformation.u.processor.options,
+						  instance.xml_template_cache.get(),
+						  template_tag);
 		assert(response_body);
 
 		InvokeResponse(status,
@@ -735,6 +737,8 @@ Request::ApplyFilter(HttpStatus status, StringMap &&headers2,
 	if (body)
 		body = NewAutoPipeIstream(&pool, std::move(body), instance.pipe_stock);
 
+	((BpRequestLogger *)request.logger)->BeginUpstream();
+
 	instance.buffered_filter_resource_loader
 		->SendRequest(pool, stopwatch,
 			      {
@@ -763,13 +767,19 @@ Request::ApplyTransformation(HttpStatus status, StringMap &&headers,
 			    transformation.u.filter);
 		break;
 
-	case Transformation::Type::PROCESS:
-		/* processor responses cannot be cached */
+	case Transformation::Type::PROCESS: {
+		/* the parsed template may be cached, but the processor
+		   response cannot; the template cache replays byte
+		   offsets, so it needs a strong ETag */
+		const char *template_tag =
+			resource_tag_append_etag(pool, resource_tag, headers,
+						 true);
 		resource_tag = nullptr;
 
 		InvokeXmlProcessor(status, headers, std::move(response_body),
-				   transformation);
+				   transformation, template_tag);
 		break;
+	}
 
 	case Transformation::Type::PROCESS_CSS:
 		/* processor responses cannot be cached */
@@ -971,6 +981,8 @@ Request::OnHttpResponse(HttpStatus status, StringMap &&_headers,
 {
 	assert(!response_sent);
 
+	((BpRequestLogger *)request.logger)->EndUpstream();
+
 	/* move the StringMap rvalue reference to the stack to avoid
 	   use-after-free bugs when pending_filter_response gets moved
 	   into it, which, by closing the given response body, may
@@ -1078,5 +1090,7 @@ Request::OnHttpError(std::exception_ptr ep) noexcept
 {
 	assert(!response_sent);
 
+	((BpRequestLogger *)request.logger)->EndUpstream();
+
 	LogDispatchError(ep);
 }
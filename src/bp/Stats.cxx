@@ -14,9 +14,18 @@
 #include "http/cache/EncodingCache.hxx"
 #include "http/cache/FilterCache.hxx"
 #include "http/cache/Public.hxx"
+#include "XmlTemplateCache.hxx"
+#include "widget/Registry.hxx"
+#include "widget/FragmentCache.hxx"
 #include "session/Manager.hxx"
 #include "net/control/Protocol.hxx"
 #include "tcp_stock.hxx"
+#include "http/local/Stock.hxx"
+#include "fcgi/Stock.hxx"
+
+#ifdef HAVE_LIBWAS
+#include "was/MStock.hxx"
+#endif
 
 Prometheus::Stats
 BpInstance::GetStats() const noexcept
@@ -50,6 +59,26 @@ BpInstance::GetStats() const noexcept
 	if (encoding_cache)
 		stats.encoding_cache = encoding_cache->GetStats();
 
+	if (xml_template_cache)
+		stats.xml_template_cache = xml_template_cache->GetStats();
+
+	if (widget_registry != nullptr)
+		stats.widget_class_cache = widget_registry->GetStats();
+
+	if (widget_fragment_cache)
+		stats.widget_fragment_cache = widget_fragment_cache->GetStats();
+
+	if (lhttp_stock != nullptr)
+		stats.lhttp_stock = lhttp_stock->GetStats();
+
+	if (fcgi_stock != nullptr)
+		stats.fcgi_stock = fcgi_stock->GetStats();
+
+#ifdef HAVE_LIBWAS
+	if (multi_was_stock != nullptr)
+		stats.was_stock = multi_was_stock->GetStats();
+#endif
+
 	stats.io_buffers = fb_pool_get().GetStats();
 
 	return stats;
@@ -12,11 +12,14 @@
 #include "widget/Class.hxx"
 #include "widget/Context.hxx"
 #include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
 #include "http/CommonHeaders.hxx"
 #include "util/CharUtil.hxx"
 #include "util/HexFormat.hxx"
 #include "util/StringCompare.hxx"
 
+#include <utility>
+
 #include <assert.h>
 #include <string.h>
 
@@ -102,33 +105,210 @@ EscapeValue(struct pool &pool, const char *v) noexcept
 			   : std::string_view{});
 }
 
+/**
+ * The entities known by the text processor.
+ */
+enum class TextEntity : unsigned {
+	TYPE,
+	CLASS,
+	LOCAL,
+	ID,
+	PATH,
+	PREFIX,
+	URI,
+	BASE,
+	FRAME,
+	VIEW,
+	SESSION,
+};
+
+static constexpr std::size_t N_TEXT_ENTITIES = std::size_t(TextEntity::SESSION) + 1;
+
+/**
+ * Build the #SubstTree with all entities.  It does not contain any
+ * values; they are determined by #TextProcessorResolver only for
+ * entities which are actually found in the document.  Therefore,
+ * this tree is built only once and shared by all responses.
+ */
 static SubstTree
-processor_subst_beng_widget(struct pool &pool,
-			    const Widget &widget,
-			    const WidgetContext &ctx) noexcept
+MakeTextProcessorTree(struct pool &pool) noexcept
+{
+	static constexpr std::pair<const char *, TextEntity> entities[] = {
+		{"&c:type;", TextEntity::TYPE},
+		{"&c:class;", TextEntity::CLASS},
+		{"&c:local;", TextEntity::LOCAL},
+		{"&c:id;", TextEntity::ID},
+		{"&c:path;", TextEntity::PATH},
+		{"&c:prefix;", TextEntity::PREFIX},
+		{"&c:uri;", TextEntity::URI},
+		{"&c:base;", TextEntity::BASE},
+		{"&c:frame;", TextEntity::FRAME},
+		{"&c:view;", TextEntity::VIEW},
+		{"&c:session;", TextEntity::SESSION},
+	};
+
+	SubstTree tree;
+	for (const auto &[name, entity] : entities)
+		tree.AddLazy(pool, name, unsigned(entity));
+
+	tree.Compile();
+	return tree;
+}
+
+/**
+ * The shared #SubstTree and the (root) pool it is allocated from.
+ * This is not a #RootPool, because that would reinitialize the
+ * temporary pool.
+ */
+struct TextProcessorTree {
+	const PoolPtr pool = pool_new_libc(nullptr, "text_processor");
+
+	const SubstTree tree = MakeTextProcessorTree(*pool);
+};
+
+static TextProcessorTree *text_processor_tree;
+
+static const SubstTree &
+GetTextProcessorTree() noexcept
+{
+	if (text_processor_tree == nullptr)
+		text_processor_tree = new TextProcessorTree();
+
+	return text_processor_tree->tree;
+}
+
+void
+text_processor_deinit() noexcept
+{
+	delete std::exchange(text_processor_tree, nullptr);
+}
+
+/**
+ * Determines the entity values for one response.  Everything which
+ * is cheap (pointers to strings which live in the pool) is copied
+ * from the #Widget and the #WidgetContext right away, because
+ * they may be gone when the document is being streamed; escaping
+ * and copying is only done for entities which are found.
+ */
+class TextProcessorResolver final : public SubstResolver {
+	struct pool &pool;
+
+	const char *const class_name, *const quoted_class_name;
+	const char *const local_uri;
+	const char *const id, *const id_path, *const prefix;
+	const char *const absolute_uri, *const uri, *const frame;
+
+	const char *const view_name;
+
+	/**
+	 * The root widget has no "&c:view;" entity; it is left as it
+	 * is.
+	 */
+	const bool is_root;
+
+	std::string_view values[N_TEXT_ENTITIES];
+	bool resolved[N_TEXT_ENTITIES]{};
+
+public:
+	TextProcessorResolver(struct pool &_pool, const Widget &widget,
+			      const WidgetContext &ctx) noexcept
+		:pool(_pool),
+		 class_name(widget.class_name),
+		 quoted_class_name(widget.GetQuotedClassName()),
+		 local_uri(widget.cls->local_uri),
+		 id(widget.id),
+		 id_path(widget.GetIdPath()),
+		 prefix(widget.GetPrefix()),
+		 absolute_uri(ctx.absolute_uri),
+		 uri(ctx.uri),
+		 frame(strmap_get_checked(ctx.args, "frame")),
+		 view_name(widget.IsRoot()
+			   ? nullptr
+			   : widget.GetEffectiveView()->name),
+		 is_root(widget.IsRoot()) {}
+
+	/* virtual methods from class SubstResolver */
+	std::optional<std::string_view> ResolveSubst(unsigned id) noexcept override;
+
+private:
+	std::string_view Resolve(TextEntity entity) noexcept;
+};
+
+/**
+ * Convert a nullable C string to a std::string_view like
+ * SubstTree::Add() does.
+ */
+static constexpr std::string_view
+NullableString(const char *s) noexcept
+{
+	return s != nullptr ? std::string_view{s} : std::string_view{};
+}
+
+inline std::string_view
+TextProcessorResolver::Resolve(TextEntity entity) noexcept
+{
+	switch (entity) {
+	case TextEntity::TYPE:
+		return NullableString(class_name);
+
+	case TextEntity::CLASS:
+		return NullableString(quoted_class_name);
+
+	case TextEntity::LOCAL:
+		return NullableString(local_uri);
+
+	case TextEntity::ID:
+		return NullableString(id);
+
+	case TextEntity::PATH:
+		return NullableString(id_path);
+
+	case TextEntity::PREFIX:
+		return NullableString(prefix);
+
+	case TextEntity::URI:
+		return EscapeValue(pool, absolute_uri);
+
+	case TextEntity::BASE:
+		return EscapeValue(pool, base_uri(&pool, uri));
+
+	case TextEntity::FRAME:
+		return EscapeValue(pool, frame);
+
+	case TextEntity::VIEW:
+		return NullableString(view_name);
+
+	case TextEntity::SESSION:
+		/* obsolete as of version 15.29 */
+		break;
+	}
+
+	return {};
+}
+
+std::optional<std::string_view>
+TextProcessorResolver::ResolveSubst(unsigned _entity) noexcept
 {
-	SubstTree subst;
-	subst.Add(pool, "&c:type;", widget.class_name);
-	subst.Add(pool, "&c:class;", widget.GetQuotedClassName());
-	subst.Add(pool, "&c:local;", widget.cls->local_uri);
-	subst.Add(pool, "&c:id;", widget.id);
-	subst.Add(pool, "&c:path;", widget.GetIdPath());
-	subst.Add(pool, "&c:prefix;", widget.GetPrefix());
-	subst.Add(pool, "&c:uri;", EscapeValue(pool, ctx.absolute_uri));
-	subst.Add(pool, "&c:base;", EscapeValue(pool, base_uri(&pool, ctx.uri)));
-	subst.Add(pool, "&c:frame;", EscapeValue(pool, strmap_get_checked(ctx.args, "frame")));
-
-	if (!widget.IsRoot())
-		subst.Add(pool, "&c:view;", widget.GetEffectiveView()->name);
-
-	subst.Add(pool, "&c:session;", nullptr); /* obsolete as of version 15.29 */
-	return subst;
+	assert(_entity < N_TEXT_ENTITIES);
+
+	const auto entity = TextEntity(_entity);
+	if (entity == TextEntity::VIEW && is_root)
+		return std::nullopt;
+
+	if (!resolved[_entity]) {
+		values[_entity] = Resolve(entity);
+		resolved[_entity] = true;
+	}
+
+	return values[_entity];
 }
 
 UnusedIstreamPtr
 text_processor(struct pool &pool, UnusedIstreamPtr input,
 	       const Widget &widget, const WidgetContext &ctx) noexcept
 {
+	auto &resolver = *NewFromPool<TextProcessorResolver>(pool, pool,
+							     widget, ctx);
 	return istream_subst_new(&pool, std::move(input),
-				 processor_subst_beng_widget(pool, widget, ctx));
+				 GetTextProcessorTree(), resolver);
 }
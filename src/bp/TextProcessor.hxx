@@ -26,3 +26,11 @@ text_processor_allowed(const StringMap &headers) noexcept;
 UnusedIstreamPtr
 text_processor(struct pool &pool, UnusedIstreamPtr istream,
 	       const Widget &widget, const WidgetContext &ctx) noexcept;
+
+/**
+ * Free the entity tree which is shared by all text_processor()
+ * calls (it is built on the first call).  No text processor
+ * #Istream may exist anymore.
+ */
+void
+text_processor_deinit() noexcept;
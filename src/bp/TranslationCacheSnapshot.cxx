@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "TranslationCacheSnapshot.hxx"
+#include "translation/Builder.hxx"
+#include "thread/Queue.hxx"
+#include "thread/Job.hxx"
+#include "memory/GrowingBuffer.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "io/FdOutputStream.hxx"
+#include "io/FileWriter.hxx"
+#include "io/Logger.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cassert>
+#include <cerrno>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Read the whole file.  Returns an empty buffer if it does not
+ * exist.
+ *
+ * Throws on error.
+ */
+static std::vector<std::byte>
+ReadSnapshotFile(const char *path)
+{
+	std::vector<std::byte> result;
+
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(path)) {
+		if (errno == ENOENT)
+			return result;
+
+		throw FmtErrno("Failed to open {}", path);
+	}
+
+	const auto size = fd.GetSize();
+	if (size > 0)
+		result.reserve(size);
+
+	std::byte buffer[65536];
+	while (true) {
+		const auto nbytes = fd.Read(buffer);
+		if (nbytes < 0)
+			throw FmtErrno("Failed to read {}", path);
+
+		if (nbytes == 0)
+			return result;
+
+		result.insert(result.end(), buffer, buffer + nbytes);
+	}
+}
+
+/**
+ * Writes a serialized snapshot to the file in a worker thread.
+ */
+class TranslationCacheSnapshot::Job final : public ThreadJob {
+	/**
+	 * The owner; nullptr if it has been destroyed while this job
+	 * was still queued or running.  In that case, Done() deletes
+	 * this object.
+	 */
+	TranslationCacheSnapshot *snapshot;
+
+	const std::string path;
+
+public:
+	/**
+	 * The serialized snapshot.  Only the worker thread may
+	 * access this while the job is queued.
+	 */
+	GrowingBuffer data;
+
+	std::exception_ptr error;
+
+	explicit Job(TranslationCacheSnapshot &_snapshot) noexcept
+		:snapshot(&_snapshot), path(_snapshot.path) {}
+
+	/**
+	 * The owner is about to be destroyed (or does not want to
+	 * hear from this job anymore), but the #ThreadQueue still
+	 * references this object.  Let Done() delete it.
+	 */
+	void PostponeDestroy() noexcept {
+		assert(snapshot != nullptr);
+		snapshot = nullptr;
+	}
+
+	/**
+	 * Write #data to the file; called in the worker thread (or
+	 * by TranslationCacheSnapshot::Shutdown()).
+	 *
+	 * Throws on error.
+	 */
+	void Write();
+
+private:
+	/* virtual methods from class ThreadJob */
+	void Run() noexcept override {
+		try {
+			Write();
+		} catch (...) {
+			error = std::current_exception();
+		}
+	}
+
+	void Done() noexcept override {
+		if (snapshot == nullptr) {
+			delete this;
+			return;
+		}
+
+		snapshot->OnJobDone();
+	}
+};
+
+void
+TranslationCacheSnapshot::Job::Write()
+{
+	/* FileWriter writes to a temporary file and replaces the
+	   old snapshot atomically in Commit() */
+	FileWriter writer{path.c_str(), 0600};
+
+	FdOutputStream os{writer.GetFileDescriptor()};
+	data.ForEachBuffer([&os](std::span<const std::byte> b){
+		os.Write(b);
+	});
+
+	writer.Commit();
+}
+
+TranslationCacheSnapshot::TranslationCacheSnapshot(TranslationCacheBuilder &_caches,
+						   ThreadQueue &_queue,
+						   const char *_path,
+						   Event::Duration _interval) noexcept
+	:caches(_caches), queue(_queue), path(_path),
+	 interval(_interval),
+	 save_timer(queue.GetEventLoop(), BIND_THIS_METHOD(OnSaveTimer)),
+	 job(std::make_unique<Job>(*this))
+{
+	Load();
+
+	caches.EnableSnapshot();
+
+	save_timer.Schedule(interval);
+}
+
+TranslationCacheSnapshot::~TranslationCacheSnapshot() noexcept
+{
+	if (busy && !queue.Cancel(*job))
+		/* the worker thread is still running it (or Done() is
+		   pending) */
+		job.release()->PostponeDestroy();
+}
+
+inline void
+TranslationCacheSnapshot::Load() noexcept
+{
+	try {
+		const auto src = ReadSnapshotFile(path.c_str());
+		if (src.empty())
+			return;
+
+		const std::size_t n = caches.LoadSnapshot(src);
+		LogConcat(4, "TranslationCache", "restored ", n,
+			  " items from ", path);
+	} catch (...) {
+		LogConcat(2, "TranslationCache", "Failed to load ", path, ": ",
+			  std::current_exception());
+	}
+}
+
+void
+TranslationCacheSnapshot::Shutdown() noexcept
+{
+	save_timer.Cancel();
+
+	if (busy) {
+		busy = false;
+
+		if (!queue.Cancel(*job)) {
+			/* the job has been executed already, but its
+			   Done() call is still pending; it must not
+			   call us anymore, so let it go and continue
+			   with a new Job */
+			if (job->error)
+				LogConcat(2, "TranslationCache", "Failed to save ", path, ": ",
+					  std::exchange(job->error, {}));
+
+			job.release()->PostponeDestroy();
+			job = std::make_unique<Job>(*this);
+		}
+
+		/* else: the worker threads have been stopped before
+		   our job was started; its data is obsolete, because
+		   a new snapshot is about to be written */
+
+		if (std::exchange(discarded, false))
+			/* the file written by the job contains
+			   invalidated items; if the new snapshot
+			   cannot be written, it must not be restored */
+			unlink(path.c_str());
+	}
+
+	if (!Serialize())
+		return;
+
+	try {
+		job->Write();
+	} catch (...) {
+		LogConcat(1, "TranslationCache", "Failed to save ", path, ": ",
+			  std::current_exception());
+	}
+
+	job->data.Clear();
+}
+
+void
+TranslationCacheSnapshot::Discard() noexcept
+{
+	if (busy)
+		/* the worker thread may be writing the file right
+		   now; OnJobDone() will delete it */
+		discarded = true;
+
+	if (unlink(path.c_str()) < 0 && errno != ENOENT)
+		LogConcat(2, "TranslationCache", "Failed to delete ", path, ": ",
+			  strerror(errno));
+}
+
+bool
+TranslationCacheSnapshot::Serialize() noexcept
+{
+	assert(!busy);
+
+	try {
+		job->data = caches.SaveSnapshot();
+		return true;
+	} catch (...) {
+		LogConcat(1, "TranslationCache", "Failed to serialize: ",
+			  std::current_exception());
+		return false;
+	}
+}
+
+inline void
+TranslationCacheSnapshot::OnSaveTimer() noexcept
+{
+	if (busy)
+		/* the previous save is still running; OnJobDone()
+		   will reschedule */
+		return;
+
+	if (!Serialize()) {
+		save_timer.Schedule(interval);
+		return;
+	}
+
+	busy = true;
+	queue.Add(*job);
+}
+
+inline void
+TranslationCacheSnapshot::OnJobDone() noexcept
+{
+	assert(busy);
+
+	busy = false;
+
+	/* free the buffers in the main thread */
+	job->data.Clear();
+
+	if (job->error)
+		LogConcat(2, "TranslationCache", "Failed to save ", path, ": ",
+			  std::exchange(job->error, {}));
+
+	if (std::exchange(discarded, false))
+		unlink(path.c_str());
+
+	save_timer.Schedule(interval);
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "event/CoarseTimerEvent.hxx"
+
+#include <memory>
+#include <string>
+
+class TranslationCacheBuilder;
+class ThreadQueue;
+
+/**
+ * Saves the translation caches to a file (see
+ * translation/Snapshot.hxx), so they can be restored after a restart
+ * and the translation server doesn't have to answer all requests
+ * again.  The caches are serialized in the main thread, and the file
+ * is written by a #ThreadQueue worker thread.
+ */
+class TranslationCacheSnapshot final {
+	/**
+	 * The part which runs in the worker thread.
+	 */
+	class Job;
+
+	TranslationCacheBuilder &caches;
+
+	ThreadQueue &queue;
+
+	const std::string path;
+
+	const Event::Duration interval;
+
+	CoarseTimerEvent save_timer;
+
+	/**
+	 * The #ThreadJob.  It is a separate object, so its destruction
+	 * can be postponed if it is still running when this object
+	 * gets destroyed.
+	 */
+	std::unique_ptr<Job> job;
+
+	/**
+	 * Has #job been submitted to the #ThreadQueue (and its Done()
+	 * method not yet been called)?
+	 */
+	bool busy = false;
+
+	/**
+	 * Has Discard() been called while the worker thread was
+	 * busy?  Then the file it writes is obsolete.
+	 */
+	bool discarded = false;
+
+public:
+	/**
+	 * Load the snapshot into the caches (this blocks) and
+	 * enable snapshots in all caches.  All caches must have been
+	 * created already.
+	 */
+	TranslationCacheSnapshot(TranslationCacheBuilder &_caches,
+				 ThreadQueue &_queue,
+				 const char *_path,
+				 Event::Duration _interval) noexcept;
+
+	~TranslationCacheSnapshot() noexcept;
+
+	TranslationCacheSnapshot(const TranslationCacheSnapshot &) = delete;
+	TranslationCacheSnapshot &operator=(const TranslationCacheSnapshot &) = delete;
+
+	/**
+	 * Save the snapshot (this blocks).  Call this during
+	 * shutdown, after the worker threads have been stopped.
+	 */
+	void Shutdown() noexcept;
+
+	/**
+	 * The caches have been flushed or invalidated; delete the
+	 * snapshot file, so the invalidated items don't get restored
+	 * after a restart.  A new snapshot is written by the next
+	 * periodic save.
+	 */
+	void Discard() noexcept;
+
+private:
+	void Load() noexcept;
+
+	/**
+	 * Serialize the caches into the #job.
+	 *
+	 * @return false on error
+	 */
+	bool Serialize() noexcept;
+
+	void OnSaveTimer() noexcept;
+
+	/**
+	 * Called by Job::Done() in the main thread.
+	 */
+	void OnJobDone() noexcept;
+};
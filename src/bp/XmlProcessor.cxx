@@ -3,6 +3,7 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "XmlProcessor.hxx"
+#include "XmlTemplateCache.hxx"
 #include "WidgetContainerParser.hxx"
 #include "TextProcessor.hxx"
 #include "CssProcessor.hxx"
@@ -14,6 +15,7 @@
 #include "widget/Ptr.hxx"
 #include "widget/Context.hxx"
 #include "widget/Inline.hxx"
+#include "widget/Prefetch.hxx"
 #include "widget/RewriteUri.hxx"
 #include "memory/ExpansibleBuffer.hxx"
 #include "escape/HTML.hxx"
@@ -31,6 +33,7 @@
 #include "util/StringCompare.hxx"
 #include "util/StringSplit.hxx"
 #include "stopwatch.hxx"
+#include "AllocatorPtr.hxx"
 
 #include <assert.h>
 #include <string.h>
@@ -69,6 +72,25 @@ class XmlProcessor final : public ReplaceIstream, WidgetContainerParser {
 
 	const unsigned options;
 
+	/**
+	 * If this is set, then all parser events are recorded, to be
+	 * stored in the #XmlTemplateCache at the end.
+	 */
+	const std::unique_ptr<XmlTemplateRecorder> recorder;
+
+	/**
+	 * If this is set, then the parser events are replayed from the
+	 * #XmlTemplateCache and #parser is unused.  It is cleared if
+	 * the source document turns out not to match the template.
+	 */
+	std::unique_ptr<XmlTemplateReplay> replay;
+
+	/**
+	 * Looks up the classes of all widgets in the #replay template
+	 * in advance.
+	 */
+	std::unique_ptr<WidgetClassPrefetch> prefetch;
+
 	XmlParser parser;
 	bool had_input;
 
@@ -118,15 +140,28 @@ public:
 	XmlProcessor(PoolPtr &&_pool, const StopwatchPtr &parent_stopwatch,
 		     UnusedIstreamPtr &&_input,
 		     Widget &_widget, SharedPoolPtr<WidgetContext> &&_ctx,
-		     unsigned _options) noexcept
+		     unsigned _options,
+		     std::unique_ptr<XmlTemplateRecorder> &&_recorder,
+		     std::unique_ptr<XmlTemplateReplay> &&_replay) noexcept
 		:ReplaceIstream(std::move(_pool), _ctx->event_loop, std::move(_input)),
 		 WidgetContainerParser(GetPool(), _widget, std::move(_ctx)),
 		 stopwatch(parent_stopwatch, "XmlProcessor"),
 		 options(_options),
-		 parser(GetPool(), *this),
+		 recorder(std::move(_recorder)),
+		 replay(std::move(_replay)),
+		 parser(GetPool(),
+			recorder
+			? static_cast<XmlParserHandler &>(*recorder)
+			: static_cast<XmlParserHandler &>(*this)),
 		 buffer(GetPool(), 128, 2048),
 		 postponed_rewrite(GetPool())
 	{
+		if (recorder)
+			recorder->SetHandler(*this);
+
+		if (replay && ctx->widget_registry != nullptr)
+			PrefetchWidgetClasses();
+
 		if (HasOptionRewriteUrl()) {
 			default_uri_rewrite.base = UriBase::TEMPLATE;
 			default_uri_rewrite.mode = RewriteUriMode::PARTIAL;
@@ -166,6 +201,21 @@ private:
 		return (options & PROCESSOR_STYLE) != 0;
 	}
 
+	/**
+	 * Start looking up the classes of all widgets in the
+	 * #replay template, so the translation server round trips
+	 * don't delay the widget requests when the widget elements
+	 * get replayed.
+	 */
+	void PrefetchWidgetClasses() noexcept;
+
+	/**
+	 * The whole source document has been collected by #replay;
+	 * verify it and replay the template, or parse the document if
+	 * it does not match.
+	 */
+	void ReplayTemplate() noexcept;
+
 	bool MustRewriteEmptyURI() const noexcept {
 		return tag == Tag::FORM;
 	}
@@ -229,10 +279,20 @@ private:
 
 	/* virtual methods from class ReplaceIstream */
 	void Parse(std::span<const std::byte> b) override {
-		parser.Feed((const char *)b.data(), b.size());
+		if (replay)
+			/* nothing is emitted until ParseEnd() has
+			   verified the source */
+			replay->Feed(b);
+		else
+			parser.Feed((const char *)b.data(), b.size());
 	}
 
 	void ParseEnd() override {
+		if (recorder)
+			recorder->Commit();
+		else if (replay)
+			ReplayTemplate();
+
 		ReplaceIstream::Finish();
 	}
 
@@ -437,6 +497,11 @@ XmlProcessor::CdataIstream::_Close() noexcept
 inline Istream *
 XmlProcessor::StartCdataIstream() noexcept
 {
+	if (recorder)
+		/* the CSS processor is fed with the CDATA contents,
+		   which are not part of the recording */
+		recorder->Abort();
+
 	return cdata_istream = NewFromPool<CdataIstream>(GetPool(), *this);
 }
 
@@ -916,6 +981,39 @@ widget_catch_callback(void *ctx, std::exception_ptr ep) noexcept
 	return {};
 }
 
+inline void
+XmlProcessor::PrefetchWidgetClasses() noexcept
+{
+	assert(replay);
+	assert(ctx->widget_registry != nullptr);
+
+	replay->ForEachWidgetType([this](std::string_view name){
+		if (!prefetch)
+			prefetch = std::make_unique<WidgetClassPrefetch>(ctx->event_loop,
+									 GetPool(),
+									 *ctx->widget_registry);
+
+		prefetch->Add(AllocatorPtr{GetPool()}.DupZ(name));
+	});
+}
+
+inline void
+XmlProcessor::ReplayTemplate() noexcept
+{
+	assert(replay);
+
+	if (replay->Finish()) {
+		replay->Replay(*this);
+		return;
+	}
+
+	/* the document was modified without a new ETag; parse it
+	   after all */
+	const auto source = replay->ReleaseSource();
+	replay.reset();
+	parser.Feed((const char *)source.data(), source.size());
+}
+
 inline Widget &
 XmlProcessor::PrepareEmbedWidget(WidgetPtr child_widget)
 {
@@ -1001,9 +1099,12 @@ XmlProcessor::OnXmlTagFinished(const XmlParserTag &xml_tag) noexcept
 		CommitUriRewrite();
 
 	if (tag == Tag::SCRIPT) {
-		if (xml_tag.type == XmlParserTagType::OPEN)
-			parser.Script();
-		else
+		if (xml_tag.type == XmlParserTagType::OPEN) {
+			/* the recorded events already reflect the
+			   parser's SCRIPT state */
+			if (!replay)
+				parser.Script();
+		} else
 			tag = Tag::NONE;
 		return true;
 	} else if (tag == Tag::REWRITE_URI) {
@@ -1112,11 +1213,35 @@ processor_process(struct pool &caller_pool,
 		  UnusedIstreamPtr input,
 		  Widget &widget,
 		  SharedPoolPtr<WidgetContext> ctx,
-		  unsigned options) noexcept
+		  unsigned options,
+		  XmlTemplateCache *template_cache,
+		  const char *template_tag) noexcept
 {
 	auto pool = pool_new_linear(&caller_pool, "WidgetLookupProcessor", 32768);
 
-	/* the text processor will expand entities */
+	std::unique_ptr<XmlTemplateRecorder> recorder;
+	std::unique_ptr<XmlTemplateReplay> replay;
+
+	/* the template cache requires the source length, because the
+	   recorded offsets must not be replayed over a different
+	   document */
+	if (const off_t length = input.GetAvailable(false);
+	    template_cache != nullptr && template_tag != nullptr &&
+	    length >= 0) {
+		const char *key =
+			XmlTemplateCache::MakeKey(AllocatorPtr{pool},
+						  template_tag, options,
+						  ctx->widget_registry != nullptr);
+		replay = template_cache->Get(key, length);
+		if (!replay) {
+			recorder = template_cache->Record(key);
+			input = recorder->ScanEntities(pool, std::move(input));
+		}
+	}
+
+	/* the text processor will expand entities; cached templates
+	   have none, so it is a no-op for them, but a modified
+	   document (which fails the checksum) may have some */
 	input = text_processor(pool,
 			       std::move(input),
 			       widget, *ctx);
@@ -1124,6 +1249,7 @@ processor_process(struct pool &caller_pool,
 	auto *processor =
 		NewFromPool<XmlProcessor>(std::move(pool), parent_stopwatch,
 					  std::move(input),
-					  widget, std::move(ctx), options);
+					  widget, std::move(ctx), options,
+					  std::move(recorder), std::move(replay));
 	return UnusedIstreamPtr(processor);
 }
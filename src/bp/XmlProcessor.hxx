@@ -41,6 +41,7 @@ class StopwatchPtr;
 class UnusedIstreamPtr;
 class Widget;
 class StringMap;
+class XmlTemplateCache;
 
 [[gnu::pure]]
 bool
@@ -50,6 +51,10 @@ processable(const StringMap &headers) noexcept;
  * Process the specified istream, and return the processed stream.
  *
  * @param widget the widget that represents the template
+ * @param template_cache an optional cache for the parsed template
+ * @param template_tag a tag which identifies the template (including
+ * its ETag) in the #template_cache; nullptr if the template cannot
+ * be cached
  */
 UnusedIstreamPtr
 processor_process(struct pool &pool,
@@ -57,4 +62,6 @@ processor_process(struct pool &pool,
 		  UnusedIstreamPtr istream,
 		  Widget &widget,
 		  SharedPoolPtr<WidgetContext> ctx,
-		  unsigned options) noexcept;
+		  unsigned options,
+		  XmlTemplateCache *template_cache,
+		  const char *template_tag) noexcept;
@@ -0,0 +1,394 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "XmlTemplateCache.hxx"
+#include "istream/ForwardIstream.hxx"
+#include "istream/Bucket.hxx"
+#include "istream/New.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "io/Logger.hxx"
+#include "util/LeakDetector.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <fmt/core.h>
+
+#include <cassert>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * The key contains the ETag, therefore a cached template never gets
+ * stale; this only limits the time an unused item occupies memory.
+ */
+static constexpr std::chrono::seconds xml_template_cache_max_age = std::chrono::hours(24);
+
+/**
+ * A filter which looks for "&c:" entities and calculates the
+ * #XmlTemplateChecksum.  It does not support buckets, because that
+ * would make it difficult to see each byte exactly once.
+ */
+class EntityScanIstream final : public ForwardIstream {
+	static constexpr std::string_view needle = "&c:"sv;
+
+	bool &found;
+
+	XmlTemplateChecksum &checksum;
+
+	/**
+	 * How many bytes of #needle have been matched at the end of
+	 * the previous chunk?
+	 */
+	std::size_t match = 0;
+
+public:
+	EntityScanIstream(struct pool &_pool, UnusedIstreamPtr &&_input,
+			  bool &_found,
+			  XmlTemplateChecksum &_checksum) noexcept
+		:ForwardIstream(_pool, std::move(_input)),
+		 found(_found), checksum(_checksum) {}
+
+	/* virtual methods from class Istream */
+
+	void _SetDirect(FdTypeMask) noexcept override {
+	}
+
+	off_t _Skip(off_t) noexcept override {
+		return -1;
+	}
+
+	void _FillBucketList(IstreamBucketList &list) override {
+		list.EnableFallback();
+	}
+
+	int _AsFd() noexcept override {
+		return -1;
+	}
+
+	/* virtual methods from class IstreamHandler */
+
+	std::size_t OnData(std::span<const std::byte> src) noexcept override {
+		const std::size_t nbytes = ForwardIstream::OnData(src);
+		if (nbytes > 0) {
+			/* scan only what was consumed, because the rest
+			   will be submitted again */
+			checksum.Update(src.first(nbytes));
+			Scan({(const char *)src.data(), nbytes});
+		}
+
+		return nbytes;
+	}
+
+private:
+	void Scan(std::string_view s) noexcept;
+};
+
+void
+EntityScanIstream::Scan(std::string_view s) noexcept
+{
+	while (!found && !s.empty()) {
+		if (match == 0) {
+			const auto amp = s.find('&');
+			if (amp == s.npos)
+				return;
+
+			s.remove_prefix(amp + 1);
+			match = 1;
+		} else if (s.front() == needle[match]) {
+			s.remove_prefix(1);
+			if (++match == needle.size())
+				found = true;
+		} else
+			/* mismatch: check this character again, it may
+			   be another ampersand */
+			match = 0;
+	}
+}
+
+UnusedIstreamPtr
+XmlTemplateRecorder::ScanEntities(struct pool &pool,
+				  UnusedIstreamPtr input) noexcept
+{
+	return NewIstreamPtr<EntityScanIstream>(pool, std::move(input),
+						has_entities,
+						skeleton.checksum);
+}
+
+void
+XmlTemplateRecorder::Commit() noexcept
+{
+	if (aborted || has_entities) {
+		LogConcat(5, "XmlTemplateCache", "nocache ", key);
+		cache.Skip();
+		return;
+	}
+
+	cache.Put(key.c_str(), std::move(skeleton));
+}
+
+XmlTemplateEvent &
+XmlTemplateRecorder::AppendTag(XmlTemplateEvent::Type type,
+			       const XmlParserTag &tag) noexcept
+{
+	auto &e = skeleton.events.emplace_back();
+	e.type = type;
+	e.tag_type = tag.type;
+	e.start = tag.start;
+	e.end = type == XmlTemplateEvent::Type::TAG_START
+		? tag.start
+		: tag.end;
+	e.name = AppendString(tag.name);
+	e.name_length = tag.name.size();
+	return e;
+}
+
+inline void
+XmlTemplateRecorder::AddWidgetType(std::size_t i) noexcept
+{
+	const auto value = skeleton.GetValue(skeleton.events[i]);
+
+	/* templates contain only few widgets, so a linear search is
+	   good enough */
+	for (const auto j : skeleton.widget_types)
+		if (skeleton.GetValue(skeleton.events[j]) == value)
+			return;
+
+	skeleton.widget_types.push_back(i);
+}
+
+bool
+XmlTemplateRecorder::OnXmlTagStart(const XmlParserTag &tag) noexcept
+{
+	const bool result = handler->OnXmlTagStart(tag);
+	if (result)
+		/* tags which were rejected by the handler don't get
+		   attributes and no "finished" call, and they don't
+		   affect the handler's state in any relevant way */
+		AppendTag(XmlTemplateEvent::Type::TAG_START, tag);
+
+	in_widget_tag = result && tag.type != XmlParserTagType::CLOSE &&
+		tag.name == "c:widget"sv;
+	return result;
+}
+
+bool
+XmlTemplateRecorder::OnXmlTagFinished(const XmlParserTag &tag) noexcept
+{
+	in_widget_tag = false;
+	AppendTag(XmlTemplateEvent::Type::TAG_FINISHED, tag);
+	return handler->OnXmlTagFinished(tag);
+}
+
+void
+XmlTemplateRecorder::OnXmlAttributeFinished(const XmlParserAttribute &attr) noexcept
+{
+	auto &e = skeleton.events.emplace_back();
+	e.type = XmlTemplateEvent::Type::ATTRIBUTE;
+	e.start = attr.name_start;
+	e.end = attr.end;
+	e.value_start = attr.value_start;
+	e.value_end = attr.value_end;
+	e.name = AppendString(attr.name);
+	e.name_length = attr.name.size();
+	e.value = AppendString(attr.value);
+	e.value_length = attr.value.size();
+
+	if (in_widget_tag && attr.name == "type"sv && !attr.value.empty())
+		AddWidgetType(skeleton.events.size() - 1);
+
+	handler->OnXmlAttributeFinished(attr);
+}
+
+size_t
+XmlTemplateRecorder::OnXmlCdata(std::string_view text, bool escaped,
+				off_t start) noexcept
+{
+	const std::size_t nbytes = handler->OnXmlCdata(text, escaped, start);
+	if (nbytes == 0)
+		return nbytes;
+
+	const off_t end = start + nbytes;
+
+	/* coalesce consecutive CDATA events; the contents are not
+	   recorded, they are taken from the source on replay */
+	if (!skeleton.events.empty() &&
+	    skeleton.events.back().type == XmlTemplateEvent::Type::CDATA) {
+		skeleton.events.back().end = end;
+		return nbytes;
+	}
+
+	auto &e = skeleton.events.emplace_back();
+	e.type = XmlTemplateEvent::Type::CDATA;
+	e.start = start;
+	e.end = end;
+	return nbytes;
+}
+
+bool
+XmlTemplateReplay::Finish() noexcept
+{
+	if (checksum == skeleton.checksum)
+		return true;
+
+	cache.Remove(item);
+	return false;
+}
+
+bool
+XmlTemplateReplay::Replay(XmlParserHandler &handler) const noexcept
+{
+	assert(checksum == skeleton.checksum);
+
+	const char *const data = (const char *)source.data();
+
+	/* did the handler reject the current tag?  Then its
+	   attributes and its "finished" event are skipped */
+	bool skip_tag = false;
+
+	for (const auto &e : skeleton.events) {
+		switch (e.type) {
+		case XmlTemplateEvent::Type::TAG_START:
+			skip_tag = !handler.OnXmlTagStart({
+					.start = e.start,
+					.end = e.end,
+					.name = skeleton.GetName(e),
+					.type = e.tag_type,
+				});
+			break;
+
+		case XmlTemplateEvent::Type::ATTRIBUTE:
+			if (!skip_tag)
+				handler.OnXmlAttributeFinished({
+						.name_start = e.start,
+						.value_start = e.value_start,
+						.value_end = e.value_end,
+						.end = e.end,
+						.name = skeleton.GetName(e),
+						.value = skeleton.GetValue(e),
+					});
+			break;
+
+		case XmlTemplateEvent::Type::TAG_FINISHED:
+			if (!skip_tag &&
+			    !handler.OnXmlTagFinished({
+					    .start = e.start,
+					    .end = e.end,
+					    .name = skeleton.GetName(e),
+					    .type = e.tag_type,
+				    }))
+				return false;
+
+			break;
+
+		case XmlTemplateEvent::Type::CDATA:
+			handler.OnXmlCdata({data + e.start,
+					    std::size_t(e.end - e.start)},
+					   false, e.start);
+			break;
+		}
+	}
+
+	return true;
+}
+
+struct XmlTemplateCache::Item final : CacheItem, LeakDetector {
+	const std::string key;
+
+	const XmlTemplate skeleton;
+
+	Item(const char *_key, std::chrono::steady_clock::time_point now,
+	     XmlTemplate &&_skeleton) noexcept
+		:CacheItem(now, xml_template_cache_max_age,
+			   _skeleton.GetMemoryUsage()),
+		 key(_key),
+		 skeleton(std::move(_skeleton)) {}
+
+	const char *GetKey() const noexcept {
+		return key.c_str();
+	}
+
+	/* virtual methods from class CacheItem */
+	void Destroy() noexcept override {
+		delete this;
+	}
+};
+
+XmlTemplateCache::XmlTemplateCache(EventLoop &event_loop,
+				   std::size_t max_size) noexcept
+	:cache(event_loop, max_size, this) {}
+
+XmlTemplateCache::~XmlTemplateCache() noexcept = default;
+
+const char *
+XmlTemplateCache::MakeKey(AllocatorPtr alloc, const char *tag,
+			  unsigned options, bool container) noexcept
+{
+	char buffer[32];
+	*fmt::format_to_n(buffer, sizeof(buffer) - 1, "{:x}{}",
+			  options, container ? "c"sv : ""sv).out = 0;
+
+	return alloc.Concat(tag, "|processor="sv, buffer);
+}
+
+std::unique_ptr<XmlTemplateReplay>
+XmlTemplateCache::Get(const char *key, off_t length) noexcept
+{
+	auto *item = (Item *)cache.Get(key);
+	if (item == nullptr) {
+		LogConcat(6, "XmlTemplateCache", "miss ", key);
+		++stats.misses;
+		return {};
+	}
+
+	if (item->skeleton.checksum.length != length) {
+		/* the resource was modified without a new ETag;
+		   the recorder will replace this item */
+		LogConcat(4, "XmlTemplateCache", "length mismatch ", key);
+		++stats.misses;
+		return {};
+	}
+
+	LogConcat(5, "XmlTemplateCache", "hit ", key);
+	++stats.hits;
+
+	return std::make_unique<XmlTemplateReplay>(*this, *item,
+						   item->skeleton);
+}
+
+std::unique_ptr<XmlTemplateRecorder>
+XmlTemplateCache::Record(const char *key) noexcept
+{
+	return std::make_unique<XmlTemplateRecorder>(*this, key);
+}
+
+void
+XmlTemplateCache::Put(const char *key, XmlTemplate &&skeleton) noexcept
+{
+	LogConcat(4, "XmlTemplateCache", "add ", key);
+	++stats.stores;
+
+	auto *item = new Item(key, cache.SteadyNow(), std::move(skeleton));
+	cache.Put(item->GetKey(), *item);
+}
+
+void
+XmlTemplateCache::Remove(CacheItem &_item) noexcept
+{
+	auto &item = (Item &)_item;
+	LogConcat(2, "XmlTemplateCache", "checksum mismatch ", item.GetKey());
+	cache.Remove(item);
+}
+
+void
+XmlTemplateCache::OnCacheItemAdded(const CacheItem &item) noexcept
+{
+	stats.allocator.brutto_size += item.GetSize();
+	stats.allocator.netto_size += item.GetSize();
+}
+
+void
+XmlTemplateCache::OnCacheItemRemoved(const CacheItem &item) noexcept
+{
+	stats.allocator.brutto_size -= item.GetSize();
+	stats.allocator.netto_size -= item.GetSize();
+}
@@ -0,0 +1,370 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "parser/XmlParser.hxx"
+#include "stats/CacheStats.hxx"
+#include "util/FNVHash.hxx"
+#include "cache.hxx"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+struct pool;
+class AllocatorPtr;
+class UnusedIstreamPtr;
+class XmlTemplateCache;
+
+/**
+ * One #XmlParser event in a #XmlTemplate.
+ */
+struct XmlTemplateEvent {
+	enum class Type : uint_least8_t {
+		TAG_START,
+		ATTRIBUTE,
+		TAG_FINISHED,
+		CDATA,
+	};
+
+	Type type;
+
+	XmlParserTagType tag_type;
+
+	/**
+	 * The start and end offset of the tag, the attribute or the
+	 * CDATA range.  For #TAG_START, the end offset is not yet
+	 * known and equals the start offset.
+	 */
+	off_t start, end;
+
+	/**
+	 * The offsets of the attribute value (only #ATTRIBUTE).
+	 */
+	off_t value_start, value_end;
+
+	/**
+	 * Tag/attribute name and attribute value, stored as
+	 * positions within #XmlTemplate::strings.
+	 */
+	uint_least32_t name, name_length, value, value_length;
+};
+
+/**
+ * Identifies the source document of a #XmlTemplate.  The ETag alone
+ * is not trusted, because replaying offsets over different bytes
+ * would produce garbage.
+ */
+struct XmlTemplateChecksum {
+	using Algorithm = FNV1aAlgorithm<FNVTraits<uint64_t>>;
+
+	off_t length = 0;
+
+	uint64_t hash = FNVTraits<uint64_t>::OFFSET_BASIS;
+
+	void Update(std::span<const std::byte> src) noexcept {
+		length += src.size();
+		hash = Algorithm::BinaryHash(src, hash);
+	}
+
+	constexpr bool operator==(const XmlTemplateChecksum &) const noexcept = default;
+};
+
+/**
+ * The parsed skeleton of a template: all #XmlParser events which
+ * were accepted by the #XmlProcessor.  Replaying them (instead of
+ * running the #XmlParser again) yields the same substitutions as
+ * long as the source document and the processor options are the
+ * same.
+ */
+struct XmlTemplate {
+	std::vector<XmlTemplateEvent> events;
+
+	/**
+	 * All tag/attribute names and attribute values, referred to by
+	 * #XmlTemplateEvent.
+	 */
+	std::string strings;
+
+	/**
+	 * Indexes of the "type" #XmlTemplateEvent::Type::ATTRIBUTE
+	 * events of all "c:widget" elements, without duplicate
+	 * values.  This allows looking up all widget classes before
+	 * the elements are replayed.
+	 */
+	std::vector<uint_least32_t> widget_types;
+
+	/**
+	 * The checksum of the raw source document.
+	 */
+	XmlTemplateChecksum checksum;
+
+	std::string_view GetName(const XmlTemplateEvent &e) const noexcept {
+		return std::string_view{strings}.substr(e.name, e.name_length);
+	}
+
+	std::string_view GetValue(const XmlTemplateEvent &e) const noexcept {
+		return std::string_view{strings}.substr(e.value, e.value_length);
+	}
+
+	[[gnu::pure]]
+	std::size_t GetMemoryUsage() const noexcept {
+		return sizeof(*this) +
+			events.capacity() * sizeof(events.front()) +
+			strings.capacity() +
+			widget_types.capacity() * sizeof(widget_types.front());
+	}
+};
+
+/**
+ * An #XmlParserHandler decorator which records the events which were
+ * accepted by the real handler.  After the whole document has been
+ * parsed, Commit() stores the #XmlTemplate in the #XmlTemplateCache.
+ */
+class XmlTemplateRecorder final : public XmlParserHandler {
+	XmlTemplateCache &cache;
+
+	const std::string key;
+
+	XmlParserHandler *handler = nullptr;
+
+	XmlTemplate skeleton;
+
+	/**
+	 * Has the entity scanner found a "&c:" entity?  Those are
+	 * expanded by the text processor with request-specific
+	 * values, which shifts all offsets.
+	 */
+	bool has_entities = false;
+
+	/**
+	 * Is the current tag a "c:widget" element accepted by the
+	 * handler?
+	 */
+	bool in_widget_tag = false;
+
+	/**
+	 * Was Abort() called?
+	 */
+	bool aborted = false;
+
+public:
+	XmlTemplateRecorder(XmlTemplateCache &_cache,
+			    const char *_key) noexcept
+		:cache(_cache), key(_key) {}
+
+	void SetHandler(XmlParserHandler &_handler) noexcept {
+		handler = &_handler;
+	}
+
+	/**
+	 * Wrap the raw (not yet text-processed) template in an
+	 * #Istream which looks for "&c:" entities and calculates the
+	 * #XmlTemplateChecksum.
+	 */
+	UnusedIstreamPtr ScanEntities(struct pool &pool,
+				      UnusedIstreamPtr input) noexcept;
+
+	/**
+	 * The template is not cacheable (e.g. because the processor
+	 * has fed "style" element contents into the CSS processor).
+	 */
+	void Abort() noexcept {
+		aborted = true;
+	}
+
+	/**
+	 * The whole template has been parsed; store it in the cache
+	 * (unless it turned out to be uncacheable).
+	 */
+	void Commit() noexcept;
+
+private:
+	uint_least32_t AppendString(std::string_view s) noexcept {
+		const auto position = skeleton.strings.size();
+		skeleton.strings.append(s);
+		return position;
+	}
+
+	XmlTemplateEvent &AppendTag(XmlTemplateEvent::Type type,
+				    const XmlParserTag &tag) noexcept;
+
+	void AddWidgetType(std::size_t i) noexcept;
+
+	/* virtual methods from class XmlParserHandler */
+	bool OnXmlTagStart(const XmlParserTag &tag) noexcept override;
+	bool OnXmlTagFinished(const XmlParserTag &tag) noexcept override;
+	void OnXmlAttributeFinished(const XmlParserAttribute &attr) noexcept override;
+	size_t OnXmlCdata(std::string_view text, bool escaped,
+			  off_t start) noexcept override;
+};
+
+/**
+ * Feeds the events of a cached #XmlTemplate into an
+ * #XmlParserHandler, replacing the #XmlParser.
+ *
+ * The source document is collected first, and the events are
+ * dispatched only after its checksum has been verified; a document
+ * which was modified without a new ETag (but with the same length)
+ * must never produce output based on the wrong offsets.
+ */
+class XmlTemplateReplay final {
+	XmlTemplateCache &cache;
+
+	CacheItem &item;
+
+	/**
+	 * Keeps the #XmlTemplateCache item alive.
+	 */
+	const SharedLease lease;
+
+	const XmlTemplate &skeleton;
+
+	/**
+	 * The source bytes received so far.
+	 */
+	std::vector<std::byte> source;
+
+	/**
+	 * The checksum of #source.
+	 */
+	XmlTemplateChecksum checksum;
+
+public:
+	XmlTemplateReplay(XmlTemplateCache &_cache, CacheItem &_item,
+			  const XmlTemplate &_skeleton) noexcept
+		:cache(_cache), item(_item),
+		 lease(_item), skeleton(_skeleton)
+	{
+		source.reserve(skeleton.checksum.length);
+	}
+
+	/**
+	 * Collect another chunk of the source document.
+	 */
+	void Feed(std::span<const std::byte> src) noexcept {
+		source.insert(source.end(), src.begin(), src.end());
+		checksum.Update(src);
+	}
+
+	/**
+	 * The whole source document has been fed.  If it was not the
+	 * one the template was recorded from (the length matched, but
+	 * the contents did not), the template is removed from the
+	 * cache, and the caller must parse the source instead of
+	 * calling Replay().
+	 *
+	 * @return true if the source matched
+	 */
+	bool Finish() noexcept;
+
+	/**
+	 * Dispatch all events.  Call this only after Finish() has
+	 * returned true.
+	 *
+	 * @return false if the handler has been destroyed
+	 */
+	bool Replay(XmlParserHandler &handler) const noexcept;
+
+	/**
+	 * Take the source document collected by Feed() (e.g. to
+	 * parse it after Finish() has returned false).
+	 */
+	std::vector<std::byte> ReleaseSource() noexcept {
+		return std::move(source);
+	}
+
+	/**
+	 * Invoke the function for each distinct widget class name
+	 * which occurs in the template (as std::string_view).
+	 */
+	template<typename F>
+	void ForEachWidgetType(F &&f) const noexcept {
+		for (const auto i : skeleton.widget_types)
+			f(skeleton.GetValue(skeleton.events[i]));
+	}
+};
+
+/**
+ * A cache for parsed templates (#XmlTemplate), keyed by resource tag
+ * and processor options.  This allows the #XmlProcessor to skip the
+ * #XmlParser for templates which have been processed before.
+ */
+class XmlTemplateCache final : CacheHandler {
+	CacheStats stats{};
+
+	Cache cache;
+
+	struct Item;
+
+public:
+	XmlTemplateCache(EventLoop &event_loop, std::size_t max_size) noexcept;
+	~XmlTemplateCache() noexcept;
+
+	XmlTemplateCache(const XmlTemplateCache &) = delete;
+	XmlTemplateCache &operator=(const XmlTemplateCache &) = delete;
+
+	CacheStats GetStats() const noexcept {
+		return stats;
+	}
+
+	void Flush() noexcept {
+		cache.Flush();
+	}
+
+	/**
+	 * Build a cache key.
+	 *
+	 * @param tag the resource tag including a strong ETag (see
+	 * resource_tag_append_etag())
+	 * @param container is a widget registry available (i.e. will
+	 * "c:widget" elements be handled)?
+	 */
+	static const char *MakeKey(AllocatorPtr alloc, const char *tag,
+				   unsigned options, bool container) noexcept;
+
+	/**
+	 * Look up a template.
+	 *
+	 * @param length the length of the source document; a
+	 * template recorded from a document with a different length
+	 * is not replayed
+	 * @return a replay object or nullptr on cache miss
+	 */
+	std::unique_ptr<XmlTemplateReplay> Get(const char *key,
+					       off_t length) noexcept;
+
+	/**
+	 * Create a recorder which will store the template after it has
+	 * been parsed.  Call this after a cache miss.
+	 */
+	std::unique_ptr<XmlTemplateRecorder> Record(const char *key) noexcept;
+
+	/**
+	 * Called by XmlTemplateRecorder::Commit().
+	 */
+	void Put(const char *key, XmlTemplate &&skeleton) noexcept;
+
+	/**
+	 * Called by XmlTemplateRecorder::Commit() if the template was
+	 * not cacheable.
+	 */
+	void Skip() noexcept {
+		++stats.skips;
+	}
+
+	/**
+	 * Called by XmlTemplateReplay::Finish() if the source
+	 * document did not match the template.
+	 */
+	void Remove(CacheItem &item) noexcept;
+
+private:
+	/* virtual methods from class CacheHandler */
+	void OnCacheItemAdded(const CacheItem &item) noexcept override;
+	void OnCacheItemRemoved(const CacheItem &item) noexcept override;
+};
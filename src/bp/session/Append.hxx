@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Serialize session records into a memory buffer.
+ */
+
+#pragma once
+
+#include "io/BufferedOutputStream.hxx"
+#include "io/OutputStream.hxx"
+#include "io/Logger.hxx"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+class VectorOutputStream final : public OutputStream {
+	std::vector<std::byte> &dest;
+
+public:
+	explicit VectorOutputStream(std::vector<std::byte> &_dest) noexcept
+		:dest(_dest) {}
+
+	/* virtual methods from class OutputStream */
+	void Write(std::span<const std::byte> src) override {
+		dest.insert(dest.end(), src.begin(), src.end());
+	}
+};
+
+/**
+ * Serialize one record (by invoking the given function with a
+ * #BufferedOutputStream) and append it to the given buffer.  On
+ * error, the buffer is left unmodified and the error is logged.
+ *
+ * @return true on success, false on error
+ */
+template<typename F>
+bool
+AppendSessionRecord(std::vector<std::byte> &dest, F &&f) noexcept
+{
+	const std::size_t old_size = dest.size();
+
+	try {
+		VectorOutputStream os{dest};
+		WithBufferedOutputStream(os, std::forward<F>(f));
+		return true;
+	} catch (...) {
+		dest.resize(old_size);
+		LogConcat(2, "SessionManager", "Failed to serialize session: ",
+			  std::current_exception());
+		return false;
+	}
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Changes.hxx"
+#include "Append.hxx"
+#include "Write.hxx"
+#include "File.hxx"
+#include "Manager.hxx"
+#include "stats/EventLoopProfiler.hxx"
+
+SessionChanges::SessionChanges(EventLoop &event_loop,
+			       SessionManager &_manager) noexcept
+	:manager(_manager),
+	 timer(event_loop, BIND_THIS_METHOD(OnTimer)) {}
+
+void
+SessionChanges::AddHandler(SessionChangesHandler &handler) noexcept
+{
+	handlers.push_front(&handler);
+
+	manager.EnableChangeTracking();
+	if (!timer.IsPending())
+		timer.Schedule(flush_interval);
+}
+
+void
+SessionChanges::Flush() noexcept
+{
+	buffer.clear();
+	ends.clear();
+
+	manager.ConsumeChanges([this](const Session &session){
+		if (AppendSessionRecord(buffer, [&session](BufferedOutputStream &os){
+			session_write_magic(os, MAGIC_SESSION);
+			session_write(os, &session);
+		}))
+			ends.push_back(buffer.size());
+	}, [this](const SessionId &id){
+		if (AppendSessionRecord(buffer, [&id](BufferedOutputStream &os){
+			session_write_erase(os, id);
+		}))
+			ends.push_back(buffer.size());
+	});
+
+	if (buffer.empty())
+		/* nothing was modified */
+		return;
+
+	for (auto *handler : handlers)
+		handler->OnSessionChanges(buffer, ends);
+}
+
+static EventLoopCallbackSite flush_site{"session_changes", EventLoopCallbackType::TIMER};
+
+inline void
+SessionChanges::OnTimer() noexcept
+{
+	const EventLoopCallbackScope scope{flush_site};
+
+	Flush();
+	timer.Schedule(flush_interval);
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "event/CoarseTimerEvent.hxx"
+
+#include <cstddef>
+#include <forward_list>
+#include <span>
+#include <vector>
+
+class SessionManager;
+
+class SessionChangesHandler {
+public:
+	/**
+	 * @param records serialized #MAGIC_SESSION and
+	 * #MAGIC_ERASE_SESSION records (the session journal format)
+	 * @param ends the end offset of each record within
+	 * #records (in ascending order; the last one equals
+	 * records.size())
+	 */
+	virtual void OnSessionChanges(std::span<const std::byte> records,
+				      std::span<const std::size_t> ends) noexcept = 0;
+};
+
+/**
+ * Collects the sessions which were modified or erased, and every
+ * few seconds passes them (serialized as session journal records)
+ * to all registered handlers.  The sessions are serialized only
+ * once, no matter how many handlers there are.
+ */
+class SessionChanges final {
+	/**
+	 * Changes are collected for this long.  This is the maximum
+	 * amount of changes lost on a crash.
+	 */
+	static constexpr Event::Duration flush_interval = std::chrono::seconds(2);
+
+	SessionManager &manager;
+
+	CoarseTimerEvent timer;
+
+	std::forward_list<SessionChangesHandler *> handlers;
+
+	std::vector<std::byte> buffer;
+
+	/**
+	 * The end offset of each record in #buffer.
+	 */
+	std::vector<std::size_t> ends;
+
+public:
+	SessionChanges(EventLoop &event_loop, SessionManager &_manager) noexcept;
+
+	SessionChanges(const SessionChanges &) = delete;
+	SessionChanges &operator=(const SessionChanges &) = delete;
+
+	void AddHandler(SessionChangesHandler &handler) noexcept;
+
+	/**
+	 * Pass all pending changes to the handlers now.
+	 */
+	void Flush() noexcept;
+
+private:
+	void OnTimer() noexcept;
+};
@@ -10,8 +10,10 @@
 
 #include <stdint.h>
 
-static constexpr uint32_t MAGIC_FILE = 2461362039;
+static constexpr uint32_t MAGIC_FILE = 2461362041;
+static constexpr uint32_t MAGIC_JOURNAL_FILE = 2461362042;
 static constexpr uint32_t MAGIC_SESSION = 663845835;
+static constexpr uint32_t MAGIC_ERASE_SESSION = 663845836;
 static constexpr uint32_t MAGIC_REALM_SESSION = 983957474;
 static constexpr uint32_t MAGIC_REALM_SESSION_OLD = 983957473;
 static constexpr uint32_t MAGIC_WIDGET_SESSION = 983957472;
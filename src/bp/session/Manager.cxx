@@ -4,6 +4,7 @@
 
 #include "Manager.hxx"
 #include "Lease.hxx"
+#include "stats/EventLoopProfiler.hxx"
 #include "io/Logger.hxx"
 #include "system/Seed.hxx"
 #include "util/DeleteDisposer.hxx"
@@ -46,13 +47,20 @@ SessionManager::EraseAndDispose(Session &session)
 {
 	assert(!sessions.empty());
 
+	if (track_changes)
+		erased_sessions.push_back(session.id);
+
 	auto i = sessions.iterator_to(session);
 	sessions.erase_and_dispose(i, DeleteDisposer{});
 }
 
+static EventLoopCallbackSite cleanup_site{"session_cleanup", EventLoopCallbackType::TIMER};
+
 void
 SessionManager::Cleanup() noexcept
 {
+	const EventLoopCallbackScope scope{cleanup_site};
+
 	const Expiry now = Expiry::Now();
 
 	sessions.remove_and_dispose_if([now](const Session &session){
@@ -104,6 +112,16 @@ SessionManager::AdjustNewSessionId(SessionId &id) const noexcept
 
 void
 SessionManager::Insert(Session &session) noexcept
+{
+	sessions.insert(session);
+	MarkDirty(session);
+
+	if (!cleanup_timer.IsPending())
+		cleanup_timer.Schedule(cleanup_interval);
+}
+
+void
+SessionManager::InsertUnmodified(Session &session) noexcept
 {
 	sessions.insert(session);
 
@@ -245,10 +263,21 @@ SessionManager::Attach(RealmSessionLease lease, std::string_view realm,
 	}
 }
 
+const Session *
+SessionManager::Get(SessionId id) const noexcept
+{
+	auto i = sessions.find(id);
+	if (i == sessions.end() || i->expires.IsExpired(Expiry::Now()))
+		return nullptr;
+
+	return &*i;
+}
+
 void
 SessionManager::Put(Session &session) noexcept
 {
-	(void)session;
+	/* the lease holder may have modified the session */
+	MarkDirty(session);
 }
 
 void
@@ -271,6 +300,8 @@ SessionManager::DiscardRealmSession(SessionId id, std::string_view realm_name) n
 
 	if (i->realms.empty())
 		EraseAndDispose(*i);
+	else
+		MarkDirty(*i);
 }
 
 void
@@ -8,9 +8,12 @@
 #include "Prng.hxx"
 #include "event/FarTimerEvent.hxx"
 #include "util/IntrusiveHashSet.hxx"
+#include "util/IntrusiveList.hxx"
 
+#include <cassert>
 #include <chrono>
 #include <random>
+#include <vector>
 
 class SessionId;
 class SessionLease;
@@ -83,6 +86,26 @@ class SessionManager {
 
 	FarTimerEvent cleanup_timer;
 
+	/**
+	 * Sessions which have been modified since the last
+	 * ConsumeChanges() call.
+	 */
+	IntrusiveList<Session,
+		      IntrusiveListMemberHookTraits<&Session::dirty_hook>> dirty_sessions;
+
+	/**
+	 * Sessions which have been erased explicitly (i.e. not
+	 * because they expired) since the last ConsumeChanges()
+	 * call.
+	 */
+	std::vector<SessionId> erased_sessions;
+
+	/**
+	 * Fill #dirty_sessions and #erased_sessions?  This is only
+	 * enabled if somebody calls ConsumeChanges() regularly.
+	 */
+	bool track_changes = false;
+
 public:
 	SessionManager(EventLoop &event_loop, std::chrono::seconds idle_timeout,
 		       unsigned _cluster_size, unsigned _cluster_node) noexcept;
@@ -124,6 +147,42 @@ public:
 	[[gnu::pure]]
 	SessionLease Find(SessionId id) noexcept;
 
+	/**
+	 * Look up a session without touching it, e.g. for saving it.
+	 * Returns nullptr if no such session exists or if it is
+	 * expired.
+	 */
+	[[gnu::pure]]
+	const Session *Get(SessionId id) const noexcept;
+
+	/**
+	 * Start tracking modified and erased sessions.
+	 */
+	void EnableChangeTracking() noexcept {
+		track_changes = true;
+	}
+
+	/**
+	 * Invoke the callbacks for each session which has been
+	 * modified (with a const Session reference) and for each one
+	 * which has been erased (with its SessionId) since the last
+	 * call, and forget about them.
+	 */
+	template<typename M, typename E>
+	void ConsumeChanges(M &&modified, E &&erased) {
+		assert(track_changes);
+
+		for (const auto &id : erased_sessions)
+			erased(id);
+		erased_sessions.clear();
+
+		const Expiry now = Expiry::Now();
+		dirty_sessions.clear_and_dispose([now, &modified](Session *session){
+			if (!session->expires.IsExpired(now))
+				modified(*session);
+		});
+	}
+
 	/**
 	 * Attach the given session to an existing session with the
 	 * given #attach value.  If no such session exists already,
@@ -166,9 +225,45 @@ public:
 
 	bool Load(BufferedReader &r);
 
+	/**
+	 * Apply a session journal (see #SessionPersist) on top of the
+	 * sessions loaded previously.
+	 *
+	 * Throws on error (e.g. if the last record is truncated); all
+	 * records before the error have been applied.
+	 */
+	void LoadJournal(BufferedReader &r);
+
+	/**
+	 * Apply session journal records (see #SessionChangesHandler)
+	 * until the end of the input.  Unlike Insert(), this does not
+	 * mark the sessions as modified, so they will not be reported
+	 * by ConsumeChanges().  A session record is ignored if the
+	 * local copy has the same or a newer Session::version (e.g.
+	 * because this node has adopted the session and modified it
+	 * after the other node had sent it).
+	 *
+	 * Throws on error.
+	 */
+	void ApplyRecords(BufferedReader &r);
+
 private:
 	void SeedPrng();
 
 	SessionId GenerateSessionId() noexcept;
 	void EraseAndDispose(Session &session);
+
+	/**
+	 * Add a session which was loaded from a file or received
+	 * from another node.  Unlike Insert(), this neither marks it
+	 * as modified nor changes its version.
+	 */
+	void InsertUnmodified(Session &session) noexcept;
+
+	void MarkDirty(Session &session) noexcept {
+		++session.version;
+
+		if (track_changes && !session.dirty_hook.is_linked())
+			dirty_sessions.push_back(session);
+	}
 };
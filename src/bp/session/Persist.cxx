@@ -0,0 +1,466 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Persist.hxx"
+#include "Append.hxx"
+#include "Save.hxx"
+#include "Write.hxx"
+#include "File.hxx"
+#include "Manager.hxx"
+#include "Session.hxx"
+#include "stats/EventLoopProfiler.hxx"
+#include "thread/Queue.hxx"
+#include "thread/Job.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "io/FdOutputStream.hxx"
+#include "io/FileWriter.hxx"
+#include "io/Logger.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <exception>
+#include <utility>
+
+#include <fcntl.h>
+#include <stdio.h> // for rename()
+#include <sys/stat.h>
+#include <unistd.h>
+
+[[gnu::pure]]
+static uint_least64_t
+GetFileSize(const char *path) noexcept
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+/**
+ * Executes #SessionPersist::Operation instances in a worker thread
+ * and owns all files.
+ */
+class SessionPersist::Worker final : public ThreadJob {
+	/**
+	 * The owner; nullptr if it has been destroyed while this job
+	 * was still queued or running.  In that case, Done() deletes
+	 * this object.
+	 */
+	SessionPersist *persist;
+
+	const std::string snapshot_path, journal_path, old_journal_path;
+
+	UniqueFileDescriptor journal_fd;
+
+	std::unique_ptr<FileWriter> snapshot_writer;
+
+public:
+	/**
+	 * Operations being executed by the worker thread.  Only the
+	 * thread may access this while the job is queued; it clears
+	 * the vector when it is done.
+	 */
+	std::vector<Operation> running;
+
+	/**
+	 * The number of bytes written to #snapshot_writer.
+	 */
+	uint_least64_t snapshot_writer_size = 0;
+
+	/**
+	 * Set by COMMIT_SNAPSHOT; evaluated (and cleared) by
+	 * SessionPersist::OnWorkerDone().
+	 */
+	bool committed = false;
+
+	std::exception_ptr error;
+
+	explicit Worker(SessionPersist &_persist) noexcept
+		:persist(&_persist),
+		 snapshot_path(_persist.snapshot_path),
+		 journal_path(_persist.journal_path),
+		 old_journal_path(_persist.old_journal_path) {}
+
+	/**
+	 * The owner is about to be destroyed, but the #ThreadQueue
+	 * still references this object.  Let Done() delete it.
+	 */
+	void PostponeDestroy() noexcept {
+		assert(persist != nullptr);
+		persist = nullptr;
+	}
+
+	/**
+	 * Close all files; an unfinished snapshot is discarded.
+	 */
+	void Close() noexcept {
+		journal_fd.Close();
+		snapshot_writer.reset();
+	}
+
+	/**
+	 * Execute all given operations, storing the first error in
+	 * #error.
+	 */
+	void ExecuteAll(const std::vector<Operation> &operations) noexcept;
+
+private:
+	void OpenJournal();
+
+	/**
+	 * Execute the given operation; called in the worker thread
+	 * (or by SessionPersist::Shutdown()).
+	 *
+	 * Throws on error.
+	 */
+	void Execute(const Operation &operation);
+
+	/* virtual methods from class ThreadJob */
+	void Run() noexcept override {
+		ExecuteAll(running);
+		running.clear();
+	}
+
+	void Done() noexcept override {
+		if (persist == nullptr) {
+			delete this;
+			return;
+		}
+
+		persist->OnWorkerDone();
+	}
+};
+
+SessionPersist::SessionPersist(SessionManager &_manager, ThreadQueue &_queue,
+			       const char *_path) noexcept
+	:manager(_manager), queue(_queue),
+	 snapshot_path(_path),
+	 journal_path(snapshot_path + ".journal"),
+	 old_journal_path(journal_path + ".old"),
+	 snapshot_event(queue.GetEventLoop(), BIND_THIS_METHOD(OnSnapshotChunk)),
+	 worker(std::make_unique<Worker>(*this))
+{
+	session_load(manager, snapshot_path.c_str());
+	session_load_journal(manager, old_journal_path.c_str());
+	session_load_journal(manager, journal_path.c_str());
+
+	/* merge everything into a fresh snapshot, so the new
+	   journal can start empty; if that fails, new records are
+	   appended to the existing journal */
+	if (session_save(manager, snapshot_path.c_str())) {
+		unlink(old_journal_path.c_str());
+		unlink(journal_path.c_str());
+	} else
+		journal_size = GetFileSize(journal_path.c_str());
+
+	snapshot_size = GetFileSize(snapshot_path.c_str());
+}
+
+SessionPersist::~SessionPersist() noexcept
+{
+	if (busy && !queue.Cancel(*worker))
+		/* the worker thread is still running it (or Done() is
+		   pending) */
+		worker.release()->PostponeDestroy();
+}
+
+void
+SessionPersist::Shutdown() noexcept
+{
+	snapshot_event.Cancel();
+
+	if (busy) {
+		busy = false;
+
+		if (queue.Cancel(*worker)) {
+			/* the worker threads have been stopped before
+			   our job was started; do it now */
+			worker->ExecuteAll(worker->running);
+			worker->running.clear();
+		} else {
+			/* the job has been executed already, but its
+			   Done() call is still pending; it must not
+			   call us anymore, so let it go and continue
+			   with a new Worker */
+			if (worker->error)
+				LogConcat(2, "SessionManager", "Failed to save sessions: ",
+					  std::exchange(worker->error, {}));
+
+			worker.release()->PostponeDestroy();
+			worker = std::make_unique<Worker>(*this);
+		}
+	}
+
+	/* abandon the compaction; a full snapshot is about to be
+	   written */
+	snapshot_ids.clear();
+	compacting = false;
+	std::erase_if(pending, [](const Operation &i){
+		return i.type != Operation::Type::APPEND_JOURNAL;
+	});
+
+	if (session_save(manager, snapshot_path.c_str())) {
+		/* the snapshot contains everything; the journals are
+		   obsolete */
+		worker->Close();
+		unlink(old_journal_path.c_str());
+		unlink(journal_path.c_str());
+		return;
+	}
+
+	/* the snapshot has failed; the remaining changes are
+	   appended to the journal instead */
+	worker->ExecuteAll(pending);
+	pending.clear();
+
+	if (worker->error)
+		LogConcat(1, "SessionManager", "Failed to save sessions: ",
+			  std::exchange(worker->error, {}));
+}
+
+std::vector<std::byte> &
+SessionPersist::AddOperation(Operation::Type type) noexcept
+{
+	if ((type == Operation::Type::APPEND_JOURNAL ||
+	     type == Operation::Type::APPEND_SNAPSHOT) &&
+	    !pending.empty() && pending.back().type == type)
+		return pending.back().data;
+
+	return pending.emplace_back(Operation{type, {}}).data;
+}
+
+void
+SessionPersist::Submit() noexcept
+{
+	if (busy || pending.empty())
+		return;
+
+	assert(worker->running.empty());
+
+	worker->running = std::exchange(pending, {});
+	pending_snapshot_size = 0;
+	busy = true;
+	queue.Add(*worker);
+}
+
+void
+SessionPersist::StartCompaction() noexcept
+{
+	assert(!compacting);
+	assert(snapshot_ids.empty());
+
+	compacting = true;
+
+	/* all changes until now (the caller has just appended them)
+	   are in the old journal; all changes after this point go to
+	   the new journal, and will be replayed on top of the new
+	   snapshot */
+	AddOperation(Operation::Type::ROTATE_JOURNAL);
+	journal_size = 0;
+
+	AddOperation(Operation::Type::BEGIN_SNAPSHOT);
+	AppendSessionRecord(AddOperation(Operation::Type::APPEND_SNAPSHOT),
+		     [](BufferedOutputStream &os){
+			     session_write_file_header(os);
+		     });
+
+	/* only the ids are collected right now; the sessions are
+	   serialized chunk by chunk in OnSnapshotChunk() */
+	snapshot_ids.reserve(manager.Count());
+	manager.Visit([](const Session *session, void *ctx){
+		auto &ids = *(std::vector<SessionId> *)ctx;
+		ids.push_back(session->id);
+	}, &snapshot_ids);
+
+	snapshot_event.Schedule();
+}
+
+void
+SessionPersist::OnSessionChanges(std::span<const std::byte> records,
+				 std::span<const std::size_t>) noexcept
+{
+	auto &data = AddOperation(Operation::Type::APPEND_JOURNAL);
+	data.insert(data.end(), records.begin(), records.end());
+	journal_size += records.size();
+
+	if (!compacting &&
+	    journal_size > std::max(snapshot_size, min_compact_size))
+		StartCompaction();
+
+	Submit();
+}
+
+static EventLoopCallbackSite snapshot_site{"session_snapshot", EventLoopCallbackType::DEFER};
+
+inline void
+SessionPersist::OnSnapshotChunk() noexcept
+{
+	const EventLoopCallbackScope scope{snapshot_site};
+
+	assert(compacting);
+
+	if (pending_snapshot_size >= max_pending_snapshot)
+		/* wait for the worker thread to catch up; Done() will
+		   resume */
+		return;
+
+	auto &data = AddOperation(Operation::Type::APPEND_SNAPSHOT);
+	const std::size_t old_size = data.size();
+
+	for (std::size_t n = 0;
+	     n < snapshot_chunk_size && !snapshot_ids.empty(); ++n) {
+		const auto id = snapshot_ids.back();
+		snapshot_ids.pop_back();
+
+		/* sessions which were erased meanwhile are skipped;
+		   those which were modified meanwhile will also be
+		   in the new journal */
+		const auto *session = manager.Get(id);
+		if (session == nullptr)
+			continue;
+
+		AppendSessionRecord(data, [session](BufferedOutputStream &os){
+			session_write_magic(os, MAGIC_SESSION);
+			session_write(os, session);
+		});
+	}
+
+	const bool finished = snapshot_ids.empty();
+	if (finished)
+		AppendSessionRecord(data, [](BufferedOutputStream &os){
+			session_write_file_tail(os);
+		});
+
+	pending_snapshot_size += data.size() - old_size;
+
+	if (finished)
+		AddOperation(Operation::Type::COMMIT_SNAPSHOT);
+	else
+		snapshot_event.Schedule();
+
+	Submit();
+}
+
+void
+SessionPersist::Worker::OpenJournal()
+{
+	if (!journal_fd.Open(journal_path.c_str(),
+			     O_WRONLY|O_CREAT|O_APPEND, 0600))
+		throw FmtErrno("Failed to open {}", journal_path);
+
+	if (journal_fd.GetSize() == 0) {
+		FdOutputStream fos(journal_fd);
+		WithBufferedOutputStream(fos, [](BufferedOutputStream &os){
+			session_write_journal_header(os);
+		});
+	}
+}
+
+void
+SessionPersist::Worker::Execute(const Operation &operation)
+{
+	switch (operation.type) {
+	case Operation::Type::APPEND_JOURNAL:
+		if (!journal_fd.IsDefined())
+			OpenJournal();
+
+		FdOutputStream(journal_fd).Write(operation.data);
+		break;
+
+	case Operation::Type::ROTATE_JOURNAL:
+		journal_fd.Close();
+
+		/* if an older "*.journal.old" exists (because the
+		   previous compaction has failed), keep it and keep
+		   appending to the current journal; both will be
+		   replayed, and COMMIT_SNAPSHOT deletes the old one */
+		if (access(old_journal_path.c_str(), F_OK) != 0 &&
+		    rename(journal_path.c_str(), old_journal_path.c_str()) < 0 &&
+		    errno != ENOENT)
+			throw FmtErrno("Failed to rename {}", journal_path);
+
+		break;
+
+	case Operation::Type::BEGIN_SNAPSHOT:
+		snapshot_writer.reset();
+		snapshot_writer = std::make_unique<FileWriter>(snapshot_path.c_str(),
+							       0600);
+		snapshot_writer_size = 0;
+		break;
+
+	case Operation::Type::APPEND_SNAPSHOT:
+		if (!snapshot_writer)
+			/* BEGIN_SNAPSHOT has failed */
+			break;
+
+		FdOutputStream(snapshot_writer->GetFileDescriptor())
+			.Write(operation.data);
+		snapshot_writer_size += operation.data.size();
+		break;
+
+	case Operation::Type::COMMIT_SNAPSHOT:
+		committed = true;
+
+		if (!snapshot_writer)
+			break;
+
+		std::exchange(snapshot_writer, {})->Commit();
+
+		/* the new snapshot contains everything from
+		   "*.journal.old", no matter whether this compaction
+		   has created it or an earlier one */
+		if (unlink(old_journal_path.c_str()) < 0 &&
+		    errno != ENOENT)
+			throw FmtErrno("Failed to delete {}", old_journal_path);
+
+		break;
+	}
+}
+
+void
+SessionPersist::Worker::ExecuteAll(const std::vector<Operation> &operations) noexcept
+{
+	for (const auto &i : operations) {
+		try {
+			Execute(i);
+		} catch (...) {
+			if (i.type == Operation::Type::BEGIN_SNAPSHOT ||
+			    i.type == Operation::Type::APPEND_SNAPSHOT ||
+			    i.type == Operation::Type::COMMIT_SNAPSHOT)
+				/* discard the incomplete snapshot */
+				snapshot_writer.reset();
+
+			if (!error)
+				error = std::current_exception();
+		}
+	}
+
+	if (journal_fd.IsDefined())
+		/* make sure the journal survives a power failure */
+		fdatasync(journal_fd.Get());
+}
+
+void
+SessionPersist::OnWorkerDone() noexcept
+{
+	assert(busy);
+	assert(worker->running.empty());
+
+	busy = false;
+
+	if (worker->error)
+		LogConcat(2, "SessionManager", "Failed to save sessions: ",
+			  std::exchange(worker->error, {}));
+
+	if (std::exchange(worker->committed, false)) {
+		compacting = false;
+		snapshot_size = worker->snapshot_writer_size;
+	} else if (compacting && !snapshot_ids.empty())
+		/* resume if OnSnapshotChunk() has been waiting for
+		   us */
+		snapshot_event.Schedule();
+
+	Submit();
+}
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "Id.hxx"
+#include "Changes.hxx"
+#include "event/DeferEvent.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SessionManager;
+class ThreadQueue;
+
+/**
+ * Saves sessions incrementally.  Modified (and erased) sessions
+ * reported by #SessionChanges are appended to a journal file.  When
+ * the journal grows too large, it is compacted into a new snapshot
+ * file; that snapshot is generated in small chunks spread
+ * over many event loop iterations.  All file I/O happens in a
+ * #ThreadQueue worker thread, so the main thread never blocks on
+ * the disk.
+ *
+ * A compaction begins by renaming the journal to "*.journal.old",
+ * which is deleted after the new snapshot has been committed.  On
+ * startup, the snapshot is loaded, then "*.journal.old" (if a
+ * compaction was interrupted) and finally the current journal are
+ * replayed.
+ */
+class SessionPersist final : public SessionChangesHandler {
+	/**
+	 * The number of sessions serialized per event loop
+	 * iteration while generating a new snapshot.
+	 */
+	static constexpr std::size_t snapshot_chunk_size = 1024;
+
+	/**
+	 * Pause generating the snapshot while this many bytes are
+	 * waiting for the worker thread.
+	 */
+	static constexpr std::size_t max_pending_snapshot = 4 * 1024 * 1024;
+
+	/**
+	 * Compact the journal when it is larger than the snapshot,
+	 * but not before it reaches this size.
+	 */
+	static constexpr uint_least64_t min_compact_size = 16 * 1024 * 1024;
+
+	struct Operation {
+		enum class Type {
+			/**
+			 * Append #data to the journal.
+			 */
+			APPEND_JOURNAL,
+
+			/**
+			 * Move the journal to "*.journal.old" and
+			 * start a new one.
+			 */
+			ROTATE_JOURNAL,
+
+			/**
+			 * Start writing a new snapshot file (a
+			 * temporary file).
+			 */
+			BEGIN_SNAPSHOT,
+
+			/**
+			 * Append #data to the new snapshot.
+			 */
+			APPEND_SNAPSHOT,
+
+			/**
+			 * Replace the snapshot file with the new
+			 * one and delete "*.journal.old" (even if it
+			 * was left over by an earlier compaction
+			 * which could not rotate the journal).
+			 */
+			COMMIT_SNAPSHOT,
+		} type;
+
+		std::vector<std::byte> data;
+	};
+
+	/**
+	 * The part which runs in the worker thread.
+	 */
+	class Worker;
+
+	SessionManager &manager;
+
+	ThreadQueue &queue;
+
+	const std::string snapshot_path, journal_path, old_journal_path;
+
+	/**
+	 * Generates the next chunk of the snapshot.
+	 */
+	DeferEvent snapshot_event;
+
+	/**
+	 * Operations which have not yet been submitted to the worker
+	 * thread.
+	 */
+	std::vector<Operation> pending;
+
+	/**
+	 * The #ThreadJob.  It is a separate object, so its destruction
+	 * can be postponed if it is still running when this object
+	 * gets destroyed.
+	 */
+	std::unique_ptr<Worker> worker;
+
+	/**
+	 * The ids of all sessions which still need to be written to
+	 * the new snapshot (in reverse order).  Empty if no
+	 * compaction is in progress.
+	 */
+	std::vector<SessionId> snapshot_ids;
+
+	/**
+	 * The number of #APPEND_SNAPSHOT bytes in #pending.
+	 */
+	std::size_t pending_snapshot_size = 0;
+
+	/**
+	 * The (estimated) size of the journal files and of the most
+	 * recent snapshot.
+	 */
+	uint_least64_t journal_size = 0, snapshot_size = 0;
+
+	/**
+	 * Is a compaction in progress?
+	 */
+	bool compacting = false;
+
+	/**
+	 * Is the worker thread processing Worker::running?
+	 */
+	bool busy = false;
+
+public:
+	/**
+	 * Load all sessions from the snapshot and the journals, and
+	 * start a fresh snapshot (this blocks).  After that, register
+	 * this object at a #SessionChanges instance.
+	 */
+	SessionPersist(SessionManager &_manager, ThreadQueue &_queue,
+		       const char *_path) noexcept;
+
+	~SessionPersist() noexcept;
+
+	SessionPersist(const SessionPersist &) = delete;
+	SessionPersist &operator=(const SessionPersist &) = delete;
+
+	/**
+	 * Save all sessions into the snapshot (this blocks).  Call
+	 * this during shutdown, after the worker threads have been
+	 * stopped and after SessionChanges::Flush().
+	 */
+	void Shutdown() noexcept;
+
+	/**
+	 * Start compacting the journal now (unless a compaction is
+	 * already in progress).  Usually, this happens automatically
+	 * when the journal has grown too large.
+	 */
+	void Compact() noexcept {
+		if (!compacting) {
+			StartCompaction();
+			Submit();
+		}
+	}
+
+	/**
+	 * Have all changes been written, and is no compaction in
+	 * progress?
+	 */
+	bool IsIdle() const noexcept {
+		return !busy && pending.empty() && !compacting;
+	}
+
+private:
+	void StartCompaction() noexcept;
+
+	/**
+	 * Append a new operation, merging it with the last one if
+	 * possible.
+	 */
+	std::vector<std::byte> &AddOperation(Operation::Type type) noexcept;
+
+	/**
+	 * Submit #pending to the worker thread unless it is busy.
+	 */
+	void Submit() noexcept;
+
+	void OnSnapshotChunk() noexcept;
+
+	/**
+	 * Called by Worker::Done().
+	 */
+	void OnWorkerDone() noexcept;
+
+	/* virtual methods from class SessionChangesHandler */
+	void OnSessionChanges(std::span<const std::byte> records,
+			      std::span<const std::size_t> ends) noexcept override;
+};
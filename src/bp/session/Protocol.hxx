@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * The session replication protocol.
+ *
+ * A beng-proxy cluster node connects to its "buddy" node (TCP) and
+ * sends a session journal header (see session_write_journal_header())
+ * followed by frames.  Each frame consists of a 32 bit length (host
+ * byte order, like the session file format) and that many bytes of
+ * complete session journal records (#MAGIC_SESSION,
+ * #MAGIC_ERASE_SESSION).  Nothing is ever sent back.
+ *
+ * After connecting, the sender transmits the sessions which were
+ * erased while it was disconnected, then all of its sessions, and
+ * after that every change.  The receiver applies a session record
+ * only if it is newer (see Session::version) than its own copy.
+ *
+ * The protocol is neither authenticated nor encrypted: anybody who
+ * can connect to the replication port can inject new sessions (e.g.
+ * with a forged user name) or overwrite existing ones.  The listener
+ * must only be reachable by the cluster nodes, e.g. on a private
+ * network interface.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr unsigned DEFAULT_SESSION_REPLICATION_PORT = 5479;
+
+/**
+ * The size of the journal header (magic and sizeof(Session)).
+ */
+static constexpr std::size_t SESSION_REPLICATION_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+/**
+ * Frames larger than this are rejected by the receiver; the sender
+ * must split its records into several frames.
+ */
+static constexpr std::size_t MAX_SESSION_REPLICATION_FRAME = 16 * 1024 * 1024;
+
+using SessionReplicationFrameSize = uint32_t;
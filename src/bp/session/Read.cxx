@@ -7,6 +7,8 @@
 #include "Session.hxx"
 #include "io/BufferedReader.hxx"
 
+#include <algorithm>
+
 namespace {
 
 class FileReader {
@@ -101,6 +103,23 @@ session_read_file_header(BufferedReader &r)
 	Expect32(file, sizeof(Session));
 }
 
+void
+session_read_journal_header(BufferedReader &r)
+{
+	FileReader file(r);
+	Expect32(file, MAGIC_JOURNAL_FILE);
+	Expect32(file, sizeof(Session));
+}
+
+SessionId
+session_read_erase(BufferedReader &r)
+{
+	FileReader file(r);
+	const auto id = file.ReadT<SessionId>();
+	Expect32(file, MAGIC_END_OF_RECORD);
+	return id;
+}
+
 static void
 ReadWidgetSessions(FileReader &file, WidgetSession::Set &widgets);
 
@@ -113,14 +132,6 @@ DoReadWidgetSession(FileReader &file, WidgetSession &ws)
 	Expect32(file, MAGIC_END_OF_RECORD);
 }
 
-static WidgetSession
-ReadWidgetSession(FileReader &file)
-{
-	WidgetSession ws;
-	DoReadWidgetSession(file, ws);
-	return ws;
-}
-
 static void
 ReadWidgetSessions(FileReader &file, WidgetSession::Set &widgets)
 {
@@ -131,10 +142,15 @@ ReadWidgetSessions(FileReader &file, WidgetSession::Set &widgets)
 		} else if (magic != MAGIC_WIDGET_SESSION)
 			throw SessionDeserializerError();
 
-		auto id = file.ReadString();
-		auto ws = ReadWidgetSession(file);
-		widgets.emplace(std::string_view{id.c_str()}, std::move(ws));
+		DoReadWidgetSession(file, widgets.emplace_back(file.ReadString()));
 	}
+
+	/* the file was written in sorted order, but don't rely on
+	   that */
+	std::sort(widgets.begin(), widgets.end(),
+		  [](const WidgetSession &a, const WidgetSession &b){
+			  return std::string_view{a.id} < std::string_view{b.id};
+		  });
 }
 
 static std::unique_ptr<Cookie>
@@ -167,8 +183,9 @@ ReadCookieJar(FileReader &file, CookieJar &jar)
 	}
 }
 
-static RealmSession
-ReadRealmSession(FileReader &file, uint32_t magic, Session &parent)
+static std::unique_ptr<RealmSession>
+ReadRealmSession(FileReader &file, uint32_t magic, Session &parent,
+		 AllocatedString &&name)
 {
 	bool have_translate;
 	if (magic == MAGIC_REALM_SESSION) {
@@ -181,18 +198,18 @@ ReadRealmSession(FileReader &file, uint32_t magic, Session &parent)
 		throw SessionDeserializerError();
 
 
-	RealmSession session{parent};
+	auto session = std::make_unique<RealmSession>(parent, std::move(name));
 
-	session.site = file.ReadString();
+	session->site = file.ReadString();
 
 	if (have_translate)
-		session.translate = file.ReadArray();
+		session->translate = file.ReadArray();
 
-	session.user = file.ReadString();
-	file.Read(session.user_expires);
-	ReadWidgetSessions(file, session.widgets);
-	ReadCookieJar(file, session.cookies);
-	session.session_cookie_same_site = file.ReadT<CookieSameSite>();
+	session->user = file.ReadString();
+	file.Read(session->user_expires);
+	ReadWidgetSessions(file, session->widgets);
+	ReadCookieJar(file, session->cookies);
+	session->session_cookie_same_site = file.ReadT<CookieSameSite>();
 	Expect32(file, MAGIC_END_OF_RECORD);
 
 	return session;
@@ -203,6 +220,7 @@ DoReadSession(FileReader &file, Session &session)
 {
 	file.Read(session.expires);
 	file.ReadT(session.counter);
+	file.ReadT(session.version);
 	session.cookie_received = file.ReadBool();
 	session.translate = file.ReadArray();
 	session.language = file.ReadString();
@@ -213,9 +231,9 @@ DoReadSession(FileReader &file, Session &session)
 			break;
 
 		auto name = file.ReadString();
-		auto realm_session = ReadRealmSession(file, magic, session);
-		session.realms.emplace(std::string_view{name.c_str()},
-				       std::move(realm_session));
+		auto realm_session = ReadRealmSession(file, magic, session,
+						      std::move(name));
+		session.realms.push_front(*realm_session.release());
 	}
 
 	Expect32(file, MAGIC_END_OF_RECORD);
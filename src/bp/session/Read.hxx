@@ -15,6 +15,7 @@
 #include <stdint.h>
 
 struct Session;
+class SessionId;
 class BufferedReader;
 
 class SessionDeserializerError {};
@@ -31,6 +32,21 @@ session_read_magic(BufferedReader &r);
 void
 session_read_file_header(BufferedReader &r);
 
+/**
+ * Throws on error.
+ */
+void
+session_read_journal_header(BufferedReader &r);
+
+/**
+ * Read the payload of a #MAGIC_ERASE_SESSION record (after the
+ * magic).
+ *
+ * Throws on error.
+ */
+SessionId
+session_read_erase(BufferedReader &r);
+
 /**
  * Throws on error.
  */
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ReplicaServer.hxx"
+#include "Protocol.hxx"
+#include "Read.hxx"
+#include "Manager.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/SocketError.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/BufferedReader.hxx"
+#include "io/Reader.hxx"
+#include "io/Logger.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace {
+
+/**
+ * A #Reader which reads from a memory buffer.
+ */
+class SpanReader final : public Reader {
+	std::span<const std::byte> src;
+
+public:
+	explicit SpanReader(std::span<const std::byte> _src) noexcept
+		:src(_src) {}
+
+	/* virtual methods from class Reader */
+	std::size_t Read(std::span<std::byte> dest) override {
+		const std::size_t n = std::min(dest.size(), src.size());
+		std::copy_n(src.begin(), n, dest.begin());
+		src = src.subspan(n);
+		return n;
+	}
+};
+
+} // anonymous namespace
+
+class SessionReplicaServer::Connection final
+	: public AutoUnlinkIntrusiveListHook
+{
+	static constexpr std::size_t read_size = 64 * 1024;
+
+	SessionManager &manager;
+
+	SocketEvent event;
+
+	/**
+	 * Received data which has not yet been parsed (an incomplete
+	 * frame).
+	 */
+	std::vector<std::byte> input;
+
+	bool have_header = false;
+
+public:
+	Connection(EventLoop &event_loop, SessionManager &_manager,
+		   UniqueSocketDescriptor fd) noexcept
+		:manager(_manager),
+		 event(event_loop, BIND_THIS_METHOD(OnSocketReady),
+		       fd.Release())
+	{
+		event.ScheduleRead();
+	}
+
+	~Connection() noexcept {
+		event.Close();
+	}
+
+private:
+	/**
+	 * Parse and apply all complete frames.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the number of bytes consumed
+	 */
+	std::size_t Parse(std::span<const std::byte> src);
+
+	void OnSocketReady(unsigned events) noexcept;
+};
+
+std::size_t
+SessionReplicaServer::Connection::Parse(std::span<const std::byte> src)
+{
+	std::size_t consumed = 0;
+
+	if (!have_header) {
+		if (src.size() < SESSION_REPLICATION_HEADER_SIZE)
+			return 0;
+
+		SpanReader sr{src.first(SESSION_REPLICATION_HEADER_SIZE)};
+		BufferedReader br{sr};
+		session_read_journal_header(br);
+
+		have_header = true;
+		consumed += SESSION_REPLICATION_HEADER_SIZE;
+	}
+
+	while (true) {
+		const auto rest = src.subspan(consumed);
+
+		SessionReplicationFrameSize size;
+		if (rest.size() < sizeof(size))
+			break;
+
+		memcpy(&size, rest.data(), sizeof(size));
+		if (size > MAX_SESSION_REPLICATION_FRAME)
+			throw std::runtime_error{"Frame too large"};
+
+		if (rest.size() < sizeof(size) + size)
+			break;
+
+		SpanReader sr{rest.subspan(sizeof(size), size)};
+		BufferedReader br{sr};
+		manager.ApplyRecords(br);
+
+		consumed += sizeof(size) + size;
+	}
+
+	return consumed;
+}
+
+inline void
+SessionReplicaServer::Connection::OnSocketReady(unsigned) noexcept
+try {
+	const std::size_t old_size = input.size();
+	input.resize(old_size + read_size);
+
+	const auto nbytes = event.GetSocket().Receive(std::span{input}.subspan(old_size),
+						      MSG_DONTWAIT);
+	if (nbytes < 0) {
+		input.resize(old_size);
+
+		const auto e = GetSocketError();
+		if (IsSocketErrorReceiveWouldBlock(e))
+			return;
+
+		throw MakeSocketError(e, "Failed to receive");
+	}
+
+	input.resize(old_size + nbytes);
+
+	if (nbytes == 0) {
+		/* the peer has closed the connection; an incomplete
+		   frame is discarded */
+		delete this;
+		return;
+	}
+
+	const auto consumed = Parse(input);
+	input.erase(input.begin(), input.begin() + consumed);
+} catch (...) {
+	LogConcat(2, "SessionReplicaServer", "Replication error: ",
+		  std::current_exception());
+	delete this;
+}
+
+SessionReplicaServer::SessionReplicaServer(EventLoop &event_loop,
+					   SessionManager &_manager,
+					   UniqueSocketDescriptor _socket) noexcept
+	:ServerSocket(event_loop, std::move(_socket)),
+	 manager(_manager)
+{
+}
+
+SessionReplicaServer::~SessionReplicaServer() noexcept
+{
+	connections.clear_and_dispose(DeleteDisposer{});
+}
+
+void
+SessionReplicaServer::OnAccept(UniqueSocketDescriptor s,
+			       SocketAddress) noexcept
+{
+	auto *c = new Connection(GetEventLoop(), manager, std::move(s));
+	connections.push_back(*c);
+}
+
+void
+SessionReplicaServer::OnAcceptError(std::exception_ptr e) noexcept
+{
+	LogConcat(2, "SessionReplicaServer", "Failed to accept: ", e);
+}
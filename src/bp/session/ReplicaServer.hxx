@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "event/net/ServerSocket.hxx"
+#include "util/IntrusiveList.hxx"
+
+class SessionManager;
+
+/**
+ * Accepts connections from #SessionReplicator instances on other
+ * cluster nodes and applies the sessions they send to the local
+ * #SessionManager.  The replicated sessions are not marked as
+ * modified, so they are neither persisted nor replicated again until
+ * this node modifies them (i.e. after it has taken over the session
+ * from the failed node).  See Protocol.hxx.
+ *
+ * Connections are not authenticated; the socket must only be
+ * reachable by other cluster nodes.
+ */
+class SessionReplicaServer final : public ServerSocket {
+	SessionManager &manager;
+
+	class Connection;
+	IntrusiveList<Connection> connections;
+
+public:
+	SessionReplicaServer(EventLoop &event_loop, SessionManager &_manager,
+			     UniqueSocketDescriptor _socket) noexcept;
+	~SessionReplicaServer() noexcept;
+
+protected:
+	void OnAccept(UniqueSocketDescriptor s,
+		      SocketAddress address) noexcept override;
+	void OnAcceptError(std::exception_ptr e) noexcept override;
+};
@@ -0,0 +1,357 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Replicator.hxx"
+#include "Protocol.hxx"
+#include "Append.hxx"
+#include "Write.hxx"
+#include "File.hxx"
+#include "Manager.hxx"
+#include "Session.hxx"
+#include "stats/EventLoopProfiler.hxx"
+#include "net/SocketError.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/Logger.hxx"
+#include "util/SpanCast.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <sys/socket.h>
+
+SessionReplicator::SessionReplicator(EventLoop &event_loop,
+				     SessionManager &_manager,
+				     SocketAddress _address,
+				     Event::Duration _reconnect_delay) noexcept
+	:manager(_manager), address(_address),
+	 reconnect_delay(_reconnect_delay),
+	 connect(event_loop, *this),
+	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady)),
+	 reconnect_timer(event_loop, BIND_THIS_METHOD(OnReconnectTimer)),
+	 sync_event(event_loop, BIND_THIS_METHOD(OnSyncChunk))
+{
+}
+
+SessionReplicator::~SessionReplicator() noexcept
+{
+	socket.Close();
+}
+
+void
+SessionReplicator::Connect() noexcept
+{
+	assert(!IsConnected());
+
+	connect.Connect(address, connect_timeout);
+}
+
+void
+SessionReplicator::Disconnect() noexcept
+{
+	sync_event.Cancel();
+	sync_ids.clear();
+	socket.Close();
+	output.clear();
+	output_position = 0;
+
+	/* the buddy may not have received these erase records; send
+	   them again after reconnecting */
+	AddErasedIds(unsent_erased_ids);
+	unsent_erased_ids.clear();
+
+	reconnect_timer.Schedule(reconnect_delay);
+}
+
+void
+SessionReplicator::CollectErasedIds(std::vector<SessionId> &dest,
+				    std::span<const std::byte> records,
+				    std::span<const std::size_t> ends) noexcept
+{
+	std::size_t position = 0;
+	for (const std::size_t end : ends) {
+		const auto record = records.subspan(position, end - position);
+		position = end;
+
+		/* see session_write_erase() */
+		uint32_t magic;
+		SessionId id;
+		if (record.size() != sizeof(magic) + sizeof(id) + sizeof(uint32_t))
+			continue;
+
+		std::memcpy(&magic, record.data(), sizeof(magic));
+		if (magic != MAGIC_ERASE_SESSION)
+			continue;
+
+		std::memcpy(&id, record.data() + sizeof(magic), sizeof(id));
+		dest.push_back(id);
+	}
+}
+
+void
+SessionReplicator::AddErasedIds(std::span<const SessionId> ids) noexcept
+{
+	assert(erased_ids.size() <= max_erased_ids);
+
+	const std::size_t n = std::min(ids.size(),
+				       max_erased_ids - erased_ids.size());
+	if (n < ids.size())
+		/* the buddy will keep these sessions until they
+		   expire */
+		LogConcat(2, "SessionReplicator", "Too many erased sessions, forgetting ",
+			  ids.size() - n);
+
+	erased_ids.insert(erased_ids.end(), ids.begin(), ids.begin() + n);
+}
+
+void
+SessionReplicator::AppendFrame(std::span<const std::byte> records) noexcept
+{
+	if (records.empty())
+		return;
+
+	assert(records.size() <= MAX_SESSION_REPLICATION_FRAME);
+
+	if (output_position == output.size()) {
+		output.clear();
+		output_position = 0;
+	}
+
+	const SessionReplicationFrameSize size = records.size();
+	const auto size_bytes = ReferenceAsBytes(size);
+	output.insert(output.end(), size_bytes.begin(), size_bytes.end());
+	output.insert(output.end(), records.begin(), records.end());
+}
+
+bool
+SessionReplicator::AppendRecords(std::span<const std::byte> records,
+				 std::span<const std::size_t> ends) noexcept
+{
+	assert(IsConnected());
+
+	if (records.empty())
+		return true;
+
+	if (GetOutputSize() + records.size() > max_output) {
+		/* the buddy is too slow; start over with a full
+		   synchronization later */
+		LogConcat(2, "SessionReplicator", "Buddy is too slow, disconnecting");
+		Disconnect();
+		return false;
+	}
+
+	/* each frame gets as many complete records as fit */
+	std::size_t frame_start = 0, position = 0;
+	for (const std::size_t end : ends) {
+		assert(end > position);
+		assert(end <= records.size());
+
+		if (end - position > MAX_SESSION_REPLICATION_FRAME) {
+			/* the buddy would reject a frame containing
+			   this record */
+			LogConcat(2, "SessionReplicator", "Session record too large: ",
+				  end - position);
+			AppendFrame(records.subspan(frame_start, position - frame_start));
+			frame_start = end;
+		} else if (end - frame_start > MAX_SESSION_REPLICATION_FRAME) {
+			AppendFrame(records.subspan(frame_start, position - frame_start));
+			frame_start = position;
+		}
+
+		position = end;
+	}
+
+	assert(position == records.size());
+
+	AppendFrame(records.subspan(frame_start, position - frame_start));
+	return true;
+}
+
+bool
+SessionReplicator::SendErasedIds() noexcept
+{
+	assert(unsent_erased_ids.empty());
+
+	std::vector<std::byte> records;
+	std::vector<std::size_t> ends;
+
+	for (const auto &id : erased_ids)
+		if (AppendSessionRecord(records, [&id](BufferedOutputStream &os){
+			session_write_erase(os, id);
+		}))
+			ends.push_back(records.size());
+
+	unsent_erased_ids = std::move(erased_ids);
+	erased_ids.clear();
+
+	return AppendRecords(records, ends);
+}
+
+void
+SessionReplicator::TryWrite() noexcept
+{
+	assert(IsConnected());
+
+	if (GetOutputSize() > 0) {
+		const auto src = std::span{output}.subspan(output_position);
+		const auto nbytes = socket.GetSocket().Send(src, MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (nbytes < 0) {
+			const auto e = GetSocketError();
+			if (!IsSocketErrorSendWouldBlock(e)) {
+				LogConcat(2, "SessionReplicator", "Failed to send: ",
+					  std::make_exception_ptr(MakeSocketError(e, "send() failed")));
+				Disconnect();
+				return;
+			}
+		} else
+			output_position += nbytes;
+	}
+
+	if (GetOutputSize() > 0) {
+		socket.ScheduleWrite();
+	} else {
+		output.clear();
+		output_position = 0;
+		socket.CancelWrite();
+
+		/* the kernel has accepted all erase records */
+		unsent_erased_ids.clear();
+	}
+
+	if (!sync_ids.empty() && GetOutputSize() < max_sync_output)
+		/* resume the full synchronization if OnSyncChunk()
+		   has been waiting for us */
+		sync_event.Schedule();
+}
+
+inline void
+SessionReplicator::OnSocketReady(unsigned events) noexcept
+{
+	if (events & (SocketEvent::READ|SocketEvent::ERROR|SocketEvent::HANGUP)) {
+		/* the buddy never sends anything; this means the
+		   connection has been closed */
+		LogConcat(2, "SessionReplicator", "Connection to buddy closed");
+		Disconnect();
+		return;
+	}
+
+	if (events & SocketEvent::WRITE)
+		TryWrite();
+}
+
+inline void
+SessionReplicator::OnReconnectTimer() noexcept
+{
+	Connect();
+}
+
+static EventLoopCallbackSite sync_site{"session_replication_sync", EventLoopCallbackType::DEFER};
+
+inline void
+SessionReplicator::OnSyncChunk() noexcept
+{
+	const EventLoopCallbackScope scope{sync_site};
+
+	assert(IsConnected());
+
+	if (GetOutputSize() >= max_sync_output)
+		/* wait for the socket; TryWrite() will resume */
+		return;
+
+	std::vector<std::byte> records;
+	std::vector<std::size_t> ends;
+
+	for (std::size_t n = 0;
+	     n < sync_chunk_size && !sync_ids.empty(); ++n) {
+		const auto id = sync_ids.back();
+		sync_ids.pop_back();
+
+		/* sessions which were erased meanwhile are skipped;
+		   those which were modified meanwhile will be sent
+		   again by OnSessionChanges() */
+		const auto *session = manager.Get(id);
+		if (session == nullptr)
+			continue;
+
+		if (AppendSessionRecord(records, [session](BufferedOutputStream &os){
+			session_write_magic(os, MAGIC_SESSION);
+			session_write(os, session);
+		}))
+			ends.push_back(records.size());
+	}
+
+	if (!AppendRecords(records, ends))
+		return;
+
+	if (!sync_ids.empty())
+		sync_event.Schedule();
+
+	TryWrite();
+}
+
+void
+SessionReplicator::OnSessionChanges(std::span<const std::byte> records,
+				    std::span<const std::size_t> ends) noexcept
+{
+	if (!IsConnected()) {
+		/* modified sessions will be included in the full
+		   synchronization after reconnecting, but erased
+		   sessions would be missing from it */
+		std::vector<SessionId> ids;
+		CollectErasedIds(ids, records, ends);
+		AddErasedIds(ids);
+		return;
+	}
+
+	CollectErasedIds(unsent_erased_ids, records, ends);
+
+	if (AppendRecords(records, ends))
+		TryWrite();
+}
+
+void
+SessionReplicator::OnSocketConnectSuccess(UniqueSocketDescriptor fd) noexcept
+{
+	socket.Open(fd.Release());
+	socket.ScheduleRead();
+
+	assert(output.empty());
+
+	AppendSessionRecord(output, [](BufferedOutputStream &os){
+		session_write_journal_header(os);
+	});
+
+	/* erase records first, because the full synchronization
+	   does not mention erased sessions at all */
+	if (!SendErasedIds())
+		return;
+
+	/* only the ids are collected right now; the sessions are
+	   serialized chunk by chunk in OnSyncChunk() */
+	assert(sync_ids.empty());
+	sync_ids.reserve(manager.Count());
+	manager.Visit([](const Session *session, void *ctx){
+		auto &ids = *(std::vector<SessionId> *)ctx;
+		ids.push_back(session->id);
+	}, &sync_ids);
+
+	if (!sync_ids.empty())
+		sync_event.Schedule();
+
+	TryWrite();
+}
+
+void
+SessionReplicator::OnSocketConnectTimeout() noexcept
+{
+	LogConcat(2, "SessionReplicator", "Timeout connecting to buddy");
+	reconnect_timer.Schedule(reconnect_delay);
+}
+
+void
+SessionReplicator::OnSocketConnectError(std::exception_ptr ep) noexcept
+{
+	LogConcat(2, "SessionReplicator", "Failed to connect to buddy: ", ep);
+	reconnect_timer.Schedule(reconnect_delay);
+}
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "Id.hxx"
+#include "Changes.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "event/net/ConnectSocket.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+
+#include <cstddef>
+#include <exception>
+#include <vector>
+
+class SessionManager;
+
+/**
+ * Sends all sessions and all changes to a "buddy" cluster node,
+ * which runs a #SessionReplicaServer.  If this node fails, the buddy
+ * can take over its sessions.  See Protocol.hxx.
+ *
+ * After (re)connecting, all sessions are sent in small chunks spread
+ * over many event loop iterations.  While the connection is down,
+ * modified sessions are not remembered, because they are included
+ * in the full synchronization after reconnecting anyway; only the
+ * ids of erased sessions are kept and sent before the full
+ * synchronization, or else the buddy would keep them until they
+ * expire.
+ *
+ * All sessions are sent, including those received from other nodes;
+ * the receiver ignores records which are not newer than its own
+ * copy (see Session::version), so a node which comes back after a
+ * failure cannot roll back the sessions its buddy has adopted and
+ * modified meanwhile.
+ */
+class SessionReplicator final : public SessionChangesHandler, ConnectSocketHandler {
+	static constexpr Event::Duration connect_timeout = std::chrono::seconds(10);
+
+	/**
+	 * The number of sessions serialized per event loop
+	 * iteration during the full synchronization.
+	 */
+	static constexpr std::size_t sync_chunk_size = 1024;
+
+	/**
+	 * Pause the full synchronization while this many bytes are
+	 * waiting to be sent.
+	 */
+	static constexpr std::size_t max_sync_output = 1024 * 1024;
+
+	/**
+	 * If the buddy is so slow that this many bytes are waiting to
+	 * be sent, give up and reconnect later.
+	 */
+	static constexpr std::size_t max_output = 64 * 1024 * 1024;
+
+	/**
+	 * Remember no more than this many erased sessions while the
+	 * connection is down.
+	 */
+	static constexpr std::size_t max_erased_ids = 256 * 1024;
+
+	SessionManager &manager;
+
+	const AllocatedSocketAddress address;
+
+	const Event::Duration reconnect_delay;
+
+	ConnectSocket connect;
+
+	SocketEvent socket;
+
+	CoarseTimerEvent reconnect_timer;
+
+	/**
+	 * Generates the next chunk of the full synchronization.
+	 */
+	DeferEvent sync_event;
+
+	/**
+	 * The ids of all sessions which still need to be sent during
+	 * the full synchronization (in reverse order).
+	 */
+	std::vector<SessionId> sync_ids;
+
+	/**
+	 * The ids of sessions which were erased while the connection
+	 * was down (or whose #MAGIC_ERASE_SESSION record had not been
+	 * sent completely when the connection failed).  They will be
+	 * sent to the buddy before the full synchronization.
+	 */
+	std::vector<SessionId> erased_ids;
+
+	/**
+	 * The ids of all sessions whose #MAGIC_ERASE_SESSION record
+	 * is in #output.  Cleared when #output has been sent
+	 * completely; moved to #erased_ids on disconnect.
+	 */
+	std::vector<SessionId> unsent_erased_ids;
+
+	/**
+	 * Data waiting to be sent; starts at #output_position.
+	 */
+	std::vector<std::byte> output;
+	std::size_t output_position = 0;
+
+public:
+	/**
+	 * @param _reconnect_delay how long to wait before
+	 * reconnecting after an error
+	 */
+	SessionReplicator(EventLoop &event_loop, SessionManager &_manager,
+			  SocketAddress _address,
+			  Event::Duration _reconnect_delay=std::chrono::seconds(10)) noexcept;
+	~SessionReplicator() noexcept;
+
+	SessionReplicator(const SessionReplicator &) = delete;
+	SessionReplicator &operator=(const SessionReplicator &) = delete;
+
+	void Start() noexcept {
+		Connect();
+	}
+
+private:
+	bool IsConnected() const noexcept {
+		return socket.IsDefined();
+	}
+
+	std::size_t GetOutputSize() const noexcept {
+		return output.size() - output_position;
+	}
+
+	void Connect() noexcept;
+
+	/**
+	 * Close the connection (after an error) and schedule a
+	 * reconnect.
+	 */
+	void Disconnect() noexcept;
+
+	/**
+	 * Remember the id of each #MAGIC_ERASE_SESSION record in
+	 * the given buffer.
+	 */
+	static void CollectErasedIds(std::vector<SessionId> &dest,
+				     std::span<const std::byte> records,
+				     std::span<const std::size_t> ends) noexcept;
+
+	void AddErasedIds(std::span<const SessionId> ids) noexcept;
+
+	/**
+	 * Append one frame to #output.
+	 */
+	void AppendFrame(std::span<const std::byte> records) noexcept;
+
+	/**
+	 * Append records to #output, split into as many frames as
+	 * necessary to obey #MAX_SESSION_REPLICATION_FRAME.  On
+	 * overflow, the connection is closed.
+	 *
+	 * @param ends the end offset of each record (see
+	 * SessionChangesHandler::OnSessionChanges())
+	 * @return false if the connection has been closed
+	 */
+	bool AppendRecords(std::span<const std::byte> records,
+			   std::span<const std::size_t> ends) noexcept;
+
+	/**
+	 * Send a #MAGIC_ERASE_SESSION record for each item in
+	 * #erased_ids.
+	 *
+	 * @return false if the connection has been closed
+	 */
+	bool SendErasedIds() noexcept;
+
+	void TryWrite() noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+	void OnReconnectTimer() noexcept;
+	void OnSyncChunk() noexcept;
+
+	/* virtual methods from class SessionChangesHandler */
+	void OnSessionChanges(std::span<const std::byte> records,
+			      std::span<const std::size_t> ends) noexcept override;
+
+	/* virtual methods from class ConnectSocketHandler */
+	void OnSocketConnectSuccess(UniqueSocketDescriptor fd) noexcept override;
+	void OnSocketConnectTimeout() noexcept override;
+	void OnSocketConnectError(std::exception_ptr ep) noexcept override;
+};
@@ -14,11 +14,11 @@
 #include "io/FdOutputStream.hxx"
 #include "io/FileWriter.hxx"
 #include "io/Logger.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/DeleteDisposer.hxx"
 
 #include <assert.h>
 
-static const char *session_save_path;
-
 static void
 session_save_callback(const Session *session, void *ctx)
 {
@@ -60,7 +60,7 @@ SessionManager::Load(BufferedReader &r)
 			continue;
 		}
 
-		Insert(*session.release());
+		InsertUnmodified(*session.release());
 		++num_added;
 	}
 
@@ -71,11 +71,62 @@ SessionManager::Load(BufferedReader &r)
 }
 
 void
-session_save(SessionManager &manager) noexcept
+SessionManager::ApplyRecords(BufferedReader &r)
+{
+	while (true) {
+		if (r.Read().empty() && !r.Fill(true))
+			/* end of file */
+			break;
+
+		const uint32_t magic = session_read_magic(r);
+		if (magic == MAGIC_SESSION) {
+			auto session = session_read(r, prng);
+			assert(session);
+
+			if (auto i = sessions.find(session->id); i != sessions.end()) {
+				if (i->version >= session->version)
+					/* our copy is not older; this
+					   record is stale (e.g. a full
+					   synchronization from a node
+					   which has failed and returned
+					   after we have adopted its
+					   sessions) */
+					continue;
+
+				/* replace the older version of this
+				   session */
+				sessions.erase_and_dispose(i, DeleteDisposer{});
+			}
+
+			if (session->expires.IsExpired(Expiry::Now()))
+				continue;
+
+			InsertUnmodified(*session.release());
+		} else if (magic == MAGIC_ERASE_SESSION) {
+			const auto id = session_read_erase(r);
+			if (auto i = sessions.find(id); i != sessions.end())
+				sessions.erase_and_dispose(i, DeleteDisposer{});
+		} else
+			throw SessionDeserializerError();
+	}
+}
+
+inline void
+SessionManager::LoadJournal(BufferedReader &r)
+{
+	session_read_journal_header(r);
+	ApplyRecords(r);
+
+	LogConcat(4, "SessionManager", "replayed journal, now ",
+		  Count(), " sessions");
+}
+
+bool
+session_save(SessionManager &manager, const char *path) noexcept
 try {
-	LogConcat(5, "SessionManager", "saving sessions to ", session_save_path);
+	LogConcat(5, "SessionManager", "saving sessions to ", path);
 
-	FileWriter fw(session_save_path, 0600);
+	FileWriter fw(path, 0600);
 	FdOutputStream fos(fw.GetFileDescriptor());
 
 	WithBufferedOutputStream(fos, [&manager](BufferedOutputStream &bos){
@@ -83,24 +134,18 @@ try {
 	});
 
 	fw.Commit();
+	return true;
 } catch (...) {
 	LogConcat(2, "SessionManager", "Failed to save sessions",
 		  std::current_exception());
-	return;
+	return false;
 }
 
 void
-session_save_init(SessionManager &manager, const char *path) noexcept
+session_load(SessionManager &manager, const char *path) noexcept
 {
-	assert(session_save_path == nullptr);
-
-	if (path == nullptr)
-		return;
-
-	session_save_path = path;
-
 	UniqueFileDescriptor fd;
-	if (!fd.OpenReadOnly(session_save_path))
+	if (!fd.OpenReadOnly(path))
 		return;
 
 	try {
@@ -119,10 +164,22 @@ session_save_init(SessionManager &manager, const char *path) noexcept
 }
 
 void
-session_save_deinit(SessionManager &manager) noexcept
+session_load_journal(SessionManager &manager, const char *path) noexcept
 {
-	if (session_save_path == nullptr)
+	UniqueFileDescriptor fd;
+	if (!fd.OpenReadOnly(path))
 		return;
 
-	session_save(manager);
+	try {
+		FdReader fr(fd);
+		BufferedReader br(fr);
+
+		manager.LoadJournal(br);
+	} catch (...) {
+		/* the last record may be incomplete after a crash;
+		   everything before it has been applied */
+		LogConcat(2, "SessionManager",
+			  "Session journal ", path, " is truncated or corrupt: ",
+			  std::current_exception());
+	}
 }
@@ -10,11 +10,25 @@
 
 class SessionManager;
 
+/**
+ * Load sessions from the specified file (if it exists).  Errors are
+ * logged.
+ */
 void
-session_save_init(SessionManager &manager, const char *path) noexcept;
+session_load(SessionManager &manager, const char *path) noexcept;
 
+/**
+ * Apply the session journal in the specified file (if it exists).
+ * Errors are logged.
+ */
 void
-session_save_deinit(SessionManager &manager) noexcept;
+session_load_journal(SessionManager &manager, const char *path) noexcept;
 
-void
-session_save(SessionManager &manager) noexcept;
+/**
+ * Save all sessions into the specified file (atomically replacing
+ * it).  Errors are logged.
+ *
+ * @return true on success
+ */
+bool
+session_save(SessionManager &manager, const char *path) noexcept;
@@ -9,23 +9,68 @@
 #include "util/StringAPI.hxx"
 #include "AllocatorPtr.hxx"
 
+#include <algorithm>
+
 #include <assert.h>
 #include <string.h>
 
 static constexpr std::chrono::seconds SESSION_TTL_NEW(120);
 
+[[gnu::pure]]
+static WidgetSession::Set::iterator
+LowerBound(WidgetSession::Set &set, std::string_view id) noexcept
+{
+	return std::lower_bound(set.begin(), set.end(), id,
+				[](const WidgetSession &ws, std::string_view _id){
+					return std::string_view{ws.id} < _id;
+				});
+}
+
+WidgetSession *
+WidgetSession::Find(Set &set, std::string_view id) noexcept
+{
+	auto i = LowerBound(set, id);
+	if (i == set.end() || std::string_view{i->id} != id)
+		return nullptr;
+
+	return &*i;
+}
+
+WidgetSession &
+WidgetSession::Make(Set &set, std::string_view id) noexcept
+{
+	auto i = LowerBound(set, id);
+	if (i != set.end() && std::string_view{i->id} == id)
+		return *i;
+
+	return *set.emplace(i, AllocatedString{id});
+}
+
+bool
+WidgetSession::Erase(Set &set, std::string_view id) noexcept
+{
+	auto i = LowerBound(set, id);
+	if (i == set.end() || std::string_view{i->id} != id)
+		return false;
+
+	set.erase(i);
+	return true;
+}
+
 void
 WidgetSession::Attach(Set &dest, Set &&src) noexcept
 {
-	while (!src.empty()) {
-		auto node = src.extract(src.begin());
-		auto i = dest.insert(std::move(node));
-		if (!i.inserted) {
+	for (auto &i : src) {
+		auto j = LowerBound(dest, i.id);
+		if (j != dest.end() && std::string_view{j->id} == std::string_view{i.id})
 			/* this WidgetSession exists already - attach
 			   it (recursively) */
-			i.position->second.Attach(std::move(i.node.mapped()));
-		}
+			j->Attach(std::move(i));
+		else
+			dest.emplace(j, std::move(i));
 	}
+
+	src.clear();
 }
 
 void
@@ -64,7 +109,10 @@ Session::Session(SessionId _id, SessionId _csrf_salt) noexcept
 {
 }
 
-Session::~Session() noexcept = default;
+Session::~Session() noexcept
+{
+	realms.clear_and_dispose(DeleteDisposer{});
+}
 
 unsigned
 Session::GetPurgeScore() const noexcept
@@ -116,23 +164,19 @@ Session::Attach(Session &&other) noexcept
 		next_external_keepalive = other.next_external_keepalive;
 	}
 
-	while (!other.realms.empty()) {
-		auto node = other.realms.extract(other.realms.begin());
-
-		auto existing = realms.find(node.key());
-		if (existing == realms.end()) {
-			// TODO optimize with lower_bound()
+	other.realms.clear_and_dispose([this](RealmSession *src){
+		if (auto *existing = FindRealm(src->name)) {
+			/* exists already: attach */
+			existing->Attach(std::move(*src));
+		} else {
 			/* doesn't exist already: create a copy (with
 			   a new RealmSession::parent) and commit
 			   it */
-			realms.emplace(std::piecewise_construct,
-				       std::forward_as_tuple(std::move(node.key())),
-				       std::forward_as_tuple(*this, std::move(node.mapped())));
-		} else {
-			/* exists already: attach */
-			existing->second.Attach(std::move(node.mapped()));
+			realms.push_front(*new RealmSession(*this, std::move(*src)));
 		}
-	}
+
+		delete src;
+	});
 }
 
 void
@@ -222,33 +266,24 @@ Session::SetExternalManager(const HttpAddress &address,
 }
 
 static WidgetSession *
-hashmap_r_get_widget_session(WidgetSession::Set &set,
-			     std::string_view id, bool create)
+GetWidgetSession(WidgetSession::Set &set,
+		 std::string_view id, bool create) noexcept
 {
-	if (auto i = set.find(id); i != set.end())
-		return &i->second;
-
-	if (!create)
-		return nullptr;
-
-	// TODO optimize, use hint with lower_bound()
-	auto [it, inserted] = set.emplace(std::piecewise_construct,
-					  std::forward_as_tuple(id),
-					  std::forward_as_tuple());
-	assert(inserted);
-	return &it->second;
+	return create
+		? &WidgetSession::Make(set, id)
+		: WidgetSession::Find(set, id);
 }
 
 WidgetSession *
 RealmSession::GetWidget(std::string_view widget_id, bool create) noexcept
 {
-	return hashmap_r_get_widget_session(widgets, widget_id, create);
+	return GetWidgetSession(widgets, widget_id, create);
 }
 
 WidgetSession *
 WidgetSession::GetChild(std::string_view child_id, bool create) noexcept
 {
-	return hashmap_r_get_widget_session(children, child_id, create);
+	return GetWidgetSession(children, child_id, create);
 }
 
 WidgetSession::~WidgetSession() noexcept = default;
@@ -265,26 +300,43 @@ RealmSession::Expire(Expiry now) noexcept
 void
 Session::Expire(Expiry now) noexcept
 {
-	for (auto &[name, realm] : realms)
+	for (auto &realm : realms)
 		realm.Expire(now);
 }
 
+RealmSession *
+Session::FindRealm(std::string_view realm_name) noexcept
+{
+	for (auto &realm : realms)
+		if (std::string_view{realm.name} == realm_name)
+			return &realm;
+
+	return nullptr;
+}
+
 RealmSession *
 Session::GetRealm(std::string_view realm_name) noexcept
 {
-	if (auto i = realms.find(realm_name); i != realms.end())
-		return &i->second;
+	if (auto *realm = FindRealm(realm_name))
+		return realm;
 
-	// TODO optimize, use hint with lower_bound()
-	return &realms.emplace(realm_name, *this).first->second;
+	auto *realm = new RealmSession(*this, AllocatedString{realm_name});
+	realms.push_front(*realm);
+	return realm;
 }
 
 bool
 Session::DiscardRealm(std::string_view realm) noexcept
 {
-	if (auto i = realms.find(realm); i != realms.end()) {
-		realms.erase(i);
-		return true;
-	} else
-		return false;
+	for (auto prev = realms.before_begin(), i = std::next(prev);
+	     i != realms.end(); prev = i++) {
+		if (std::string_view{i->name} == realm) {
+			auto &r = *i;
+			realms.erase_after(prev);
+			delete &r;
+			return true;
+		}
+	}
+
+	return false;
 }
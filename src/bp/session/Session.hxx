@@ -15,11 +15,14 @@
 #include "util/AllocatedArray.hxx"
 #include "util/AllocatedString.hxx"
 #include "util/Expiry.hxx"
+#include "util/IntrusiveForwardList.hxx"
 #include "util/IntrusiveHashSet.hxx"
+#include "util/IntrusiveList.hxx"
 
 #include <chrono>
-#include <map>
-#include <string>
+#include <cstdint>
+#include <string_view>
+#include <vector>
 
 struct RealmSession;
 struct HttpAddress;
@@ -28,7 +31,16 @@ struct HttpAddress;
  * Session data associated with a widget instance (struct widget).
  */
 struct WidgetSession {
-	using Set = std::map<std::string, WidgetSession, std::less<>>;
+	/**
+	 * A flat array sorted by #id.  This needs much less memory
+	 * than a node-based container and keeps the (usually small)
+	 * tree in few contiguous allocations.  Note that inserting or
+	 * erasing an element invalidates pointers to its siblings.
+	 */
+	using Set = std::vector<WidgetSession>;
+
+	/** the widget id; this is the key within the parent's #Set */
+	AllocatedString id;
 
 	Set children;
 
@@ -38,13 +50,28 @@ struct WidgetSession {
 	/** last query string */
 	AllocatedString query_string;
 
-	WidgetSession() noexcept = default;
+	explicit WidgetSession(AllocatedString &&_id) noexcept
+		:id(std::move(_id)) {}
 
 	~WidgetSession() noexcept;
 
 	WidgetSession(WidgetSession &&) noexcept = default;
 	WidgetSession &operator=(WidgetSession &&) noexcept = default;
 
+	[[gnu::pure]]
+	static WidgetSession *Find(Set &set, std::string_view id) noexcept;
+
+	/**
+	 * Find the #WidgetSession with the specified id or create a
+	 * new one.
+	 */
+	static WidgetSession &Make(Set &set, std::string_view id) noexcept;
+
+	/**
+	 * @return true if the element was found and erased
+	 */
+	static bool Erase(Set &set, std::string_view id) noexcept;
+
 	static void Attach(Set &dest, Set &&src) noexcept;
 	void Attach(WidgetSession &&other) noexcept;
 
@@ -57,9 +84,15 @@ struct Session;
 /**
  * A session associated with a user.
  */
-struct RealmSession {
+struct RealmSession : IntrusiveForwardListHook {
 	Session &parent;
 
+	/**
+	 * The name of the realm; this is the key within
+	 * Session::realms.
+	 */
+	AllocatedString name;
+
 	/**
 	 * The site name as provided by the translation server in the
 	 * packet #TRANSLATE_SESSION_SITE.
@@ -91,13 +124,14 @@ struct RealmSession {
 	 */
 	CookieSameSite session_cookie_same_site = CookieSameSite::DEFAULT;
 
-	explicit RealmSession(Session &_parent) noexcept
-		:parent(_parent)
+	RealmSession(Session &_parent, AllocatedString &&_name) noexcept
+		:parent(_parent), name(std::move(_name))
 	{
 	}
 
 	RealmSession(Session &_parent, RealmSession &&src) noexcept
 		:parent(_parent),
+		 name(std::move(src.name)),
 		 site(std::move(src.site)),
 		 user(std::move(src.user)),
 		 user_expires(src.user_expires),
@@ -106,7 +140,8 @@ struct RealmSession {
 	{
 	}
 
-	RealmSession(RealmSession &&) noexcept = default;
+	RealmSession(const RealmSession &) = delete;
+	RealmSession &operator=(const RealmSession &) = delete;
 
 	~RealmSession() noexcept;
 
@@ -146,6 +181,14 @@ struct Session {
 
 	IntrusiveHashSetHook<IntrusiveHookMode::AUTO_UNLINK> by_attach_hook;
 
+	/**
+	 * If linked, then this session has been modified since it
+	 * was last written to the session journal.
+	 *
+	 * @see SessionManager::ConsumeChanges()
+	 */
+	IntrusiveListHook<IntrusiveHookMode::AUTO_UNLINK> dirty_hook;
+
 	/** identification number of this session */
 	const SessionId id;
 
@@ -160,6 +203,15 @@ struct Session {
 	 */
 	unsigned counter = 1;
 
+	/**
+	 * Incremented each time this session is modified (see
+	 * SessionManager::MarkDirty()).  When session records are
+	 * applied (from a journal or from another cluster node), a
+	 * record is ignored unless its version is newer than the
+	 * local one.
+	 */
+	uint_least32_t version = 0;
+
 	/** has a HTTP cookie with this session id already been received? */
 	bool cookie_received = false;
 
@@ -190,9 +242,13 @@ struct Session {
 
 	std::chrono::steady_clock::time_point next_external_keepalive;
 
-	using RealmSessionSet = std::map<std::string, RealmSession, std::less<>>;
+	/**
+	 * Most sessions have only one or two realms, therefore a
+	 * simple list (searched linearly) is cheaper than a map.
+	 */
+	using RealmSessionList = IntrusiveForwardList<RealmSession>;
 
-	RealmSessionSet realms;
+	RealmSessionList realms;
 
 	Session(SessionId _id, SessionId _csrf_salt) noexcept;
 	~Session() noexcept;
@@ -206,7 +262,7 @@ struct Session {
 
 	[[gnu::pure]]
 	bool HasUser() const noexcept {
-		for (auto &[name, realm] : realms)
+		for (const auto &realm : realms)
 			if (realm.user != nullptr)
 				return true;
 
@@ -244,6 +300,12 @@ struct Session {
 	void Expire(Expiry now) noexcept;
 
 	[[gnu::pure]]
+	RealmSession *FindRealm(std::string_view realm) noexcept;
+
+	/**
+	 * Find the #RealmSession with the specified name or create a
+	 * new one.
+	 */
 	RealmSession *GetRealm(std::string_view realm) noexcept;
 
 	bool DiscardRealm(std::string_view realm) noexcept;
@@ -109,6 +109,23 @@ session_write_file_tail(BufferedOutputStream &file)
 	session_write_magic(file, MAGIC_END_OF_LIST);
 }
 
+void
+session_write_journal_header(BufferedOutputStream &os)
+{
+	FileWriter file(os);
+	file.Write32(MAGIC_JOURNAL_FILE);
+	file.Write32(sizeof(Session));
+}
+
+void
+session_write_erase(BufferedOutputStream &os, const SessionId &id)
+{
+	FileWriter file(os);
+	file.Write32(MAGIC_ERASE_SESSION);
+	file.WriteT(id);
+	file.Write32(MAGIC_END_OF_RECORD);
+}
+
 static void
 WriteWidgetSessions(FileWriter &file, const WidgetSession::Set &widgets);
 
@@ -124,9 +141,9 @@ WriteWidgetSession(FileWriter &file, const WidgetSession &session)
 static void
 WriteWidgetSessions(FileWriter &file, const WidgetSession::Set &widgets)
 {
-	for (const auto &[id, ws] : widgets) {
+	for (const auto &ws : widgets) {
 		file.Write32(MAGIC_WIDGET_SESSION);
-		file.Write(id);
+		file.Write(ws.id);
 		WriteWidgetSession(file, ws);
 	}
 
@@ -176,13 +193,14 @@ session_write(BufferedOutputStream &os, const Session *session)
 	file.WriteT(session->id);
 	file.Write(session->expires);
 	file.WriteT(session->counter);
+	file.WriteT(session->version);
 	file.WriteBool(session->cookie_received);
 	file.Write(session->translate);
 	file.Write(session->language);
 
-	for (const auto &[name, realm] : session->realms) {
+	for (const auto &realm : session->realms) {
 		file.Write32(MAGIC_REALM_SESSION);
-		file.Write(name);
+		file.Write(realm.name);
 		WriteRealmSession(file, realm);
 	}
 
@@ -11,6 +11,7 @@
 #include <stdint.h>
 
 struct Session;
+class SessionId;
 class BufferedOutputStream;
 
 /**
@@ -31,6 +32,22 @@ session_write_file_header(BufferedOutputStream &os);
 void
 session_write_file_tail(BufferedOutputStream &os);
 
+/**
+ * Write the header of a session journal file.
+ *
+ * Throws on error.
+ */
+void
+session_write_journal_header(BufferedOutputStream &os);
+
+/**
+ * Write a journal record which erases a session.
+ *
+ * Throws on error.
+ */
+void
+session_write_erase(BufferedOutputStream &os, const SessionId &id);
+
 /**
  * Throws on error.
  */
@@ -76,6 +76,10 @@ public:
 			std::chrono::system_clock::time_point system_now,
 			std::chrono::system_clock::time_point _expires) noexcept;
 
+	std::chrono::steady_clock::time_point GetExpires() const noexcept {
+		return expires;
+	}
+
 	size_t GetSize() const noexcept {
 		return size;
 	}
@@ -223,6 +227,15 @@ public:
 
 	void Flush() noexcept;
 
+	/**
+	 * Invoke the given function for each item, least recently
+	 * used first.  The function must not modify the cache.
+	 */
+	void ForEach(std::invocable<const CacheItem &> auto f) const {
+		for (const auto &item : sorted_items)
+			f(item);
+	}
+
 private:
 	/** clean up expired cache items every 60 seconds */
 	bool ExpireCallback() noexcept;
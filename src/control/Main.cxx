@@ -241,18 +241,20 @@ DiscardSession(const char *server, ConstBuffer<const char *> args)
 	client.Send(BengControl::Command::DISCARD_SESSION, attach_id);
 }
 
+/**
+ * Send a command with a pipe and copy everything the server writes
+ * to the pipe to stdout.
+ */
 static void
-Stopwatch(const char *server, ConstBuffer<const char *> args)
+SendWithPipe(const char *server, BengControl::Command cmd,
+	     std::span<const std::byte> payload)
 {
-	if (!args.empty())
-		throw Usage{"Too many arguments"};
-
 	auto [r, w] = CreatePipe();
 
 	FileDescriptor fds[] = { w };
 
 	BengControl::Client client(server);
-	client.Send(BengControl::Command::STOPWATCH_PIPE, nullptr, fds);
+	client.Send(cmd, payload, fds);
 
 	w.Close();
 
@@ -267,6 +269,31 @@ Stopwatch(const char *server, ConstBuffer<const char *> args)
 	}
 }
 
+static void
+Stopwatch(const char *server, ConstBuffer<const char *> args)
+{
+	/* the options are passed as-is to the server, which
+	   validates them */
+	std::string options;
+	while (!args.empty()) {
+		if (!options.empty())
+			options.push_back(' ');
+		options.append(args.shift());
+	}
+
+	SendWithPipe(server, BengControl::Command::STOPWATCH_PIPE,
+		     AsBytes(options));
+}
+
+static void
+Stats(const char *server, ConstBuffer<const char *> args)
+{
+	if (!args.empty())
+		throw Usage{"Too many arguments"};
+
+	SendWithPipe(server, BengControl::Command::STATS, {});
+}
+
 int
 main(int argc, char **argv)
 try {
@@ -339,6 +366,9 @@ try {
 	} else if (StringIsEqual(command, "stopwatch")) {
 		Stopwatch(server, args);
 		return EXIT_SUCCESS;
+	} else if (StringIsEqual(command, "stats")) {
+		Stats(server, args);
+		return EXIT_SUCCESS;
 	} else
 		throw Usage{"Unknown command"};
 } catch (const Usage &u) {
@@ -362,7 +392,8 @@ try {
 		"  flush-http-cache [TAG]\n"
 		"  flush-filter-cache [TAG]\n"
 		"  discard-session ATTACH_ID\n"
-		"  stopwatch\n"
+		"  stopwatch [binary] [sample=N] [filter=PREFIX]\n"
+		"  stats\n"
 		"\n"
 		"Names for tcache-invalidate:\n",
 		argv[0]);
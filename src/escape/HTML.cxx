@@ -9,6 +9,11 @@
 #include "util/StringSplit.hxx"
 #include "util/UTF8.hxx"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <bit>
+#endif
+
 #include <assert.h>
 #include <string.h>
 
@@ -132,30 +137,76 @@ html_unescape(std::string_view src, char *q) noexcept
 	return q - q_start;
 }
 
+/**
+ * Find the first character which must be escaped.  With SSE2, this
+ * checks 16 bytes per step.
+ *
+ * @return a pointer to that character or #end if there is none
+ */
+[[gnu::pure]]
+static const char *
+FindHtmlSpecial(const char *p, const char *const end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i quot = _mm_set1_epi8('"');
+	const __m128i apos = _mm_set1_epi8('\'');
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i gt = _mm_set1_epi8('>');
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		const __m128i special =
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp),
+						  _mm_cmpeq_epi8(v, quot)),
+				     _mm_or_si128(_mm_cmpeq_epi8(v, apos),
+						  _mm_or_si128(_mm_cmpeq_epi8(v, lt),
+							       _mm_cmpeq_epi8(v, gt))));
+
+		const unsigned mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return p + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	for (; p < end; ++p) {
+		switch (*p) {
+		case '&':
+		case '"':
+		case '\'':
+		case '<':
+		case '>':
+			return p;
+		}
+	}
+
+	return end;
+}
+
 static size_t
 html_escape_size(std::string_view _p) noexcept
 {
 	const char *p = _p.begin(), *const end = _p.end();
 
-	size_t size = 0;
-	while (p < end) {
+	size_t size = _p.size();
+	while ((p = FindHtmlSpecial(p, end)) < end) {
 		switch (*p++) {
 		case '&':
-			size += 5;
+			size += 4;
 			break;
 
 		case '"':
 		case '\'':
-			size += 6;
+			size += 5;
 			break;
 
 		case '<':
 		case '>':
-			size += 4;
+			size += 3;
 			break;
-
-		default:
-			++size;
 		}
 	}
 
@@ -165,23 +216,11 @@ html_escape_size(std::string_view _p) noexcept
 static const char *
 html_escape_find(std::string_view _p) noexcept
 {
-	const char *p = _p.begin(), *const end = _p.end();
-
-	while (p < end) {
-		switch (*p) {
-		case '&':
-		case '"':
-		case '\'':
-		case '<':
-		case '>':
-			return p;
-
-		default:
-			++p;
-		}
-	}
-
-	return nullptr;
+	const char *const end = _p.end();
+	const char *p = FindHtmlSpecial(_p.begin(), end);
+	return p < end
+		? p
+		: nullptr;
 }
 
 static std::string_view
@@ -214,32 +253,17 @@ html_escape(std::string_view _p, char *q) noexcept
 {
 	const char *p = _p.begin(), *const p_end = _p.end(), *const q_start = q;
 
-	while (p < p_end) {
-		char ch = *p++;
-		switch (ch) {
-		case '&':
-			q = (char *)mempcpy(q, "&amp;", 5);
-			break;
-
-		case '"':
-			q = (char *)mempcpy(q, "&quot;", 6);
-			break;
-
-		case '\'':
-			q = (char *)mempcpy(q, "&apos;", 6);
-			break;
-
-		case '<':
-			q = (char *)mempcpy(q, "&lt;", 4);
-			break;
-
-		case '>':
-			q = (char *)mempcpy(q, "&gt;", 4);
+	while (true) {
+		/* copy the run of characters which need no escaping
+		   in one step */
+		const char *special = FindHtmlSpecial(p, p_end);
+		q = (char *)mempcpy(q, p, special - p);
+		if (special == p_end)
 			break;
 
-		default:
-			*q++ = ch;
-		}
+		const auto entity = html_escape_char(*special);
+		q = (char *)mempcpy(q, entity.data(), entity.size());
+		p = special + 1;
 	}
 
 	return q - q_start;
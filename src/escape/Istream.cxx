@@ -5,9 +5,11 @@
 #include "Istream.hxx"
 #include "Class.hxx"
 #include "istream/FacadeIstream.hxx"
+#include "istream/Bucket.hxx"
 #include "istream/UnusedPtr.hxx"
 #include "istream/New.hxx"
 #include "util/SpanCast.hxx"
+#include "util/StaticVector.hxx"
 #include "util/DestructObserver.hxx"
 
 #include <assert.h>
@@ -17,6 +19,23 @@ class EscapeIstream final : public FacadeIstream, DestructAnchor {
 
 	std::string_view escaped{};
 
+	/**
+	 * A run of input characters which need no escaping, followed
+	 * by the replacement of one control character (or nothing).
+	 */
+	struct BucketRun {
+		std::size_t plain;
+		std::string_view entity;
+	};
+
+	/**
+	 * The input layout submitted by the most recent
+	 * _FillBucketList() call.  _ConsumeBucketList() uses it to
+	 * translate the number of output bytes to the number of input
+	 * bytes.
+	 */
+	StaticVector<BucketRun, 32> bucket_runs;
+
 public:
 	EscapeIstream(struct pool &_pool, UnusedIstreamPtr _input,
 		      const struct escape_class &_cls) noexcept
@@ -42,6 +61,8 @@ public:
 	}
 
 	void _Read() noexcept override;
+	void _FillBucketList(IstreamBucketList &list) override;
+	ConsumeBucketResult _ConsumeBucketList(std::size_t nbytes) noexcept override;
 
 	int _AsFd() noexcept override {
 		return -1;
@@ -163,6 +184,127 @@ EscapeIstream::_Read() noexcept
 	input.Read();
 }
 
+void
+EscapeIstream::_FillBucketList(IstreamBucketList &list)
+{
+	bucket_runs.clear();
+
+	if (!escaped.empty())
+		list.Push(AsBytes(escaped));
+
+	if (!HasInput())
+		return;
+
+	IstreamBucketList tmp;
+	FillBucketListFromInput(tmp);
+
+	if (tmp.IsEmpty() && !tmp.HasMore()) {
+		CloseInput();
+		return;
+	}
+
+	/* pass runs of plain input through and insert the entities
+	   between them; only those are not backed by the input
+	   buffer */
+
+	for (const auto &bucket : tmp) {
+		if (!bucket.IsBuffer()) {
+			list.EnableFallback();
+			return;
+		}
+
+		auto s = ToStringView(bucket.GetBuffer());
+		while (!s.empty()) {
+			if (bucket_runs.full() || list.IsFull()) {
+				list.SetMore();
+				return;
+			}
+
+			const char *control = escape_find(&cls, s);
+			const std::size_t plain = control != nullptr
+				? std::size_t(control - s.data())
+				: s.size();
+
+			if (plain > 0)
+				list.Push(AsBytes(s.substr(0, plain)));
+
+			auto &run = bucket_runs.emplace_back();
+			run.plain = plain;
+			if (control == nullptr)
+				break;
+
+			if (list.IsFull()) {
+				list.SetMore();
+				return;
+			}
+
+			run.entity = escape_char(&cls, *control);
+			list.Push(AsBytes(run.entity));
+			s = s.substr(plain + 1);
+		}
+	}
+
+	if (tmp.HasMore()) {
+		list.SetMore();
+
+		if (tmp.ShouldFallback())
+			list.EnableFallback();
+	}
+}
+
+Istream::ConsumeBucketResult
+EscapeIstream::_ConsumeBucketList(std::size_t nbytes) noexcept
+{
+	std::size_t total = 0;
+
+	if (!escaped.empty()) {
+		const std::size_t n = std::min(nbytes, escaped.size());
+		escaped = escaped.substr(n);
+		nbytes -= n;
+		total += n;
+	}
+
+	std::size_t consumed_input = 0;
+
+	for (const auto &run : bucket_runs) {
+		if (nbytes == 0)
+			break;
+
+		std::size_t n = std::min(nbytes, run.plain);
+		consumed_input += n;
+		nbytes -= n;
+		total += n;
+
+		if (n < run.plain || run.entity.empty() || nbytes == 0)
+			continue;
+
+		/* the control character is consumed as soon as its
+		   entity has been started; the rest of the entity
+		   will be submitted later */
+		++consumed_input;
+
+		n = std::min(nbytes, run.entity.size());
+		escaped = run.entity.substr(n);
+		nbytes -= n;
+		total += n;
+	}
+
+	bucket_runs.clear();
+
+	if (consumed_input > 0) {
+		assert(HasInput());
+
+		[[maybe_unused]]
+		const auto r = input.ConsumeBucketList(consumed_input);
+		assert(r.consumed == consumed_input);
+
+		if (r.eof)
+			CloseInput();
+	}
+
+	return {Consumed(total), !HasInput() && escaped.empty()};
+}
+
 void
 EscapeIstream::_Close() noexcept
 {
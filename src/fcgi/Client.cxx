@@ -15,12 +15,12 @@
 #include "istream/UnusedPtr.hxx"
 #include "istream/ConcatIstream.hxx"
 #include "istream/Bucket.hxx"
+#include "io/Iovec.hxx"
 #include "http/CommonHeaders.hxx"
 #include "http/HeaderLimits.hxx"
 #include "http/Method.hxx"
 #include "http/HeaderParser.hxx"
 #include "strmap.hxx"
-#include "product.h"
 #include "pool/pool.hxx"
 #include "system/Error.hxx"
 #include "event/net/BufferedSocket.hxx"
@@ -31,6 +31,7 @@
 #include "io/SpliceSupport.hxx"
 #include "util/DestructObserver.hxx"
 #include "util/StringSplit.hxx"
+#include "util/StaticVector.hxx"
 #include "util/StringStrip.hxx"
 #include "util/Cancellable.hxx"
 #include "util/Exception.hxx"
@@ -38,8 +39,6 @@
 #include "stopwatch.hxx"
 #include "lease.hxx"
 
-#include <fmt/format.h>
-
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -84,6 +83,41 @@ class FcgiClient final
 
 	const uint16_t id;
 
+	enum class BucketResult {
+		/**
+		 * No bucket data is available.  Fall back to
+		 * Istream::Read().
+		 */
+		FALLBACK,
+
+		/**
+		 * No data is available right now.  Wait for the
+		 * IstreamHandler::OnIstreamReady() call.
+		 */
+		LATER,
+
+		/**
+		 * Some data has been transferred, more data will be
+		 * available later.
+		 */
+		MORE,
+
+		/**
+		 * Writing to our socket blocks.
+		 */
+		BLOCKING,
+
+		/**
+		 * The request #Istream is now empty.
+		 */
+		DEPLETED,
+
+		/**
+		 * This object has been destroyed inside the function.
+		 */
+		DESTROYED,
+	};
+
 	struct Request {
 		/**
 		 * This flag is set when the request istream has submitted
@@ -190,7 +224,7 @@ public:
 
 	void Start() noexcept {
 		socket.ScheduleRead();
-		input.Read();
+		socket.DeferWrite();
 	}
 
 private:
@@ -296,6 +330,15 @@ private:
 	 */
 	BufferedResult ConsumeInput(std::span<const std::byte> src) noexcept;
 
+	/**
+	 * Try to send request data from #input via
+	 * Istream::FillBucketList() with one writev() call; the
+	 * buckets refer to the buffers of the PARAMS block and the
+	 * request body, and #FcgiIstream inserts the STDIN record
+	 * headers between them.
+	 */
+	BucketResult TryWriteBuckets() noexcept;
+
 	/* virtual methods from class BufferedSocketHandler */
 	BufferedResult OnBufferedData() override;
 	bool OnBufferedClosed() noexcept override;
@@ -1190,12 +1233,105 @@ FcgiClient::OnBufferedClosed() noexcept
 	return true;
 }
 
+inline FcgiClient::BucketResult
+FcgiClient::TryWriteBuckets() noexcept
+{
+	IstreamBucketList list;
+
+	try {
+		input.FillBucketList(list);
+	} catch (...) {
+		stopwatch.RecordEvent("request_error");
+		AbortResponse(NestException(std::current_exception(),
+					    std::runtime_error("FastCGI request stream failed")));
+		return BucketResult::DESTROYED;
+	}
+
+	StaticVector<struct iovec, 64> v;
+	for (const auto &bucket : list) {
+		if (!bucket.IsBuffer())
+			break;
+
+		v.push_back(MakeIovec(bucket.GetBuffer()));
+
+		if (v.full())
+			break;
+	}
+
+	if (v.empty()) {
+		if (list.HasMore())
+			return list.ShouldFallback()
+				? BucketResult::FALLBACK
+				: BucketResult::LATER;
+
+		stopwatch.RecordEvent("request_end");
+		CloseInput();
+		socket.UnscheduleWrite();
+		return BucketResult::DEPLETED;
+	}
+
+	ssize_t nbytes = socket.WriteV(v);
+	if (nbytes < 0) {
+		if (nbytes == WRITE_BLOCKING) [[likely]]
+			return BucketResult::BLOCKING;
+
+		if (nbytes == WRITE_DESTROYED)
+			return BucketResult::DESTROYED;
+
+		AbortResponse(NestException(std::make_exception_ptr(MakeSocketError("Write error")),
+					    FcgiClientError(FcgiClientErrorCode::IO,
+							    "write to FastCGI application failed")));
+		return BucketResult::DESTROYED;
+	}
+
+	request.got_data = true;
+
+	const auto r = input.ConsumeBucketList(nbytes);
+	assert(r.consumed == (std::size_t)nbytes);
+
+	if (r.eof) {
+		stopwatch.RecordEvent("request_end");
+		CloseInput();
+		socket.UnscheduleWrite();
+		return BucketResult::DEPLETED;
+	}
+
+	socket.ScheduleWrite();
+
+	return list.ShouldFallback()
+		? BucketResult::FALLBACK
+		: BucketResult::MORE;
+}
+
 bool
 FcgiClient::OnBufferedWrite()
 {
+	request.got_data = false;
+
+	switch (TryWriteBuckets()) {
+	case BucketResult::FALLBACK:
+		assert(HasInput());
+		break;
+
+	case BucketResult::LATER:
+		assert(HasInput());
+		socket.UnscheduleWrite();
+		return true;
+
+	case BucketResult::MORE:
+	case BucketResult::DEPLETED:
+		return true;
+
+	case BucketResult::BLOCKING:
+		socket.ScheduleWrite();
+		return true;
+
+	case BucketResult::DESTROYED:
+		return false;
+	}
+
 	const DestructObserver destructed(*this);
 
-	request.got_data = false;
 	input.Read();
 
 	const bool result = !destructed;
@@ -1294,72 +1430,17 @@ fcgi_client_request(struct pool *pool, EventLoop &event_loop,
 	static unsigned next_request_id = 1;
 	++next_request_id;
 
-	FcgiRecordHeader header{
-		.version = FCGI_VERSION_1,
-		.type = FcgiRecordType::BEGIN_REQUEST,
-		.request_id = next_request_id,
-	};
-	static constexpr FcgiBeginRequest begin_request{
-		.role = static_cast<uint16_t>(FcgiRole::RESPONDER),
-		.flags = FCGI_FLAG_KEEP_CONN,
-	};
+	const uint16_t request_id = next_request_id;
 
 	assert(http_method_is_valid(method));
 
 	GrowingBuffer buffer;
-	header.content_length = sizeof(begin_request);
-	buffer.WriteT(header);
-	buffer.WriteT(begin_request);
-
-	FcgiParamsSerializer ps(buffer, header.request_id);
-
-	ps("REQUEST_METHOD", http_method_to_string(method))
-		("REQUEST_URI", uri)
-		("SCRIPT_FILENAME", script_filename)
-		("SCRIPT_NAME", script_name)
-		("PATH_INFO", path_info)
-		("QUERY_STRING", query_string)
-		("DOCUMENT_ROOT", document_root)
-		("SERVER_SOFTWARE", PRODUCT_TOKEN);
-
-	if (remote_addr != nullptr)
-		ps("REMOTE_ADDR", remote_addr);
-
-	off_t available = body
-		? body.GetAvailable(false)
-		: -1;
-	if (available >= 0) {
-		const fmt::format_int value{available};
-
-		ps("HTTP_CONTENT_LENGTH", value.c_str())
-			/* PHP wants the parameter without
-			   "HTTP_" */
-			("CONTENT_LENGTH", value.c_str());
-	}
-
-	if (const char *content_type = headers.Get(content_type_header);
-	    content_type != nullptr)
-		/* same for the "Content-Type" request
-		   header */
-		ps("CONTENT_TYPE", content_type);
-
-	if (const char *https = headers.Get(x_cm4all_https_header);
-	    https != nullptr && strcmp(https, "on") == 0)
-		ps("HTTPS", https);
-
-	ps.Headers(headers);
-
-	for (const std::string_view param : params) {
-		const auto [name, value] = Split(param, '=');
-		if (!name.empty() && value.data() != nullptr)
-			ps(name, value);
-	}
-
-	ps.Commit();
-
-	header.type = FcgiRecordType::PARAMS;
-	header.content_length = 0;
-	buffer.WriteT(header);
+	fcgi_serialize_request(buffer, request_id, method, uri,
+			       script_filename, script_name, path_info,
+			       query_string, document_root, remote_addr,
+			       headers,
+			       body ? body.GetAvailable(false) : -1,
+			       params);
 
 	UnusedIstreamPtr request;
 
@@ -1368,11 +1449,15 @@ fcgi_client_request(struct pool *pool, EventLoop &event_loop,
 		request = NewConcatIstream(*pool,
 					   istream_gb_new(*pool, std::move(buffer)),
 					   istream_fcgi_new(*pool, std::move(body),
-							    header.request_id));
+							    request_id));
 	else {
 		/* no request body - append an empty STDIN packet */
-		header.type = FcgiRecordType::STDIN;
-		header.content_length = 0;
+		const FcgiRecordHeader header{
+			.version = FCGI_VERSION_1,
+			.type = FcgiRecordType::STDIN,
+			.request_id = request_id,
+			.content_length = 0,
+		};
 		buffer.WriteT(header);
 
 		request = istream_gb_new(*pool, std::move(buffer));
@@ -1382,7 +1467,7 @@ fcgi_client_request(struct pool *pool, EventLoop &event_loop,
 					      std::move(stopwatch),
 					      fd, fd_type, lease,
 					      std::move(stderr_fd),
-					      header.request_id, method,
+					      request_id, method,
 					      std::move(request),
 					      handler, cancel_ptr);
 	client->Start();
@@ -0,0 +1,1290 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "MConnection.hxx"
+#include "Error.hxx"
+#include "Protocol.hxx"
+#include "Serialize.hxx"
+#include "http/CommonHeaders.hxx"
+#include "http/HeaderLimits.hxx"
+#include "http/HeaderParser.hxx"
+#include "http/Method.hxx"
+#include "http/ResponseHandler.hxx"
+#include "istream/FifoBufferSink.hxx"
+#include "istream/LengthIstream.hxx"
+#include "istream/MultiFifoBufferIstream.hxx"
+#include "istream/New.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "memory/fb_pool.hxx"
+#include "net/SocketError.hxx"
+#include "net/SocketProtocolError.hxx"
+#include "net/TimeoutError.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "pool/pool.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DeleteDisposer.hxx"
+#include "util/Exception.hxx"
+#include "util/SpanCast.hxx"
+#include "util/StringSplit.hxx"
+#include "util/StringStrip.hxx"
+#include "AllocatorPtr.hxx"
+#include "lease.hxx"
+#include "stopwatch.hxx"
+#include "strmap.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr Event::Duration fcgi_multiplex_timeout = std::chrono::minutes(1);
+static constexpr Event::Duration fcgi_probe_timeout = std::chrono::seconds(10);
+
+/**
+ * The maximum payload of a STDIN record generated by us.  Smaller
+ * than the protocol limit, so the request bodies of concurrent
+ * requests are interleaved at a finer granularity.
+ */
+static constexpr std::size_t fcgi_max_stdin_record = 16384;
+
+class FcgiMultiplexConnection::Request final
+	: Cancellable, MultiFifoBufferIstreamHandler, FifoBufferSinkHandler,
+	  public IntrusiveListHook<IntrusiveHookMode::NORMAL>
+{
+	FcgiMultiplexConnection &connection;
+
+	/**
+	 * The caller's pool.  Must not be used after the request has
+	 * been detached from the caller.
+	 */
+	struct pool &pool;
+
+	const StopwatchPtr stopwatch;
+
+	LeasePtr lease_ref;
+
+	UniqueFileDescriptor stderr_fd;
+
+	/**
+	 * The response handler; nullptr after the response has been
+	 * submitted.
+	 */
+	HttpResponseHandler *handler;
+
+	std::optional<FifoBufferSink> request_body;
+
+	/**
+	 * The response body; only valid in #State::BODY.
+	 */
+	MultiFifoBufferIstream *response_body = nullptr;
+
+	StringMap headers;
+
+	/**
+	 * An incomplete response header line at the end of a STDOUT
+	 * record; the rest follows in the next one.
+	 */
+	std::string header_line;
+
+	std::size_t total_header_size = 0;
+
+	/**
+	 * The remaining number of response body bytes announced by
+	 * the "Content-Length" header, or -1 if unknown.
+	 */
+	off_t available = -1;
+
+	const uint_least16_t id;
+
+	HttpStatus status = HttpStatus::OK;
+
+	enum class State : uint_least8_t {
+		/**
+		 * Receiving response headers.
+		 */
+		HEADERS,
+
+		/**
+		 * The response headers are complete, but there is no
+		 * response body; waiting for END_REQUEST before the
+		 * response is submitted.
+		 */
+		NO_BODY,
+
+		/**
+		 * The response has been submitted and body data is
+		 * being received.
+		 */
+		BODY,
+
+		/**
+		 * The caller has lost interest, and ABORT_REQUEST has
+		 * been sent.  This object stays in the list until
+		 * END_REQUEST arrives, so the request id is not reused
+		 * too early.
+		 */
+		ABORTED,
+	} state = State::HEADERS;
+
+	/**
+	 * This flag is true in HEAD requests.  HTTP does not allow a
+	 * response body, so we ignore it.
+	 */
+	const bool no_body;
+
+	/**
+	 * Has the request body reached end-of-file?  The final empty
+	 * STDIN record is sent after its buffer has been drained.
+	 */
+	bool request_body_eof = false;
+
+public:
+	Request(FcgiMultiplexConnection &_connection, struct pool &_pool,
+		StopwatchPtr &&_stopwatch, Lease &lease, uint_least16_t _id,
+		HttpMethod method, UniqueFileDescriptor &&_stderr_fd,
+		HttpResponseHandler &_handler,
+		CancellablePointer &cancel_ptr) noexcept
+		:connection(_connection), pool(_pool),
+		 stopwatch(std::move(_stopwatch)),
+		 lease_ref(lease),
+		 stderr_fd(std::move(_stderr_fd)),
+		 handler(&_handler),
+		 id(_id),
+		 no_body(http_method_is_empty(method))
+	{
+		cancel_ptr = *this;
+	}
+
+	uint_least16_t GetId() const noexcept {
+		return id;
+	}
+
+	bool IsActive() const noexcept {
+		return state != State::ABORTED;
+	}
+
+	void SetRequestBody(UnusedIstreamPtr &&body) noexcept {
+		FifoBufferSinkHandler &sink_handler = *this;
+		request_body.emplace(std::move(body), sink_handler);
+	}
+
+	/**
+	 * Shall the request body be asked for more data?
+	 */
+	bool WantRequestBodyData() noexcept {
+		return request_body && !request_body_eof &&
+			!request_body->GetBuffer().IsFull();
+	}
+
+	void ReadRequestBody() noexcept {
+		assert(request_body);
+
+		request_body->Read();
+	}
+
+	/**
+	 * Copy one STDIN record from the request body buffer to the
+	 * output buffer.
+	 *
+	 * @return true if a record has been appended
+	 */
+	bool FillOutput() noexcept;
+
+	/**
+	 * Remove this object from the connection, release the lease
+	 * and delete it.
+	 */
+	void Destroy(PutAction action) noexcept;
+
+	/**
+	 * The connection has failed; report the error to the caller
+	 * and destroy this object.
+	 */
+	void Abort(std::exception_ptr error) noexcept;
+
+	/**
+	 * This request has failed, but the connection is still
+	 * usable; report the error to the caller and detach.
+	 */
+	void Fail(std::exception_ptr error) noexcept;
+
+	FrameResult OnStdoutHeader() const noexcept {
+		return state == State::HEADERS || state == State::BODY
+			? FrameResult::CONTINUE
+			: FrameResult::SKIP;
+	}
+
+	std::pair<FrameResult, std::size_t> OnStdout(std::span<const std::byte> src) noexcept;
+
+	void OnStderr(std::span<const std::byte> src) noexcept {
+		/* ignore errors and partial writes while forwarding
+		   STDERR payload, just like FcgiClient */
+		if (stderr_fd.IsDefined())
+			stderr_fd.Write(src);
+		else
+			fwrite(src.data(), 1, src.size(), stderr);
+	}
+
+	void SubmitResponse() noexcept;
+
+	void SubmitBody() noexcept {
+		if (state == State::BODY)
+			response_body->SubmitBuffer();
+	}
+
+	void OnEndRequest(FcgiProtocolStatus protocol_status) noexcept;
+
+private:
+	/**
+	 * Tell the FastCGI application to abort this request, and
+	 * release the lease.  This object remains (as a placeholder
+	 * for the request id) until END_REQUEST arrives; it may have
+	 * been destroyed already when this method returns.
+	 */
+	void Detach() noexcept;
+
+	/**
+	 * Throws on error.
+	 *
+	 * @return true if the response headers are complete
+	 */
+	bool HandleLine(std::string_view line);
+
+	/**
+	 * Feed STDOUT payload into the response header parser.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the number of bytes up to and including the empty
+	 * line which ends the headers, or 0 if more headers are
+	 * expected (the whole payload has been consumed)
+	 */
+	std::size_t ParseHeaders(std::string_view src);
+
+	/* virtual methods from class Cancellable */
+	void Cancel() noexcept override;
+
+	/* virtual methods from class MultiFifoBufferIstreamHandler */
+	void OnFifoBufferIstreamConsumed(std::size_t nbytes) noexcept override;
+	void OnFifoBufferIstreamClosed() noexcept override;
+
+	/* virtual methods from class FifoBufferSinkHandler */
+	bool OnFifoBufferSinkData() noexcept override;
+	void OnFifoBufferSinkEof() noexcept override;
+	void OnFifoBufferSinkError(std::exception_ptr error) noexcept override;
+};
+
+inline bool
+FcgiMultiplexConnection::Request::FillOutput() noexcept
+{
+	if (!request_body)
+		return false;
+
+	auto &buffer = request_body->GetBuffer();
+
+	if (auto r = buffer.Read(); !r.empty()) {
+		if (r.size() > fcgi_max_stdin_record)
+			r = r.first(fcgi_max_stdin_record);
+
+		connection.AppendRecordHeader(FcgiRecordType::STDIN, id,
+					      r.size());
+		connection.output.Write(r);
+		buffer.Consume(r.size());
+		return true;
+	}
+
+	buffer.FreeIfEmpty();
+
+	if (!request_body_eof)
+		return false;
+
+	/* the empty STDIN record marks the end of the request body */
+	connection.AppendRecordHeader(FcgiRecordType::STDIN, id, 0);
+	request_body.reset();
+	stopwatch.RecordEvent("request_end");
+	return true;
+}
+
+void
+FcgiMultiplexConnection::Request::Destroy(PutAction action) noexcept
+{
+	connection.RemoveRequest(*this);
+
+	if (lease_ref)
+		lease_ref.Release(action);
+
+	delete this;
+}
+
+void
+FcgiMultiplexConnection::Request::Detach() noexcept
+{
+	assert(state != State::ABORTED);
+
+	state = State::ABORTED;
+	handler = nullptr;
+	response_body = nullptr;
+	request_body.reset();
+	headers.Clear();
+
+	connection.SendAbortRequest(id);
+
+	lease_ref.Release(PutAction::REUSE);
+}
+
+void
+FcgiMultiplexConnection::Request::Abort(std::exception_ptr error) noexcept
+{
+	switch (state) {
+	case State::HEADERS:
+	case State::NO_BODY:
+		{
+			auto &_handler = *handler;
+			headers.Clear();
+			Destroy(PutAction::DESTROY);
+			_handler.InvokeError(std::move(error));
+		}
+
+		break;
+
+	case State::BODY:
+		{
+			auto &rbc = *response_body;
+			Destroy(PutAction::DESTROY);
+			rbc.DestroyError(std::move(error));
+		}
+
+		break;
+
+	case State::ABORTED:
+		Destroy(PutAction::DESTROY);
+		break;
+	}
+}
+
+void
+FcgiMultiplexConnection::Request::Fail(std::exception_ptr error) noexcept
+{
+	switch (state) {
+	case State::HEADERS:
+	case State::NO_BODY:
+		{
+			auto &_handler = *handler;
+			Detach();
+			_handler.InvokeError(std::move(error));
+		}
+
+		break;
+
+	case State::BODY:
+		{
+			auto &rbc = *response_body;
+			Detach();
+			rbc.DestroyError(std::move(error));
+		}
+
+		break;
+
+	case State::ABORTED:
+		break;
+	}
+}
+
+inline bool
+FcgiMultiplexConnection::Request::HandleLine(std::string_view line)
+{
+	if (line.empty()) {
+		stopwatch.RecordEvent("response_headers");
+		return true;
+	}
+
+	if (line.size() >= MAX_HTTP_HEADER_SIZE)
+		throw FcgiClientError{FcgiClientErrorCode::GARBAGE, "Response header is too long"};
+
+	total_header_size += line.size();
+	if (total_header_size >= MAX_TOTAL_HTTP_HEADER_SIZE)
+		throw FcgiClientError{FcgiClientErrorCode::GARBAGE, "Too many response headers"};
+
+	if (!header_parse_line(pool, headers, line))
+		throw FcgiClientError(FcgiClientErrorCode::GARBAGE, "Malformed FastCGI response header");
+
+	return false;
+}
+
+inline std::size_t
+FcgiMultiplexConnection::Request::ParseHeaders(const std::string_view src0)
+{
+	std::string_view src = src0;
+
+	while (true) {
+		const auto [line, rest] = Split(src, '\n');
+		if (rest.data() == nullptr) {
+			if (header_line.size() + line.size() >= MAX_HTTP_HEADER_SIZE)
+				throw FcgiClientError{FcgiClientErrorCode::GARBAGE, "Response header is too long"};
+
+			header_line.append(line);
+			return 0;
+		}
+
+		bool complete;
+		if (header_line.empty()) {
+			complete = HandleLine(StripRight(line));
+		} else {
+			header_line.append(line);
+			complete = HandleLine(StripRight(std::string_view{header_line}));
+			header_line.clear();
+		}
+
+		if (complete)
+			return rest.data() - src0.data();
+
+		src = rest;
+	}
+}
+
+std::pair<FcgiFrameHandler::FrameResult, std::size_t>
+FcgiMultiplexConnection::Request::OnStdout(std::span<const std::byte> src) noexcept
+{
+	switch (state) {
+	case State::HEADERS:
+		try {
+			const std::size_t end = ParseHeaders(ToStringView(src));
+			if (end == 0)
+				return {FrameResult::CONTINUE, src.size()};
+
+			connection.pending = Pending::RESPONSE;
+			return {FrameResult::STOP, end};
+		} catch (...) {
+			connection.pending_error = std::current_exception();
+			connection.pending = Pending::ERROR;
+			return {FrameResult::STOP, 0};
+		}
+
+	case State::BODY:
+		if (available >= 0 && std::cmp_greater(src.size(), available)) {
+			connection.pending_error =
+				std::make_exception_ptr(FcgiClientError(FcgiClientErrorCode::GARBAGE,
+									"excess data at end of body "
+									"from FastCGI application"));
+			connection.pending = Pending::ERROR;
+			return {FrameResult::STOP, 0};
+		}
+
+		if (response_body->GetAvailable() >= max_response_buffer) {
+			/* the consumer is too slow; stop parsing (and
+			   reading) until OnFifoBufferIstreamConsumed() */
+			connection.blocked = true;
+			return {FrameResult::CONTINUE, 0};
+		}
+
+		response_body->Push(src);
+		if (available >= 0)
+			available -= src.size();
+
+		connection.pending = Pending::BODY;
+		return {FrameResult::STOP, src.size()};
+
+	case State::NO_BODY:
+	case State::ABORTED:
+		break;
+	}
+
+	/* ignore the rest of this STDOUT payload */
+	return {FrameResult::SKIP, 0};
+}
+
+void
+FcgiMultiplexConnection::Request::SubmitResponse() noexcept
+{
+	assert(state == State::HEADERS);
+	assert(handler != nullptr);
+
+	const char *p = headers.Remove(status_header);
+	if (p != nullptr) {
+		int i = atoi(p);
+		if (http_status_is_valid(static_cast<HttpStatus>(i)))
+			status = static_cast<HttpStatus>(i);
+	}
+
+	if (no_body || http_status_is_empty(status)) {
+		stopwatch.RecordEvent("response_no_body");
+		state = State::NO_BODY;
+		return;
+	}
+
+	p = headers.Remove(content_length_header);
+	if (p != nullptr) {
+		char *endptr;
+		unsigned long long l = strtoull(p, &endptr, 10);
+		if (endptr > p && *endptr == 0)
+			available = l;
+	}
+
+	MultiFifoBufferIstreamHandler &fbi_handler = *this;
+	response_body = NewFromPool<MultiFifoBufferIstream>(pool, pool,
+							    fbi_handler);
+	state = State::BODY;
+
+	UnusedIstreamPtr body{response_body};
+	if (available >= 0)
+		body = NewIstreamPtr<LengthIstream>(pool, std::move(body),
+						    available);
+
+	std::exchange(handler, nullptr)->InvokeResponse(status,
+							std::move(headers),
+							std::move(body));
+}
+
+void
+FcgiMultiplexConnection::Request::OnEndRequest(FcgiProtocolStatus protocol_status) noexcept
+{
+	stopwatch.RecordEvent("end");
+
+	if (state == State::ABORTED) {
+		Destroy(PutAction::REUSE);
+		return;
+	}
+
+	switch (protocol_status) {
+	case FcgiProtocolStatus::REQUEST_COMPLETE:
+	case FcgiProtocolStatus::UNKNOWN_ROLE:
+		break;
+
+	case FcgiProtocolStatus::CANT_MPX_CONN:
+	case FcgiProtocolStatus::OVERLOADED:
+		if (state != State::BODY) {
+			/* the application has rejected this request;
+			   the caller may retry it elsewhere */
+			Abort(std::make_exception_ptr(FcgiClientError(FcgiClientErrorCode::REFUSED,
+								      "FastCGI application has rejected the request")));
+			return;
+		}
+
+		break;
+	}
+
+	switch (state) {
+	case State::HEADERS:
+		Abort(std::make_exception_ptr(FcgiClientError(FcgiClientErrorCode::GARBAGE,
+							      "premature end of headers "
+							      "from FastCGI application")));
+		break;
+
+	case State::NO_BODY:
+		{
+			auto &_handler = *handler;
+			StringMap _headers{std::move(headers)};
+			const auto _status = status;
+			Destroy(PutAction::REUSE);
+			_handler.InvokeResponse(_status, std::move(_headers),
+						UnusedIstreamPtr{});
+		}
+
+		break;
+
+	case State::BODY:
+		if (available > 0) {
+			Abort(std::make_exception_ptr(FcgiClientError(FcgiClientErrorCode::GARBAGE,
+								      "premature end of body "
+								      "from FastCGI application")));
+			break;
+		}
+
+		{
+			auto &rbc = *response_body;
+			Destroy(PutAction::REUSE);
+			rbc.SetEof();
+		}
+
+		break;
+
+	case State::ABORTED:
+		/* handled above */
+		break;
+	}
+}
+
+void
+FcgiMultiplexConnection::Request::Cancel() noexcept
+{
+	assert(state == State::HEADERS || state == State::NO_BODY);
+
+	stopwatch.RecordEvent("cancel");
+	Detach();
+}
+
+void
+FcgiMultiplexConnection::Request::OnFifoBufferIstreamConsumed(std::size_t) noexcept
+{
+	assert(state == State::BODY);
+
+	if (response_body->GetAvailable() < max_response_buffer)
+		connection.Resume();
+}
+
+void
+FcgiMultiplexConnection::Request::OnFifoBufferIstreamClosed() noexcept
+{
+	assert(state == State::BODY);
+
+	stopwatch.RecordEvent("close");
+
+	/* if the connection waits for this response body to be
+	   consumed, it can proceed now */
+	connection.Resume();
+	Detach();
+}
+
+bool
+FcgiMultiplexConnection::Request::OnFifoBufferSinkData() noexcept
+{
+	connection.defer_write.Schedule();
+	return true;
+}
+
+void
+FcgiMultiplexConnection::Request::OnFifoBufferSinkEof() noexcept
+{
+	request_body_eof = true;
+	connection.defer_write.Schedule();
+}
+
+void
+FcgiMultiplexConnection::Request::OnFifoBufferSinkError(std::exception_ptr error) noexcept
+{
+	stopwatch.RecordEvent("request_error");
+
+	Fail(NestException(error,
+			   FcgiClientError(FcgiClientErrorCode::UNSPECIFIED,
+					   "FastCGI request stream failed")));
+}
+
+FcgiMultiplexConnection::FcgiMultiplexConnection(EventLoop &event_loop,
+						 FcgiMultiplexConnectionHandler &_handler) noexcept
+	:handler(_handler),
+	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady)),
+	 timeout_event(event_loop, BIND_THIS_METHOD(OnTimeout)),
+	 defer_write(event_loop, BIND_THIS_METHOD(OnDeferredWrite)),
+	 defer_resume(event_loop, BIND_THIS_METHOD(OnDeferredResume))
+{
+}
+
+FcgiMultiplexConnection::~FcgiMultiplexConnection() noexcept
+{
+	/* only requests which have been detached may be left; they
+	   don't hold a lease */
+	assert(!HasActiveRequests());
+
+	requests.clear_and_dispose(DeleteDisposer{});
+	Disconnect();
+}
+
+void
+FcgiMultiplexConnection::Connect()
+{
+	assert(!socket.IsDefined());
+
+	socket.Open(handler.OnFcgiMultiplexConnect().Release());
+	socket.ScheduleRead();
+}
+
+void
+FcgiMultiplexConnection::Disconnect() noexcept
+{
+	timeout_event.Cancel();
+	defer_write.Cancel();
+	defer_resume.Cancel();
+
+	if (socket.IsDefined())
+		socket.Close();
+
+	input.FreeIfDefined();
+	output.Clear();
+	parser = {};
+	current = nullptr;
+	pending = Pending::NONE;
+	pending_error = {};
+	probing = false;
+	blocked = false;
+}
+
+void
+FcgiMultiplexConnection::Fail(std::exception_ptr error) noexcept
+{
+	const bool was_probing = probing;
+	Disconnect();
+
+	if (was_probing) {
+		handler.OnFcgiMultiplexProbe(false);
+		return;
+	}
+
+	if (HasActiveRequests())
+		handler.OnFcgiMultiplexError(error);
+
+	AbortAllRequests(std::move(error));
+}
+
+void
+FcgiMultiplexConnection::AbortAllRequests(std::exception_ptr error) noexcept
+{
+	const DestructObserver destructed{*this};
+
+	while (!requests.empty()) {
+		requests.front().Abort(error);
+		if (destructed)
+			return;
+	}
+}
+
+bool
+FcgiMultiplexConnection::HasActiveRequests() const noexcept
+{
+	return std::any_of(requests.begin(), requests.end(),
+			   [](const Request &request){
+				   return request.IsActive();
+			   });
+}
+
+FcgiMultiplexConnection::Request *
+FcgiMultiplexConnection::FindRequest(uint_least16_t id) noexcept
+{
+	for (auto &i : requests)
+		if (i.GetId() == id)
+			return &i;
+
+	return nullptr;
+}
+
+uint_least16_t
+FcgiMultiplexConnection::NextRequestId() noexcept
+{
+	do {
+		/* request id 0 is reserved for management records */
+		last_request_id = last_request_id < 0xffff
+			? last_request_id + 1
+			: 1;
+	} while (FindRequest(last_request_id) != nullptr);
+
+	return last_request_id;
+}
+
+void
+FcgiMultiplexConnection::RemoveRequest(Request &request) noexcept
+{
+	if (current == &request)
+		current = nullptr;
+
+	requests.erase(requests.iterator_to(request));
+
+	if (!probing && !HasActiveRequests())
+		timeout_event.Cancel();
+
+	/* the removed request may have been blocking the input */
+	Resume();
+}
+
+void
+FcgiMultiplexConnection::ScheduleTimeout() noexcept
+{
+	timeout_event.Schedule(probing
+			       ? fcgi_probe_timeout
+			       : fcgi_multiplex_timeout);
+}
+
+void
+FcgiMultiplexConnection::AppendRecordHeader(FcgiRecordType type,
+					    uint_least16_t request_id,
+					    std::size_t content_length) noexcept
+{
+	assert(content_length <= 0xffff);
+
+	const FcgiRecordHeader header{
+		.version = FCGI_VERSION_1,
+		.type = type,
+		.request_id = request_id,
+		.content_length = static_cast<uint16_t>(content_length),
+		.padding_length = 0,
+		.reserved = {},
+	};
+
+	output.WriteT(header);
+}
+
+void
+FcgiMultiplexConnection::SendAbortRequest(uint_least16_t request_id) noexcept
+{
+	if (!socket.IsDefined())
+		return;
+
+	AppendRecordHeader(FcgiRecordType::ABORT_REQUEST, request_id, 0);
+	defer_write.Schedule();
+}
+
+bool
+FcgiMultiplexConnection::FillOutput() noexcept
+{
+	/* round-robin: one record per request and pass, so a large
+	   request body does not delay all others */
+	bool progress = true;
+	while (progress) {
+		progress = false;
+
+		for (auto &request : requests) {
+			if (output.GetSize() >= max_output)
+				return true;
+
+			if (request.FillOutput())
+				progress = true;
+		}
+	}
+
+	return false;
+}
+
+bool
+FcgiMultiplexConnection::Flush() noexcept
+{
+	while (!output.IsEmpty()) {
+		const auto r = output.Read();
+		const auto nbytes = socket.GetSocket().Send(r, MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (nbytes < 0) {
+			const auto e = GetSocketError();
+			if (IsSocketErrorSendWouldBlock(e)) {
+				socket.ScheduleWrite();
+				return true;
+			}
+
+			Fail(NestException(std::make_exception_ptr(MakeSocketError(e, "Send failed")),
+					   FcgiClientError(FcgiClientErrorCode::IO,
+							   "Write error on FastCGI connection")));
+			return false;
+		}
+
+		output.Consume(nbytes);
+
+		if (std::cmp_less(nbytes, r.size())) {
+			socket.ScheduleWrite();
+			return true;
+		}
+	}
+
+	socket.CancelWrite();
+	return true;
+}
+
+void
+FcgiMultiplexConnection::ReadRequestBodies() noexcept
+{
+	const DestructObserver destructed{*this};
+
+	for (auto i = requests.begin(); i != requests.end();) {
+		auto &request = *i++;
+
+		if (request.WantRequestBodyData()) {
+			request.ReadRequestBody();
+			if (destructed)
+				return;
+		}
+	}
+}
+
+void
+FcgiMultiplexConnection::OnDeferredWrite() noexcept
+{
+	if (!socket.IsDefined())
+		return;
+
+	const bool more = FillOutput();
+
+	if (!output.IsEmpty()) {
+		if (HasActiveRequests() || probing)
+			ScheduleTimeout();
+
+		if (!Flush())
+			return;
+	}
+
+	if (more && output.IsEmpty())
+		defer_write.Schedule();
+
+	ReadRequestBodies();
+}
+
+void
+FcgiMultiplexConnection::TryRead() noexcept
+{
+	input.AllocateIfNull(fb_pool_get());
+
+	const auto w = input.Write();
+	if (w.empty()) {
+		/* the parser is blocked; Resume() will continue */
+		socket.CancelRead();
+		return;
+	}
+
+	const auto nbytes = socket.GetSocket().Receive(w, MSG_DONTWAIT);
+	if (nbytes < 0) {
+		const auto e = GetSocketError();
+		if (IsSocketErrorReceiveWouldBlock(e)) {
+			input.FreeIfEmpty();
+			return;
+		}
+
+		Fail(NestException(std::make_exception_ptr(MakeSocketError(e, "Receive failed")),
+				   FcgiClientError(FcgiClientErrorCode::IO,
+						   "FastCGI socket error")));
+		return;
+	}
+
+	if (nbytes == 0) {
+		if (!probing && !HasActiveRequests()) {
+			/* the application has closed the idle
+			   connection; the next request will reconnect */
+			Disconnect();
+			requests.clear_and_dispose(DeleteDisposer{});
+			return;
+		}
+
+		Fail(std::make_exception_ptr(SocketClosedPrematurelyError{}));
+		return;
+	}
+
+	input.Append(nbytes);
+
+	if (probing || HasActiveRequests())
+		ScheduleTimeout();
+
+	ParseInput();
+}
+
+void
+FcgiMultiplexConnection::ParseInput() noexcept
+{
+	while (true) {
+		switch (parser.Feed(input.Read(), *this)) {
+		case FcgiParser::FeedResult::OK:
+		case FcgiParser::FeedResult::MORE:
+			input.FreeIfEmpty();
+			return;
+
+		case FcgiParser::FeedResult::BLOCKING:
+			/* a response body buffer is full */
+			assert(blocked);
+			socket.CancelRead();
+			return;
+
+		case FcgiParser::FeedResult::STOP:
+			if (!HandlePending())
+				return;
+
+			if (!socket.IsDefined())
+				/* disconnected by a handler */
+				return;
+
+			break;
+
+		case FcgiParser::FeedResult::CLOSED:
+			return;
+		}
+	}
+}
+
+void
+FcgiMultiplexConnection::Resume() noexcept
+{
+	if (blocked)
+		defer_resume.Schedule();
+}
+
+void
+FcgiMultiplexConnection::OnDeferredResume() noexcept
+{
+	assert(blocked);
+	assert(socket.IsDefined());
+
+	blocked = false;
+	socket.ScheduleRead();
+	ParseInput();
+}
+
+bool
+FcgiMultiplexConnection::HandlePending() noexcept
+{
+	const DestructObserver destructed{*this};
+
+	switch (std::exchange(pending, Pending::NONE)) {
+	case Pending::NONE:
+		break;
+
+	case Pending::RESPONSE:
+		if (current != nullptr)
+			current->SubmitResponse();
+		break;
+
+	case Pending::BODY:
+		if (current != nullptr)
+			current->SubmitBody();
+		break;
+
+	case Pending::END:
+		if (auto *request = std::exchange(current, nullptr)) {
+			auto protocol_status = FcgiProtocolStatus::REQUEST_COMPLETE;
+			if (record_payload_size >= sizeof(FcgiEndRequest)) {
+				const auto &end = *reinterpret_cast<const FcgiEndRequest *>(record_payload.data());
+				protocol_status = static_cast<FcgiProtocolStatus>(end.protocol_status);
+			}
+
+			if (protocol_status == FcgiProtocolStatus::CANT_MPX_CONN) {
+				/* the application has changed its
+				   mind; stop multiplexing (this
+				   request gets retried) */
+				handler.OnFcgiMultiplexError(std::make_exception_ptr(FcgiClientError(FcgiClientErrorCode::REFUSED,
+												     "FastCGI application refuses to multiplex")));
+				if (destructed)
+					return false;
+			}
+
+			request->OnEndRequest(protocol_status);
+		}
+
+		break;
+
+	case Pending::ERROR:
+		if (current != nullptr)
+			current->Fail(std::exchange(pending_error, {}));
+		else
+			pending_error = {};
+		break;
+
+	case Pending::PROBE:
+		OnProbeResult();
+		break;
+	}
+
+	return !destructed;
+}
+
+inline void
+FcgiMultiplexConnection::OnProbeResult() noexcept
+{
+	assert(probing);
+
+	probing = false;
+
+	const bool supported = current_type == FcgiRecordType::GET_VALUES_RESULT &&
+		fcgi_find_param(std::span{record_payload}.first(record_payload_size),
+				"FCGI_MPXS_CONNS"sv) == "1"sv;
+
+	if (supported) {
+		if (!HasActiveRequests())
+			timeout_event.Cancel();
+	} else
+		Disconnect();
+
+	handler.OnFcgiMultiplexProbe(supported);
+}
+
+void
+FcgiMultiplexConnection::OnSocketReady(unsigned events) noexcept
+{
+	if (events & SocketEvent::WRITE) {
+		const DestructObserver destructed{*this};
+		OnDeferredWrite();
+		if (destructed || !socket.IsDefined())
+			return;
+	}
+
+	if (events & (SocketEvent::READ|SocketEvent::ERROR|SocketEvent::HANGUP))
+		TryRead();
+}
+
+void
+FcgiMultiplexConnection::OnTimeout() noexcept
+{
+	Fail(std::make_exception_ptr(TimeoutError{}));
+}
+
+void
+FcgiMultiplexConnection::Probe()
+{
+	assert(!socket.IsDefined());
+	assert(requests.empty());
+
+	Connect();
+	probing = true;
+
+	FcgiParamsSerializer ps{output, FcgiRecordType::GET_VALUES, 0};
+	ps("FCGI_MPXS_CONNS"sv, ""sv);
+	ps.Commit();
+
+	ScheduleTimeout();
+	defer_write.Schedule();
+}
+
+void
+FcgiMultiplexConnection::SendRequest(struct pool &pool, StopwatchPtr stopwatch,
+				     Lease &lease,
+				     HttpMethod method, const char *uri,
+				     const char *script_filename,
+				     const char *script_name,
+				     const char *path_info,
+				     const char *query_string,
+				     const char *document_root,
+				     const char *remote_addr,
+				     const StringMap &headers,
+				     UnusedIstreamPtr body,
+				     std::span<const char *const> params,
+				     UniqueFileDescriptor &&stderr_fd,
+				     HttpResponseHandler &_handler,
+				     CancellablePointer &cancel_ptr) noexcept
+{
+	auto *request = new Request(*this, pool, std::move(stopwatch), lease,
+				    NextRequestId(), method,
+				    std::move(stderr_fd), _handler, cancel_ptr);
+	requests.push_back(*request);
+
+	if (!socket.IsDefined()) {
+		try {
+			Connect();
+		} catch (...) {
+			request->Abort(NestException(std::current_exception(),
+						     FcgiClientError(FcgiClientErrorCode::REFUSED,
+								     "Failed to connect to FastCGI server")));
+			return;
+		}
+	}
+
+	const off_t content_length = body ? body.GetAvailable(false) : -1;
+
+	fcgi_serialize_request(output, request->GetId(), method, uri,
+			       script_filename, script_name, path_info,
+			       query_string, document_root, remote_addr,
+			       headers, content_length, params);
+
+	if (body)
+		request->SetRequestBody(std::move(body));
+	else
+		AppendRecordHeader(FcgiRecordType::STDIN, request->GetId(), 0);
+
+	ScheduleTimeout();
+	defer_write.Schedule();
+}
+
+/*
+ * FcgiFrameHandler
+ *
+ */
+
+void
+FcgiMultiplexConnection::OnFrameConsumed(std::size_t nbytes) noexcept
+{
+	input.Consume(nbytes);
+}
+
+FcgiFrameHandler::FrameResult
+FcgiMultiplexConnection::OnFrameHeader(FcgiRecordType type,
+				       uint_least16_t request_id)
+{
+	current_type = type;
+	record_payload_size = 0;
+
+	if (request_id == 0) {
+		/* a management record */
+		current = nullptr;
+
+		switch (type) {
+		case FcgiRecordType::GET_VALUES_RESULT:
+		case FcgiRecordType::UNKNOWN_TYPE:
+			return probing
+				? FrameResult::CONTINUE
+				: FrameResult::SKIP;
+
+		default:
+			return FrameResult::SKIP;
+		}
+	}
+
+	current = FindRequest(request_id);
+	if (current == nullptr)
+		/* unknown request id; discard this record */
+		return FrameResult::SKIP;
+
+	switch (type) {
+	case FcgiRecordType::STDOUT:
+		return current->OnStdoutHeader();
+
+	case FcgiRecordType::STDERR:
+	case FcgiRecordType::END_REQUEST:
+		return FrameResult::CONTINUE;
+
+	default:
+		current = nullptr;
+		return FrameResult::SKIP;
+	}
+}
+
+std::pair<FcgiFrameHandler::FrameResult, std::size_t>
+FcgiMultiplexConnection::OnFramePayload(std::span<const std::byte> src)
+{
+	switch (current_type) {
+	case FcgiRecordType::STDOUT:
+		if (current == nullptr)
+			return {FrameResult::SKIP, 0};
+
+		return current->OnStdout(src);
+
+	case FcgiRecordType::STDERR:
+		if (current != nullptr)
+			current->OnStderr(src);
+		return {FrameResult::CONTINUE, src.size()};
+
+	default:
+		/* END_REQUEST or GET_VALUES_RESULT: collect the
+		   payload for OnFrameEnd() */
+		{
+			const std::size_t n = std::min(src.size(),
+						       record_payload.size() - record_payload_size);
+			std::copy_n(src.begin(), n,
+				    record_payload.begin() + record_payload_size);
+			record_payload_size += n;
+		}
+
+		return {FrameResult::CONTINUE, src.size()};
+	}
+}
+
+FcgiFrameHandler::FrameResult
+FcgiMultiplexConnection::OnFrameEnd()
+{
+	switch (current_type) {
+	case FcgiRecordType::END_REQUEST:
+		if (current == nullptr)
+			break;
+
+		pending = Pending::END;
+		return FrameResult::STOP;
+
+	case FcgiRecordType::GET_VALUES_RESULT:
+	case FcgiRecordType::UNKNOWN_TYPE:
+		if (!probing || current != nullptr)
+			break;
+
+		pending = Pending::PROBE;
+		return FrameResult::STOP;
+
+	default:
+		break;
+	}
+
+	return FrameResult::CONTINUE;
+}
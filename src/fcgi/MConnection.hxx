@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "Parser.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "memory/GrowingBuffer.hxx"
+#include "memory/SliceFifoBuffer.hxx"
+#include "util/DestructObserver.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <span>
+
+enum class HttpMethod : uint_least8_t;
+enum class FcgiRecordType : uint8_t;
+struct pool;
+class Lease;
+class UnusedIstreamPtr;
+class UniqueSocketDescriptor;
+class UniqueFileDescriptor;
+class StringMap;
+class HttpResponseHandler;
+class CancellablePointer;
+class StopwatchPtr;
+class EventLoop;
+
+class FcgiMultiplexConnectionHandler {
+public:
+	/**
+	 * Open a new socket to the FastCGI application.
+	 *
+	 * Throws on error.
+	 */
+	virtual UniqueSocketDescriptor OnFcgiMultiplexConnect() = 0;
+
+	/**
+	 * The FastCGI application has answered the FCGI_MPXS_CONNS
+	 * query (or failed to).  If multiplexing is not supported,
+	 * the connection has been closed and SendRequest() must not
+	 * be called.
+	 */
+	virtual void OnFcgiMultiplexProbe(bool supported) noexcept = 0;
+
+	/**
+	 * The connection has failed while requests were pending.
+	 * All requests are about to be aborted.
+	 */
+	virtual void OnFcgiMultiplexError(std::exception_ptr error) noexcept = 0;
+};
+
+/**
+ * A connection to a FastCGI application which advertises
+ * FCGI_MPXS_CONNS.  Any number of concurrent requests are sent over
+ * this one connection with distinct request ids; STDIN records of
+ * different requests are interleaved at record boundaries, and the
+ * records received are routed to the request they belong to.
+ *
+ * Call Probe() first to find out whether the application supports
+ * multiplexing.  If the application closes the socket while no
+ * request is pending, a new socket is connected by the next
+ * SendRequest() call.
+ */
+class FcgiMultiplexConnection final : FcgiFrameHandler, DestructAnchor {
+	/**
+	 * Stop reading from the socket while one response body
+	 * buffer holds this many bytes which have not yet been
+	 * consumed.  FastCGI has no per-request flow control, so a
+	 * slow response body consumer stalls all other requests on
+	 * this connection.
+	 */
+	static constexpr std::size_t max_response_buffer = 256 * 1024;
+
+	/**
+	 * Stop copying request body data to the output buffer while
+	 * it holds this many bytes.
+	 */
+	static constexpr std::size_t max_output = 64 * 1024;
+
+	FcgiMultiplexConnectionHandler &handler;
+
+	SocketEvent socket;
+
+	/**
+	 * Aborts all requests if the FastCGI application does not
+	 * respond in time.
+	 */
+	CoarseTimerEvent timeout_event;
+
+	/**
+	 * Copies request body data to the output buffer and sends
+	 * it.
+	 */
+	DeferEvent defer_write;
+
+	/**
+	 * Resumes parsing the input buffer after a response body
+	 * buffer has been drained.
+	 */
+	DeferEvent defer_resume;
+
+	SliceFifoBuffer input;
+
+	GrowingBuffer output;
+
+	FcgiParser parser;
+
+	class Request;
+	using RequestList = IntrusiveList<
+		Request,
+		IntrusiveListBaseHookTraits<Request>,
+		IntrusiveListOptions{.constant_time_size = true}>;
+
+	/**
+	 * All requests whose END_REQUEST record has not yet been
+	 * received, including those which have been aborted by us.
+	 */
+	RequestList requests;
+
+	/**
+	 * The request the current record belongs to, or nullptr if
+	 * it shall be ignored.
+	 */
+	Request *current = nullptr;
+
+	/**
+	 * The payload of the current END_REQUEST or
+	 * GET_VALUES_RESULT record.
+	 */
+	std::array<std::byte, 256> record_payload;
+	std::size_t record_payload_size = 0;
+
+	std::exception_ptr pending_error;
+
+	FcgiRecordType current_type{};
+
+	/**
+	 * What shall ParseInput() do after the #FcgiParser has
+	 * returned #FcgiParser::FeedResult::STOP?  External handlers
+	 * are only invoked from there, because they may destroy this
+	 * object.
+	 */
+	enum class Pending : uint_least8_t {
+		NONE,
+
+		/**
+		 * The response headers of #current are complete.
+		 */
+		RESPONSE,
+
+		/**
+		 * Data has been added to the response body of
+		 * #current.
+		 */
+		BODY,
+
+		/**
+		 * The END_REQUEST record of #current has been
+		 * received.
+		 */
+		END,
+
+		/**
+		 * #current has failed with #pending_error.
+		 */
+		ERROR,
+
+		/**
+		 * The answer to our GET_VALUES record has been
+		 * received.
+		 */
+		PROBE,
+	} pending = Pending::NONE;
+
+	uint_least16_t last_request_id = 0;
+
+	/**
+	 * Are we waiting for the answer to our GET_VALUES record?
+	 */
+	bool probing = false;
+
+	/**
+	 * Has reading from the socket been paused because a response
+	 * body buffer is full?
+	 */
+	bool blocked = false;
+
+public:
+	FcgiMultiplexConnection(EventLoop &event_loop,
+				FcgiMultiplexConnectionHandler &_handler) noexcept;
+
+	~FcgiMultiplexConnection() noexcept;
+
+	FcgiMultiplexConnection(const FcgiMultiplexConnection &) = delete;
+	FcgiMultiplexConnection &operator=(const FcgiMultiplexConnection &) = delete;
+
+	/**
+	 * Connect to the FastCGI application and ask whether it
+	 * supports multiplexing.  The answer will be delivered to
+	 * FcgiMultiplexConnectionHandler::OnFcgiMultiplexProbe().
+	 *
+	 * Throws on error.
+	 */
+	void Probe();
+
+	/**
+	 * Sends a HTTP request to the FastCGI application, and
+	 * passes the response to the handler.  The parameters are
+	 * the same as for fcgi_client_request().
+	 *
+	 * @param lease released as soon as the request is finished
+	 * or canceled; the connection remains usable either way
+	 */
+	void SendRequest(struct pool &pool, StopwatchPtr stopwatch,
+			 Lease &lease,
+			 HttpMethod method, const char *uri,
+			 const char *script_filename,
+			 const char *script_name, const char *path_info,
+			 const char *query_string,
+			 const char *document_root,
+			 const char *remote_addr,
+			 const StringMap &headers, UnusedIstreamPtr body,
+			 std::span<const char *const> params,
+			 UniqueFileDescriptor &&stderr_fd,
+			 HttpResponseHandler &handler,
+			 CancellablePointer &cancel_ptr) noexcept;
+
+private:
+	/**
+	 * Throws on error.
+	 */
+	void Connect();
+
+	void Disconnect() noexcept;
+
+	/**
+	 * Close the socket and abort all requests.  This object may
+	 * have been destroyed when this method returns.
+	 */
+	void Fail(std::exception_ptr error) noexcept;
+
+	void AbortAllRequests(std::exception_ptr error) noexcept;
+
+	[[gnu::pure]]
+	bool HasActiveRequests() const noexcept;
+
+	[[gnu::pure]]
+	Request *FindRequest(uint_least16_t id) noexcept;
+
+	uint_least16_t NextRequestId() noexcept;
+
+	void RemoveRequest(Request &request) noexcept;
+
+	void ScheduleTimeout() noexcept;
+
+	void AppendRecordHeader(FcgiRecordType type, uint_least16_t request_id,
+				std::size_t content_length) noexcept;
+
+	/**
+	 * Tell the FastCGI application to abort the given request.
+	 */
+	void SendAbortRequest(uint_least16_t request_id) noexcept;
+
+	/**
+	 * Copy request body data to the output buffer, one record
+	 * per request at a time.
+	 *
+	 * @return true if there is more data which did not fit into
+	 * the output buffer
+	 */
+	bool FillOutput() noexcept;
+
+	/**
+	 * Send the output buffer to the socket.
+	 *
+	 * @return false if this object has been destroyed
+	 */
+	bool Flush() noexcept;
+
+	/**
+	 * Ask all request bodies to fill their buffers.
+	 */
+	void ReadRequestBodies() noexcept;
+
+	void OnDeferredWrite() noexcept;
+
+	void TryRead() noexcept;
+
+	void ParseInput() noexcept;
+
+	void OnDeferredResume() noexcept;
+
+	/**
+	 * Called by the #Request when its response body buffer has
+	 * been drained or closed.
+	 */
+	void Resume() noexcept;
+
+	/**
+	 * Execute #pending.
+	 *
+	 * @return false if this object has been destroyed
+	 */
+	bool HandlePending() noexcept;
+
+	void OnProbeResult() noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+	void OnTimeout() noexcept;
+
+	/* virtual methods from class FcgiFrameHandler */
+	void OnFrameConsumed(std::size_t nbytes) noexcept override;
+	FrameResult OnFrameHeader(FcgiRecordType type,
+				  uint_least16_t request_id) override;
+	std::pair<FrameResult, std::size_t> OnFramePayload(std::span<const std::byte> src) override;
+	FrameResult OnFrameEnd() override;
+};
@@ -5,6 +5,7 @@
 #include "Request.hxx"
 #include "Stock.hxx"
 #include "SConnection.hxx"
+#include "MConnection.hxx"
 #include "Client.hxx"
 #include "http/PendingRequest.hxx"
 #include "http/ResponseHandler.hxx"
@@ -164,6 +165,22 @@ FcgiRequest::OnStockItemReady(StockItem &item) noexcept
 
 	const char *script_filename = address.path;
 
+	if (auto *multiplex = fcgi_stock_item_get_multiplex(*stock_item)) {
+		multiplex->SendRequest(pool, std::move(stopwatch), *this,
+				       pending_request.method, pending_request.uri,
+				       script_filename,
+				       address.script_name, address.path_info,
+				       address.query_string,
+				       address.document_root,
+				       remote_addr,
+				       pending_request.headers,
+				       std::move(pending_request.body),
+				       address.params.ToArray(pool),
+				       std::move(stderr_fd2),
+				       *this, cancel_ptr);
+		return;
+	}
+
 	fcgi_client_request(&pool, item.GetStock().GetEventLoop(), std::move(stopwatch),
 			    fcgi_stock_item_get(*stock_item),
 			    FdType::FD_SOCKET,
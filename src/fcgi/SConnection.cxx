@@ -19,6 +19,17 @@ FcgiStockConnection::FcgiStockConnection(CreateStockItem c, ListenChildStockItem
 {
 }
 
+FcgiStockConnection::FcgiStockConnection(CreateStockItem c, ListenChildStockItem &_child,
+					 FcgiMultiplexConnection &_multiplex) noexcept
+	:StockItem(c), logger(GetStockName()),
+	 child(_child),
+	 multiplex(&_multiplex),
+	 event(GetStock().GetEventLoop(), BIND_THIS_METHOD(OnSocketEvent)),
+	 defer_schedule_read(GetStock().GetEventLoop(),
+			     BIND_THIS_METHOD(DeferredScheduleRead))
+{
+}
+
 inline void
 FcgiStockConnection::SetAborted() noexcept
 {
@@ -47,6 +58,10 @@ FcgiStockConnection::OnSocketEvent(unsigned) noexcept
 bool
 FcgiStockConnection::Borrow() noexcept
 {
+	if (multiplex != nullptr)
+		/* the shared connection checks its socket itself */
+		return true;
+
 	if (event.GetReadyFlags() != 0) [[unlikely]] {
 		/* this connection was probably closed, but our
 		   SocketEvent callback hasn't been invoked yet;
@@ -65,13 +80,17 @@ bool
 FcgiStockConnection::Release() noexcept
 {
 	fresh = false;
-	defer_schedule_read.ScheduleIdle();
+
+	if (multiplex == nullptr)
+		defer_schedule_read.ScheduleIdle();
+
 	return true;
 }
 
 FcgiStockConnection::~FcgiStockConnection() noexcept
 {
-	event.Close();
+	if (event.IsDefined())
+		event.Close();
 }
 
 UniqueFileDescriptor
@@ -95,6 +114,13 @@ fcgi_stock_item_set_uri(StockItem &item, const char *uri) noexcept
 	connection.SetUri(uri);
 }
 
+FcgiMultiplexConnection *
+fcgi_stock_item_get_multiplex(const StockItem &item) noexcept
+{
+	const auto &connection = (const FcgiStockConnection &)item;
+	return connection.GetMultiplex();
+}
+
 SocketDescriptor
 fcgi_stock_item_get(const StockItem &item) noexcept
 {
@@ -11,12 +11,20 @@
 #include "io/Logger.hxx"
 
 class UniqueSocketDescriptor;
+class FcgiMultiplexConnection;
 
 class FcgiStockConnection final : public StockItem {
 	const LLogger logger;
 
 	ListenChildStockItem &child;
 
+	/**
+	 * If this is not nullptr, then this item is merely a request
+	 * slot on a connection shared by all items of this child
+	 * process, and #event is not used.
+	 */
+	FcgiMultiplexConnection *const multiplex = nullptr;
+
 	SocketEvent event;
 
 	/**
@@ -36,6 +44,9 @@ public:
 	explicit FcgiStockConnection(CreateStockItem c, ListenChildStockItem &_child,
 				     UniqueSocketDescriptor &&socket) noexcept;
 
+	FcgiStockConnection(CreateStockItem c, ListenChildStockItem &_child,
+			    FcgiMultiplexConnection &_multiplex) noexcept;
+
 	~FcgiStockConnection() noexcept override;
 
 	[[gnu::pure]]
@@ -43,6 +54,10 @@ public:
 		return child.GetTag();
 	}
 
+	FcgiMultiplexConnection *GetMultiplex() const noexcept {
+		return multiplex;
+	}
+
 	SocketDescriptor GetSocket() const noexcept {
 		assert(event.IsDefined());
 		return event.GetSocket();
@@ -87,6 +102,13 @@ fcgi_stock_item_set_uri(StockItem &item, const char *uri) noexcept;
 SocketDescriptor
 fcgi_stock_item_get(const StockItem &item) noexcept;
 
+/**
+ * Returns the shared connection if the specified stock item is a
+ * request slot on a multiplexed connection, nullptr otherwise.
+ */
+FcgiMultiplexConnection *
+fcgi_stock_item_get_multiplex(const StockItem &item) noexcept;
+
 UniqueFileDescriptor
 fcgi_stock_item_get_stderr(const StockItem &item) noexcept;
 
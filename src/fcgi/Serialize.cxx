@@ -5,14 +5,23 @@
 #include "Serialize.hxx"
 #include "Protocol.hxx"
 #include "memory/GrowingBuffer.hxx"
+#include "http/CommonHeaders.hxx"
+#include "http/Method.hxx"
 #include "strmap.hxx"
+#include "product.h"
 #include "util/ByteOrder.hxx"
 #include "util/CharUtil.hxx"
+#include "util/SpanCast.hxx"
 #include "util/StringAPI.hxx"
+#include "util/StringSplit.hxx"
+
+#include <fmt/format.h>
 
 #include <cassert>
 #include <cstdint>
 
+#include <string.h>
+
 FcgiRecordSerializer::FcgiRecordSerializer(GrowingBuffer &_buffer,
 					   FcgiRecordType type,
 					   uint16_t request_id_be) noexcept
@@ -98,3 +107,131 @@ FcgiParamsSerializer::Headers(const StringMap &headers) noexcept
 		(*this)({buffer, 5 + i}, pair.value);
 	}
 }
+
+void
+fcgi_serialize_request(GrowingBuffer &buffer, uint16_t request_id,
+		       HttpMethod method, const char *uri,
+		       const char *script_filename,
+		       const char *script_name, const char *path_info,
+		       const char *query_string,
+		       const char *document_root,
+		       const char *remote_addr,
+		       const StringMap &headers, off_t content_length,
+		       std::span<const char *const> params) noexcept
+{
+	FcgiRecordHeader header{
+		.version = FCGI_VERSION_1,
+		.type = FcgiRecordType::BEGIN_REQUEST,
+		.request_id = request_id,
+	};
+	static constexpr FcgiBeginRequest begin_request{
+		.role = static_cast<uint16_t>(FcgiRole::RESPONDER),
+		.flags = FCGI_FLAG_KEEP_CONN,
+	};
+
+	header.content_length = sizeof(begin_request);
+	buffer.WriteT(header);
+	buffer.WriteT(begin_request);
+
+	FcgiParamsSerializer ps(buffer, request_id);
+
+	ps("REQUEST_METHOD", http_method_to_string(method))
+		("REQUEST_URI", uri)
+		("SCRIPT_FILENAME", script_filename)
+		("SCRIPT_NAME", script_name)
+		("PATH_INFO", path_info)
+		("QUERY_STRING", query_string)
+		("DOCUMENT_ROOT", document_root)
+		("SERVER_SOFTWARE", PRODUCT_TOKEN);
+
+	if (remote_addr != nullptr)
+		ps("REMOTE_ADDR", remote_addr);
+
+	if (content_length >= 0) {
+		const fmt::format_int value{content_length};
+
+		ps("HTTP_CONTENT_LENGTH", value.c_str())
+			/* PHP wants the parameter without
+			   "HTTP_" */
+			("CONTENT_LENGTH", value.c_str());
+	}
+
+	if (const char *content_type = headers.Get(content_type_header);
+	    content_type != nullptr)
+		/* same for the "Content-Type" request
+		   header */
+		ps("CONTENT_TYPE", content_type);
+
+	if (const char *https = headers.Get(x_cm4all_https_header);
+	    https != nullptr && strcmp(https, "on") == 0)
+		ps("HTTPS", https);
+
+	ps.Headers(headers);
+
+	for (const std::string_view param : params) {
+		const auto [name, value] = Split(param, '=');
+		if (!name.empty() && value.data() != nullptr)
+			ps(name, value);
+	}
+
+	ps.Commit();
+
+	/* an empty PARAMS record terminates the PARAMS stream */
+	header.type = FcgiRecordType::PARAMS;
+	header.content_length = 0;
+	buffer.WriteT(header);
+}
+
+/**
+ * Parse a name/value length from a PARAMS payload.
+ *
+ * @return the length or SIZE_MAX on error
+ */
+static std::size_t
+fcgi_parse_length(std::span<const std::byte> &src) noexcept
+{
+	if (src.empty())
+		return SIZE_MAX;
+
+	if ((static_cast<uint8_t>(src.front()) & 0x80) == 0) {
+		const std::size_t length = static_cast<uint8_t>(src.front());
+		src = src.subspan(1);
+		return length;
+	}
+
+	if (src.size() < 4)
+		return SIZE_MAX;
+
+	const std::size_t length =
+		((static_cast<uint8_t>(src[0]) & 0x7f) << 24) |
+		(static_cast<uint8_t>(src[1]) << 16) |
+		(static_cast<uint8_t>(src[2]) << 8) |
+		static_cast<uint8_t>(src[3]);
+	src = src.subspan(4);
+	return length;
+}
+
+std::string_view
+fcgi_find_param(std::span<const std::byte> src,
+		std::string_view name) noexcept
+{
+	while (!src.empty()) {
+		const std::size_t name_length = fcgi_parse_length(src);
+		const std::size_t value_length = fcgi_parse_length(src);
+		if (name_length > src.size() ||
+		    value_length > src.size() - name_length)
+			/* also catches SIZE_MAX */
+			break;
+
+		const auto name_value = ToStringView(src.first(name_length));
+		src = src.subspan(name_length);
+
+		const auto value = ToStringView(src.first(value_length));
+		src = src.subspan(value_length);
+
+		if (name_value == name)
+			return value;
+	}
+
+	return {};
+}
@@ -8,11 +8,14 @@
 
 #pragma once
 
+#include <span>
 #include <string_view>
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h> // for off_t
 
+enum class HttpMethod : uint_least8_t;
 enum class FcgiRecordType : uint8_t;
 struct FcgiRecordHeader;
 class GrowingBuffer;
@@ -42,6 +45,14 @@ public:
 	FcgiParamsSerializer(GrowingBuffer &_buffer,
 			     uint16_t request_id_be) noexcept;
 
+	/**
+	 * Serialize name-value pairs into a record of a different
+	 * type, e.g. #FcgiRecordType::GET_VALUES.
+	 */
+	FcgiParamsSerializer(GrowingBuffer &_buffer, FcgiRecordType type,
+			     uint16_t request_id_be) noexcept
+		:record(_buffer, type, request_id_be) {}
+
 	FcgiParamsSerializer &operator()(std::string_view name,
 					 std::string_view value) noexcept;
 
@@ -59,3 +70,34 @@ public:
 		record.Commit(content_length);
 	}
 };
+
+/**
+ * Serialize the BEGIN_REQUEST record and the PARAMS records of a
+ * FastCGI request.  The caller is responsible for sending the
+ * STDIN records.
+ *
+ * @param content_length the length of the request body, or -1 if
+ * unknown (or if there is no request body)
+ */
+void
+fcgi_serialize_request(GrowingBuffer &buffer, uint16_t request_id,
+		       HttpMethod method, const char *uri,
+		       const char *script_filename,
+		       const char *script_name, const char *path_info,
+		       const char *query_string,
+		       const char *document_root,
+		       const char *remote_addr,
+		       const StringMap &headers, off_t content_length,
+		       std::span<const char *const> params) noexcept;
+
+/**
+ * Look up a name-value pair in the payload of a PARAMS or
+ * GET_VALUES_RESULT record.
+ *
+ * @return the value, or a nullptr string_view if the name was not
+ * found or if the payload is malformed
+ */
+[[gnu::pure]]
+std::string_view
+fcgi_find_param(std::span<const std::byte> src,
+		std::string_view name) noexcept;
@@ -4,6 +4,7 @@
 
 #include "Stock.hxx"
 #include "SConnection.hxx"
+#include "MConnection.hxx"
 #include "Error.hxx"
 #include "stock/Stock.hxx"
 #include "stock/Class.hxx"
@@ -22,6 +23,8 @@
 #include "util/Cancellable.hxx"
 #include "util/StringList.hxx"
 
+#include <optional>
+
 #include <assert.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -64,6 +67,96 @@ private:
 	}
 };
 
+/**
+ * A FastCGI child process which may share one connection among all
+ * concurrent requests (see #FcgiMultiplexConnection).
+ */
+class FcgiChild final : public ListenChildStockItem, FcgiMultiplexConnectionHandler {
+	std::optional<FcgiMultiplexConnection> multiplex;
+
+	enum class MultiplexState : uint_least8_t {
+		/**
+		 * Multiplexing is disabled in the configuration, or
+		 * the child process does not support it.
+		 */
+		DISABLED,
+
+		/**
+		 * Not yet known whether the child process supports
+		 * multiplexing.
+		 */
+		UNKNOWN,
+
+		/**
+		 * Waiting for the answer to FCGI_MPXS_CONNS.
+		 */
+		PROBING,
+
+		ENABLED,
+	} multiplex_state;
+
+public:
+	FcgiChild(CreateStockItem c, ChildStock &_child_stock,
+		  std::string_view _tag, bool _multiplex) noexcept
+		:ListenChildStockItem(c, _child_stock, _tag),
+		 multiplex_state(_multiplex
+				 ? MultiplexState::UNKNOWN
+				 : MultiplexState::DISABLED) {}
+
+	/**
+	 * Returns the shared connection if the child process
+	 * supports multiplexing, nullptr otherwise (or if that is
+	 * not yet known).  The first call starts probing.
+	 */
+	FcgiMultiplexConnection *GetMultiplexConnection() noexcept;
+
+private:
+	/* virtual methods from class FcgiMultiplexConnectionHandler */
+	UniqueSocketDescriptor OnFcgiMultiplexConnect() override {
+		return Connect();
+	}
+
+	void OnFcgiMultiplexProbe(bool supported) noexcept override {
+		multiplex_state = supported
+			? MultiplexState::ENABLED
+			: MultiplexState::DISABLED;
+	}
+
+	void OnFcgiMultiplexError(std::exception_ptr) noexcept override {
+		/* don't hand out more request slots for this child
+		   process; the MultiStock will launch a new one */
+		multiplex_state = MultiplexState::DISABLED;
+		Fade();
+	}
+};
+
+FcgiMultiplexConnection *
+FcgiChild::GetMultiplexConnection() noexcept
+{
+	switch (multiplex_state) {
+	case MultiplexState::DISABLED:
+	case MultiplexState::PROBING:
+		break;
+
+	case MultiplexState::UNKNOWN:
+		multiplex_state = MultiplexState::PROBING;
+		multiplex.emplace(GetEventLoop(), *this);
+
+		try {
+			multiplex->Probe();
+		} catch (...) {
+			multiplex_state = MultiplexState::DISABLED;
+		}
+
+		break;
+
+	case MultiplexState::ENABLED:
+		return &*multiplex;
+	}
+
+	return nullptr;
+}
+
 /*
  * child_stock class
  *
@@ -213,6 +306,14 @@ FcgiStock::CreateRequest::OnStockItemError(std::exception_ptr error) noexcept
 	delete this;
 }
 
+std::unique_ptr<ChildStockItem>
+FcgiStock::CreateChild(CreateStockItem c, const void *info,
+		       ChildStock &_child_stock)
+{
+	return std::make_unique<FcgiChild>(c, _child_stock,
+					   GetChildTag(info), multiplex);
+}
+
 /*
  * stock class
  *
@@ -221,7 +322,12 @@ FcgiStock::CreateRequest::OnStockItemError(std::exception_ptr error) noexcept
 StockItem *
 FcgiStock::Create(CreateStockItem c, StockItem &shared_item)
 {
-	auto &child = (ListenChildStockItem &)shared_item;
+	auto &child = (FcgiChild &)shared_item;
+
+	if (auto *m = child.GetMultiplexConnection())
+		/* all requests share one connection; this item is
+		   just a request slot */
+		return new FcgiStockConnection(c, child, *m);
 
 	try {
 		return new FcgiStockConnection(c, child, child.Connect());
@@ -238,6 +344,7 @@ FcgiStock::Create(CreateStockItem c, StockItem &shared_item)
  */
 
 FcgiStock::FcgiStock(unsigned limit, [[maybe_unused]] unsigned max_idle,
+		     unsigned prespawn, bool _multiplex,
 		     EventLoop &event_loop, SpawnService &spawn_service,
 		     ListenStreamStock *listen_stream_stock,
 		     Net::Log::Sink *log_sink,
@@ -249,7 +356,10 @@ FcgiStock::FcgiStock(unsigned limit, [[maybe_unused]] unsigned max_idle,
 	 mchild_stock(event_loop, child_stock,
 		      limit,
 		      // TODO max_idle,
-		      *this)
+		      *this),
+	 prespawner(mchild_stock, *this, limit,
+		    child_stock, *this, prespawn),
+	 multiplex(_multiplex)
 {
 }
 
@@ -282,6 +392,7 @@ FcgiStock::Get(const ChildOptions &options,
 						    args, options,
 						    parallelism, concurrency, false));
 	const char *key = r->GetStockKey(*tpool);
+	prespawner.OnRequest(key, *r, concurrency);
 	mchild_stock.Get(key, std::move(r),
 			 concurrency,
 			 handler, cancel_ptr);
@@ -6,6 +6,7 @@
 
 #include "pool/Ptr.hxx"
 #include "spawn/ListenChildStock.hxx"
+#include "spawn/Prespawn.hxx"
 #include "stock/MultiStock.hxx"
 
 #include <span>
@@ -27,11 +28,27 @@ class FcgiStock final : MultiStockClass, ListenChildStockClass {
 	PoolPtr pool;
 	ChildStock child_stock;
 	MultiStock mchild_stock;
+	ChildStockPrespawner prespawner;
+
+	/**
+	 * Probe new child processes for FCGI_MPXS_CONNS, and if
+	 * supported, send all their concurrent requests over one
+	 * shared connection?
+	 */
+	const bool multiplex;
 
 	class CreateRequest;
 
 public:
-	FcgiStock(unsigned limit, unsigned max_idle,
+	/**
+	 * @param prespawn the maximum number of child processes per
+	 * key to be kept warm (see #ChildStockPrespawner)
+	 *
+	 * @param multiplex multiplex concurrent requests over a shared
+	 * connection if the child process supports it
+	 */
+	FcgiStock(unsigned limit, unsigned max_idle, unsigned prespawn,
+		  bool multiplex,
 		  EventLoop &event_loop, SpawnService &spawn_service,
 		  ListenStreamStock *listen_stream_stock,
 		  Net::Log::Sink *log_sink,
@@ -53,6 +70,10 @@ public:
 		 StockGetHandler &handler,
 		 CancellablePointer &cancel_ptr) noexcept;
 
+	ChildStockStats GetStats() const noexcept {
+		return prespawner.GetStats();
+	}
+
 	void FadeAll() noexcept {
 		mchild_stock.FadeAll();
 	}
@@ -80,6 +101,9 @@ private:
 	Event::Duration GetChildClearInterval(const void *info) const noexcept override;
 
 	/* virtual methods from class ListenChildStockClass */
+	std::unique_ptr<ChildStockItem> CreateChild(CreateStockItem c,
+						    const void *info,
+						    ChildStock &child_stock) override;
 	unsigned GetChildBacklog(const void *info) const noexcept override;
 	void PrepareListenChild(const void *info, UniqueSocketDescriptor fd,
 				PreparedChildProcess &p,
@@ -5,11 +5,15 @@
 #include "istream_fcgi.hxx"
 #include "Protocol.hxx"
 #include "istream/FacadeIstream.hxx"
+#include "istream/Bucket.hxx"
 #include "istream/UnusedPtr.hxx"
 #include "istream/New.hxx"
 #include "util/ByteOrder.hxx"
 #include "util/DestructObserver.hxx"
 
+#include <algorithm>
+#include <utility>
+
 #include <assert.h>
 #include <string.h>
 
@@ -19,6 +23,13 @@ class FcgiIstream final : public FacadeIstream, DestructAnchor {
 	FcgiRecordHeader header;
 	size_t header_sent = sizeof(header);
 
+	/**
+	 * The empty STDIN record which terminates the stream.  This
+	 * is a separate copy of #header, because _FillBucketList()
+	 * needs to refer to it while #header is still in use.
+	 */
+	const FcgiRecordHeader end_header;
+
 public:
 	FcgiIstream(struct pool &_pool, UnusedIstreamPtr _input,
 		    uint16_t request_id) noexcept
@@ -27,13 +38,33 @@ public:
 			 .version = FCGI_VERSION_1,
 			 .type = FcgiRecordType::STDIN,
 			 .request_id = request_id,
-		 }
+		 },
+		 end_header(header)
 	{
 	}
 
 	bool WriteHeader() noexcept;
 	void StartRecord(size_t length) noexcept;
 
+	std::span<const std::byte> ReadHeader() const noexcept {
+		return std::as_bytes(std::span{&header, 1}).subspan(header_sent);
+	}
+
+	/**
+	 * Mark up to the given number of header bytes as consumed.
+	 *
+	 * @return the number of bytes consumed
+	 */
+	size_t ConsumeHeader(size_t nbytes) noexcept {
+		const size_t size = std::min(ReadHeader().size(), nbytes);
+		if (size > 0) {
+			header_sent += size;
+			Consumed(size);
+		}
+
+		return size;
+	}
+
 	/* virtual methods from class Istream */
 
 	off_t _GetAvailable(bool partial) noexcept override {
@@ -47,6 +78,8 @@ public:
 	}
 
 	void _Read() noexcept override;
+	void _FillBucketList(IstreamBucketList &list) override;
+	ConsumeBucketResult _ConsumeBucketList(size_t nbytes) noexcept override;
 
 	int _AsFd() noexcept override {
 		return -1;
@@ -73,8 +106,7 @@ FcgiIstream::WriteHeader() noexcept
 	if (length == 0)
 		return true;
 
-	const std::byte *data = (std::byte *)&header + header_sent;
-	size_t nbytes = InvokeData({data, length});
+	size_t nbytes = InvokeData(ReadHeader());
 	if (nbytes > 0)
 		header_sent += nbytes;
 
@@ -188,6 +220,111 @@ FcgiIstream::_Read() noexcept
 	input.Read();
 }
 
+void
+FcgiIstream::_FillBucketList(IstreamBucketList &list)
+{
+	if (!HasInput()) {
+		/* only (the rest of) the end-of-stream record is
+		   left */
+		if (auto b = ReadHeader(); !b.empty())
+			list.Push(b);
+
+		return;
+	}
+
+	IstreamBucketList sub;
+	FillBucketListFromInput(sub);
+
+	if (sub.IsEmpty() && !sub.HasMore()) {
+		assert(missing_from_current_record == 0);
+		assert(header_sent == sizeof(header));
+
+		CloseInput();
+
+		/* write EOF record (length 0) */
+		StartRecord(0);
+		list.Push(ReadHeader());
+		return;
+	}
+
+	auto b = ReadHeader();
+	if (b.empty() && missing_from_current_record == 0) {
+		/* see which of FillBucketList() and GetAvailable()
+		   returns more data and use that to start the new
+		   record */
+
+		off_t available = input.GetAvailable(true);
+		if (std::cmp_greater(sub.GetTotalBufferSize(), available))
+			available = sub.GetTotalBufferSize();
+
+		if (available > 0) {
+			StartRecord(available);
+			b = ReadHeader();
+		}
+	}
+
+	if (!b.empty())
+		list.Push(b);
+
+	if (missing_from_current_record > 0) {
+		/* the record payload refers to the input's buffers
+		   directly, without copying */
+		size_t nbytes = list.SpliceBuffersFrom(std::move(sub),
+						       missing_from_current_record);
+		if (nbytes >= missing_from_current_record && !list.HasMore())
+			/* the input ends with this record */
+			list.Push(std::as_bytes(std::span{&end_header, 1}));
+	} else if (sub.HasMore()) {
+		list.SetMore();
+
+		if (sub.ShouldFallback())
+			list.EnableFallback();
+	} else if (!sub.IsEmpty()) {
+		/* there is more data, but the header of the next
+		   record has not been generated yet */
+		list.SetMore();
+	}
+}
+
+Istream::ConsumeBucketResult
+FcgiIstream::_ConsumeBucketList(size_t nbytes) noexcept
+{
+	size_t total = 0;
+
+	size_t size = ConsumeHeader(nbytes);
+	nbytes -= size;
+	total += size;
+
+	size = std::min(nbytes, missing_from_current_record);
+	if (size > 0) {
+		assert(HasInput());
+
+		const auto [consumed, is_eof] = input.ConsumeBucketList(size);
+		if (is_eof)
+			CloseInput();
+
+		Consumed(consumed);
+		nbytes -= consumed;
+		total += consumed;
+
+		missing_from_current_record -= consumed;
+		if (missing_from_current_record == 0 && !HasInput()) {
+			/* the end-of-stream record follows
+			   immediately */
+			StartRecord(0);
+
+			size = ConsumeHeader(nbytes);
+			nbytes -= size;
+			total += size;
+		}
+	}
+
+	return {
+		total,
+		missing_from_current_record == 0 && header_sent == sizeof(header) && !HasInput(),
+	};
+}
+
 /*
  * constructor
  *
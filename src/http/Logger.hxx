@@ -16,6 +16,13 @@ class IncomingHttpRequestLogger {
 public:
 	virtual ~IncomingHttpRequestLogger() noexcept = default;
 
+	/**
+	 * The request handler has submitted the response status and
+	 * headers.  This can be used to measure the "time to first
+	 * byte".
+	 */
+	virtual void OnResponseSubmitted() noexcept {}
+
 	/**
 	 * @param wait_duration the total duration waiting for the
 	 * client (either request body data or response body)
@@ -169,6 +169,7 @@ LhttpStock::Create(CreateStockItem c, StockItem &shared_item)
  */
 
 LhttpStock::LhttpStock(unsigned limit, [[maybe_unused]] unsigned max_idle,
+		       unsigned prespawn,
 		       EventLoop &event_loop, SpawnService &spawn_service,
 		       ListenStreamStock *_listen_stream_stock,
 		       Net::Log::Sink *log_sink,
@@ -180,7 +181,9 @@ LhttpStock::LhttpStock(unsigned limit, [[maybe_unused]] unsigned max_idle,
 	 mchild_stock(event_loop, child_stock,
 		      limit,
 		      // TODO max_idle,
-		      *this)
+		      *this),
+	 prespawner(mchild_stock, *this, limit,
+		    child_stock, *this, prespawn)
 {
 }
 
@@ -202,7 +205,9 @@ LhttpStock::Get(const LhttpAddress &address,
 		CancellablePointer &cancel_ptr) noexcept
 {
 	const TempPoolLease tpool;
-	mchild_stock.Get(lhttp_stock_key(tpool, &address),
+	const char *key = lhttp_stock_key(tpool, &address);
+	prespawner.OnRequest(key, address, address.concurrency);
+	mchild_stock.Get(key,
 			 ToNopPointer(const_cast<LhttpAddress *>(&address)),
 			 address.concurrency,
 			 handler, cancel_ptr);
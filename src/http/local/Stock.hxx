@@ -6,6 +6,7 @@
 
 #include "pool/Ptr.hxx"
 #include "spawn/ListenChildStock.hxx"
+#include "spawn/Prespawn.hxx"
 #include "stock/MultiStock.hxx"
 
 #include <cstddef>
@@ -25,15 +26,24 @@ class LhttpStock final : MultiStockClass, ListenChildStockClass {
 	PoolPtr pool;
 	ChildStock child_stock;
 	MultiStock mchild_stock;
+	ChildStockPrespawner prespawner;
 
 public:
-	LhttpStock(unsigned limit, unsigned max_idle,
+	/**
+	 * @param prespawn the maximum number of child processes per
+	 * key to be kept warm (see #ChildStockPrespawner)
+	 */
+	LhttpStock(unsigned limit, unsigned max_idle, unsigned prespawn,
 		   EventLoop &event_loop, SpawnService &spawn_service,
 		   ListenStreamStock *_listen_stream_stock,
 		   Net::Log::Sink *log_sink,
 		   const ChildErrorLogOptions &log_options) noexcept;
 	~LhttpStock() noexcept;
 
+	ChildStockStats GetStats() const noexcept {
+		return prespawner.GetStats();
+	}
+
 	/**
 	 * Discard one or more processes to free some memory.
 	 */
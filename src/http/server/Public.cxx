@@ -12,6 +12,7 @@
 #include "system/Error.hxx"
 #include "net/PToString.hxx"
 #include "net/TimeoutError.hxx"
+#include "stats/EventLoopProfiler.hxx"
 #include "io/Iovec.hxx"
 #include "util/StaticVector.hxx"
 
@@ -196,9 +197,15 @@ HttpServerConnection::TryWrite() noexcept
  *
  */
 
+static EventLoopCallbackSite read_site{"http_server_read", EventLoopCallbackType::SOCKET};
+static EventLoopCallbackSite write_site{"http_server_write", EventLoopCallbackType::SOCKET};
+static EventLoopCallbackSite read_timeout_site{"http_server_read_timeout", EventLoopCallbackType::TIMER};
+
 BufferedResult
 HttpServerConnection::OnBufferedData()
 {
+	const EventLoopCallbackScope scope{read_site};
+
 	auto r = socket->ReadBuffer();
 	assert(!r.empty());
 
@@ -224,6 +231,8 @@ HttpServerConnection::OnBufferedDirect(SocketDescriptor fd, FdType fd_type)
 bool
 HttpServerConnection::OnBufferedWrite()
 {
+	const EventLoopCallbackScope scope{write_site};
+
 	assert(!response.pending_drained);
 
 	response.want_write = false;
@@ -282,6 +291,8 @@ HttpServerConnection::IdleTimeoutCallback() noexcept
 inline void
 HttpServerConnection::OnReadTimeout() noexcept
 {
+	const EventLoopCallbackScope scope{read_timeout_site};
+
 	switch (request.read_state) {
 	case Request::START:
 		break;
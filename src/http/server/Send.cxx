@@ -5,6 +5,7 @@
 #include "Internal.hxx"
 #include "Request.hxx"
 #include "http/Headers.hxx"
+#include "http/Logger.hxx"
 #include "http/Method.hxx"
 #include "http/Upgrade.hxx"
 #include "memory/GrowingBuffer.hxx"
@@ -194,6 +195,9 @@ HttpServerRequest::SendResponse(HttpStatus status,
 {
 	assert(connection.request.request == this);
 
+	if (logger != nullptr)
+		logger->OnResponseSubmitted();
+
 	connection.SubmitResponse(status, std::move(response_headers),
 				  std::move(response_body));
 }
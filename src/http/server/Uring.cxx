@@ -10,6 +10,7 @@
 #include "fs/FilteredSocket.hxx"
 #include "system/Error.hxx"
 #include "io/uring/Queue.hxx"
+#include "stats/EventLoopProfiler.hxx"
 
 #include <cassert>
 
@@ -196,9 +197,13 @@ HttpServerConnection::OnUringSpliceCompletion(int nbytes,
 	ScheduleWrite();
 }
 
+static EventLoopCallbackSite splice_site{"http_server_splice", EventLoopCallbackType::URING};
+
 void
 HttpServerConnection::UringSplice::OnUringCompletion(int res) noexcept
 {
+	const EventLoopCallbackScope scope{splice_site};
+
 	parent.OnUringSpliceCompletion(res, max_length, then_eof);
 }
 
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "BuiltinIconv.hxx"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <bit>
+#endif
+
+#include <algorithm>
+#include <string_view>
+
+#include <assert.h>
+#include <string.h>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * The Unicode code points of the Windows-1252 characters 0x80..0x9f;
+ * zero means undefined.
+ */
+static constexpr char32_t cp1252_c1[0x20] = {
+	0x20ac, 0, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+	0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0, 0x017d, 0,
+	0, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+	0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0, 0x017e, 0x0178,
+};
+
+static constexpr char32_t INVALID = 0xffffffff;
+
+[[gnu::pure]]
+static bool
+CharsetEquals(const char *name, std::string_view normalized) noexcept
+{
+	for (; *name != 0; ++name) {
+		char ch = *name;
+		if (ch == '-' || ch == '_')
+			continue;
+
+		if (ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+
+		if (normalized.empty() || ch != normalized.front())
+			return false;
+
+		normalized.remove_prefix(1);
+	}
+
+	return normalized.empty();
+}
+
+[[gnu::pure]]
+static bool
+IsUTF8(const char *name) noexcept
+{
+	return CharsetEquals(name, "utf8"sv);
+}
+
+[[gnu::pure]]
+static bool
+IsLatin1(const char *name) noexcept
+{
+	return CharsetEquals(name, "iso88591"sv) ||
+		CharsetEquals(name, "latin1"sv);
+}
+
+[[gnu::pure]]
+static bool
+IsCP1252(const char *name) noexcept
+{
+	return CharsetEquals(name, "windows1252"sv) ||
+		CharsetEquals(name, "cp1252"sv);
+}
+
+std::optional<BuiltinIconvType>
+FindBuiltinIconv(const char *tocode, const char *fromcode) noexcept
+{
+	if (IsUTF8(tocode)) {
+		if (IsLatin1(fromcode))
+			return BuiltinIconvType::LATIN1_TO_UTF8;
+
+		if (IsCP1252(fromcode))
+			return BuiltinIconvType::CP1252_TO_UTF8;
+	} else if (IsUTF8(fromcode)) {
+		if (IsLatin1(tocode))
+			return BuiltinIconvType::UTF8_TO_LATIN1;
+
+		if (IsCP1252(tocode))
+			return BuiltinIconvType::UTF8_TO_CP1252;
+	}
+
+	return std::nullopt;
+}
+
+std::size_t
+CountLeadingASCII(std::span<const std::byte> src) noexcept
+{
+	const auto *const begin = (const unsigned char *)src.data();
+	const auto *p = begin, *const end = p + src.size();
+
+#ifdef __SSE2__
+	while (end - p >= 16) {
+		/* the sign bit is set in all non-ASCII bytes */
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+		const unsigned mask = _mm_movemask_epi8(v);
+		if (mask != 0)
+			return p - begin + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && *p < 0x80)
+		++p;
+
+	return p - begin;
+}
+
+/**
+ * @return the number of bytes written to #q (1..3)
+ */
+static std::size_t
+EncodeUTF8(char32_t ch, unsigned char *q) noexcept
+{
+	assert(ch >= 0x80 && ch < 0x10000);
+
+	if (ch < 0x800) {
+		q[0] = 0xc0 | (ch >> 6);
+		q[1] = 0x80 | (ch & 0x3f);
+		return 2;
+	}
+
+	q[0] = 0xe0 | (ch >> 12);
+	q[1] = 0x80 | ((ch >> 6) & 0x3f);
+	q[2] = 0x80 | (ch & 0x3f);
+	return 3;
+}
+
+struct DecodedUTF8 {
+	/**
+	 * The code point or #INVALID.
+	 */
+	char32_t ch;
+
+	/**
+	 * The length of the sequence; 0 if it is incomplete.
+	 */
+	std::size_t length;
+};
+
+/**
+ * Decode one (non-ASCII) UTF-8 sequence.  Invalid sequences
+ * (including overlong forms and surrogates) have a length of 1, so
+ * only the lead byte gets skipped.
+ */
+[[gnu::pure]]
+static DecodedUTF8
+DecodeUTF8(const unsigned char *p, const unsigned char *end) noexcept
+{
+	assert(p < end);
+
+	const unsigned char lead = *p;
+	std::size_t length;
+	char32_t ch, min;
+
+	if (lead >= 0xc2 && lead < 0xe0) {
+		length = 2;
+		ch = lead & 0x1f;
+		min = 0x80;
+	} else if (lead >= 0xe0 && lead < 0xf0) {
+		length = 3;
+		ch = lead & 0x0f;
+		min = 0x800;
+	} else if (lead >= 0xf0 && lead < 0xf5) {
+		length = 4;
+		ch = lead & 0x07;
+		min = 0x10000;
+	} else
+		return {INVALID, 1};
+
+	for (std::size_t i = 1; i < length; ++i) {
+		if (p + i == end)
+			return {INVALID, 0};
+
+		if ((p[i] & 0xc0) != 0x80)
+			return {INVALID, 1};
+
+		ch = (ch << 6) | (p[i] & 0x3f);
+	}
+
+	if (ch < min || ch > 0x10ffff || (ch >= 0xd800 && ch < 0xe000))
+		return {INVALID, 1};
+
+	return {ch, length};
+}
+
+/**
+ * @return the Windows-1252 byte or 0 if the character cannot be
+ * represented
+ */
+[[gnu::const]]
+static unsigned char
+ToCP1252(char32_t ch) noexcept
+{
+	if (ch >= 0xa0 && ch < 0x100)
+		return ch;
+
+	const auto i = std::find(std::begin(cp1252_c1), std::end(cp1252_c1), ch);
+	return i != std::end(cp1252_c1) && ch != 0
+		? 0x80 + (i - std::begin(cp1252_c1))
+		: 0;
+}
+
+BuiltinIconvResult
+BuiltinIconv(BuiltinIconvType type,
+	     std::span<const std::byte> src,
+	     std::span<std::byte> dest) noexcept
+{
+	const auto *const s_begin = (const unsigned char *)src.data();
+	const auto *s = s_begin, *const s_end = s + src.size();
+	auto *const d_begin = (unsigned char *)dest.data();
+	auto *d = d_begin, *const d_end = d + dest.size();
+
+	bool incomplete = false;
+
+	while (s < s_end) {
+		/* copy the ASCII run in one step */
+		const std::size_t n =
+			CountLeadingASCII(std::as_bytes(std::span{s, std::size_t(std::min(s_end - s, d_end - d))}));
+		memcpy(d, s, n);
+		s += n;
+		d += n;
+
+		if (s == s_end || d == d_end)
+			break;
+
+		/* convert one non-ASCII character */
+
+		if (type == BuiltinIconvType::LATIN1_TO_UTF8 ||
+		    type == BuiltinIconvType::CP1252_TO_UTF8) {
+			char32_t ch = *s;
+			if (type == BuiltinIconvType::CP1252_TO_UTF8 &&
+			    ch < 0xa0) {
+				ch = cp1252_c1[ch - 0x80];
+				if (ch == 0) {
+					/* undefined: skip */
+					++s;
+					continue;
+				}
+			}
+
+			if (d_end - d < 3 && (ch >= 0x800 || d_end - d < 2))
+				/* no room for this character */
+				break;
+
+			d += EncodeUTF8(ch, d);
+			++s;
+		} else {
+			const auto [ch, length] = DecodeUTF8(s, s_end);
+			if (length == 0) {
+				incomplete = true;
+				break;
+			}
+
+			s += length;
+
+			if (ch == INVALID)
+				continue;
+
+			if (type == BuiltinIconvType::UTF8_TO_LATIN1) {
+				if (ch < 0x100)
+					*d++ = ch;
+			} else {
+				if (const auto b = ToCP1252(ch); b != 0)
+					*d++ = b;
+			}
+		}
+	}
+
+	return {
+		std::size_t(s - s_begin),
+		std::size_t(d - d_begin),
+		incomplete,
+	};
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Built-in converters for the most common charset pairs, which avoid
+ * the overhead of libiconv.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+enum class BuiltinIconvType : uint_least8_t {
+	LATIN1_TO_UTF8,
+	CP1252_TO_UTF8,
+	UTF8_TO_LATIN1,
+	UTF8_TO_CP1252,
+};
+
+/**
+ * Is there a built-in converter for this charset pair?  The charset
+ * names are compared case-insensitively, ignoring dashes and
+ * underscores.
+ */
+[[gnu::pure]]
+std::optional<BuiltinIconvType>
+FindBuiltinIconv(const char *tocode, const char *fromcode) noexcept;
+
+struct BuiltinIconvResult {
+	std::size_t consumed, produced;
+
+	/**
+	 * Conversion has stopped at an incomplete multi-byte
+	 * sequence at the end of the input.
+	 */
+	bool incomplete;
+};
+
+/**
+ * Convert as much as possible from #src to #dest.  Invalid and
+ * unrepresentable characters are skipped (like #IconvIstream does
+ * with libiconv's EILSEQ).
+ */
+BuiltinIconvResult
+BuiltinIconv(BuiltinIconvType type,
+	     std::span<const std::byte> src,
+	     std::span<std::byte> dest) noexcept;
+
+/**
+ * Find the first byte which is not ASCII.  ASCII characters are
+ * the same in all supported charsets and can be passed through
+ * unmodified.
+ *
+ * @return the number of leading ASCII bytes
+ */
+[[gnu::pure]]
+std::size_t
+CountLeadingASCII(std::span<const std::byte> src) noexcept;
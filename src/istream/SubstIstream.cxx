@@ -8,574 +8,551 @@
 #include "New.hxx"
 #include "Bucket.hxx"
 #include "pool/pool.hxx"
-#include "util/Compiler.h"
 #include "util/DestructObserver.hxx"
 #include "util/SpanCast.hxx"
-#include "util/StringSplit.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 #include <assert.h>
 #include <string.h>
 
-/* ternary search tree */
+/**
+ * A node in the Aho-Corasick automaton.  Each node represents a
+ * prefix of one or more search words.
+ */
 struct SubstNode {
-	SubstNode *parent, *left, *right, *equals;
+	/**
+	 * The first child node and the next sibling; siblings are
+	 * sorted by #ch.
+	 */
+	SubstNode *child = nullptr, *sibling = nullptr;
+
+	/**
+	 * The failure link: the node for the longest proper suffix
+	 * of this node's prefix which is also a prefix in the tree.
+	 * Only the root has none.
+	 */
+	const SubstNode *fail = nullptr;
+
+	/**
+	 * The nearest node on the failure chain (including this one)
+	 * which completes a search word, i.e. the longest search word
+	 * which ends here.
+	 */
+	const SubstNode *output = nullptr;
+
+	/**
+	 * A search word which begins with this node's prefix.  This is
+	 * used to reproduce input which has been consumed already.
+	 */
+	const char *a;
+
+	/**
+	 * The replacement (only if #is_leaf).
+	 */
+	const char *b = nullptr;
+	std::size_t b_length = 0;
+
+	/**
+	 * The length of this node's prefix.
+	 */
+	uint_least32_t depth;
+
 	char ch;
 
-	struct {
-		const char *a;
-		size_t b_length;
-		char b[1];
+	/**
+	 * Does a search word end here?
+	 */
+	bool is_leaf = false;
 
-		constexpr std::span<const char> AsSpan() const noexcept {
-			return {b, b_length};
-		}
-	} leaf;
+	/**
+	 * Is the replacement determined by a #SubstResolver (only if
+	 * #is_leaf)?  Then #b is unused, and #lazy_id is passed to
+	 * the resolver.
+	 */
+	bool is_lazy = false;
+
+	/**
+	 * The id passed to SubstTree::AddLazy() (only if #is_lazy).
+	 */
+	unsigned lazy_id = 0;
+
+	constexpr SubstNode(const char *_a, uint_least32_t _depth,
+			    char _ch) noexcept
+		:a(_a), depth(_depth), ch(_ch) {}
+
+	std::span<const char> GetReplacement() const noexcept {
+		assert(is_leaf);
+		assert(!is_lazy);
+
+		return {b, b_length};
+	}
+
+	[[gnu::pure]]
+	const SubstNode *FindChild(char _ch) const noexcept {
+		for (const SubstNode *i = child; i != nullptr && i->ch <= _ch;
+		     i = i->sibling)
+			if (i->ch == _ch)
+				return i;
+
+		return nullptr;
+	}
+};
+
+struct SubstRoot : SubstNode {
+	/**
+	 * Which characters start a search word?
+	 */
+	bool first_chars[256]{};
+
+	/**
+	 * If all search words start with the same character, then
+	 * this is it (allows using memchr()); -1 otherwise.
+	 */
+	int single_first_char = -1;
+
+	bool compiled = false;
+
+	constexpr SubstRoot() noexcept
+		:SubstNode(nullptr, 0, 0) {}
 };
 
+/**
+ * The root of an empty #SubstTree.  It does not have any first
+ * characters, therefore it never gets stepped.
+ */
+static constinit SubstRoot empty_root;
+
 class SubstIstream final : public FacadeIstream, DestructAnchor {
 	bool had_input, had_output;
 
-	bool send_first;
+	/**
+	 * The tree passed to the constructor if this object owns it.
+	 */
+	const SubstTree owned_tree;
 
-	SubstTree tree;
+	const SubstTree &tree;
 
-	const SubstNode *match;
-	std::span<const std::byte> mismatch{};
+	SubstResolver *const resolver = nullptr;
 
-	enum class State {
-		/** searching the first matching character */
-		NONE,
+	/**
+	 * The current state of the automaton.  Its prefix (the last
+	 * node->depth bytes of input) has been consumed, but has not
+	 * yet been submitted to our handler, because it may still
+	 * turn out to be part of a search word.
+	 */
+	const SubstNode *node;
 
-		/** at least the first character was found, checking for the
-		    rest */
-		MATCH,
+	/**
+	 * The number of bytes at the beginning of #node's prefix which
+	 * have already been submitted to our handler.
+	 */
+	std::size_t sent = 0;
 
-		/** inserting the substitution */
-		INSERT,
-	} state = State::NONE;
-	size_t a_match, b_sent;
+	/**
+	 * The rest of a replacement which has yet to be submitted.
+	 */
+	std::span<const std::byte> insert{};
 
 public:
 	SubstIstream(struct pool &p, UnusedIstreamPtr &&_input, SubstTree &&_tree) noexcept
-		:FacadeIstream(p, std::move(_input)), tree(std::move(_tree)) {}
+		:FacadeIstream(p, std::move(_input)),
+		 owned_tree(std::move(_tree)), tree(owned_tree),
+		 node(&tree.GetRoot()) {}
+
+	SubstIstream(struct pool &p, UnusedIstreamPtr &&_input,
+		     const SubstTree &_tree, SubstResolver &_resolver) noexcept
+		:FacadeIstream(p, std::move(_input)),
+		 tree(_tree), resolver(&_resolver),
+		 node(&tree.GetRoot()) {}
 
 private:
-	/** find the first occurence of a "first character" in the buffer */
-	const char *FindFirstChar(const char *data, size_t length) noexcept;
+	bool IsIdle() const noexcept {
+		return node == &tree.GetRoot();
+	}
+
+	/**
+	 * Determine the replacement for the given match.
+	 */
+	std::span<const std::byte> GetReplacement(const SubstNode &match) noexcept;
+
+	std::span<const char> GetUnsentPrefix(std::size_t length) const noexcept {
+		assert(sent <= length);
+		assert(length <= node->depth);
+
+		return std::span{node->a + sent, length - sent};
+	}
 
 	/**
-	 * Write data from "b".
+	 * Submit data to our handler.
 	 *
-	 * @return the number of bytes remaining
+	 * @return the number of bytes consumed by the handler; if
+	 * this is 0, this object may have been destroyed
 	 */
-	size_t TryWriteB() noexcept;
+	std::size_t Submit(std::span<const char> src) noexcept;
 
-	bool FeedMismatch() noexcept;
-	bool WriteMismatch() noexcept;
+	/**
+	 * Submit the beginning of the current node's prefix (up to
+	 * the given length) which was consumed by a previous OnData()
+	 * call.
+	 *
+	 * @return true if everything has been submitted; false if the
+	 * handler has blocked or if this object has been destroyed
+	 */
+	bool SubmitPrefix(std::size_t length) noexcept;
 
 	/**
-	 * Forwards source data to the istream handler.
+	 * Submit the rest of the replacement.
 	 *
-	 * @return (size_t)-1 when everything has been consumed, or the
-	 * correct return value for the data() callback.
+	 * @return true if everything has been submitted; false if the
+	 * handler has blocked or if this object has been destroyed
 	 */
-	size_t ForwardSourceData(const char *start,
-				 const char *p, size_t length) noexcept;
-	size_t ForwardSourceDataFinal(const char *start,
-				      const char *end, const char *p) noexcept;
+	bool SubmitInsert() noexcept;
 
-	size_t Feed(std::span<const std::byte> src) noexcept;
+	std::size_t Feed(std::span<const std::byte> src) noexcept;
 
 public:
 	/* virtual methods from class Istream */
 
 	void _Read() noexcept override;
-
-#if 0
-	// TODO enable this once this and _GetAvailable() is implemented properly
 	void _FillBucketList(IstreamBucketList &list) override;
-	ConsumeBucketResult _ConsumeBucketList(size_t nbytes) noexcept override;
-#endif
+	ConsumeBucketResult _ConsumeBucketList(std::size_t nbytes) noexcept override;
 
 	/* istream handler */
 
-	size_t OnData(std::span<const std::byte> src) noexcept override;
+	std::size_t OnData(std::span<const std::byte> src) noexcept override;
 
 	void OnEof() noexcept override;
 	void OnError(std::exception_ptr ep) noexcept override;
 };
 
 /*
- * helper functions
+ * SubstTree
  *
  */
 
-/** find a character in the tree */
-[[gnu::pure]]
-static const SubstNode *
-subst_find_char(const SubstNode *node, char ch) noexcept
+inline const SubstNode &
+SubstTree::GetRoot() const noexcept
 {
-	assert(node != nullptr);
+	return root != nullptr ? *root : empty_root;
+}
 
-	if (ch == 0)
-		/* we cannot support null bytes */
-		return nullptr;
+inline const char *
+SubstTree::FindFirstChar(const char *p, const char *end) const noexcept
+{
+	if (root == nullptr)
+		return end;
 
-	do {
-		if (node->ch == ch) {
-			assert(node->equals != nullptr);
-			return node->equals;
-		}
+	const SubstRoot &r = *root;
+
+	if (r.single_first_char >= 0) {
+		p = (const char *)memchr(p, r.single_first_char, end - p);
+		return p != nullptr ? p : end;
+	}
 
-		if (ch < node->ch)
-			node = node->left;
-		else
-			node = node->right;
-	} while (node != nullptr);
+	while (p < end && !r.first_chars[(unsigned char)*p])
+		++p;
 
-	return nullptr;
+	return p;
 }
 
-/** find the leaf ending the current search word */
-[[gnu::pure]]
-static const SubstNode *
-subst_find_leaf(const SubstNode *node) noexcept
+inline const SubstNode &
+SubstTree::Step(const SubstNode &_node, char ch) const noexcept
 {
-	assert(node != nullptr);
+	for (const SubstNode *n = &_node;; n = n->fail) {
+		if (const auto *c = n->FindChild(ch))
+			return *c;
 
-	do {
-		if (node->ch == 0)
-			return node;
-
-		if (0 < node->ch)
-			node = node->left;
-		else
-			node = node->right;
-	} while (node != nullptr);
-
-	return nullptr;
+		if (n->fail == nullptr)
+			/* this is the root */
+			return *n;
+	}
 }
 
 /**
- * Check whether the given input can possibly be a match.
+ * Insert a new search word into the trie.
  *
- * @param match the current match (usually found with memchr() by
- * SubstTree::FindFirstChar())
- * @param input the remaining input
- * @param true if the remaining input matches so far (but may not be
- * complete yet), false if the input cannot match
+ * @return the new leaf node or nullptr if this search word already
+ * exists
  */
-[[gnu::pure]]
-static bool
-CheckMatch(const SubstNode *match, std::string_view input) noexcept
+static SubstNode *
+InsertWord(struct pool &pool, SubstRoot &root, const char *a0) noexcept
 {
-	for (const char ch : input) {
-		if (subst_find_leaf(match) != nullptr)
-			return true;
+	assert(a0 != nullptr);
+	assert(*a0 != 0);
+	assert(!root.compiled);
+
+	SubstNode *n = &root;
+	for (const char *a = a0; *a != 0; ++a) {
+		/* find the child in the sorted sibling list or
+		   insert a new one */
+		SubstNode **pp = &n->child;
+		while (*pp != nullptr && (*pp)->ch < *a)
+			pp = &(*pp)->sibling;
+
+		if (*pp == nullptr || (*pp)->ch != *a) {
+			auto *c = NewFromPool<SubstNode>(pool, a0, n->depth + 1, *a);
+			c->sibling = *pp;
+			*pp = c;
+		}
 
-		match = subst_find_char(match, ch);
-		if (match == nullptr)
-			return false;
+		n = *pp;
 	}
 
-	return true;
-}
-
-/** find any leaf which begins with the current partial match, used to
-    find a buffer which is partially re-inserted into the data
-    stream */
-[[gnu::pure]]
-static const SubstNode *
-subst_find_any_leaf(const SubstNode *node) noexcept
-{
-	while (true) {
-		assert(node != nullptr);
+	if (n->is_leaf)
+		/* this keyword already exists */
+		return nullptr;
 
-		if (node->ch == 0)
-			return node;
+	n->is_leaf = true;
 
-		node = node->equals;
-	}
-}
+	root.first_chars[(unsigned char)*a0] = true;
 
-/** iterates over the current depth */
-[[gnu::pure]]
-static const SubstNode *
-subst_next_non_leaf_node(const SubstNode *node, const SubstNode *root) noexcept
-{
-	/* dive into left wing first */
-	if (node->left != nullptr && node->left->ch != 0)
-		return node->left;
-
-	/* if left does not exist, go right */
-	if (node->right != nullptr && node->right->ch != 0)
-		return node->right;
-
-	/* this subtree is finished, go up */
-	while (true) {
-		/* don't go above our root */
-		if (node == root)
-			return nullptr;
-
-		assert(node->parent != nullptr);
-
-		if (node->parent->left == node) {
-			node = node->parent;
-
-			/* only go to parent->right if we came from
-			   parent->left */
-			if (node->right != nullptr && node->right->ch != 0)
-				return node;
-		} else {
-			node = node->parent;
-		}
-	}
+	return n;
 }
 
-inline std::pair<const SubstNode *, const char *>
-SubstTree::FindFirstChar(const char *data, size_t length) const noexcept
+bool
+SubstTree::Add(struct pool &pool, const char *a0, std::string_view b) noexcept
 {
-	const char *const end = data + length;
-	const SubstNode *n = root;
-	const SubstNode *match = nullptr;
-	const char *min = nullptr;
-
-	while (n != nullptr) {
-		assert(n->ch != 0);
-
-		/* loop to find all instances of this start character, until
-		   there is one where the rest also matches */
-		const char *p = data;
-		while (true) {
-			p = (const char *)memchr(p, n->ch, end - p);
-			if (p != nullptr && (min == nullptr || p < min)) {
-				if (!CheckMatch(n->equals, {p + 1, end})) {
-					/* late mismatch; continue the loop to check if
-					   there are more of the current start
-					   character */
-					++p;
-					continue;
-				}
-
-				assert(n->equals != nullptr);
-				match = n->equals;
-				min = p;
-			}
-
-			break;
-		}
+	if (root == nullptr)
+		root = NewFromPool<SubstRoot>(pool);
 
-		/* check the next start character in the #SubstTree */
-		n = subst_next_non_leaf_node(n, root);
-	}
+	SubstNode *n = InsertWord(pool, *root, a0);
+	if (n == nullptr)
+		return false;
 
-	return std::make_pair(match, min);
+	n->b = (const char *)p_memdup(&pool, b.data(), b.size());
+	n->b_length = b.size();
+	return true;
 }
 
-inline const char *
-SubstIstream::FindFirstChar(const char *data, size_t length) noexcept
+bool
+SubstTree::Add(struct pool &pool, const char *a0, const char *b) noexcept
 {
-	auto x = tree.FindFirstChar(data, length);
-	match = x.first;
-	return x.second;
+	return Add(pool, a0,
+		   b != nullptr ? std::string_view{b} : std::string_view{});
 }
 
-size_t
-SubstIstream::TryWriteB() noexcept
+bool
+SubstTree::AddLazy(struct pool &pool, const char *a0, unsigned id) noexcept
 {
-	assert(state == State::INSERT);
-	assert(a_match > 0);
-	assert(match != nullptr);
-	assert(match->ch == 0);
-	assert(a_match == strlen(match->leaf.a));
+	if (root == nullptr)
+		root = NewFromPool<SubstRoot>(pool);
 
-	const auto src = std::as_bytes(match->leaf.AsSpan().subspan(b_sent));
-	assert(!src.empty());
-
-	const size_t nbytes = InvokeData(src);
-	assert(nbytes <= src.size());
-	if (nbytes > 0) {
-		/* note progress */
-		b_sent += nbytes;
-
-		/* finished sending substitution? */
-		if (nbytes == src.size())
-			state = State::NONE;
-	}
+	SubstNode *n = InsertWord(pool, *root, a0);
+	if (n == nullptr)
+		return false;
 
-	return src.size() - nbytes;
+	n->is_lazy = true;
+	n->lazy_id = id;
+	return true;
 }
 
-bool
-SubstIstream::FeedMismatch() noexcept
+void
+SubstTree::Compile() noexcept
 {
-	assert(state == State::NONE);
-	assert(input.IsDefined());
-	assert(!mismatch.empty());
+	if (root == nullptr || root->compiled)
+		return;
 
-	if (send_first) {
-		const size_t nbytes = InvokeData(mismatch.first(1));
-		if (nbytes == 0)
-			return true;
+	root->compiled = true;
 
-		mismatch = mismatch.subspan(nbytes);
+	if (root->child != nullptr && root->child->sibling == nullptr)
+		root->single_first_char = (unsigned char)root->child->ch;
 
-		if (mismatch.empty())
-			return false;
+	/* breadth-first traversal: the failure link of each node
+	   points to a node with a smaller depth, which has been
+	   visited already */
 
-		send_first = false;
-	}
+	std::vector<SubstNode *> queue;
 
-	const size_t nbytes = Feed(mismatch);
-	if (nbytes == 0)
-		return true;
+	for (SubstNode *c = root->child; c != nullptr; c = c->sibling) {
+		c->fail = root;
+		c->output = c->is_leaf ? c : nullptr;
+		queue.push_back(c);
+	}
 
-	assert(nbytes <= mismatch.size());
-	mismatch = mismatch.subspan(nbytes);
+	for (std::size_t i = 0; i < queue.size(); ++i) {
+		const SubstNode &n = *queue[i];
 
-	return !mismatch.empty();
+		for (SubstNode *c = n.child; c != nullptr; c = c->sibling) {
+			c->fail = &Step(*n.fail, c->ch);
+			c->output = c->is_leaf ? c : c->fail->output;
+			queue.push_back(c);
+		}
+	}
 }
 
-bool
-SubstIstream::WriteMismatch() noexcept
+/*
+ * helper methods
+ *
+ */
+
+std::span<const std::byte>
+SubstIstream::GetReplacement(const SubstNode &match) noexcept
 {
-	assert(!input.IsDefined() || state == State::NONE);
-	assert(!mismatch.empty());
+	if (!match.is_lazy)
+		return std::as_bytes(match.GetReplacement());
 
-	size_t nbytes = InvokeData(mismatch);
-	if (nbytes == 0)
-		return true;
+	assert(resolver != nullptr);
 
-	assert(nbytes <= mismatch.size());
-	mismatch = mismatch.subspan(nbytes);
+	if (const auto value = resolver->ResolveSubst(match.lazy_id))
+		return AsBytes(*value);
 
-	if (!mismatch.empty())
-		return true;
+	/* no replacement: submit the search word unmodified */
+	return std::as_bytes(std::span{match.a, match.depth});
+}
 
-	if (!input.IsDefined()) {
-		DestroyEof();
-		return true;
-	}
+inline std::size_t
+SubstIstream::Submit(std::span<const char> src) noexcept
+{
+	assert(!src.empty());
 
-	return false;
+	const std::size_t nbytes = InvokeData(std::as_bytes(src));
+	if (nbytes > 0)
+		had_output = true;
+	return nbytes;
 }
 
-size_t
-SubstIstream::ForwardSourceData(const char *start,
-				const char *p, size_t length) noexcept
+bool
+SubstIstream::SubmitPrefix(std::size_t length) noexcept
 {
-	const DestructObserver destructed(*this);
-
-	size_t nbytes = InvokeData(std::as_bytes(std::span{p, length}));
-	if (destructed) {
-		/* stream has been closed - we must return 0 */
-		assert(nbytes == 0);
-		return 0;
-	}
+	const auto src = GetUnsentPrefix(length);
+	if (src.empty())
+		return true;
 
-	had_output = true;
+	const std::size_t nbytes = Submit(src);
+	if (nbytes == 0)
+		return false;
 
-	if (nbytes < length) {
-		/* blocking */
-		state = State::NONE;
-		return (p - start) + nbytes;
-	} else
-		/* everything has been consumed */
-		return (size_t)-1;
+	sent += nbytes;
+	return nbytes == src.size();
 }
 
-inline size_t
-SubstIstream::ForwardSourceDataFinal(const char *start,
-				     const char *end, const char *p) noexcept
+bool
+SubstIstream::SubmitInsert() noexcept
 {
-	const DestructObserver destructed(*this);
+	if (insert.empty())
+		return true;
 
-	size_t nbytes = InvokeData(std::as_bytes(std::span{p, end}));
-	if (nbytes > 0 || !destructed) {
-		had_output = true;
-		nbytes += (p - start);
-	}
+	const std::size_t nbytes = InvokeData(insert);
+	if (nbytes == 0)
+		return false;
 
-	return nbytes;
+	had_output = true;
+	insert = insert.subspan(nbytes);
+	return insert.empty();
 }
 
-size_t
+std::size_t
 SubstIstream::Feed(std::span<const std::byte> src) noexcept
 {
 	assert(input.IsDefined());
+	assert(insert.empty());
 
 	const DestructObserver destructed(*this);
 
-	const char *const data0 = (const char *)src.data(), *data = data0, *p = data0,
-		*const end = p + src.size(), *first = nullptr;
-	const SubstNode *n;
-
-	had_input = true;
-
-	/* find new match */
-
-	do {
-		assert(data >= data0);
-		assert(p >= data);
-		assert(p <= end);
-
-		switch (state) {
-		case State::NONE:
-			/* find matching first char */
-
-			assert(first == nullptr);
-
-			first = FindFirstChar(p, end - p);
-			if (first == nullptr)
-				/* no match, try to write and return */
-				return ForwardSourceDataFinal(data0, end, data);
-
-			state = State::MATCH;
-			a_match = 1;
-
-			p = first + 1;
-
-			/* XXX check if match is full */
-			break;
-
-		case State::MATCH:
-			/* now see if the rest matches; note that max_compare may be
-			   0, but that isn't a problem */
-
-			n = subst_find_char(match, *p);
-			if (n != nullptr) {
-				/* next character matches */
-
-				++a_match;
-				++p;
-				match = n;
-
-				n = subst_find_leaf(n);
-				if (n != nullptr) {
-					/* full match */
-
-					match = n;
-
-					if (first != nullptr && first > data) {
-						/* write the data chunk before the match */
-
-						had_output = true;
-
-						const size_t chunk_length = first - data;
-						const size_t nbytes =
-							ForwardSourceData(data0, data, chunk_length);
-						if (nbytes != (size_t)-1)
-							return nbytes;
-					}
-
-					/* move data pointer */
+	const char *const start = (const char *)src.data(),
+		*const end = start + src.size();
 
-					data = p;
-					first = nullptr;
+	/* the first byte which has been neither submitted nor
+	   absorbed by the automaton */
+	const char *data = start;
 
-					/* switch state */
+	/* the number of bytes at the beginning of the current node's
+	   prefix which were consumed by a previous OnData() call and
+	   are therefore not in this buffer */
+	std::size_t carried = node->depth;
 
-					if (n->leaf.b_length > 0) {
-						state = State::INSERT;
-						b_sent = 0;
-					} else {
-						state = State::NONE;
-					}
-				}
-			} else {
-				/* mismatch. reset match indicator and find new one */
-
-				if (first != nullptr && (first > data ||
-							 !mismatch.empty())) {
-					/* write the data chunk before the (mis-)match */
-
-					had_output = true;
-
-					size_t chunk_length = first - data;
-					if (!mismatch.empty())
-						++chunk_length;
-
-					const size_t nbytes =
-						ForwardSourceData(data0, data, chunk_length);
-					if (nbytes != (size_t)-1)
-						return nbytes;
-				} else {
-					/* when re-parsing a mismatch, "first" must not be
-					   nullptr because we entered this function with
-					   state=NONE */
-					assert(mismatch.empty());
-				}
-
-				/* move data pointer */
-
-				data = p;
-				first = nullptr;
-
-				/* switch state */
-
-				/* seek any leaf to get a valid match->leaf.a which we
-				   can use to re-insert the partial match into the
-				   stream */
-
-				state = State::NONE;
-
-				if (mismatch.empty()) {
-					send_first = true;
-
-					n = subst_find_any_leaf(match);
-					assert(n != nullptr);
-					assert(n->ch == 0);
-					mismatch = std::as_bytes(std::span{n->leaf.a, a_match});
+	had_input = true;
 
-					if (FeedMismatch())
-						return destructed ? 0 : data - data0;
-				}
-			}
+	for (const char *p = start; p < end;) {
+		if (IsIdle()) {
+			p = tree.FindFirstChar(p, end);
+			if (p == end)
+				break;
+		}
 
-			break;
+		const SubstNode &next = tree.Step(*node, *p);
+		const SubstNode *const match = next.output;
+
+		/* the number of bytes of the current prefix plus the new
+		   character which are not going to be part of the next
+		   prefix or the match; they are submitted as-is */
+		const std::size_t literal = node->depth + 1 -
+			(match != nullptr ? match->depth : next.depth);
+
+		/* the carried bytes precede everything in this buffer,
+		   and they are submitted first */
+		const std::size_t carried_literal = std::min(literal, carried);
+		if (!SubmitPrefix(carried_literal))
+			/* blocking; the current character will be
+			   submitted again, and #sent remembers how
+			   far we got */
+			return destructed ? 0 : p - start;
+
+		if (match == nullptr) {
+			/* no match (yet) */
+			carried -= carried_literal;
+			node = &next;
+			sent = 0;
+			++p;
+			continue;
+		}
 
-		case State::INSERT:
-			/* there is a previous full match, copy data from b */
+		/* submit all input before the match */
 
-			const size_t nbytes = TryWriteB();
-			if (nbytes > 0) {
-				if (destructed)
+		const char *const held = p - (node->depth - carried);
+		if (const char *match_start = held + (literal - carried_literal);
+		    match_start > data) {
+			const std::size_t length = match_start - data;
+			const std::size_t nbytes = Submit({data, length});
+			if (nbytes < length) {
+				if (nbytes == 0 && destructed)
 					return 0;
 
-				assert(state == State::INSERT);
-				/* blocking */
-				return data - data0;
+				/* blocking: discard the partial match;
+				   it will be found again when the rest
+				   is submitted again, because no other
+				   match can begin before it */
+				node = &tree.GetRoot();
+				sent = 0;
+				return data + nbytes - start;
 			}
+		}
 
-			assert(state == State::NONE);
+		/* now submit the replacement */
 
-			break;
-		}
-	} while (p < end || state == State::INSERT);
-
-	size_t chunk_length;
-	if (first != nullptr)
-		/* we have found a partial match which we discard now, instead
-		   we will write the chunk right before this match */
-		chunk_length = first - data;
-	else if (state == State::MATCH || state == State::INSERT)
-		chunk_length = 0;
-	else
-		/* there was no match (maybe a partial match which mismatched
-		   at a later stage): pass everything */
-		chunk_length = end - data;
-
-	if (chunk_length > 0) {
-		/* write chunk */
+		node = &tree.GetRoot();
+		sent = 0;
+		carried = 0;
+		data = ++p;
 
-		had_output = true;
+		insert = GetReplacement(*match);
+		if (!SubmitInsert())
+			return destructed ? 0 : p - start;
+	}
 
-		const size_t nbytes = ForwardSourceData(data0, data, chunk_length);
-		if (nbytes != (size_t)-1)
-			return nbytes;
+	/* submit the rest, except for the prefix held by the
+	   automaton */
+
+	const char *const held = end - (node->depth - carried);
+	if (held > data) {
+		const std::size_t length = held - data;
+		const std::size_t nbytes = Submit({data, length});
+		if (nbytes < length) {
+			if (nbytes == 0 && destructed)
+				return 0;
+
+			/* blocking: discard the partial match (see
+			   above) */
+			node = &tree.GetRoot();
+			sent = 0;
+			return data + nbytes - start;
+		}
 	}
 
-	return p - data0;
+	return src.size();
 }
 
 /*
@@ -583,10 +560,10 @@ SubstIstream::Feed(std::span<const std::byte> src) noexcept
  *
  */
 
-inline size_t
+std::size_t
 SubstIstream::OnData(std::span<const std::byte> src) noexcept
 {
-	if (!mismatch.empty() && FeedMismatch())
+	if (!SubmitInsert())
 		return 0;
 
 	return Feed(src);
@@ -599,35 +576,9 @@ SubstIstream::OnEof() noexcept
 
 	input.Clear();
 
-	switch (state) {
-		size_t nbytes;
-
-	case State::NONE:
-		break;
-
-	case State::MATCH:
-		/* we're in the middle of a match, technically making this a
-		   mismatch because we reach end of file before end of
-		   match */
-		if (mismatch.empty()) {
-			const SubstNode *n = subst_find_any_leaf(match);
-			assert(n != nullptr);
-			assert(n->ch == 0);
-
-			mismatch = std::as_bytes(std::span{n->leaf.a, a_match});
-			WriteMismatch();
-			return;
-		}
-		break;
-
-	case State::INSERT:
-		nbytes = TryWriteB();
-		if (nbytes > 0)
-			return;
-		break;
-	}
-
-	if (state == State::NONE)
+	/* the prefix held by the automaton will never be completed;
+	   submit it as-is */
+	if (SubmitInsert() && SubmitPrefix(node->depth))
 		DestroyEof();
 }
 
@@ -648,201 +599,116 @@ SubstIstream::OnError(std::exception_ptr ep) noexcept
 void
 SubstIstream::_Read() noexcept
 {
-	if (!mismatch.empty()) {
-		bool ret = input.IsDefined()
-			? FeedMismatch()
-			: WriteMismatch();
-
-		if (ret || !input.IsDefined())
-			return;
-	} else {
-		assert(input.IsDefined());
-	}
-
-	switch (state) {
-		size_t nbytes;
-
-	case State::NONE:
-	case State::MATCH: {
-		assert(input.IsDefined());
-
-		had_output = false;
-
-		const DestructObserver destructed(*this);
-
-		do {
-			had_input = false;
-			input.Read();
-		} while (!destructed && input.IsDefined() && had_input &&
-			 !had_output && state != State::INSERT);
+	if (!SubmitInsert())
+		return;
 
+	if (!input.IsDefined()) {
+		if (SubmitPrefix(node->depth))
+			DestroyEof();
 		return;
 	}
 
-	case State::INSERT:
-		nbytes = TryWriteB();
-		if (nbytes > 0)
-			return;
-		break;
-	}
+	had_output = false;
 
-	if (state == State::NONE && !input.IsDefined())
-		DestroyEof();
-}
+	const DestructObserver destructed(*this);
 
-#if 0
-// TODO enable this once this and _GetAvailable() is implemented properly
+	do {
+		had_input = false;
+		input.Read();
+	} while (!destructed && input.IsDefined() && had_input &&
+		 !had_output && insert.empty());
+}
 
 void
 SubstIstream::_FillBucketList(IstreamBucketList &list)
 {
-	if (!mismatch.empty()) {
-		if (input.IsDefined()) {
-			// FeedMismatch()
+	if (!insert.empty())
+		list.Push(insert);
 
-			if (send_first)
-				list.Push(mismatch.first(1));
+	if (!input.IsDefined()) {
+		if (const auto rest = GetUnsentPrefix(node->depth);
+		    !rest.empty())
+			list.Push(std::as_bytes(rest));
+		return;
+	}
 
-			// TODO: re-parse the rest of the mismatch buffer
-			list.SetMore();
-			list.EnableFallback(); // TODO eliminate
-			return;
-		} else {
-			// WriteMismatch()
-			list.Push(mismatch);
-			return;
-		}
-	} else {
-		assert(input.IsDefined());
+	if (!IsIdle()) {
+		/* the automaton holds a partial match; let
+		   OnData() sort this out */
+		list.EnableFallback();
+		return;
 	}
 
-	switch (state) {
-	case State::NONE: {
-		IstreamBucketList tmp;
-		FillBucketListFromInput(tmp);
+	IstreamBucketList tmp;
+	FillBucketListFromInput(tmp);
 
-		if (tmp.HasMore()) {
-			list.SetMore();
+	/* pass all input through until the first character which
+	   may start a search word */
 
-			if (tmp.ShouldFallback())
-				list.EnableFallback();
+	for (const auto &bucket : tmp) {
+		if (!bucket.IsBuffer()) {
+			list.EnableFallback();
+			return;
 		}
 
-		for (const auto &bucket : tmp) {
-			if (!bucket.IsBuffer()) {
-				list.SetMore();
-				list.EnableFallback(); // TODO eliminate
-				return;
-			}
-
-			auto s = ToStringView(bucket.GetBuffer());
-
-			const char *first = FindFirstChar(s.data(),
-							  s.size());
-			if (first != nullptr) {
-				s = Partition(s, first).first;
-				if (!s.empty())
-					list.Push(AsBytes(s));
-				list.SetMore();
-				list.EnableFallback(); // TOOD eliminate
-				return;
-			}
+		const auto s = ToStringView(bucket.GetBuffer());
+		const char *first = tree.FindFirstChar(s.data(),
+						       s.data() + s.size());
+		if (first > s.data())
+			list.Push(AsBytes(std::string_view{s.data(), first}));
 
-			list.Push(AsBytes(s));
+		if (first < s.data() + s.size()) {
+			list.EnableFallback();
+			return;
 		}
-
-		return;
 	}
 
-	case State::MATCH:
-		// TODO: read from input
-		list.SetMore();
-		list.EnableFallback(); // TODO eliminate
-		return;
-
-	case State::INSERT: {
-		// TryWriteB
-		assert(state == State::INSERT);
-		assert(a_match > 0);
-		assert(match != nullptr);
-		assert(match->ch == 0);
-		assert(a_match == strlen(match->leaf.a));
-
-		const size_t length = match->leaf.b_length - b_sent;
-		assert(length > 0);
-
-		list.Push({(const std::byte *)match->leaf.b + b_sent, length});
+	if (tmp.HasMore()) {
 		list.SetMore();
-		list.EnableFallback(); // TODO eliminate
 
-		// TODO: read more
-		return;
-	}
+		if (tmp.ShouldFallback())
+			list.EnableFallback();
 	}
 }
 
 Istream::ConsumeBucketResult
-SubstIstream::_ConsumeBucketList(size_t nbytes) noexcept
+SubstIstream::_ConsumeBucketList(std::size_t nbytes) noexcept
 {
-	assert(nbytes > 0);
+	std::size_t total = 0;
 
-	// TODO return eof flag?
+	if (!insert.empty()) {
+		const std::size_t n = std::min(nbytes, insert.size());
+		insert = insert.subspan(n);
+		nbytes -= n;
+		total += n;
+	}
 
-	if (!mismatch.empty()) {
-		if (input.IsDefined()) {
-			// FeedMismatch()
+	if (input.IsDefined()) {
+		if (nbytes > 0 && insert.empty()) {
+			/* _FillBucketList() submits input only while
+			   the automaton is idle, and those bytes do
+			   not start a search word */
+			assert(IsIdle());
 
-			if (send_first) {
-				send_first = false;
-				return {Consumed(1), false};
-			}
+			const auto r = input.ConsumeBucketList(nbytes);
+			total += r.consumed;
 
-			return {0, false};
-		} else {
-			// WriteMismatch()
-			nbytes = std::min(nbytes, mismatch.size());
-			mismatch = mismatch.subspan(nbytes);
-			return {Consumed(nbytes), false};
+			if (r.eof)
+				CloseInput();
 		}
 	} else {
-		assert(input.IsDefined());
+		const std::size_t n = std::min(nbytes,
+					       GetUnsentPrefix(node->depth).size());
+		sent += n;
+		total += n;
 	}
 
-	switch (state) {
-	case State::NONE:
-		return Consumed(input.ConsumeBucketList(nbytes));
-
-	case State::MATCH:
-		return {0, false};
-
-	case State::INSERT: {
-		// TryWriteB
-		assert(state == State::INSERT);
-		assert(a_match > 0);
-		assert(match != nullptr);
-		assert(match->ch == 0);
-		assert(a_match == strlen(match->leaf.a));
-
-		const size_t length = match->leaf.b_length - b_sent;
-		assert(length > 0);
-
-		size_t consumed = std::min(nbytes, length);
-
-		/* note progress */
-		b_sent += consumed;
-
-		/* finished sending substitution? */
-		if (consumed == length)
-			state = State::NONE;
-		return {Consumed(consumed), false};
-	}
-	}
-
-	gcc_unreachable();
+	return {
+		Consumed(total),
+		!input.IsDefined() && insert.empty() && sent == node->depth,
+	};
 }
 
-#endif
-
 /*
  * constructor
  *
@@ -852,74 +718,16 @@ UnusedIstreamPtr
 istream_subst_new(struct pool *pool, UnusedIstreamPtr input,
 		  SubstTree tree) noexcept
 {
+	tree.Compile();
+
 	return NewIstreamPtr<SubstIstream>(*pool, std::move(input),
 					   std::move(tree));
 }
 
-bool
-SubstTree::Add(struct pool &pool, const char *a0, std::string_view b) noexcept
-{
-	SubstNode *parent = nullptr;
-	const char *a = a0;
-
-	assert(a0 != nullptr);
-	assert(*a0 != 0);
-
-	auto **pp = &root;
-	do {
-		auto *p = *pp;
-		if (p == nullptr) {
-			/* create new tree node */
-
-			p = (SubstNode *)p_malloc(&pool, sizeof(*p) - sizeof(p->leaf));
-			p->parent = parent;
-			p->left = nullptr;
-			p->right = nullptr;
-			p->equals = nullptr;
-			p->ch = *a++;
-
-			*pp = parent = p;
-			pp = &p->equals;
-		} else if (*a < p->ch) {
-			pp = &p->left;
-			parent = p;
-		} else if (*a > p->ch) {
-			pp = &p->right;
-			parent = p;
-		} else {
-			/* tree node exists and matches, enter new level (next
-			   character) */
-			pp = &p->equals;
-			parent = p;
-			++a;
-		}
-	} while (*a);
-
-	/* this keyword already exists */
-	if (*pp != nullptr)
-		return false;
-
-	/* create new leaf node */
-
-	SubstNode *p = (SubstNode *)
-		p_malloc(&pool, sizeof(*p) + b.size() - sizeof(p->leaf.b));
-	p->parent = parent;
-	p->left = nullptr;
-	p->right = nullptr;
-	p->equals = nullptr;
-	p->ch = 0;
-	p->leaf.a = a0;
-	p->leaf.b_length = b.size();
-	std::copy(b.begin(), b.end(), p->leaf.b);
-
-	*pp = p;
-
-	return true;
-}
-
-bool
-SubstTree::Add(struct pool &pool, const char *a0, const char *b) noexcept
+UnusedIstreamPtr
+istream_subst_new(struct pool *pool, UnusedIstreamPtr input,
+		  const SubstTree &tree, SubstResolver &resolver) noexcept
 {
-	return Add(pool, a0,
-		   b != nullptr ? std::string_view{b} : std::string_view{});
+	return NewIstreamPtr<SubstIstream>(*pool, std::move(input),
+					   tree, resolver);
 }
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <optional>
 #include <string_view>
 #include <utility>
 
@@ -12,9 +13,16 @@
 struct pool;
 class UnusedIstreamPtr;
 struct SubstNode;
+struct SubstRoot;
 
+/**
+ * A set of search words and their replacements.  Internally, this is
+ * an Aho-Corasick automaton: a trie of all search words plus
+ * "failure" links which allow scanning the input in linear time
+ * without ever looking at a byte twice.
+ */
 class SubstTree {
-	SubstNode *root = nullptr;
+	SubstRoot *root = nullptr;
 
 public:
 	SubstTree() = default;
@@ -28,17 +36,84 @@ public:
 		return *this;
 	}
 
+	/**
+	 * Add a search word.  This must not be called after
+	 * Compile().
+	 *
+	 * @param a0 the search word; it is not copied, and the
+	 * caller is responsible for keeping it alive
+	 * @return false if this search word already exists
+	 */
 	bool Add(struct pool &pool, const char *a0, std::string_view b) noexcept;
 	bool Add(struct pool &pool, const char *a0, const char *b) noexcept;
 
+	/**
+	 * Add a search word whose replacement is determined only
+	 * when it is found, by SubstResolver::ResolveSubst().
+	 *
+	 * @param id an arbitrary number passed to the
+	 * #SubstResolver
+	 * @return false if this search word already exists
+	 */
+	bool AddLazy(struct pool &pool, const char *a0, unsigned id) noexcept;
+
+	/**
+	 * Calculate the failure links.  This is called by
+	 * istream_subst_new() after all search words have been
+	 * added; calling it again is a no-op.
+	 */
+	void Compile() noexcept;
+
+	const SubstNode &GetRoot() const noexcept;
+
+	/**
+	 * Find the first character which may start a search word.
+	 *
+	 * @return a pointer to that character or #end if there is
+	 * none
+	 */
 	[[gnu::pure]]
-	std::pair<const SubstNode *, const char *> FindFirstChar(const char *data,
-								 size_t length) const noexcept;
+	const char *FindFirstChar(const char *p, const char *end) const noexcept;
+
+	/**
+	 * Advance the automaton by one character.
+	 */
+	[[gnu::pure]]
+	const SubstNode &Step(const SubstNode &node, char ch) const noexcept;
+};
+
+/**
+ * Determines the replacements of search words which were added with
+ * SubstTree::AddLazy().
+ */
+class SubstResolver {
+public:
+	/**
+	 * @param id the number passed to SubstTree::AddLazy()
+	 * @return the replacement (which must remain valid until the
+	 * #Istream is destroyed) or std::nullopt to leave the search
+	 * word as it is
+	 */
+	virtual std::optional<std::string_view> ResolveSubst(unsigned id) noexcept = 0;
 };
 
 /**
  * This istream filter substitutes a word with another string.
+ *
+ * If search words overlap, the one which ends first wins; if several
+ * end at the same position, the longest one wins.
  */
 UnusedIstreamPtr
 istream_subst_new(struct pool *pool, UnusedIstreamPtr input,
 		  SubstTree tree) noexcept;
+
+/**
+ * Like istream_subst_new(), but use a shared #SubstTree which must
+ * have been compiled already and must outlive the #Istream; the
+ * replacements of lazy search words are obtained from the
+ * #SubstResolver.  This avoids building a new tree for each
+ * response.
+ */
+UnusedIstreamPtr
+istream_subst_new(struct pool *pool, UnusedIstreamPtr input,
+		  const SubstTree &tree, SubstResolver &resolver) noexcept;
@@ -3,7 +3,9 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "istream_iconv.hxx"
+#include "BuiltinIconv.hxx"
 #include "FacadeIstream.hxx"
+#include "Bucket.hxx"
 #include "UnusedPtr.hxx"
 #include "New.hxx"
 #include "memory/fb_pool.hxx"
@@ -12,13 +14,24 @@
 
 #include <iconv.h>
 
+#include <optional>
 #include <stdexcept>
 
 #include <assert.h>
 #include <errno.h>
 
 class IconvIstream final : public FacadeIstream, DestructAnchor {
+	/**
+	 * The libiconv handle; (iconv_t)-1 if #builtin is used.
+	 */
 	const iconv_t iconv;
+
+	/**
+	 * If set, then this built-in converter is used instead of
+	 * libiconv.
+	 */
+	const std::optional<BuiltinIconvType> builtin;
+
 	SliceFifoBuffer buffer;
 
 public:
@@ -29,8 +42,16 @@ public:
 	{
 	}
 
+	IconvIstream(struct pool &p, UnusedIstreamPtr _input,
+		     BuiltinIconvType _builtin) noexcept
+		:FacadeIstream(p, std::move(_input)),
+		 iconv((iconv_t)-1), builtin(_builtin)
+	{
+	}
+
 	~IconvIstream() noexcept override {
-		iconv_close(iconv);
+		if (iconv != (iconv_t)-1)
+			iconv_close(iconv);
 	}
 
 	/* virtual methods from class Istream */
@@ -43,12 +64,24 @@ public:
 	}
 
 	void _Read() noexcept override;
+	void _FillBucketList(IstreamBucketList &list) override;
+	ConsumeBucketResult _ConsumeBucketList(std::size_t nbytes) noexcept override;
 
 	/* handler */
 
 	size_t OnData(std::span<const std::byte> src) noexcept override;
 	void OnEof() noexcept override;
 	void OnError(std::exception_ptr ep) noexcept override;
+
+private:
+	/**
+	 * Convert as much as possible from the source into #dest and
+	 * append the result to #buffer.
+	 *
+	 * @return 0 on success or an errno value like iconv()
+	 */
+	int Convert(const char *&src, std::size_t &length,
+		    std::span<std::byte> dest) noexcept;
 };
 
 static inline size_t
@@ -60,6 +93,38 @@ deconst_iconv(iconv_t cd,
 	return iconv(cd, inbuf2, inbytesleft, outbuf, outbytesleft);
 }
 
+int
+IconvIstream::Convert(const char *&src, std::size_t &length,
+		      std::span<std::byte> dest) noexcept
+{
+	if (builtin) {
+		const auto r = BuiltinIconv(*builtin,
+					    std::as_bytes(std::span{src, length}),
+					    dest);
+		buffer.Append(r.produced);
+		src += r.consumed;
+		length -= r.consumed;
+
+		if (r.incomplete)
+			return EINVAL;
+
+		/* the built-in converters skip invalid input, so
+		   the only other reason for stopping is that the
+		   output buffer is full */
+		return length > 0 ? E2BIG : 0;
+	}
+
+	char *const dest0 = (char *)dest.data();
+	char *dest_p = dest0;
+	size_t dest_left = dest.size();
+
+	size_t ret = deconst_iconv(iconv, &src, &length, &dest_p, &dest_left);
+	if (dest_p > dest0)
+		buffer.Append(dest_p - dest0);
+
+	return ret == (size_t)-1 ? errno : 0;
+}
+
 /*
  * istream handler
  *
@@ -94,16 +159,8 @@ IconvIstream::OnData(const std::span<const std::byte> _src) noexcept
 			continue;
 		}
 
-		char *const dest0 = (char *)w.data();
-		char *dest = dest0;
-		size_t dest_left = w.size();
-
-		size_t ret = deconst_iconv(iconv, &src, &length, &dest, &dest_left);
-		if (dest > dest0)
-			buffer.Append(dest - dest0);
-
-		if (ret == (size_t)-1) {
-			switch (errno) {
+		if (const int error = Convert(src, length, w); error != 0) {
+			switch (error) {
 				size_t nbytes;
 
 			case EILSEQ:
@@ -193,6 +250,83 @@ IconvIstream::_Read() noexcept
 	}
 }
 
+void
+IconvIstream::_FillBucketList(IstreamBucketList &list)
+{
+	if (auto r = buffer.Read(); !r.empty())
+		list.Push(r);
+
+	if (!input.IsDefined())
+		return;
+
+	if (!builtin) {
+		list.EnableFallback();
+		return;
+	}
+
+	IstreamBucketList tmp;
+	FillBucketListFromInput(tmp);
+
+	if (tmp.IsEmpty() && !tmp.HasMore()) {
+		CloseInput();
+		return;
+	}
+
+	/* ASCII is the same in all charsets supported by the
+	   built-in converters: pass it through until the first
+	   non-ASCII byte */
+
+	for (const auto &bucket : tmp) {
+		if (!bucket.IsBuffer()) {
+			list.EnableFallback();
+			return;
+		}
+
+		const auto b = bucket.GetBuffer();
+		const std::size_t n = CountLeadingASCII(b);
+		if (n > 0)
+			list.Push(b.first(n));
+
+		if (n < b.size()) {
+			list.EnableFallback();
+			return;
+		}
+	}
+
+	if (tmp.HasMore()) {
+		list.SetMore();
+
+		if (tmp.ShouldFallback())
+			list.EnableFallback();
+	}
+}
+
+Istream::ConsumeBucketResult
+IconvIstream::_ConsumeBucketList(std::size_t nbytes) noexcept
+{
+	std::size_t total = 0;
+
+	if (const std::size_t n = std::min(nbytes, buffer.GetAvailable());
+	    n > 0) {
+		buffer.Consume(n);
+		buffer.FreeIfEmpty();
+		nbytes -= n;
+		total += n;
+	}
+
+	if (nbytes > 0 && input.IsDefined()) {
+		/* _FillBucketList() submits only ASCII input, which
+		   needs no conversion */
+		const auto r = input.ConsumeBucketList(nbytes);
+		total += r.consumed;
+
+		if (r.eof)
+			CloseInput();
+	}
+
+	return {Consumed(total), !input.IsDefined() && buffer.empty()};
+}
+
 /*
  * constructor
  *
@@ -200,11 +334,23 @@ IconvIstream::_Read() noexcept
 
 UnusedIstreamPtr
 istream_iconv_new(struct pool &pool, UnusedIstreamPtr input,
-		  const char *tocode, const char *fromcode) noexcept
+		  const char *tocode, const char *fromcode,
+		  IconvPath *path_r) noexcept
 {
+	if (const auto builtin = FindBuiltinIconv(tocode, fromcode)) {
+		if (path_r != nullptr)
+			*path_r = IconvPath::BUILTIN;
+
+		return NewIstreamPtr<IconvIstream>(pool, std::move(input),
+						   *builtin);
+	}
+
 	const iconv_t iconv = iconv_open(tocode, fromcode);
 	if (iconv == (iconv_t)-1)
 		return nullptr;
 
+	if (path_r != nullptr)
+		*path_r = IconvPath::ICONV;
+
 	return NewIstreamPtr<IconvIstream>(pool, std::move(input), iconv);
 }
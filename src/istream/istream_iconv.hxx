@@ -4,9 +4,37 @@
 
 #pragma once
 
+#include <cstdint>
+
 struct pool;
 class UnusedIstreamPtr;
 
+/**
+ * Which converter was chosen by istream_iconv_new()?
+ */
+enum class IconvPath : uint_least8_t {
+	/**
+	 * The generic libiconv converter.
+	 */
+	ICONV,
+
+	/**
+	 * A built-in converter for ISO-8859-1 or Windows-1252
+	 * from/to UTF-8; ASCII input is passed through as buckets.
+	 */
+	BUILTIN,
+};
+
+/**
+ * Convert the input from one charset to another.  The common
+ * conversions between ISO-8859-1/Windows-1252 and UTF-8 are built
+ * in; everything else is handled by libiconv.
+ *
+ * @param path_r if not nullptr, then the converter which was chosen
+ * is stored here
+ * @return nullptr if the charset pair is not supported
+ */
 UnusedIstreamPtr
 istream_iconv_new(struct pool &pool, UnusedIstreamPtr input,
-		  const char *tocode, const char *fromcode) noexcept;
+		  const char *tocode, const char *fromcode,
+		  IconvPath *path_r=nullptr) noexcept;
@@ -5,12 +5,15 @@
 #include "Control.hxx"
 #include "Instance.hxx"
 #include "Config.hxx"
+#include "prometheus/EventLoopStats.hxx"
+#include "stats/EventLoopMonitor.hxx"
 #include "pool/tpool.hxx"
 #include "pool/pool.hxx"
 #include "translation/InvalidateParser.hxx"
 #include "net/FormatAddress.hxx"
 #include "net/FailureManager.hxx"
 #include "net/FailureRef.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 #include "util/Exception.hxx"
 #include "util/SpanCast.hxx"
 #include "util/StringSplit.hxx"
@@ -24,6 +27,8 @@
 #include <systemd/sd-journal.h>
 #endif
 
+#include <stdexcept>
+
 #include <string.h>
 #include <stdlib.h>
 
@@ -247,11 +252,29 @@ try {
 	logger(3, std::current_exception());
 }
 
+/**
+ * Send the event loop statistics to the pipe passed with a STATS
+ * packet.  Without a pipe, the packet is ignored (the old STATS
+ * reply is deprecated).
+ */
+static void
+HandleStats(const EventLoopMonitor &monitor,
+	    std::span<UniqueFileDescriptor> fds)
+{
+	if (fds.empty())
+		return;
+
+	if (fds.size() != 1 || !fds.front().IsPipe())
+		throw std::runtime_error("Malformed STATS packet");
+
+	Prometheus::SendToPipe(fds.front(), "lb", monitor.GetStats());
+}
+
 void
 LbControl::OnControlPacket(BengControl::Server &control_server,
 			   BengControl::Command command,
 			   std::span<const std::byte> payload,
-			   std::span<UniqueFileDescriptor>,
+			   std::span<UniqueFileDescriptor> fds,
 			   SocketAddress address, int uid)
 {
 	using namespace BengControl;
@@ -329,9 +352,12 @@ LbControl::OnControlPacket(BengControl::Server &control_server,
 		break;
 
 	case Command::FLUSH_NFS_CACHE:
-	case Command::STATS:
 		// deprecated
 		break;
+
+	case Command::STATS:
+		HandleStats(instance.event_loop_monitor, fds);
+		break;
 	}
 }
 
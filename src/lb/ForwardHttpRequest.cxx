@@ -295,6 +295,8 @@ LbRequest::OnHttpResponse(HttpStatus status, StringMap &&_headers,
 {
 	failure->UnsetProtocol();
 
+	((LbRequestLogger *)request.logger)->EndUpstream();
+
 	if (auto &rl = *(LbRequestLogger *)request.logger; rl.generator == nullptr)
 		/* if there is a GENERATOR header, include it in the
 		   access log */
@@ -336,6 +338,8 @@ LbRequest::OnHttpError(std::exception_ptr ep) noexcept
 		failure->SetProtocol(GetEventLoop().SteadyNow(),
 				     std::chrono::seconds(20));
 
+	((LbRequestLogger *)request.logger)->EndUpstream();
+
 	connection.logger(2, ep);
 
 	auto &_connection = connection;
@@ -384,6 +388,8 @@ LbRequest::OnFilteredSocketError(std::exception_ptr ep) noexcept
 {
 	connection.logger(2, "Connect error: ", ep);
 
+	((LbRequestLogger *)request.logger)->EndUpstream();
+
 	body.Clear();
 
 	auto &_connection = connection;
@@ -441,6 +447,8 @@ LbRequest::MakeBindAddress() const noexcept
 inline void
 LbRequest::Start() noexcept
 {
+	((LbRequestLogger *)request.logger)->BeginUpstream();
+
 	cluster.ConnectHttp(pool, nullptr,
 			    MakeFairnessHash(),
 			    MakeBindAddress(),
@@ -69,6 +69,7 @@ void
 LbInstance::InitWorker()
 {
 	compress_event.Schedule(COMPRESS_INTERVAL);
+	event_loop_monitor.Enable();
 
 	for (auto &listener : listeners)
 		listener.Scan(goto_map);
@@ -9,6 +9,7 @@
 #include "MonitorManager.hxx"
 #include "access_log/Multi.hxx"
 #include "stats/HttpStats.hxx"
+#include "stats/EventLoopMonitor.hxx"
 #include "lib/avahi/ErrorHandler.hxx"
 #include "memory/SlicePool.hxx"
 #include "event/FarTimerEvent.hxx"
@@ -55,6 +56,8 @@ struct LbInstance final : PInstance, Avahi::ErrorHandler {
 
 	HttpStats http_stats;
 
+	EventLoopMonitor event_loop_monitor{event_loop};
+
 	std::forward_list<LbControl> controls;
 
 	/**
@@ -62,6 +62,7 @@ LbInstance::ShutdownCallback() noexcept
 	thread_pool_stop();
 
 	compress_event.Cancel();
+	event_loop_monitor.Disable();
 
 	DeinitAllControls();
 
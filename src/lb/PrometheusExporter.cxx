@@ -9,6 +9,7 @@
 #include "Config.hxx"
 #include "prometheus/Stats.hxx"
 #include "prometheus/HttpStats.hxx"
+#include "prometheus/EventLoopStats.hxx"
 #include "net/control/Protocol.hxx"
 #include "http/Address.hxx"
 #include "http/Headers.hxx"
@@ -125,6 +126,7 @@ WriteStats(GrowingBuffer &buffer, const LbInstance &instance) noexcept
 	constexpr auto process = "lb"sv;
 
 	Prometheus::Write(buffer, process, instance.GetStats());
+	Prometheus::Write(buffer, process, instance.event_loop_monitor.GetStats());
 
 	for (const auto &listener : instance.listeners)
 		if (const auto *stats = listener.GetHttpStats())
@@ -8,6 +8,8 @@
 #include "http/CommonHeaders.hxx"
 #include "http/IncomingRequest.hxx"
 
+#include <utility> // for std::exchange
+
 LbRequestLogger::LbRequestLogger(LbInstance &_instance,
 				 HttpStats &_http_stats,
 				 AccessLogGlue *_access_logger,
@@ -24,6 +26,31 @@ LbRequestLogger::LbRequestLogger(LbInstance &_instance,
 {
 }
 
+void
+LbRequestLogger::BeginUpstream() noexcept
+{
+	upstream_start = instance.event_loop.SteadyNow();
+}
+
+void
+LbRequestLogger::EndUpstream() noexcept
+{
+	if (upstream_start == std::chrono::steady_clock::time_point{})
+		return;
+
+	const auto d = instance.event_loop.SteadyNow() - std::exchange(upstream_start, {});
+	if (upstream_wait.count() < 0)
+		upstream_wait = d;
+	else
+		upstream_wait += d;
+}
+
+void
+LbRequestLogger::OnResponseSubmitted() noexcept
+{
+	response_time = instance.event_loop.SteadyNow();
+}
+
 void
 LbRequestLogger::LogHttpRequest(IncomingHttpRequest &request,
 				Event::Duration wait_duration,
@@ -35,13 +62,16 @@ LbRequestLogger::LogHttpRequest(IncomingHttpRequest &request,
 	const auto total_duration = GetDuration(instance.event_loop.SteadyNow());
 	assert(total_duration >= wait_duration);
 	const auto duration = total_duration - wait_duration;
+	const auto ttfb = response_time != std::chrono::steady_clock::time_point{}
+		? response_time - start_time
+		: std::chrono::steady_clock::duration{-1};
 
 	instance.http_stats.AddRequest(status,
 				       bytes_received, bytes_sent,
-				       duration);
+				       duration, ttfb, upstream_wait);
 	http_stats.AddRequest(status,
 			      bytes_received, bytes_sent,
-			      duration);
+			      duration, ttfb, upstream_wait);
 
 	if (access_logger != nullptr &&
 	    (!access_logger_only_errors || http_status_is_error(status)))
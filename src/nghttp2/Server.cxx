@@ -541,6 +541,9 @@ ServerConnection::Request::SendResponse(HttpStatus status,
 
 	the_status = status;
 
+	if (logger != nullptr)
+		logger->OnResponseSubmitted();
+
 	StaticVector<nghttp2_nv, 256> hdrs;
 
 	const fmt::format_int status_string{static_cast<unsigned>(status)};
@@ -4,6 +4,7 @@
 
 #include "CssParser.hxx"
 #include "CssSyntax.hxx"
+#include "CssScan.hxx"
 #include "util/DestructObserver.hxx"
 #include "util/StringStrip.hxx"
 
@@ -34,6 +35,12 @@ CssParser::Feed(const char *start, size_t length) noexcept
 		switch (state) {
 		case State::NONE:
 			do {
+				/* skip quickly to the next character which
+				   may be interesting */
+				buffer = FindCssSelectorSpecial(buffer, end);
+				if (buffer == end)
+					break;
+
 				switch (*buffer) {
 				case '{':
 					/* start of block */
@@ -76,52 +83,44 @@ CssParser::Feed(const char *start, size_t length) noexcept
 			break;
 
 		case State::CLASS_NAME:
-			do {
-				if (!is_css_nmchar(*buffer)) {
-					if (!name_buffer.empty()) {
-						CssParserValue name{
-							name_start,
-							position + (off_t)(buffer - start),
-							name_buffer,
-						};
+			p = FindNonCssNmchar(buffer, end);
+			name_buffer.AppendName({buffer, p});
+			buffer = p;
 
-						handler.class_name(&name,handler_ctx);
-					}
-
-					state = State::NONE;
-					break;
+			if (buffer < end) {
+				if (!name_buffer.empty()) {
+					CssParserValue name{
+						name_start,
+						position + (off_t)(buffer - start),
+						name_buffer,
+					};
+
+					handler.class_name(&name,handler_ctx);
 				}
 
-				if (name_buffer.size() < name_buffer.max_size() - 1)
-					name_buffer.push_back(*buffer);
-
-				++buffer;
-			} while (buffer < end);
+				state = State::NONE;
+			}
 
 			break;
 
 		case State::XML_ID:
-			do {
-				if (!is_css_nmchar(*buffer)) {
-					if (!name_buffer.empty()) {
-						CssParserValue name = {
-							name_start,
-							position + (off_t)(buffer - start),
-							name_buffer,
-						};
-
-						handler.xml_id(&name, handler_ctx);
-					}
+			p = FindNonCssNmchar(buffer, end);
+			name_buffer.AppendName({buffer, p});
+			buffer = p;
 
-					state = State::NONE;
-					break;
+			if (buffer < end) {
+				if (!name_buffer.empty()) {
+					CssParserValue name = {
+						name_start,
+						position + (off_t)(buffer - start),
+						name_buffer,
+					};
+
+					handler.xml_id(&name, handler_ctx);
 				}
 
-				if (name_buffer.size() < name_buffer.max_size() - 1)
-					name_buffer.push_back(*buffer);
-
-				++buffer;
-			} while (buffer < end);
+				state = State::NONE;
+			}
 
 			break;
 
@@ -175,17 +174,14 @@ CssParser::Feed(const char *start, size_t length) noexcept
 			break;
 
 		case State::PROPERTY:
-			while (buffer < end) {
-				if (!is_css_ident_char(*buffer)) {
-					state = State::POST_PROPERTY;
-					break;
-				}
+			/* is_css_ident_char() is the same as
+			   is_css_nmchar() */
+			p = FindNonCssNmchar(buffer, end);
+			name_buffer.AppendName({buffer, p});
+			buffer = p;
 
-				if (name_buffer.size() < name_buffer.max_size() - 1)
-					name_buffer.push_back(*buffer);
-
-				++buffer;
-			}
+			if (buffer < end)
+				state = State::POST_PROPERTY;
 
 			break;
 
@@ -221,11 +217,11 @@ CssParser::Feed(const char *start, size_t length) noexcept
 			if (buffer < end) {
 				switch (*buffer) {
 				case '}':
-					/* end of block */
-					if (block)
-						break;
-
-					state = State::NONE;
+					/* end of block; in block mode, it is
+					   ignored, but it must still be
+					   consumed */
+					if (!block)
+						state = State::NONE;
 					++buffer;
 					break;
 
@@ -276,8 +272,13 @@ CssParser::Feed(const char *start, size_t length) noexcept
 					break;
 
 				default:
-					if (value_buffer.size() >= value_buffer.capacity() - 1)
-						break;
+					if (value_buffer.size() >= value_buffer.capacity() - 1) {
+						/* the value buffer is full, nothing
+						   else will be recorded; skip quickly
+						   to the end of the value */
+						buffer = FindCssValueSpecial(buffer + 1, end);
+						continue;
+					}
 
 					value_buffer.push_back(*buffer);
 					if (handler.url != nullptr &&
@@ -295,11 +296,11 @@ CssParser::Feed(const char *start, size_t length) noexcept
 			if (buffer < end) {
 				switch (*buffer) {
 				case '}':
-					/* end of block */
-					if (block)
-						break;
-
-					state = State::NONE;
+					/* end of block; in block mode, it is
+					   ignored, but it must still be
+					   consumed */
+					if (!block)
+						state = State::NONE;
 					++buffer;
 					break;
 
@@ -350,20 +351,16 @@ CssParser::Feed(const char *start, size_t length) noexcept
 			break;
 
 		case State::AT:
-			do {
-				if (!is_css_nmchar(*buffer)) {
-					if ("import"sv == name_buffer)
-						state = State::PRE_IMPORT;
-					else
-						state = State::NONE;
-					break;
-				}
+			p = FindNonCssNmchar(buffer, end);
+			name_buffer.AppendName({buffer, p});
+			buffer = p;
 
-				if (name_buffer.size() < name_buffer.capacity() - 1)
-					name_buffer.push_back(*buffer);
-
-				++buffer;
-			} while (buffer < end);
+			if (buffer < end) {
+				if ("import"sv == name_buffer)
+					state = State::PRE_IMPORT;
+				else
+					state = State::NONE;
+			}
 
 			break;
 
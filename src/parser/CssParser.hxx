@@ -71,6 +71,20 @@ class CssParser final : DestructAnchor {
 			this->the_size += n;
 		}
 
+		/**
+		 * Like AppendTruncated(), but leave room for one more
+		 * character (e.g. a null terminator).
+		 */
+		void AppendName(std::string_view p) noexcept {
+			const size_t limit = capacity() - 1;
+			if (size() >= limit)
+				return;
+
+			size_t n = std::min(p.size(), limit - size());
+			std::copy_n(p.data(), n, end());
+			this->the_size += n;
+		}
+
 		constexpr operator std::string_view() const noexcept {
 			return {data(), size()};
 		}
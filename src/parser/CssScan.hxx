@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Find the end of character runs in a CSS document.  With SSE2,
+ * these functions classify 16 bytes per step; the scalar loops
+ * handle the tail and all other architectures.
+ */
+
+#pragma once
+
+#include "CssSyntax.hxx"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <bit>
+#endif
+
+/**
+ * Find the first character which is not a CSS name character (see
+ * is_css_nmchar()).
+ *
+ * @return a pointer to that character or #end if there is none
+ */
+[[gnu::pure]]
+static inline const char *
+FindNonCssNmchar(const char *p, const char *const end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i lower_a = _mm_set1_epi8('a' - 1);
+	const __m128i lower_z = _mm_set1_epi8('z' + 1);
+	const __m128i digit_0 = _mm_set1_epi8('0' - 1);
+	const __m128i digit_9 = _mm_set1_epi8('9' + 1);
+	const __m128i dash = _mm_set1_epi8('-');
+	const __m128i underscore = _mm_set1_epi8('_');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+		const __m128i lower = _mm_or_si128(v, case_bit);
+
+		/* the signed comparisons reject everything >= 0x80;
+		   these are handled by the sign bit below */
+		const __m128i alpha =
+			_mm_and_si128(_mm_cmpgt_epi8(lower, lower_a),
+				      _mm_cmplt_epi8(lower, lower_z));
+		const __m128i digit =
+			_mm_and_si128(_mm_cmpgt_epi8(v, digit_0),
+				      _mm_cmplt_epi8(v, digit_9));
+		const __m128i punct =
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, dash),
+						  _mm_cmpeq_epi8(v, underscore)),
+				     _mm_cmpeq_epi8(v, backslash));
+
+		const unsigned mask =
+			~(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit),
+							 punct)) |
+			  /* non-ASCII */
+			  _mm_movemask_epi8(v)) & 0xffff;
+		if (mask != 0)
+			return p + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && is_css_nmchar(*p))
+		++p;
+
+	return p;
+}
+
+/**
+ * Find the first character which may have a meaning outside of a
+ * block: '{', '.', '#' or '@'.
+ *
+ * @return a pointer to that character or #end if there is none
+ */
+[[gnu::pure]]
+static inline const char *
+FindCssSelectorSpecial(const char *p, const char *const end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i brace = _mm_set1_epi8('{');
+	const __m128i dot = _mm_set1_epi8('.');
+	const __m128i hash = _mm_set1_epi8('#');
+	const __m128i at = _mm_set1_epi8('@');
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		const unsigned mask =
+			_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, brace),
+								    _mm_cmpeq_epi8(v, dot)),
+						       _mm_or_si128(_mm_cmpeq_epi8(v, hash),
+								    _mm_cmpeq_epi8(v, at))));
+		if (mask != 0)
+			return p + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && *p != '{' && *p != '.' && *p != '#' && *p != '@')
+		++p;
+
+	return p;
+}
+
+/**
+ * Find the first character which ends a property value or starts a
+ * quoted string within it: '}', ';', '\'' or '"'.
+ *
+ * @return a pointer to that character or #end if there is none
+ */
+[[gnu::pure]]
+static inline const char *
+FindCssValueSpecial(const char *p, const char *const end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i brace = _mm_set1_epi8('}');
+	const __m128i semicolon = _mm_set1_epi8(';');
+	const __m128i squote = _mm_set1_epi8('\'');
+	const __m128i dquote = _mm_set1_epi8('"');
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		const unsigned mask =
+			_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, brace),
+								    _mm_cmpeq_epi8(v, semicolon)),
+						       _mm_or_si128(_mm_cmpeq_epi8(v, squote),
+								    _mm_cmpeq_epi8(v, dquote))));
+		if (mask != 0)
+			return p + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && *p != '}' && *p != ';' && *p != '\'' && *p != '"')
+		++p;
+
+	return p;
+}
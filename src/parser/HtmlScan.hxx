@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Find the end of character runs in a HTML/XML document.  With SSE2,
+ * these functions classify 16 bytes per step; the scalar loops
+ * handle the tail and all other architectures.
+ */
+
+#pragma once
+
+#include "HtmlSyntax.hxx"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <bit>
+#endif
+
+/**
+ * Find the first character which is not a HTML name character
+ * (see is_html_name_char()).
+ *
+ * @return a pointer to that character or #end if there is none
+ */
+[[gnu::pure]]
+static inline const char *
+FindNonHtmlNameChar(const char *p, const char *const end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i lower_a = _mm_set1_epi8('a' - 1);
+	const __m128i lower_z = _mm_set1_epi8('z' + 1);
+	const __m128i digit_0 = _mm_set1_epi8('0' - 1);
+	/* includes the colon which follows '9' */
+	const __m128i colon = _mm_set1_epi8(':' + 1);
+	const __m128i dash = _mm_set1_epi8('-' - 1);
+	/* includes the dot which follows '-' */
+	const __m128i dot = _mm_set1_epi8('.' + 1);
+	const __m128i underscore = _mm_set1_epi8('_');
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+
+	while (end - p >= 16) {
+		/* all name characters are ASCII; the signed
+		   comparisons reject everything >= 0x80 */
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+		const __m128i lower = _mm_or_si128(v, case_bit);
+
+		const __m128i alpha =
+			_mm_and_si128(_mm_cmpgt_epi8(lower, lower_a),
+				      _mm_cmplt_epi8(lower, lower_z));
+		const __m128i digit =
+			_mm_and_si128(_mm_cmpgt_epi8(v, digit_0),
+				      _mm_cmplt_epi8(v, colon));
+		const __m128i punct =
+			_mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(v, dash),
+						   _mm_cmplt_epi8(v, dot)),
+				     _mm_cmpeq_epi8(v, underscore));
+
+		const unsigned mask =
+			~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit),
+							punct)) & 0xffff;
+		if (mask != 0)
+			return p + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && is_html_name_char(*p))
+		++p;
+
+	return p;
+}
+
+/**
+ * Find the first whitespace/null character (see IsWhitespaceOrNull())
+ * or the first '>', i.e. the end of an unquoted attribute value.
+ *
+ * @return a pointer to that character or #end if there is none
+ */
+[[gnu::pure]]
+static inline const char *
+FindUnquotedAttributeValueEnd(const char *p, const char *const end) noexcept
+{
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i gt = _mm_set1_epi8('>');
+
+	while (end - p >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		/* unsigned "v <= 0x20" */
+		const __m128i ws = _mm_cmpeq_epi8(_mm_min_epu8(v, space), v);
+
+		const unsigned mask =
+			_mm_movemask_epi8(_mm_or_si128(ws, _mm_cmpeq_epi8(v, gt)));
+		if (mask != 0)
+			return p + std::countr_zero(mask);
+
+		p += 16;
+	}
+#endif
+
+	while (p < end && !IsWhitespaceOrNull(*p) && *p != '>')
+		++p;
+
+	return p;
+}
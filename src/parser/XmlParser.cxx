@@ -3,10 +3,12 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "XmlParser.hxx"
-#include "HtmlSyntax.hxx"
+#include "HtmlScan.hxx"
 #include "util/CharUtil.hxx"
 #include "util/Poison.hxx"
 
+#include <algorithm>
+
 #include <string.h>
 
 XmlParser::XmlParser(struct pool &pool,
@@ -16,6 +18,27 @@ XmlParser::XmlParser(struct pool &pool,
 {
 }
 
+/**
+ * Append a run of name characters (converted to lower case) to a
+ * name buffer and advance #src.
+ *
+ * @return false if the name buffer is overflowing; #src points to
+ * the first character which did not fit
+ */
+template<std::size_t size>
+static bool
+AppendLowerName(char (&dest)[size], std::size_t &length,
+		const char *&src, const char *end) noexcept
+{
+	const std::size_t n = end - src;
+	const std::size_t room = size - length;
+
+	for (const char *i = src + std::min(n, room); src != i;)
+		dest[length++] = ToLowerASCII(*src++);
+
+	return n <= room;
+}
+
 inline void
 XmlParser::InvokeAttributeFinished() noexcept
 {
@@ -97,13 +120,13 @@ XmlParser::Feed(const char *start, size_t length) noexcept
 			/* copy element name */
 			while (buffer < end) {
 				if (is_html_name_char(*buffer)) {
-					if (tag_name_length == sizeof(tag_name)) {
+					if (!AppendLowerName(tag_name, tag_name_length,
+							     buffer,
+							     FindNonHtmlNameChar(buffer, end))) {
 						/* name buffer overflowing */
 						state = State::NONE;
 						break;
 					}
-
-					tag_name[tag_name_length++] = ToLowerASCII(*buffer++);
 				} else if (*buffer == '/' && tag_name_length == 0) {
 					tag.type = XmlParserTagType::CLOSE;
 					++buffer;
@@ -194,20 +217,16 @@ XmlParser::Feed(const char *start, size_t length) noexcept
 
 		case State::ATTR_NAME:
 			/* copy attribute name */
-			do {
-				if (is_html_name_char(*buffer)) {
-					if (attr_name_length == sizeof(attr_name)) {
-						/* name buffer overflowing */
-						state = State::ELEMENT_TAG;
-						break;
-					}
+			if (!AppendLowerName(attr_name, attr_name_length,
+					     buffer,
+					     FindNonHtmlNameChar(buffer, end))) {
+				/* name buffer overflowing */
+				state = State::ELEMENT_TAG;
+				break;
+			}
 
-					attr_name[attr_name_length++] = ToLowerASCII(*buffer++);
-				} else {
-					state = State::AFTER_ATTR_NAME;
-					break;
-				}
-			} while (buffer < end);
+			if (buffer < end)
+				state = State::AFTER_ATTR_NAME;
 
 			break;
 
@@ -224,7 +243,8 @@ XmlParser::Feed(const char *start, size_t length) noexcept
 					/* there is no value (probably malformed XML) -
 					   use the current position as start and end
 					   offset because that's the best we can do */
-					attr.value_start = attr.value_end = position + (off_t)(buffer - start);
+					attr.value_start = attr.value_end = attr.end =
+						position + (off_t)(buffer - start);
 
 					InvokeAttributeFinished();
 					state = State::ELEMENT_TAG;
@@ -281,22 +301,25 @@ XmlParser::Feed(const char *start, size_t length) noexcept
 
 		case State::ATTR_VALUE_COMPAT:
 			/* wait till the value is finished */
-			do {
-				if (!IsWhitespaceOrNull(*buffer) && *buffer != '>') {
-					if (!attr_value.Write({buffer, 1})) {
-						state = State::ELEMENT_TAG;
-						break;
-					}
-
+			p = FindUnquotedAttributeValueEnd(buffer, end);
+			if (!attr_value.Write({buffer, p})) {
+				/* the value buffer is overflowing: append
+				   as much as fits */
+				while (attr_value.Write({buffer, 1}))
 					++buffer;
-				} else {
-					attr.value_end = attr.end =
-						position + (off_t)(buffer - start);
-					InvokeAttributeFinished();
-					state = State::ELEMENT_TAG;
-					break;
-				}
-			} while (buffer < end);
+
+				state = State::ELEMENT_TAG;
+				break;
+			}
+
+			buffer = p;
+
+			if (buffer < end) {
+				attr.value_end = attr.end =
+					position + (off_t)(buffer - start);
+				InvokeAttributeFinished();
+				state = State::ELEMENT_TAG;
+			}
 
 			break;
 
@@ -376,7 +399,6 @@ XmlParser::Feed(const char *start, size_t length) noexcept
 		case State::CDATA_SECTION:
 			/* copy CDATA section contents */
 
-			/* XXX this loop can be optimized with memchr() */
 			p = buffer;
 			while (buffer < end) {
 				if (*buffer == ']' && cdend_match < 2) {
@@ -425,7 +447,10 @@ XmlParser::Feed(const char *start, size_t length) noexcept
 						p = buffer;
 					}
 
-					++buffer;
+					/* skip to the next ']' */
+					const char *bracket = (const char *)
+						memchr(buffer + 1, ']', end - buffer - 1);
+					buffer = bracket != nullptr ? bracket : end;
 				}
 			}
 
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "EventLoopStats.hxx"
+#include "LatencyHistogram.hxx"
+#include "stats/EventLoopStats.hxx"
+#include "memory/GrowingBuffer.hxx"
+#include "io/FileDescriptor.hxx"
+#include "system/Error.hxx"
+#include "lib/fmt/ToBuffer.hxx"
+
+namespace Prometheus {
+
+static constexpr double
+ToSeconds(std::chrono::steady_clock::duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+void
+Write(GrowingBuffer &buffer, std::string_view process,
+      const EventLoopStats &stats) noexcept
+{
+	buffer.Fmt(R"(
+# HELP beng_proxy_event_loop_lag Delay of the event loop in seconds
+# TYPE beng_proxy_event_loop_lag histogram
+
+# HELP beng_proxy_event_loop_max_lag Largest delay of the event loop in seconds
+# TYPE beng_proxy_event_loop_max_lag gauge
+
+# HELP beng_proxy_event_loop_stalls Number of event loop stalls
+# TYPE beng_proxy_event_loop_stalls counter
+
+# HELP beng_proxy_event_loop_cpu CPU time consumed by the event loop thread in seconds
+# TYPE beng_proxy_event_loop_cpu counter
+
+beng_proxy_event_loop_max_lag{{process={:?}}} {:e}
+beng_proxy_event_loop_stalls{{process={:?}}} {}
+beng_proxy_event_loop_cpu{{process={:?},mode="user"}} {:e}
+beng_proxy_event_loop_cpu{{process={:?},mode="system"}} {:e}
+)",
+		   process, ToSeconds(stats.max_lag),
+		   process, stats.n_stalls,
+		   process, ToSeconds(stats.cpu_user),
+		   process, ToSeconds(stats.cpu_system));
+
+	const auto labels = FmtBuffer<64>("process={:?},", process);
+	Write(buffer, "beng_proxy_event_loop_lag", labels.c_str(), stats.lag);
+
+	buffer.Write(R"(
+# HELP beng_proxy_event_loop_callbacks Number of profiled event loop callbacks
+# TYPE beng_proxy_event_loop_callbacks counter
+
+# HELP beng_proxy_event_loop_callback_seconds Time spent in profiled event loop callbacks
+# TYPE beng_proxy_event_loop_callback_seconds counter
+
+# HELP beng_proxy_event_loop_callback_max_seconds Longest profiled event loop callback
+# TYPE beng_proxy_event_loop_callback_max_seconds gauge
+
+)");
+
+	for (std::size_t i = 0; i < stats.types.size(); ++i) {
+		const std::string_view type = ToString(EventLoopCallbackType(i));
+		const auto &t = stats.types[i];
+
+		buffer.Fmt(R"(beng_proxy_event_loop_callbacks{{process={:?},type={:?}}} {}
+beng_proxy_event_loop_callback_seconds{{process={:?},type={:?}}} {:e}
+beng_proxy_event_loop_callback_max_seconds{{process={:?},type={:?}}} {:e}
+)",
+			   process, type, t.n_calls,
+			   process, type, ToSeconds(t.total),
+			   process, type, ToSeconds(t.max));
+	}
+
+	buffer.Write(R"(
+# HELP beng_proxy_event_loop_site_seconds Time spent in the most expensive event loop callbacks
+# TYPE beng_proxy_event_loop_site_seconds counter
+
+# HELP beng_proxy_event_loop_site_max_seconds Longest invocation of the most expensive event loop callbacks
+# TYPE beng_proxy_event_loop_site_max_seconds gauge
+
+)");
+
+	for (const auto &i : stats.top_sites) {
+		const std::string_view type = ToString(i.type), site = i.name;
+
+		buffer.Fmt(R"(beng_proxy_event_loop_site_seconds{{process={:?},site={:?},type={:?}}} {:e}
+beng_proxy_event_loop_site_max_seconds{{process={:?},site={:?},type={:?}}} {:e}
+)",
+			   process, site, type, ToSeconds(i.stats.total),
+			   process, site, type, ToSeconds(i.stats.max));
+	}
+}
+
+void
+SendToPipe(FileDescriptor pipe, std::string_view process,
+	   const EventLoopStats &stats)
+{
+	GrowingBuffer buffer;
+	Write(buffer, process, stats);
+
+	GrowingBufferReader reader{std::move(buffer)};
+	for (auto r = reader.Read(); !r.empty(); r = reader.Read()) {
+		const auto nbytes = pipe.Write(r);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to write to pipe");
+
+		reader.Consume(nbytes);
+	}
+}
+
+} // namespace Prometheus
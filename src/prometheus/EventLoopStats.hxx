@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <string_view>
+
+class GrowingBuffer;
+class FileDescriptor;
+struct EventLoopStats;
+
+namespace Prometheus {
+
+void
+Write(GrowingBuffer &buffer, std::string_view process,
+      const EventLoopStats &stats) noexcept;
+
+/**
+ * Write the #EventLoopStats (in the same text format) to the pipe
+ * passed with the control command STATS.
+ *
+ * Throws on error.
+ */
+void
+SendToPipe(FileDescriptor pipe, std::string_view process,
+	   const EventLoopStats &stats);
+
+} // namespace Prometheus
@@ -3,6 +3,7 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "HttpStats.hxx"
+#include "LatencyHistogram.hxx"
 #include "stats/HttpStats.hxx"
 #include "stats/TaggedHttpStats.hxx"
 #include "stats/PerGeneratorStats.hxx"
@@ -47,6 +48,15 @@ Write(GrowingBuffer &buffer, std::string_view labels,
 # HELP beng_proxy_http_traffic Number of bytes transferred
 # TYPE beng_proxy_http_traffic counter
 
+# HELP beng_proxy_http_duration Duration of HTTP requests in seconds
+# TYPE beng_proxy_http_duration histogram
+
+# HELP beng_proxy_http_ttfb Duration until the HTTP response headers were submitted in seconds
+# TYPE beng_proxy_http_ttfb histogram
+
+# HELP beng_proxy_http_upstream_wait Duration waiting for upstream servers in seconds
+# TYPE beng_proxy_http_upstream_wait histogram
+
 beng_proxy_http_requests_delayed{{{}}} {}
 beng_proxy_http_invalid_frames{{{}}} {}
 beng_proxy_http_total_duration{{{}}} {:e}
@@ -60,6 +70,9 @@ beng_proxy_http_traffic{{{}direction="out"}} {}
 	       labels, stats.traffic_sent);
 
 	Write(buffer, "beng_proxy_http_requests"sv, labels, stats.n_per_status);
+	Write(buffer, "beng_proxy_http_duration"sv, labels, stats.duration_histogram);
+	Write(buffer, "beng_proxy_http_ttfb"sv, labels, stats.ttfb_histogram);
+	Write(buffer, "beng_proxy_http_upstream_wait"sv, labels, stats.upstream_histogram);
 }
 
 void
@@ -94,6 +107,8 @@ Write(GrowingBuffer &buffer, std::string_view process,
 
 	Write(buffer, "beng_proxy_http_requests_per_generator"sv,
 	      labels.c_str(), stats.n_per_status);
+	Write(buffer, "beng_proxy_http_duration_per_generator"sv,
+	      labels.c_str(), stats.duration_histogram);
 }
 
 void
@@ -104,6 +119,9 @@ Write(GrowingBuffer &buffer, std::string_view process,
 	buffer.Write(R"(
 # HELP beng_proxy_http_requests_per_generator Number of HTTP requests per GENERATOR
 # TYPE beng_proxy_http_requests_per_generator counter
+
+# HELP beng_proxy_http_duration_per_generator Duration of HTTP requests per GENERATOR in seconds
+# TYPE beng_proxy_http_duration_per_generator histogram
 )"sv);
 
 	for (const auto &[generator, stats] : per_generator.per_generator)
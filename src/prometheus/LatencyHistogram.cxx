@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "LatencyHistogram.hxx"
+#include "stats/LatencyHistogram.hxx"
+#include "memory/GrowingBuffer.hxx"
+
+namespace Prometheus {
+
+static constexpr double
+ToSeconds(std::chrono::steady_clock::duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+void
+Write(GrowingBuffer &buffer,
+      std::string_view name, std::string_view labels,
+      const LatencyHistogram &histogram) noexcept
+{
+	uint_least64_t cumulative = 0;
+	for (std::size_t i = 0; i < LatencyHistogram::upper_bounds.size(); ++i) {
+		cumulative += histogram.buckets[i];
+		buffer.Fmt("{}_bucket{{{}le=\"{}\"}} {}\n",
+			   name, labels,
+			   ToSeconds(LatencyHistogram::upper_bounds[i]),
+			   cumulative);
+	}
+
+	buffer.Fmt("{}_bucket{{{}le=\"+Inf\"}} {}\n"
+		   "{}_sum{{{}}} {:e}\n"
+		   "{}_count{{{}}} {}\n",
+		   name, labels, histogram.count,
+		   name, labels, ToSeconds(histogram.sum),
+		   name, labels, histogram.count);
+}
+
+} // namespace Prometheus
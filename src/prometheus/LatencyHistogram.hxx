@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <string_view>
+
+class GrowingBuffer;
+struct LatencyHistogram;
+
+namespace Prometheus {
+
+/**
+ * Write the "_bucket", "_sum" and "_count" samples of a
+ * histogram.  The "HELP" and "TYPE" lines must be written by the
+ * caller.
+ *
+ * @param labels a comma-separated list of labels with a trailing
+ * comma (or empty)
+ */
+void
+Write(GrowingBuffer &buffer,
+      std::string_view name, std::string_view labels,
+      const LatencyHistogram &histogram) noexcept;
+
+} // namespace Prometheus
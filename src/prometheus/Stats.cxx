@@ -42,6 +42,27 @@ beng_proxy_cache_hits{{process={:?},type={:?}}} {}
 		   process, type, stats.hits);
 }
 
+static void
+Write(GrowingBuffer &buffer,
+      std::string_view process, std::string_view type,
+      const ChildStockStats &stats) noexcept
+{
+	buffer.Fmt(R"(
+beng_proxy_child_acquisitions{{process={:?},type={:?},state="warm"}} {}
+beng_proxy_child_acquisitions{{process={:?},type={:?},state="cold"}} {}
+beng_proxy_child_prespawns{{process={:?},type={:?}}} {}
+beng_proxy_child_concurrency_limit{{process={:?},type={:?}}} {}
+beng_proxy_child_concurrency_changes{{process={:?},type={:?},direction="up"}} {}
+beng_proxy_child_concurrency_changes{{process={:?},type={:?},direction="down"}} {}
+)",
+		   process, type, stats.warm_acquisitions,
+		   process, type, stats.cold_acquisitions,
+		   process, type, stats.prespawns,
+		   process, type, stats.concurrency_limit,
+		   process, type, stats.concurrency_increases,
+		   process, type, stats.concurrency_decreases);
+}
+
 void
 Write(GrowingBuffer &buffer, std::string_view process,
       const Stats &stats) noexcept
@@ -69,6 +90,18 @@ Write(GrowingBuffer &buffer, std::string_view process,
 # HELP beng_proxy_cache_hits Number of cache hits
 # TYPE beng_proxy_cache_hits counter
 
+# HELP beng_proxy_child_acquisitions Number of requests served by an already running (warm) or a newly spawned (cold) child process
+# TYPE beng_proxy_child_acquisitions counter
+
+# HELP beng_proxy_child_prespawns Number of child processes spawned in advance
+# TYPE beng_proxy_child_prespawns counter
+
+# HELP beng_proxy_child_concurrency_limit Sum of the adaptive per-process concurrency limits
+# TYPE beng_proxy_child_concurrency_limit gauge
+
+# HELP beng_proxy_child_concurrency_changes Number of times an adaptive concurrency limit was raised or lowered
+# TYPE beng_proxy_child_concurrency_changes counter
+
 # HELP beng_proxy_buffer_size Size of buffers in bytes
 # TYPE beng_proxy_buffer_size gauge
 
@@ -84,6 +117,12 @@ beng_proxy_sessions{{process={:?}}} {}
 	Write(buffer, process, "http"sv, stats.http_cache);
 	Write(buffer, process, "filter"sv, stats.filter_cache);
 	Write(buffer, process, "encoding"sv, stats.encoding_cache);
+	Write(buffer, process, "xml_template"sv, stats.xml_template_cache);
+	Write(buffer, process, "widget_class"sv, stats.widget_class_cache);
+	Write(buffer, process, "widget_fragment"sv, stats.widget_fragment_cache);
+	Write(buffer, process, "lhttp"sv, stats.lhttp_stock);
+	Write(buffer, process, "fcgi"sv, stats.fcgi_stock);
+	Write(buffer, process, "was"sv, stats.was_stock);
 	Write(buffer, "beng_proxy_buffer_size"sv, process, "io"sv, stats.io_buffers);
 }
 
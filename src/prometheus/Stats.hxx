@@ -5,6 +5,7 @@
 #pragma once
 
 #include "stats/CacheStats.hxx"
+#include "stats/ChildStockStats.hxx"
 #include "memory/AllocatorStats.hxx"
 
 #include <cstdint>
@@ -45,6 +46,12 @@ struct Stats {
 
 	CacheStats translation_cache, http_cache, filter_cache, encoding_cache;
 
+	CacheStats xml_template_cache;
+
+	CacheStats widget_class_cache, widget_fragment_cache;
+
+	ChildStockStats lhttp_stock, fcgi_stock, was_stock;
+
 	AllocatorStats io_buffers;
 };
 
@@ -7,10 +7,11 @@
 #include "http/CommonHeaders.hxx"
 #include "http/List.hxx"
 #include "AllocatorPtr.hxx"
+#include "util/StringCompare.hxx"
 
 const char *
 resource_tag_append_etag(AllocatorPtr alloc, const char *tag,
-			 const StringMap &headers)
+			 const StringMap &headers, bool strong)
 {
 	const char *etag, *p;
 
@@ -21,6 +22,11 @@ resource_tag_append_etag(AllocatorPtr alloc, const char *tag,
 	if (etag == NULL)
 		return NULL;
 
+	if (strong && StringStartsWith(etag, "W/"))
+		/* a weak ETag does not guarantee byte-identical
+		   contents */
+		return NULL;
+
 	p = headers.Get(cache_control_header);
 	if (p != NULL && http_list_contains(p, "no-store"))
 		/* generating a resource tag for the cache is pointless,
@@ -10,9 +10,13 @@ class StringMap;
 
 /**
  * A tag which addresses a resource in the filter cache.
+ *
+ * @param strong if true, then weak ETags ("W/...") are not accepted
+ * (i.e. nullptr is returned); use this if the cached data depends
+ * on the exact bytes of the resource
  */
 const char *
 resource_tag_append_etag(AllocatorPtr alloc, const char *tag,
-			 const StringMap &headers);
+			 const StringMap &headers, bool strong=false);
 
 #endif
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+/**
+ * Estimates the request rate for one child process key (an
+ * exponentially weighted moving average) and derives the number of
+ * child processes which shall be kept warm.
+ */
+class ChildDemand {
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * The time constant of the moving average [seconds].
+	 */
+	static constexpr double tau = 600;
+
+	/**
+	 * Below this rate [requests per second], no child process is
+	 * kept warm.  With #tau, a single request keeps one child
+	 * process warm for about 18 minutes.
+	 */
+	static constexpr double min_rate = 1.0 / 3600;
+
+	/**
+	 * The assumed time it takes to start a child process
+	 * [seconds].  Enough child processes are kept warm to absorb
+	 * the requests which arrive during one startup.
+	 */
+	static constexpr double startup_time = 1;
+
+	/**
+	 * The rate [requests per second] as of #last.
+	 */
+	double rate = 0;
+
+	Clock::time_point last;
+
+public:
+	void AddRequest(Clock::time_point now) noexcept {
+		rate = GetRate(now) + 1.0 / tau;
+		last = now;
+	}
+
+	[[gnu::pure]]
+	double GetRate(Clock::time_point now) const noexcept {
+		if (rate <= 0)
+			return 0;
+
+		const double dt = std::chrono::duration<double>(now - last).count();
+		return rate * std::exp(-dt / tau);
+	}
+
+	/**
+	 * @param concurrency the number of concurrent requests one
+	 * child process can handle
+	 * @param max_warm the upper limit
+	 * @return the number of child processes to be kept warm; 0
+	 * if this key has been unused for too long
+	 */
+	[[gnu::pure]]
+	unsigned GetWarmTarget(Clock::time_point now, unsigned concurrency,
+			       unsigned max_warm) const noexcept {
+		const double r = GetRate(now);
+		if (r < min_rate || max_warm == 0)
+			return 0;
+
+		const double n = std::ceil(r * startup_time / std::max(concurrency, 1U));
+		return n < max_warm
+			? std::max(static_cast<unsigned>(n), 1U)
+			: max_warm;
+	}
+};
@@ -74,6 +74,7 @@ private:
 
 	void Cancel() noexcept override {
 		cancel_ptr.Cancel();
+		stock.OnSpawnFinished(create.GetStockName());
 		delete this;
 	}
 };
@@ -96,6 +97,7 @@ try {
 
 	item.release()->RegisterCompletionHandler(handler, caller_cancel_ptr);
 } catch (...) {
+	OnSpawnFinished(c.GetStockName());
 	c.InvokeCreateError(handler, std::current_exception());
 }
 
@@ -109,6 +111,9 @@ ChildStock::Create(CreateStockItem c, StockRequest request,
 		   StockGetHandler &handler,
 		   CancellablePointer &cancel_ptr)
 {
+	++n_spawns;
+	++keys[c.GetStockName()].n_starting;
+
 	auto *queue_item = new QueueItem(*this, std::move(c),
 					 cls.PreserveRequest(std::move(request)),
 					 handler, cancel_ptr);
@@ -161,3 +166,47 @@ ChildStock::DiscardOldestIdle() noexcept
 
 	return true;
 }
+
+ChildStock::KeyState
+ChildStock::GetKeyState(std::string_view key) const noexcept
+{
+	if (auto i = keys.find(key); i != keys.end())
+		return i->second;
+
+	return {};
+}
+
+inline void
+ChildStock::ReleaseKeyState(std::map<std::string, KeyState, std::less<>>::iterator i) noexcept
+{
+	if (i->second.n_children == 0 && i->second.n_starting == 0)
+		keys.erase(i);
+}
+
+void
+ChildStock::AddChild(const char *key) noexcept
+{
+	++keys[key].n_children;
+}
+
+void
+ChildStock::RemoveChild(const char *key) noexcept
+{
+	auto i = keys.find(key);
+	assert(i != keys.end());
+	assert(i->second.n_children > 0);
+
+	--i->second.n_children;
+	ReleaseKeyState(i);
+}
+
+void
+ChildStock::OnSpawnFinished(const char *key) noexcept
+{
+	auto i = keys.find(key);
+	assert(i != keys.end());
+	assert(i->second.n_starting > 0);
+
+	--i->second.n_starting;
+	ReleaseKeyState(i);
+}
@@ -9,7 +9,10 @@
 #include "access_log/ChildErrorLogOptions.hxx"
 #include "util/IntrusiveList.hxx"
 
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <string>
 #include <string_view>
 
 namespace Net::Log { class Sink; }
@@ -94,6 +97,38 @@ class ChildStock final : public StockClass {
 	 */
 	IntrusiveList<ChildStockItem> idle;
 
+	/**
+	 * The number of Create() calls, i.e. the number of child
+	 * processes spawned so far.
+	 */
+	uint_least64_t n_spawns = 0;
+
+public:
+	/**
+	 * The number of child processes of one key.
+	 */
+	struct KeyState {
+		/**
+		 * The number of child processes which exist (including
+		 * those which are still starting).
+		 */
+		std::size_t n_children = 0;
+
+		/**
+		 * The number of Create() calls which have not yet
+		 * completed, i.e. the number of #StockGetHandler
+		 * instances waiting for a child process to start.
+		 */
+		std::size_t n_starting = 0;
+	};
+
+private:
+	/**
+	 * Only keys with at least one child process or pending spawn
+	 * are in this map.
+	 */
+	std::map<std::string, KeyState, std::less<>> keys;
+
 public:
 	ChildStock(SpawnService &_spawn_service,
 		   ListenStreamStock *_listen_stream_stock,
@@ -122,6 +157,25 @@ public:
 		return log_options;
 	}
 
+	uint_least64_t GetSpawnCount() const noexcept {
+		return n_spawns;
+	}
+
+	[[gnu::pure]]
+	KeyState GetKeyState(std::string_view key) const noexcept;
+
+	/**
+	 * For internal use only.
+	 */
+	void AddChild(const char *key) noexcept;
+	void RemoveChild(const char *key) noexcept;
+
+	/**
+	 * For internal use only.  Called when a Create() call has
+	 * completed (successfully or not) or has been canceled.
+	 */
+	void OnSpawnFinished(const char *key) noexcept;
+
 	/**
 	 * For internal use only.
 	 */
@@ -135,6 +189,8 @@ public:
 	bool DiscardOldestIdle() noexcept;
 
 private:
+	void ReleaseKeyState(std::map<std::string, KeyState, std::less<>>::iterator i) noexcept;
+
 	void DoSpawn(CreateStockItem c, StockRequest request,
 		     StockGetHandler &handler,
 		     CancellablePointer &caller_cancel_ptr) noexcept;
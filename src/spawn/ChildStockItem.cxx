@@ -27,9 +27,15 @@ ChildStockItem::ChildStockItem(CreateStockItem c,
 			       std::string_view _tag) noexcept
 	:StockItem(c),
 	 child_stock(_child_stock),
-	 tag(_tag) {}
+	 tag(_tag)
+{
+	child_stock.AddChild(GetStockName());
+}
 
-ChildStockItem::~ChildStockItem() noexcept = default;
+ChildStockItem::~ChildStockItem() noexcept
+{
+	child_stock.RemoveChild(GetStockName());
+}
 
 void
 ChildStockItem::Prepare(ChildStockClass &cls, const void *info,
@@ -151,6 +157,8 @@ ChildStockItem::OnSpawnSuccess() noexcept
 {
 	assert(state == State::CREATE);
 
+	child_stock.OnSpawnFinished(GetStockName());
+
 	if (!handle || IsFading()) {
 		/* meanwhile, OnChildProcessExit() or Disconnected()
                    has been called; we can't use this process */
@@ -168,6 +176,8 @@ ChildStockItem::OnSpawnError(std::exception_ptr error) noexcept
 {
 	assert(state == State::CREATE);
 
+	child_stock.OnSpawnFinished(GetStockName());
+
 	InvokeCreateError(*handler, std::move(error));
 }
 
@@ -178,6 +188,8 @@ ChildStockItem::Cancel() noexcept
 	assert(state == State::CREATE);
 	assert(handle);
 
+	child_stock.OnSpawnFinished(GetStockName());
+
 	delete this;
 }
 
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Prespawn.hxx"
+#include "ChildStock.hxx"
+#include "stock/MultiStock.hxx"
+#include "stock/GetHandler.hxx"
+#include "stock/Item.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DisposablePointer.hxx"
+
+#include <algorithm>
+#include <list>
+
+#include <assert.h>
+
+/**
+ * Obtains a number of leases from the #MultiStock at the same time,
+ * which forces it to spawn enough child processes, and releases
+ * them as soon as they are ready.
+ */
+class ChildStockPrespawner::WarmUp final {
+	class Lease final : StockGetHandler {
+		WarmUp &warm_up;
+
+		StockItem *item = nullptr;
+
+		CancellablePointer cancel_ptr;
+
+	public:
+		explicit Lease(WarmUp &_warm_up) noexcept
+			:warm_up(_warm_up) {}
+
+		~Lease() noexcept {
+			if (cancel_ptr)
+				cancel_ptr.Cancel();
+			else
+				Release();
+		}
+
+		void Start(MultiStock &stock, const char *name,
+			   StockRequest &&request, unsigned concurrency) noexcept {
+			stock.Get(name, std::move(request), concurrency,
+				  *this, cancel_ptr);
+		}
+
+		void Release() noexcept {
+			if (item != nullptr)
+				std::exchange(item, nullptr)->Put(PutAction::REUSE);
+		}
+
+	private:
+		/* virtual methods from class StockGetHandler */
+		void OnStockItemReady(StockItem &_item) noexcept override {
+			cancel_ptr = nullptr;
+			item = &_item;
+			warm_up.OnLeaseFinished(*this);
+		}
+
+		void OnStockItemError(std::exception_ptr) noexcept override {
+			cancel_ptr = nullptr;
+			warm_up.OnLeaseFinished(*this);
+		}
+	};
+
+	std::list<Lease> leases;
+
+	std::size_t n_pending = 0;
+
+	/**
+	 * Are we still inside Start()?  During that, finished leases
+	 * are not released, or else the next MultiStock::Get() call
+	 * would reuse the same child process.
+	 */
+	bool starting = true;
+
+public:
+	/**
+	 * @param n the number of leases to obtain
+	 */
+	void Start(MultiStock &stock, const char *name, const Key &key,
+		   unsigned n) noexcept {
+		for (unsigned i = 0; i < n; ++i) {
+			++n_pending;
+			leases.emplace_back(*this).Start(stock, name,
+							 key.make_request(key.request.get()),
+							 key.concurrency);
+		}
+
+		starting = false;
+
+		/* release the leases which have been ready right
+		   away, i.e. the child processes which were idle
+		   already */
+		for (auto &i : leases)
+			i.Release();
+	}
+
+	bool IsFinished() const noexcept {
+		return n_pending == 0;
+	}
+
+private:
+	void OnLeaseFinished(Lease &lease) noexcept {
+		assert(n_pending > 0);
+		--n_pending;
+
+		if (!starting)
+			lease.Release();
+	}
+};
+
+ChildStockPrespawner::Key::Key(StockRequest &&_request,
+			       MakeRequest _make_request,
+			       unsigned _concurrency) noexcept
+	:request(std::move(_request)), make_request(_make_request),
+	 concurrency(_concurrency) {}
+
+ChildStockPrespawner::Key::~Key() noexcept = default;
+
+ChildStockPrespawner::ChildStockPrespawner(MultiStock &_stock,
+					   const MultiStockClass &_mcls,
+					   std::size_t _limit,
+					   ChildStock &_child_stock,
+					   ChildStockClass &_cls,
+					   unsigned _max_warm) noexcept
+	:stock(_stock), mcls(_mcls), limit(_limit),
+	 child_stock(_child_stock), cls(_cls),
+	 max_warm(_max_warm),
+	 timer(stock.GetEventLoop(), BIND_THIS_METHOD(OnTimer)) {}
+
+ChildStockPrespawner::~ChildStockPrespawner() noexcept = default;
+
+void
+ChildStockPrespawner::OnRequest(const char *name, const void *request,
+				unsigned concurrency,
+				MakeRequest make_request) noexcept
+{
+	++n_requests;
+
+	if (max_warm == 0)
+		return;
+
+	auto i = keys.find(name);
+	if (i == keys.end())
+		i = keys.try_emplace(name,
+				     cls.PreserveRequest(make_request(request)),
+				     make_request, concurrency).first;
+
+	i->second.demand.AddRequest(stock.GetEventLoop().SteadyNow());
+
+	if (!timer.IsPending())
+		timer.Schedule(interval);
+}
+
+unsigned
+ChildStockPrespawner::GetWarmUpTarget(const std::string &name,
+				      const Key &key,
+				      unsigned target) const noexcept
+{
+	const auto state = child_stock.GetKeyState(name);
+	if (state.n_starting > 0)
+		/* a real request is waiting for a child process;
+		   the MultiStock queues the warm-up leases behind
+		   it, which would only delay the next waiter */
+		return 0;
+
+	const std::size_t key_limit = mcls.GetLimit(key.request.get(), limit);
+	if (key_limit > 0) {
+		if (state.n_children >= key_limit)
+			/* no room for more child processes; obtaining
+			   leases would make us compete with real
+			   requests */
+			return 0;
+
+		target = std::min<std::size_t>(target, key_limit);
+	}
+
+	return target;
+}
+
+void
+ChildStockPrespawner::StartWarmUp(const std::string &name, Key &key,
+				  unsigned target) noexcept
+{
+	key.warm_up = std::make_unique<WarmUp>();
+
+	/* all spawns during WarmUp::Start() are caused by this
+	   prespawner, all others by real requests */
+	const auto n_spawns = child_stock.GetSpawnCount();
+
+	key.warm_up->Start(stock, name.c_str(), key,
+			   target * std::max(key.concurrency, 1U));
+
+	stats.prespawns += child_stock.GetSpawnCount() - n_spawns;
+
+	if (key.warm_up->IsFinished())
+		key.warm_up.reset();
+}
+
+void
+ChildStockPrespawner::Refresh() noexcept
+{
+	const auto now = stock.GetEventLoop().SteadyNow();
+
+	for (auto i = keys.begin(); i != keys.end();) {
+		auto &key = i->second;
+
+		if (key.warm_up) {
+			if (!key.warm_up->IsFinished()) {
+				/* the previous attempt is still
+				   waiting for a child process; try
+				   again next time */
+				++i;
+				continue;
+			}
+
+			key.warm_up.reset();
+		}
+
+		unsigned target = key.demand.GetWarmTarget(now, key.concurrency,
+							   max_warm);
+		if (target == 0) {
+			/* this key has been unused for too long;
+			   let the MultiStock clear its idle child
+			   processes */
+			i = keys.erase(i);
+			continue;
+		}
+
+		target = GetWarmUpTarget(i->first, key, target);
+		if (target > 0)
+			StartWarmUp(i->first, key, target);
+		++i;
+	}
+}
+
+inline void
+ChildStockPrespawner::OnTimer() noexcept
+{
+	Refresh();
+
+	if (!keys.empty())
+		timer.Schedule(interval);
+}
+
+ChildStockStats
+ChildStockPrespawner::GetStats() const noexcept
+{
+	ChildStockStats result = stats;
+
+	/* each spawn which was not caused by the prespawner made a
+	   request wait */
+	const uint_least64_t n_spawns = child_stock.GetSpawnCount();
+	result.cold_acquisitions = n_spawns > stats.prespawns
+		? std::min(n_spawns - stats.prespawns, n_requests)
+		: 0;
+	result.warm_acquisitions = n_requests - result.cold_acquisitions;
+	return result;
+}
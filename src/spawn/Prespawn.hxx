@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ChildDemand.hxx"
+#include "stats/ChildStockStats.hxx"
+#include "stock/Request.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "util/DisposablePointer.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+class MultiStock;
+class MultiStockClass;
+class ChildStock;
+class ChildStockClass;
+
+/**
+ * Keeps child processes of a #MultiStock warm, so the first requests
+ * after a period of low traffic (or during a traffic ramp) don't
+ * have to wait for the child process to start.
+ *
+ * The request rate of each key is tracked by #ChildDemand.  A timer
+ * periodically (more often than the #MultiStock clears idle items)
+ * obtains and immediately releases as many leases as are needed to
+ * make the #MultiStock spawn the desired number of child processes;
+ * this also refreshes their idle timers.
+ *
+ * Keys whose child processes are all needed by real requests are
+ * left alone: if the #MultiStock has reached its limit or if a
+ * request is waiting for a child process to start, the leases of a
+ * warm-up would only queue up behind (and compete with) the waiting
+ * requests.
+ */
+class ChildStockPrespawner final {
+	static constexpr Event::Duration interval = std::chrono::minutes(1);
+
+	MultiStock &stock;
+
+	/**
+	 * The class of #stock; used to obtain the per-key limit.
+	 */
+	const MultiStockClass &mcls;
+
+	/**
+	 * The global limit passed to MultiStockClass::GetLimit().
+	 */
+	const std::size_t limit;
+
+	ChildStock &child_stock;
+
+	ChildStockClass &cls;
+
+	/**
+	 * The maximum number of warm child processes per key; 0
+	 * disables this class.
+	 */
+	const unsigned max_warm;
+
+	CoarseTimerEvent timer;
+
+	class WarmUp;
+
+	/**
+	 * Creates a non-owning #StockRequest pointing to the given
+	 * object.
+	 */
+	using MakeRequest = StockRequest (*)(const void *request) noexcept;
+
+	struct Key {
+		/**
+		 * A copy of the first request for this key, created
+		 * by ChildStockClass::PreserveRequest().
+		 */
+		StockRequest request;
+
+		const MakeRequest make_request;
+
+		ChildDemand demand;
+
+		std::unique_ptr<WarmUp> warm_up;
+
+		unsigned concurrency;
+
+		Key(StockRequest &&_request, MakeRequest _make_request,
+		    unsigned _concurrency) noexcept;
+		~Key() noexcept;
+
+		Key(Key &&) = delete;
+		Key &operator=(Key &&) = delete;
+	};
+
+	std::map<std::string, Key, std::less<>> keys;
+
+	/**
+	 * The number of requests passed to OnRequest().
+	 */
+	uint_least64_t n_requests = 0;
+
+	ChildStockStats stats{};
+
+public:
+	/**
+	 * @param _limit the limit which was passed to the #MultiStock
+	 */
+	ChildStockPrespawner(MultiStock &_stock,
+			     const MultiStockClass &_mcls, std::size_t _limit,
+			     ChildStock &_child_stock,
+			     ChildStockClass &_cls,
+			     unsigned _max_warm) noexcept;
+	~ChildStockPrespawner() noexcept;
+
+	ChildStockPrespawner(const ChildStockPrespawner &) = delete;
+	ChildStockPrespawner &operator=(const ChildStockPrespawner &) = delete;
+
+	/**
+	 * Notify this object about a request which is about to be
+	 * passed to MultiStock::Get().
+	 */
+	template<typename T>
+	void OnRequest(const char *key, const T &request,
+		       unsigned concurrency) noexcept {
+		OnRequest(key, &request, concurrency,
+			  [](const void *p) noexcept -> StockRequest {
+				  return ToNopPointer(const_cast<T *>(static_cast<const T *>(p)));
+			  });
+	}
+
+	/**
+	 * Check all keys and start warm-ups where needed.  This is
+	 * called periodically by a timer.
+	 */
+	void Refresh() noexcept;
+
+	[[gnu::pure]]
+	ChildStockStats GetStats() const noexcept;
+
+private:
+	void OnRequest(const char *key, const void *request,
+		       unsigned concurrency,
+		       MakeRequest make_request) noexcept;
+
+	/**
+	 * Determine how many child processes of this key may be kept
+	 * warm right now, i.e. the target clipped to the limit.
+	 *
+	 * @return 0 if the key is busy (waiting requests or limit
+	 * reached)
+	 */
+	[[gnu::pure]]
+	unsigned GetWarmUpTarget(const std::string &name, const Key &key,
+				 unsigned target) const noexcept;
+
+	void StartWarmUp(const std::string &name, Key &key,
+			 unsigned target) noexcept;
+
+	void OnTimer() noexcept;
+};
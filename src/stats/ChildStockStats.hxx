@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <cstdint>
+
+struct ChildStockStats {
+	/**
+	 * The number of requests which were served by a child
+	 * process which was already running.
+	 */
+	uint_least64_t warm_acquisitions;
+
+	/**
+	 * The number of requests which had to wait for a new child
+	 * process.
+	 */
+	uint_least64_t cold_acquisitions;
+
+	/**
+	 * The number of child processes spawned in advance.
+	 */
+	uint_least64_t prespawns;
+
+	/**
+	 * The sum of the current per-process concurrency limits of
+	 * all keys with adaptive concurrency.
+	 */
+	uint_least64_t concurrency_limit;
+
+	/**
+	 * The number of times an adaptive concurrency limit was
+	 * raised or lowered.
+	 */
+	uint_least64_t concurrency_increases, concurrency_decreases;
+
+	constexpr ChildStockStats &operator+=(const ChildStockStats &other) noexcept {
+		warm_acquisitions += other.warm_acquisitions;
+		cold_acquisitions += other.cold_acquisitions;
+		prespawns += other.prespawns;
+		concurrency_limit += other.concurrency_limit;
+		concurrency_increases += other.concurrency_increases;
+		concurrency_decreases += other.concurrency_decreases;
+		return *this;
+	}
+};
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "EventLoopMonitor.hxx"
+#include "EventLoopProfiler.hxx"
+#include "event/Loop.hxx"
+#include "io/Logger.hxx"
+
+#include <sys/resource.h>
+
+EventLoopMonitor::EventLoopMonitor(EventLoop &event_loop) noexcept
+	:timer(event_loop, BIND_THIS_METHOD(OnTimer))
+{
+}
+
+static constexpr std::chrono::steady_clock::duration
+ToDuration(const struct timeval &tv) noexcept
+{
+	return std::chrono::seconds{tv.tv_sec} +
+		std::chrono::microseconds{tv.tv_usec};
+}
+
+EventLoopStats
+EventLoopMonitor::GetStats() const noexcept
+{
+	EventLoopStats result = stats;
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		result.cpu_user = ToDuration(usage.ru_utime);
+		result.cpu_system = ToDuration(usage.ru_stime);
+	}
+
+	EventLoopCallbackSite::Collect(result, TOP_SITES);
+
+	return result;
+}
+
+inline void
+EventLoopMonitor::Schedule() noexcept
+{
+	due = timer.GetEventLoop().SteadyNow() + INTERVAL;
+	timer.Schedule(INTERVAL);
+}
+
+void
+EventLoopMonitor::OnTimer() noexcept
+{
+	/* not using EventLoop::SteadyNow() because that is cached
+	   and doesn't include the duration of callbacks which were
+	   invoked before this one in the same iteration */
+	const auto now = std::chrono::steady_clock::now();
+	const auto lag = now > due ? now - due : Event::Duration{};
+
+	stats.lag.Add(lag);
+	if (lag > stats.max_lag)
+		stats.max_lag = lag;
+
+	if (lag > STALL_THRESHOLD) {
+		++stats.n_stalls;
+		LogConcat(3, "EventLoopMonitor", "event loop stalled for ",
+			  std::chrono::duration_cast<std::chrono::milliseconds>(lag).count(),
+			  "ms");
+	}
+
+	Schedule();
+}
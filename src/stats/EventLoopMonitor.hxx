@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "EventLoopStats.hxx"
+#include "event/FineTimerEvent.hxx"
+
+/**
+ * Measures how responsive an #EventLoop is: a timer is scheduled
+ * periodically, and the delay between its due time and the actual
+ * invocation is the time the loop spent in other callbacks (or
+ * blocked in a system call).  Samples are collected in a histogram;
+ * stalls exceeding a threshold are logged.
+ *
+ * This is cheap enough to be enabled permanently: it costs one
+ * timer wakeup per #INTERVAL.
+ *
+ * GetStats() also reports the run time of the callbacks profiled
+ * with #EventLoopCallbackScope, which tells which callbacks cause
+ * the lag.
+ */
+class EventLoopMonitor final {
+	static constexpr Event::Duration INTERVAL = std::chrono::milliseconds{100};
+
+	/**
+	 * Lags above this value are logged and counted as "stall".
+	 */
+	static constexpr Event::Duration STALL_THRESHOLD = std::chrono::milliseconds{100};
+
+	/**
+	 * How many callback sites are reported in
+	 * EventLoopStats::top_sites?
+	 */
+	static constexpr std::size_t TOP_SITES = 10;
+
+	FineTimerEvent timer;
+
+	/**
+	 * The time when #timer is expected to fire.
+	 */
+	Event::TimePoint due;
+
+	EventLoopStats stats;
+
+public:
+	explicit EventLoopMonitor(EventLoop &event_loop) noexcept;
+
+	EventLoopMonitor(const EventLoopMonitor &) = delete;
+	EventLoopMonitor &operator=(const EventLoopMonitor &) = delete;
+
+	void Enable() noexcept {
+		Schedule();
+	}
+
+	void Disable() noexcept {
+		timer.Cancel();
+	}
+
+	/**
+	 * Returns a snapshot of the statistics, including the current
+	 * CPU usage of the calling thread and the profiled callback
+	 * sites.
+	 */
+	EventLoopStats GetStats() const noexcept;
+
+private:
+	void Schedule() noexcept;
+	void OnTimer() noexcept;
+};
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "EventLoopProfiler.hxx"
+
+#include <algorithm>
+
+constinit EventLoopCallbackSite *EventLoopCallbackSite::head = nullptr;
+
+void
+EventLoopCallbackSite::Collect(EventLoopStats &dest,
+			       std::size_t max_sites) noexcept
+{
+	dest.types = {};
+	dest.top_sites.clear();
+
+	for (const auto *i = head; i != nullptr; i = i->next) {
+		dest.types[std::size_t(i->type)] += i->stats;
+
+		if (i->stats.n_calls > 0)
+			dest.top_sites.push_back({i->name, i->type, i->stats});
+	}
+
+	const auto by_total = [](const EventLoopCallbackSiteStats &a,
+				 const EventLoopCallbackSiteStats &b){
+		return a.stats.total > b.stats.total;
+	};
+
+	if (dest.top_sites.size() > max_sites) {
+		std::partial_sort(dest.top_sites.begin(),
+				  dest.top_sites.begin() + max_sites,
+				  dest.top_sites.end(), by_total);
+		dest.top_sites.resize(max_sites);
+	} else
+		std::sort(dest.top_sites.begin(), dest.top_sites.end(),
+			  by_total);
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "EventLoopStats.hxx"
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+/**
+ * An #EventLoop callback whose run time is measured by
+ * #EventLoopCallbackScope.  Instances must have static storage
+ * duration; they add themselves to a global list which is
+ * evaluated by Collect().
+ *
+ * This is not thread-safe; use it only for callbacks of the main
+ * #EventLoop.  A callback invoked by another profiled callback is
+ * counted by both sites.
+ */
+class EventLoopCallbackSite {
+	static EventLoopCallbackSite *head;
+
+	EventLoopCallbackSite *const next;
+
+public:
+	const char *const name;
+
+	const EventLoopCallbackType type;
+
+	EventLoopCallbackStats stats;
+
+	EventLoopCallbackSite(const char *_name,
+			      EventLoopCallbackType _type) noexcept
+		:next(std::exchange(head, this)),
+		 name(_name), type(_type) {}
+
+	EventLoopCallbackSite(const EventLoopCallbackSite &) = delete;
+	EventLoopCallbackSite &operator=(const EventLoopCallbackSite &) = delete;
+
+	/**
+	 * Sum up all sites in EventLoopStats::types (replacing the
+	 * old values) and copy the @max_sites most expensive ones
+	 * (by total run time) to EventLoopStats::top_sites.  Sites
+	 * which have never been invoked are omitted.
+	 */
+	static void Collect(EventLoopStats &dest,
+			    std::size_t max_sites) noexcept;
+};
+
+/**
+ * Measures the run time of the current scope and adds it to an
+ * #EventLoopCallbackSite.  It does not access the object whose
+ * callback is being profiled, so that object may be destroyed
+ * inside the scope.
+ */
+class EventLoopCallbackScope {
+	EventLoopCallbackSite &site;
+
+	const std::chrono::steady_clock::time_point start =
+		std::chrono::steady_clock::now();
+
+public:
+	explicit EventLoopCallbackScope(EventLoopCallbackSite &_site) noexcept
+		:site(_site) {}
+
+	~EventLoopCallbackScope() noexcept {
+		site.stats.Add(std::chrono::steady_clock::now() - start);
+	}
+
+	EventLoopCallbackScope(const EventLoopCallbackScope &) = delete;
+	EventLoopCallbackScope &operator=(const EventLoopCallbackScope &) = delete;
+};
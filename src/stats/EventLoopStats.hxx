@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "LatencyHistogram.hxx"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The kind of event which invoked a profiled #EventLoop callback
+ * (see #EventLoopCallbackSite).
+ */
+enum class EventLoopCallbackType : uint_least8_t {
+	SOCKET,
+	TIMER,
+	DEFER,
+	URING,
+};
+
+static constexpr std::size_t N_EVENT_LOOP_CALLBACK_TYPES =
+	std::size_t(EventLoopCallbackType::URING) + 1;
+
+constexpr const char *
+ToString(EventLoopCallbackType type) noexcept
+{
+	switch (type) {
+	case EventLoopCallbackType::SOCKET:
+		return "socket";
+
+	case EventLoopCallbackType::TIMER:
+		return "timer";
+
+	case EventLoopCallbackType::DEFER:
+		return "defer";
+
+	case EventLoopCallbackType::URING:
+		return "uring";
+	}
+
+	return "unknown";
+}
+
+/**
+ * How much time was spent in profiled #EventLoop callbacks.
+ */
+struct EventLoopCallbackStats {
+	uint_least64_t n_calls = 0;
+
+	std::chrono::steady_clock::duration total{}, max{};
+
+	constexpr void Add(std::chrono::steady_clock::duration d) noexcept {
+		++n_calls;
+		total += d;
+		if (d > max)
+			max = d;
+	}
+
+	constexpr EventLoopCallbackStats &operator+=(const EventLoopCallbackStats &src) noexcept {
+		n_calls += src.n_calls;
+		total += src.total;
+		if (src.max > max)
+			max = src.max;
+		return *this;
+	}
+};
+
+/**
+ * A snapshot of one #EventLoopCallbackSite.
+ */
+struct EventLoopCallbackSiteStats {
+	const char *name;
+
+	EventLoopCallbackType type;
+
+	EventLoopCallbackStats stats;
+};
+
+/**
+ * Statistics about the responsiveness of an #EventLoop, collected
+ * by #EventLoopMonitor.
+ */
+struct EventLoopStats {
+	/**
+	 * How late the periodic sampling timer fired, i.e. how long
+	 * the event loop was busy with other callbacks.
+	 */
+	LatencyHistogram lag;
+
+	/**
+	 * The largest lag ever observed.
+	 */
+	std::chrono::steady_clock::duration max_lag{};
+
+	/**
+	 * The number of samples whose lag exceeded the "stall"
+	 * threshold.
+	 */
+	uint_least64_t n_stalls = 0;
+
+	/**
+	 * CPU time consumed by the event loop thread in user and
+	 * kernel mode.
+	 */
+	std::chrono::steady_clock::duration cpu_user{}, cpu_system{};
+
+	/**
+	 * The time spent in profiled callbacks, per
+	 * #EventLoopCallbackType.
+	 */
+	std::array<EventLoopCallbackStats, N_EVENT_LOOP_CALLBACK_TYPES> types{};
+
+	/**
+	 * The profiled callback sites which have consumed the most
+	 * time, the most expensive one first.
+	 */
+	std::vector<EventLoopCallbackSiteStats> top_sites;
+};
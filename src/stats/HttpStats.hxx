@@ -5,6 +5,7 @@
 #pragma once
 
 #include "PerHttpStatusCounters.hxx"
+#include "LatencyHistogram.hxx"
 
 #include <chrono>
 #include <cstdint>
@@ -32,15 +33,51 @@ struct HttpStats {
 
 	PerHttpStatusCounters n_per_status{};
 
+	/**
+	 * Histogram of the request durations (excluding the time
+	 * waiting for the client).
+	 */
+	LatencyHistogram duration_histogram;
+
+	/**
+	 * Histogram of the durations from the start of the request
+	 * until the response headers were submitted ("time to first
+	 * byte").
+	 */
+	LatencyHistogram ttfb_histogram;
+
+	/**
+	 * Histogram of the durations waiting for the response headers
+	 * of upstream servers.  Only requests which were forwarded to
+	 * an upstream server are counted.
+	 */
+	LatencyHistogram upstream_histogram;
+
+	/**
+	 * @param ttfb the "time to first byte"; negative if no
+	 * response was submitted
+	 * @param upstream_wait the time waiting for upstream
+	 * servers; negative if the request was not forwarded
+	 */
 	void AddRequest(HttpStatus status,
 			uint_least64_t bytes_received,
 			uint_least64_t bytes_sent,
-			std::chrono::steady_clock::duration duration) noexcept {
+			std::chrono::steady_clock::duration duration,
+			std::chrono::steady_clock::duration ttfb,
+			std::chrono::steady_clock::duration upstream_wait) noexcept {
 		++n_requests;
 		traffic_received += bytes_received;
 		traffic_sent += bytes_sent;
 		total_duration += duration;
 
 		++n_per_status[HttpStatusToIndex(status)];
+
+		duration_histogram.Add(duration);
+
+		if (ttfb.count() >= 0)
+			ttfb_histogram.Add(ttfb);
+
+		if (upstream_wait.count() >= 0)
+			upstream_histogram.Add(upstream_wait);
 	}
 };
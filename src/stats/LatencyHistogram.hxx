@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A histogram of durations with fixed log-linear buckets (1, 2.5
+ * and 5 per decade, from 100 microseconds to 60 seconds).  It is
+ * meant to be exported as a Prometheus histogram, which allows
+ * calculating percentiles with histogram_quantile().
+ *
+ * All instances live in one #EventLoop thread, therefore Add()
+ * needs no locking; it is just one increment of a counter selected
+ * by a short linear search.
+ */
+struct LatencyHistogram {
+	using Duration = std::chrono::steady_clock::duration;
+
+	/**
+	 * The (inclusive) upper bounds of all buckets except for the
+	 * last one ("+Inf").
+	 */
+	static constexpr std::array upper_bounds{
+		std::chrono::microseconds{100},
+		std::chrono::microseconds{250},
+		std::chrono::microseconds{500},
+		std::chrono::microseconds{1000},
+		std::chrono::microseconds{2500},
+		std::chrono::microseconds{5000},
+		std::chrono::microseconds{10000},
+		std::chrono::microseconds{25000},
+		std::chrono::microseconds{50000},
+		std::chrono::microseconds{100000},
+		std::chrono::microseconds{250000},
+		std::chrono::microseconds{500000},
+		std::chrono::microseconds{1000000},
+		std::chrono::microseconds{2500000},
+		std::chrono::microseconds{5000000},
+		std::chrono::microseconds{10000000},
+		std::chrono::microseconds{30000000},
+		std::chrono::microseconds{60000000},
+	};
+
+	static constexpr std::size_t N_BUCKETS = upper_bounds.size() + 1;
+
+	/**
+	 * Non-cumulative counters; the last one is the "+Inf"
+	 * bucket.
+	 */
+	std::array<uint_least64_t, N_BUCKETS> buckets{};
+
+	uint_least64_t count = 0;
+
+	Duration sum{};
+
+	[[gnu::const]]
+	static constexpr std::size_t FindBucket(Duration d) noexcept {
+		std::size_t i = 0;
+		while (i < upper_bounds.size() && d > upper_bounds[i])
+			++i;
+		return i;
+	}
+
+	constexpr void Add(Duration d) noexcept {
+		++buckets[FindBucket(d)];
+		++count;
+		sum += d;
+	}
+
+	constexpr LatencyHistogram &operator+=(const LatencyHistogram &other) noexcept {
+		for (std::size_t i = 0; i < buckets.size(); ++i)
+			buckets[i] += other.buckets[i];
+		count += other.count;
+		sum += other.sum;
+		return *this;
+	}
+};
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "PerHttpStatusCounters.hxx"
+#include "LatencyHistogram.hxx"
 
 #include <map>
 #include <string>
@@ -12,8 +13,12 @@
 struct PerGeneratorStats {
 	PerHttpStatusCounters n_per_status{};
 
-	void AddRequest(HttpStatus status) noexcept {
+	LatencyHistogram duration_histogram;
+
+	void AddRequest(HttpStatus status,
+			std::chrono::steady_clock::duration duration) noexcept {
 		++n_per_status[HttpStatusToIndex(status)];
+		duration_histogram.Add(duration);
 	}
 };
 
@@ -21,9 +26,10 @@ struct PerGeneratorStatsMap {
 	std::map<std::string, PerGeneratorStats, std::less<>> per_generator;
 
 	void AddRequest(std::string_view generator,
-			HttpStatus status) noexcept {
+			HttpStatus status,
+			std::chrono::steady_clock::duration duration) noexcept {
 		auto &s = FindOrEmplace(generator);
-		s.AddRequest(status);
+		s.AddRequest(status, duration);
 	}
 
 private:
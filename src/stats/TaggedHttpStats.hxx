@@ -16,10 +16,12 @@ struct TaggedHttpStats {
 			HttpStatus status,
 			uint64_t bytes_received,
 			uint64_t bytes_sent,
-			std::chrono::steady_clock::duration duration) noexcept {
+			std::chrono::steady_clock::duration duration,
+			std::chrono::steady_clock::duration ttfb,
+			std::chrono::steady_clock::duration upstream_wait) noexcept {
 		auto &s = FindOrEmplace(tag);
 		s.AddRequest(status, bytes_received, bytes_sent,
-			     duration);
+			     duration, ttfb, upstream_wait);
 	}
 
 private:
@@ -3,17 +3,25 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "stopwatch.hxx"
+#include "stopwatch_binary.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "util/LeakDetector.hxx"
 #include "util/SpanCast.hxx"
 #include "util/StaticVector.hxx"
 #include "util/StringBuilder.hxx"
+#include "util/StringCompare.hxx"
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstdint>
 #include <list>
+#include <span>
 #include <string>
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h> // for PIPE_BUF
 #include <stdio.h>
 #include <string.h>
 
@@ -23,6 +31,56 @@
 
 static UniqueFileDescriptor stopwatch_fd;
 
+static StopwatchOptions stopwatch_options;
+
+/**
+ * Counts root stopwatches for #StopwatchOptions::sample_rate.
+ */
+static unsigned stopwatch_sample_counter;
+
+/**
+ * The buffer where one trace in the binary format is assembled, to
+ * be submitted with a single write() call.  Its size is limited to
+ * PIPE_BUF, which makes this write atomic: it either succeeds
+ * completely or fails with EAGAIN; larger traces are discarded.
+ */
+class StopwatchBinaryBuffer {
+	std::array<std::byte, PIPE_BUF> buffer;
+	std::size_t fill;
+
+public:
+	void Clear() noexcept {
+		fill = sizeof(StopwatchBinaryHeader);
+	}
+
+	template<typename T>
+	bool AppendStruct(const T &src) noexcept {
+		return Append(ReferenceAsBytes(src));
+	}
+
+	bool Append(std::span<const std::byte> src) noexcept {
+		if (src.size() > buffer.size() - fill)
+			return false;
+
+		std::copy(src.begin(), src.end(), buffer.begin() + fill);
+		fill += src.size();
+		return true;
+	}
+
+	std::span<const std::byte> Finish() noexcept {
+		const StopwatchBinaryHeader header{
+			STOPWATCH_BINARY_MAGIC,
+			uint32_t(fill - sizeof(header)),
+		};
+
+		const auto h = ReferenceAsBytes(header);
+		std::copy(h.begin(), h.end(), buffer.begin());
+		return {buffer.data(), fill};
+	}
+};
+
+static StopwatchBinaryBuffer stopwatch_binary_buffer;
+
 struct StopwatchEvent {
 	std::string name;
 
@@ -67,8 +125,12 @@ public:
 	}
 
 	~Stopwatch() noexcept {
-		if (dump)
-			Dump(time, 0);
+		if (dump) {
+			if (stopwatch_options.binary)
+				DumpBinary();
+			else
+				Dump(time, 0);
+		}
 	}
 
 	template<typename C>
@@ -80,14 +142,29 @@ public:
 
 	void Dump(std::chrono::steady_clock::time_point root_time,
 		  size_t indent) noexcept;
+
+private:
+	bool SerializeBinary(StopwatchBinaryBuffer &buffer,
+			     unsigned depth) const noexcept;
+	void DumpBinary() noexcept;
 };
 
 void
-stopwatch_enable(UniqueFileDescriptor fd) noexcept
+stopwatch_enable(UniqueFileDescriptor fd, StopwatchOptions &&options) noexcept
 {
 	assert(fd.IsDefined());
 
+	if (options.binary)
+		/* never block the event loop; if the reader is too
+		   slow, traces are dropped */
+		fd.SetNonBlocking();
+
+	if (options.sample_rate == 0)
+		options.sample_rate = 1;
+
 	stopwatch_fd = std::move(fd);
+	stopwatch_options = std::move(options);
+	stopwatch_sample_counter = 0;
 }
 
 bool
@@ -115,6 +192,15 @@ stopwatch_new(const char *name, const char *suffix) noexcept
 	if (!stopwatch_is_enabled())
 		return nullptr;
 
+	if (!stopwatch_options.filter.empty() &&
+	    !StringStartsWith(name, stopwatch_options.filter))
+		return nullptr;
+
+	if (++stopwatch_sample_counter < stopwatch_options.sample_rate)
+		return nullptr;
+
+	stopwatch_sample_counter = 0;
+
 	return std::make_shared<Stopwatch>(MakeStopwatchName(name, suffix), true);
 }
 
@@ -212,3 +298,69 @@ try {
 		child->Dump(root_time, indent);
 } catch (StringBuilder::Overflow) {
 }
+
+static constexpr uint64_t
+ToMicroseconds(std::chrono::steady_clock::duration d) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+static bool
+AppendName(StopwatchBinaryBuffer &buffer, std::string_view name) noexcept
+{
+	return buffer.Append(AsBytes(name));
+}
+
+inline bool
+Stopwatch::SerializeBinary(StopwatchBinaryBuffer &buffer,
+			   unsigned depth) const noexcept
+{
+	/* omit the events which do not fit into "n_events" */
+	const std::span<const StopwatchEvent> binary_events{
+		events.data(),
+		std::min(events.size(), STOPWATCH_BINARY_MAX_EVENTS),
+	};
+
+	const StopwatchBinaryNode node{
+		ToMicroseconds(time.time_since_epoch()),
+		uint16_t(name.size()),
+		uint8_t(std::min(depth, 255U)),
+		uint8_t(binary_events.size()),
+	};
+
+	if (!buffer.AppendStruct(node) || !AppendName(buffer, name))
+		return false;
+
+	for (const auto &i : binary_events) {
+		const StopwatchBinaryEvent event{
+			uint32_t(ToMicroseconds(i.time - time)),
+			uint16_t(i.name.size()),
+		};
+
+		if (!buffer.AppendStruct(event) || !AppendName(buffer, i.name))
+			return false;
+	}
+
+	for (const auto &child : children)
+		if (!child->SerializeBinary(buffer, depth + 1))
+			return false;
+
+	return true;
+}
+
+inline void
+Stopwatch::DumpBinary() noexcept
+{
+	if (!stopwatch_fd.IsDefined())
+		return;
+
+	auto &buffer = stopwatch_binary_buffer;
+	buffer.Clear();
+
+	if (!SerializeBinary(buffer, 0))
+		/* too large, discard this trace */
+		return;
+
+	if (stopwatch_fd.Write(buffer.Finish()) < 0 && errno != EAGAIN)
+		stopwatch_fd.Close();
+}
@@ -4,11 +4,33 @@
 
 #pragma once
 
+#include <string>
 #include <utility>
 
 class Stopwatch;
 class UniqueFileDescriptor;
 
+struct StopwatchOptions {
+	/**
+	 * If non-empty, then only root stopwatches whose name
+	 * starts with this prefix are recorded.
+	 */
+	std::string filter;
+
+	/**
+	 * Record only one of this many root stopwatches.
+	 */
+	unsigned sample_rate = 1;
+
+	/**
+	 * Write the compact binary format instead of text lines (see
+	 * doc/bp.rst).  In this mode, the file descriptor is
+	 * non-blocking and traces are dropped if the reader is too
+	 * slow.
+	 */
+	bool binary = false;
+};
+
 #ifdef ENABLE_STOPWATCH
 
 #include <memory>
@@ -54,7 +76,8 @@ public:
 };
 
 void
-stopwatch_enable(UniqueFileDescriptor fd) noexcept;
+stopwatch_enable(UniqueFileDescriptor fd,
+		 StopwatchOptions &&options={}) noexcept;
 
 [[gnu::pure]]
 bool
@@ -82,7 +105,8 @@ public:
 using RootStopwatchPtr = StopwatchPtr;
 
 static inline void
-stopwatch_enable(UniqueFileDescriptor &&) noexcept
+stopwatch_enable(UniqueFileDescriptor &&,
+		 StopwatchOptions && ={}) noexcept
 {
 }
 
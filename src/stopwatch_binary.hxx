@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Definitions for the binary stopwatch trace format (see doc/bp.rst).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Magic number at the start of each trace in the binary format
+ * ("SWT1" in little-endian).
+ */
+static constexpr uint32_t STOPWATCH_BINARY_MAGIC = 0x31545753;
+
+/**
+ * Header of a trace in the binary format.  All integers are in host
+ * byte order.
+ */
+struct StopwatchBinaryHeader {
+	uint32_t magic;
+
+	/**
+	 * The number of bytes following this header.
+	 */
+	uint32_t size;
+};
+
+/**
+ * One stopwatch in the binary format; it is followed by the name
+ * and #n_events #StopwatchBinaryEvent instances, each followed by
+ * the event name.  Nodes are serialized in pre-order.
+ */
+struct StopwatchBinaryNode {
+	/**
+	 * Start time (steady clock) in microseconds.
+	 */
+	uint64_t start_us;
+
+	uint16_t name_length;
+	uint8_t depth;
+	uint8_t n_events;
+
+	uint32_t reserved = 0;
+};
+
+static_assert(sizeof(StopwatchBinaryNode) == 16);
+
+/**
+ * The maximum number of events per node which fits into
+ * StopwatchBinaryNode::n_events; additional events are omitted.
+ */
+static constexpr std::size_t STOPWATCH_BINARY_MAX_EVENTS = UINT8_MAX;
+
+struct StopwatchBinaryEvent {
+	/**
+	 * Offset relative to the start of the node in microseconds.
+	 */
+	uint32_t offset_us;
+
+	uint16_t name_length;
+
+	uint16_t reserved = 0;
+};
+
+static_assert(sizeof(StopwatchBinaryEvent) == 8);
@@ -5,8 +5,13 @@
 #include "Builder.hxx"
 #include "Glue.hxx"
 #include "Cache.hxx"
+#include "Marshal.hxx"
+#include "Snapshot.hxx"
 #include "stats/CacheStats.hxx"
+#include "memory/GrowingBuffer.hxx"
 #include "net/SocketAddress.hxx"
+#include "pool/tpool.hxx"
+#include "AllocatorPtr.hxx"
 
 #include <algorithm> // for std::lexicographical_compare()
 #include <cassert>
@@ -29,8 +34,9 @@ SocketAddressCompare::operator()(SocketAddress a,
 	return std::lexicographical_compare(as.begin(), as.end(), bs.begin(), bs.end());
 }
 
-TranslationStockBuilder::TranslationStockBuilder(unsigned _limit) noexcept
-	:limit(_limit)
+TranslationStockBuilder::TranslationStockBuilder(unsigned _limit,
+						 bool _multiplex) noexcept
+	:limit(_limit), multiplex(_multiplex)
 {
 }
 
@@ -43,7 +49,7 @@ TranslationStockBuilder::Get(SocketAddress address,
 	auto e = m.try_emplace(address, nullptr);
 	if (e.second)
 		e.first->second = std::make_shared<TranslationGlue>
-			(event_loop, address, limit);
+			(event_loop, address, limit, multiplex);
 
 	return e.first->second;
 }
@@ -92,17 +98,93 @@ TranslationCacheBuilder::Invalidate(const TranslateRequest &request,
 		i.second->Invalidate(request, vary, site);
 }
 
+void
+TranslationCacheBuilder::EnableSnapshot() noexcept
+{
+	snapshot = true;
+
+	for (auto &i : m)
+		i.second->EnableSnapshot();
+}
+
+GrowingBuffer
+TranslationCacheBuilder::SaveSnapshot() const
+{
+	TranslationMarshaller header;
+	TranslationSnapshotWriteHeader(header);
+
+	GrowingBuffer result = header.Commit();
+
+	for (const auto &[address, cache] : m) {
+		TranslationMarshaller server;
+		TranslationSnapshotWriteServer(server, address);
+		result.AppendMoveFrom(server.Commit());
+
+		cache->SaveSnapshot(result);
+	}
+
+	return result;
+}
+
+[[gnu::pure]]
+static TranslationCache *
+FindCache(const auto &m, std::span<const std::byte> address) noexcept
+{
+	for (const auto &[key, cache] : m) {
+		const std::span<const std::byte> k{key};
+		if (std::equal(k.begin(), k.end(),
+			       address.begin(), address.end()))
+			return cache.get();
+	}
+
+	return nullptr;
+}
+
+std::size_t
+TranslationCacheBuilder::LoadSnapshot(std::span<const std::byte> src)
+{
+	TranslationSnapshotReader reader{src};
+
+	std::size_t n = 0;
+	TranslationCache *cache = nullptr;
+
+	while (true) {
+		const TempPoolLease tpool;
+		std::span<const std::byte> server;
+		TranslationSnapshotItem item;
+
+		switch (reader.Next(AllocatorPtr{tpool}, server, item)) {
+		case TranslationSnapshotReader::Result::END:
+			return n;
+
+		case TranslationSnapshotReader::Result::SERVER:
+			cache = FindCache(m, server);
+			break;
+
+		case TranslationSnapshotReader::Result::ITEM:
+			if (cache != nullptr &&
+			    cache->RestoreSnapshotItem(item))
+				++n;
+			break;
+		}
+	}
+}
+
 std::shared_ptr<TranslationService>
 TranslationCacheBuilder::Get(SocketAddress address,
 			     EventLoop &event_loop) noexcept
 {
 	auto e = m.try_emplace(address, nullptr);
-	if (e.second)
+	if (e.second) {
 		e.first->second = std::make_shared<TranslationCache>
 			(pool, event_loop,
 			 // TODO: refactor to std::shared_ptr?
 			 *builder.Get(address, event_loop),
 			 max_size, false);
 
+		if (snapshot)
+			e.first->second->EnableSnapshot();
+	}
+
 	return e.first->second;
 }
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -11,6 +12,7 @@
 
 struct CacheStats;
 class EventLoop;
+class GrowingBuffer;
 class SocketAddress;
 class TranslationGlue;
 class TranslationCache;
@@ -31,11 +33,14 @@ public:
 class TranslationStockBuilder final : public TranslationServiceBuilder {
 	const unsigned limit;
 
+	const bool multiplex;
+
 	std::map<SocketAddress, std::shared_ptr<TranslationGlue>,
 		 SocketAddressCompare> m;
 
 public:
-	explicit TranslationStockBuilder(unsigned _limit) noexcept;
+	explicit TranslationStockBuilder(unsigned _limit,
+					 bool _multiplex=false) noexcept;
 	~TranslationStockBuilder() noexcept;
 
 	std::shared_ptr<TranslationService> Get(SocketAddress address,
@@ -49,6 +54,11 @@ class TranslationCacheBuilder final : public TranslationServiceBuilder {
 
 	const unsigned max_size;
 
+	/**
+	 * Was EnableSnapshot() called?
+	 */
+	bool snapshot = false;
+
 	std::map<SocketAddress, std::shared_ptr<TranslationCache>,
 		 SocketAddressCompare> m;
 
@@ -69,6 +79,33 @@ public:
 			std::span<const TranslationCommand> vary,
 			const char *site) noexcept;
 
+	/**
+	 * Enable TranslationCache::EnableSnapshot() on all
+	 * (existing and future) caches.
+	 */
+	void EnableSnapshot() noexcept;
+
+	/**
+	 * Serialize all caches into one snapshot file (see
+	 * Snapshot.hxx).
+	 *
+	 * Throws on error.
+	 */
+	GrowingBuffer SaveSnapshot() const;
+
+	/**
+	 * Restore the caches from a snapshot file.  Items which
+	 * belong to translation servers which are not (or no longer)
+	 * configured are ignored, and so are expired items.  All
+	 * caches must have been created already (with Get()).
+	 *
+	 * Throws if the file is malformed; items which have been
+	 * restored until then are kept.
+	 *
+	 * @return the number of restored items
+	 */
+	std::size_t LoadSnapshot(std::span<const std::byte> src);
+
 	std::shared_ptr<TranslationService> Get(SocketAddress address,
 						EventLoop &event_loop) noexcept override;
 };
@@ -4,6 +4,10 @@
 
 #include "Cache.hxx"
 #include "Layout.hxx"
+#include "Marshal.hxx"
+#include "Snapshot.hxx"
+#include "Extension.hxx"
+#include "translation/Parser.hxx"
 #include "translation/Handler.hxx"
 #include "translation/Request.hxx"
 #include "translation/Response.hxx"
@@ -22,6 +26,8 @@
 #include "pool/StringBuilder.hxx"
 #include "pool/PSocketAddress.hxx"
 #include "memory/SlicePool.hxx"
+#include "memory/ExpansibleBuffer.hxx"
+#include "memory/GrowingBuffer.hxx"
 #include "stats/CacheStats.hxx"
 #include "lib/fmt/Unsafe.hxx"
 #include "lib/pcre/UniqueRegex.hxx"
@@ -32,6 +38,8 @@
 #include "util/SpanCast.hxx"
 
 #include <cassert>
+#include <optional>
+#include <stdexcept>
 
 #include <time.h>
 #include <string.h>
@@ -53,6 +61,19 @@ static constexpr std::size_t MAX_FILE_NOT_FOUND = 256;
 static constexpr std::size_t MAX_DIRECTORY_INDEX = 256;
 static constexpr std::size_t MAX_READ_FILE = 256;
 
+/**
+ * Larger responses are not saved in snapshots; this limit ensures
+ * that the response fits in one #TRANSLATION_SNAPSHOT_RESPONSE
+ * packet.
+ */
+static constexpr std::size_t MAX_SNAPSHOT_RESPONSE = 0xfffe;
+
+/**
+ * The maximum total size of all extension packets (see
+ * Extension.hxx) of one response which are stored in the cache.
+ */
+static constexpr std::size_t MAX_EXTENSIONS = 4096;
+
 struct TranslateCacheItem final : PoolHolder, CacheItem {
 	IntrusiveHashSetHook<IntrusiveHookMode::AUTO_UNLINK> per_host_siblings, per_site_siblings;
 
@@ -80,6 +101,25 @@ struct TranslateCacheItem final : PoolHolder, CacheItem {
 
 	TranslateResponse response;
 
+	/**
+	 * The response packets as received from the translation
+	 * server, to be saved in a snapshot (see
+	 * TranslationCache::EnableSnapshot()).  nullptr if not
+	 * available.
+	 */
+	std::span<const std::byte> raw_response;
+
+	/**
+	 * The request URI (only if #raw_response is set).
+	 */
+	const char *uri = nullptr;
+
+	/**
+	 * Extension packets (see Extension.hxx) which are submitted
+	 * to the handler on each hit.
+	 */
+	std::span<const std::byte> extensions;
+
 	UniqueRegex regex, inverse_regex;
 
 	AllocatorStats stats;
@@ -215,6 +255,12 @@ struct tcache final : private CacheHandler {
 	 */
 	bool active;
 
+	/**
+	 * Shall the raw responses be kept for snapshots?  See
+	 * TranslationCache::EnableSnapshot().
+	 */
+	bool snapshot = false;
+
 	tcache(struct pool &_pool, EventLoop &event_loop,
 	       TranslationService &_next, unsigned max_size,
 	       bool handshake_cacheable);
@@ -262,6 +308,25 @@ struct TranslateCacheRequest final : TranslateHandler {
 
 	TranslateHandler *handler;
 
+	/**
+	 * Collects the raw response for snapshots.  Reset if the
+	 * response is too large.
+	 */
+	std::optional<ExpansibleBuffer> raw_response;
+
+	/**
+	 * Collects extension packets (see Extension.hxx) to be stored
+	 * in the #TranslateCacheItem.
+	 */
+	std::optional<ExpansibleBuffer> extensions;
+
+	/**
+	 * Did the extension packets exceed #MAX_EXTENSIONS?  Then
+	 * the response is not cached, because replaying only some
+	 * of them would be wrong.
+	 */
+	bool extensions_overflow = false;
+
 	TranslateCacheRequest(AllocatorPtr _alloc, struct tcache &_tcache,
 			      const TranslateRequest &_request, const char *_key,
 			      bool _cacheable,
@@ -269,11 +334,46 @@ struct TranslateCacheRequest final : TranslateHandler {
 		:alloc(_alloc), tcache(&_tcache), request(_request),
 		 cacheable(_cacheable),
 		 find_base(false), key(_key),
-		 handler(&_handler) {}
+		 handler(&_handler)
+	{
+		if (cacheable && tcache->snapshot)
+			raw_response.emplace(alloc.GetPool(), 1024,
+					     MAX_SNAPSHOT_RESPONSE);
+	}
 
 	TranslateCacheRequest(TranslateCacheRequest &) = delete;
 
 	/* virtual methods from TranslateHandler */
+	bool WantTranslateRawResponse() const noexcept override {
+		return raw_response.has_value();
+	}
+
+	void OnTranslateRawResponse(std::span<const std::byte> src) noexcept override {
+		if (raw_response && !raw_response->Write(src))
+			/* too large; don't save it in a snapshot */
+			raw_response.reset();
+	}
+
+	void OnTranslateExtension(TranslationCommand command,
+				  std::span<const std::byte> payload) noexcept override {
+		if (cacheable && !extensions_overflow) {
+			if (!extensions)
+				extensions.emplace(alloc.GetPool(), 256,
+						   MAX_EXTENSIONS);
+
+			TranslationHeader header;
+			header.length = payload.size();
+			header.command = command;
+			if (!extensions->Write(std::as_bytes(std::span{&header, 1})) ||
+			    !extensions->Write(payload)) {
+				extensions_overflow = true;
+				extensions.reset();
+			}
+		}
+
+		handler->OnTranslateExtension(command, payload);
+	}
+
 	void OnTranslateResponse(UniquePoolPtr<TranslateResponse> response) noexcept override;
 	void OnTranslateError(std::exception_ptr error) noexcept override;
 };
@@ -900,77 +1000,90 @@ TranslationCache::Invalidate(const TranslateRequest &request,
 
 /**
  * Throws std::runtime_error on error.
+ *
+ * @param key the cache key of the request
+ * @param extensions the extension packets of the response
+ * @param raw_response the response packets to be saved in a
+ * snapshot; nullptr if not available
+ * @param restore true if the item is restored from a snapshot; then
+ * #key is the final key (already rewritten for BASE responses), and
+ * #request contains only the parameters the response varies on
  */
 static const TranslateCacheItem *
-tcache_store(TranslateCacheRequest &tcr, const TranslateResponse &response)
+tcache_store(struct tcache &tcache, const TranslateRequest &request,
+	     const char *key, bool find_base,
+	     const TranslateResponse &response,
+	     std::chrono::seconds max_age,
+	     std::span<const std::byte> extensions,
+	     std::span<const std::byte> raw_response,
+	     bool restore=false)
 {
-	auto max_age = response.max_age;
 	constexpr std::chrono::seconds max_max_age = std::chrono::hours(24);
 	if (max_age < std::chrono::seconds::zero() || max_age > max_max_age)
 		/* limit to one day */
 		max_age = max_max_age;
 
-	auto item = NewFromPool<TranslateCacheItem>(pool_new_slice(*tcr.tcache->pool, "tcache_item",
-								   tcr.tcache->slice_pool),
-						    tcr.tcache->cache.SteadyNow(),
+	auto item = NewFromPool<TranslateCacheItem>(pool_new_slice(*tcache.pool, "tcache_item",
+								   tcache.slice_pool),
+						    tcache.cache.SteadyNow(),
 						    max_age);
 
 	const AllocatorPtr alloc(item->GetPool());
 
 	item->request.param =
-		tcache_vary_copy(alloc, tcr.request.param,
+		tcache_vary_copy(alloc, request.param,
 				 response, TranslationCommand::PARAM);
 
 	item->request.session =
-		tcache_vary_copy(alloc, tcr.request.session,
+		tcache_vary_copy(alloc, request.session,
 				 response, TranslationCommand::SESSION);
 
 	item->request.realm_session =
-		tcache_vary_copy(alloc, tcr.request.realm_session,
+		tcache_vary_copy(alloc, request.realm_session,
 				 response, TranslationCommand::REALM_SESSION);
 
 	item->request.listener_tag =
-		tcache_vary_copy(alloc, tcr.request.listener_tag,
+		tcache_vary_copy(alloc, request.listener_tag,
 				 response, TranslationCommand::LISTENER_TAG);
 
 	item->request.local_address =
-		!tcr.request.local_address.IsNull() &&
+		!request.local_address.IsNull() &&
 		(response.VaryContains(TranslationCommand::LOCAL_ADDRESS) ||
 		 response.VaryContains(TranslationCommand::LOCAL_ADDRESS_STRING))
-		? DupAddress(alloc, tcr.request.local_address)
+		? DupAddress(alloc, request.local_address)
 		: nullptr;
 
-	tcache_vary_copy(alloc, tcr.request.remote_host,
+	tcache_vary_copy(alloc, request.remote_host,
 			 response, TranslationCommand::REMOTE_HOST);
 	item->request.remote_host =
-		tcache_vary_copy(alloc, tcr.request.remote_host,
+		tcache_vary_copy(alloc, request.remote_host,
 				 response, TranslationCommand::REMOTE_HOST);
-	item->request.host = tcache_vary_copy(alloc, tcr.request.host,
+	item->request.host = tcache_vary_copy(alloc, request.host,
 					      response, TranslationCommand::HOST);
 	item->request.accept_language =
-		tcache_vary_copy(alloc, tcr.request.accept_language,
+		tcache_vary_copy(alloc, request.accept_language,
 				 response, TranslationCommand::LANGUAGE);
 	item->request.user_agent =
-		tcache_vary_copy(alloc, tcr.request.user_agent,
+		tcache_vary_copy(alloc, request.user_agent,
 				 response, TranslationCommand::USER_AGENT);
 	item->request.query_string =
-		tcache_vary_copy(alloc, tcr.request.query_string,
+		tcache_vary_copy(alloc, request.query_string,
 				 response, TranslationCommand::QUERY_STRING);
 	item->request.internal_redirect =
-		tcache_vary_copy(alloc, tcr.request.internal_redirect,
+		tcache_vary_copy(alloc, request.internal_redirect,
 				 response, TranslationCommand::INTERNAL_REDIRECT);
 	item->request.enotdir =
-		tcache_vary_copy(alloc, tcr.request.enotdir,
+		tcache_vary_copy(alloc, request.enotdir,
 				 response, TranslationCommand::ENOTDIR_);
 	item->request.user =
-		tcache_vary_copy(alloc, tcr.request.user,
+		tcache_vary_copy(alloc, request.user,
 				 response, TranslationCommand::USER);
 
-	const char *key;
+	const char *base_key;
 
 	try {
-		key = tcache_store_response(alloc, item->response, response,
-					    tcr.request);
+		base_key = tcache_store_response(alloc, item->response, response,
+						 request);
 	} catch (...) {
 		item->Destroy();
 		throw;
@@ -979,8 +1092,9 @@ tcache_store(TranslateCacheRequest &tcr, const TranslateResponse &response)
 	assert(!item->response.easy_base ||
 	       item->response.address.IsValidBase());
 
-	if (key == nullptr)
-		key = alloc.Dup(tcr.key);
+	key = base_key != nullptr && !restore
+		? base_key
+		: alloc.Dup(key);
 
 	LogConcat(4, "TranslationCache", "store ", key);
 
@@ -1004,20 +1118,50 @@ tcache_store(TranslateCacheRequest &tcr, const TranslateResponse &response)
 		}
 	}
 
+	if (!extensions.empty())
+		item->extensions = alloc.Dup(extensions);
+
+	if (raw_response.data() != nullptr) {
+		item->raw_response = alloc.Dup(raw_response);
+		item->uri = alloc.CheckDup(request.uri);
+	}
+
 	item->stats = pool_stats(item->GetPool());
 
 	if (response.VaryContains(TranslationCommand::HOST))
-		tcr.tcache->per_host.insert(*item);
+		tcache.per_host.insert(*item);
 
 	if (response.site != nullptr)
-		tcr.tcache->per_site.insert(*item);
+		tcache.per_site.insert(*item);
+
+	++tcache.stats.stores;
+
+	if (restore) {
+		/* the items of a snapshot did not conflict with each
+		   other when it was saved, and the request is
+		   incomplete, so don't attempt to match */
+		tcache.cache.Add(key, *item);
+	} else {
+		TranslateCacheMatchContext match_ctx{request, find_base};
+		tcache.cache.PutMatch(key, *item, tcache_item_match, &match_ctx);
+	}
 
-	++tcr.tcache->stats.stores;
-	TranslateCacheMatchContext match_ctx{tcr.request, tcr.find_base};
-	tcr.tcache->cache.PutMatch(key, *item, tcache_item_match, &match_ctx);
 	return item;
 }
 
+static const TranslateCacheItem *
+tcache_store(TranslateCacheRequest &tcr, const TranslateResponse &response)
+{
+	return tcache_store(*tcr.tcache, tcr.request, tcr.key, tcr.find_base,
+			    response, response.max_age,
+			    tcr.extensions
+			    ? tcr.extensions->Read()
+			    : std::span<const std::byte>{},
+			    tcr.raw_response
+			    ? tcr.raw_response->Read()
+			    : std::span<const std::byte>{});
+}
+
 /**
  * Return a null-terminated string with the given URI minus the query
  * string.  This function is only needed because various functions
@@ -1059,6 +1203,8 @@ try {
 	if (!cacheable) {
 		if (key != nullptr)
 			LogConcat(4, "TranslationCache", "ignore ", key);
+	} else if (extensions_overflow) {
+		LogConcat(4, "TranslationCache", "nocache too many extensions ", key);
 	} else if (tcache_response_evaluate(response)) {
 		tcache_store(*this, response);
 	} else {
@@ -1127,6 +1273,7 @@ tcache_hit(AllocatorPtr alloc,
 		}
 	}
 
+	TranslateInvokeExtensions(handler, item.extensions);
 	handler.OnTranslateResponse(std::move(response));
 }
 
@@ -1267,6 +1414,152 @@ TranslationCache::Flush() noexcept
 	cache->slice_pool.Compress();
 }
 
+void
+TranslationCache::EnableSnapshot() noexcept
+{
+	cache->snapshot = true;
+}
+
+std::size_t
+TranslationCache::SaveSnapshot(GrowingBuffer &dest) const noexcept
+{
+	const auto steady_now = cache->cache.SteadyNow();
+	const auto system_now = cache->cache.SystemNow();
+
+	std::size_t n = 0;
+
+	cache->cache.ForEach([&](const CacheItem &_item){
+		const auto &item = (const TranslateCacheItem &)_item;
+		if (item.raw_response.data() == nullptr ||
+		    item.GetExpires() <= steady_now)
+			return;
+
+		TranslationSnapshotItem s{
+			.key = item.GetKey(),
+			.expires = system_now +
+			std::chrono::duration_cast<std::chrono::system_clock::duration>(item.GetExpires() - steady_now),
+			.request = {},
+			.response = item.raw_response,
+		};
+
+		s.request.uri = item.uri;
+		s.request.param = item.request.param;
+		s.request.session = item.request.session;
+		s.request.realm_session = item.request.realm_session;
+		s.request.listener_tag = item.request.listener_tag;
+		s.request.local_address = item.request.local_address;
+		s.request.remote_host = item.request.remote_host;
+		s.request.host = item.request.host;
+		s.request.accept_language = item.request.accept_language;
+		s.request.user_agent = item.request.user_agent;
+		s.request.query_string = item.request.query_string;
+		s.request.internal_redirect = item.request.internal_redirect;
+		s.request.enotdir = item.request.enotdir;
+		s.request.user = item.request.user;
+
+		/* marshal each item separately, so an oversized
+		   item doesn't corrupt the snapshot */
+		try {
+			TranslationMarshaller m;
+			TranslationSnapshotWriteItem(m, s);
+			dest.AppendMoveFrom(m.Commit());
+			++n;
+		} catch (...) {
+			LogConcat(4, "TranslationCache", "not saving ",
+				  item.GetKey());
+		}
+	});
+
+	return n;
+}
+
+/**
+ * Parse a raw response from a snapshot.
+ *
+ * Throws on error.
+ *
+ * @param extensions receives the extension packets (see
+ * Extension.hxx), which are not passed to the parser
+ */
+static void
+tcache_parse_raw_response(AllocatorPtr alloc, const TranslateRequest &request,
+			  TranslateResponse &response,
+			  ExpansibleBuffer &extensions,
+			  std::span<const std::byte> src)
+{
+	TranslateParser parser(alloc, request, response);
+
+	while (true) {
+		TranslationHeader header;
+		if (src.size() < sizeof(header))
+			throw std::runtime_error("Truncated response");
+
+		memcpy(&header, src.data(), sizeof(header));
+
+		const std::size_t size = sizeof(header) + header.length;
+		if (src.size() < size)
+			throw std::runtime_error("Truncated response");
+
+		if (IsTranslationExtension(header.command)) {
+			if (!extensions.Write(src.first(size)))
+				throw std::runtime_error("Too many extension packets");
+
+			src = src.subspan(size);
+			continue;
+		}
+
+		auto packet = src.first(size);
+		src = src.subspan(size);
+
+		while (!packet.empty()) {
+			const std::size_t nbytes = parser.Feed(packet);
+			if (nbytes == 0)
+				throw std::runtime_error("Malformed response");
+
+			packet = packet.subspan(nbytes);
+
+			if (parser.Process() == TranslateParser::Result::DONE) {
+				if (!packet.empty() || !src.empty())
+					throw std::runtime_error("Garbage after response");
+
+				return;
+			}
+		}
+	}
+}
+
+bool
+TranslationCache::RestoreSnapshotItem(const TranslationSnapshotItem &item) noexcept
+{
+	const auto system_now = cache->cache.SystemNow();
+	const auto max_age =
+		std::chrono::duration_cast<std::chrono::seconds>(item.expires - system_now);
+	if (max_age <= std::chrono::seconds::zero())
+		return false;
+
+	const TempPoolLease tpool;
+	const AllocatorPtr alloc{tpool};
+	auto response = UniquePoolPtr<TranslateResponse>::Make(alloc.GetPool());
+	ExpansibleBuffer extensions{alloc.GetPool(), 256, MAX_EXTENSIONS};
+
+	try {
+		tcache_parse_raw_response(alloc, item.request, *response,
+					  extensions, item.response);
+		if (!tcache_response_evaluate(*response))
+			return false;
+
+		tcache_store(*cache, item.request, item.key, false,
+			     *response, max_age, extensions.Read(),
+			     item.response, true);
+	} catch (...) {
+		LogConcat(3, "TranslationCache", "failed to restore ",
+			  item.key, ": ", std::current_exception());
+		return false;
+	}
+
+	LogConcat(5, "TranslationCache", "restore ", item.key);
+	return true;
+}
 
 /*
  * methods
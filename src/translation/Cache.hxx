@@ -6,12 +6,15 @@
 
 #include "Service.hxx"
 
+#include <cstddef>
 #include <memory>
 #include <span>
 
 enum class TranslationCommand : uint16_t;
 class EventLoop;
+class GrowingBuffer;
 struct CacheStats;
+struct TranslationSnapshotItem;
 
 struct tcache;
 
@@ -53,6 +56,29 @@ public:
 			std::span<const TranslationCommand> vary,
 			const char *site) noexcept;
 
+	/**
+	 * Keep a copy of the raw response packets in all new cache
+	 * items, to be able to save them with SaveSnapshot().
+	 */
+	void EnableSnapshot() noexcept;
+
+	/**
+	 * Serialize all cache items which have a raw response (see
+	 * EnableSnapshot()) in the snapshot format (see
+	 * Snapshot.hxx).
+	 *
+	 * @return the number of items
+	 */
+	std::size_t SaveSnapshot(GrowingBuffer &dest) const noexcept;
+
+	/**
+	 * Restore a cache item from a snapshot.  Errors are logged.
+	 *
+	 * @return true if the item has been restored, false if it
+	 * has expired or if it could not be parsed
+	 */
+	bool RestoreSnapshotItem(const TranslationSnapshotItem &item) noexcept;
+
 	/* virtual methods from class TranslationService */
 	void SendRequest(AllocatorPtr alloc,
 			 const TranslateRequest &request,
@@ -4,6 +4,7 @@
 
 #include "Client.hxx"
 #include "Marshal.hxx"
+#include "Extension.hxx"
 #include "translation/Parser.hxx"
 #include "translation/Request.hxx"
 #include "translation/Response.hxx"
@@ -19,13 +20,12 @@
 #include "util/Exception.hxx"
 #include "lease.hxx"
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <assert.h>
 #include <string.h>
 
-static const uint8_t PROTOCOL_VERSION = 3;
-
 class TranslateClient final : BufferedSocketHandler, Cancellable {
 	static constexpr Event::Duration read_timeout = std::chrono::minutes{2};
 	static constexpr Event::Duration write_timeout = std::chrono::seconds{10};
@@ -46,6 +46,18 @@ class TranslateClient final : BufferedSocketHandler, Cancellable {
 
 	TranslateParser parser;
 
+	/**
+	 * The number of bytes of the current response packet (header
+	 * and payload) which have not yet been passed to the parser.
+	 * Zero means the next packet header is expected.
+	 */
+	std::size_t packet_remaining = 0;
+
+	/**
+	 * Copy of TranslateHandler::WantTranslateRawResponse().
+	 */
+	const bool want_raw;
+
 public:
 	TranslateClient(AllocatorPtr alloc, EventLoop &event_loop,
 			StopwatchPtr &&_stopwatch,
@@ -135,11 +147,49 @@ inline BufferedResult
 TranslateClient::Feed(std::span<const std::byte> src) noexcept
 try {
 	while (!src.empty()) {
-		size_t nbytes = parser.Feed(src);
+		if (packet_remaining == 0) {
+			TranslationHeader header;
+			if (src.size() < sizeof(header))
+				/* need more data */
+				break;
+
+			memcpy(&header, src.data(), sizeof(header));
+
+			if (IsTranslationExtension(header.command)) {
+				/* the parser doesn't know this packet */
+				if (header.length > MAX_TRANSLATION_EXTENSION_PAYLOAD)
+					throw SocketProtocolError{"Translation extension packet too large"};
+
+				const std::size_t size = sizeof(header) + header.length;
+				if (src.size() < size)
+					/* need more data */
+					break;
+
+				handler.OnTranslateExtension(header.command,
+							     src.subspan(sizeof(header),
+									 header.length));
+				if (want_raw)
+					handler.OnTranslateRawResponse(src.first(size));
+
+				src = src.subspan(size);
+				socket.DisposeConsumed(size);
+				continue;
+			}
+
+			packet_remaining = sizeof(header) + header.length;
+		}
+
+		size_t nbytes = parser.Feed(src.first(std::min(src.size(),
+								packet_remaining)));
 		if (nbytes == 0)
 			/* need more data */
 			break;
 
+		packet_remaining -= nbytes;
+
+		if (want_raw)
+			handler.OnTranslateRawResponse(src.first(nbytes));
+
 		src = src.subspan(nbytes);
 		socket.DisposeConsumed(nbytes);
 
@@ -223,7 +273,8 @@ TranslateClient::TranslateClient(AllocatorPtr alloc, EventLoop &event_loop,
 	 request(std::move(_request)),
 	 handler(_handler),
 	 response(UniquePoolPtr<TranslateResponse>::Make(alloc.GetPool())),
-	 parser(alloc, request2, *response)
+	 parser(alloc, request2, *response),
+	 want_raw(handler.WantTranslateRawResponse())
 {
 	socket.Init(fd, FdType::FD_SOCKET, write_timeout, *this);
 
@@ -250,7 +301,7 @@ try {
 	       (request.content_type_lookup.data() != nullptr &&
 		request.suffix != nullptr));
 
-	GrowingBuffer gb = MarshalTranslateRequest(PROTOCOL_VERSION,
+	GrowingBuffer gb = MarshalTranslateRequest(TRANSLATION_PROTOCOL_VERSION,
 						   request);
 
 	alloc.New<TranslateClient>(alloc, event_loop,
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Response packets which are not known to #TranslateParser.  The
+ * translation clients remove them from the response before it gets
+ * parsed and pass them to TranslateHandler::OnTranslateExtension().
+ * The command numbers 0xf000..0xf0ff are reserved for such
+ * extensions (see also Multiplex.hxx).
+ *
+ * An extension packet is always received as a whole, therefore its
+ * payload is limited to #MAX_TRANSLATION_EXTENSION_PAYLOAD.
+ */
+
+#pragma once
+
+#include "translation/Handler.hxx"
+#include "translation/Protocol.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+/**
+ * Allows the #WidgetFragmentCache to store the rendered output of
+ * widgets of this class (only in the response to a WIDGET_TYPE
+ * request).  Payload: the maximum age in seconds (32 bit unsigned
+ * integer, host byte order, not zero).
+ */
+inline constexpr TranslationCommand TRANSLATE_WIDGET_FRAGMENT_CACHE{0xf003};
+
+static constexpr std::size_t MAX_TRANSLATION_EXTENSION_PAYLOAD = 1024;
+
+/**
+ * The upper limit for #TRANSLATE_WIDGET_FRAGMENT_CACHE.
+ */
+static constexpr std::chrono::seconds MAX_WIDGET_FRAGMENT_MAX_AGE = std::chrono::hours(24);
+
+constexpr bool
+IsTranslationExtension(TranslationCommand command) noexcept
+{
+	return unsigned(command) >= 0xf000 && unsigned(command) < 0xf100;
+}
+
+/**
+ * Invoke TranslateHandler::OnTranslateExtension() for each packet
+ * in the buffer (which contains complete extension packets, as
+ * collected from earlier responses).
+ */
+inline void
+TranslateInvokeExtensions(TranslateHandler &handler,
+			  std::span<const std::byte> src) noexcept
+{
+	while (src.size() >= sizeof(TranslationHeader)) {
+		TranslationHeader header;
+		std::memcpy(&header, src.data(), sizeof(header));
+		src = src.subspan(sizeof(header));
+
+		if (src.size() < header.length)
+			break;
+
+		handler.OnTranslateExtension(header.command,
+					     src.first(header.length));
+		src = src.subspan(header.length);
+	}
+}
+
+/**
+ * Parse the payload of #TRANSLATE_WIDGET_FRAGMENT_CACHE.
+ *
+ * Throws std::runtime_error on error.
+ */
+inline std::chrono::seconds
+ParseWidgetFragmentCache(std::span<const std::byte> payload)
+{
+	uint32_t value;
+	if (payload.size() != sizeof(value))
+		throw std::runtime_error("Malformed WIDGET_FRAGMENT_CACHE packet");
+
+	std::memcpy(&value, payload.data(), sizeof(value));
+	if (value == 0)
+		throw std::runtime_error("Malformed WIDGET_FRAGMENT_CACHE packet");
+
+	return std::min(std::chrono::seconds{value},
+			MAX_WIDGET_FRAGMENT_MAX_AGE);
+}
@@ -15,6 +15,7 @@
 #include "lib/fmt/SystemError.hxx"
 #include "net/ConnectSocket.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
+#include "event/Loop.hxx"
 #include "event/SocketEvent.hxx"
 #include "io/Logger.hxx"
 #include "util/Cancellable.hxx"
@@ -114,6 +115,68 @@ TranslationGlue::Request::OnStockItemError(std::exception_ptr ep) noexcept
 	_handler.OnTranslateError(ep);
 }
 
+TranslationMultiplexClient *
+TranslationGlue::GetMultiplexClient() noexcept
+{
+	switch (multiplex_state) {
+	case MultiplexState::DISABLED:
+	case MultiplexState::PROBING:
+		break;
+
+	case MultiplexState::UNKNOWN:
+		if (GetEventLoop().SteadyNow() < next_probe)
+			break;
+
+		if (!multiplex)
+			multiplex.emplace(GetEventLoop(), *this);
+
+		try {
+			multiplex->Probe();
+			multiplex_state = MultiplexState::PROBING;
+		} catch (...) {
+			/* the translation server is not reachable;
+			   try again later */
+			next_probe = GetEventLoop().SteadyNow() + multiplex_probe_backoff;
+		}
+
+		break;
+
+	case MultiplexState::ENABLED:
+		return &*multiplex;
+	}
+
+	return nullptr;
+}
+
+UniqueSocketDescriptor
+TranslationGlue::OnTranslationMultiplexConnect()
+{
+	return CreateConnectSocketNonBlock(stock.GetAddress(), SOCK_STREAM);
+}
+
+void
+TranslationGlue::OnTranslationMultiplexProbe(bool supported) noexcept
+{
+	multiplex_state = supported
+		? MultiplexState::ENABLED
+		: MultiplexState::DISABLED;
+}
+
+void
+TranslationGlue::OnTranslationMultiplexDisconnect(std::exception_ptr error) noexcept
+{
+	/* the translation server may have been replaced by one which
+	   does not support multiplexing; probe again before the next
+	   request is sent over a shared connection.  Only an explicit
+	   answer disables multiplexing; after an error (e.g. the
+	   server is restarting), wait a while and use the
+	   TranslationStock meanwhile */
+	multiplex_state = MultiplexState::UNKNOWN;
+
+	if (error)
+		next_probe = GetEventLoop().SteadyNow() + multiplex_probe_backoff;
+}
+
 void
 TranslationGlue::SendRequest(AllocatorPtr alloc,
 			      const TranslateRequest &request,
@@ -121,6 +184,14 @@ TranslationGlue::SendRequest(AllocatorPtr alloc,
 			      TranslateHandler &handler,
 			      CancellablePointer &cancel_ptr) noexcept
 {
+	if (auto *m = GetMultiplexClient()) {
+		m->SendRequest(alloc,
+			       StopwatchPtr{parent_stopwatch, "translate",
+					    request.GetDiagnosticName()},
+			       request, handler, cancel_ptr);
+		return;
+	}
+
 	auto r = alloc.New<Request>(alloc, request,
 				    parent_stopwatch,
 				    handler, cancel_ptr);
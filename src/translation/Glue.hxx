@@ -6,18 +6,71 @@
 
 #include "Service.hxx"
 #include "Stock.hxx"
+#include "MClient.hxx"
+#include "event/Chrono.hxx"
+
+#include <cstdint>
+#include <optional>
 
 struct TranslateRequest;
 class TranslateHandler;
 
-class TranslationGlue final : public TranslationService {
+/**
+ * Sends translation requests over connections from a
+ * #TranslationStock, one request per connection at a time.  If
+ * enabled, it asks the translation server whether it supports
+ * multiplexing, and if so, all requests share one connection (see
+ * #TranslationMultiplexClient).
+ */
+class TranslationGlue final
+	: public TranslationService, TranslationMultiplexClientHandler
+{
 	class Request;
 
 	TranslationStock stock;
 
+	std::optional<TranslationMultiplexClient> multiplex;
+
+	enum class MultiplexState : uint_least8_t {
+		/**
+		 * Multiplexing is disabled in the configuration, or
+		 * the translation server does not support it.
+		 */
+		DISABLED,
+
+		/**
+		 * Not yet known whether the translation server
+		 * supports multiplexing.
+		 */
+		UNKNOWN,
+
+		/**
+		 * Waiting for the answer to #TRANSLATE_MULTIPLEX.
+		 */
+		PROBING,
+
+		ENABLED,
+	} multiplex_state;
+
+	/**
+	 * How long to wait before probing again after the probe or
+	 * the multiplexed connection has failed.
+	 */
+	static constexpr Event::Duration multiplex_probe_backoff = std::chrono::seconds(10);
+
+	/**
+	 * In state #MultiplexState::UNKNOWN, don't probe before this
+	 * time.
+	 */
+	Event::TimePoint next_probe{};
+
 public:
-	TranslationGlue(EventLoop &event_loop, SocketAddress _address, unsigned limit) noexcept
-		:stock(event_loop, _address, limit) {}
+	TranslationGlue(EventLoop &event_loop, SocketAddress _address, unsigned limit,
+			bool _multiplex=false) noexcept
+		:stock(event_loop, _address, limit),
+		 multiplex_state(_multiplex
+				 ? MultiplexState::UNKNOWN
+				 : MultiplexState::DISABLED) {}
 
 	auto &GetEventLoop() const noexcept {
 		return stock.GetEventLoop();
@@ -29,4 +82,17 @@ public:
 			 const StopwatchPtr &parent_stopwatch,
 			 TranslateHandler &handler,
 			 CancellablePointer &cancel_ptr) noexcept override;
+
+private:
+	/**
+	 * Returns the shared connection if the translation server
+	 * supports multiplexing, nullptr otherwise (or if that is
+	 * not yet known).  The first call starts probing.
+	 */
+	TranslationMultiplexClient *GetMultiplexClient() noexcept;
+
+	/* virtual methods from class TranslationMultiplexClientHandler */
+	UniqueSocketDescriptor OnTranslationMultiplexConnect() override;
+	void OnTranslationMultiplexProbe(bool supported) noexcept override;
+	void OnTranslationMultiplexDisconnect(std::exception_ptr error) noexcept override;
 };
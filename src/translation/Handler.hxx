@@ -5,8 +5,11 @@
 #pragma once
 
 #include "pool/UniquePtr.hxx"
+#include "translation/Protocol.hxx"
 
+#include <cstddef>
 #include <exception>
+#include <span>
 
 struct TranslateResponse;
 
@@ -14,4 +17,29 @@ class TranslateHandler {
 public:
 	virtual void OnTranslateResponse(UniquePoolPtr<TranslateResponse> response) noexcept = 0;
 	virtual void OnTranslateError(std::exception_ptr error) noexcept = 0;
+
+	/**
+	 * Does this handler want to see the raw response packets
+	 * (see OnTranslateRawResponse())?  This is only checked
+	 * once, before the response is received.
+	 */
+	virtual bool WantTranslateRawResponse() const noexcept {
+		return false;
+	}
+
+	/**
+	 * Receives a chunk of the raw response (BEGIN to END, as sent
+	 * by the translation server) before OnTranslateResponse() is
+	 * invoked.  Packets which belong to the transport (e.g.
+	 * #TRANSLATE_REQUEST_ID) are omitted, but extension packets
+	 * (see Extension.hxx) are included.
+	 */
+	virtual void OnTranslateRawResponse([[maybe_unused]] std::span<const std::byte> src) noexcept {}
+
+	/**
+	 * Receives a response packet of a protocol extension (see
+	 * Extension.hxx) before OnTranslateResponse() is invoked.
+	 */
+	virtual void OnTranslateExtension([[maybe_unused]] TranslationCommand command,
+					  [[maybe_unused]] std::span<const std::byte> payload) noexcept {}
 };
@@ -0,0 +1,652 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "MClient.hxx"
+#include "Marshal.hxx"
+#include "Extension.hxx"
+#include "translation/Parser.hxx"
+#include "translation/Request.hxx"
+#include "translation/Response.hxx"
+#include "translation/Handler.hxx"
+#include "event/Loop.hxx"
+#include "memory/fb_pool.hxx"
+#include "net/SocketError.hxx"
+#include "net/SocketProtocolError.hxx"
+#include "net/TimeoutError.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "pool/pool.hxx"
+#include "util/Cancellable.hxx"
+#include "util/Exception.hxx"
+#include "AllocatorPtr.hxx"
+#include "stopwatch.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/socket.h>
+
+static constexpr Event::Duration translation_multiplex_timeout = std::chrono::minutes(2);
+static constexpr Event::Duration translation_probe_timeout = std::chrono::seconds(10);
+
+/**
+ * The largest BEGIN payload we accept in a multiplexed response.  It
+ * contains only the protocol version, and this limit ensures that
+ * BEGIN and #TRANSLATE_REQUEST_ID always fit into the input buffer.
+ */
+static constexpr std::size_t max_begin_payload = 256;
+
+class TranslationMultiplexClient::Request final
+	: Cancellable, public IntrusiveListHook<IntrusiveHookMode::NORMAL>
+{
+	TranslationMultiplexClient &client;
+
+	const StopwatchPtr stopwatch;
+
+	TranslateHandler &handler;
+
+	UniquePoolPtr<TranslateResponse> response;
+
+	TranslateParser parser;
+
+	/**
+	 * Copy of TranslateHandler::WantTranslateRawResponse().
+	 */
+	const bool want_raw;
+
+public:
+	const TranslationRequestId id;
+
+	/**
+	 * When this request times out.
+	 */
+	const Event::TimePoint deadline;
+
+	Request(TranslationMultiplexClient &_client, AllocatorPtr alloc,
+		StopwatchPtr &&_stopwatch,
+		const TranslateRequest &request,
+		TranslateHandler &_handler,
+		CancellablePointer &cancel_ptr,
+		TranslationRequestId _id) noexcept
+		:client(_client),
+		 stopwatch(std::move(_stopwatch)),
+		 handler(_handler),
+		 response(UniquePoolPtr<TranslateResponse>::Make(alloc.GetPool())),
+		 parser(alloc, request, *response),
+		 want_raw(handler.WantTranslateRawResponse()),
+		 id(_id),
+		 deadline(client.GetEventLoop().SteadyNow() + translation_multiplex_timeout)
+	{
+		cancel_ptr = *this;
+	}
+
+	/**
+	 * Pass response data to the parser.
+	 *
+	 * @return the number of bytes consumed (0 if more data is
+	 * needed)
+	 */
+	std::size_t Feed(std::span<const std::byte> src) {
+		const std::size_t nbytes = parser.Feed(src);
+		if (want_raw && nbytes > 0)
+			handler.OnTranslateRawResponse(src.first(nbytes));
+		return nbytes;
+	}
+
+	/**
+	 * Pass a complete extension packet (see Extension.hxx) to the
+	 * handler, bypassing the parser.
+	 */
+	void Extension(TranslationCommand command,
+		       std::span<const std::byte> packet) noexcept {
+		handler.OnTranslateExtension(command,
+					     packet.subspan(sizeof(TranslationHeader)));
+		if (want_raw)
+			handler.OnTranslateRawResponse(packet);
+	}
+
+	/**
+	 * Throws on error.
+	 */
+	TranslateParser::Result Process() {
+		return parser.Process();
+	}
+
+	/**
+	 * Submit the response to the handler and destroy this
+	 * object.  The caller must have removed it from the list.
+	 */
+	void Finish() noexcept {
+		stopwatch.RecordEvent("response");
+
+		auto &_handler = handler;
+		auto _response = std::move(response);
+		Destroy();
+		_handler.OnTranslateResponse(std::move(_response));
+	}
+
+	/**
+	 * Submit the error to the handler and destroy this object.
+	 * The caller must have removed it from the list.
+	 */
+	void Abort(std::exception_ptr error) noexcept {
+		stopwatch.RecordEvent("error");
+
+		auto &_handler = handler;
+		Destroy();
+		_handler.OnTranslateError(std::move(error));
+	}
+
+private:
+	void Destroy() noexcept {
+		this->~Request();
+	}
+
+	/* virtual methods from class Cancellable */
+	void Cancel() noexcept override {
+		stopwatch.RecordEvent("cancel");
+		client.CancelRequest(*this);
+		Destroy();
+	}
+};
+
+TranslationMultiplexClient::TranslationMultiplexClient(EventLoop &event_loop,
+						       TranslationMultiplexClientHandler &_handler) noexcept
+	:handler(_handler),
+	 socket(event_loop, BIND_THIS_METHOD(OnSocketReady)),
+	 timeout_event(event_loop, BIND_THIS_METHOD(OnTimeout)),
+	 defer_write(event_loop, BIND_THIS_METHOD(OnDeferredWrite))
+{
+}
+
+TranslationMultiplexClient::~TranslationMultiplexClient() noexcept
+{
+	/* all callers must have canceled their requests */
+	assert(requests.empty());
+
+	Disconnect();
+}
+
+void
+TranslationMultiplexClient::Connect()
+{
+	assert(!socket.IsDefined());
+
+	socket.Open(handler.OnTranslationMultiplexConnect().Release());
+	socket.ScheduleRead();
+}
+
+void
+TranslationMultiplexClient::Disconnect() noexcept
+{
+	timeout_event.Cancel();
+	defer_write.Cancel();
+
+	if (socket.IsDefined())
+		socket.Close();
+
+	input.FreeIfDefined();
+	output.Clear();
+	current = nullptr;
+	packet_remaining = 0;
+	probing = false;
+	probe_supported = false;
+	discarding = false;
+}
+
+void
+TranslationMultiplexClient::Fail(std::exception_ptr error) noexcept
+{
+	const DestructObserver destructed{*this};
+
+	Disconnect();
+
+	handler.OnTranslationMultiplexDisconnect(error);
+	if (destructed)
+		return;
+
+	AbortAllRequests(std::move(error));
+}
+
+void
+TranslationMultiplexClient::AbortAllRequests(std::exception_ptr error) noexcept
+{
+	const DestructObserver destructed{*this};
+
+	while (!requests.empty()) {
+		auto &request = requests.front();
+		RemoveRequest(request);
+		request.Abort(error);
+		if (destructed)
+			return;
+	}
+}
+
+TranslationMultiplexClient::Request *
+TranslationMultiplexClient::FindRequest(TranslationRequestId id) noexcept
+{
+	for (auto &i : requests)
+		if (i.id == id)
+			return &i;
+
+	return nullptr;
+}
+
+TranslationRequestId
+TranslationMultiplexClient::NextRequestId() noexcept
+{
+	/* ids of canceled requests are not reused until the counter
+	   wraps around, so a late response to a canceled request
+	   cannot be mistaken for the response to a new one */
+
+	do {
+		++last_request_id;
+	} while (last_request_id == 0 || FindRequest(last_request_id) != nullptr);
+
+	return last_request_id;
+}
+
+void
+TranslationMultiplexClient::RemoveRequest(Request &request) noexcept
+{
+	if (current == &request)
+		current = nullptr;
+
+	const bool was_oldest = &request == &requests.front();
+	requests.erase(requests.iterator_to(request));
+
+	if (was_oldest && !probing)
+		ScheduleTimeout();
+}
+
+void
+TranslationMultiplexClient::CancelRequest(Request &request) noexcept
+{
+	if (current == &request)
+		/* ignore the rest of this response */
+		discarding = true;
+
+	RemoveRequest(request);
+
+	if (!socket.IsDefined())
+		return;
+
+	TranslationMarshaller m;
+	m.WriteT(TRANSLATE_CANCEL, request.id);
+	output.AppendMoveFrom(m.Commit());
+	defer_write.Schedule();
+}
+
+void
+TranslationMultiplexClient::ScheduleTimeout() noexcept
+{
+	if (probing)
+		timeout_event.Schedule(translation_probe_timeout);
+	else if (requests.empty())
+		timeout_event.Cancel();
+	else
+		/* the list is ordered by deadline */
+		timeout_event.Schedule(std::max(requests.front().deadline - GetEventLoop().SteadyNow(),
+						Event::Duration::zero()));
+}
+
+void
+TranslationMultiplexClient::ExpireRequests() noexcept
+{
+	const DestructObserver destructed{*this};
+	const auto now = GetEventLoop().SteadyNow();
+
+	while (!requests.empty() && requests.front().deadline <= now) {
+		auto &request = requests.front();
+
+		/* the server may still send the response; it will be
+		   discarded */
+		CancelRequest(request);
+
+		request.Abort(NestException(std::make_exception_ptr(TimeoutError{}),
+					    std::runtime_error("Translation server timed out")));
+		if (destructed)
+			return;
+	}
+
+	ScheduleTimeout();
+}
+
+bool
+TranslationMultiplexClient::Flush() noexcept
+{
+	while (!output.IsEmpty()) {
+		const auto r = output.Read();
+		const auto nbytes = socket.GetSocket().Send(r, MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (nbytes < 0) {
+			const auto e = GetSocketError();
+			if (IsSocketErrorSendWouldBlock(e)) {
+				socket.ScheduleWrite();
+				return true;
+			}
+
+			Fail(NestException(std::make_exception_ptr(MakeSocketError(e, "Send failed")),
+					   std::runtime_error("Translation server connection failed")));
+			return false;
+		}
+
+		output.Consume(nbytes);
+
+		if (std::cmp_less(nbytes, r.size())) {
+			socket.ScheduleWrite();
+			return true;
+		}
+	}
+
+	socket.CancelWrite();
+	return true;
+}
+
+void
+TranslationMultiplexClient::TryRead() noexcept
+{
+	input.AllocateIfNull(fb_pool_get());
+
+	const auto w = input.Write();
+	if (w.empty()) {
+		/* the parser was unable to consume anything from a
+		   full buffer */
+		Fail(std::make_exception_ptr(SocketProtocolError{"Translation response packet too large"}));
+		return;
+	}
+
+	const auto nbytes = socket.GetSocket().Receive(w, MSG_DONTWAIT);
+	if (nbytes < 0) {
+		const auto e = GetSocketError();
+		if (IsSocketErrorReceiveWouldBlock(e)) {
+			input.FreeIfEmpty();
+			return;
+		}
+
+		Fail(NestException(std::make_exception_ptr(MakeSocketError(e, "Receive failed")),
+				   std::runtime_error("Translation server connection failed")));
+		return;
+	}
+
+	if (nbytes == 0) {
+		if (!probing && requests.empty()) {
+			/* the server has closed the idle connection; the
+			   next request will reconnect and probe again */
+			Disconnect();
+			handler.OnTranslationMultiplexDisconnect({});
+			return;
+		}
+
+		Fail(NestException(std::make_exception_ptr(SocketClosedPrematurelyError{}),
+				   std::runtime_error("Translation server connection failed")));
+		return;
+	}
+
+	input.Append(nbytes);
+
+	try {
+		if (!ParseInput())
+			return;
+	} catch (...) {
+		Fail(std::current_exception());
+		return;
+	}
+
+	input.FreeIfEmpty();
+}
+
+bool
+TranslationMultiplexClient::ParseResponseStart(std::span<const std::byte> src)
+{
+	assert(current == nullptr);
+	assert(packet_remaining == 0);
+
+	TranslationHeader begin;
+	std::memcpy(&begin, src.data(), sizeof(begin));
+
+	if (begin.command != TranslationCommand::BEGIN ||
+	    begin.length > max_begin_payload)
+		throw SocketProtocolError{"Malformed multiplexed translation response"};
+
+	const std::size_t begin_size = sizeof(begin) + begin.length;
+
+	TranslationHeader id_header;
+	TranslationRequestId id;
+	if (src.size() < begin_size + sizeof(id_header) + sizeof(id))
+		return false;
+
+	std::memcpy(&id_header, src.data() + begin_size, sizeof(id_header));
+	if (id_header.command != TRANSLATE_REQUEST_ID ||
+	    id_header.length != sizeof(id))
+		throw SocketProtocolError{"REQUEST_ID missing in multiplexed translation response"};
+
+	std::memcpy(&id, src.data() + begin_size + sizeof(id_header), sizeof(id));
+
+	if (auto *request = FindRequest(id)) {
+		/* pass BEGIN to the request's parser, but omit
+		   REQUEST_ID, which is not part of the response */
+		for (auto b = src.first(begin_size); !b.empty();) {
+			const std::size_t nbytes = request->Feed(b);
+			if (nbytes == 0)
+				throw SocketProtocolError{"Malformed multiplexed translation response"};
+
+			b = b.subspan(nbytes);
+			request->Process();
+		}
+
+		current = request;
+	} else
+		/* unknown (or canceled) request */
+		discarding = true;
+
+	input.Consume(begin_size + sizeof(id_header) + sizeof(id));
+	return true;
+}
+
+bool
+TranslationMultiplexClient::ParseInput()
+{
+	const DestructObserver destructed{*this};
+
+	while (true) {
+		const auto r = input.Read();
+		if (r.empty())
+			break;
+
+		if (packet_remaining == 0) {
+			TranslationHeader header;
+			if (r.size() < sizeof(header))
+				break;
+
+			if (current == nullptr && !discarding && !probing) {
+				if (!ParseResponseStart(r))
+					break;
+
+				continue;
+			}
+
+			std::memcpy(&header, r.data(), sizeof(header));
+
+			if (current != nullptr &&
+			    IsTranslationExtension(header.command)) {
+				/* the parser doesn't know this packet */
+				if (header.length > MAX_TRANSLATION_EXTENSION_PAYLOAD)
+					throw SocketProtocolError{"Translation extension packet too large"};
+
+				const std::size_t size = sizeof(header) + header.length;
+				if (r.size() < size)
+					break;
+
+				current->Extension(header.command, r.first(size));
+				input.Consume(size);
+				continue;
+			}
+
+			packet_command = header.command;
+			packet_remaining = sizeof(header) + header.length;
+
+			if (probing && packet_command == TRANSLATE_MULTIPLEX)
+				probe_supported = true;
+		}
+
+		const auto src = r.first(std::min(r.size(), packet_remaining));
+
+		if (current == nullptr) {
+			/* skip this packet */
+			input.Consume(src.size());
+			packet_remaining -= src.size();
+
+			if (packet_remaining == 0 &&
+			    packet_command == TranslationCommand::END) {
+				if (probing) {
+					OnProbeResult();
+					if (destructed || !socket.IsDefined())
+						return false;
+				} else
+					discarding = false;
+			}
+
+			continue;
+		}
+
+		auto &request = *current;
+
+		const std::size_t nbytes = request.Feed(src);
+		if (nbytes == 0)
+			/* need more data */
+			break;
+
+		input.Consume(nbytes);
+		packet_remaining -= nbytes;
+
+		TranslateParser::Result result;
+
+		try {
+			result = request.Process();
+		} catch (...) {
+			/* the response is malformed, but the stream
+			   is still intact: fail only this request and
+			   skip the rest of its response */
+			discarding = packet_remaining > 0 ||
+				packet_command != TranslationCommand::END;
+			RemoveRequest(request);
+			request.Abort(std::current_exception());
+			if (destructed)
+				return false;
+
+			continue;
+		}
+
+		if (result == TranslateParser::Result::DONE) {
+			if (packet_remaining > 0)
+				throw SocketProtocolError{"Malformed multiplexed translation response"};
+
+			RemoveRequest(request);
+			request.Finish();
+			if (destructed)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+inline void
+TranslationMultiplexClient::OnProbeResult() noexcept
+{
+	assert(probing);
+
+	probing = false;
+
+	const bool supported = probe_supported;
+
+	if (supported) {
+		if (requests.empty())
+			timeout_event.Cancel();
+	} else
+		Disconnect();
+
+	handler.OnTranslationMultiplexProbe(supported);
+}
+
+void
+TranslationMultiplexClient::OnSocketReady(unsigned events) noexcept
+{
+	if (events & SocketEvent::WRITE) {
+		const DestructObserver destructed{*this};
+		Flush();
+		if (destructed || !socket.IsDefined())
+			return;
+	}
+
+	if (events & (SocketEvent::READ|SocketEvent::ERROR|SocketEvent::HANGUP))
+		TryRead();
+}
+
+void
+TranslationMultiplexClient::OnTimeout() noexcept
+{
+	if (probing) {
+		Fail(NestException(std::make_exception_ptr(TimeoutError{}),
+				   std::runtime_error("Translation server timed out")));
+		return;
+	}
+
+	/* time out only the requests which have waited too long; the
+	   connection may still be healthy (e.g. if the server takes
+	   long for one particular request) */
+	ExpireRequests();
+}
+
+void
+TranslationMultiplexClient::Probe()
+{
+	assert(!socket.IsDefined());
+	assert(!probing);
+
+	Connect();
+	probing = true;
+
+	TranslationMarshaller m;
+	m.WriteT(TranslationCommand::BEGIN, TRANSLATION_PROTOCOL_VERSION);
+	m.Write(TRANSLATE_MULTIPLEX);
+	m.Write(TranslationCommand::END);
+	output.AppendMoveFrom(m.Commit());
+
+	ScheduleTimeout();
+	defer_write.Schedule();
+}
+
+void
+TranslationMultiplexClient::SendRequest(AllocatorPtr alloc,
+					StopwatchPtr stopwatch,
+					const TranslateRequest &request,
+					TranslateHandler &_handler,
+					CancellablePointer &cancel_ptr) noexcept
+{
+	assert(!probing);
+	assert(socket.IsDefined());
+
+	const auto id = NextRequestId();
+
+	try {
+		output.AppendMoveFrom(MarshalTranslateRequest(TRANSLATION_PROTOCOL_VERSION,
+							      request, id));
+	} catch (...) {
+		stopwatch.RecordEvent("error");
+		_handler.OnTranslateError(std::current_exception());
+		return;
+	}
+
+	auto *r = alloc.New<Request>(*this, alloc, std::move(stopwatch),
+				     request, _handler, cancel_ptr, id);
+	requests.push_back(*r);
+
+	if (requests.size() == 1)
+		ScheduleTimeout();
+
+	defer_write.Schedule();
+}
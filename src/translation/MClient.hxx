@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "Multiplex.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "memory/GrowingBuffer.hxx"
+#include "memory/SliceFifoBuffer.hxx"
+#include "util/DestructObserver.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <cstddef>
+#include <exception>
+#include <span>
+
+class AllocatorPtr;
+class UniqueSocketDescriptor;
+class CancellablePointer;
+class StopwatchPtr;
+class EventLoop;
+struct TranslateRequest;
+class TranslateHandler;
+
+class TranslationMultiplexClientHandler {
+public:
+	/**
+	 * Open a new socket to the translation server.
+	 *
+	 * Throws on error.
+	 */
+	virtual UniqueSocketDescriptor OnTranslationMultiplexConnect() = 0;
+
+	/**
+	 * The translation server has answered the
+	 * #TRANSLATE_MULTIPLEX probe.  If multiplexing is not
+	 * supported, the connection has been closed and
+	 * SendRequest() must not be called.
+	 */
+	virtual void OnTranslationMultiplexProbe(bool supported) noexcept = 0;
+
+	/**
+	 * The connection has been closed, either because of an error
+	 * (including a failed or timed out probe) or because the
+	 * translation server has closed the idle connection.
+	 * Pending requests are about to be aborted.  Probe() must be
+	 * called again before the next SendRequest() call.
+	 *
+	 * @param error the error; nullptr if the server has closed
+	 * the idle connection
+	 */
+	virtual void OnTranslationMultiplexDisconnect(std::exception_ptr error) noexcept = 0;
+};
+
+/**
+ * A connection to a translation server which supports the
+ * multiplexing protocol extension (see Multiplex.hxx).  Any number of
+ * concurrent requests are sent over this one connection, and the
+ * responses are routed to the request they belong to by their
+ * #TRANSLATE_REQUEST_ID.
+ *
+ * Call Probe() first to find out whether the server supports
+ * multiplexing; SendRequest() may only be called after a successful
+ * probe.  When the connection gets closed, the handler is notified,
+ * and the next connection needs to be probed again (the server may
+ * have been replaced by one which does not support multiplexing).
+ */
+class TranslationMultiplexClient final : DestructAnchor {
+	TranslationMultiplexClientHandler &handler;
+
+	SocketEvent socket;
+
+	/**
+	 * Fires when the probe or the oldest pending request times
+	 * out.  Each request has its own deadline, so a busy
+	 * connection cannot postpone the timeout of a request whose
+	 * response never arrives.
+	 */
+	CoarseTimerEvent timeout_event;
+
+	/**
+	 * Sends the output buffer.  Deferred, so all requests
+	 * submitted in one event loop iteration are sent with one
+	 * system call.
+	 */
+	DeferEvent defer_write;
+
+	SliceFifoBuffer input;
+
+	GrowingBuffer output;
+
+	class Request;
+	using RequestList = IntrusiveList<
+		Request,
+		IntrusiveListBaseHookTraits<Request>,
+		IntrusiveListOptions{.constant_time_size = true}>;
+
+	/**
+	 * All requests whose response has not yet been received.
+	 * Canceled requests are removed immediately.
+	 */
+	RequestList requests;
+
+	/**
+	 * The request the current response belongs to, or nullptr.
+	 */
+	Request *current = nullptr;
+
+	/**
+	 * The number of bytes of the current packet (including its
+	 * header) which have not yet been consumed; 0 at a packet
+	 * boundary.
+	 */
+	std::size_t packet_remaining = 0;
+
+	TranslationRequestId last_request_id = 0;
+
+	/**
+	 * The command of the current packet.
+	 */
+	TranslationCommand packet_command{};
+
+	/**
+	 * Are we waiting for the answer to our #TRANSLATE_MULTIPLEX
+	 * probe?
+	 */
+	bool probing = false;
+
+	/**
+	 * Has the probe response contained #TRANSLATE_MULTIPLEX?
+	 */
+	bool probe_supported = false;
+
+	/**
+	 * Is the rest of the current response discarded (because
+	 * its request has been canceled)?
+	 */
+	bool discarding = false;
+
+public:
+	TranslationMultiplexClient(EventLoop &event_loop,
+				   TranslationMultiplexClientHandler &_handler) noexcept;
+
+	~TranslationMultiplexClient() noexcept;
+
+	TranslationMultiplexClient(const TranslationMultiplexClient &) = delete;
+	TranslationMultiplexClient &operator=(const TranslationMultiplexClient &) = delete;
+
+	auto &GetEventLoop() const noexcept {
+		return socket.GetEventLoop();
+	}
+
+	bool IsConnected() const noexcept {
+		return socket.IsDefined();
+	}
+
+	/**
+	 * Connect to the translation server and ask whether it
+	 * supports multiplexing.  The answer will be delivered to
+	 * TranslationMultiplexClientHandler::OnTranslationMultiplexProbe().
+	 *
+	 * Throws on error.
+	 */
+	void Probe();
+
+	/**
+	 * Send a request to the translation server.  The parameters
+	 * are the same as for translate().  This requires a
+	 * successful Probe() on the current connection.
+	 */
+	void SendRequest(AllocatorPtr alloc, StopwatchPtr stopwatch,
+			 const TranslateRequest &request,
+			 TranslateHandler &handler,
+			 CancellablePointer &cancel_ptr) noexcept;
+
+private:
+	/**
+	 * Throws on error.
+	 */
+	void Connect();
+
+	void Disconnect() noexcept;
+
+	/**
+	 * Close the socket and abort all requests.  This object may
+	 * have been destroyed when this method returns.
+	 */
+	void Fail(std::exception_ptr error) noexcept;
+
+	void AbortAllRequests(std::exception_ptr error) noexcept;
+
+	[[gnu::pure]]
+	Request *FindRequest(TranslationRequestId id) noexcept;
+
+	TranslationRequestId NextRequestId() noexcept;
+
+	void RemoveRequest(Request &request) noexcept;
+
+	/**
+	 * Called by the #Request when the caller cancels it.
+	 */
+	void CancelRequest(Request &request) noexcept;
+
+	/**
+	 * Schedule #timeout_event for the probe or for the oldest
+	 * pending request (or cancel it if there is none).
+	 */
+	void ScheduleTimeout() noexcept;
+
+	/**
+	 * Abort all requests whose deadline has passed.
+	 */
+	void ExpireRequests() noexcept;
+
+	/**
+	 * Send the output buffer to the socket.
+	 *
+	 * @return false if this object has been destroyed
+	 */
+	bool Flush() noexcept;
+
+	void TryRead() noexcept;
+
+	/**
+	 * Throws on protocol error.
+	 *
+	 * @return false if this object has been destroyed or the
+	 * connection has been closed
+	 */
+	bool ParseInput();
+
+	/**
+	 * Parse the BEGIN and #TRANSLATE_REQUEST_ID packets at the
+	 * start of a response.
+	 *
+	 * Throws on protocol error.
+	 *
+	 * @return false if more data is needed
+	 */
+	bool ParseResponseStart(std::span<const std::byte> src);
+
+	void OnProbeResult() noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+	void OnTimeout() noexcept;
+
+	void OnDeferredWrite() noexcept {
+		Flush();
+	}
+};
@@ -16,6 +16,11 @@ enum class TranslationCommand : uint16_t;
 struct TranslateRequest;
 class SocketAddress;
 
+/**
+ * The translation protocol version implemented by this client.
+ */
+static constexpr uint8_t TRANSLATION_PROTOCOL_VERSION = 3;
+
 class TranslationMarshaller {
 	GrowingBuffer buffer;
 
@@ -67,6 +72,11 @@ public:
 	}
 };
 
+/**
+ * @param request_id if non-zero, then a #TRANSLATE_REQUEST_ID packet
+ * is added (see Multiplex.hxx)
+ */
 GrowingBuffer
 MarshalTranslateRequest(uint8_t PROTOCOL_VERSION,
-			const TranslateRequest &request);
+			const TranslateRequest &request,
+			uint32_t request_id=0);
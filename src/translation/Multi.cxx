@@ -6,9 +6,12 @@
 #include "pool/LeakDetector.hxx"
 #include "translation/Response.hxx"
 #include "translation/Handler.hxx"
+#include "translation/Extension.hxx"
 #include "util/Cancellable.hxx"
 #include "AllocatorPtr.hxx"
 
+#include <vector>
+
 class MultiTranslationService::Request final
 	: PoolLeakDetector, TranslateHandler, Cancellable {
 
@@ -22,6 +25,13 @@ class MultiTranslationService::Request final
 
 	CancellablePointer cancel_ptr;
 
+	/**
+	 * Extension packets (see Extension.hxx) of the current
+	 * response.  They are submitted to the handler only after it
+	 * is known that the response was not deferred.
+	 */
+	std::vector<std::byte> extensions;
+
 public:
 	Request(AllocatorPtr _alloc, const TranslateRequest &_request,
 		const StopwatchPtr &_parent_stopwatch,
@@ -42,6 +52,7 @@ public:
 	}
 
 	void Start() noexcept {
+		extensions.clear();
 		(*i)->SendRequest(alloc, request, parent_stopwatch,
 				  *this, cancel_ptr);
 	}
@@ -54,6 +65,17 @@ private:
 	}
 
 	/* virtual methods from TranslateHandler */
+	void OnTranslateExtension(TranslationCommand command,
+				  std::span<const std::byte> payload) noexcept override {
+		TranslationHeader header;
+		header.length = payload.size();
+		header.command = command;
+
+		const auto h = std::as_bytes(std::span{&header, 1});
+		extensions.insert(extensions.end(), h.begin(), h.end());
+		extensions.insert(extensions.end(), payload.begin(), payload.end());
+	}
+
 	void OnTranslateResponse(UniquePoolPtr<TranslateResponse> response) noexcept override;
 
 	void OnTranslateError(std::exception_ptr error) noexcept override {
@@ -72,7 +94,9 @@ MultiTranslationService::Request::OnTranslateResponse(UniquePoolPtr<TranslateRes
 		Start();
 	} else {
 		auto &_handler = handler;
+		const auto _extensions = std::move(extensions);
 		Destroy();
+		TranslateInvokeExtensions(_handler, _extensions);
 		_handler.OnTranslateResponse(std::move(response));
 	}
 }
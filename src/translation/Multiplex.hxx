@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * An optional extension to the translation protocol: any number of
+ * requests share one connection, and responses may be sent in any
+ * order.
+ *
+ * Negotiation: right after connecting, the client sends a request
+ * which consists only of BEGIN, #TRANSLATE_MULTIPLEX and END.  A
+ * server which supports this extension replies with BEGIN,
+ * #TRANSLATE_MULTIPLEX and END.  Any other reply (or closing the
+ * connection) means that the server does not support it.
+ *
+ * After that, each request and each response contains a
+ * #TRANSLATE_REQUEST_ID packet right after BEGIN.  Packets of
+ * different responses must not be interleaved.  The client may send
+ * a standalone #TRANSLATE_CANCEL packet (not enclosed in BEGIN/END)
+ * to tell the server that it is no longer interested in the
+ * response; the server may still send it, and the client discards
+ * it.
+ */
+
+#pragma once
+
+#include "translation/Protocol.hxx"
+
+#include <cstdint>
+
+/**
+ * Announces support for this extension (no payload).
+ */
+inline constexpr TranslationCommand TRANSLATE_MULTIPLEX{0xf000};
+
+/**
+ * The id of a multiplexed request or response (32 bit unsigned
+ * integer, host byte order, never zero).
+ */
+inline constexpr TranslationCommand TRANSLATE_REQUEST_ID{0xf001};
+
+/**
+ * Cancel the multiplexed request with the given id (32 bit unsigned
+ * integer).
+ */
+inline constexpr TranslationCommand TRANSLATE_CANCEL{0xf002};
+
+using TranslationRequestId = uint32_t;
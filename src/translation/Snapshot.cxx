@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Snapshot.hxx"
+#include "Marshal.hxx"
+#include "lib/fmt/RuntimeError.hxx"
+#include "net/SocketAddress.hxx"
+#include "util/SpanCast.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <stdexcept>
+
+#include <string.h>
+
+void
+TranslationSnapshotWriteHeader(TranslationMarshaller &m)
+{
+	m.WriteT(TRANSLATION_SNAPSHOT_MAGIC, TRANSLATION_SNAPSHOT_VERSION);
+}
+
+void
+TranslationSnapshotWriteServer(TranslationMarshaller &m,
+			       std::span<const std::byte> address)
+{
+	m.Write(TRANSLATION_SNAPSHOT_SERVER, address);
+}
+
+void
+TranslationSnapshotWriteItem(TranslationMarshaller &m,
+			     const TranslationSnapshotItem &item)
+{
+	const auto &request = item.request;
+
+	m.Write(TRANSLATION_SNAPSHOT_KEY, item.key);
+	m.WriteT<int64_t>(TRANSLATION_SNAPSHOT_EXPIRES,
+			  std::chrono::system_clock::to_time_t(item.expires));
+
+	m.WriteOptional(TranslationCommand::URI, request.uri);
+	m.WriteOptional(TranslationCommand::PARAM, request.param);
+	m.WriteOptional(TranslationCommand::SESSION, request.session);
+	m.WriteOptional(TranslationCommand::REALM_SESSION,
+			request.realm_session);
+	m.WriteOptional(TranslationCommand::LISTENER_TAG,
+			request.listener_tag);
+
+	if (!request.local_address.IsNull())
+		m.Write(TranslationCommand::LOCAL_ADDRESS, request.local_address);
+
+	m.WriteOptional(TranslationCommand::REMOTE_HOST, request.remote_host);
+	m.WriteOptional(TranslationCommand::HOST, request.host);
+	m.WriteOptional(TranslationCommand::LANGUAGE,
+			request.accept_language);
+	m.WriteOptional(TranslationCommand::USER_AGENT, request.user_agent);
+	m.WriteOptional(TranslationCommand::QUERY_STRING,
+			request.query_string);
+	m.WriteOptional(TranslationCommand::INTERNAL_REDIRECT,
+			request.internal_redirect);
+	m.WriteOptional(TranslationCommand::ENOTDIR_, request.enotdir);
+	m.WriteOptional(TranslationCommand::USER, request.user);
+
+	m.Write(TRANSLATION_SNAPSHOT_RESPONSE, item.response);
+	m.Write(TranslationCommand::END);
+}
+
+TranslationSnapshotReader::TranslationSnapshotReader(std::span<const std::byte> _src)
+	:src(_src)
+{
+	std::span<const std::byte> payload;
+	if (src.empty() ||
+	    ReadPacket(payload) != TRANSLATION_SNAPSHOT_MAGIC)
+		throw std::runtime_error("Not a translation cache snapshot");
+
+	uint32_t version;
+	if (payload.size() != sizeof(version))
+		throw std::runtime_error("Malformed snapshot header");
+
+	memcpy(&version, payload.data(), sizeof(version));
+	if (version != TRANSLATION_SNAPSHOT_VERSION)
+		throw FmtRuntimeError("Unsupported snapshot version {}",
+				      version);
+}
+
+TranslationCommand
+TranslationSnapshotReader::ReadPacket(std::span<const std::byte> &payload)
+{
+	TranslationHeader header;
+	if (src.size() < sizeof(header))
+		throw std::runtime_error("Truncated snapshot");
+
+	memcpy(&header, src.data(), sizeof(header));
+	src = src.subspan(sizeof(header));
+
+	if (src.size() < header.length)
+		throw std::runtime_error("Truncated snapshot");
+
+	payload = src.first(header.length);
+	src = src.subspan(header.length);
+	return header.command;
+}
+
+static const char *
+DupString(AllocatorPtr alloc, std::span<const std::byte> payload) noexcept
+{
+	return alloc.DupZ(ToStringView(payload));
+}
+
+static SocketAddress
+DupAddress(AllocatorPtr alloc, std::span<const std::byte> payload)
+{
+	if (payload.size() < sizeof(struct sockaddr))
+		throw std::runtime_error("Malformed LOCAL_ADDRESS");
+
+	/* copy to get the alignment right */
+	const auto copy = alloc.Dup(payload);
+	return {
+		reinterpret_cast<const struct sockaddr *>(copy.data()),
+		static_cast<SocketAddress::size_type>(copy.size()),
+	};
+}
+
+TranslationSnapshotReader::Result
+TranslationSnapshotReader::Next(AllocatorPtr alloc,
+				std::span<const std::byte> &server,
+				TranslationSnapshotItem &item)
+{
+	if (src.empty())
+		return Result::END;
+
+	std::span<const std::byte> payload;
+	auto command = ReadPacket(payload);
+
+	if (command == TRANSLATION_SNAPSHOT_SERVER) {
+		server = payload;
+		return Result::SERVER;
+	}
+
+	if (command != TRANSLATION_SNAPSHOT_KEY || payload.empty())
+		throw FmtRuntimeError("Unexpected snapshot packet {}",
+				      unsigned(command));
+
+	item = {};
+	item.key = DupString(alloc, payload);
+
+	bool have_expires = false;
+
+	auto &request = item.request;
+
+	while (true) {
+		command = ReadPacket(payload);
+
+		switch (command) {
+		case TranslationCommand::END:
+			if (!have_expires || item.response.data() == nullptr)
+				throw std::runtime_error("Incomplete snapshot item");
+
+			return Result::ITEM;
+
+		case TranslationCommand::URI:
+			request.uri = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::PARAM:
+			request.param = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::SESSION:
+			request.session = payload;
+			break;
+
+		case TranslationCommand::REALM_SESSION:
+			request.realm_session = payload;
+			break;
+
+		case TranslationCommand::LISTENER_TAG:
+			request.listener_tag = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::LOCAL_ADDRESS:
+			request.local_address = DupAddress(alloc, payload);
+			break;
+
+		case TranslationCommand::REMOTE_HOST:
+			request.remote_host = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::HOST:
+			request.host = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::LANGUAGE:
+			request.accept_language = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::USER_AGENT:
+			request.user_agent = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::QUERY_STRING:
+			request.query_string = DupString(alloc, payload);
+			break;
+
+		case TranslationCommand::INTERNAL_REDIRECT:
+			request.internal_redirect = payload;
+			break;
+
+		case TranslationCommand::ENOTDIR_:
+			request.enotdir = payload;
+			break;
+
+		case TranslationCommand::USER:
+			request.user = DupString(alloc, payload);
+			break;
+
+		case TRANSLATION_SNAPSHOT_EXPIRES:
+			{
+				int64_t expires;
+				if (payload.size() != sizeof(expires))
+					throw std::runtime_error("Malformed EXPIRES");
+
+				memcpy(&expires, payload.data(), sizeof(expires));
+				item.expires = std::chrono::system_clock::from_time_t(expires);
+				have_expires = true;
+			}
+
+			break;
+
+		case TRANSLATION_SNAPSHOT_RESPONSE:
+			item.response = payload;
+			break;
+
+		default:
+			throw FmtRuntimeError("Unexpected snapshot packet {}",
+					      unsigned(command));
+		}
+	}
+}
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * The file format of translation cache snapshots.  It is a sequence
+ * of translation protocol packets (host byte order, no padding).
+ *
+ * The file begins with #TRANSLATION_SNAPSHOT_MAGIC.  Each
+ * #TRANSLATION_SNAPSHOT_SERVER packet begins the section of one
+ * translation server (i.e. one translation cache).  Each cache item
+ * begins with #TRANSLATION_SNAPSHOT_KEY and
+ * #TRANSLATION_SNAPSHOT_EXPIRES, followed by the request packets the
+ * response varies on (using their regular command numbers),
+ * #TRANSLATION_SNAPSHOT_RESPONSE and END.
+ *
+ * The file is only meant to be loaded by the same (or a compatible)
+ * version of this software on the same host; the version number in
+ * #TRANSLATION_SNAPSHOT_MAGIC is incremented when the format
+ * changes.
+ */
+
+#pragma once
+
+#include "Request.hxx"
+#include "translation/Protocol.hxx"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+class AllocatorPtr;
+class TranslationMarshaller;
+
+/**
+ * The first packet of a snapshot file.  Payload: the format version
+ * (32 bit unsigned integer).
+ */
+inline constexpr TranslationCommand TRANSLATION_SNAPSHOT_MAGIC{0xf100};
+
+/**
+ * Payload: the address of the translation server whose cache items
+ * follow.
+ */
+inline constexpr TranslationCommand TRANSLATION_SNAPSHOT_SERVER{0xf101};
+
+/**
+ * Payload: the cache key (not null-terminated).
+ */
+inline constexpr TranslationCommand TRANSLATION_SNAPSHOT_KEY{0xf102};
+
+/**
+ * Payload: the wall-clock expiry time (64 bit signed integer,
+ * seconds since the epoch).
+ */
+inline constexpr TranslationCommand TRANSLATION_SNAPSHOT_EXPIRES{0xf103};
+
+/**
+ * Payload: the response packets (BEGIN to END) as received from the
+ * translation server.
+ */
+inline constexpr TranslationCommand TRANSLATION_SNAPSHOT_RESPONSE{0xf104};
+
+static constexpr uint32_t TRANSLATION_SNAPSHOT_VERSION = 1;
+
+/**
+ * One translation cache item in a snapshot.
+ */
+struct TranslationSnapshotItem {
+	const char *key;
+
+	std::chrono::system_clock::time_point expires;
+
+	/**
+	 * The request parameters the response varies on, plus the
+	 * URI.
+	 */
+	TranslateRequest request;
+
+	/**
+	 * The raw response packets.
+	 */
+	std::span<const std::byte> response;
+};
+
+void
+TranslationSnapshotWriteHeader(TranslationMarshaller &m);
+
+void
+TranslationSnapshotWriteServer(TranslationMarshaller &m,
+			       std::span<const std::byte> address);
+
+/**
+ * Throws if a payload is too large.
+ */
+void
+TranslationSnapshotWriteItem(TranslationMarshaller &m,
+			     const TranslationSnapshotItem &item);
+
+/**
+ * Parses a snapshot file which was created with the functions above.
+ */
+class TranslationSnapshotReader {
+	std::span<const std::byte> src;
+
+public:
+	/**
+	 * Throws if the file header is malformed.
+	 */
+	explicit TranslationSnapshotReader(std::span<const std::byte> _src);
+
+	enum class Result {
+		/**
+		 * The end of the file has been reached.
+		 */
+		END,
+
+		/**
+		 * A #TRANSLATION_SNAPSHOT_SERVER packet has been
+		 * parsed; the address has been stored in the
+		 * "server" parameter.  All following items belong
+		 * to this server.
+		 */
+		SERVER,
+
+		/**
+		 * An item has been parsed and stored in the "item"
+		 * parameter.
+		 */
+		ITEM,
+	};
+
+	/**
+	 * Parse the next section or item.  Strings are allocated
+	 * with the given allocator; all other payloads (including
+	 * the response) point into the source buffer.
+	 *
+	 * Throws on error.
+	 */
+	Result Next(AllocatorPtr alloc,
+		    std::span<const std::byte> &server,
+		    TranslationSnapshotItem &item);
+
+private:
+	/**
+	 * Throws if the packet is truncated.
+	 */
+	TranslationCommand ReadPacket(std::span<const std::byte> &payload);
+};
@@ -30,6 +30,10 @@ public:
 		return stock.GetEventLoop();
 	}
 
+	SocketAddress GetAddress() const noexcept {
+		return address;
+	}
+
 	void Get(StockGetHandler &handler,
 		 CancellablePointer &cancel_ptr) noexcept {
 		stock.Get(nullptr, handler, cancel_ptr);
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+/**
+ * Adjusts the number of concurrent requests per child process for
+ * one Multi-WAS key (AIMD): while the response latency stays close
+ * to the lowest recent latency, the limit grows by one per "window"
+ * of requests; if the latency rises well above that baseline (the
+ * application is saturated) or if requests fail, the limit is
+ * reduced by a constant factor.
+ *
+ * A new limit only applies to child processes spawned afterwards,
+ * therefore only results from child processes which were spawned
+ * with the current limit are taken into account.
+ */
+class AdaptiveConcurrency {
+	using Duration = std::chrono::steady_clock::duration;
+
+	/**
+	 * The weight of a new sample in #smoothed.
+	 */
+	static constexpr double smoothing = 0.1;
+
+	/**
+	 * The limit is reduced if #smoothed exceeds #baseline by this
+	 * factor plus #slack.
+	 */
+	static constexpr double tolerance = 2;
+
+	/**
+	 * An absolute latency tolerance [seconds] which prevents
+	 * jitter from shrinking the limit of very fast applications.
+	 */
+	static constexpr double slack = 0.005;
+
+	/**
+	 * The factor which is applied to the limit on overload.
+	 */
+	static constexpr double backoff = 0.75;
+
+	/**
+	 * The number of latency samples per window.  The baseline is
+	 * the minimum of the current and the previous window, so a
+	 * single very fast response is forgotten after two windows,
+	 * and a permanent change of the application's latency (e.g.
+	 * after a deployment) is accepted.
+	 */
+	static constexpr unsigned window_size = 500;
+
+	const double min_limit, max_limit;
+
+	double limit;
+
+	/**
+	 * The lowest latency [seconds] in the current and in the
+	 * previous window (0 if there was no sample).
+	 */
+	double window_min = 0, previous_window_min = 0;
+
+	/**
+	 * The number of samples in the current window.
+	 */
+	unsigned window_samples = 0;
+
+	/**
+	 * The moving average of the latency [seconds].
+	 */
+	double smoothed = 0;
+
+	uint_least64_t increases = 0, decreases = 0;
+
+public:
+	/**
+	 * @param _min_limit the lower bound (at least 1)
+	 * @param _max_limit the upper bound
+	 * @param initial the initial limit (the configured
+	 * concurrency)
+	 */
+	constexpr AdaptiveConcurrency(unsigned _min_limit, unsigned _max_limit,
+				      unsigned initial) noexcept
+		:min_limit(std::max(_min_limit, 1U)),
+		 max_limit(std::max({_max_limit, _min_limit, 1U})),
+		 limit(std::clamp<double>(initial, min_limit, max_limit)) {}
+
+	constexpr unsigned GetLimit() const noexcept {
+		return static_cast<unsigned>(limit);
+	}
+
+	constexpr uint_least64_t GetIncreases() const noexcept {
+		return increases;
+	}
+
+	constexpr uint_least64_t GetDecreases() const noexcept {
+		return decreases;
+	}
+
+	/**
+	 * Submit the result of one request.
+	 *
+	 * @param child_limit the limit the child process which
+	 * handled the request was spawned with; if it differs from
+	 * GetLimit(), the result is ignored
+	 * @param latency the time between sending the request and
+	 * receiving the response headers; std::nullopt if unknown
+	 * (e.g. because a request body had to be transferred first)
+	 * @param error true if the request has failed
+	 */
+	void OnResult(unsigned child_limit,
+		      std::optional<Duration> latency, bool error) noexcept {
+		if (child_limit != GetLimit())
+			return;
+
+		if (error) {
+			/* errors are not latency samples (they are
+			   usually fast) */
+			Decrease();
+			return;
+		}
+
+		if (!latency)
+			return;
+
+		const double l = std::chrono::duration<double>(*latency).count();
+
+		smoothed = smoothed > 0
+			? smoothed + smoothing * (l - smoothed)
+			: l;
+
+		if (window_min <= 0 || l < window_min)
+			window_min = l;
+
+		if (++window_samples >= window_size) {
+			previous_window_min = window_min;
+			window_min = 0;
+			window_samples = 0;
+		}
+
+		if (smoothed > tolerance * GetBaseline() + slack)
+			Decrease();
+		else
+			Increase();
+	}
+
+private:
+	[[gnu::pure]]
+	double GetBaseline() const noexcept {
+		if (window_min <= 0)
+			return previous_window_min;
+
+		if (previous_window_min <= 0)
+			return window_min;
+
+		return std::min(window_min, previous_window_min);
+	}
+
+	void Increase() noexcept {
+		const unsigned old_limit = GetLimit();
+
+		/* one step per window of "limit" results */
+		limit = std::min(limit + 1 / limit, max_limit);
+
+		if (GetLimit() > old_limit) {
+			++increases;
+
+			/* forget the latencies measured with the old
+			   limit */
+			smoothed = 0;
+		}
+	}
+
+	void Decrease() noexcept {
+		const unsigned old_limit = GetLimit();
+
+		limit = std::max(limit * backoff, min_limit);
+
+		if (GetLimit() < old_limit)
+			++decreases;
+
+		/* forget the latencies measured with the old limit */
+		smoothed = 0;
+	}
+};
@@ -8,6 +8,7 @@
 #include "Output.hxx"
 #include "Input.hxx"
 #include "Lease.hxx"
+#include "Shm.hxx"
 #include "was/async/Control.hxx"
 #include "http/ResponseHandler.hxx"
 #include "istream/istream_null.hxx"
@@ -62,6 +63,12 @@ class WasClient final
 
 	Was::Control &control;
 
+	/**
+	 * The shared memory area of this connection (see #WasShm),
+	 * or nullptr if it has none.
+	 */
+	WasShm *const shm;
+
 	WasMetricsHandler *const metrics_handler;
 
 	HttpResponseHandler &handler;
@@ -79,6 +86,11 @@ class WasClient final
 	struct Request {
 		WasOutput *body;
 
+		/**
+		 * Is #body sent through the shared memory ring?
+		 */
+		bool shm = false;
+
 		explicit Request(WasOutput *_body) noexcept:body(_body) {}
 
 		void ClearBody() noexcept {
@@ -153,6 +165,7 @@ public:
 		  StopwatchPtr &&_stopwatch,
 		  Was::Control &_control,
 		  FileDescriptor input_fd, FileDescriptor output_fd,
+		  WasShm *_shm,
 		  WasLease &_lease,
 		  HttpMethod method, UnusedIstreamPtr body,
 		  WasMetricsHandler *_metrics_handler,
@@ -360,6 +373,14 @@ private:
 
 	void OnSubmitResponseTimer() noexcept;
 
+	/**
+	 * Handle a #WAS_COMMAND_NOP packet which may belong to the
+	 * shared memory extension.
+	 *
+	 * @return false if this object has been destroyed
+	 */
+	bool OnShmPacket(WasShmPacket packet) noexcept;
+
 	/* virtual methods from class Cancellable */
 	void Cancel() noexcept override {
 		/* Cancellable::Cancel() can only be used before the
@@ -529,6 +550,9 @@ WasClient::OnWasControlPacket(enum was_command cmd,
 		HttpStatus status;
 
 	case WAS_COMMAND_NOP:
+		if (shm != nullptr)
+			return OnShmPacket(WasShmParsePacket(payload));
+
 		break;
 
 	case WAS_COMMAND_REQUEST:
@@ -737,6 +761,42 @@ WasClient::OnWasControlPacket(enum was_command cmd,
 	return true;
 }
 
+inline bool
+WasClient::OnShmPacket(WasShmPacket packet) noexcept
+{
+	assert(shm != nullptr);
+
+	switch (packet) {
+	case WasShmPacket::NONE:
+	case WasShmPacket::OFFER:
+		break;
+
+	case WasShmPacket::ACCEPT:
+		/* the next request body may be sent through the
+		   ring */
+		shm->SetAccepted();
+		break;
+
+	case WasShmPacket::DATA:
+		/* the response body will be sent through the ring
+		   instead of the pipe */
+		if (!response.IsReceivingMetadata() ||
+		    response.body == nullptr) {
+			stopwatch.RecordEvent("control_error");
+			AbortResponse(std::make_exception_ptr(SocketProtocolError{"misplaced shared memory DATA packet"}));
+			return false;
+		}
+
+		was_input_free_unused_p(&response.body);
+		response.body = was_input_new(caller_pool,
+					      control.GetEventLoop(),
+					      shm->GetInput(), *this);
+		break;
+	}
+
+	return true;
+}
+
 bool
 WasClient::OnWasControlDrained() noexcept
 {
@@ -881,11 +941,32 @@ WasClient::WasInputError() noexcept
  *
  */
 
+/**
+ * Create the #WasOutput for the request body, using the shared memory
+ * ring if the WAS application has accepted it.
+ */
+static WasOutput *
+NewRequestBody(struct pool &pool, EventLoop &event_loop,
+	       FileDescriptor output_fd, WasShm *shm,
+	       UnusedIstreamPtr body, WasOutputHandler &handler) noexcept
+{
+	if (!body)
+		return nullptr;
+
+	if (shm != nullptr && shm->IsAccepted())
+		return was_output_new(pool, event_loop, shm->GetOutput(),
+				      std::move(body), handler);
+
+	return was_output_new(pool, event_loop, output_fd,
+			      std::move(body), handler);
+}
+
 inline
 WasClient::WasClient(struct pool &_pool, struct pool &_caller_pool,
 		     StopwatchPtr &&_stopwatch,
 		     Was::Control &_control,
 		     FileDescriptor input_fd, FileDescriptor output_fd,
+		     WasShm *_shm,
 		     WasLease &_lease,
 		     HttpMethod method, UnusedIstreamPtr body,
 		     WasMetricsHandler *_metrics_handler,
@@ -896,18 +977,20 @@ WasClient::WasClient(struct pool &_pool, struct pool &_caller_pool,
 	 stopwatch(std::move(_stopwatch)),
 	 lease(_lease),
 	 control(_control),
+	 shm(_shm),
 	 metrics_handler(_metrics_handler),
 	 handler(_handler),
 	 submit_response_timer(control.GetEventLoop(),
 			       BIND_THIS_METHOD(OnSubmitResponseTimer)),
-	 request(body
-		 ? was_output_new(_pool, control.GetEventLoop(), output_fd,
-				  std::move(body), *this)
-		 : nullptr),
+	 request(NewRequestBody(_pool, control.GetEventLoop(), output_fd, shm,
+				std::move(body), *this)),
 	 response(http_method_is_empty(method)
 		  ? nullptr
 		  : was_input_new(_pool, control.GetEventLoop(), input_fd, *this))
 {
+	request.shm = request.body != nullptr && shm != nullptr &&
+		shm->IsAccepted();
+
 	cancel_ptr = *this;
 
 	control.SetHandler(*this);
@@ -921,6 +1004,7 @@ SendRequest(Was::Control &control,
 	    const char *script_name, const char *path_info,
 	    const char *query_string,
 	    const StringMap &headers, WasOutput *request_body,
+	    bool request_body_shm,
 	    std::span<const char *const> params)
 {
 	const uint32_t method32 = (uint32_t)method;
@@ -940,6 +1024,9 @@ SendRequest(Was::Control &control,
 		control.SendArray(WAS_COMMAND_PARAMETER, params) &&
 		(remote_host == nullptr ||
 		 control.SendString(WAS_COMMAND_REMOTE_HOST, remote_host)) &&
+		(!request_body_shm ||
+		 control.SendString(WAS_COMMAND_NOP,
+				    WasShmPacketPayload(WasShmPacket::DATA))) &&
 		control.Send(request_body != nullptr
 			     ? WAS_COMMAND_DATA
 			     : WAS_COMMAND_NO_DATA) &&
@@ -957,7 +1044,7 @@ WasClient::SendRequest(const char *remote_host,
 	::SendRequest(control, metrics_handler != nullptr,
 		      remote_host,
 		      method, uri, script_name, path_info,
-		      query_string, headers, request.body,
+		      query_string, headers, request.body, request.shm,
 		      params);
 }
 
@@ -966,6 +1053,7 @@ was_client_request(struct pool &caller_pool,
 		   StopwatchPtr stopwatch,
 		   Was::Control &control,
 		   FileDescriptor input_fd, FileDescriptor output_fd,
+		   WasShm *shm,
 		   WasLease &lease,
 		   const char *remote_host,
 		   HttpMethod method, const char *uri,
@@ -982,7 +1070,7 @@ was_client_request(struct pool &caller_pool,
 
 	auto client = NewFromPool<WasClient>(caller_pool, caller_pool, caller_pool,
 					     std::move(stopwatch),
-					     control, input_fd, output_fd,
+					     control, input_fd, output_fd, shm,
 					     lease, method, std::move(body),
 					     metrics_handler,
 					     handler, cancel_ptr);
@@ -16,6 +16,7 @@ class UnusedIstreamPtr;
 class WasLease;
 class StringMap;
 class WasMetricsHandler;
+class WasShm;
 class HttpResponseHandler;
 class CancellablePointer;
 namespace Was { class Control; }
@@ -38,6 +39,8 @@ IsWasClientRetryFailure(std::exception_ptr error) noexcept;
  * @param control a control socket to the WAS server
  * @param input_fd a data pipe for the response body
  * @param output_fd a data pipe for the request body
+ * @param shm the shared memory area of this connection (see #WasShm)
+ * or nullptr
  * @param lease the lease for both sockets
  * @param method the HTTP request method
  * @param uri the request URI path
@@ -57,6 +60,7 @@ was_client_request(struct pool &pool,
 		   StopwatchPtr stopwatch,
 		   Was::Control &control,
 		   FileDescriptor input_fd, FileDescriptor output_fd,
+		   WasShm *shm,
 		   WasLease &lease,
 		   const char *remote_host,
 		   HttpMethod method, const char *uri,
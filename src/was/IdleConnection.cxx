@@ -16,8 +16,10 @@
 
 WasIdleConnection::WasIdleConnection(EventLoop &event_loop,
 				     WasSocket &&_socket,
+				     std::unique_ptr<WasShm> &&_shm,
 				     WasIdleConnectionHandler &_handler) noexcept
 	:socket(std::move(_socket)),
+	 shm(std::move(_shm)),
 	 control(event_loop, socket.control, *this),
 	 handler(_handler)
 {
@@ -26,6 +28,16 @@ WasIdleConnection::WasIdleConnection(EventLoop &event_loop,
 inline void
 WasIdleConnection::DiscardInput(uint64_t remaining)
 {
+	if (shm != nullptr && shm->GetInput().IsActive()) {
+		auto &channel = shm->GetInput();
+		if (channel.GetRing().GetAvailable() < remaining)
+			throw SocketProtocolError{"Bogus PREMATURE payload"};
+
+		channel.Consume(remaining);
+		channel.SetActive(false);
+		return;
+	}
+
 	while (remaining > 0) {
 		std::array<std::byte, 16384> buffer;
 		std::span<std::byte> dest = buffer;
@@ -59,6 +71,14 @@ WasIdleConnection::OnPrematureControlPacket(std::span<const std::byte> payload)
 	return true;
 }
 
+inline void
+WasIdleConnection::OnNop(std::span<const std::byte> payload) noexcept
+{
+	if (shm != nullptr &&
+	    WasShmParsePacket(payload) == WasShmPacket::ACCEPT)
+		shm->SetAccepted();
+}
+
 bool
 WasIdleConnection::OnWasControlPacket(enum was_command cmd,
 				      std::span<const std::byte> payload) noexcept
@@ -66,7 +86,7 @@ try {
 	if (stopping) {
 		switch (cmd) {
 		case WAS_COMMAND_NOP:
-			/* ignore */
+			OnNop(payload);
 			return true;
 
 		case WAS_COMMAND_HEADER:
@@ -97,7 +117,7 @@ try {
 
 	switch (cmd) {
 	case WAS_COMMAND_NOP:
-		/* ignore */
+		OnNop(payload);
 		return true;
 
 	default:
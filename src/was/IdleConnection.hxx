@@ -4,10 +4,12 @@
 
 #pragma once
 
+#include "Shm.hxx"
 #include "was/async/Socket.hxx"
 #include "was/async/Control.hxx"
 
 #include <exception>
+#include <memory>
 #include <utility>
 
 /**
@@ -27,6 +29,12 @@ public:
 class WasIdleConnection final : Was::ControlHandler {
 	WasSocket socket;
 
+	/**
+	 * The shared memory area offered to the WAS application (see
+	 * #WasShm), or nullptr.
+	 */
+	std::unique_ptr<WasShm> shm;
+
 	Was::Control control;
 
 	WasIdleConnectionHandler &handler;
@@ -45,6 +53,7 @@ class WasIdleConnection final : Was::ControlHandler {
 public:
 	WasIdleConnection(EventLoop &event_loop,
 			  WasSocket &&_socket,
+			  std::unique_ptr<WasShm> &&_shm,
 			  WasIdleConnectionHandler &_handler) noexcept;
 
 #ifdef HAVE_URING
@@ -65,6 +74,10 @@ public:
 		return control;
 	}
 
+	WasShm *GetShm() const noexcept {
+		return shm.get();
+	}
+
 	void Stop(uint64_t _received) noexcept {
 		assert(!stopping);
 
@@ -96,12 +109,16 @@ private:
 	};
 
 	/**
-	 * Discard the given amount of data from the input pipe.
+	 * Discard the given amount of data from the input pipe (or
+	 * from the shared memory ring if the response body was
+	 * transferred there).
 	 *
 	 * Throws on error.
 	 */
 	void DiscardInput(uint64_t remaining);
 
+	void OnNop(std::span<const std::byte> payload) noexcept;
+
 	/**
 	 * Attempt to recover after the WAS client sent STOP to the
 	 * application.  Handles a PREMATURE packet and discards
@@ -3,6 +3,7 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "Input.hxx"
+#include "Shm.hxx"
 #include "event/PipeEvent.hxx"
 #include "event/DeferEvent.hxx"
 #include "istream/istream.hxx"
@@ -31,6 +32,14 @@ class WasInput final : Istream {
 
 	WasInputHandler &handler;
 
+	/**
+	 * If not nullptr, then the body is received from this shared
+	 * memory ring instead of the pipe, and #event watches its
+	 * data eventfd.  #received counts the bytes consumed from the
+	 * ring, and #buffer is unused.
+	 */
+	WasShmChannel *const shm;
+
 	SliceFifoBuffer buffer;
 
 	uint64_t received = 0, length;
@@ -47,7 +56,17 @@ public:
 		:Istream(p),
 		 event(event_loop, BIND_THIS_METHOD(EventCallback), fd),
 		 defer_read(event_loop, BIND_THIS_METHOD(OnDeferredRead)),
-		 handler(_handler) {
+		 handler(_handler), shm(nullptr) {
+	}
+
+	WasInput(struct pool &p, EventLoop &event_loop, WasShmChannel &_shm,
+		 WasInputHandler &_handler) noexcept
+		:Istream(p),
+		 event(event_loop, BIND_THIS_METHOD(EventCallback),
+		       _shm.GetDataEvent()),
+		 defer_read(event_loop, BIND_THIS_METHOD(OnDeferredRead)),
+		 handler(_handler), shm(&_shm) {
+		shm->SetActive(true);
 	}
 
 	void Free(std::exception_ptr ep) noexcept;
@@ -101,6 +120,11 @@ private:
 		event.Cancel();
 		event.ReleaseFileDescriptor();
 
+		if (shm != nullptr)
+			/* everything has been consumed from the
+			   ring */
+			shm->SetActive(false);
+
 		return handler.WasInputRelease();
 	}
 
@@ -179,8 +203,41 @@ private:
 	bool TryBuffered(bool invoke_ready) noexcept;
 	bool TryDirect() noexcept;
 
+	/*
+	 * shared memory
+	 *
+	 */
+
+	/**
+	 * How many bytes of this body can be consumed from the ring
+	 * right now?
+	 */
+	std::size_t GetShmAvailable() const noexcept {
+		std::size_t available = shm->GetRing().GetAvailable();
+		if (known_length && length - received < available)
+			available = length - received;
+		return available;
+	}
+
+	void ConsumeShm(std::size_t nbytes) noexcept {
+		shm->Consume(nbytes);
+		received += nbytes;
+	}
+
+	/**
+	 * Submit data from the ring to the #IstreamHandler.
+	 *
+	 * @return false if the handler blocks or if this object has
+	 * been destroyed
+	 */
+	bool SubmitShm(bool invoke_ready) noexcept;
+
+	void TryShm(bool invoke_ready) noexcept;
+
 	void TryRead(bool invoke_ready) noexcept {
-		if (direct) {
+		if (shm != nullptr) {
+			TryShm(invoke_ready);
+		} else if (direct) {
 			if (SubmitBuffer(invoke_ready) && buffer.empty())
 				TryDirect();
 		} else {
@@ -201,13 +258,17 @@ private:
 		if (known_length)
 			return length - received + buffer.GetAvailable();
 		else if (partial)
-			return buffer.GetAvailable();
+			return shm != nullptr
+				? GetShmAvailable()
+				: buffer.GetAvailable();
 		else
 			return -1;
 	}
 
 	void _Read() noexcept override {
-		if (SubmitBuffer(false))
+		if (shm != nullptr)
+			TryShm(false);
+		else if (SubmitBuffer(false))
 			TryRead(false);
 	}
 
@@ -385,6 +446,62 @@ WasInput::TryDirect() noexcept
 	gcc_unreachable();
 }
 
+bool
+WasInput::SubmitShm(bool invoke_ready) noexcept
+{
+	assert(shm != nullptr);
+
+	if (invoke_ready && GetShmAvailable() > 0) {
+		switch (InvokeReady()) {
+		case IstreamReadyResult::OK:
+			return true;
+
+		case IstreamReadyResult::FALLBACK:
+			break;
+
+		case IstreamReadyResult::CLOSED:
+			return false;
+		}
+	}
+
+	while (true) {
+		auto r = shm->GetRing().GetReadBuffers().front();
+		if (known_length && r.size() > length - received)
+			r = r.first(length - received);
+
+		if (r.empty())
+			return true;
+
+		std::size_t nbytes = InvokeData(r);
+		if (nbytes == 0)
+			return false;
+
+		ConsumeShm(nbytes);
+
+		if (nbytes < r.size())
+			return false;
+	}
+}
+
+inline void
+WasInput::TryShm(bool invoke_ready) noexcept
+{
+	assert(shm != nullptr);
+
+	if (!SubmitShm(invoke_ready))
+		return;
+
+	if (HasPipe() && !CheckReleasePipe())
+		return;
+
+	if (CheckEof())
+		return;
+
+	if (HasPipe())
+		/* wait for the producer to append more data */
+		ScheduleRead();
+}
+
 /*
  * libevent callback
  *
@@ -395,6 +512,9 @@ WasInput::EventCallback(unsigned) noexcept
 {
 	assert(HasPipe());
 
+	if (shm != nullptr)
+		WasShmChannel::Drain(GetPipe());
+
 	TryRead(true);
 }
 
@@ -403,6 +523,12 @@ WasInput::OnDeferredRead() noexcept
 {
 	assert(HasPipe());
 
+	if (shm != nullptr) {
+		/* the ring may contain data already */
+		TryShm(true);
+		return;
+	}
+
 	/* this method gets called after Enable(); maybe there's
 	   already data in the buffer, so submit that; then schedule
 	   reading more, but do not fill the buffer in here (if the
@@ -434,6 +560,14 @@ was_input_new(struct pool &pool, EventLoop &event_loop, FileDescriptor fd,
 				     handler);
 }
 
+WasInput *
+was_input_new(struct pool &pool, EventLoop &event_loop, WasShmChannel &shm,
+	      WasInputHandler &handler) noexcept
+{
+	return NewFromPool<WasInput>(pool, pool, event_loop, shm,
+				     handler);
+}
+
 inline void
 WasInput::Free(std::exception_ptr ep) noexcept
 {
@@ -523,6 +657,17 @@ WasInput::PrematureThrow(uint64_t _length)
 
 	uint64_t remaining = _length - received;
 
+	if (shm != nullptr) {
+		/* the producer has appended everything to the ring
+		   before sending PREMATURE */
+		if (shm->GetRing().GetAvailable() < remaining)
+			throw SocketProtocolError{"announced premature length is too large"};
+
+		ConsumeShm(remaining);
+		shm->SetActive(false);
+		return;
+	}
+
 	while (remaining > 0) {
 		std::array<std::byte, 4096> discard_buffer;
 		std::span<std::byte> dest{discard_buffer};
@@ -587,6 +732,34 @@ was_input_premature_throw(WasInput *input, uint64_t length)
 void
 WasInput::_FillBucketList(IstreamBucketList &list)
 {
+	if (shm != nullptr) {
+		/* pass the ring memory to our handler without
+		   copying */
+		uint64_t remaining = known_length
+			? length - received
+			: UINT64_MAX;
+
+		for (auto r : shm->GetRing().GetReadBuffers()) {
+			if (r.size() > remaining)
+				r = r.first(remaining);
+
+			if (r.empty())
+				break;
+
+			list.Push(r);
+			remaining -= r.size();
+		}
+
+		if (!known_length || remaining > 0) {
+			list.SetMore();
+
+			if (HasPipe())
+				ScheduleRead();
+		}
+
+		return;
+	}
+
 	auto r = buffer.Read();
 	if (r.empty()) {
 		if (!HasPipe())
@@ -630,6 +803,16 @@ WasInput::_FillBucketList(IstreamBucketList &list)
 Istream::ConsumeBucketResult
 WasInput::_ConsumeBucketList(std::size_t nbytes) noexcept
 {
+	if (shm != nullptr) {
+		std::size_t consumed = std::min(GetShmAvailable(), nbytes);
+		ConsumeShm(consumed);
+
+		if (nbytes > 0 && HasPipe())
+			ScheduleRead();
+
+		return {Consumed(consumed), CanRelease()};
+	}
+
 	std::size_t consumed = std::min(buffer.GetAvailable(), nbytes);
 
 	buffer.Consume(consumed);
@@ -13,6 +13,7 @@ class FileDescriptor;
 class EventLoop;
 class UnusedIstreamPtr;
 class WasInput;
+class WasShmChannel;
 
 class WasInputHandler {
 public:
@@ -65,6 +66,14 @@ WasInput *
 was_input_new(struct pool &pool, EventLoop &event_loop, FileDescriptor fd,
 	      WasInputHandler &handler) noexcept;
 
+/**
+ * Like the other was_input_new() overload, but receive the body from
+ * a shared memory ring (see #WasShm).
+ */
+WasInput *
+was_input_new(struct pool &pool, EventLoop &event_loop, WasShmChannel &shm,
+	      WasInputHandler &handler) noexcept;
+
 /**
  * @param error the error reported to the istream handler
  */
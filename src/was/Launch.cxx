@@ -64,7 +64,8 @@ was_launch(SpawnService &spawn_service,
 	   const char *executable_path,
 	   std::span<const char *const> args,
 	   const ChildOptions &options,
-	   UniqueFileDescriptor stderr_fd)
+	   UniqueFileDescriptor stderr_fd,
+	   bool shm)
 {
 	auto s = WasSocket::CreatePair();
 
@@ -72,6 +73,13 @@ was_launch(SpawnService &spawn_service,
 	process.input.SetNonBlocking();
 	process.output.SetNonBlocking();
 
+	if (shm) {
+		/* the offer must be in the socket buffer before the
+		   process starts (see WasShm::ReceiveOffer()) */
+		process.shm = WasShm::Create();
+		process.shm->SendOffer(process.control);
+	}
+
 	process.handle = WasLaunch(spawn_service, listen_stream_stock,
 				   process.listen_stream_lease,
 				   name, executable_path, args,
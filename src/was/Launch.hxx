@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "Shm.hxx"
 #include "was/async/Socket.hxx"
 #include "spawn/ProcessHandle.hxx"
 #include "util/SharedLease.hxx"
@@ -24,6 +25,11 @@ struct WasProcess : WasSocket {
 	 */
 	SharedLease listen_stream_lease;
 
+	/**
+	 * The shared memory area offered to the process, or nullptr.
+	 */
+	std::unique_ptr<WasShm> shm;
+
 	WasProcess() = default;
 
 	explicit WasProcess(WasSocket &&_socket) noexcept
@@ -34,6 +40,9 @@ struct WasProcess : WasSocket {
  * Launch WAS child processes.
  *
  * Throws std::runtime_error on error.
+ *
+ * @param shm offer transferring bodies through shared memory (see
+ * #WasShm)?
  */
 WasProcess
 was_launch(SpawnService &spawn_service,
@@ -42,4 +51,5 @@ was_launch(SpawnService &spawn_service,
 	   const char *executable_path,
 	   std::span<const char *const> args,
 	   const ChildOptions &options,
-	   UniqueFileDescriptor stderr_fd);
+	   UniqueFileDescriptor stderr_fd,
+	   bool shm);
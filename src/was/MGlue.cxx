@@ -24,6 +24,12 @@ class MultiWasRequest final : WasStockRequest
 	const std::span<const char *const> args;
 	const unsigned parallelism, concurrency;
 
+	/**
+	 * The stock key if adaptive concurrency is enabled (see
+	 * MultiWasStock::OnResult()).
+	 */
+	const char *adaptive_key = nullptr;
+
 public:
 	MultiWasRequest(struct pool &_pool, MultiWasStock &_stock,
 			StopwatchPtr &&_stopwatch,
@@ -62,9 +68,16 @@ protected:
 		stock.Get(pool,
 			  options,
 			  action, args,
-			  parallelism, concurrency,
+			  parallelism, concurrency, adaptive_key,
 			  *this, cancel_ptr);
 	}
+
+	void OnWasResult(std::optional<std::chrono::steady_clock::duration> latency,
+			 bool error) noexcept override {
+		if (adaptive_key != nullptr)
+			stock.OnResult(adaptive_key, item_concurrency,
+				       latency, error);
+	}
 };
 
 class RemoteWasRequest final : WasStockRequest
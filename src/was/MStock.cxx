@@ -30,16 +30,36 @@
 class MultiWasChild final : public ChildStockItem, Was::MultiClientHandler {
 	EventLoop &event_loop;
 
+	MultiWasStock &multi_was_stock;
+
 	std::optional<Was::MultiClient> client;
 
+	/**
+	 * The number of concurrent requests this process was spawned
+	 * for.
+	 */
+	const unsigned concurrency;
+
 public:
 	MultiWasChild(CreateStockItem c,
 		      ChildStock &_child_stock,
-		      std::string_view _tag) noexcept
+		      MultiWasStock &_multi_was_stock,
+		      std::string_view _tag,
+		      unsigned _concurrency) noexcept
 		:ChildStockItem(c, _child_stock, _tag),
-		 event_loop(c.stock.GetEventLoop())
+		 event_loop(c.stock.GetEventLoop()),
+		 multi_was_stock(_multi_was_stock),
+		 concurrency(_concurrency)
 	{}
 
+	~MultiWasChild() noexcept override {
+		multi_was_stock.OnChildRemoved();
+	}
+
+	unsigned GetConcurrency() const noexcept {
+		return concurrency;
+	}
+
 	WasSocket Connect() {
 		return client->Connect();
 	}
@@ -101,13 +121,21 @@ public:
 	void SetUri(const char *uri) noexcept override {
 		child.SetUri(uri);
 	}
+
+	unsigned GetConcurrency() const noexcept override {
+		return child.GetConcurrency();
+	}
 };
 
 MultiWasStock::MultiWasStock(unsigned limit, [[maybe_unused]] unsigned max_idle,
+			     unsigned prespawn, unsigned _max_concurrency,
 			     EventLoop &event_loop, SpawnService &spawn_service,
 			     Net::Log::Sink *log_sink,
 			     const ChildErrorLogOptions &log_options) noexcept
 	:pool(pool_new_dummy(nullptr, "MultiWasStock")),
+	 max_concurrency(_max_concurrency),
+	 prune_adaptive_event(event_loop,
+			      BIND_THIS_METHOD(PruneAdaptiveConcurrency)),
 	 child_stock(spawn_service,
 		     nullptr, // TODO do we need ListenStreamSpawnStock here?
 		     *this,
@@ -115,7 +143,25 @@ MultiWasStock::MultiWasStock(unsigned limit, [[maybe_unused]] unsigned max_idle,
 	 mchild_stock(event_loop, child_stock,
 		      limit,
 		      // TODO max_idle,
-		      *this) {}
+		      *this),
+	 prespawner(mchild_stock, *this, limit,
+		    child_stock, *this, prespawn) {}
+
+ChildStockStats
+MultiWasStock::GetStats() const noexcept
+{
+	auto stats = prespawner.GetStats();
+	stats.concurrency_increases = pruned_concurrency_increases;
+	stats.concurrency_decreases = pruned_concurrency_decreases;
+
+	for (const auto &[key, adaptive] : adaptive_concurrency) {
+		stats.concurrency_limit += adaptive.GetLimit();
+		stats.concurrency_increases += adaptive.GetIncreases();
+		stats.concurrency_decreases += adaptive.GetDecreases();
+	}
+
+	return stats;
+}
 
 std::size_t
 MultiWasStock::GetLimit(const void *request,
@@ -168,8 +214,11 @@ MultiWasStock::CreateChild(CreateStockItem c,
 			   const void *info,
 			   ChildStock &_child_stock)
 {
-	return std::make_unique<MultiWasChild>(c, _child_stock,
-					       GetChildTag(info));
+	const auto &params = *(const CgiChildParams *)info;
+
+	return std::make_unique<MultiWasChild>(c, _child_stock, *this,
+					       GetChildTag(info),
+					       params.concurrency);
 }
 
 void
@@ -215,6 +264,7 @@ MultiWasStock::Get(AllocatorPtr alloc,
 		   const char *executable_path,
 		   std::span<const char *const> args,
 		   unsigned parallelism, unsigned concurrency,
+		   const char *&adaptive_key_r,
 		   StockGetHandler &handler,
 		   CancellablePointer &cancel_ptr) noexcept
 {
@@ -224,7 +274,77 @@ MultiWasStock::Get(AllocatorPtr alloc,
 						      args, options,
 						      parallelism, concurrency,
 						      false);
-	const char *key = r->GetStockKey(*tpool);
 
+	/* with adaptive concurrency, the caller needs the key to
+	   submit the result */
+	const char *key = r->GetStockKey(max_concurrency > 0
+					 ? alloc : AllocatorPtr{*tpool});
+
+	if (max_concurrency > 0) {
+		auto i = adaptive_concurrency.find(key);
+		if (i == adaptive_concurrency.end())
+			i = adaptive_concurrency.try_emplace(key, 1, max_concurrency,
+							     concurrency).first;
+
+		/* MultiStock applies this limit to child processes
+		   spawned from now on; CreateChild() stores it in
+		   the MultiWasChild */
+		concurrency = r->concurrency = i->second.GetLimit();
+		adaptive_key_r = key;
+	} else
+		adaptive_key_r = nullptr;
+
+	prespawner.OnRequest(key, *r, concurrency);
 	mchild_stock.Get(key, std::move(r), concurrency, handler, cancel_ptr);
 }
+
+void
+MultiWasStock::OnResult(const char *key, unsigned child_limit,
+			std::optional<std::chrono::steady_clock::duration> latency,
+			bool error) noexcept
+{
+	auto i = adaptive_concurrency.find(key);
+	if (i == adaptive_concurrency.end())
+		/* pruned meanwhile */
+		return;
+
+	auto &adaptive = i->second;
+	const unsigned old_limit = adaptive.GetLimit();
+	adaptive.OnResult(child_limit, latency, error);
+
+	const unsigned new_limit = adaptive.GetLimit();
+	if (new_limit < old_limit) {
+		/* the application is overloaded; don't wait for the
+		   child processes with the old limit to expire */
+		const std::string_view _key{key};
+		mchild_stock.FadeIf([_key, new_limit](const StockItem &item){
+			const auto &child = (const MultiWasChild &)item;
+			return child.GetConcurrency() > new_limit &&
+				_key == child.GetStockName();
+		});
+	}
+}
+
+void
+MultiWasStock::OnChildRemoved() noexcept
+{
+	/* ChildStock still counts this child; look at the keys after
+	   it has been destroyed */
+	if (!adaptive_concurrency.empty())
+		prune_adaptive_event.Schedule();
+}
+
+void
+MultiWasStock::PruneAdaptiveConcurrency() noexcept
+{
+	std::erase_if(adaptive_concurrency, [this](const auto &i){
+		const auto state = child_stock.GetKeyState(i.first);
+		if (state.n_children > 0 || state.n_starting > 0)
+			return false;
+
+		/* keep the counters monotonic */
+		pruned_concurrency_increases += i.second.GetIncreases();
+		pruned_concurrency_decreases += i.second.GetDecreases();
+		return true;
+	});
+}
@@ -4,12 +4,19 @@
 
 #pragma once
 
+#include "AdaptiveConcurrency.hxx"
 #include "spawn/ChildStock.hxx"
+#include "spawn/Prespawn.hxx"
 #include "stock/MultiStock.hxx"
+#include "event/DeferEvent.hxx"
 #include "pool/Ptr.hxx"
 #include "io/uring/config.h" // for HAVE_URING
 
+#include <chrono>
+#include <map>
+#include <optional>
 #include <span>
+#include <string>
 
 class AllocatorPtr;
 struct ChildOptions;
@@ -25,15 +32,49 @@ namespace Uring { class Queue; }
 
 class MultiWasStock final : MultiStockClass, ChildStockClass {
 	PoolPtr pool;
+
+	/**
+	 * The upper bound for #AdaptiveConcurrency; 0 means the
+	 * concurrency is fixed to the configured value.
+	 */
+	const unsigned max_concurrency;
+
+	/**
+	 * The concurrency controller for each stock key.  Items are
+	 * removed by #prune_adaptive_event when the key has no child
+	 * processes left.
+	 */
+	std::map<std::string, AdaptiveConcurrency, std::less<>> adaptive_concurrency;
+
+	/**
+	 * The counters of pruned #adaptive_concurrency items.
+	 */
+	uint_least64_t pruned_concurrency_increases = 0;
+	uint_least64_t pruned_concurrency_decreases = 0;
+
+	DeferEvent prune_adaptive_event;
+
+	/* these are declared after #adaptive_concurrency because
+	   destroying a child process calls OnChildRemoved() */
 	ChildStock child_stock;
 	MultiStock mchild_stock;
+	ChildStockPrespawner prespawner;
 
 #ifdef HAVE_URING
 	Uring::Queue *uring_queue = nullptr;
 #endif
 
 public:
-	MultiWasStock(unsigned limit, unsigned max_idle,
+	/**
+	 * @param prespawn the maximum number of child processes per
+	 * key to be kept warm (see #ChildStockPrespawner)
+	 * @param _max_concurrency if non-zero, then the number of
+	 * concurrent requests per child process is adjusted between 1
+	 * and this value according to the latency and error rate
+	 * (see #AdaptiveConcurrency)
+	 */
+	MultiWasStock(unsigned limit, unsigned max_idle, unsigned prespawn,
+		      unsigned _max_concurrency,
 		      EventLoop &event_loop, SpawnService &spawn_service,
 		      Net::Log::Sink *log_sink,
 		      const ChildErrorLogOptions &log_options) noexcept;
@@ -48,6 +89,9 @@ public:
 	}
 #endif
 
+	[[gnu::pure]]
+	ChildStockStats GetStats() const noexcept;
+
 	std::size_t DiscardSome() noexcept {
 		return mchild_stock.DiscardOldestIdle(64);
 	}
@@ -61,16 +105,50 @@ public:
 	/**
 	 * The resulting #StockItem will be a #WasStockConnection
 	 * instance.
+	 *
+	 * @param concurrency the configured concurrency; with
+	 * adaptive concurrency, this is the initial limit
+	 * @param adaptive_key_r is set to the stock key (allocated
+	 * with #alloc) which shall be passed to OnResult(), or
+	 * nullptr if adaptive concurrency is disabled
 	 */
 	void Get(AllocatorPtr alloc,
 		 const ChildOptions &options,
 		 const char *executable_path,
 		 std::span<const char *const> args,
 		 unsigned parallelism, unsigned concurrency,
+		 const char *&adaptive_key_r,
 		 StockGetHandler &handler,
 		 CancellablePointer &cancel_ptr) noexcept;
 
+	/**
+	 * Submit the result of a request to the #AdaptiveConcurrency
+	 * instance of the given key.  If the limit is lowered, child
+	 * processes which were spawned with a higher limit are faded,
+	 * so the new limit takes effect without waiting for them to
+	 * expire.
+	 *
+	 * @param key the key returned by Get()
+	 * @param child_limit the concurrency limit of the child
+	 * process which has handled the request (see
+	 * WasStockConnection::GetConcurrency())
+	 */
+	void OnResult(const char *key, unsigned child_limit,
+		      std::optional<std::chrono::steady_clock::duration> latency,
+		      bool error) noexcept;
+
+	/**
+	 * Called by the child process destructor.
+	 */
+	void OnChildRemoved() noexcept;
+
 private:
+	/**
+	 * Remove #AdaptiveConcurrency instances whose key has no
+	 * child processes left.
+	 */
+	void PruneAdaptiveConcurrency() noexcept;
+
 	/* virtual methods from class MultiStockClass */
 	std::size_t GetLimit(const void *request,
 			     std::size_t _limit) const noexcept override;
@@ -3,6 +3,7 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "Output.hxx"
+#include "Shm.hxx"
 #include "event/PipeEvent.hxx"
 #include "event/DeferEvent.hxx"
 #include "event/CoarseTimerEvent.hxx"
@@ -36,6 +37,13 @@ class WasOutput final : PoolLeakDetector, IstreamSink, DestructAnchor {
 
 	WasOutputHandler &handler;
 
+	/**
+	 * If not nullptr, then the body is sent through this shared
+	 * memory ring instead of the pipe, and #event watches its
+	 * space eventfd.
+	 */
+	WasShmChannel *const shm;
+
 	uint64_t sent = 0;
 
 	uint64_t total_length;
@@ -53,13 +61,29 @@ public:
 		 event(event_loop, BIND_THIS_METHOD(WriteEventCallback), fd),
 		 defer_write(event_loop, BIND_THIS_METHOD(OnDeferredWrite)),
 		 timeout_event(event_loop, BIND_THIS_METHOD(OnTimeout)),
-		 handler(_handler)
+		 handler(_handler), shm(nullptr)
 	{
 		input.SetDirect(ISTREAM_TO_PIPE);
 
 		defer_write.Schedule();
 	}
 
+	WasOutput(struct pool &pool, EventLoop &event_loop, WasShmChannel &_shm,
+		  UnusedIstreamPtr _input,
+		  WasOutputHandler &_handler) noexcept
+		:PoolLeakDetector(pool),
+		 IstreamSink(std::move(_input)),
+		 event(event_loop, BIND_THIS_METHOD(WriteEventCallback),
+		       _shm.GetSpaceEvent()),
+		 defer_write(event_loop, BIND_THIS_METHOD(OnDeferredWrite)),
+		 timeout_event(event_loop, BIND_THIS_METHOD(OnTimeout)),
+		 handler(_handler), shm(&_shm)
+	{
+		/* no splice() into the ring; all data is copied */
+
+		defer_write.Schedule();
+	}
+
 	uint64_t Close() noexcept {
 		const auto _sent = sent;
 		Destroy();
@@ -119,6 +143,23 @@ private:
 		timeout_event.Schedule(was_output_timeout);
 	}
 
+	/**
+	 * Continue after data has been copied to the ring: right
+	 * away if there is free space, or else when the consumer
+	 * signals the space eventfd.
+	 */
+	void ScheduleShm() noexcept {
+		assert(shm != nullptr);
+
+		if (shm->GetRing().GetWriteBuffer().empty()) {
+			event.ScheduleRead();
+			timeout_event.Schedule(was_output_timeout);
+		} else
+			DeferNextWrite();
+	}
+
+	IstreamReadyResult OnIstreamReadyShm(const IstreamBucketList &list) noexcept;
+
 	void WriteEventCallback(unsigned events) noexcept;
 	void OnDeferredWrite() noexcept;
 
@@ -164,6 +205,13 @@ WasOutput::WriteEventCallback(unsigned) noexcept
 
 	timeout_event.Cancel();
 
+	if (shm != nullptr) {
+		/* the consumer has made room in the ring; the next
+		   ScheduleShm() call will wait again if needed */
+		WasShmChannel::Drain(GetPipe());
+		event.Cancel();
+	}
+
 	if (!CheckLength())
 		return;
 
@@ -172,7 +220,7 @@ WasOutput::WriteEventCallback(unsigned) noexcept
 
 	input.Read();
 
-	if (!destructed && !got_data)
+	if (!destructed && !got_data && shm == nullptr)
 		/* the Istream is not ready for reading, so cancel our
 		   write event */
 		event.CancelWrite();
@@ -220,6 +268,9 @@ WasOutput::OnIstreamReady() noexcept
 		return IstreamReadyResult::CLOSED;
 	}
 
+	if (shm != nullptr)
+		return OnIstreamReadyShm(list);
+
 	/* convert buckets to struct iovec array */
 
 	StaticVector<struct iovec, 64> v;
@@ -271,6 +322,45 @@ WasOutput::OnIstreamReady() noexcept
 	return result;
 }
 
+inline IstreamReadyResult
+WasOutput::OnIstreamReadyShm(const IstreamBucketList &list) noexcept
+{
+	/* copy buckets to the ring */
+
+	std::size_t nbytes = 0;
+	IstreamReadyResult result = IstreamReadyResult::OK;
+
+	for (const auto &i : list) {
+		if (!i.IsBuffer()) {
+			result = IstreamReadyResult::FALLBACK;
+			break;
+		}
+
+		const auto buffer = i.GetBuffer();
+		const std::size_t n = shm->Write(buffer);
+		nbytes += n;
+
+		if (n < buffer.size())
+			/* the ring is full */
+			break;
+	}
+
+	if (nbytes > 0) {
+		sent += nbytes;
+
+		if (input.ConsumeBucketList(nbytes).eof) {
+			/* we've just reached end of our input */
+
+			CloseInput();
+			DestroyEof();
+			return IstreamReadyResult::CLOSED;
+		}
+	}
+
+	ScheduleShm();
+	return result;
+}
+
 inline std::size_t
 WasOutput::OnData(const std::span<const std::byte> src) noexcept
 {
@@ -280,6 +370,20 @@ WasOutput::OnData(const std::span<const std::byte> src) noexcept
 
 	got_data = true;
 
+	if (shm != nullptr) {
+		const std::size_t nbytes = shm->Write(src);
+		sent += nbytes;
+
+		if (IsEof()) {
+			CloseInput();
+			DestroyEof();
+			return 0;
+		}
+
+		ScheduleShm();
+		return nbytes;
+	}
+
 	ssize_t nbytes = GetPipe().Write(src);
 	if (nbytes > 0) [[likely]] {
 		sent += nbytes;
@@ -312,6 +416,7 @@ WasOutput::OnDirect(FdType, FileDescriptor source_fd, off_t source_offset,
 		    std::size_t max_length, bool then_eof) noexcept
 {
 	assert(HasPipe());
+	assert(shm == nullptr);
 	assert(!IsEof());
 
 	if (then_eof && !known_length) {
@@ -396,6 +501,15 @@ was_output_new(struct pool &pool, EventLoop &event_loop,
 				      std::move(input), handler);
 }
 
+WasOutput *
+was_output_new(struct pool &pool, EventLoop &event_loop,
+	       WasShmChannel &shm, UnusedIstreamPtr input,
+	       WasOutputHandler &handler) noexcept
+{
+	return NewFromPool<WasOutput>(pool, pool, event_loop, shm,
+				      std::move(input), handler);
+}
+
 uint64_t
 was_output_free(WasOutput *output) noexcept
 {
@@ -13,6 +13,7 @@ class EventLoop;
 class FileDescriptor;
 class UnusedIstreamPtr;
 class WasOutput;
+class WasShmChannel;
 
 class WasOutputHandler {
 public:
@@ -49,7 +50,17 @@ was_output_new(struct pool &pool, EventLoop &event_loop,
 	       WasOutputHandler &handler) noexcept;
 
 /**
- * @return the total number of bytes written to the pipe
+ * Like the other was_output_new() overload, but send the body
+ * through a shared memory ring (see #WasShm).
+ */
+WasOutput *
+was_output_new(struct pool &pool, EventLoop &event_loop,
+	       WasShmChannel &shm, UnusedIstreamPtr input,
+	       WasOutputHandler &handler) noexcept;
+
+/**
+ * @return the total number of bytes written to the pipe (or the
+ * shared memory ring)
  */
 uint64_t
 was_output_free(WasOutput *data) noexcept;
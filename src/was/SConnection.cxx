@@ -7,10 +7,12 @@
 
 #include <cassert>
 
-WasStockConnection::WasStockConnection(CreateStockItem c, WasSocket &&_socket) noexcept
+WasStockConnection::WasStockConnection(CreateStockItem c, WasSocket &&_socket,
+				       std::unique_ptr<WasShm> &&_shm) noexcept
 	:StockItem(c),
 	 logger(GetStockName()),
-	 connection(c.stock.GetEventLoop(), std::move(_socket), *this) {}
+	 connection(c.stock.GetEventLoop(), std::move(_socket),
+		    std::move(_shm), *this) {}
 
 void
 WasStockConnection::Stop(uint_least64_t _received) noexcept
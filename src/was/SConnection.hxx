@@ -16,7 +16,8 @@ class WasStockConnection
 	WasIdleConnection connection;
 
 public:
-	WasStockConnection(CreateStockItem c, WasSocket &&_socket) noexcept;
+	WasStockConnection(CreateStockItem c, WasSocket &&_socket,
+			   std::unique_ptr<WasShm> &&_shm={}) noexcept;
 
 #ifdef HAVE_URING
 	void EnableUring(Uring::Queue &uring_queue) {
@@ -36,6 +37,10 @@ public:
 		return connection.GetControl();
 	}
 
+	WasShm *GetShm() const noexcept {
+		return connection.GetShm();
+	}
+
 	/**
 	 * Set the "stopping" flag.  Call this after sending
 	 * #WAS_COMMAND_STOP, before calling hstock_put().  This will
@@ -46,6 +51,14 @@ public:
 	virtual void SetSite([[maybe_unused]] const char *site) noexcept {}
 	virtual void SetUri([[maybe_unused]] const char *uri) noexcept {}
 
+	/**
+	 * Returns the number of concurrent requests the process was
+	 * spawned for, or 0 if that is not known.
+	 */
+	virtual unsigned GetConcurrency() const noexcept {
+		return 0;
+	}
+
 protected:
 	/* virtual methods from class StockItem */
 	bool Borrow() noexcept override;
@@ -6,6 +6,7 @@
 #include "SConnection.hxx"
 #include "SLease.hxx"
 #include "Client.hxx"
+#include "http/Status.hxx"
 #include "pool/pool.hxx"
 #include "stock/Item.hxx"
 #include "stock/Stock.hxx"
@@ -20,10 +21,15 @@ WasStockRequest::OnStockItemReady(StockItem &item) noexcept
 	const auto &process = connection.GetSocket();
 	auto &lease = *NewFromPool<WasStockLease>(pool, connection);
 
+	send_time = std::chrono::steady_clock::now();
+	item_concurrency = connection.GetConcurrency();
+	had_request_body = pending_request.body;
+
 	was_client_request(pool,
 			   std::move(stopwatch),
 			   connection.GetControl(),
 			   process.input, process.output,
+			   connection.GetShm(),
 			   lease,
 			   remote_host,
 			   pending_request.method, pending_request.uri,
@@ -48,6 +54,9 @@ void
 WasStockRequest::OnHttpResponse(HttpStatus status, StringMap &&_headers,
 				UnusedIstreamPtr _body) noexcept
 {
+	OnWasResult(GetLatency(),
+		    status == HttpStatus::SERVICE_UNAVAILABLE);
+
 	auto &_handler = handler;
 	Destroy();
 	_handler.InvokeResponse(status, std::move(_headers), std::move(_body));
@@ -66,6 +75,8 @@ WasStockRequest::OnHttpError(std::exception_ptr error) noexcept
 		return;
 	}
 
+	OnWasResult(GetLatency(), true);
+
 	auto &_handler = handler;
 	Destroy();
 	_handler.InvokeError(std::move(error));
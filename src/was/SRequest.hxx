@@ -11,6 +11,9 @@
 #include "util/Cancellable.hxx"
 #include "stopwatch.hxx"
 
+#include <chrono>
+#include <optional>
+
 class WasMetricsHandler;
 
 class WasStockRequest
@@ -41,6 +44,24 @@ public:
 
 	unsigned retries;
 
+	/**
+	 * When was the request sent to the WAS application?
+	 */
+	std::chrono::steady_clock::time_point send_time;
+
+	/**
+	 * The value of WasStockConnection::GetConcurrency() of the
+	 * connection which handles this request.
+	 */
+	unsigned item_concurrency = 0;
+
+	/**
+	 * Did this request have a body?  Then the response latency
+	 * includes the time it took to transfer it, and it doesn't
+	 * tell how busy the application is.
+	 */
+	bool had_request_body = false;
+
 public:
 	WasStockRequest(struct pool &_pool,
 			StopwatchPtr &&_stopwatch,
@@ -77,7 +98,28 @@ protected:
 
 	virtual void GetStockItem() noexcept = 0;
 
+	/**
+	 * The WAS application has responded (or the request has
+	 * failed).  This is called before the #HttpResponseHandler is
+	 * invoked.
+	 *
+	 * @param latency the time between sending the request and
+	 * receiving the response headers; std::nullopt if the request
+	 * had a body
+	 * @param error true if the request has failed or if the
+	 * application has declared itself unavailable
+	 */
+	virtual void OnWasResult([[maybe_unused]] std::optional<std::chrono::steady_clock::duration> latency,
+				 [[maybe_unused]] bool error) noexcept {}
+
 private:
+	std::optional<std::chrono::steady_clock::duration> GetLatency() const noexcept {
+		if (had_request_body)
+			return std::nullopt;
+
+		return std::chrono::steady_clock::now() - send_time;
+	}
+
 	/* virtual methods from class StockGetHandler */
 	void OnStockItemReady(StockItem &item) noexcept final;
 	void OnStockItemError(std::exception_ptr ep) noexcept final;
@@ -25,17 +25,35 @@
 
 using std::string_view_literals::operator""sv;
 
+/**
+ * Receive the shared memory offer from the client; errors are
+ * ignored, which means the client falls back to the pipes.
+ */
+static std::unique_ptr<WasShm>
+ReceiveShmOffer(SocketDescriptor control) noexcept
+try {
+	return WasShm::ReceiveOffer(control);
+} catch (...) {
+	return nullptr;
+}
+
 WasServer::WasServer(struct pool &_pool, EventLoop &event_loop,
 		     WasSocket &&_socket,
 		     WasServerHandler &_handler) noexcept
 	:pool(_pool),
 	 socket(std::move(_socket)),
+	 shm(ReceiveShmOffer(socket.control)),
 	 control(event_loop, socket.control, *this),
 	 handler(_handler)
 {
 	assert(socket.control.IsDefined());
 	assert(socket.input.IsDefined());
 	assert(socket.output.IsDefined());
+
+	if (shm)
+		/* the output buffer is empty, so this cannot fail */
+		control.SendString(WAS_COMMAND_NOP,
+				   WasShmPacketPayload(WasShmPacket::ACCEPT));
 }
 
 void
@@ -219,6 +237,17 @@ WasServer::OnWasControlPacket(enum was_command cmd,
 		HttpMethod method;
 
 	case WAS_COMMAND_NOP:
+		if (shm && WasShmParsePacket(payload) == WasShmPacket::DATA) {
+			if (request.state != Request::State::HEADERS) {
+				AbortProtocolError("misplaced shared memory DATA packet");
+				return false;
+			}
+
+			request.shm_body = true;
+		}
+
+		break;
+
 	case WAS_COMMAND_METRIC:
 		break;
 
@@ -233,6 +262,7 @@ WasServer::OnWasControlPacket(enum was_command cmd,
 		request.uri = nullptr;
 		request.headers = strmap_new(request.pool);
 		request.body = nullptr;
+		request.shm_body = false;
 		request.state = Request::State::HEADERS;
 		response.body = nullptr;
 		break;
@@ -337,8 +367,11 @@ WasServer::OnWasControlPacket(enum was_command cmd,
 			return false;
 		}
 
-		request.body = was_input_new(*request.pool, control.GetEventLoop(),
-					     socket.input, *this);
+		request.body = request.shm_body
+			? was_input_new(*request.pool, control.GetEventLoop(),
+					shm->GetInput(), *this)
+			: was_input_new(*request.pool, control.GetEventLoop(),
+					socket.input, *this);
 		request.state = Request::State::PENDING;
 		break;
 
@@ -458,7 +491,19 @@ WasServer::SendResponse(HttpStatus status,
 
 	Was::SendMap(control, WAS_COMMAND_HEADER, headers);
 
-	if (body) {
+	if (body && shm) {
+		if (!control.SendString(WAS_COMMAND_NOP,
+					WasShmPacketPayload(WasShmPacket::DATA)))
+			return;
+
+		response.body = was_output_new(*request.pool,
+					       control.GetEventLoop(),
+					       shm->GetOutput(), std::move(body),
+					       *this);
+		if (!control.Send(WAS_COMMAND_DATA) ||
+		    !was_output_check_length(*response.body))
+			return;
+	} else if (body) {
 		response.body = was_output_new(*request.pool,
 					       control.GetEventLoop(),
 					       socket.output, std::move(body),
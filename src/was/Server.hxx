@@ -6,6 +6,7 @@
 
 #include "Output.hxx"
 #include "Input.hxx"
+#include "Shm.hxx"
 #include "was/async/Control.hxx"
 #include "was/async/Socket.hxx"
 #include "pool/Ptr.hxx"
@@ -30,6 +31,11 @@ class WasServer final : Was::ControlHandler, WasOutputHandler, WasInputHandler {
 
 	WasSocket socket;
 
+	/**
+	 * The shared memory area offered by the client, or nullptr.
+	 */
+	const std::unique_ptr<WasShm> shm;
+
 	Was::Control control;
 
 	WasServerHandler &handler;
@@ -52,6 +58,12 @@ class WasServer final : Was::ControlHandler, WasOutputHandler, WasInputHandler {
 
 		bool released = false;
 
+		/**
+		 * Has the client announced that the request body is
+		 * transferred through #shm?
+		 */
+		bool shm_body;
+
 		enum class State : uint8_t {
 			/**
 			 * No request is being processed currently.
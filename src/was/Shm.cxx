@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Shm.hxx"
+#include "system/Error.hxx"
+#include "net/MsgHdr.hxx"
+#include "net/ScmRightsBuilder.hxx"
+#include "net/SendMessage.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "net/SocketError.hxx"
+#include "net/SocketProtocolError.hxx"
+#include "io/Iovec.hxx"
+#include "util/SpanCast.hxx"
+
+#include <was/protocol.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+static constexpr std::string_view offer_payload = "was-shm-offer"sv;
+static constexpr std::string_view accept_payload = "was-shm-accept"sv;
+static constexpr std::string_view data_payload = "was-shm-data"sv;
+
+static constexpr uint32_t WAS_SHM_MAGIC = 0x5753484d;
+
+/**
+ * The size of each ring.  This is a lot more than a pipe buffer, and
+ * the memory is only allocated by the kernel when it is used.
+ */
+static constexpr std::size_t WAS_SHM_RING_SIZE = 1024 * 1024;
+
+/**
+ * The beginning of the memfd, followed by the request ring and the
+ * response ring.
+ */
+struct WasShmHeader {
+	uint32_t magic;
+	uint32_t ring_size;
+
+	WasShmRingHeader request, response;
+};
+
+/**
+ * The size reserved for #WasShmHeader.
+ */
+static constexpr std::size_t WAS_SHM_HEADER_SIZE = 4096;
+static_assert(sizeof(WasShmHeader) <= WAS_SHM_HEADER_SIZE);
+
+std::string_view
+WasShmPacketPayload(WasShmPacket packet) noexcept
+{
+	switch (packet) {
+	case WasShmPacket::NONE:
+		break;
+
+	case WasShmPacket::OFFER:
+		return offer_payload;
+
+	case WasShmPacket::ACCEPT:
+		return accept_payload;
+
+	case WasShmPacket::DATA:
+		return data_payload;
+	}
+
+	return {};
+}
+
+WasShmPacket
+WasShmParsePacket(std::span<const std::byte> payload) noexcept
+{
+	const auto s = ToStringView(payload);
+	if (s == data_payload)
+		return WasShmPacket::DATA;
+	else if (s == accept_payload)
+		return WasShmPacket::ACCEPT;
+	else if (s == offer_payload)
+		return WasShmPacket::OFFER;
+	else
+		return WasShmPacket::NONE;
+}
+
+std::span<std::byte>
+WasShmRing::GetWriteBuffer() const noexcept
+{
+	const uint64_t tail = header->tail.load();
+
+	/* clip the distance, just in case the peer has written a
+	   bogus value */
+	const std::size_t fill = std::min<uint64_t>(position - tail, size);
+	const std::size_t offset = position & (size - 1);
+	return {data + offset, std::min(size - fill, size - offset)};
+}
+
+bool
+WasShmRing::Append(std::size_t nbytes) noexcept
+{
+	const uint64_t old_position = position;
+	position += nbytes;
+	header->head.store(position);
+
+	/* if the consumer has consumed everything we had written
+	   before, it may be waiting for more */
+	return header->tail.load() == old_position;
+}
+
+std::size_t
+WasShmRing::GetAvailable() const noexcept
+{
+	return std::min<uint64_t>(header->head.load() - position, size);
+}
+
+std::array<std::span<const std::byte>, 2>
+WasShmRing::GetReadBuffers() const noexcept
+{
+	const std::size_t available = GetAvailable();
+	const std::size_t offset = position & (size - 1);
+	const std::size_t first = std::min(available, size - offset);
+
+	return {
+		std::span<const std::byte>{data + offset, first},
+		std::span<const std::byte>{data, available - first},
+	};
+}
+
+bool
+WasShmRing::Consume(std::size_t nbytes) noexcept
+{
+	const uint64_t old_position = position;
+	position += nbytes;
+	header->tail.store(position);
+
+	/* if the ring was full, the producer may be waiting for
+	   free space */
+	return header->head.load() - old_position >= size;
+}
+
+std::size_t
+WasShmChannel::Write(std::span<const std::byte> src) noexcept
+{
+	std::size_t total = 0;
+	bool notify = false;
+
+	while (!src.empty()) {
+		const auto w = ring.GetWriteBuffer();
+		if (w.empty())
+			break;
+
+		const std::size_t nbytes = std::min(w.size(), src.size());
+		std::copy_n(src.begin(), nbytes, w.begin());
+		notify |= ring.Append(nbytes);
+
+		src = src.subspan(nbytes);
+		total += nbytes;
+	}
+
+	if (notify)
+		Signal(data_event);
+
+	return total;
+}
+
+void
+WasShmChannel::Drain(FileDescriptor event_fd) noexcept
+{
+	uint64_t value;
+	[[maybe_unused]] ssize_t nbytes =
+		event_fd.Read(std::as_writable_bytes(std::span{&value, 1}));
+}
+
+void
+WasShmChannel::Signal(FileDescriptor event_fd) noexcept
+{
+	const uint64_t value = 1;
+	[[maybe_unused]] ssize_t nbytes =
+		event_fd.Write(std::as_bytes(std::span{&value, 1}));
+}
+
+WasShm::WasShm(UniqueFileDescriptor &&_memfd,
+	       std::array<UniqueFileDescriptor, 4> &&_events,
+	       void *_map, std::size_t _map_size,
+	       bool _server) noexcept
+	:memfd(std::move(_memfd)), events(std::move(_events)),
+	 map(_map), map_size(_map_size),
+	 server(_server)
+{
+	auto &header = *static_cast<WasShmHeader *>(map);
+	auto *data = static_cast<std::byte *>(map) + WAS_SHM_HEADER_SIZE;
+	const std::size_t ring_size = header.ring_size;
+
+	request = {
+		WasShmRing{header.request, data, ring_size},
+		events[0], events[1],
+	};
+
+	response = {
+		WasShmRing{header.response, data + ring_size, ring_size},
+		events[2], events[3],
+	};
+}
+
+WasShm::~WasShm() noexcept
+{
+	munmap(map, map_size);
+}
+
+static UniqueFileDescriptor
+CreateEventFD()
+{
+	UniqueFileDescriptor fd{eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)};
+	if (!fd.IsDefined())
+		throw MakeErrno("eventfd() failed");
+
+	return fd;
+}
+
+std::unique_ptr<WasShm>
+WasShm::Create()
+{
+	UniqueFileDescriptor memfd{memfd_create("was-shm", MFD_CLOEXEC|MFD_ALLOW_SEALING)};
+	if (!memfd.IsDefined())
+		throw MakeErrno("memfd_create() failed");
+
+	const std::size_t size = WAS_SHM_HEADER_SIZE + 2 * WAS_SHM_RING_SIZE;
+	if (ftruncate(memfd.Get(), size) < 0)
+		throw MakeErrno("Failed to resize memfd");
+
+	/* the WAS application must not be able to shrink the file,
+	   which would crash us with SIGBUS */
+	if (fcntl(memfd.Get(), F_ADD_SEALS,
+		  F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0)
+		throw MakeErrno("Failed to seal memfd");
+
+	std::array<UniqueFileDescriptor, 4> events{
+		CreateEventFD(), CreateEventFD(),
+		CreateEventFD(), CreateEventFD(),
+	};
+
+	void *map = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED,
+			 memfd.Get(), 0);
+	if (map == MAP_FAILED)
+		throw MakeErrno("Failed to map memfd");
+
+	auto *header = ::new(map) WasShmHeader();
+	header->magic = WAS_SHM_MAGIC;
+	header->ring_size = WAS_SHM_RING_SIZE;
+
+	return std::unique_ptr<WasShm>(new WasShm(std::move(memfd),
+						  std::move(events),
+						  map, size, false));
+}
+
+void
+WasShm::SendOffer(SocketDescriptor control) const
+{
+	const struct was_header header{
+		.length = static_cast<uint16_t>(offer_payload.size()),
+		.command = WAS_COMMAND_NOP,
+	};
+
+	const std::array vec{
+		MakeIovecT(header),
+		MakeIovec(AsBytes(offer_payload)),
+	};
+
+	MessageHeader msg{vec};
+
+	ScmRightsBuilder<5> srb(msg);
+	srb.push_back(memfd.Get());
+	for (const auto &i : events)
+		srb.push_back(i.Get());
+	srb.Finish(msg);
+
+	const auto nbytes = SendMessage(control, msg, MSG_DONTWAIT);
+	if (nbytes != sizeof(header) + offer_payload.size())
+		throw std::runtime_error("Short send on WAS control socket");
+}
+
+/**
+ * Does the given buffer contain a #WasShmPacket::OFFER packet?
+ */
+[[gnu::pure]]
+static bool
+IsOffer(std::span<const std::byte> src) noexcept
+{
+	struct was_header header;
+	if (src.size() < sizeof(header))
+		return false;
+
+	std::memcpy(&header, src.data(), sizeof(header));
+	src = src.subspan(sizeof(header));
+
+	return header.command == WAS_COMMAND_NOP &&
+		header.length == src.size() &&
+		WasShmParsePacket(src) == WasShmPacket::OFFER;
+}
+
+std::unique_ptr<WasShm>
+WasShm::ReceiveOffer(SocketDescriptor control)
+{
+	std::array<std::byte, sizeof(struct was_header) + offer_payload.size()> buffer;
+
+	/* peek first, to leave all other packets to the
+	   Was::Control; the client sends the offer before starting
+	   this process, so if it isn't there already, there is
+	   none */
+	ssize_t nbytes = recv(control.Get(), buffer.data(), buffer.size(),
+			      MSG_PEEK|MSG_DONTWAIT);
+	if (nbytes != static_cast<ssize_t>(buffer.size()) || !IsOffer(buffer))
+		return nullptr;
+
+	std::array iov{MakeIovec(std::span{buffer})};
+	std::byte ccmsg[CMSG_SPACE(sizeof(int) * 5)];
+	auto msg = MakeMsgHdr(nullptr, iov, ccmsg);
+
+	nbytes = recvmsg(control.Get(), &msg, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+	if (nbytes < 0)
+		throw MakeSocketError("recvmsg() failed");
+
+	if (static_cast<std::size_t>(nbytes) != buffer.size())
+		throw SocketProtocolError{"Short WAS shared memory offer"};
+
+	UniqueFileDescriptor memfd;
+	std::array<UniqueFileDescriptor, 4> events;
+	std::size_t n_fds = 0;
+
+	for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		const std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		const auto *data = reinterpret_cast<const std::byte *>(CMSG_DATA(cmsg));
+		for (std::size_t i = 0; i < n; ++i) {
+			int fd;
+			std::memcpy(&fd, data + i * sizeof(fd), sizeof(fd));
+
+			UniqueFileDescriptor u{fd};
+			if (n_fds == 0)
+				memfd = std::move(u);
+			else if (n_fds <= events.size())
+				events[n_fds - 1] = std::move(u);
+
+			++n_fds;
+		}
+	}
+
+	if (n_fds != 1 + events.size() || (msg.msg_flags & MSG_CTRUNC) != 0)
+		throw SocketProtocolError{"Malformed WAS shared memory offer"};
+
+	struct stat st;
+	if (fstat(memfd.Get(), &st) < 0)
+		throw MakeErrno("Failed to stat memfd");
+
+	if (st.st_size < static_cast<off_t>(WAS_SHM_HEADER_SIZE))
+		throw SocketProtocolError{"WAS shared memory is too small"};
+
+	const std::size_t size = st.st_size;
+	void *map = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED,
+			 memfd.Get(), 0);
+	if (map == MAP_FAILED)
+		throw MakeErrno("Failed to map memfd");
+
+	const auto &header = *static_cast<const WasShmHeader *>(map);
+	const std::size_t ring_size = header.ring_size;
+	if (header.magic != WAS_SHM_MAGIC ||
+	    ring_size == 0 || (ring_size & (ring_size - 1)) != 0 ||
+	    size != WAS_SHM_HEADER_SIZE + 2 * ring_size) {
+		munmap(map, size);
+		throw SocketProtocolError{"Malformed WAS shared memory header"};
+	}
+
+	/* only the client needs the memfd */
+	memfd.Close();
+
+	return std::unique_ptr<WasShm>(new WasShm(std::move(memfd),
+						  std::move(events),
+						  map, size, true));
+}
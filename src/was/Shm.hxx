@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * An optional extension to the Web Application Socket protocol:
+ * request and response bodies are transferred through ring buffers
+ * in shared memory instead of the data pipes, which saves most
+ * system calls and wakeups for large bodies.
+ *
+ * Negotiation: the client creates a memfd and four eventfds and
+ * sends them (#SCM_RIGHTS) to the server in a #WAS_COMMAND_NOP
+ * packet with the #WasShmPacket::OFFER payload, before the server
+ * process is started.  Servers which do not know this extension
+ * ignore the NOP packet, and the kernel discards the file
+ * descriptors.  A server which supports it replies with a NOP packet
+ * containing #WasShmPacket::ACCEPT.
+ *
+ * After that, a peer may announce a #WasShmPacket::DATA packet right
+ * before #WAS_COMMAND_DATA, which means that this body is
+ * transferred through the ring instead of the pipe.  All other
+ * control packets keep their meaning; LENGTH and PREMATURE count the
+ * bytes appended to the ring.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+
+class SocketDescriptor;
+
+enum class WasShmPacket : uint_least8_t {
+	/**
+	 * Not a packet of this extension.
+	 */
+	NONE,
+
+	OFFER,
+	ACCEPT,
+	DATA,
+};
+
+/**
+ * Returns the payload of a #WAS_COMMAND_NOP packet which carries the
+ * given extension packet.
+ */
+[[gnu::const]]
+std::string_view
+WasShmPacketPayload(WasShmPacket packet) noexcept;
+
+/**
+ * Parse the payload of a #WAS_COMMAND_NOP packet.
+ */
+[[gnu::pure]]
+WasShmPacket
+WasShmParsePacket(std::span<const std::byte> payload) noexcept;
+
+/**
+ * The indexes of one ring, shared between both processes.  Each is
+ * the total number of bytes (modulo 2^64), and each is written by
+ * only one of the peers.
+ */
+struct WasShmRingHeader {
+	/**
+	 * The number of bytes appended by the producer.
+	 */
+	alignas(64) std::atomic<uint64_t> head;
+
+	/**
+	 * The number of bytes consumed by the consumer.
+	 */
+	alignas(64) std::atomic<uint64_t> tail;
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free);
+};
+
+/**
+ * A single-producer single-consumer byte ring in shared memory.
+ * Each process keeps its own copy of the index it owns, so a
+ * misbehaving peer can garble the data, but cannot make us access
+ * memory outside of the ring.
+ *
+ * Both indexes are accessed with sequential consistency: the
+ * producer stores "head" and then loads "tail", the consumer stores
+ * "tail" and then loads "head".  This way, at least one of them sees
+ * the other's update, and a peer which is waiting for an eventfd
+ * is always notified.
+ */
+class WasShmRing {
+	WasShmRingHeader *header = nullptr;
+	std::byte *data = nullptr;
+
+	/**
+	 * The size of #data; a power of two.
+	 */
+	std::size_t size = 0;
+
+	/**
+	 * Our own copy of "head" (if we're the producer) or "tail"
+	 * (if we're the consumer).
+	 */
+	uint64_t position = 0;
+
+public:
+	WasShmRing() noexcept = default;
+
+	WasShmRing(WasShmRingHeader &_header,
+		   std::byte *_data, std::size_t _size) noexcept
+		:header(&_header), data(_data), size(_size) {}
+
+	/* producer methods */
+
+	/**
+	 * Returns the free space at the current write position (which
+	 * may be less than the total free space if it wraps around).
+	 */
+	std::span<std::byte> GetWriteBuffer() const noexcept;
+
+	/**
+	 * Commit data which has been copied to GetWriteBuffer().
+	 *
+	 * @return true if the consumer may be waiting for data and
+	 * needs to be notified
+	 */
+	bool Append(std::size_t nbytes) noexcept;
+
+	/* consumer methods */
+
+	/**
+	 * Returns the number of bytes which can be consumed.
+	 */
+	std::size_t GetAvailable() const noexcept;
+
+	/**
+	 * Returns the data which can be consumed in up to two
+	 * segments (the second one is non-empty if the data wraps
+	 * around the end of the ring).
+	 */
+	std::array<std::span<const std::byte>, 2> GetReadBuffers() const noexcept;
+
+	/**
+	 * Mark data as consumed.  The caller must not consume more
+	 * than GetAvailable().
+	 *
+	 * @return true if the producer may be waiting for free space
+	 * and needs to be notified
+	 */
+	bool Consume(std::size_t nbytes) noexcept;
+};
+
+/**
+ * One direction of a #WasShm: a ring and two eventfds.
+ */
+class WasShmChannel {
+	WasShmRing ring;
+
+	/**
+	 * Signalled by the producer after appending data.
+	 */
+	FileDescriptor data_event;
+
+	/**
+	 * Signalled by the consumer after consuming data.
+	 */
+	FileDescriptor space_event;
+
+	/**
+	 * Is a body being received through this channel?  This is
+	 * set by the #WasInput and cleared when the body has been
+	 * received completely, to allow discarding the rest after
+	 * #WAS_COMMAND_STOP.
+	 */
+	bool active = false;
+
+public:
+	WasShmChannel() noexcept = default;
+
+	WasShmChannel(const WasShmRing &_ring,
+		      FileDescriptor _data_event,
+		      FileDescriptor _space_event) noexcept
+		:ring(_ring),
+		 data_event(_data_event), space_event(_space_event) {}
+
+	auto &GetRing() noexcept {
+		return ring;
+	}
+
+	const auto &GetRing() const noexcept {
+		return ring;
+	}
+
+	FileDescriptor GetDataEvent() const noexcept {
+		return data_event;
+	}
+
+	FileDescriptor GetSpaceEvent() const noexcept {
+		return space_event;
+	}
+
+	bool IsActive() const noexcept {
+		return active;
+	}
+
+	void SetActive(bool _active) noexcept {
+		active = _active;
+	}
+
+	/**
+	 * Copy as much of the given data as possible to the ring
+	 * and notify the consumer.
+	 *
+	 * @return the number of bytes copied
+	 */
+	std::size_t Write(std::span<const std::byte> src) noexcept;
+
+	/**
+	 * Consume data from the ring and notify the producer.
+	 */
+	void Consume(std::size_t nbytes) noexcept {
+		if (ring.Consume(nbytes))
+			Signal(space_event);
+	}
+
+	/**
+	 * Reset the counter of the given eventfd after it has been
+	 * reported readable.
+	 */
+	static void Drain(FileDescriptor event_fd) noexcept;
+
+private:
+	static void Signal(FileDescriptor event_fd) noexcept;
+};
+
+/**
+ * The shared memory area of one WAS connection: one ring for request
+ * bodies and one for response bodies.
+ */
+class WasShm {
+	/**
+	 * Only the client keeps this, to be able to send it with the
+	 * offer.
+	 */
+	UniqueFileDescriptor memfd;
+
+	/**
+	 * The eventfds: data and space for request bodies, then data
+	 * and space for response bodies.
+	 */
+	std::array<UniqueFileDescriptor, 4> events;
+
+	void *map;
+	std::size_t map_size;
+
+	WasShmChannel request, response;
+
+	/**
+	 * Are we the WAS server (i.e. the application)?
+	 */
+	const bool server;
+
+	/**
+	 * Has the server accepted the offer?
+	 */
+	bool accepted = false;
+
+	WasShm(UniqueFileDescriptor &&_memfd,
+	       std::array<UniqueFileDescriptor, 4> &&_events,
+	       void *_map, std::size_t _map_size,
+	       bool _server) noexcept;
+
+public:
+	~WasShm() noexcept;
+
+	WasShm(const WasShm &) = delete;
+	WasShm &operator=(const WasShm &) = delete;
+
+	/**
+	 * Create a new shared memory area (for the client).
+	 *
+	 * Throws on error.
+	 */
+	static std::unique_ptr<WasShm> Create();
+
+	/**
+	 * Send the #WasShmPacket::OFFER packet with all file
+	 * descriptors.  This must be done before anybody else writes
+	 * to the control socket, i.e. before the server process is
+	 * started.
+	 *
+	 * Throws on error.
+	 */
+	void SendOffer(SocketDescriptor control) const;
+
+	/**
+	 * Check whether the client has sent an offer, and if so,
+	 * receive it (for the server).  This must be done before
+	 * anybody else reads from the control socket.
+	 *
+	 * Throws on error.
+	 *
+	 * @return nullptr if there is no offer
+	 */
+	static std::unique_ptr<WasShm> ReceiveOffer(SocketDescriptor control);
+
+	bool IsAccepted() const noexcept {
+		return accepted;
+	}
+
+	void SetAccepted() noexcept {
+		accepted = true;
+	}
+
+	/**
+	 * The channel for the bodies we send.
+	 */
+	WasShmChannel &GetOutput() noexcept {
+		return server ? response : request;
+	}
+
+	/**
+	 * The channel for the bodies we receive.
+	 */
+	WasShmChannel &GetInput() noexcept {
+		return server ? request : response;
+	}
+};
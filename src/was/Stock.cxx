@@ -44,7 +44,8 @@ public:
 			  ChildErrorLog &&_log,
 			  WasProcess &&process,
 			  std::string_view _tag, bool _disposable) noexcept
-		:WasStockConnection(c, std::move(process)),
+		:WasStockConnection(c, std::move(process),
+				    std::move(process.shm)),
 		 tag(_tag),
 		 log(std::move(_log)),
 		 handle(std::move(process.handle)),
@@ -112,7 +113,8 @@ WasStock::Create(CreateStockItem c, StockRequest _request,
 				  params.options,
 				  log.EnableClient(GetEventLoop(),
 						   log_sink, log_options,
-						   params.options.stderr_pond));
+						   params.options.stderr_pond),
+				  shm);
 
 	auto *child = new WasChild(c, std::move(log), std::move(process), params.options.tag, params.disposable);
 
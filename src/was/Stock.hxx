@@ -33,6 +33,12 @@ class WasStock final : StockClass {
 	Net::Log::Sink *const log_sink;
 	const ChildErrorLogOptions log_options;
 
+	/**
+	 * Offer transferring bodies through shared memory to new
+	 * child processes (see #WasShm)?
+	 */
+	const bool shm;
+
 	class WasStockMap final : public StockMap {
 	public:
 		using StockMap::StockMap;
@@ -53,10 +59,12 @@ public:
 			  ListenStreamStock *_listen_stream_stock,
 			  Net::Log::Sink *_log_sink,
 			  const ChildErrorLogOptions &_log_options,
-			  unsigned limit, unsigned max_idle) noexcept
+			  unsigned limit, unsigned max_idle,
+			  bool _shm) noexcept
 		:spawn_service(_spawn_service),
 		 listen_stream_stock(_listen_stream_stock),
 		 log_sink(_log_sink), log_options(_log_options),
+		 shm(_shm),
 		 stock(event_loop, *this, limit, max_idle,
 		       std::chrono::minutes(10)) {}
 
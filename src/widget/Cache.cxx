@@ -3,27 +3,89 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "Cache.hxx"
+#include "Class.hxx"
 #include "pool/pool.hxx"
+#include "memory/AllocatorStats.hxx"
+#include "io/Logger.hxx"
 #include "AllocatorPtr.hxx"
 
-inline
-WidgetClassCache::Item::Item(PoolPtr &&_pool, const WidgetClass &_cls) noexcept
-	:PoolHolder(std::move(_pool)), cls(AllocatorPtr(pool), _cls)
+struct WidgetClassCache::Item final : PoolHolder, CacheItem {
+	const char *const name;
+
+	const WidgetClass cls;
+
+	AllocatorStats stats;
+
+	Item(PoolPtr &&_pool, std::chrono::steady_clock::time_point now,
+	     std::chrono::seconds max_age,
+	     const char *_name, const WidgetClass &_cls) noexcept
+		:PoolHolder(std::move(_pool)),
+		 CacheItem(now, max_age, 1),
+		 name(p_strdup(pool, _name)),
+		 cls(AllocatorPtr(pool), _cls),
+		 stats(pool_stats(*pool)) {}
+
+	/* virtual methods from class CacheItem */
+	void Destroy() noexcept override {
+		pool_trash(pool);
+		this->~Item();
+	}
+};
+
+WidgetClassCache::WidgetClassCache(EventLoop &event_loop,
+				   struct pool &parent_pool) noexcept
+	:PoolHolder(pool_new_dummy(&parent_pool, "WidgetClassCache")),
+	 cache(event_loop, max_items, this) {}
+
+WidgetClassCache::~WidgetClassCache() noexcept = default;
+
+const WidgetClass *
+WidgetClassCache::Get(const char *name) noexcept
 {
-}
+	auto *item = (Item *)cache.Get(name);
+	if (item == nullptr) {
+		LogConcat(6, "WidgetClassCache", "miss ", name);
+		++stats.misses;
+		return nullptr;
+	}
 
-WidgetClassCache::WidgetClassCache(struct pool &parent_pool) noexcept
-	:PoolHolder(pool_new_dummy(&parent_pool, "WidgetClassCache")) {}
+	LogConcat(6, "WidgetClassCache", "hit ", name);
+	++stats.hits;
+	return &item->cls;
+}
 
 void
-WidgetClassCache::Put(const char *name, const WidgetClass &cls) noexcept
+WidgetClassCache::Put(const char *name, const WidgetClass &cls,
+		      std::chrono::seconds max_age) noexcept
 {
-	auto item_pool = pool_new_linear(pool, "WidgetClassCacheItem", 4096);
+	if (max_age == std::chrono::seconds::zero()) {
+		++stats.skips;
+		return;
+	}
 
-	/* move the string to the new pool */
-	name = p_strdup(item_pool, name);
+	constexpr std::chrono::seconds max_max_age = std::chrono::hours(24);
+	if (max_age < std::chrono::seconds::zero() || max_age > max_max_age)
+		/* limit to one day */
+		max_age = max_max_age;
 
-	map.emplace(std::piecewise_construct,
-		    std::forward_as_tuple(name),
-		    std::forward_as_tuple(std::move(item_pool), cls));
+	auto *item = NewFromPool<Item>(pool_new_linear(pool, "WidgetClassCacheItem", 4096),
+				       cache.SteadyNow(), max_age,
+				       name, cls);
+
+	++stats.stores;
+	cache.Put(item->name, *item);
+}
+
+void
+WidgetClassCache::OnCacheItemAdded(const CacheItem &_item) noexcept
+{
+	const auto &item = (const Item &)_item;
+	stats.allocator += item.stats;
+}
+
+void
+WidgetClassCache::OnCacheItemRemoved(const CacheItem &_item) noexcept
+{
+	const auto &item = (const Item &)_item;
+	stats.allocator -= item.stats;
 }
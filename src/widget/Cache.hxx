@@ -4,34 +4,70 @@
 
 #pragma once
 
-#include "Class.hxx"
+#include "stats/CacheStats.hxx"
 #include "pool/Holder.hxx"
-#include "util/StringLess.hxx"
+#include "cache.hxx"
 
-#include <map>
+#include <chrono>
 
-class WidgetClassCache final : PoolHolder {
-	struct Item final : PoolHolder {
-		const WidgetClass cls;
+struct WidgetClass;
 
-		Item(PoolPtr &&_pool, const WidgetClass &_cls) noexcept;
-	};
+/**
+ * A cache for widget classes received from the translation server.
+ * The number of items is bounded; the least recently used ones are
+ * evicted first, and items expire after the "max_age" specified by
+ * the translation server (at most one day).
+ */
+class WidgetClassCache final : PoolHolder, CacheHandler {
+	static constexpr std::size_t max_items = 16384;
 
-	std::map<const char *, Item, StringLess> map;
+	struct Item;
+
+	Cache cache;
+
+	CacheStats stats{};
 
 public:
-	explicit WidgetClassCache(struct pool &parent_pool) noexcept;
+	WidgetClassCache(EventLoop &event_loop,
+			 struct pool &parent_pool) noexcept;
 
-	const WidgetClass *Get(const char *name) const noexcept {
-		auto i = map.find(name);
-		return i != map.end()
-			? &i->second.cls
-			: nullptr;
+	~WidgetClassCache() noexcept;
+
+	const CacheStats &GetStats() const noexcept {
+		return stats;
 	}
 
-	void Put(const char *name, const WidgetClass &cls) noexcept;
+	/**
+	 * Look up a widget class.  The returned pointer is only valid
+	 * until the caller returns to the event loop; it must be
+	 * copied.
+	 */
+	const WidgetClass *Get(const char *name) noexcept;
+
+	/**
+	 * Like Get(), but only check whether the item exists and
+	 * don't update the statistics.
+	 */
+	bool Contains(const char *name) noexcept {
+		return cache.Get(name) != nullptr;
+	}
+
+	/**
+	 * Add a copy of the specified widget class to the cache.
+	 *
+	 * @param max_age the "max_age" from the translation response;
+	 * zero means the class must not be cached, negative means
+	 * unspecified
+	 */
+	void Put(const char *name, const WidgetClass &cls,
+		 std::chrono::seconds max_age) noexcept;
 
 	void Clear() noexcept {
-		map.clear();
+		cache.Flush();
 	}
+
+private:
+	/* virtual methods from CacheHandler */
+	void OnCacheItemAdded(const CacheItem &item) noexcept override;
+	void OnCacheItemRemoved(const CacheItem &item) noexcept override;
 };
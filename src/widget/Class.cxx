@@ -20,7 +20,8 @@ WidgetClass::WidgetClass(AllocatorPtr alloc, const WidgetClass &src) noexcept
 	 require_csrf_token(src.require_csrf_token),
 	 anchor_absolute(src.anchor_absolute),
 	 info_headers(src.info_headers),
-	 dump_headers(src.dump_headers)
+	 dump_headers(src.dump_headers),
+	 fragment_max_age(src.fragment_max_age)
 {
 	container_groups.CopyFrom(alloc, src.container_groups);
 }
@@ -7,6 +7,8 @@
 #include "VList.hxx"
 #include "util/StringSet.hxx"
 
+#include <chrono>
+
 /**
  * A widget class is a server which provides a widget.
  */
@@ -95,6 +97,13 @@ struct WidgetClass {
 
 	bool dump_headers = false;
 
+	/**
+	 * How long may the rendered output of this widget be served
+	 * from the #WidgetFragmentCache?  Zero means it must not be
+	 * cached.  See #TRANSLATE_WIDGET_FRAGMENT_CACHE.
+	 */
+	std::chrono::seconds fragment_max_age{};
+
 	WidgetClass() = default;
 	WidgetClass(AllocatorPtr alloc, const WidgetClass &src) noexcept;
 
@@ -13,6 +13,7 @@
 class EventLoop;
 class ResourceLoader;
 class WidgetRegistry;
+class WidgetFragmentCache;
 class StringMap;
 class SessionManager;
 class SessionLease;
@@ -29,6 +30,12 @@ struct WidgetContext {
 
 	WidgetRegistry *widget_registry;
 
+	/**
+	 * If non-nullptr, then the rendered output of cacheable
+	 * inline widgets is stored here.
+	 */
+	WidgetFragmentCache *fragment_cache = nullptr;
+
 	const char *site_name;
 
 	/**
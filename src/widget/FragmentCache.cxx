@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "FragmentCache.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/SharedLeaseIstream.hxx"
+#include "istream/TeeIstream.hxx"
+#include "memory/istream_rubber.hxx"
+#include "memory/sink_rubber.hxx"
+#include "pool/pool.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/Loop.hxx"
+#include "io/Logger.hxx"
+#include "util/Cancellable.hxx"
+#include "util/LeakDetector.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <string>
+#include <string_view>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * Widget fragments are embedded in a template; larger ones are
+ * unusual and not worth the memory.
+ */
+static constexpr off_t cacheable_size_limit = 256 * 1024;
+
+struct WidgetFragmentCache::Item final : CacheItem, LeakDetector {
+	const std::string key;
+
+	const RubberAllocation allocation;
+
+	Item(const char *_key,
+	     std::chrono::steady_clock::time_point now,
+	     std::chrono::system_clock::time_point system_now,
+	     std::chrono::seconds max_age,
+	     std::size_t _size, RubberAllocation &&_allocation) noexcept
+		:CacheItem(now, system_now, system_now + max_age, _size),
+		 key(_key),
+		 allocation(std::move(_allocation)) {}
+
+	const char *GetKey() const noexcept {
+		return key.c_str();
+	}
+
+	/* virtual methods from class CacheItem */
+	void Destroy() noexcept override {
+		delete this;
+	}
+};
+
+class WidgetFragmentCache::Store final
+	: public AutoUnlinkIntrusiveListHook, RubberSinkHandler, LeakDetector
+{
+	static constexpr Event::Duration timeout = std::chrono::minutes(1);
+
+	WidgetFragmentCache &cache;
+
+	const char *const key;
+
+	const std::chrono::seconds max_age;
+
+	/**
+	 * This event limits the duration for receiving the fragment.
+	 */
+	CoarseTimerEvent timeout_event;
+
+	/**
+	 * To cancel the RubberSink.
+	 */
+	CancellablePointer rubber_cancel_ptr;
+
+public:
+	Store(WidgetFragmentCache &_cache, const char *_key,
+	      std::chrono::seconds _max_age) noexcept
+		:cache(_cache), key(_key), max_age(_max_age),
+		 timeout_event(cache.GetEventLoop(), BIND_THIS_METHOD(OnTimeout)) {}
+
+	/**
+	 * Release resources held by this request.
+	 */
+	void Destroy() noexcept {
+		assert(!rubber_cancel_ptr);
+
+		this->~Store();
+	}
+
+	void Start(struct pool &pool, UnusedIstreamPtr &&src) noexcept {
+		timeout_event.Schedule(timeout);
+
+		sink_rubber_new(pool, std::move(src),
+				cache.rubber, cacheable_size_limit,
+				*this,
+				rubber_cancel_ptr);
+	}
+
+	/**
+	 * Cancel storing the fragment.
+	 */
+	void CancelStore() noexcept {
+		assert(rubber_cancel_ptr);
+
+		rubber_cancel_ptr.Cancel();
+		Destroy();
+	}
+
+private:
+	void OnTimeout() noexcept {
+		/* rendering the widget has taken too long already;
+		   don't store this fragment */
+		LogConcat(4, "WidgetFragmentCache", "timeout ", key);
+		CancelStore();
+	}
+
+	/* virtual methods from class RubberSinkHandler */
+	void RubberDone(RubberAllocation &&a, std::size_t size) noexcept override;
+	void RubberOutOfMemory() noexcept override;
+	void RubberTooLarge() noexcept override;
+	void RubberError(std::exception_ptr ep) noexcept override;
+};
+
+void
+WidgetFragmentCache::Store::RubberDone(RubberAllocation &&a,
+				       std::size_t size) noexcept
+{
+	rubber_cancel_ptr = nullptr;
+
+	cache.Add(key, max_age, std::move(a), size);
+
+	Destroy();
+}
+
+void
+WidgetFragmentCache::Store::RubberOutOfMemory() noexcept
+{
+	rubber_cancel_ptr = nullptr;
+
+	LogConcat(4, "WidgetFragmentCache", "nocache oom ", key);
+	++cache.stats.skips;
+	Destroy();
+}
+
+void
+WidgetFragmentCache::Store::RubberTooLarge() noexcept
+{
+	rubber_cancel_ptr = nullptr;
+
+	LogConcat(4, "WidgetFragmentCache", "nocache too large ", key);
+	++cache.stats.skips;
+	Destroy();
+}
+
+void
+WidgetFragmentCache::Store::RubberError(std::exception_ptr ep) noexcept
+{
+	rubber_cancel_ptr = nullptr;
+
+	LogConcat(4, "WidgetFragmentCache", "body_error ", key, ": ", ep);
+	++cache.stats.skips;
+	Destroy();
+}
+
+static constexpr std::string_view
+NullableString(const char *s) noexcept
+{
+	return s != nullptr ? std::string_view{s} : std::string_view{};
+}
+
+const char *
+WidgetFragmentCache::MakeKey(AllocatorPtr alloc, const char *class_name,
+			     const char *path_info,
+			     const char *query_string,
+			     const char *id_path,
+			     const char *prefix,
+			     const char *page_uri) noexcept
+{
+	/* an empty query string is different from none */
+	const std::string_view query_separator = query_string != nullptr
+		? "?"sv
+		: std::string_view{};
+
+	return alloc.Concat(class_name, '|', NullableString(path_info),
+			    query_separator, NullableString(query_string),
+			    '|', NullableString(id_path),
+			    '|', NullableString(prefix),
+			    '|', NullableString(page_uri));
+}
+
+UnusedIstreamPtr
+WidgetFragmentCache::Get(struct pool &pool, const char *key) noexcept
+{
+	auto *item = (Item *)cache.Get(key);
+	if (item == nullptr) {
+		LogConcat(6, "WidgetFragmentCache", "miss ", key);
+		++stats.misses;
+		return {};
+	}
+
+	LogConcat(5, "WidgetFragmentCache", "hit ", key);
+	++stats.hits;
+
+	return NewSharedLeaseIstream(pool,
+				     istream_rubber_new(pool, rubber, item->allocation.GetId(),
+							0, item->GetSize(), false),
+				     *item);
+}
+
+UnusedIstreamPtr
+WidgetFragmentCache::Put(struct pool &pool, const char *key,
+			 UnusedIstreamPtr src,
+			 std::chrono::seconds max_age) noexcept
+{
+	if (!src)
+		return src;
+
+	if (const auto available = src.GetAvailable(true);
+	    available > cacheable_size_limit) {
+		LogConcat(4, "WidgetFragmentCache", "nocache too large ", key);
+		++stats.skips;
+		return src;
+	}
+
+	LogConcat(4, "WidgetFragmentCache", "put ", key);
+
+	/* tee the fragment: one goes into the template, and one goes
+	   into the cache */
+	src = NewTeeIstream(pool, std::move(src),
+			    GetEventLoop(),
+			    false, false);
+
+	auto store = NewFromPool<Store>(pool, *this, key, max_age);
+	stores.push_back(*store);
+
+	store->Start(pool, AddTeeIstream(src, true));
+
+	return src;
+}
+
+void
+WidgetFragmentCache::Add(const char *key, std::chrono::seconds max_age,
+			 RubberAllocation &&a, std::size_t size) noexcept
+{
+	LogConcat(4, "WidgetFragmentCache", "add ", key);
+	++stats.stores;
+
+	auto item = new Item(key,
+			     cache.SteadyNow(),
+			     cache.SystemNow(),
+			     max_age,
+			     size,
+			     std::move(a));
+
+	cache.Put(item->GetKey(), *item);
+}
+
+WidgetFragmentCache::WidgetFragmentCache(EventLoop &_event_loop,
+					 std::size_t max_size)
+	:rubber(max_size, "widget_fragment_cache"),
+	 /* leave 12.5% of the rubber allocator empty, see
+	    EncodingCache */
+	 cache(_event_loop, max_size * 7 / 8),
+	 compress_timer(_event_loop, BIND_THIS_METHOD(OnCompressTimer))
+{
+	compress_timer.Schedule(compress_interval);
+}
+
+WidgetFragmentCache::~WidgetFragmentCache() noexcept
+{
+	stores.clear_and_dispose([](auto *r){ r->CancelStore(); });
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "stats/CacheStats.hxx"
+#include "memory/Rubber.hxx"
+#include "event/FarTimerEvent.hxx"
+#include "util/IntrusiveList.hxx"
+#include "cache.hxx"
+
+class AllocatorPtr;
+class UnusedIstreamPtr;
+
+/**
+ * A cache for the rendered (i.e. processed and formatted) output of
+ * inline widgets.  A hit allows embedding the widget without
+ * contacting the widget server and without running the processor.
+ *
+ * The translation server opts in per widget class with
+ * #TRANSLATE_WIDGET_FRAGMENT_CACHE (see WidgetClass::fragment_max_age).
+ */
+class WidgetFragmentCache final {
+	static constexpr Event::Duration compress_interval = std::chrono::minutes(10);
+
+	Rubber rubber;
+	Cache cache;
+
+	FarTimerEvent compress_timer;
+
+	struct Item;
+
+	class Store;
+
+	IntrusiveList<Store> stores;
+
+	mutable CacheStats stats{};
+
+public:
+	WidgetFragmentCache(EventLoop &_event_loop, std::size_t max_size);
+
+	~WidgetFragmentCache() noexcept;
+
+	auto &GetEventLoop() const noexcept {
+		return compress_timer.GetEventLoop();
+	}
+
+	void ForkCow(bool inherit) noexcept {
+		rubber.ForkCow(inherit);
+	}
+
+	CacheStats GetStats() const noexcept {
+		stats.allocator = rubber.GetStats();
+		return stats;
+	}
+
+	void Flush() noexcept {
+		cache.Flush();
+		Compress();
+	}
+
+	/**
+	 * Build a cache key.  By enabling the cache for a widget
+	 * class, the translation server declares that the output
+	 * depends only on these parameters.
+	 *
+	 * The processors rewrite URIs relative to the page and
+	 * prefix XML ids and CSS classes with the widget's id path
+	 * and prefix, therefore these are part of the key, too.
+	 *
+	 * @param path_info the path_info from the template
+	 * @param query_string the query string from the template (may
+	 * be nullptr)
+	 * @param id_path the widget's id path (may be nullptr)
+	 * @param prefix the widget's XML id prefix (may be nullptr)
+	 * @param page_uri the absolute URI of the page the widget is
+	 * embedded in (may be nullptr)
+	 */
+	static const char *MakeKey(AllocatorPtr alloc, const char *class_name,
+				   const char *path_info,
+				   const char *query_string,
+				   const char *id_path,
+				   const char *prefix,
+				   const char *page_uri) noexcept;
+
+	/**
+	 * @return the cached fragment or a "nulled" pointer on cache
+	 * miss
+	 */
+	UnusedIstreamPtr Get(struct pool &pool, const char *key) noexcept;
+
+	/**
+	 * Tee the specified fragment into the cache.
+	 *
+	 * @param key the cache key; it must be allocated from #pool
+	 * @param max_age how long may the fragment be served from the
+	 * cache?
+	 * @return the istream which replaces #src
+	 */
+	UnusedIstreamPtr Put(struct pool &pool, const char *key,
+			     UnusedIstreamPtr src,
+			     std::chrono::seconds max_age) noexcept;
+
+private:
+	void Add(const char *key, std::chrono::seconds max_age,
+		 RubberAllocation &&a, std::size_t size) noexcept;
+
+	void Compress() noexcept {
+		rubber.Compress();
+	}
+
+	void OnCompressTimer() noexcept {
+		Compress();
+		compress_timer.Schedule(compress_interval);
+	}
+};
@@ -6,8 +6,10 @@
 #include "Request.hxx"
 #include "Error.hxx"
 #include "Widget.hxx"
+#include "Class.hxx"
 #include "Context.hxx"
 #include "Resolver.hxx"
+#include "FragmentCache.hxx"
 #include "http/CommonHeaders.hxx"
 #include "http/HeaderUtil.hxx"
 #include "http/ResponseHandler.hxx"
@@ -64,6 +66,12 @@ class InlineWidget final : PoolLeakDetector, HttpResponseHandler, Cancellable {
 
 	CancellablePointer cancel_ptr;
 
+	/**
+	 * The #WidgetFragmentCache key for this widget; nullptr if the
+	 * widget is not cacheable.
+	 */
+	const char *fragment_key = nullptr;
+
 public:
 	InlineWidget(struct pool &_pool, SharedPoolPtr<WidgetContext> &&_ctx,
 		     const StopwatchPtr &_parent_stopwatch,
@@ -169,13 +177,16 @@ widget_response_format(struct pool &pool, const Widget &widget,
 		   utf-8; this widget however used a different charset.
 		   Automatically convert it with istream_iconv */
 		const char *charset2 = p_strdup(pool, charset);
-		auto ic = istream_iconv_new(pool, std::move(body), "utf-8", charset2);
+		IconvPath path;
+		auto ic = istream_iconv_new(pool, std::move(body), "utf-8", charset2,
+					    &path);
 		if (!ic)
 			throw WidgetError(widget, WidgetErrorCode::UNSUPPORTED_ENCODING,
 					  FmtBuffer<64>("widget sent unknown charset '{}'",
 							charset2));
 
-		widget.logger.Fmt(6, "charset conversion {:?} -> UTF-8", charset);
+		widget.logger.Fmt(6, "charset conversion {:?} -> UTF-8 ({})", charset,
+				  path == IconvPath::BUILTIN ? "builtin"sv : "iconv"sv);
 		body = std::move(ic);
 	}
 
@@ -197,6 +208,31 @@ widget_response_format(struct pool &pool, const Widget &widget,
 	return body;
 }
 
+/**
+ * May the rendered output of this widget be stored in the
+ * #WidgetFragmentCache?  The widget class must have opted in (see
+ * #TRANSLATE_WIDGET_FRAGMENT_CACHE), and everything which depends on
+ * state not described by WidgetFragmentCache::MakeKey() is
+ * excluded.
+ */
+[[gnu::pure]]
+static bool
+IsFragmentCacheable(const Widget &widget, bool plain_text) noexcept
+{
+	return widget.cls->fragment_max_age > std::chrono::seconds{} &&
+		!widget.cls->stateful &&
+		widget.from_request.method == HttpMethod::GET &&
+		!widget.from_request.body &&
+		widget.for_focused == nullptr &&
+		/* a container's output includes its child widgets,
+		   which have their own caching rules */
+		!widget.IsContainer() &&
+		/* the key contains neither the view nor the output
+		   format */
+		widget.GetEffectiveView() == widget.GetDefaultView() &&
+		!plain_text;
+}
+
 /*
  * HTTP response handler
  *
@@ -230,6 +266,12 @@ InlineWidget::OnHttpResponse(HttpStatus status, StringMap &&headers,
 			body = widget_response_format(pool, widget,
 						      headers, std::move(body),
 						      plain_text);
+
+			if (fragment_key != nullptr &&
+			    status == HttpStatus::OK)
+				body = ctx->fragment_cache->Put(pool, fragment_key,
+							       std::move(body),
+							       widget.cls->fragment_max_age);
 		} catch (...) {
 			Fail(std::current_exception());
 			return;
@@ -297,6 +339,33 @@ try {
 			widget.session_sync_pending = false;
 	}
 
+	if (ctx->fragment_cache != nullptr &&
+	    IsFragmentCacheable(widget, plain_text)) {
+		/* the widget is not stateful, therefore only the
+		   path_info and the query string from the template
+		   are relevant for the request; the processors
+		   however rewrite the output for this widget
+		   instance and this page */
+		fragment_key =
+			WidgetFragmentCache::MakeKey(pool, widget.class_name,
+						     widget.GetDefaultPathInfo(),
+						     widget.from_template.query_string,
+						     widget.GetIdPath(),
+						     widget.GetPrefix(),
+						     ctx->absolute_uri != nullptr
+						     ? ctx->absolute_uri
+						     : ctx->uri);
+
+		if (auto cached = ctx->fragment_cache->Get(pool, fragment_key)) {
+			/* cache hit: no need to contact the widget
+			   server or to run the processor */
+			auto &_delayed = delayed;
+			Destroy();
+			_delayed.Set(std::move(cached));
+			return;
+		}
+	}
+
 	header_timeout_event.Schedule(inline_widget_header_timeout);
 	widget_http_request(pool, widget, ctx,
 			    parent_stopwatch,
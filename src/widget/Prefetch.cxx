@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Prefetch.hxx"
+#include "Registry.hxx"
+#include "pool/pool.hxx"
+#include "util/Cancellable.hxx"
+
+class WidgetClassPrefetch::Job final
+	: public IntrusiveListHook<IntrusiveHookMode::NORMAL>
+{
+	WidgetClassPrefetch &prefetch;
+
+	const char *const name;
+
+	LimitedConcurrencyJob throttle_job;
+
+	/**
+	 * Cancels the #WidgetRegistry lookup.  This is only set
+	 * while the lookup is in flight.
+	 */
+	CancellablePointer cancel_ptr;
+
+public:
+	Job(WidgetClassPrefetch &_prefetch, const char *_name) noexcept
+		:prefetch(_prefetch), name(_name),
+		 throttle_job(prefetch.queue, BIND_THIS_METHOD(OnThrottled)) {}
+
+	~Job() noexcept {
+		if (cancel_ptr)
+			cancel_ptr.Cancel();
+	}
+
+	void Start() noexcept {
+		throttle_job.Schedule();
+	}
+
+private:
+	/* LimitedConcurrencyJob callback */
+	void OnThrottled() noexcept {
+		prefetch.registry.LookupWidgetClass(prefetch.pool, prefetch.pool,
+						    name,
+						    BIND_THIS_METHOD(OnLookup),
+						    cancel_ptr);
+	}
+
+	/* WidgetRegistryCallback */
+	void OnLookup(const WidgetClass *) noexcept {
+		/* the result has already been stored in the
+		   WidgetRegistry's cache (if it is cacheable at all);
+		   this copy is not needed */
+		cancel_ptr = nullptr;
+		prefetch.Finish(*this);
+	}
+};
+
+WidgetClassPrefetch::WidgetClassPrefetch(EventLoop &event_loop,
+					 struct pool &_pool,
+					 WidgetRegistry &_registry) noexcept
+	:pool(_pool), registry(_registry),
+	 queue(event_loop, concurrency_limit) {}
+
+WidgetClassPrefetch::~WidgetClassPrefetch() noexcept
+{
+	jobs.clear_and_dispose([](Job *job){ job->~Job(); });
+}
+
+void
+WidgetClassPrefetch::Add(const char *name) noexcept
+{
+	if (registry.IsCached(name))
+		/* nothing to do */
+		return;
+
+	auto *job = NewFromPool<Job>(pool, *this, name);
+	jobs.push_back(*job);
+
+	/* this may finish (and destroy the Job) synchronously */
+	job->Start();
+}
+
+inline void
+WidgetClassPrefetch::Finish(Job &job) noexcept
+{
+	jobs.erase_and_dispose(jobs.iterator_to(job),
+			       [](Job *j){ j->~Job(); });
+}
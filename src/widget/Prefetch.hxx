@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "util/IntrusiveList.hxx"
+#include "util/LimitedConcurrencyQueue.hxx"
+
+struct pool;
+class EventLoop;
+class WidgetRegistry;
+
+/**
+ * Looks up widget classes before the processor reaches the widget
+ * elements which need them.  This is used when all widget elements
+ * of a template are known in advance (i.e. it was found in the
+ * #XmlTemplateCache), so the translation server round trips for all
+ * widget classes run concurrently instead of one after another
+ * while the template is being parsed.
+ *
+ * The results are not used directly; they fill the
+ * #WidgetRegistry's cache, and lookups by the #InlineWidget attach
+ * to prefetches which are still in flight.
+ */
+class WidgetClassPrefetch final {
+	/**
+	 * The maximum number of translation requests running at a
+	 * time for one page.
+	 */
+	static constexpr std::size_t concurrency_limit = 16;
+
+	struct pool &pool;
+
+	WidgetRegistry &registry;
+
+	LimitedConcurrencyQueue queue;
+
+	class Job;
+
+	IntrusiveList<Job> jobs;
+
+public:
+	/**
+	 * @param _pool the pool where all jobs and the widget class
+	 * copies are allocated; it must outlive this object
+	 */
+	WidgetClassPrefetch(EventLoop &event_loop, struct pool &_pool,
+			    WidgetRegistry &_registry) noexcept;
+
+	/**
+	 * Cancels all prefetches which have not finished yet.
+	 */
+	~WidgetClassPrefetch() noexcept;
+
+	WidgetClassPrefetch(const WidgetClassPrefetch &) = delete;
+	WidgetClassPrefetch &operator=(const WidgetClassPrefetch &) = delete;
+
+	/**
+	 * Schedule the lookup of one widget class.
+	 *
+	 * @param name the widget class name; it must remain valid
+	 * until this object is destroyed
+	 */
+	void Add(const char *name) noexcept;
+
+	bool IsEmpty() const noexcept {
+		return jobs.empty();
+	}
+
+private:
+	void Finish(Job &job) noexcept;
+};
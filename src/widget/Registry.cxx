@@ -9,57 +9,178 @@
 #include "translation/Handler.hxx"
 #include "translation/Request.hxx"
 #include "translation/Response.hxx"
+#include "translation/Extension.hxx"
+#include "pool/pool.hxx"
 #include "AllocatorPtr.hxx"
 #include "io/Logger.hxx"
+#include "util/Cancellable.hxx"
+#include "util/djb_hash.hxx"
+#include "util/IntrusiveList.hxx"
+#include "util/SpanCast.hxx"
 #include "stopwatch.hxx"
 
-static void
-widget_registry_lookup(struct pool &caller_pool, struct pool &widget_pool,
-		       TranslationService &service,
-		       const char *widget_type,
-		       TranslateHandler &handler,
-		       CancellablePointer &cancel_ptr) noexcept
+/**
+ * A translation request for one widget class.  All callers which
+ * look up this class while the request is in flight are attached to
+ * it as #Waiter instances.
+ */
+class WidgetRegistry::Lookup final
+	: PoolHolder,
+	  public IntrusiveHashSetHook<IntrusiveHookMode::AUTO_UNLINK>,
+	  TranslateHandler
 {
-	auto request = NewFromPool<TranslateRequest>(caller_pool);
+	WidgetRegistry &registry;
 
-	request->widget_type = widget_type;
+	const char *const name;
 
-	service.SendRequest(widget_pool, *request,
-			    nullptr, // TODO
-			    handler, cancel_ptr);
-}
+	struct Waiter final
+		: IntrusiveListHook<IntrusiveHookMode::NORMAL>,
+		  Cancellable
+	{
+		Lookup &lookup;
 
-class WidgetRegistryLookup final : TranslateHandler {
-	struct pool &widget_pool;
+		struct pool &widget_pool;
 
-	WidgetClassCache &cache;
+		const WidgetRegistryCallback callback;
 
-	const char *const name;
+		Waiter(Lookup &_lookup, struct pool &_widget_pool,
+		       WidgetRegistryCallback _callback,
+		       CancellablePointer &cancel_ptr) noexcept
+			:lookup(_lookup), widget_pool(_widget_pool),
+			 callback(_callback)
+		{
+			cancel_ptr = *this;
+		}
+
+		/* virtual methods from class Cancellable */
+		void Cancel() noexcept override {
+			lookup.CancelWaiter(*this);
+		}
+	};
+
+	IntrusiveList<Waiter> waiters;
 
-	const WidgetRegistryCallback callback;
+	/**
+	 * Cancels the translation request.  This is cleared as soon
+	 * as the translation server has responded.
+	 */
+	CancellablePointer cancel_ptr;
+
+	/**
+	 * From #TRANSLATE_WIDGET_FRAGMENT_CACHE.
+	 */
+	std::chrono::seconds fragment_max_age{};
 
 public:
-	WidgetRegistryLookup(struct pool &_widget_pool, WidgetClassCache &_cache,
-			     const char *_name,
-			     WidgetRegistryCallback _callback) noexcept
-		:widget_pool(_widget_pool), cache(_cache),
-		 name(_name), callback(_callback) {}
-
-	void Start(struct pool &caller_pool, TranslationService &service,
-		   CancellablePointer &cancel_ptr) noexcept {
-		widget_registry_lookup(caller_pool, widget_pool,
-				       service, name,
-				       *this, cancel_ptr);
+	Lookup(PoolPtr &&_pool, WidgetRegistry &_registry,
+	       const char *_name) noexcept
+		:PoolHolder(std::move(_pool)),
+		 registry(_registry),
+		 name(p_strdup(pool, _name)) {}
+
+	std::string_view GetKey() const noexcept {
+		return name;
+	}
+
+	void AddWaiter(struct pool &caller_pool, struct pool &widget_pool,
+		       WidgetRegistryCallback callback,
+		       CancellablePointer &caller_cancel_ptr) noexcept {
+		auto *waiter = NewFromPool<Waiter>(caller_pool, *this,
+						   widget_pool, callback,
+						   caller_cancel_ptr);
+		waiters.push_back(*waiter);
+	}
+
+	void Start() noexcept {
+		assert(!waiters.empty());
+
+		auto request = NewFromPool<TranslateRequest>(*pool);
+		request->widget_type = name;
+
+		registry.translation_service.SendRequest(*pool, *request,
+							 nullptr, // TODO
+							 *this, cancel_ptr);
 	}
 
 private:
+	void Destroy() noexcept {
+		this->~Lookup();
+	}
+
+	void CancelWaiter(Waiter &waiter) noexcept;
+
+	/**
+	 * Invoke all waiters and destroy this object.
+	 *
+	 * @param cls the widget class or nullptr on error
+	 */
+	void Finish(const WidgetClass *cls) noexcept;
+
 	/* virtual methods from TranslateHandler */
+	void OnTranslateExtension(TranslationCommand command,
+				  std::span<const std::byte> payload) noexcept override;
 	void OnTranslateResponse(UniquePoolPtr<TranslateResponse> response) noexcept override;
 	void OnTranslateError(std::exception_ptr error) noexcept override;
 };
 
+inline void
+WidgetRegistry::Lookup::CancelWaiter(Waiter &waiter) noexcept
+{
+	waiters.erase_and_dispose(waiters.iterator_to(waiter),
+				  [](Waiter *w) { w->~Waiter(); });
+
+	if (waiters.empty() && cancel_ptr) {
+		/* nobody is interested in the response anymore */
+		cancel_ptr.Cancel();
+		Destroy();
+	}
+}
+
+void
+WidgetRegistry::Lookup::Finish(const WidgetClass *cls) noexcept
+{
+	cancel_ptr = nullptr;
+
+	/* new lookups for this class shall not attach to this object
+	   anymore */
+	unlink();
+
+	/* the callbacks may cancel other waiters; the loop copes with
+	   that because CancelWaiter() does not destroy this object
+	   after cancel_ptr was cleared */
+	while (!waiters.empty()) {
+		auto &waiter = waiters.front();
+		waiters.pop_front();
+
+		auto &widget_pool = waiter.widget_pool;
+		const auto callback = waiter.callback;
+		waiter.~Waiter();
+
+		callback(cls != nullptr
+			 ? NewFromPool<WidgetClass>(widget_pool, widget_pool, *cls)
+			 : nullptr);
+	}
+
+	Destroy();
+}
+
+void
+WidgetRegistry::Lookup::OnTranslateExtension(TranslationCommand command,
+					     std::span<const std::byte> payload) noexcept
+{
+	if (command != TRANSLATE_WIDGET_FRAGMENT_CACHE)
+		return;
+
+	try {
+		fragment_max_age = ParseWidgetFragmentCache(payload);
+	} catch (...) {
+		LogConcat(2, "WidgetRegistry", name, ": ",
+			  std::current_exception());
+	}
+}
+
 void
-WidgetRegistryLookup::OnTranslateResponse(UniquePoolPtr<TranslateResponse> _response) noexcept
+WidgetRegistry::Lookup::OnTranslateResponse(UniquePoolPtr<TranslateResponse> _response) noexcept
 {
 	auto &response = *_response;
 
@@ -67,11 +188,11 @@ WidgetRegistryLookup::OnTranslateResponse(UniquePoolPtr<TranslateResponse> _resp
 
 	if (response.status != HttpStatus{}) {
 		_response.reset();
-		callback(nullptr);
+		Finish(nullptr);
 		return;
 	}
 
-	auto cls = NewFromPool<WidgetClass>(widget_pool);
+	auto cls = NewFromPool<WidgetClass>(*pool);
 	cls->local_uri = response.local_uri;
 	cls->untrusted_host = response.untrusted;
 	cls->untrusted_prefix = response.untrusted_prefix;
@@ -89,27 +210,55 @@ WidgetRegistryLookup::OnTranslateResponse(UniquePoolPtr<TranslateResponse> _resp
 	cls->anchor_absolute = response.anchor_absolute;
 	cls->info_headers = response.widget_info;
 	cls->dump_headers = response.dump_headers;
-	cls->views = Clone(widget_pool, response.views);
+	cls->fragment_max_age = fragment_max_age;
+	cls->views = Clone(*pool, response.views);
 
 	if (auto &view = cls->views.front();
 	    !view.address.IsDefined() && response.address.IsDefined()) {
-		view.address.CopyFrom(widget_pool, response.address);
+		view.address.CopyFrom(*pool, response.address);
 		view.filter_4xx = response.filter_4xx;
 	}
 
+	const auto max_age = response.max_age;
+
 	_response.reset();
 
-	cache.Put(name, *cls);
+	registry.cache.Put(name, *cls, max_age);
 
-	callback(cls);
+	Finish(cls);
 }
 
 void
-WidgetRegistryLookup::OnTranslateError(std::exception_ptr ep) noexcept
+WidgetRegistry::Lookup::OnTranslateError(std::exception_ptr ep) noexcept
 {
 	LogConcat(2, "WidgetRegistry", ep);
 
-	callback(nullptr);
+	Finish(nullptr);
+}
+
+inline std::size_t
+WidgetRegistry::LookupHash::operator()(std::string_view key) const noexcept
+{
+	return djb_hash(AsBytes(key));
+}
+
+inline std::string_view
+WidgetRegistry::LookupGetKey::operator()(const Lookup &lookup) const noexcept
+{
+	return lookup.GetKey();
+}
+
+WidgetRegistry::WidgetRegistry(EventLoop &event_loop,
+			       struct pool &parent_pool,
+			       TranslationService &_translation_service) noexcept
+	:pool(parent_pool),
+	 translation_service(_translation_service),
+	 cache(event_loop, parent_pool) {}
+
+WidgetRegistry::~WidgetRegistry() noexcept
+{
+	/* all callers must have cancelled their lookups */
+	assert(lookups.empty());
 }
 
 void
@@ -121,14 +270,24 @@ WidgetRegistry::LookupWidgetClass(struct pool &caller_pool,
 {
 	assert(widget_type != nullptr);
 
-	const auto *cls = cache.Get(widget_type);
-	if (cls != nullptr) {
+	if (const auto *cls = cache.Get(widget_type)) {
 		callback(NewFromPool<WidgetClass>(widget_pool, widget_pool, *cls));
 		return;
 	}
 
-	auto lookup = NewFromPool<WidgetRegistryLookup>(caller_pool, widget_pool,
-							cache, widget_type,
-							callback);
-	lookup->Start(caller_pool, translation_service, cancel_ptr);
+	auto [it, inserted] = lookups.insert_check(std::string_view{widget_type});
+	if (!inserted) {
+		/* another translation request for this class is
+		   already in flight; wait for its response */
+		it->AddWaiter(caller_pool, widget_pool, callback, cancel_ptr);
+		return;
+	}
+
+	auto *lookup = NewFromPool<Lookup>(pool_new_linear(&pool, "WidgetRegistryLookup", 8192),
+					   *this, widget_type);
+	lookups.insert_commit(it, *lookup);
+	lookup->AddWaiter(caller_pool, widget_pool, callback, cancel_ptr);
+
+	/* this may finish (and destroy the Lookup) synchronously */
+	lookup->Start();
 }
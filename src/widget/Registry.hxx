@@ -6,8 +6,12 @@
 
 #include "Cache.hxx"
 #include "util/BindMethod.hxx"
+#include "util/IntrusiveHashSet.hxx"
+
+#include <string_view>
 
 struct pool;
+class EventLoop;
 class TranslationService;
 class CancellablePointer;
 struct WidgetClass;
@@ -17,22 +21,58 @@ typedef BoundMethod<void(const WidgetClass *cls) noexcept> WidgetRegistryCallbac
 /**
  * Interface for the widget registry managed by the translation
  * server.
+ *
+ * Concurrent lookups of the same (uncached) widget class are
+ * coalesced into one translation request.
  */
 class WidgetRegistry {
+	struct pool &pool;
+
 	TranslationService &translation_service;
 
 	WidgetClassCache cache;
 
+	class Lookup;
+
+	struct LookupHash {
+		[[gnu::pure]]
+		std::size_t operator()(std::string_view key) const noexcept;
+	};
+
+	struct LookupGetKey {
+		[[gnu::pure]]
+		std::string_view operator()(const Lookup &lookup) const noexcept;
+	};
+
+	/**
+	 * Translation requests which are currently in flight.
+	 */
+	IntrusiveHashSet<Lookup, 256,
+			 IntrusiveHashSetOperators<Lookup, LookupGetKey, LookupHash,
+						   std::equal_to<std::string_view>>> lookups;
+
 public:
-	explicit WidgetRegistry(struct pool &parent_pool,
-				TranslationService &_translation_service) noexcept
-		:translation_service(_translation_service),
-		 cache(parent_pool) {}
+	WidgetRegistry(EventLoop &event_loop, struct pool &parent_pool,
+		       TranslationService &_translation_service) noexcept;
+
+	~WidgetRegistry() noexcept;
 
 	void FlushCache() noexcept {
 		cache.Clear();
 	}
 
+	const CacheStats &GetStats() const noexcept {
+		return cache.GetStats();
+	}
+
+	/**
+	 * Is this widget class in the cache?  This can be used to
+	 * avoid needless prefetches.
+	 */
+	bool IsCached(const char *name) noexcept {
+		return cache.Contains(name);
+	}
+
 	void LookupWidgetClass(struct pool &caller_pool, struct pool &widget_pool,
 			       const char *name,
 			       WidgetRegistryCallback callback,
@@ -348,7 +348,8 @@ WidgetRequest::ProcessResponse(HttpStatus status,
 		DispatchResponse(status, processor_header_forward(pool, headers),
 				 processor_process(pool, parent_stopwatch,
 						   std::move(body),
-						   widget, ctx, options));
+						   widget, ctx, options,
+						   nullptr, nullptr));
 }
 
 [[gnu::pure]]
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Measure the memory usage of sessions and the time it takes to
+ * iterate, serialize and clean them up.
+ */
+
+#include "bp/session/Lease.hxx"
+#include "bp/session/Session.hxx"
+#include "bp/session/Manager.hxx"
+#include "bp/session/Write.hxx"
+#include "event/Loop.hxx"
+#include "io/BufferedOutputStream.hxx"
+#include "io/OutputStream.hxx"
+#include "util/PrintException.hxx"
+
+#include <chrono>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+class NullOutputStream final : public OutputStream {
+public:
+	std::size_t size = 0;
+
+	/* virtual methods from class OutputStream */
+	void Write(std::span<const std::byte> src) override {
+		size += src.size();
+	}
+};
+
+static std::size_t
+GetHeapUsage() noexcept
+{
+	return mallinfo2().uordblks;
+}
+
+template<typename F>
+static void
+Measure(const char *name, F &&f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const std::chrono::duration<double, std::milli> duration =
+		std::chrono::steady_clock::now() - start;
+	printf("%s: %.1f ms\n", name, duration.count());
+}
+
+static void
+PopulateSession(Session &session)
+{
+	auto *realm = session.GetRealm("example.com");
+	realm->SetSite("example.com");
+	realm->SetUser("user@example.com", std::chrono::hours(1));
+
+	for (const char *id : {"header", "navigation", "content", "footer"}) {
+		auto *ws = realm->GetWidget(id, true);
+		ws->path_info = "/index.html";
+		ws->query_string = "page=1";
+
+		auto *child = ws->GetChild("item", true);
+		child->path_info = "/item";
+	}
+}
+
+int
+main(int argc, char **argv)
+try {
+	/* stay below SessionManager's limit which would purge
+	   sessions */
+	const unsigned n = argc > 1
+		? strtoul(argv[1], nullptr, 10)
+		: 60000;
+	if (n == 0) {
+		fprintf(stderr, "Usage: RunSessionBenchmark [COUNT]\n");
+		return EXIT_FAILURE;
+	}
+
+	EventLoop event_loop;
+	SessionManager manager(event_loop, std::chrono::minutes(30), 0, 0);
+
+	const std::size_t heap_before = GetHeapUsage();
+
+	Measure("create", [&manager, n]{
+		for (unsigned i = 0; i < n; ++i)
+			PopulateSession(*manager.CreateSession());
+	});
+
+	printf("memory: %zu bytes per session\n",
+	       (GetHeapUsage() - heap_before) / n);
+
+	Measure("visit", [&manager]{
+		unsigned n_users = 0;
+		manager.Visit([](const Session *session, void *ctx){
+			if (session->HasUser())
+				++*(unsigned *)ctx;
+		}, &n_users);
+	});
+
+	Measure("serialize", [&manager]{
+		NullOutputStream os;
+		WithBufferedOutputStream(os, [&manager](BufferedOutputStream &bos){
+			manager.Visit([](const Session *session, void *ctx){
+				session_write(*(BufferedOutputStream *)ctx,
+					      session);
+			}, &bos);
+		});
+	});
+
+	Measure("cleanup", [&manager]{
+		manager.Cleanup();
+	});
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+/*
+ * Measure the body throughput of a WAS application which echoes the
+ * request body (e.g. "was_mirror"), optionally with shared memory
+ * body transfer.
+ */
+
+#include "TestInstance.hxx"
+#include "was/Client.hxx"
+#include "was/Launch.hxx"
+#include "was/Lease.hxx"
+#include "was/async/Control.hxx"
+#include "http/ResponseHandler.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
+#include "istream/Sink.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/HeadIstream.hxx"
+#include "istream/ZeroIstream.hxx"
+#include "spawn/Config.hxx"
+#include "spawn/ChildOptions.hxx"
+#include "spawn/Registry.hxx"
+#include "spawn/Local.hxx"
+#include "event/DeferEvent.hxx"
+#include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
+#include "strmap.hxx"
+#include "io/Logger.hxx"
+#include "util/Cancellable.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringAPI.hxx"
+
+#include <was/protocol.h>
+
+#include <cassert>
+#include <chrono>
+#include <optional>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Context final
+	: TestInstance, WasLease, HttpResponseHandler, IstreamSink,
+	  Was::ControlHandler {
+
+	WasProcess process;
+	std::optional<Was::Control> control;
+
+	DeferEvent defer_request{event_loop, BIND_THIS_METHOD(SendRequest)};
+
+	PoolPtr request_pool;
+
+	CancellablePointer cancel_ptr;
+
+	std::size_t size;
+	unsigned remaining;
+
+	uint_least64_t received = 0;
+
+	bool released = true, error = false;
+
+	void SendRequest() noexcept;
+
+	void Fail() noexcept {
+		error = true;
+		event_loop.Break();
+	}
+
+	/**
+	 * Check whether the current request is finished, and if so,
+	 * start the next one.
+	 */
+	void CheckNext() noexcept {
+		if (released && !HasInput())
+			defer_request.Schedule();
+	}
+
+	/* virtual methods from class Lease */
+	void ReleaseWas(PutAction action) noexcept override {
+		if (action != PutAction::REUSE) {
+			Fail();
+			return;
+		}
+
+		/* the WasClient is gone; packets received until the
+		   next request are handled by us */
+		control->SetHandler(*this);
+
+		released = true;
+		CheckNext();
+	}
+
+	void ReleaseWasStop(uint_least64_t) noexcept override {
+		Fail();
+	}
+
+	/* virtual methods from class HttpResponseHandler */
+	void OnHttpResponse(HttpStatus status, StringMap &&,
+			    UnusedIstreamPtr body) noexcept override {
+		if (status != HttpStatus::OK || !body) {
+			fprintf(stderr, "unexpected response: %u\n",
+				static_cast<unsigned>(status));
+			Fail();
+			return;
+		}
+
+		SetInput(std::move(body));
+		input.Read();
+	}
+
+	void OnHttpError(std::exception_ptr ep) noexcept override {
+		PrintException(ep);
+		Fail();
+	}
+
+	/* virtual methods from class IstreamHandler */
+	std::size_t OnData(std::span<const std::byte> src) noexcept override {
+		received += src.size();
+		return src.size();
+	}
+
+	void OnEof() noexcept override {
+		ClearInput();
+		CheckNext();
+	}
+
+	void OnError(std::exception_ptr ep) noexcept override {
+		ClearInput();
+		PrintException(ep);
+		Fail();
+	}
+
+	/* virtual methods from class Was::ControlHandler */
+	bool OnWasControlPacket(enum was_command cmd,
+				std::span<const std::byte> payload) noexcept override {
+		if (cmd == WAS_COMMAND_NOP && process.shm &&
+		    WasShmParsePacket(payload) == WasShmPacket::ACCEPT)
+			process.shm->SetAccepted();
+
+		return true;
+	}
+
+	bool OnWasControlDrained() noexcept override {
+		return true;
+	}
+
+	void OnWasControlDone() noexcept override {}
+
+	void OnWasControlHangup() noexcept override {
+		Fail();
+	}
+
+	void OnWasControlError(std::exception_ptr ep) noexcept override {
+		PrintException(ep);
+		Fail();
+	}
+};
+
+void
+Context::SendRequest() noexcept
+{
+	assert(released);
+	assert(!HasInput());
+
+	if (remaining == 0) {
+		event_loop.Break();
+		return;
+	}
+
+	--remaining;
+	released = false;
+
+	request_pool = pool_new_linear(root_pool, "request", 8192);
+
+	was_client_request(*request_pool, nullptr,
+			   *control,
+			   process.input, process.output,
+			   process.shm.get(),
+			   *this,
+			   nullptr,
+			   HttpMethod::POST, "/",
+			   nullptr,
+			   nullptr, nullptr,
+			   StringMap{},
+			   istream_head_new(*request_pool,
+					    istream_zero_new(*request_pool),
+					    size, true),
+			   {},
+			   nullptr,
+			   *this, cancel_ptr);
+}
+
+int
+main(int argc, char **argv)
+try {
+	SetLogLevel(2);
+
+	if (argc < 4) {
+		fprintf(stderr, "Usage: RunWasBenchmark PATH COUNT SIZE [--shm]\n");
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[1];
+	const unsigned count = strtoul(argv[2], nullptr, 10);
+	const std::size_t size = strtoul(argv[3], nullptr, 10);
+	const bool shm = argc > 4 && StringIsEqual(argv[4], "--shm");
+
+	Context context;
+	context.remaining = count;
+	context.size = size;
+
+	SpawnConfig spawn_config;
+
+	ChildOptions child_options;
+	child_options.no_new_privs = true;
+
+	ChildProcessRegistry child_process_registry;
+	LocalSpawnService spawn_service(spawn_config, context.event_loop,
+					child_process_registry);
+
+	context.process = was_launch(spawn_service, nullptr, "was",
+				     path, {},
+				     child_options,
+				     UniqueFileDescriptor(::dup(STDERR_FILENO)),
+				     shm);
+	context.control.emplace(context.event_loop, context.process.control,
+				context);
+
+	const auto start = std::chrono::steady_clock::now();
+
+	context.defer_request.Schedule();
+	context.event_loop.Run();
+
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+
+	if (context.error)
+		return EXIT_FAILURE;
+
+	printf("%u requests, %llu bytes in %.3f s: %.1f MB/s, %.0f requests/s\n",
+	       count, static_cast<unsigned long long>(context.received),
+	       duration.count(),
+	       context.received / duration.count() / (1024 * 1024),
+	       count / duration.count());
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
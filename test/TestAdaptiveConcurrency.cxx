@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "was/AdaptiveConcurrency.hxx"
+
+#include <gtest/gtest.h>
+
+using std::chrono::milliseconds;
+
+/**
+ * Submit a result from a child process which was spawned with the
+ * current limit.
+ */
+static void
+Submit(AdaptiveConcurrency &a, milliseconds latency,
+       bool error=false) noexcept
+{
+	a.OnResult(a.GetLimit(), latency, error);
+}
+
+TEST(AdaptiveConcurrency, Bounds)
+{
+	EXPECT_EQ(AdaptiveConcurrency(1, 16, 4).GetLimit(), 4U);
+	EXPECT_EQ(AdaptiveConcurrency(1, 16, 0).GetLimit(), 1U);
+	EXPECT_EQ(AdaptiveConcurrency(1, 16, 100).GetLimit(), 16U);
+	EXPECT_EQ(AdaptiveConcurrency(0, 0, 4).GetLimit(), 1U);
+}
+
+TEST(AdaptiveConcurrency, Increase)
+{
+	AdaptiveConcurrency a{1, 16, 2};
+
+	/* constant latency: the limit grows up to the upper bound */
+	for (unsigned i = 0; i < 1000; ++i)
+		Submit(a, milliseconds{10});
+
+	EXPECT_EQ(a.GetLimit(), 16U);
+	EXPECT_EQ(a.GetIncreases(), 14U);
+	EXPECT_EQ(a.GetDecreases(), 0U);
+}
+
+TEST(AdaptiveConcurrency, Latency)
+{
+	AdaptiveConcurrency a{1, 64, 32};
+
+	for (unsigned i = 0; i < 10; ++i)
+		Submit(a, milliseconds{10});
+
+	const unsigned before = a.GetLimit();
+
+	/* the application is saturated: the latency grows */
+	for (unsigned i = 0; i < 200; ++i)
+		Submit(a, milliseconds{100});
+
+	EXPECT_LT(a.GetLimit(), before);
+	EXPECT_GT(a.GetDecreases(), 0U);
+	EXPECT_GE(a.GetLimit(), 1U);
+}
+
+TEST(AdaptiveConcurrency, Jitter)
+{
+	AdaptiveConcurrency a{1, 8, 8};
+
+	/* small absolute variations of a fast application don't
+	   shrink the limit */
+	for (unsigned i = 0; i < 1000; ++i)
+		Submit(a, milliseconds{i % 2 == 0 ? 1 : 3});
+
+	EXPECT_EQ(a.GetLimit(), 8U);
+	EXPECT_EQ(a.GetDecreases(), 0U);
+}
+
+/**
+ * A single very fast response must not become the baseline forever.
+ */
+TEST(AdaptiveConcurrency, BaselineExpires)
+{
+	AdaptiveConcurrency a{1, 16, 8};
+
+	Submit(a, milliseconds{1});
+
+	/* all other responses are a lot slower; the limit shrinks at
+	   first, but recovers once the fast response has left the
+	   window */
+	for (unsigned i = 0; i < 5000; ++i)
+		Submit(a, milliseconds{20});
+
+	EXPECT_GT(a.GetDecreases(), 0U);
+	EXPECT_EQ(a.GetLimit(), 16U);
+}
+
+TEST(AdaptiveConcurrency, Error)
+{
+	AdaptiveConcurrency a{2, 16, 16};
+
+	Submit(a, milliseconds{10}, true);
+	EXPECT_EQ(a.GetLimit(), 12U);
+	EXPECT_EQ(a.GetDecreases(), 1U);
+
+	/* the other child processes which were spawned with the old
+	   limit are expected to fail, too; ignore them */
+	for (unsigned i = 0; i < 15; ++i)
+		a.OnResult(16, milliseconds{10}, true);
+	EXPECT_EQ(a.GetLimit(), 12U);
+
+	/* persistent errors shrink the limit down to the lower
+	   bound */
+	for (unsigned i = 0; i < 1000; ++i)
+		Submit(a, milliseconds{10}, true);
+	EXPECT_EQ(a.GetLimit(), 2U);
+}
+
+/**
+ * Results from child processes which were spawned with another limit
+ * don't tell anything about the current limit.
+ */
+TEST(AdaptiveConcurrency, OtherLimit)
+{
+	AdaptiveConcurrency a{1, 16, 8};
+
+	for (unsigned i = 0; i < 1000; ++i)
+		a.OnResult(4, milliseconds{10}, false);
+	for (unsigned i = 0; i < 1000; ++i)
+		a.OnResult(4, milliseconds{10}, true);
+
+	EXPECT_EQ(a.GetLimit(), 8U);
+	EXPECT_EQ(a.GetIncreases(), 0U);
+	EXPECT_EQ(a.GetDecreases(), 0U);
+}
+
+/**
+ * Results without latency (requests with a body) only count if they
+ * are errors.
+ */
+TEST(AdaptiveConcurrency, NoLatency)
+{
+	AdaptiveConcurrency a{1, 16, 8};
+
+	for (unsigned i = 0; i < 1000; ++i)
+		a.OnResult(a.GetLimit(), std::nullopt, false);
+
+	EXPECT_EQ(a.GetLimit(), 8U);
+	EXPECT_EQ(a.GetIncreases(), 0U);
+
+	a.OnResult(a.GetLimit(), std::nullopt, true);
+	EXPECT_EQ(a.GetLimit(), 6U);
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "spawn/ChildDemand.hxx"
+
+#include <gtest/gtest.h>
+
+using std::chrono::milliseconds;
+using std::chrono::minutes;
+
+TEST(ChildDemand, Empty)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	ChildDemand d;
+	EXPECT_EQ(d.GetRate(now), 0.);
+	EXPECT_EQ(d.GetWarmTarget(now, 1, 8), 0U);
+}
+
+TEST(ChildDemand, Single)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	ChildDemand d;
+	d.AddRequest(now);
+	EXPECT_GT(d.GetRate(now), 0.);
+	EXPECT_EQ(d.GetWarmTarget(now, 1, 8), 1U);
+	EXPECT_EQ(d.GetWarmTarget(now, 1, 0), 0U);
+
+	/* one request keeps a child process warm for a while, but
+	   not forever */
+	EXPECT_EQ(d.GetWarmTarget(now + minutes{17}, 1, 8), 1U);
+	EXPECT_EQ(d.GetWarmTarget(now + minutes{18}, 1, 8), 0U);
+}
+
+TEST(ChildDemand, Steady)
+{
+	auto now = std::chrono::steady_clock::now();
+
+	/* 20 requests per second for 100 minutes */
+	ChildDemand d;
+	for (unsigned i = 0; i < 20 * 60 * 100; ++i) {
+		d.AddRequest(now);
+		now += milliseconds{50};
+	}
+
+	EXPECT_NEAR(d.GetRate(now), 20., 0.1);
+	EXPECT_EQ(d.GetWarmTarget(now, 3, 10), 7U);
+	EXPECT_EQ(d.GetWarmTarget(now, 3, 4), 4U);
+	EXPECT_EQ(d.GetWarmTarget(now, 100, 10), 1U);
+
+	/* the demand decays after the traffic stops */
+	EXPECT_LT(d.GetWarmTarget(now + minutes{20}, 3, 10), 7U);
+	EXPECT_EQ(d.GetWarmTarget(now + minutes{120}, 3, 10), 0U);
+}
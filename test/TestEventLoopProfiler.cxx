@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "stats/EventLoopProfiler.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string_view>
+
+using std::chrono::milliseconds;
+
+static EventLoopCallbackSite site_a{"a", EventLoopCallbackType::SOCKET};
+static EventLoopCallbackSite site_b{"b", EventLoopCallbackType::SOCKET};
+static EventLoopCallbackSite site_c{"c", EventLoopCallbackType::TIMER};
+static EventLoopCallbackSite site_unused{"unused", EventLoopCallbackType::URING};
+
+TEST(EventLoopProfiler, Collect)
+{
+	site_a.stats = {};
+	site_b.stats = {};
+	site_c.stats = {};
+
+	site_a.stats.Add(milliseconds{1});
+	site_a.stats.Add(milliseconds{2});
+	site_b.stats.Add(milliseconds{5});
+	site_c.stats.Add(milliseconds{4});
+
+	EventLoopStats stats;
+	EventLoopCallbackSite::Collect(stats, 10);
+
+	const auto &socket = stats.types[std::size_t(EventLoopCallbackType::SOCKET)];
+	EXPECT_EQ(socket.n_calls, 3U);
+	EXPECT_EQ(socket.total, milliseconds{8});
+	EXPECT_EQ(socket.max, milliseconds{5});
+
+	const auto &timer = stats.types[std::size_t(EventLoopCallbackType::TIMER)];
+	EXPECT_EQ(timer.n_calls, 1U);
+	EXPECT_EQ(timer.total, milliseconds{4});
+
+	EXPECT_EQ(stats.types[std::size_t(EventLoopCallbackType::URING)].n_calls, 0U);
+
+	/* sorted by total time; the unused site is omitted */
+	ASSERT_EQ(stats.top_sites.size(), 3U);
+	EXPECT_EQ(std::string_view{stats.top_sites[0].name}, "b");
+	EXPECT_EQ(std::string_view{stats.top_sites[1].name}, "c");
+	EXPECT_EQ(std::string_view{stats.top_sites[2].name}, "a");
+	EXPECT_EQ(stats.top_sites[2].type, EventLoopCallbackType::SOCKET);
+	EXPECT_EQ(stats.top_sites[2].stats.n_calls, 2U);
+
+	/* only the most expensive ones */
+	EventLoopCallbackSite::Collect(stats, 2);
+	ASSERT_EQ(stats.top_sites.size(), 2U);
+	EXPECT_EQ(std::string_view{stats.top_sites[0].name}, "b");
+	EXPECT_EQ(std::string_view{stats.top_sites[1].name}, "c");
+}
+
+TEST(EventLoopProfiler, Scope)
+{
+	site_a.stats = {};
+
+	{
+		const EventLoopCallbackScope scope{site_a};
+	}
+
+	{
+		const EventLoopCallbackScope scope{site_a};
+	}
+
+	EXPECT_EQ(site_a.stats.n_calls, 2U);
+	EXPECT_GE(site_a.stats.total, site_a.stats.max);
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "fcgi/Serialize.hxx"
+#include "fcgi/Protocol.hxx"
+#include "memory/GrowingBuffer.hxx"
+#include "memory/fb_pool.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * Serialize the given name-value pairs and return the payload of the
+ * resulting record (without the header).
+ */
+static std::vector<std::byte>
+SerializeParams(std::initializer_list<std::pair<std::string_view, std::string_view>> params)
+{
+	GrowingBuffer buffer;
+
+	FcgiParamsSerializer ps{buffer, FcgiRecordType::GET_VALUES_RESULT, 0};
+	for (const auto &[name, value] : params)
+		ps(name, value);
+	ps.Commit();
+
+	std::vector<std::byte> result;
+	buffer.ForEachBuffer([&result](std::span<const std::byte> b){
+		result.insert(result.end(), b.begin(), b.end());
+	});
+
+	EXPECT_GE(result.size(), sizeof(FcgiRecordHeader));
+	const auto &header = *reinterpret_cast<const FcgiRecordHeader *>(result.data());
+	EXPECT_EQ(header.type, FcgiRecordType::GET_VALUES_RESULT);
+	EXPECT_EQ(header.content_length, result.size() - sizeof(header));
+
+	result.erase(result.begin(), result.begin() + sizeof(header));
+	return result;
+}
+
+TEST(FcgiParams, Find)
+{
+	const ScopeFbPoolInit fb_pool_init;
+
+	const std::string long_value(1000, 'x');
+
+	const auto payload = SerializeParams({
+		{"FCGI_MAX_CONNS"sv, "10"sv},
+		{"FCGI_MPXS_CONNS"sv, "1"sv},
+		{"LONG"sv, long_value},
+		{"EMPTY"sv, {}},
+	});
+
+	EXPECT_EQ(fcgi_find_param(payload, "FCGI_MPXS_CONNS"sv), "1"sv);
+	EXPECT_EQ(fcgi_find_param(payload, "FCGI_MAX_CONNS"sv), "10"sv);
+	EXPECT_EQ(fcgi_find_param(payload, "LONG"sv), long_value);
+
+	const auto empty = fcgi_find_param(payload, "EMPTY"sv);
+	EXPECT_NE(empty.data(), nullptr);
+	EXPECT_TRUE(empty.empty());
+
+	EXPECT_EQ(fcgi_find_param(payload, "FCGI_MPXS"sv).data(), nullptr);
+	EXPECT_EQ(fcgi_find_param(payload, "NOT_FOUND"sv).data(), nullptr);
+	EXPECT_EQ(fcgi_find_param({}, "FCGI_MPXS_CONNS"sv).data(), nullptr);
+}
+
+TEST(FcgiParams, Malformed)
+{
+	const ScopeFbPoolInit fb_pool_init;
+
+	auto payload = SerializeParams({
+		{"A"sv, "1"sv},
+		{"FCGI_MPXS_CONNS"sv, "1"sv},
+	});
+
+	/* truncate in the middle of the second value */
+	payload.pop_back();
+	EXPECT_EQ(fcgi_find_param(payload, "A"sv), "1"sv);
+	EXPECT_EQ(fcgi_find_param(payload, "FCGI_MPXS_CONNS"sv).data(), nullptr);
+
+	/* a four-byte length which is truncated */
+	const std::byte truncated_length[] = {
+		std::byte{0x80}, std::byte{0x00},
+	};
+	EXPECT_EQ(fcgi_find_param(truncated_length, "A"sv).data(), nullptr);
+
+	/* a huge length */
+	const std::byte huge_length[] = {
+		std::byte{0xff}, std::byte{0xff}, std::byte{0xff}, std::byte{0xff},
+		std::byte{0x01}, std::byte{'A'}, std::byte{'1'},
+	};
+	EXPECT_EQ(fcgi_find_param(huge_length, "A"sv).data(), nullptr);
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "stats/LatencyHistogram.hxx"
+
+#include <gtest/gtest.h>
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+TEST(LatencyHistogram, FindBucket)
+{
+	EXPECT_EQ(LatencyHistogram::FindBucket({}), 0U);
+	EXPECT_EQ(LatencyHistogram::FindBucket(microseconds{100}), 0U);
+	EXPECT_EQ(LatencyHistogram::FindBucket(microseconds{101}), 1U);
+	EXPECT_EQ(LatencyHistogram::FindBucket(milliseconds{1}), 3U);
+	EXPECT_EQ(LatencyHistogram::FindBucket(milliseconds{3}), 5U);
+	EXPECT_EQ(LatencyHistogram::FindBucket(seconds{60}),
+		  LatencyHistogram::N_BUCKETS - 2);
+	EXPECT_EQ(LatencyHistogram::FindBucket(seconds{3600}),
+		  LatencyHistogram::N_BUCKETS - 1);
+}
+
+TEST(LatencyHistogram, Add)
+{
+	LatencyHistogram h;
+	h.Add(microseconds{50});
+	h.Add(milliseconds{20});
+	h.Add(milliseconds{20});
+	h.Add(seconds{100});
+
+	EXPECT_EQ(h.count, 4U);
+	EXPECT_EQ(h.sum, microseconds{50} + milliseconds{40} + seconds{100});
+	EXPECT_EQ(h.buckets[0], 1U);
+	EXPECT_EQ(h.buckets[LatencyHistogram::FindBucket(milliseconds{20})], 2U);
+	EXPECT_EQ(h.buckets.back(), 1U);
+
+	LatencyHistogram h2;
+	h2.Add(microseconds{50});
+	h2 += h;
+	EXPECT_EQ(h2.count, 5U);
+	EXPECT_EQ(h2.buckets[0], 2U);
+}
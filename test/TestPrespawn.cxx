@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "TestInstance.hxx"
+#include "spawn/Prespawn.hxx"
+#include "spawn/ChildStock.hxx"
+#include "spawn/Interface.hxx"
+#include "spawn/ProcessHandle.hxx"
+#include "spawn/CompletionHandler.hxx"
+#include "access_log/ChildErrorLogOptions.hxx"
+#include "stock/MultiStock.hxx"
+#include "stock/GetHandler.hxx"
+#include "stock/Item.hxx"
+#include "util/Cancellable.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cassert>
+
+namespace {
+
+struct TestRequest {
+	unsigned parallelism = 0;
+};
+
+/**
+ * A "child process" which never runs; the test decides when its
+ * startup completes.
+ */
+class FakeChildProcessHandle final
+	: public ChildProcessHandle, public AutoUnlinkIntrusiveListHook
+{
+public:
+	SpawnCompletionHandler *completion_handler = nullptr;
+
+	void SetCompletionHandler(SpawnCompletionHandler &_handler) noexcept override {
+		completion_handler = &_handler;
+	}
+
+	void SetExitListener(ExitListener &) noexcept override {}
+	void Kill(int) noexcept override {}
+};
+
+class FakeSpawnService final : public SpawnService {
+	IntrusiveList<FakeChildProcessHandle> starting;
+
+public:
+	unsigned n_spawned = 0;
+
+	/**
+	 * Finish the startup of all child processes.
+	 */
+	void CompleteAll() noexcept {
+		while (!starting.empty()) {
+			auto &handle = starting.front();
+			handle.unlink();
+
+			assert(handle.completion_handler != nullptr);
+			handle.completion_handler->OnSpawnSuccess();
+		}
+	}
+
+	/* virtual methods from class SpawnService */
+	std::unique_ptr<ChildProcessHandle> SpawnChildProcess(std::string_view,
+							      PreparedChildProcess &&) override {
+		++n_spawned;
+		auto handle = std::make_unique<FakeChildProcessHandle>();
+		starting.push_back(*handle);
+		return handle;
+	}
+
+	void Enqueue(EnqueueCallback callback, CancellablePointer &) noexcept override {
+		callback();
+	}
+};
+
+class TestLease final : public StockItem {
+public:
+	explicit TestLease(CreateStockItem c) noexcept
+		:StockItem(c) {}
+
+	/* virtual methods from class StockItem */
+	bool Borrow() noexcept override {
+		return true;
+	}
+
+	bool Release() noexcept override {
+		return true;
+	}
+};
+
+class TestStockClass final : public MultiStockClass, public ChildStockClass {
+public:
+	/* virtual methods from class MultiStockClass */
+	std::size_t GetLimit(const void *request,
+			     std::size_t _limit) const noexcept override {
+		const auto &r = *(const TestRequest *)request;
+		return r.parallelism > 0 ? r.parallelism : _limit;
+	}
+
+	Event::Duration GetClearInterval(const void *) const noexcept override {
+		return std::chrono::minutes(10);
+	}
+
+	StockItem *Create(CreateStockItem c, StockItem &) override {
+		return new TestLease(c);
+	}
+
+	/* virtual methods from class ChildStockClass */
+	StockRequest PreserveRequest(StockRequest request) noexcept override {
+		/* the TestRequest objects outlive the stock */
+		return request;
+	}
+
+	bool WantStderrPond(const void *) const noexcept override {
+		return false;
+	}
+
+	void PrepareChild(const void *, PreparedChildProcess &,
+			  FdHolder &) override {}
+};
+
+class MyGetHandler final : public StockGetHandler {
+public:
+	CancellablePointer cancel_ptr;
+
+	StockItem *item = nullptr;
+
+	~MyGetHandler() noexcept {
+		if (cancel_ptr)
+			cancel_ptr.Cancel();
+		else
+			Release();
+	}
+
+	void Release() noexcept {
+		if (item != nullptr)
+			std::exchange(item, nullptr)->Put(PutAction::REUSE);
+	}
+
+	/* virtual methods from class StockGetHandler */
+	void OnStockItemReady(StockItem &_item) noexcept override {
+		cancel_ptr = nullptr;
+		item = &_item;
+	}
+
+	void OnStockItemError(std::exception_ptr) noexcept override {
+		cancel_ptr = nullptr;
+	}
+};
+
+struct Context : TestInstance {
+	FakeSpawnService spawn_service;
+	TestStockClass cls;
+	ChildStock child_stock;
+	MultiStock stock;
+	ChildStockPrespawner prespawner;
+
+	explicit Context(std::size_t limit) noexcept
+		:child_stock(spawn_service, nullptr, cls,
+			     nullptr, ChildErrorLogOptions{}),
+		 stock(event_loop, child_stock, limit, cls),
+		 prespawner(stock, cls, limit, child_stock, cls, 4) {}
+
+	/**
+	 * A real request: notify the prespawner and obtain a lease.
+	 */
+	void Get(const char *key, const TestRequest &request,
+		 MyGetHandler &handler) noexcept {
+		prespawner.OnRequest(key, request, 1);
+		stock.Get(key, ToNopPointer(const_cast<TestRequest *>(&request)),
+			  1, handler, handler.cancel_ptr);
+	}
+};
+
+} // anonymous namespace
+
+TEST(Prespawn, WarmUp)
+{
+	const TestRequest request;
+	Context c{16};
+
+	/* the first request spawns a child process */
+	{
+		MyGetHandler handler;
+		c.Get("foo", request, handler);
+		EXPECT_EQ(c.spawn_service.n_spawned, 1U);
+		EXPECT_EQ(c.child_stock.GetKeyState("foo").n_starting, 1U);
+
+		c.spawn_service.CompleteAll();
+		EXPECT_NE(handler.item, nullptr);
+		EXPECT_EQ(c.child_stock.GetKeyState("foo").n_starting, 0U);
+		EXPECT_EQ(c.child_stock.GetKeyState("foo").n_children, 1U);
+	}
+
+	/* the idle child process is refreshed, but no new one is
+	   spawned */
+	c.prespawner.Refresh();
+	EXPECT_EQ(c.spawn_service.n_spawned, 1U);
+	EXPECT_EQ(c.prespawner.GetStats().prespawns, 0U);
+}
+
+TEST(Prespawn, WarmUpBusy)
+{
+	const TestRequest request;
+	Context c{16};
+
+	MyGetHandler handler;
+	c.Get("foo", request, handler);
+	c.spawn_service.CompleteAll();
+	ASSERT_NE(handler.item, nullptr);
+
+	/* the only child process is busy; the prespawner starts
+	   another one */
+	c.prespawner.Refresh();
+	EXPECT_EQ(c.spawn_service.n_spawned, 2U);
+	EXPECT_EQ(c.prespawner.GetStats().prespawns, 1U);
+
+	c.spawn_service.CompleteAll();
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_children, 2U);
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_starting, 0U);
+}
+
+TEST(Prespawn, SkipWaiting)
+{
+	const TestRequest request;
+	Context c{16};
+
+	/* a request is waiting for its child process to start */
+	MyGetHandler handler;
+	c.Get("foo", request, handler);
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_starting, 1U);
+
+	/* the warm-up must not queue behind it */
+	c.prespawner.Refresh();
+	EXPECT_EQ(c.spawn_service.n_spawned, 1U);
+	EXPECT_EQ(c.prespawner.GetStats().prespawns, 0U);
+
+	c.spawn_service.CompleteAll();
+	EXPECT_NE(handler.item, nullptr);
+}
+
+TEST(Prespawn, SkipLimit)
+{
+	const TestRequest request{.parallelism = 1};
+	Context c{16};
+
+	MyGetHandler handler;
+	c.Get("foo", request, handler);
+	c.spawn_service.CompleteAll();
+	ASSERT_NE(handler.item, nullptr);
+
+	/* the per-key limit has been reached; the warm-up would only
+	   wait for the busy child process */
+	c.prespawner.Refresh();
+	EXPECT_EQ(c.spawn_service.n_spawned, 1U);
+	EXPECT_EQ(c.prespawner.GetStats().prespawns, 0U);
+
+	/* the next real request gets the child process right
+	   away */
+	handler.Release();
+
+	MyGetHandler handler2;
+	c.Get("foo", request, handler2);
+	EXPECT_NE(handler2.item, nullptr);
+	EXPECT_EQ(c.spawn_service.n_spawned, 1U);
+}
+
+TEST(Prespawn, KeyState)
+{
+	const TestRequest request;
+	Context c{16};
+
+	MyGetHandler handler1, handler2;
+	c.Get("foo", request, handler1);
+	c.Get("foo", request, handler2);
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_starting, 2U);
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_children, 2U);
+	EXPECT_EQ(c.child_stock.GetKeyState("bar").n_starting, 0U);
+	EXPECT_EQ(c.child_stock.GetKeyState("bar").n_children, 0U);
+
+	c.spawn_service.CompleteAll();
+	EXPECT_NE(handler1.item, nullptr);
+	EXPECT_NE(handler2.item, nullptr);
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_starting, 0U);
+	EXPECT_EQ(c.child_stock.GetKeyState("foo").n_children, 2U);
+}
@@ -0,0 +1,455 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "bp/session/Persist.hxx"
+#include "bp/session/Changes.hxx"
+#include "bp/session/Save.hxx"
+#include "bp/session/Append.hxx"
+#include "bp/session/Write.hxx"
+#include "bp/session/File.hxx"
+#include "bp/session/Lease.hxx"
+#include "bp/session/Session.hxx"
+#include "bp/session/Manager.hxx"
+#include "event/Loop.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "thread/Pool.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+
+namespace {
+
+class TempDir {
+	std::string path;
+
+public:
+	TempDir() {
+		char buffer[] = "/tmp/TestSessionPersist.XXXXXX";
+		if (mkdtemp(buffer) == nullptr)
+			throw std::runtime_error{"mkdtemp() failed"};
+
+		path = buffer;
+	}
+
+	~TempDir() noexcept {
+		std::error_code ec;
+		std::filesystem::remove_all(path, ec);
+	}
+
+	std::string operator/(const char *name) const noexcept {
+		return path + "/" + name;
+	}
+};
+
+/**
+ * Builds a session journal file.
+ */
+class JournalBuilder {
+	std::vector<std::byte> data;
+
+public:
+	JournalBuilder() noexcept {
+		AppendSessionRecord(data, [](BufferedOutputStream &os){
+			session_write_journal_header(os);
+		});
+	}
+
+	JournalBuilder &Modified(const Session &session) noexcept {
+		AppendSessionRecord(data, [&session](BufferedOutputStream &os){
+			session_write_magic(os, MAGIC_SESSION);
+			session_write(os, &session);
+		});
+		return *this;
+	}
+
+	JournalBuilder &Erased(SessionId id) noexcept {
+		AppendSessionRecord(data, [id](BufferedOutputStream &os){
+			session_write_erase(os, id);
+		});
+		return *this;
+	}
+
+	std::size_t size() const noexcept {
+		return data.size();
+	}
+
+	void WriteFile(const std::string &path, std::size_t truncate=0) const {
+		UniqueFileDescriptor fd;
+		if (!fd.Open(path.c_str(), O_CREAT|O_TRUNC|O_WRONLY, 0600))
+			throw std::runtime_error{"Failed to create file"};
+
+		const std::span<const std::byte> src{data.data(),
+						     data.size() - truncate};
+		if (fd.Write(src) != (ssize_t)src.size())
+			throw std::runtime_error{"Failed to write file"};
+	}
+};
+
+/**
+ * Runs the #EventLoop until the #SessionPersist has finished all
+ * its work.
+ */
+class IdleWaiter {
+	EventLoop &event_loop;
+	const SessionPersist &persist;
+	FineTimerEvent timer;
+
+public:
+	IdleWaiter(EventLoop &_event_loop,
+		   const SessionPersist &_persist) noexcept
+		:event_loop(_event_loop), persist(_persist),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)) {}
+
+	void Run() noexcept {
+		if (persist.IsIdle())
+			return;
+
+		timer.Schedule(std::chrono::milliseconds{1});
+		event_loop.Run();
+	}
+
+private:
+	void OnTimer() noexcept {
+		if (persist.IsIdle())
+			event_loop.Break();
+		else
+			timer.Schedule(std::chrono::milliseconds{1});
+	}
+};
+
+struct Context {
+	EventLoop event_loop;
+
+	const TempDir dir;
+	const std::string path = dir / "sessions";
+	const std::string journal_path = path + ".journal";
+	const std::string old_journal_path = journal_path + ".old";
+
+	Context() noexcept {
+		thread_pool_set_volatile();
+	}
+
+	~Context() noexcept {
+		thread_pool_stop();
+		thread_pool_join();
+		thread_pool_deinit();
+	}
+
+	ThreadQueue &GetQueue() noexcept {
+		return thread_pool_get_queue(event_loop);
+	}
+
+	SessionManager MakeManager() noexcept {
+		return {event_loop, std::chrono::minutes(30), 0, 0};
+	}
+
+	void WaitIdle(const SessionPersist &persist) noexcept {
+		IdleWaiter{event_loop, persist}.Run();
+	}
+};
+
+} // anonymous namespace
+
+static SessionId
+CreateSession(SessionManager &manager, const char *language) noexcept
+{
+	auto session = manager.CreateSession();
+	session->SetLanguage(language);
+	return session->id;
+}
+
+static void
+SetLanguage(SessionManager &manager, SessionId id,
+	    const char *language) noexcept
+{
+	SessionLease session{manager, id};
+	ASSERT_TRUE(session);
+	session->SetLanguage(language);
+}
+
+static std::string
+GetLanguage(const SessionManager &manager, SessionId id) noexcept
+{
+	const auto *session = manager.Get(id);
+	if (session == nullptr)
+		return "(none)";
+
+	if (session->language == nullptr)
+		return "(null)";
+
+	return session->language.c_str();
+}
+
+static bool
+Exists(const std::string &path) noexcept
+{
+	return std::filesystem::exists(path);
+}
+
+/**
+ * Load the files the way SessionPersist does, but without merging
+ * and deleting them.
+ */
+static void
+LoadAll(SessionManager &manager, const Context &c) noexcept
+{
+	session_load(manager, c.path.c_str());
+	session_load_journal(manager, c.old_journal_path.c_str());
+	session_load_journal(manager, c.journal_path.c_str());
+}
+
+TEST(SessionPersist, JournalFormat)
+{
+	Context c;
+
+	auto manager = c.MakeManager();
+	const auto a = CreateSession(manager, "a1");
+	const auto b = CreateSession(manager, "b1");
+	ASSERT_TRUE(session_save(manager, c.path.c_str()));
+
+	SetLanguage(manager, a, "a2");
+
+	JournalBuilder journal;
+	journal.Modified(*manager.Get(a));
+	journal.Erased(b);
+	journal.WriteFile(c.journal_path);
+
+	auto manager2 = c.MakeManager();
+	LoadAll(manager2, c);
+	EXPECT_EQ(manager2.Count(), 1U);
+	EXPECT_EQ(GetLanguage(manager2, a), "a2");
+	EXPECT_EQ(GetLanguage(manager2, b), "(none)");
+
+	/* a journal without the header is rejected as a whole */
+	auto manager3 = c.MakeManager();
+	session_load(manager3, c.path.c_str());
+	session_load_journal(manager3, c.path.c_str());
+	EXPECT_EQ(manager3.Count(), 2U);
+	EXPECT_EQ(GetLanguage(manager3, a), "a1");
+}
+
+TEST(SessionPersist, ReplayOrder)
+{
+	Context c;
+
+	auto manager = c.MakeManager();
+	const auto a = CreateSession(manager, "v1");
+	const auto b = CreateSession(manager, "b1");
+	ASSERT_TRUE(session_save(manager, c.path.c_str()));
+
+	/* an interrupted compaction: "*.journal.old" is older than
+	   the current journal */
+	SetLanguage(manager, a, "v2");
+	JournalBuilder old_journal;
+	old_journal.Modified(*manager.Get(a));
+	old_journal.Erased(b);
+	old_journal.WriteFile(c.old_journal_path);
+
+	SetLanguage(manager, a, "v3");
+	JournalBuilder journal;
+	journal.Modified(*manager.Get(a));
+	journal.WriteFile(c.journal_path);
+
+	/* the constructor loads snapshot, old journal, journal (in
+	   this order) and merges them into a new snapshot */
+	{
+		auto manager2 = c.MakeManager();
+		SessionPersist persist{manager2, c.GetQueue(), c.path.c_str()};
+		EXPECT_EQ(manager2.Count(), 1U);
+		EXPECT_EQ(GetLanguage(manager2, a), "v3");
+		EXPECT_EQ(GetLanguage(manager2, b), "(none)");
+	}
+
+	EXPECT_FALSE(Exists(c.old_journal_path));
+	EXPECT_FALSE(Exists(c.journal_path));
+
+	auto manager3 = c.MakeManager();
+	session_load(manager3, c.path.c_str());
+	EXPECT_EQ(manager3.Count(), 1U);
+	EXPECT_EQ(GetLanguage(manager3, a), "v3");
+}
+
+TEST(SessionPersist, Truncated)
+{
+	Context c;
+
+	auto manager = c.MakeManager();
+	const auto a = CreateSession(manager, "a1");
+	const auto b = CreateSession(manager, "b1");
+	ASSERT_TRUE(session_save(manager, c.path.c_str()));
+
+	SetLanguage(manager, a, "a2");
+	SetLanguage(manager, b, "b2");
+
+	JournalBuilder journal;
+	journal.Modified(*manager.Get(a));
+	const std::size_t complete_size = journal.size();
+	journal.Modified(*manager.Get(b));
+
+	/* a crash while the last record was being written: it is
+	   ignored, but everything before it is applied */
+	for (const std::size_t truncate : {1U, 7U, 32U}) {
+		ASSERT_LT(truncate, journal.size() - complete_size);
+		journal.WriteFile(c.journal_path, truncate);
+
+		auto manager2 = c.MakeManager();
+		LoadAll(manager2, c);
+		EXPECT_EQ(manager2.Count(), 2U);
+		EXPECT_EQ(GetLanguage(manager2, a), "a2");
+		EXPECT_EQ(GetLanguage(manager2, b), "b1");
+	}
+
+	/* truncated in the middle of the header: nothing is
+	   applied */
+	journal.WriteFile(c.journal_path, journal.size() - 2);
+
+	auto manager3 = c.MakeManager();
+	LoadAll(manager3, c);
+	EXPECT_EQ(manager3.Count(), 2U);
+	EXPECT_EQ(GetLanguage(manager3, a), "a1");
+}
+
+TEST(SessionPersist, Journal)
+{
+	Context c;
+
+	auto manager = c.MakeManager();
+	const auto a = CreateSession(manager, "a1");
+	const auto b = CreateSession(manager, "b1");
+
+	SessionPersist persist{manager, c.GetQueue(), c.path.c_str()};
+	SessionChanges changes{c.event_loop, manager};
+	changes.AddHandler(persist);
+
+	SetLanguage(manager, a, "a2");
+	manager.EraseAndDispose(b);
+	const auto d = CreateSession(manager, "d1");
+	changes.Flush();
+	c.WaitIdle(persist);
+
+	EXPECT_TRUE(Exists(c.journal_path));
+
+	auto manager2 = c.MakeManager();
+	LoadAll(manager2, c);
+	EXPECT_EQ(manager2.Count(), 2U);
+	EXPECT_EQ(GetLanguage(manager2, a), "a2");
+	EXPECT_EQ(GetLanguage(manager2, b), "(none)");
+	EXPECT_EQ(GetLanguage(manager2, d), "d1");
+
+	/* a clean shutdown merges everything into the snapshot */
+	persist.Shutdown();
+	EXPECT_FALSE(Exists(c.journal_path));
+
+	auto manager3 = c.MakeManager();
+	session_load(manager3, c.path.c_str());
+	EXPECT_EQ(manager3.Count(), 2U);
+	EXPECT_EQ(GetLanguage(manager3, a), "a2");
+	EXPECT_EQ(GetLanguage(manager3, d), "d1");
+}
+
+TEST(SessionPersist, Compaction)
+{
+	Context c;
+
+	auto manager = c.MakeManager();
+
+	/* more sessions than fit in one snapshot chunk */
+	std::vector<SessionId> ids;
+	for (unsigned i = 0; i < 3000; ++i)
+		ids.push_back(CreateSession(manager, "x"));
+
+	SessionPersist persist{manager, c.GetQueue(), c.path.c_str()};
+	SessionChanges changes{c.event_loop, manager};
+	changes.AddHandler(persist);
+
+	SetLanguage(manager, ids[0], "before");
+	manager.EraseAndDispose(ids[1]);
+	changes.Flush();
+
+	persist.Compact();
+
+	/* changes during the compaction go to the new journal */
+	SetLanguage(manager, ids[2], "during");
+	manager.EraseAndDispose(ids[3]);
+	changes.Flush();
+
+	c.WaitIdle(persist);
+
+	EXPECT_FALSE(Exists(c.old_journal_path));
+
+	auto manager2 = c.MakeManager();
+	LoadAll(manager2, c);
+	EXPECT_EQ(manager2.Count(), 2998U);
+	EXPECT_EQ(GetLanguage(manager2, ids[0]), "before");
+	EXPECT_EQ(GetLanguage(manager2, ids[1]), "(none)");
+	EXPECT_EQ(GetLanguage(manager2, ids[2]), "during");
+	EXPECT_EQ(GetLanguage(manager2, ids[3]), "(none)");
+	EXPECT_EQ(GetLanguage(manager2, ids[2999]), "x");
+
+	/* the snapshot alone has everything up to the compaction */
+	auto manager3 = c.MakeManager();
+	session_load(manager3, c.path.c_str());
+	EXPECT_EQ(GetLanguage(manager3, ids[0]), "before");
+	EXPECT_EQ(GetLanguage(manager3, ids[1]), "(none)");
+	EXPECT_EQ(GetLanguage(manager3, ids[2999]), "x");
+}
+
+TEST(SessionPersist, CompactionWithoutRotate)
+{
+	Context c;
+
+	auto manager = c.MakeManager();
+	const auto a = CreateSession(manager, "a1");
+	const auto b = CreateSession(manager, "b1");
+
+	SessionPersist persist{manager, c.GetQueue(), c.path.c_str()};
+	SessionChanges changes{c.event_loop, manager};
+	changes.AddHandler(persist);
+
+	/* a leftover from an earlier compaction which has failed
+	   after rotating the journal */
+	SetLanguage(manager, a, "a2");
+	JournalBuilder old_journal;
+	old_journal.Modified(*manager.Get(a));
+	old_journal.WriteFile(c.old_journal_path);
+
+	SetLanguage(manager, b, "b2");
+	changes.Flush();
+
+	/* the journal cannot be rotated, because "*.journal.old"
+	   exists; the new snapshot supersedes it, so it is deleted
+	   after the commit */
+	persist.Compact();
+	c.WaitIdle(persist);
+
+	EXPECT_FALSE(Exists(c.old_journal_path));
+	EXPECT_TRUE(Exists(c.journal_path));
+
+	auto manager2 = c.MakeManager();
+	LoadAll(manager2, c);
+	EXPECT_EQ(manager2.Count(), 2U);
+	EXPECT_EQ(GetLanguage(manager2, a), "a2");
+	EXPECT_EQ(GetLanguage(manager2, b), "b2");
+
+	/* the next compaction rotates again */
+	SetLanguage(manager, a, "a3");
+	changes.Flush();
+	persist.Compact();
+	c.WaitIdle(persist);
+
+	EXPECT_FALSE(Exists(c.old_journal_path));
+
+	auto manager3 = c.MakeManager();
+	LoadAll(manager3, c);
+	EXPECT_EQ(GetLanguage(manager3, a), "a3");
+	EXPECT_EQ(GetLanguage(manager3, b), "b2");
+}
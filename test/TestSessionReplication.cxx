@@ -0,0 +1,402 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "bp/session/Replicator.hxx"
+#include "bp/session/ReplicaServer.hxx"
+#include "bp/session/Changes.hxx"
+#include "bp/session/Lease.hxx"
+#include "bp/session/Session.hxx"
+#include "bp/session/Manager.hxx"
+#include "event/Loop.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/SocketError.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * Runs the #EventLoop until a condition becomes true.
+ */
+class Waiter {
+	EventLoop &event_loop;
+	FineTimerEvent timer;
+
+	std::function<bool()> predicate;
+
+	/**
+	 * Give up after this many polls.
+	 */
+	unsigned remaining;
+
+	static constexpr Event::Duration poll_interval = std::chrono::milliseconds{1};
+
+public:
+	explicit Waiter(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)) {}
+
+	/**
+	 * @return the last result of the predicate (i.e. false on
+	 * timeout)
+	 */
+	bool Run(std::function<bool()> _predicate,
+		 Event::Duration timeout) noexcept {
+		predicate = std::move(_predicate);
+		remaining = timeout / poll_interval;
+
+		if (!predicate()) {
+			timer.Schedule(poll_interval);
+			event_loop.Run();
+			timer.Cancel();
+		}
+
+		return predicate();
+	}
+
+private:
+	void OnTimer() noexcept {
+		if (predicate() || --remaining == 0)
+			event_loop.Break();
+		else
+			timer.Schedule(poll_interval);
+	}
+};
+
+static UniqueSocketDescriptor
+Listen(SocketAddress address)
+{
+	UniqueSocketDescriptor fd;
+	if (!fd.Create(AF_LOCAL, SOCK_STREAM, 0))
+		throw MakeSocketError("Failed to create socket");
+
+	if (!fd.Bind(address))
+		throw MakeSocketError("Failed to bind");
+
+	if (!fd.Listen(16))
+		throw MakeSocketError("Failed to listen");
+
+	return fd;
+}
+
+struct Context final : SessionChangesHandler {
+	EventLoop event_loop;
+
+	/**
+	 * An abstract socket address, which disappears as soon as
+	 * the listener is closed.
+	 */
+	AllocatedSocketAddress address;
+
+	/**
+	 * The node which owns the sessions.
+	 */
+	SessionManager source{event_loop, std::chrono::minutes(30), 0, 0};
+	SessionChanges changes{event_loop, source};
+
+	/**
+	 * The buddy node.
+	 */
+	std::optional<SessionManager> replica;
+	std::unique_ptr<SessionReplicaServer> server;
+
+	std::unique_ptr<SessionReplicator> replicator;
+
+	Context() {
+		address.SetLocal(("@TestSessionReplication-" +
+				  std::to_string(getpid())).c_str());
+
+		/* SessionChanges does not allow removing handlers;
+		   this object forwards to the current replicator */
+		changes.AddHandler(*this);
+	}
+
+	~Context() noexcept {
+		replicator.reset();
+		server.reset();
+	}
+
+	/**
+	 * Start a new buddy (with no sessions) listening on
+	 * #address.
+	 */
+	void StartReplica() {
+		server.reset();
+		replica.emplace(event_loop, std::chrono::minutes(30), 0, 0);
+		server = std::make_unique<SessionReplicaServer>(event_loop, *replica,
+								Listen(address));
+	}
+
+	void StopReplica() noexcept {
+		server.reset();
+	}
+
+	/**
+	 * Restart the buddy's listener after StopReplica(), keeping
+	 * its sessions.
+	 */
+	void RestartReplica() {
+		server = std::make_unique<SessionReplicaServer>(event_loop, *replica,
+								Listen(address));
+	}
+
+	/**
+	 * Start a new replicator, as if the node had been
+	 * restarted.
+	 */
+	void StartReplicator() noexcept {
+		replicator.reset();
+		replicator = std::make_unique<SessionReplicator>(event_loop, source,
+								 address,
+								 std::chrono::milliseconds{10});
+		replicator->Start();
+	}
+
+	bool WaitFor(std::function<bool()> predicate) noexcept {
+		return Waiter{event_loop}.Run(std::move(predicate),
+					      std::chrono::seconds{5});
+	}
+
+	/**
+	 * Run the #EventLoop for the specified duration.
+	 */
+	void RunFor(Event::Duration duration) noexcept {
+		Waiter{event_loop}.Run([]{ return false; }, duration);
+	}
+
+	/* virtual methods from class SessionChangesHandler */
+	void OnSessionChanges(std::span<const std::byte> records,
+			      std::span<const std::size_t> ends) noexcept override {
+		if (replicator)
+			static_cast<SessionChangesHandler &>(*replicator).OnSessionChanges(records, ends);
+	}
+};
+
+} // anonymous namespace
+
+static SessionId
+CreateSession(SessionManager &manager, const char *language) noexcept
+{
+	auto session = manager.CreateSession();
+	session->SetLanguage(language);
+	return session->id;
+}
+
+static void
+SetLanguage(SessionManager &manager, SessionId id,
+	    const char *language) noexcept
+{
+	SessionLease session{manager, id};
+	ASSERT_TRUE(session);
+	session->SetLanguage(language);
+}
+
+static std::string
+GetLanguage(const SessionManager &manager, SessionId id) noexcept
+{
+	const auto *session = manager.Get(id);
+	if (session == nullptr)
+		return "(none)";
+
+	if (session->language == nullptr)
+		return "(null)";
+
+	return session->language.c_str();
+}
+
+TEST(SessionReplication, FullSync)
+{
+	Context c;
+
+	/* more sessions than fit in one chunk */
+	std::vector<SessionId> ids;
+	for (unsigned i = 0; i < 3000; ++i)
+		ids.push_back(CreateSession(c.source, "x"));
+
+	c.StartReplica();
+	c.StartReplicator();
+
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 3000; }));
+	EXPECT_EQ(GetLanguage(*c.replica, ids.front()), "x");
+	EXPECT_EQ(GetLanguage(*c.replica, ids.back()), "x");
+}
+
+TEST(SessionReplication, Changes)
+{
+	Context c;
+
+	const auto a = CreateSession(c.source, "a1");
+	const auto b = CreateSession(c.source, "b1");
+
+	c.StartReplica();
+	c.StartReplicator();
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 2; }));
+
+	SetLanguage(c.source, a, "a2");
+	c.source.EraseAndDispose(b);
+	const auto d = CreateSession(c.source, "d1");
+	c.changes.Flush();
+
+	ASSERT_TRUE(c.WaitFor([&c, d]{
+		return c.replica->Get(d) != nullptr;
+	}));
+
+	EXPECT_EQ(c.replica->Count(), 2U);
+	EXPECT_EQ(GetLanguage(*c.replica, a), "a2");
+	EXPECT_EQ(GetLanguage(*c.replica, b), "(none)");
+	EXPECT_EQ(GetLanguage(*c.replica, d), "d1");
+}
+
+/**
+ * The changes do not fit into one frame; they must be split.
+ */
+TEST(SessionReplication, LargeChanges)
+{
+	Context c;
+
+	CreateSession(c.source, "a");
+
+	c.StartReplica();
+	c.StartReplicator();
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 1; }));
+
+	const std::string language(60000, 'x');
+	std::vector<SessionId> ids;
+	for (unsigned i = 0; i < 320; ++i)
+		ids.push_back(CreateSession(c.source, language.c_str()));
+	c.changes.Flush();
+
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 321; }));
+	EXPECT_EQ(GetLanguage(*c.replica, ids.front()), language);
+	EXPECT_EQ(GetLanguage(*c.replica, ids.back()), language);
+}
+
+/**
+ * The buddy has adopted a session and modified it; a full
+ * synchronization from the original node must not roll it back.
+ */
+TEST(SessionReplication, Stale)
+{
+	Context c;
+
+	const auto a = CreateSession(c.source, "a1");
+	const auto b = CreateSession(c.source, "b1");
+
+	c.StartReplica();
+	c.StartReplicator();
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 2; }));
+
+	/* the buddy modifies its copy */
+	SetLanguage(*c.replica, a, "adopted");
+
+	/* the original node comes back; a frame is applied as a
+	   whole, so once "b2" has arrived, "a1" has been
+	   rejected */
+	SetLanguage(c.source, b, "b2");
+	c.StartReplicator();
+
+	ASSERT_TRUE(c.WaitFor([&c, b]{
+		return GetLanguage(*c.replica, b) == "b2";
+	}));
+
+	EXPECT_EQ(GetLanguage(*c.replica, a), "adopted");
+
+	/* the original node modifies the session again, but its
+	   version is still older than the buddy's */
+	SetLanguage(c.source, a, "a2");
+	SetLanguage(c.source, b, "b3");
+	c.changes.Flush();
+
+	ASSERT_TRUE(c.WaitFor([&c, b]{
+		return GetLanguage(*c.replica, b) == "b3";
+	}));
+
+	EXPECT_EQ(GetLanguage(*c.replica, a), "adopted");
+}
+
+TEST(SessionReplication, Reconnect)
+{
+	Context c;
+
+	const auto a = CreateSession(c.source, "a1");
+	const auto b = CreateSession(c.source, "b1");
+
+	c.StartReplica();
+	c.StartReplicator();
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 2; }));
+
+	/* the buddy goes away; changes made while the connection is
+	   down are not lost */
+	c.StopReplica();
+
+	SetLanguage(c.source, a, "a2");
+	c.source.EraseAndDispose(b);
+	const auto d = CreateSession(c.source, "d1");
+	c.changes.Flush();
+
+	/* let the replicator notice the failure */
+	c.RunFor(std::chrono::milliseconds{50});
+
+	/* the buddy restarts without any sessions; the replicator
+	   reconnects and sends everything again */
+	c.StartReplica();
+
+	ASSERT_TRUE(c.WaitFor([&c, a, d]{
+		return GetLanguage(*c.replica, a) == "a2" &&
+			c.replica->Get(d) != nullptr;
+	}));
+
+	EXPECT_EQ(c.replica->Count(), 2U);
+	EXPECT_EQ(GetLanguage(*c.replica, b), "(none)");
+	EXPECT_EQ(GetLanguage(*c.replica, d), "d1");
+}
+
+/**
+ * A session is erased while the connection is down, and the buddy
+ * comes back with its old sessions; the full synchronization alone
+ * would not remove the session from the buddy.
+ */
+TEST(SessionReplication, EraseWhileDisconnected)
+{
+	Context c;
+
+	const auto a = CreateSession(c.source, "a1");
+	const auto b = CreateSession(c.source, "b1");
+
+	c.StartReplica();
+	c.StartReplicator();
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.replica->Count() == 2; }));
+
+	c.StopReplica();
+
+	/* let the replicator notice the failure */
+	c.RunFor(std::chrono::milliseconds{50});
+
+	SetLanguage(c.source, a, "a2");
+	c.source.EraseAndDispose(b);
+	c.changes.Flush();
+
+	c.RestartReplica();
+
+	/* the erase record is sent before the full synchronization,
+	   so once "a2" has arrived, "b" must be gone */
+	ASSERT_TRUE(c.WaitFor([&c, a]{
+		return GetLanguage(*c.replica, a) == "a2";
+	}));
+
+	EXPECT_EQ(c.replica->Count(), 1U);
+	EXPECT_EQ(GetLanguage(*c.replica, b), "(none)");
+}
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "stopwatch.hxx"
+#include "stopwatch_binary.hxx"
+#include "io/Pipe.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <limits.h> // for PIPE_BUF
+#include <string.h>
+
+struct ParsedEvent {
+	std::string name;
+};
+
+struct ParsedNode {
+	std::string name;
+	unsigned depth;
+	std::vector<ParsedEvent> events;
+};
+
+template<typename T>
+static T
+ReadStruct(std::span<const std::byte> &src)
+{
+	if (src.size() < sizeof(T))
+		throw std::runtime_error{"Truncated trace"};
+
+	T value;
+	memcpy(&value, src.data(), sizeof(value));
+	src = src.subspan(sizeof(value));
+	return value;
+}
+
+static std::string
+ReadName(std::span<const std::byte> &src, std::size_t length)
+{
+	if (src.size() < length)
+		throw std::runtime_error{"Truncated trace"};
+
+	std::string name{reinterpret_cast<const char *>(src.data()), length};
+	src = src.subspan(length);
+	return name;
+}
+
+/**
+ * Read one binary trace from the pipe and parse all of its nodes.
+ */
+static std::vector<ParsedNode>
+ReadTrace(FileDescriptor fd)
+{
+	std::array<std::byte, PIPE_BUF> buffer;
+	const auto nbytes = fd.Read(buffer);
+	if (nbytes <= 0)
+		throw std::runtime_error{"No trace"};
+
+	std::span<const std::byte> src{buffer.data(), std::size_t(nbytes)};
+
+	const auto header = ReadStruct<StopwatchBinaryHeader>(src);
+	EXPECT_EQ(header.magic, STOPWATCH_BINARY_MAGIC);
+	EXPECT_EQ(header.size, src.size());
+
+	std::vector<ParsedNode> nodes;
+	while (!src.empty()) {
+		const auto node = ReadStruct<StopwatchBinaryNode>(src);
+		auto &n = nodes.emplace_back();
+		n.name = ReadName(src, node.name_length);
+		n.depth = node.depth;
+
+		for (unsigned i = 0; i < node.n_events; ++i) {
+			const auto event = ReadStruct<StopwatchBinaryEvent>(src);
+			n.events.push_back({ReadName(src, event.name_length)});
+		}
+	}
+
+	return nodes;
+}
+
+static UniqueFileDescriptor
+EnableBinaryStopwatch()
+{
+	auto [r, w] = CreatePipe();
+	stopwatch_enable(std::move(w), {.binary = true});
+	return std::move(r);
+}
+
+TEST(Stopwatch, Binary)
+{
+	const auto r = EnableBinaryStopwatch();
+
+	{
+		RootStopwatchPtr root{"root"};
+		ASSERT_TRUE(root);
+		root.RecordEvent("a");
+
+		StopwatchPtr child{root, "child", "_suffix"};
+		child.RecordEvent("b");
+		child.RecordEvent("c");
+	}
+
+	const auto nodes = ReadTrace(r);
+	ASSERT_EQ(nodes.size(), 2U);
+
+	EXPECT_EQ(nodes[0].name, "root");
+	EXPECT_EQ(nodes[0].depth, 0U);
+	ASSERT_EQ(nodes[0].events.size(), 1U);
+	EXPECT_EQ(nodes[0].events[0].name, "a");
+
+	EXPECT_EQ(nodes[1].name, "child_suffix");
+	EXPECT_EQ(nodes[1].depth, 1U);
+	ASSERT_EQ(nodes[1].events.size(), 2U);
+	EXPECT_EQ(nodes[1].events[0].name, "b");
+	EXPECT_EQ(nodes[1].events[1].name, "c");
+}
+
+/**
+ * Record more events than a node can hold; the extra events must be
+ * omitted and "n_events" must match the events actually serialized.
+ */
+TEST(Stopwatch, BinaryTooManyEvents)
+{
+	constexpr unsigned N = STOPWATCH_BINARY_MAX_EVENTS + 2;
+
+	const auto r = EnableBinaryStopwatch();
+
+	{
+		RootStopwatchPtr root{"root"};
+		ASSERT_TRUE(root);
+
+		for (unsigned i = 0; i < N; ++i)
+			root.RecordEvent(std::to_string(i).c_str());
+
+		StopwatchPtr child{root, "child"};
+		child.RecordEvent("x");
+	}
+
+	const auto nodes = ReadTrace(r);
+	ASSERT_EQ(nodes.size(), 2U);
+
+	const auto &events = nodes[0].events;
+	EXPECT_GT(events.size(), 0U);
+	EXPECT_LE(events.size(), STOPWATCH_BINARY_MAX_EVENTS);
+
+	/* the first events are kept */
+	for (std::size_t i = 0; i < events.size(); ++i)
+		EXPECT_EQ(events[i].name, std::to_string(i));
+
+	/* the following node is still parsed correctly */
+	EXPECT_EQ(nodes[1].name, "child");
+	ASSERT_EQ(nodes[1].events.size(), 1U);
+	EXPECT_EQ(nodes[1].events[0].name, "x");
+}
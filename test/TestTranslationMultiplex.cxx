@@ -0,0 +1,490 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "TestInstance.hxx"
+#include "RecordingTranslateHandler.hxx"
+#include "translation/MClient.hxx"
+#include "translation/Marshal.hxx"
+#include "translation/Protocol.hxx"
+#include "translation/Request.hxx"
+#include "translation/Response.hxx"
+#include "http/Status.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "net/SocketPair.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "pool/pool.hxx"
+#include "stopwatch.hxx"
+#include "util/Cancellable.hxx"
+#include "util/SpanCast.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace {
+
+/**
+ * Runs the #EventLoop until a condition becomes true.
+ */
+class Waiter {
+	EventLoop &event_loop;
+	FineTimerEvent timer;
+
+	std::function<bool()> predicate;
+
+	/**
+	 * Give up after this many polls.
+	 */
+	unsigned remaining;
+
+	static constexpr Event::Duration poll_interval = std::chrono::milliseconds{1};
+
+public:
+	explicit Waiter(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop),
+		 timer(event_loop, BIND_THIS_METHOD(OnTimer)) {}
+
+	/**
+	 * @return the last result of the predicate (i.e. false on
+	 * timeout)
+	 */
+	bool Run(std::function<bool()> _predicate,
+		 Event::Duration timeout) noexcept {
+		predicate = std::move(_predicate);
+		remaining = timeout / poll_interval;
+
+		if (!predicate()) {
+			timer.Schedule(poll_interval);
+			event_loop.Run();
+			timer.Cancel();
+		}
+
+		return predicate();
+	}
+
+private:
+	void OnTimer() noexcept {
+		if (predicate() || --remaining == 0)
+			event_loop.Break();
+		else
+			timer.Schedule(poll_interval);
+	}
+};
+
+/**
+ * The server side of the socket pair: parses the packets sent by the
+ * #TranslationMultiplexClient and sends hand-made responses.
+ */
+struct FakeTranslationServer {
+	UniqueSocketDescriptor socket;
+
+	std::string input;
+
+	/**
+	 * The number of #TRANSLATE_MULTIPLEX probes received.
+	 */
+	unsigned n_probes = 0;
+
+	std::vector<TranslationRequestId> request_ids, canceled_ids;
+
+	/**
+	 * Receive and parse everything the client has sent so far.
+	 */
+	void Receive() noexcept {
+		std::array<std::byte, 4096> buffer;
+		ssize_t nbytes;
+		while ((nbytes = socket.Receive(buffer, MSG_DONTWAIT)) > 0)
+			input.append((const char *)buffer.data(), nbytes);
+
+		while (input.size() >= sizeof(TranslationHeader)) {
+			TranslationHeader header;
+			std::memcpy(&header, input.data(), sizeof(header));
+
+			const std::size_t size = sizeof(header) + header.length;
+			if (input.size() < size)
+				break;
+
+			const char *payload = input.data() + sizeof(header);
+
+			if (header.command == TRANSLATE_MULTIPLEX) {
+				++n_probes;
+			} else if (header.command == TRANSLATE_REQUEST_ID ||
+				   header.command == TRANSLATE_CANCEL) {
+				TranslationRequestId id;
+				std::memcpy(&id, payload, sizeof(id));
+
+				if (header.command == TRANSLATE_REQUEST_ID)
+					request_ids.push_back(id);
+				else
+					canceled_ids.push_back(id);
+			}
+
+			input.erase(0, size);
+		}
+	}
+
+	void Send(std::string_view data) {
+		if (socket.Send(AsBytes(data), MSG_NOSIGNAL) != (ssize_t)data.size())
+			throw std::runtime_error("Send failed");
+	}
+
+	static std::string ToString(GrowingBuffer &&buffer) {
+		std::string result;
+		while (true) {
+			const auto r = buffer.Read();
+			if (r.empty())
+				break;
+
+			result.append((const char *)r.data(), r.size());
+			buffer.Consume(r.size());
+		}
+
+		return result;
+	}
+
+	static std::string MakeProbeResponse(bool supported) {
+		TranslationMarshaller m;
+		m.WriteT(TranslationCommand::BEGIN, TRANSLATION_PROTOCOL_VERSION);
+		if (supported)
+			m.Write(TRANSLATE_MULTIPLEX);
+		m.Write(TranslationCommand::END);
+		return ToString(m.Commit());
+	}
+
+	static std::string MakeResponse(TranslationRequestId id,
+					HttpStatus status) {
+		TranslationMarshaller m;
+		m.WriteT(TranslationCommand::BEGIN, TRANSLATION_PROTOCOL_VERSION);
+		m.WriteT(TRANSLATE_REQUEST_ID, id);
+		m.Write16(TranslationCommand::STATUS, static_cast<uint16_t>(status));
+		m.Write(TranslationCommand::END);
+		return ToString(m.Commit());
+	}
+};
+
+struct Context final : TestInstance, TranslationMultiplexClientHandler {
+	PoolPtr pool = pool_new_linear(root_pool, "test", 8192);
+
+	FakeTranslationServer server;
+
+	/**
+	 * The client side of the next connection; handed out by
+	 * OnTranslationMultiplexConnect().
+	 */
+	UniqueSocketDescriptor next_socket;
+
+	std::optional<bool> probe_result;
+
+	unsigned n_disconnects = 0;
+	std::exception_ptr disconnect_error;
+
+	TranslationMultiplexClient client{event_loop, *this};
+
+	TranslateRequest request;
+
+	Context() {
+		request.uri = "/";
+	}
+
+	bool WaitFor(std::function<bool()> predicate) noexcept {
+		return Waiter{event_loop}.Run(std::move(predicate),
+					      std::chrono::seconds{5});
+	}
+
+	/**
+	 * Run the #EventLoop until the client has sent everything.
+	 */
+	void Flush() noexcept {
+		Waiter{event_loop}.Run([]{ return false; },
+				       std::chrono::milliseconds{10});
+		server.Receive();
+	}
+
+	/**
+	 * Connect to a new #FakeTranslationServer and wait until the
+	 * client has sent its probe.
+	 */
+	void StartProbe() {
+		auto [a, b] = CreateStreamSocketPairNonBlock();
+		next_socket = std::move(a);
+		server = {};
+		server.socket = std::move(b);
+		probe_result.reset();
+
+		client.Probe();
+		ASSERT_TRUE(WaitFor([this]{
+			server.Receive();
+			return server.n_probes > 0;
+		}));
+	}
+
+	void Probe(bool supported) {
+		StartProbe();
+		server.Send(FakeTranslationServer::MakeProbeResponse(supported));
+		ASSERT_TRUE(WaitFor([this]{ return probe_result.has_value(); }));
+	}
+
+	void SendRequest(RecordingTranslateHandler &handler,
+			 CancellablePointer &cancel_ptr) noexcept {
+		client.SendRequest(*pool, nullptr, request, handler, cancel_ptr);
+	}
+
+	bool WaitResponse(const RecordingTranslateHandler &handler) noexcept {
+		return WaitFor([&handler]{ return handler.finished; });
+	}
+
+	/* virtual methods from class TranslationMultiplexClientHandler */
+	UniqueSocketDescriptor OnTranslationMultiplexConnect() override {
+		if (!next_socket.IsDefined())
+			throw std::runtime_error("Connection refused");
+
+		return std::move(next_socket);
+	}
+
+	void OnTranslationMultiplexProbe(bool supported) noexcept override {
+		probe_result = supported;
+	}
+
+	void OnTranslationMultiplexDisconnect(std::exception_ptr error) noexcept override {
+		++n_disconnects;
+		disconnect_error = std::move(error);
+	}
+};
+
+} // anonymous namespace
+
+static HttpStatus
+GetStatus(const RecordingTranslateHandler &handler) noexcept
+{
+	if (!handler.finished || !handler.response)
+		return {};
+
+	return handler.response->status;
+}
+
+TEST(TranslationMultiplex, Probe)
+{
+	Context c;
+
+	c.Probe(true);
+	EXPECT_EQ(c.probe_result, true);
+	EXPECT_TRUE(c.client.IsConnected());
+	EXPECT_EQ(c.n_disconnects, 0U);
+}
+
+/**
+ * The server answers the probe without #TRANSLATE_MULTIPLEX: this is
+ * the only case which disables multiplexing.
+ */
+TEST(TranslationMultiplex, ProbeUnsupported)
+{
+	Context c;
+
+	c.Probe(false);
+	EXPECT_EQ(c.probe_result, false);
+	EXPECT_FALSE(c.client.IsConnected());
+	EXPECT_EQ(c.n_disconnects, 0U);
+}
+
+/**
+ * The connection breaks before the probe has been answered: that is
+ * an error, not an answer.
+ */
+TEST(TranslationMultiplex, ProbeFallback)
+{
+	Context c;
+
+	c.StartProbe();
+	c.server.socket.Close();
+
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.n_disconnects > 0; }));
+	EXPECT_FALSE(c.probe_result.has_value());
+	EXPECT_TRUE(c.disconnect_error);
+	EXPECT_FALSE(c.client.IsConnected());
+
+	/* connecting fails, too */
+	EXPECT_THROW(c.client.Probe(), std::runtime_error);
+	EXPECT_FALSE(c.client.IsConnected());
+
+	/* the next probe succeeds */
+	c.Probe(true);
+	EXPECT_EQ(c.probe_result, true);
+}
+
+/**
+ * Responses are delivered to their requests regardless of the order
+ * in which they arrive.
+ */
+TEST(TranslationMultiplex, OutOfOrder)
+{
+	Context c;
+	c.Probe(true);
+	ASSERT_EQ(c.probe_result, true);
+
+	RecordingTranslateHandler h1{*c.pool}, h2{*c.pool}, h3{*c.pool};
+	CancellablePointer cancel1, cancel2, cancel3;
+	c.SendRequest(h1, cancel1);
+	c.SendRequest(h2, cancel2);
+	c.SendRequest(h3, cancel3);
+
+	ASSERT_TRUE(c.WaitFor([&c]{
+		c.server.Receive();
+		return c.server.request_ids.size() == 3;
+	}));
+
+	const auto ids = c.server.request_ids;
+	EXPECT_NE(ids[0], ids[1]);
+	EXPECT_NE(ids[1], ids[2]);
+	EXPECT_NE(ids[0], ids[2]);
+
+	c.server.Send(FakeTranslationServer::MakeResponse(ids[2], HttpStatus::GONE));
+	ASSERT_TRUE(c.WaitResponse(h3));
+	EXPECT_FALSE(h1.finished);
+	EXPECT_FALSE(h2.finished);
+
+	/* two responses in one chunk */
+	c.server.Send(FakeTranslationServer::MakeResponse(ids[1], HttpStatus::NOT_FOUND) +
+		      FakeTranslationServer::MakeResponse(ids[0], HttpStatus::OK));
+	ASSERT_TRUE(c.WaitResponse(h1));
+	ASSERT_TRUE(c.WaitResponse(h2));
+
+	EXPECT_FALSE(h1.error);
+	EXPECT_FALSE(h2.error);
+	EXPECT_FALSE(h3.error);
+	EXPECT_EQ(GetStatus(h1), HttpStatus::OK);
+	EXPECT_EQ(GetStatus(h2), HttpStatus::NOT_FOUND);
+	EXPECT_EQ(GetStatus(h3), HttpStatus::GONE);
+
+	/* the connection stays open for more requests */
+	EXPECT_TRUE(c.client.IsConnected());
+	EXPECT_EQ(c.n_disconnects, 0U);
+}
+
+/**
+ * A canceled request is announced to the server, and its response
+ * (even if it is already being received) is discarded.
+ */
+TEST(TranslationMultiplex, Cancel)
+{
+	Context c;
+	c.Probe(true);
+	ASSERT_EQ(c.probe_result, true);
+
+	RecordingTranslateHandler h1{*c.pool}, h2{*c.pool};
+	CancellablePointer cancel1, cancel2;
+	c.SendRequest(h1, cancel1);
+	c.SendRequest(h2, cancel2);
+
+	ASSERT_TRUE(c.WaitFor([&c]{
+		c.server.Receive();
+		return c.server.request_ids.size() == 2;
+	}));
+
+	const auto ids = c.server.request_ids;
+
+	/* the first half of the first response arrives */
+	const auto response1 = FakeTranslationServer::MakeResponse(ids[0], HttpStatus::OK);
+	const std::size_t half = response1.size() / 2;
+	c.server.Send(std::string_view{response1}.substr(0, half));
+	c.Flush();
+	EXPECT_FALSE(h1.finished);
+
+	cancel1.Cancel();
+
+	ASSERT_TRUE(c.WaitFor([&c]{
+		c.server.Receive();
+		return !c.server.canceled_ids.empty();
+	}));
+	EXPECT_EQ(c.server.canceled_ids.front(), ids[0]);
+
+	/* the rest of the canceled response is discarded, and the
+	   following one is still delivered */
+	c.server.Send(std::string_view{response1}.substr(half));
+	c.server.Send(FakeTranslationServer::MakeResponse(ids[1], HttpStatus::NOT_FOUND));
+	ASSERT_TRUE(c.WaitResponse(h2));
+	EXPECT_EQ(GetStatus(h2), HttpStatus::NOT_FOUND);
+	EXPECT_FALSE(h1.finished);
+
+	/* a late response to a request which was canceled before
+	   its response started is discarded as well */
+	RecordingTranslateHandler h3{*c.pool}, h4{*c.pool};
+	CancellablePointer cancel3, cancel4;
+	c.SendRequest(h3, cancel3);
+	c.SendRequest(h4, cancel4);
+
+	ASSERT_TRUE(c.WaitFor([&c]{
+		c.server.Receive();
+		return c.server.request_ids.size() == 4;
+	}));
+
+	cancel3.Cancel();
+	c.server.Send(FakeTranslationServer::MakeResponse(c.server.request_ids[2],
+							  HttpStatus::OK) +
+		      FakeTranslationServer::MakeResponse(c.server.request_ids[3],
+							  HttpStatus::GONE));
+	ASSERT_TRUE(c.WaitResponse(h4));
+	EXPECT_EQ(GetStatus(h4), HttpStatus::GONE);
+	EXPECT_FALSE(h3.finished);
+
+	EXPECT_TRUE(c.client.IsConnected());
+	EXPECT_EQ(c.n_disconnects, 0U);
+}
+
+/**
+ * The server closes the connection while requests are pending: they
+ * fail.
+ */
+TEST(TranslationMultiplex, Broken)
+{
+	Context c;
+	c.Probe(true);
+	ASSERT_EQ(c.probe_result, true);
+
+	RecordingTranslateHandler h1{*c.pool};
+	CancellablePointer cancel1;
+	c.SendRequest(h1, cancel1);
+
+	ASSERT_TRUE(c.WaitFor([&c]{
+		c.server.Receive();
+		return c.server.request_ids.size() == 1;
+	}));
+
+	c.server.socket.Close();
+
+	ASSERT_TRUE(c.WaitResponse(h1));
+	EXPECT_TRUE(h1.error);
+	EXPECT_EQ(c.n_disconnects, 1U);
+	EXPECT_TRUE(c.disconnect_error);
+	EXPECT_FALSE(c.client.IsConnected());
+}
+
+/**
+ * The server closes the idle connection: this is not an error, and
+ * the next connection is probed again.
+ */
+TEST(TranslationMultiplex, IdleDisconnect)
+{
+	Context c;
+	c.Probe(true);
+	ASSERT_EQ(c.probe_result, true);
+
+	c.server.socket.Close();
+
+	ASSERT_TRUE(c.WaitFor([&c]{ return c.n_disconnects > 0; }));
+	EXPECT_FALSE(c.disconnect_error);
+	EXPECT_FALSE(c.client.IsConnected());
+
+	/* the new server does not support multiplexing */
+	c.Probe(false);
+	EXPECT_EQ(c.probe_result, false);
+}
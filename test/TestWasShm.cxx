@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "was/Shm.hxx"
+#include "was/async/Socket.hxx"
+#include "util/SpanCast.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using std::string_view_literals::operator""sv;
+
+static std::string
+ReadAll(WasShmRing &ring)
+{
+	std::string result;
+	for (const auto &i : ring.GetReadBuffers())
+		result.append(ToStringView(i));
+	ring.Consume(result.size());
+	return result;
+}
+
+static std::size_t
+Write(WasShmRing &ring, std::string_view src)
+{
+	std::size_t total = 0;
+
+	while (!src.empty()) {
+		const auto w = ring.GetWriteBuffer();
+		if (w.empty())
+			break;
+
+		const std::size_t n = std::min(w.size(), src.size());
+		std::copy_n(AsBytes(src).begin(), n, w.begin());
+		ring.Append(n);
+		src.remove_prefix(n);
+		total += n;
+	}
+
+	return total;
+}
+
+TEST(WasShm, Packet)
+{
+	for (const auto i : {WasShmPacket::OFFER, WasShmPacket::ACCEPT,
+			     WasShmPacket::DATA})
+		EXPECT_EQ(WasShmParsePacket(AsBytes(WasShmPacketPayload(i))), i);
+
+	EXPECT_EQ(WasShmParsePacket({}), WasShmPacket::NONE);
+	EXPECT_EQ(WasShmParsePacket(AsBytes("foo"sv)), WasShmPacket::NONE);
+}
+
+TEST(WasShm, Ring)
+{
+	WasShmRingHeader header{};
+	std::array<std::byte, 8> buffer;
+
+	/* the producer and the consumer each have their own view */
+	WasShmRing producer{header, buffer.data(), buffer.size()};
+	WasShmRing consumer{header, buffer.data(), buffer.size()};
+
+	EXPECT_EQ(consumer.GetAvailable(), 0U);
+	EXPECT_EQ(producer.GetWriteBuffer().size(), 8U);
+
+	EXPECT_EQ(Write(producer, "abcdef"sv), 6U);
+	EXPECT_EQ(consumer.GetAvailable(), 6U);
+	EXPECT_EQ(ReadAll(consumer), "abcdef"sv);
+
+	/* wrap around */
+	EXPECT_EQ(producer.GetWriteBuffer().size(), 2U);
+	EXPECT_EQ(Write(producer, "0123456789"sv), 8U);
+	EXPECT_EQ(producer.GetWriteBuffer().size(), 0U);
+	EXPECT_EQ(consumer.GetAvailable(), 8U);
+
+	const auto r = consumer.GetReadBuffers();
+	EXPECT_EQ(ToStringView(r[0]), "01"sv);
+	EXPECT_EQ(ToStringView(r[1]), "234567"sv);
+
+	/* the producer must be notified after consuming a full
+	   ring */
+	EXPECT_TRUE(consumer.Consume(3));
+
+	/* the write buffer ends at the end of the ring */
+	EXPECT_EQ(producer.GetWriteBuffer().size(), 2U);
+
+	EXPECT_FALSE(consumer.Consume(1));
+	EXPECT_EQ(ReadAll(consumer), "4567"sv);
+	EXPECT_EQ(consumer.GetAvailable(), 0U);
+
+	/* the consumer must be notified after appending to an empty
+	   ring */
+	EXPECT_TRUE(producer.Append(0));
+}
+
+TEST(WasShm, BogusPeer)
+{
+	WasShmRingHeader header{};
+	std::array<std::byte, 8> buffer;
+
+	WasShmRing producer{header, buffer.data(), buffer.size()};
+	WasShmRing consumer{header, buffer.data(), buffer.size()};
+
+	/* a bogus "head" must not let the consumer read beyond the
+	   ring */
+	header.head = 1000;
+	EXPECT_EQ(consumer.GetAvailable(), 8U);
+
+	/* a bogus "tail" must not let the producer write beyond the
+	   ring */
+	header.head = 0;
+	header.tail = 1000;
+	EXPECT_LE(producer.GetWriteBuffer().size(), 8U);
+}
+
+TEST(WasShm, Offer)
+{
+	auto [client_socket, server_socket] = WasSocket::CreatePair();
+
+	/* no offer */
+	EXPECT_EQ(WasShm::ReceiveOffer(server_socket.control), nullptr);
+
+	auto client = WasShm::Create();
+	EXPECT_FALSE(client->IsAccepted());
+	client->SendOffer(client_socket.control);
+
+	auto server = WasShm::ReceiveOffer(server_socket.control);
+	ASSERT_NE(server, nullptr);
+
+	/* the offer has been consumed */
+	EXPECT_EQ(WasShm::ReceiveOffer(server_socket.control), nullptr);
+
+	/* request body */
+	EXPECT_EQ(client->GetOutput().Write(AsBytes("hello"sv)), 5U);
+	EXPECT_EQ(ReadAll(server->GetInput().GetRing()), "hello"sv);
+
+	/* response body */
+	EXPECT_EQ(server->GetOutput().Write(AsBytes("world"sv)), 5U);
+	EXPECT_EQ(ReadAll(client->GetInput().GetRing()), "world"sv);
+}
@@ -190,6 +190,28 @@ FcgiServer::DiscardRequestBody(const FcgiRequest &r)
 	}
 }
 
+void
+FcgiServer::ReadGetValues()
+{
+	const auto header = ReadHeader();
+	if (header.type != FcgiRecordType::GET_VALUES ||
+	    header.request_id != 0)
+		throw std::runtime_error{"GET_VALUES expected"};
+
+	DiscardRaw(header.content_length + header.padding_length);
+}
+
+uint_least16_t
+FcgiServer::ReadAbortRequest()
+{
+	const auto header = ReadHeader();
+	if (header.type != FcgiRecordType::ABORT_REQUEST)
+		throw std::runtime_error{"ABORT_REQUEST expected"};
+
+	DiscardRaw(header.content_length + header.padding_length);
+	return header.request_id;
+}
+
 std::size_t
 FcgiServer::ReadRaw(std::span<std::byte> dest)
 {
@@ -332,10 +354,35 @@ FcgiServer::WriteResponseHeaders(const FcgiRequest &r, HttpStatus status,
 }
 
 void
-FcgiServer::EndResponse(const FcgiRequest &r)
+FcgiServer::WriteGetValuesResult(std::string_view name,
+				 std::string_view value)
+{
+	assert(name.size() < 0x80);
+	assert(value.size() < 0x80);
+
+	WriteHeader({
+		.version = FCGI_VERSION_1,
+		.type = FcgiRecordType::GET_VALUES_RESULT,
+		.request_id = 0,
+		.content_length = 2 + name.size() + value.size(),
+	});
+
+	const std::byte lengths[] = {
+		static_cast<std::byte>(name.size()),
+		static_cast<std::byte>(value.size()),
+	};
+
+	WriteFullRaw(lengths);
+	WriteFullRaw(AsBytes(name));
+	WriteFullRaw(AsBytes(value));
+}
+
+void
+FcgiServer::EndResponse(const FcgiRequest &r,
+			FcgiProtocolStatus protocol_status)
 {
-	static constexpr FcgiEndRequest end_request{
-		.protocol_status = static_cast<uint8_t>(FcgiProtocolStatus::REQUEST_COMPLETE),
+	const FcgiEndRequest end_request{
+		.protocol_status = static_cast<uint8_t>(protocol_status),
 	};
 
 	WriteHeader({
@@ -55,6 +55,18 @@ public:
 
 	void DiscardRequestBody(const FcgiRequest &r);
 
+	/**
+	 * Read a GET_VALUES record and discard its payload.
+	 */
+	void ReadGetValues();
+
+	/**
+	 * Read an ABORT_REQUEST record.
+	 *
+	 * @return the request id
+	 */
+	uint_least16_t ReadAbortRequest();
+
 	[[nodiscard]]
 	std::size_t ReadRaw(std::span<std::byte> dest);
 
@@ -95,9 +107,17 @@ public:
 		WriteRecord(r, FcgiRecordType::STDERR, payload, padding);
 	}
 
+	/**
+	 * Write a GET_VALUES_RESULT record with one name/value pair
+	 * (each shorter than 128 bytes).
+	 */
+	void WriteGetValuesResult(std::string_view name,
+				  std::string_view value);
+
 	void MirrorRaw(std::size_t size);
 
-	void EndResponse(const FcgiRequest &r);
+	void EndResponse(const FcgiRequest &r,
+			 FcgiProtocolStatus protocol_status=FcgiProtocolStatus::REQUEST_COMPLETE);
 
 	void Shutdown() noexcept {
 		socket.Shutdown();
@@ -10,7 +10,6 @@
 class IstreamFcgiTestTraits {
 public:
 	static constexpr IstreamFilterTestOptions options{
-		.enable_buckets = false,
 	};
 
 	UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
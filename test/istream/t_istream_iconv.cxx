@@ -11,7 +11,6 @@ class IstreamIconvTestTraits {
 public:
 	static constexpr IstreamFilterTestOptions options{
 		.expected_result = "f\xc3\xbc\xc3\xbc",
-		.enable_buckets = false,
 	};
 
 	UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
@@ -26,3 +25,26 @@ public:
 
 INSTANTIATE_TYPED_TEST_SUITE_P(Iconv, IstreamFilterTest,
 			       IstreamIconvTestTraits);
+
+/**
+ * ISO-8859-15 is not built in; this tests the libiconv path.
+ */
+class IstreamIconvLibiconvTestTraits {
+public:
+	static constexpr IstreamFilterTestOptions options{
+		.expected_result = "f\xc3\xbc\xe2\x82\xac",
+	};
+
+	UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
+		return istream_string_new(pool, "f\xfc\xa4");
+	}
+
+	UnusedIstreamPtr CreateTest(EventLoop &, struct pool &pool,
+				    UnusedIstreamPtr input) const noexcept {
+		return istream_iconv_new(pool, std::move(input),
+					 "utf-8", "iso-8859-15");
+	}
+};
+
+INSTANTIATE_TYPED_TEST_SUITE_P(IconvLibiconv, IstreamFilterTest,
+			       IstreamIconvLibiconvTestTraits);
@@ -7,12 +7,12 @@
 #include "istream/istream_string.hxx"
 #include "istream/istream.hxx"
 #include "istream/UnusedPtr.hxx"
+#include "pool/pool.hxx"
 
 class IstreamSubstTestTraits {
 public:
 	static constexpr IstreamFilterTestOptions options{
 		.expected_result = "xyz bar fo fo bar bla! fo",
-		.enable_buckets = false, // TODO enable this once SubsIstream::_ConsumeBucketList() and _GetAvailable() is implemented properly
 	};
 
 	UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
@@ -31,3 +31,74 @@ public:
 
 INSTANTIATE_TYPED_TEST_SUITE_P(Subst, IstreamFilterTest,
 			       IstreamSubstTestTraits);
+
+/**
+ * Overlapping search words which require following the automaton's
+ * failure links, and a partial match at the end of the input.
+ */
+class IstreamSubstOverlapTestTraits {
+public:
+	static constexpr IstreamFilterTestOptions options{
+		.expected_result = "xa2x &c:W 1 &c:i",
+	};
+
+	UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
+		return istream_string_new(pool, "xabcex &c:&c:id; abcd &c:i");
+	}
+
+	UnusedIstreamPtr CreateTest(EventLoop &, struct pool &pool,
+				    UnusedIstreamPtr input) const noexcept {
+		SubstTree tree;
+		tree.Add(pool, "abcd", "1");
+		tree.Add(pool, "bce", "2");
+		tree.Add(pool, "&c:id;", "W");
+
+		return UnusedIstreamPtr(istream_subst_new(&pool, std::move(input), std::move(tree)));
+	}
+};
+
+INSTANTIATE_TYPED_TEST_SUITE_P(SubstOverlap, IstreamFilterTest,
+			       IstreamSubstOverlapTestTraits);
+
+/**
+ * A shared tree with lazy replacements; "&c:id;" is resolved, and
+ * "&c:path;" is left as it is.
+ */
+class IstreamSubstLazyTestTraits {
+	struct Resolver final : SubstResolver {
+		std::optional<std::string_view> ResolveSubst(unsigned id) noexcept override {
+			if (id == 0)
+				return "W";
+
+			return std::nullopt;
+		}
+	};
+
+public:
+	static constexpr IstreamFilterTestOptions options{
+		.expected_result = "x W &c:path; W bar",
+	};
+
+	UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
+		return istream_string_new(pool, "x &c:id; &c:path; &c:id; foo");
+	}
+
+	UnusedIstreamPtr CreateTest(EventLoop &, struct pool &pool,
+				    UnusedIstreamPtr input) const noexcept {
+		/* the shared tree and the resolver must outlive the
+		   istream; allocate them from its pool, so each test
+		   gets its own */
+		auto &tree = *NewFromPool<SubstTree>(pool);
+		tree.AddLazy(pool, "&c:id;", 0);
+		tree.AddLazy(pool, "&c:path;", 1);
+		tree.Add(pool, "foo", "bar");
+		tree.Compile();
+
+		auto &resolver = *NewFromPool<Resolver>(pool);
+
+		return istream_subst_new(&pool, std::move(input), tree, resolver);
+	}
+};
+
+INSTANTIATE_TYPED_TEST_SUITE_P(SubstLazy, IstreamFilterTest,
+			       IstreamSubstLazyTestTraits);
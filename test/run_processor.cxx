@@ -88,7 +88,8 @@ try {
 				  OpenFileIstream(instance.event_loop,
 						  instance.root_pool,
 						  "/dev/stdin"),
-				  widget, std::move(ctx), PROCESSOR_CONTAINER);
+				  widget, std::move(ctx), PROCESSOR_CONTAINER,
+				  nullptr, nullptr);
 
 	StdioSink sink(std::move(result));
 	sink.LoopRead();
@@ -172,7 +172,7 @@ try {
 	SetLogLevel(5);
 
 	if (argc < 3) {
-		fmt::print(stderr, "Usage: run_was PATH URI [--parameter a=b ...] -- ARGS...\n");
+		fmt::print(stderr, "Usage: run_was PATH URI [--parameter a=b ...] [--shm] -- ARGS...\n");
 		return EXIT_FAILURE;
 	}
 
@@ -183,6 +183,7 @@ try {
 	StaticVector<const char *, 64> params;
 	bool collect_args = false;
 	StaticVector<const char *, 64> args;
+	bool shm = false;
 
 	StringMap headers;
 
@@ -212,6 +213,9 @@ try {
 
 			AllocatorPtr alloc(context.root_pool);
 			headers.Add(alloc, alloc.DupToLower(name), alloc.DupZ(value));
+		} else if (!collect_args && StringIsEqual(argv[i], "--shm")) {
+			shm = true;
+			i++;
 		} else if (StringIsEqual(argv[i], "--")) {
 			collect_args = true;
 			i++;
@@ -237,13 +241,15 @@ try {
 	context.process = was_launch(spawn_service, nullptr, "was",
 				     path, args,
 				     child_options,
-				     UniqueFileDescriptor(::dup(STDERR_FILENO)));
+				     UniqueFileDescriptor(::dup(STDERR_FILENO)),
+				     shm);
 	context.control.emplace(context.event_loop, context.process.control, context);
 
 	was_client_request(context.root_pool, nullptr,
 			   *context.control,
 			   context.process.input,
 			   context.process.output,
+			   context.process.shm.get(),
 			   context,
 			   nullptr,
 			   HttpMethod::GET, uri,
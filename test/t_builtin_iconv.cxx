@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "istream/BuiltinIconv.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <errno.h>
+#include <iconv.h>
+
+/**
+ * Convert with libiconv, skipping invalid input like IconvIstream
+ * does.
+ */
+static std::string
+ConvertLibiconv(const char *tocode, const char *fromcode, std::string src)
+{
+	const iconv_t cd = iconv_open(tocode, fromcode);
+	EXPECT_NE(cd, (iconv_t)-1);
+
+	std::string result;
+	char *in = src.data();
+	std::size_t in_left = src.size();
+
+	while (in_left > 0) {
+		char buffer[256];
+		char *out = buffer;
+		std::size_t out_left = sizeof(buffer);
+
+		const std::size_t ret = iconv(cd, &in, &in_left, &out, &out_left);
+		result.append(buffer, out);
+
+		if (ret == (std::size_t)-1) {
+			if (errno == EILSEQ) {
+				++in;
+				--in_left;
+			} else if (errno != E2BIG)
+				break;
+		}
+	}
+
+	iconv_close(cd);
+	return result;
+}
+
+/**
+ * Convert with the built-in converter, using a small output buffer
+ * to check that no character gets split.
+ */
+static std::string
+ConvertBuiltin(BuiltinIconvType type, std::string_view src)
+{
+	std::string result;
+	auto in = std::as_bytes(std::span{src});
+
+	while (!in.empty()) {
+		std::byte buffer[5];
+		const auto r = BuiltinIconv(type, in, buffer);
+		result.append((const char *)buffer, r.produced);
+		in = in.subspan(r.consumed);
+
+		if (r.incomplete)
+			break;
+
+		EXPECT_GT(r.consumed, 0U);
+	}
+
+	return result;
+}
+
+static void
+Compare(const char *tocode, const char *fromcode, const std::string &src)
+{
+	const auto type = FindBuiltinIconv(tocode, fromcode);
+	ASSERT_TRUE(type);
+
+	EXPECT_EQ(ConvertBuiltin(*type, src),
+		  ConvertLibiconv(tocode, fromcode, src));
+}
+
+TEST(BuiltinIconv, Find)
+{
+	EXPECT_EQ(FindBuiltinIconv("utf-8", "ISO-8859-1"),
+		  BuiltinIconvType::LATIN1_TO_UTF8);
+	EXPECT_EQ(FindBuiltinIconv("UTF8", "iso_8859-1"),
+		  BuiltinIconvType::LATIN1_TO_UTF8);
+	EXPECT_EQ(FindBuiltinIconv("utf-8", "windows-1252"),
+		  BuiltinIconvType::CP1252_TO_UTF8);
+	EXPECT_EQ(FindBuiltinIconv("latin1", "utf-8"),
+		  BuiltinIconvType::UTF8_TO_LATIN1);
+	EXPECT_EQ(FindBuiltinIconv("CP1252", "utf-8"),
+		  BuiltinIconvType::UTF8_TO_CP1252);
+
+	EXPECT_FALSE(FindBuiltinIconv("utf-8", "iso-8859-15"));
+	EXPECT_FALSE(FindBuiltinIconv("utf-8//TRANSLIT", "latin1"));
+	EXPECT_FALSE(FindBuiltinIconv("latin1", "cp1252"));
+}
+
+TEST(BuiltinIconv, ASCII)
+{
+	std::string s(100, 'a');
+	EXPECT_EQ(CountLeadingASCII(std::as_bytes(std::span{s})), s.size());
+
+	for (std::size_t i = 0; i < s.size(); ++i) {
+		std::string t = s;
+		t[i] = '\x80';
+		EXPECT_EQ(CountLeadingASCII(std::as_bytes(std::span{t})), i);
+	}
+}
+
+TEST(BuiltinIconv, FromSingleByte)
+{
+	/* all byte values, at different alignments */
+	std::string src;
+	for (unsigned i = 0; i < 256; ++i) {
+		src.push_back((char)i);
+		src.append(i % 7, 'x');
+	}
+
+	Compare("utf-8", "iso-8859-1", src);
+	Compare("utf-8", "windows-1252", src);
+}
+
+TEST(BuiltinIconv, FromUTF8)
+{
+	const std::string valid =
+		"ascii \xc3\xa4\xc3\xb6\xc3\xbc \xc2\x80\xc2\x9f "
+		"\xe2\x82\xac \xe2\x80\x9e\xe2\x80\x9c \xc5\x92 "
+		"\xe4\xb8\xad \xf0\x9f\x98\x80 end";
+	const std::string invalid =
+		"\x80\xbf\xc0\xaf\xc3\x28\xe2\x82\x28\xed\xa0\x80"
+		"\xf8\x88\x80\x80\x80\xff x";
+
+	for (const char *tocode : {"iso-8859-1", "windows-1252"}) {
+		Compare(tocode, "utf-8", valid);
+		Compare(tocode, "utf-8", invalid);
+		Compare(tocode, "utf-8", valid + invalid + valid);
+	}
+}
+
+TEST(BuiltinIconv, Incomplete)
+{
+	const std::string_view src = "ab\xe2\x82";
+	std::byte buffer[16];
+	const auto r = BuiltinIconv(BuiltinIconvType::UTF8_TO_CP1252,
+				    std::as_bytes(std::span{src}), buffer);
+	EXPECT_EQ(r.consumed, 2U);
+	EXPECT_EQ(r.produced, 2U);
+	EXPECT_TRUE(r.incomplete);
+}
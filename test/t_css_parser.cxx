@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "parser/CssParser.hxx"
+#include "parser/CssScan.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using std::string_literals::operator""s;
+
+namespace {
+
+struct CssRecorder {
+	std::vector<std::string> events;
+
+	void Add(const char *type, const CssParserValue &v) noexcept {
+		events.emplace_back(type + " "s + std::to_string(v.start) +
+				    " " + std::to_string(v.end) + " " +
+				    std::string{v.value});
+	}
+};
+
+static void
+RecordClassName(const CssParserValue *name, void *ctx) noexcept
+{
+	((CssRecorder *)ctx)->Add("class", *name);
+}
+
+static void
+RecordXmlId(const CssParserValue *id, void *ctx) noexcept
+{
+	((CssRecorder *)ctx)->Add("id", *id);
+}
+
+static void
+RecordBlock(void *ctx) noexcept
+{
+	((CssRecorder *)ctx)->events.emplace_back("block");
+}
+
+static void
+RecordPropertyKeyword(const char *name, std::string_view value,
+		      off_t start, off_t end, void *ctx) noexcept
+{
+	((CssRecorder *)ctx)->events.emplace_back("property "s +
+						  std::to_string(start) + " " +
+						  std::to_string(end) + " " +
+						  name + "=" +
+						  std::string{value});
+}
+
+static void
+RecordUrl(const CssParserValue *url, void *ctx) noexcept
+{
+	((CssRecorder *)ctx)->Add("url", *url);
+}
+
+static void
+RecordImport(const CssParserValue *url, void *ctx) noexcept
+{
+	((CssRecorder *)ctx)->Add("import", *url);
+}
+
+static constexpr CssParserHandler recording_css_parser_handler = {
+	.class_name = RecordClassName,
+	.xml_id = RecordXmlId,
+	.block = RecordBlock,
+	.property_keyword = RecordPropertyKeyword,
+	.url = RecordUrl,
+	.import = RecordImport,
+};
+
+}
+
+static std::vector<std::string>
+Parse(std::string_view src, bool block=false)
+{
+	CssRecorder recorder;
+	CssParser parser(block, recording_css_parser_handler, &recorder);
+	EXPECT_EQ(parser.Feed(src.data(), src.size()), src.size());
+	return std::move(recorder.events);
+}
+
+TEST(CssParser, Basic)
+{
+	const std::vector<std::string> expected{
+		"class 1 4 foo",
+		"id 6 9 bar",
+		"block",
+		"property 12 26 display=none",
+		"url 44 49 a.png",
+	};
+
+	EXPECT_EQ(Parse(".foo #bar { display: none; background: url('a.png') }"),
+		  expected);
+}
+
+TEST(CssParser, LongName)
+{
+	/* names are truncated, but the positions are not */
+	const std::string name(1000, 'n');
+	const auto events = Parse("." + name + "{}");
+	ASSERT_EQ(events.size(), 2U);
+	EXPECT_EQ(events.front(), "class 1 1001 " + name.substr(0, 63));
+}
+
+TEST(CssParser, Import)
+{
+	const std::vector<std::string> expected{
+		"import 9 14 a.css",
+	};
+
+	EXPECT_EQ(Parse("@import \"a.css\";"), expected);
+}
+
+/**
+ * A closing brace in a "style" attribute used to make the parser
+ * loop forever.
+ */
+TEST(CssParser, BlockBrace)
+{
+	EXPECT_TRUE(Parse("a: }", true).empty());
+	EXPECT_TRUE(Parse("a: url( }", true).empty());
+}
+
+/**
+ * Compare the vectorized scanners with a trivial implementation for
+ * all byte values at all positions within a 16 byte block.
+ */
+TEST(CssParser, Scan)
+{
+	char buffer[48];
+
+	for (unsigned ch = 0; ch < 256; ++ch) {
+		for (std::size_t i = 0; i < sizeof(buffer); ++i) {
+			std::fill_n(buffer, sizeof(buffer), 'a');
+			buffer[i] = (char)ch;
+
+			const char *const begin = buffer;
+			const char *const end = buffer + sizeof(buffer);
+
+			EXPECT_EQ(FindNonCssNmchar(begin, end),
+				  std::find_if_not(begin, end,
+						   is_css_nmchar));
+
+			EXPECT_EQ(FindCssSelectorSpecial(begin, end),
+				  std::find_if(begin, end, [](char c){
+					  return c == '{' || c == '.' ||
+						  c == '#' || c == '@';
+				  }));
+
+			EXPECT_EQ(FindCssValueSpecial(begin, end),
+				  std::find_if(begin, end, [](char c){
+					  return c == '}' || c == ';' ||
+						  c == '\'' || c == '"';
+				  }));
+		}
+	}
+}
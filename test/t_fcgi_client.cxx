@@ -4,6 +4,8 @@
 
 #include "t_client.hxx"
 #include "fcgi/Client.hxx"
+#include "fcgi/MConnection.hxx"
+#include "fcgi/Error.hxx"
 #include "system/SetupProcess.hxx"
 #include "io/Pipe.hxx"
 #include "io/UniqueFileDescriptor.hxx"
@@ -21,8 +23,11 @@
 
 #include <gtest/gtest-param-test.h>
 
+#include <deque>
 #include <functional>
+#include <optional>
 #include <thread>
+#include <vector>
 
 using std::string_view_literals::operator""sv;
 
@@ -219,6 +224,31 @@ fcgi_server_nop(struct pool &pool, FcgiServer &server)
 	server.DiscardRequestBody(request);
 }
 
+using FcgiServerFunction = std::function<void(struct pool &pool, FcgiServer &server)>;
+
+/**
+ * Run the given function in a new thread which serves the FastCGI
+ * protocol on the given socket.
+ */
+static std::thread
+StartFcgiServer(UniqueSocketDescriptor &&socket, FcgiServerFunction function)
+{
+	return std::thread{[](UniqueSocketDescriptor s, FcgiServerFunction f){
+		auto pool = pool_new_libc(nullptr, "f");
+		FcgiServer server{std::move(s)};
+
+		try {
+			f(*pool, server);
+			server.FlushOutput();
+		} catch (...) {
+			PrintException(std::current_exception());
+		}
+
+		server.Shutdown();
+		pool.reset();
+	}, std::move(socket), std::move(function)};
+}
+
 class FcgiClientConnection final : public ClientConnection {
 	EventLoop &event_loop;
 	std::thread thread;
@@ -287,7 +317,7 @@ struct FcgiClientFactory {
 		}
 	}
 
-	using ServerFunction = std::function<void(struct pool &pool, FcgiServer &server)>;
+	using ServerFunction = FcgiServerFunction;
 
 	static FcgiClientConnection *New(EventLoop &event_loop, ServerFunction function);
 
@@ -435,21 +465,8 @@ FcgiClientFactory::New(EventLoop &event_loop, ServerFunction _function)
 {
 	auto [server_socket, client_socket] = CreateStreamSocketPair();
 
-	// not using std::thread because libc++ still doesn't have it in 2023
-	std::thread thread{[](UniqueSocketDescriptor s, ServerFunction function){
-		auto pool = pool_new_libc(nullptr, "f");
-		FcgiServer server{std::move(s)};
-
-		try {
-			function(*pool, server);
-			server.FlushOutput();
-		} catch (...) {
-			PrintException(std::current_exception());
-		}
-
-		server.Shutdown();
-		pool.reset();
-	}, std::move(server_socket), std::move(_function)};
+	auto thread = StartFcgiServer(std::move(server_socket),
+				      std::move(_function));
 
 	client_socket.SetNonBlocking();
 	return new FcgiClientConnection(event_loop, std::move(thread),
@@ -694,3 +711,411 @@ TEST_P(FcgiClientB, BlockingStderr)
 INSTANTIATE_TEST_SUITE_P(FcgiClient,
                          FcgiClientB,
                          testing::Values(false, true));
+
+/*
+ * FcgiMultiplexConnection
+ *
+ */
+
+namespace {
+
+/**
+ * Owns a #FcgiMultiplexConnection.  Each new socket is served by a
+ * new #FcgiServer thread which runs the next function from the
+ * list.
+ */
+class FcgiMultiplexFixture final : FcgiMultiplexConnectionHandler {
+	EventLoop &event_loop;
+
+	std::deque<FcgiServerFunction> servers;
+	std::vector<std::thread> threads;
+
+public:
+	std::optional<FcgiMultiplexConnection> connection;
+
+	std::optional<bool> probe_result;
+
+	unsigned n_errors = 0;
+
+	FcgiMultiplexFixture(EventLoop &_event_loop,
+			     std::initializer_list<FcgiServerFunction> _servers) noexcept
+		:event_loop(_event_loop), servers(_servers)
+	{
+		connection.emplace(event_loop, *this);
+	}
+
+	~FcgiMultiplexFixture() noexcept {
+		/* closing the socket lets the server threads exit */
+		connection.reset();
+
+		for (auto &i : threads)
+			i.join();
+	}
+
+	/**
+	 * Connect a new socket (also used for the classic client).
+	 */
+	UniqueSocketDescriptor Connect() {
+		assert(!servers.empty());
+
+		auto [server_socket, client_socket] = CreateStreamSocketPair();
+		threads.emplace_back(StartFcgiServer(std::move(server_socket),
+						     std::move(servers.front())));
+		servers.pop_front();
+
+		client_socket.SetNonBlocking();
+		return std::move(client_socket);
+	}
+
+	bool Probe() {
+		connection->Probe();
+
+		if (!probe_result)
+			event_loop.Run();
+
+		assert(probe_result);
+		return *probe_result;
+	}
+
+private:
+	/* virtual methods from class FcgiMultiplexConnectionHandler */
+	UniqueSocketDescriptor OnFcgiMultiplexConnect() override {
+		return Connect();
+	}
+
+	void OnFcgiMultiplexProbe(bool supported) noexcept override {
+		probe_result = supported;
+		event_loop.Break();
+	}
+
+	void OnFcgiMultiplexError(std::exception_ptr) noexcept override {
+		++n_errors;
+	}
+};
+
+/**
+ * A request on the shared #FcgiMultiplexConnection.  Like
+ * #FcgiClientConnection, it is deleted by Context::ReleaseLease().
+ */
+class FcgiMultiplexSlot final : public ClientConnection {
+	FcgiMultiplexConnection &connection;
+
+public:
+	explicit FcgiMultiplexSlot(FcgiMultiplexConnection &_connection) noexcept
+		:connection(_connection) {}
+
+	void Request(struct pool &pool,
+		     Lease &lease,
+		     HttpMethod method, const char *uri,
+		     StringMap &&headers, UnusedIstreamPtr body,
+		     [[maybe_unused]] bool expect_100,
+		     HttpResponseHandler &handler,
+		     CancellablePointer &cancel_ptr) noexcept override {
+		connection.SendRequest(pool, nullptr, lease,
+				       method, uri, uri, nullptr, nullptr,
+				       nullptr, nullptr, "192.168.1.100",
+				       headers, std::move(body),
+				       {},
+				       UniqueFileDescriptor{},
+				       handler, cancel_ptr);
+	}
+
+	void InjectSocketFailure() noexcept override {}
+};
+
+} // anonymous namespace
+
+static void
+SendMultiplexRequest(Context &c, FcgiMultiplexFixture &f) noexcept
+{
+	c.connection = new FcgiMultiplexSlot(*f.connection);
+	c.connection->Request(c.pool, c,
+			      HttpMethod::GET, "/foo", {},
+			      nullptr,
+			      false,
+			      c, c.cancel_ptr);
+}
+
+static void
+fcgi_server_probe_supported(struct pool &, FcgiServer &server)
+{
+	server.ReadGetValues();
+	server.WriteGetValuesResult("FCGI_MPXS_CONNS"sv, "1"sv);
+}
+
+TEST(FcgiMultiplex, Probe)
+{
+	Instance instance;
+	FcgiMultiplexFixture f{instance.event_loop, {fcgi_server_probe_supported}};
+
+	EXPECT_TRUE(f.Probe());
+	EXPECT_EQ(f.n_errors, 0U);
+}
+
+/**
+ * The application does not support multiplexing; the probe fails
+ * and requests are sent with the classic client on a new
+ * connection.
+ */
+static void
+TestProbeFallback(FcgiServerFunction probe_server)
+{
+	Instance instance;
+	FcgiMultiplexFixture f{instance.event_loop,
+			       {std::move(probe_server), fcgi_server_hello}};
+
+	EXPECT_FALSE(f.Probe());
+
+	Context c{instance};
+	c.connection = new FcgiClientConnection(c.event_loop, std::thread{},
+						f.Connect());
+	c.connection->Request(c.pool, c,
+			      HttpMethod::GET, "/foo", {},
+			      nullptr,
+			      false,
+			      c, c.cancel_ptr);
+
+	c.WaitForEnd();
+	c.WaitReleased();
+
+	EXPECT_FALSE(c.request_error);
+	EXPECT_FALSE(c.body_error);
+	EXPECT_EQ(c.status, HttpStatus::OK);
+	EXPECT_EQ(c.body_data, 5);
+	EXPECT_TRUE(c.body_eof);
+	EXPECT_EQ(c.lease_action, PutAction::REUSE);
+	EXPECT_EQ(f.n_errors, 0U);
+}
+
+TEST(FcgiMultiplex, ProbeUnsupported)
+{
+	TestProbeFallback([](struct pool &, FcgiServer &server){
+		server.ReadGetValues();
+		server.WriteGetValuesResult("FCGI_MPXS_CONNS"sv, "0"sv);
+	});
+}
+
+TEST(FcgiMultiplex, ProbeUnknownType)
+{
+	/* an application which doesn't know GET_VALUES */
+	TestProbeFallback([](struct pool &, FcgiServer &server){
+		server.ReadGetValues();
+		server.WriteHeader({
+			.version = FCGI_VERSION_1,
+			.type = FcgiRecordType::UNKNOWN_TYPE,
+			.request_id = 0,
+			.content_length = 8,
+		});
+
+		const std::byte body[8]{static_cast<std::byte>(FcgiRecordType::GET_VALUES)};
+		server.WriteFullRaw(body);
+	});
+}
+
+TEST(FcgiMultiplex, ProbeClosed)
+{
+	/* an application which closes the connection instead of
+	   answering */
+	TestProbeFallback([](struct pool &, FcgiServer &server){
+		server.ReadGetValues();
+	});
+}
+
+/**
+ * The STDOUT/STDERR records of two concurrent responses are
+ * interleaved; each one must be routed to its own request.
+ */
+TEST(FcgiMultiplex, Interleaved)
+{
+	Instance instance;
+	FcgiMultiplexFixture f{instance.event_loop, {[](struct pool &pool, FcgiServer &server){
+		const auto a = server.ReadRequest(pool);
+		server.DiscardRequestBody(a);
+		const auto b = server.ReadRequest(pool);
+		server.DiscardRequestBody(b);
+
+		if (a.id == b.id)
+			throw std::runtime_error{"Duplicate request id"};
+
+		server.WriteStdout(b, "content-length: 3\n\nb"sv);
+		server.WriteStdout(a, "content-length: 5\n"sv);
+		server.WriteStderr(b, "err\n"sv, 3);
+		server.WriteStdout(a, "\nhe"sv);
+		server.WriteStdout(b, "ar"sv, 5);
+		server.WriteStdout(a, "llo"sv);
+		server.EndResponse(b);
+		server.EndResponse(a);
+	}}};
+
+	Context a{instance}, b{instance};
+	SendMultiplexRequest(a, f);
+	SendMultiplexRequest(b, f);
+
+	a.WaitForEnd();
+	b.WaitForEnd();
+	a.WaitReleased();
+	b.WaitReleased();
+
+	EXPECT_FALSE(a.request_error);
+	EXPECT_FALSE(a.body_error);
+	EXPECT_EQ(a.status, HttpStatus::OK);
+	EXPECT_EQ(a.available, 5);
+	EXPECT_EQ(a.body_data, 5);
+	EXPECT_TRUE(a.body_eof);
+	EXPECT_EQ(a.lease_action, PutAction::REUSE);
+
+	EXPECT_FALSE(b.request_error);
+	EXPECT_FALSE(b.body_error);
+	EXPECT_EQ(b.status, HttpStatus::OK);
+	EXPECT_EQ(b.available, 3);
+	EXPECT_EQ(b.body_data, 3);
+	EXPECT_TRUE(b.body_eof);
+	EXPECT_EQ(b.lease_action, PutAction::REUSE);
+
+	EXPECT_EQ(f.n_errors, 0U);
+}
+
+/**
+ * The server side of the Abort and Cancel tests: the first request
+ * is aborted by the client; its late records must be discarded and
+ * its id must not be reused before its END_REQUEST.
+ */
+static void
+fcgi_server_abort(struct pool &pool, FcgiServer &server,
+		  bool send_headers)
+{
+	const auto a = server.ReadRequest(pool);
+	server.DiscardRequestBody(a);
+
+	if (send_headers) {
+		server.WriteStdout(a, "content-length: 10\n\nhello"sv);
+		server.FlushOutput();
+	}
+
+	if (server.ReadAbortRequest() != a.id)
+		throw std::runtime_error{"Wrong ABORT_REQUEST id"};
+
+	const auto b = server.ReadRequest(pool);
+	server.DiscardRequestBody(b);
+
+	if (b.id == a.id)
+		throw std::runtime_error{"Request id reused before END_REQUEST"};
+
+	if (!send_headers)
+		server.WriteStdout(a, "content-length: 10\n\nhello"sv);
+	server.WriteStdout(a, "world"sv);
+	server.WriteStdout(b, "content-length: 3\n\nbar"sv);
+	server.EndResponse(a);
+	server.EndResponse(b);
+}
+
+static void
+CheckAfterAbort(Instance &instance, FcgiMultiplexFixture &f) noexcept
+{
+	Context b{instance};
+	SendMultiplexRequest(b, f);
+
+	b.WaitForEnd();
+	b.WaitReleased();
+
+	EXPECT_FALSE(b.request_error);
+	EXPECT_FALSE(b.body_error);
+	EXPECT_EQ(b.status, HttpStatus::OK);
+	EXPECT_EQ(b.body_data, 3);
+	EXPECT_TRUE(b.body_eof);
+	EXPECT_EQ(b.lease_action, PutAction::REUSE);
+}
+
+/**
+ * Close the response body in the middle of the response.
+ */
+TEST(FcgiMultiplex, Abort)
+{
+	Instance instance;
+	FcgiMultiplexFixture f{instance.event_loop, {[](struct pool &pool, FcgiServer &server){
+		fcgi_server_abort(pool, server, true);
+	}}};
+
+	Context a{instance};
+	SendMultiplexRequest(a, f);
+
+	a.WaitForResponse();
+	a.WaitForFirstBodyByte();
+
+	EXPECT_EQ(a.status, HttpStatus::OK);
+	EXPECT_EQ(a.body_data, 5);
+	EXPECT_FALSE(a.released);
+
+	a.CloseInput();
+
+	/* the lease is released right away; the shared connection
+	   remains usable */
+	EXPECT_TRUE(a.released);
+	EXPECT_EQ(a.lease_action, PutAction::REUSE);
+
+	CheckAfterAbort(instance, f);
+	EXPECT_EQ(f.n_errors, 0U);
+}
+
+/**
+ * Cancel the request before the response headers arrive.
+ */
+TEST(FcgiMultiplex, Cancel)
+{
+	Instance instance;
+	FcgiMultiplexFixture f{instance.event_loop, {[](struct pool &pool, FcgiServer &server){
+		fcgi_server_abort(pool, server, false);
+	}}};
+
+	Context a{instance};
+	SendMultiplexRequest(a, f);
+
+	a.cancel_ptr.Cancel();
+
+	EXPECT_TRUE(a.released);
+	EXPECT_EQ(a.lease_action, PutAction::REUSE);
+
+	CheckAfterAbort(instance, f);
+	EXPECT_EQ(f.n_errors, 0U);
+}
+
+/**
+ * The application rejects requests with CANT_MPX_CONN and
+ * OVERLOADED; they fail with a REFUSED error, which lets
+ * #FcgiRequest retry them.
+ */
+TEST(FcgiMultiplex, Refused)
+{
+	Instance instance;
+	FcgiMultiplexFixture f{instance.event_loop, {[](struct pool &pool, FcgiServer &server){
+		const auto a = server.ReadRequest(pool);
+		server.DiscardRequestBody(a);
+		server.EndResponse(a, FcgiProtocolStatus::CANT_MPX_CONN);
+		server.FlushOutput();
+
+		const auto b = server.ReadRequest(pool);
+		server.DiscardRequestBody(b);
+		server.EndResponse(b, FcgiProtocolStatus::OVERLOADED);
+	}}};
+
+	for (unsigned i = 0; i < 2; ++i) {
+		Context c{instance};
+		SendMultiplexRequest(c, f);
+		c.WaitForResponse();
+
+		EXPECT_EQ(c.status, HttpStatus{});
+		ASSERT_TRUE(c.request_error);
+		EXPECT_TRUE(IsFcgiClientRetryFailure(c.request_error));
+
+		const auto *e = FindNested<FcgiClientError>(c.request_error);
+		ASSERT_NE(e, nullptr);
+		EXPECT_EQ(e->GetCode(), FcgiClientErrorCode::REFUSED);
+
+		EXPECT_TRUE(c.released);
+		EXPECT_EQ(c.lease_action, PutAction::DESTROY);
+
+		/* only CANT_MPX_CONN (the first request) disables
+		   multiplexing */
+		EXPECT_EQ(f.n_errors, 1U);
+	}
+}
@@ -8,6 +8,7 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
 #include <string_view>
 
 using std::string_view_literals::operator""sv;
@@ -56,3 +57,32 @@ TEST(HtmlEscape, Basic)
 	char d[] = "&amp;&&quot;";
 	ASSERT_EQ(html_unescape_inplace(d, sizeof(d) - 1), "&&\""sv);
 }
+
+TEST(HtmlEscape, Escape)
+{
+	ASSERT_STREQ(escape_static(&html_escape_class, "foo bar"), "foo bar");
+	ASSERT_STREQ(escape_static(&html_escape_class, "<a href=\"x\">&'"),
+		     "&lt;a href=&quot;x&quot;&gt;&amp;&apos;");
+
+	/* each special character at each position of a 16 byte
+	   block, to check the vectorized scanner */
+	for (const char ch : "&\"'<>"sv) {
+		for (std::size_t i = 0; i < 48; ++i) {
+			std::string s(48, 'x');
+			s[i] = ch;
+
+			const auto entity = escape_char(&html_escape_class, ch);
+			const std::string expected = s.substr(0, i) +
+				std::string{entity} + s.substr(i + 1);
+
+			ASSERT_EQ(escape_find(&html_escape_class, s), s.data() + i);
+			ASSERT_EQ(escape_size(&html_escape_class, s),
+				  expected.size());
+			ASSERT_STREQ(escape_static(&html_escape_class, s),
+				     expected.c_str());
+		}
+	}
+
+	ASSERT_EQ(escape_find(&html_escape_class, std::string(100, 'x')),
+		  nullptr);
+}
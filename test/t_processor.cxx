@@ -5,6 +5,7 @@
 #include "TestInstance.hxx"
 #include "http/rl/FailingResourceLoader.hxx"
 #include "bp/XmlProcessor.hxx"
+#include "bp/XmlTemplateCache.hxx"
 #include "bp/WidgetLookupProcessor.hxx"
 #include "widget/Inline.hxx"
 #include "widget/Widget.hxx"
@@ -15,6 +16,10 @@
 #include "istream/istream.hxx"
 #include "istream/BlockIstream.hxx"
 #include "istream/istream_string.hxx"
+#include "istream/FourIstream.hxx"
+#include "istream/ForwardIstream.hxx"
+#include "istream/New.hxx"
+#include "istream/StringSink.hxx"
 #include "pool/pool.hxx"
 #include "pool/SharedPtr.hxx"
 #include "util/Cancellable.hxx"
@@ -90,6 +95,122 @@ public:
 	}
 };
 
+/*
+ * KnownLengthIstream
+ *
+ */
+
+/**
+ * Announces the total length of the input even though the input
+ * (e.g. #FourIstream) hides it; the #XmlTemplateCache is only used
+ * for documents with a known length.
+ */
+class KnownLengthIstream final : public ForwardIstream {
+	off_t remaining;
+
+public:
+	KnownLengthIstream(struct pool &p, UnusedIstreamPtr _input,
+			   off_t _length) noexcept
+		:ForwardIstream(p, std::move(_input)), remaining(_length) {}
+
+	/* virtual methods from class Istream */
+
+	off_t _GetAvailable(bool partial) noexcept override {
+		return partial
+			? ForwardIstream::_GetAvailable(partial)
+			: remaining;
+	}
+
+	off_t _Skip(off_t) noexcept override {
+		return -1;
+	}
+
+	/* virtual methods from class IstreamHandler */
+
+	std::size_t OnData(std::span<const std::byte> src) noexcept override {
+		const std::size_t nbytes = ForwardIstream::OnData(src);
+		remaining -= nbytes;
+		return nbytes;
+	}
+};
+
+/*
+ * StringSinkHandler
+ *
+ */
+
+class MyStringSinkHandler final : public StringSinkHandler {
+	EventLoop &event_loop;
+
+public:
+	std::string value;
+	bool finished = false;
+
+	explicit MyStringSinkHandler(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	/* virtual methods from class StringSinkHandler */
+	void OnStringSinkSuccess(std::string &&_value) noexcept override {
+		value = std::move(_value);
+		finished = true;
+		event_loop.Break();
+	}
+
+	void OnStringSinkError(std::exception_ptr ep) noexcept override {
+		PrintException(ep);
+		finished = true;
+		event_loop.Break();
+	}
+};
+
+static std::string
+Process(TestInstance &instance, XmlTemplateCache *template_cache,
+	const char *template_tag, const char *source, unsigned options)
+{
+	auto pool = pool_new_libc(instance.root_pool, "test");
+
+	FailingResourceLoader resource_loader;
+
+	auto ctx = SharedPoolPtr<WidgetContext>::Make
+		(*pool, instance.event_loop,
+		 resource_loader, resource_loader,
+		 nullptr,
+		 nullptr, nullptr,
+		 "localhost:8080",
+		 "localhost:8080",
+		 "/beng.html",
+		 "http://localhost:8080/beng.html",
+		 "/beng.html"sv,
+		 nullptr,
+		 nullptr, nullptr, SessionId{}, nullptr,
+		 nullptr);
+	auto &widget = ctx->AddRootWidget(MakeRootWidget(pool, nullptr));
+
+	/* feed the processor in small chunks to check how tags and
+	   CDATA spanning several chunks are replayed */
+	auto input = NewIstreamPtr<KnownLengthIstream>(*pool,
+						       istream_four_new(pool, istream_string_new(*pool, source)),
+						       strlen(source));
+
+	MyStringSinkHandler handler{instance.event_loop};
+	CancellablePointer cancel_ptr;
+	auto &sink = NewStringSink(*pool,
+				   processor_process(*pool, nullptr,
+						     std::move(input),
+						     widget, std::move(ctx),
+						     options,
+						     template_cache,
+						     template_tag),
+				   handler, cancel_ptr);
+	ReadStringSink(sink);
+
+	if (!handler.finished)
+		instance.event_loop.Run();
+
+	EXPECT_TRUE(handler.finished);
+	return std::move(handler.value);
+}
+
 /*
  * tests
  *
@@ -130,3 +251,134 @@ TEST(Processor, Abort)
 
 	pool.reset();
 }
+
+TEST(Processor, TemplateCache)
+{
+	static constexpr unsigned options = PROCESSOR_REWRITE_URL |
+		PROCESSOR_PREFIX_CSS_CLASS | PROCESSOR_PREFIX_XML_ID;
+	static constexpr const char *source =
+		"<?xml version=\"1.0\"?>\n"
+		"<html><body>\n"
+		"<p id=\"___a\" class=\"___b x\">hello world</p>\n"
+		"<a href=\"/foo\" c:base=\"widget\" name=\"__n\">link</a>\n"
+		"<!-- a comment -->\n"
+		"<script>var s = \"</div>\";</script>\n"
+		"<label for=\"___a\">label</label>\n"
+		"</body></html>\n";
+
+	TestInstance instance;
+	XmlTemplateCache cache(instance.event_loop, 1024 * 1024);
+
+	const auto expected = Process(instance, nullptr, nullptr,
+				      source, options);
+	EXPECT_NE(expected.find("id=\"C_a\" class=\"C_b x\""),
+		  expected.npos);
+	EXPECT_EQ(expected.find("c:base"), expected.npos);
+
+	/* the first run records the template */
+	EXPECT_EQ(Process(instance, &cache, "tag", source, options),
+		  expected);
+	EXPECT_EQ(cache.GetStats().misses, 1U);
+	EXPECT_EQ(cache.GetStats().stores, 1U);
+
+	/* the second run replays it */
+	EXPECT_EQ(Process(instance, &cache, "tag", source, options),
+		  expected);
+	EXPECT_EQ(cache.GetStats().hits, 1U);
+
+	/* different options need a different skeleton */
+	EXPECT_EQ(Process(instance, &cache, "tag", source, PROCESSOR_REWRITE_URL),
+		  Process(instance, nullptr, nullptr, source, PROCESSOR_REWRITE_URL));
+	EXPECT_EQ(cache.GetStats().misses, 2U);
+	EXPECT_EQ(cache.GetStats().hits, 1U);
+}
+
+TEST(Processor, TemplateCacheEntities)
+{
+	static constexpr const char *source =
+		"<p id=\"___a\">&c:path;</p>";
+
+	TestInstance instance;
+	XmlTemplateCache cache(instance.event_loop, 1024 * 1024);
+
+	const auto expected = Process(instance, nullptr, nullptr,
+				      source, PROCESSOR_PREFIX_XML_ID);
+
+	/* templates with entities are not cacheable, because the text
+	   processor shifts all offsets */
+	EXPECT_EQ(Process(instance, &cache, "tag", source,
+			  PROCESSOR_PREFIX_XML_ID),
+		  expected);
+	EXPECT_EQ(Process(instance, &cache, "tag", source,
+			  PROCESSOR_PREFIX_XML_ID),
+		  expected);
+	EXPECT_EQ(cache.GetStats().skips, 2U);
+	EXPECT_EQ(cache.GetStats().stores, 0U);
+	EXPECT_EQ(cache.GetStats().hits, 0U);
+}
+
+TEST(Processor, TemplateCacheModified)
+{
+	static constexpr unsigned options = PROCESSOR_PREFIX_XML_ID;
+	static constexpr const char *source1 =
+		"<p id=\"___a\">hello</p><p id=\"___b\">world</p>";
+	static constexpr const char *source2 =
+		"<p id=\"___a\">hello, world</p>";
+	static constexpr const char *source3 =
+		"<p><b id=\"___a\">hello</b>id=\"___b\">world</p>";
+	static constexpr const char *source4 =
+		"<p id=\"___a\">hello</p><p>&c:path;world!!</p>";
+
+	static_assert(std::string_view{source1}.size() ==
+		      std::string_view{source3}.size());
+	static_assert(std::string_view{source1}.size() ==
+		      std::string_view{source4}.size());
+
+	TestInstance instance;
+	XmlTemplateCache cache(instance.event_loop, 1024 * 1024);
+
+	EXPECT_EQ(Process(instance, &cache, "tag", source1, options),
+		  Process(instance, nullptr, nullptr, source1, options));
+	EXPECT_EQ(cache.GetStats().stores, 1U);
+
+	/* the document was modified without a new ETag; the length
+	   differs, so the template must not be replayed */
+	EXPECT_EQ(Process(instance, &cache, "tag", source2, options),
+		  Process(instance, nullptr, nullptr, source2, options));
+	EXPECT_EQ(cache.GetStats().hits, 0U);
+	EXPECT_EQ(cache.GetStats().misses, 2U);
+	EXPECT_EQ(cache.GetStats().stores, 2U);
+
+	/* back to the first version: the item recorded from source2
+	   is not replayed, either */
+	Process(instance, &cache, "tag", source1, options);
+	EXPECT_EQ(cache.GetStats().hits, 0U);
+	EXPECT_EQ(cache.GetStats().stores, 3U);
+
+	/* same length, but different contents: this cannot be
+	   detected in advance, but the checksum is verified before
+	   anything is emitted, so the output is still correct, and
+	   the template is evicted */
+	EXPECT_EQ(Process(instance, &cache, "tag", source3, options),
+		  Process(instance, nullptr, nullptr, source3, options));
+	EXPECT_EQ(cache.GetStats().hits, 1U);
+
+	EXPECT_EQ(Process(instance, &cache, "tag", source1, options),
+		  Process(instance, nullptr, nullptr, source1, options));
+	EXPECT_EQ(cache.GetStats().hits, 1U);
+	EXPECT_EQ(cache.GetStats().stores, 4U);
+
+	/* same length again, but with an entity which must be
+	   expanded */
+	EXPECT_EQ(Process(instance, &cache, "tag", source4, options),
+		  Process(instance, nullptr, nullptr, source4, options));
+	EXPECT_EQ(cache.GetStats().hits, 2U);
+
+	/* the replay itself still works */
+	EXPECT_EQ(Process(instance, &cache, "tag", source1, options),
+		  Process(instance, nullptr, nullptr, source1, options));
+	EXPECT_EQ(cache.GetStats().stores, 5U);
+	EXPECT_EQ(Process(instance, &cache, "tag", source1, options),
+		  Process(instance, nullptr, nullptr, source1, options));
+	EXPECT_EQ(cache.GetStats().hits, 3U);
+}
@@ -35,3 +35,96 @@ TEST(SessionTest, Basic)
 	widget = realm->GetWidget("a_widget_name", true);
 	ASSERT_NE(widget, nullptr);
 }
+
+TEST(SessionTest, WidgetSessionSet)
+{
+	WidgetSession::Set set;
+
+	ASSERT_EQ(WidgetSession::Find(set, "a"), nullptr);
+
+	WidgetSession::Make(set, "c").path_info = "/c";
+	WidgetSession::Make(set, "a").path_info = "/a";
+	WidgetSession::Make(set, "b").path_info = "/b";
+	ASSERT_EQ(set.size(), 3U);
+
+	/* no duplicate */
+	ASSERT_STREQ(WidgetSession::Make(set, "b").path_info.c_str(), "/b");
+	ASSERT_EQ(set.size(), 3U);
+
+	/* sorted */
+	ASSERT_STREQ(set[0].id.c_str(), "a");
+	ASSERT_STREQ(set[1].id.c_str(), "b");
+	ASSERT_STREQ(set[2].id.c_str(), "c");
+
+	auto *c = WidgetSession::Find(set, "c");
+	ASSERT_NE(c, nullptr);
+	ASSERT_STREQ(c->path_info.c_str(), "/c");
+
+	ASSERT_TRUE(WidgetSession::Erase(set, "b"));
+	ASSERT_FALSE(WidgetSession::Erase(set, "b"));
+	ASSERT_EQ(WidgetSession::Find(set, "b"), nullptr);
+	ASSERT_EQ(set.size(), 2U);
+}
+
+TEST(SessionTest, Realms)
+{
+	EventLoop event_loop;
+
+	SessionManager session_manager(event_loop, std::chrono::minutes(30),
+				       0, 0);
+
+	auto session = session_manager.CreateSession();
+	ASSERT_TRUE(session);
+
+	auto *a = session->GetRealm("a");
+	ASSERT_NE(a, nullptr);
+	ASSERT_EQ(&a->parent, session.get());
+	ASSERT_EQ(session->FindRealm("b"), nullptr);
+
+	/* creating another realm must not move the existing one */
+	auto *b = session->GetRealm("b");
+	ASSERT_NE(b, a);
+	ASSERT_EQ(session->GetRealm("a"), a);
+	ASSERT_EQ(session->FindRealm("b"), b);
+
+	ASSERT_TRUE(session->DiscardRealm("a"));
+	ASSERT_FALSE(session->DiscardRealm("a"));
+	ASSERT_EQ(session->FindRealm("a"), nullptr);
+	ASSERT_EQ(session->FindRealm("b"), b);
+}
+
+TEST(SessionTest, Attach)
+{
+	EventLoop event_loop;
+
+	SessionManager session_manager(event_loop, std::chrono::minutes(30),
+				       0, 0);
+
+	auto session1 = session_manager.CreateSession();
+	auto session2 = session_manager.CreateSession();
+
+	auto *realm1 = session1->GetRealm("shared");
+	realm1->GetWidget("w", true)->GetChild("x", true)->path_info = "/x1";
+
+	auto *realm2 = session2->GetRealm("shared");
+	realm2->SetUser("foo", std::chrono::hours(1));
+	realm2->GetWidget("w", true)->GetChild("y", true)->path_info = "/y2";
+	session2->GetRealm("other")->SetSite("other");
+
+	session1->Attach(std::move(*session2));
+
+	ASSERT_EQ(session1->FindRealm("shared"), realm1);
+	ASSERT_STREQ(realm1->user.c_str(), "foo");
+
+	auto *w = realm1->GetWidget("w", false);
+	ASSERT_NE(w, nullptr);
+	ASSERT_EQ(w->children.size(), 2U);
+	ASSERT_STREQ(w->GetChild("x", false)->path_info.c_str(), "/x1");
+	ASSERT_STREQ(w->GetChild("y", false)->path_info.c_str(), "/y2");
+
+	auto *other = session1->FindRealm("other");
+	ASSERT_NE(other, nullptr);
+	ASSERT_EQ(&other->parent, session1.get());
+	ASSERT_STREQ(other->site.c_str(), "other");
+	ASSERT_TRUE(session2->realms.empty());
+}
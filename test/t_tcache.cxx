@@ -12,6 +12,9 @@
 #include "translation/Response.hxx"
 #include "translation/Transformation.hxx"
 #include "translation/Protocol.hxx"
+#include "translation/Marshal.hxx"
+#include "translation/Snapshot.hxx"
+#include "translation/Extension.hxx"
 #include "widget/View.hxx"
 #include "http/Status.hxx"
 #include "http/Address.hxx"
@@ -21,13 +24,17 @@
 #include "spawn/Mount.hxx"
 #include "spawn/NamespaceOptions.hxx"
 #include "pool/pool.hxx"
+#include "memory/GrowingBuffer.hxx"
 #include "PInstance.hxx"
 #include "util/Cancellable.hxx"
+#include "util/SpanCast.hxx"
 #include "util/StringAPI.hxx"
 #include "stopwatch.hxx"
 
 #include <gtest/gtest.h>
 
+#include <vector>
+
 using std::string_view_literals::operator""sv;
 
 class MyTranslationService final : public TranslationService {
@@ -50,6 +57,20 @@ struct Instance : PInstance {
 
 const TranslateResponse *next_response;
 
+/**
+ * The raw response packets passed to handlers which want them (see
+ * TranslateHandler::WantTranslateRawResponse()).
+ */
+std::span<const std::byte> next_raw_response;
+
+/**
+ * Submit this extension packet (see Extension.hxx) this many times
+ * before the response.
+ */
+TranslationCommand next_extension_command;
+std::span<const std::byte> next_extension_payload;
+unsigned next_extension_count;
+
 void
 MyTranslationService::SendRequest(AllocatorPtr alloc,
 				  const TranslateRequest &,
@@ -60,6 +81,12 @@ MyTranslationService::SendRequest(AllocatorPtr alloc,
 	if (next_response != nullptr) {
 		auto response = UniquePoolPtr<TranslateResponse>::Make(alloc.GetPool());
 		response->FullCopyFrom(alloc, *next_response);
+		for (unsigned i = 0; i < next_extension_count; ++i)
+			handler.OnTranslateExtension(next_extension_command,
+						     next_extension_payload);
+		if (next_raw_response.data() != nullptr &&
+		    handler.WantTranslateRawResponse())
+			handler.OnTranslateRawResponse(next_raw_response);
 		handler.OnTranslateResponse(std::move(response));
 	} else
 		handler.OnTranslateError(std::make_exception_ptr(std::runtime_error("Error")));
@@ -1177,3 +1204,225 @@ TEST(TranslationCache, ExpandBindMount)
 		    .BindMount("/home/bar", "/mnt")
 		    .BindMount("/etc", "/etc")));
 }
+
+static std::vector<std::byte>
+ToVector(GrowingBuffer &&buffer) noexcept
+{
+	std::vector<std::byte> result;
+	buffer.ForEachBuffer([&result](std::span<const std::byte> b){
+		result.insert(result.end(), b.begin(), b.end());
+	});
+	return result;
+}
+
+/**
+ * Build the raw packets of a response with a (relative) BASE and a
+ * PATH.
+ */
+static std::vector<std::byte>
+MakeRawResponse(const char *base, const char *path)
+{
+	TranslationMarshaller m;
+	m.WriteT(TranslationCommand::BEGIN, TRANSLATION_PROTOCOL_VERSION);
+	m.WriteOptional(TranslationCommand::BASE, base);
+	m.Write(TranslationCommand::PATH, path);
+	m.Write(TranslationCommand::END);
+	return ToVector(m.Commit());
+}
+
+/**
+ * Serialize the cache into a snapshot file with one server section.
+ */
+static std::vector<std::byte>
+SaveSnapshot(const TranslationCache &cache, std::size_t &n_items)
+{
+	TranslationMarshaller m;
+	TranslationSnapshotWriteHeader(m);
+	TranslationSnapshotWriteServer(m, AsBytes("server"sv));
+
+	GrowingBuffer buffer = m.Commit();
+	n_items = cache.SaveSnapshot(buffer);
+	return ToVector(std::move(buffer));
+}
+
+/**
+ * Parse all items of a snapshot file.
+ */
+static std::vector<TranslationSnapshotItem>
+ReadSnapshot(struct pool &pool, std::span<const std::byte> src)
+{
+	TranslationSnapshotReader reader{src};
+	std::vector<TranslationSnapshotItem> items;
+
+	while (true) {
+		std::span<const std::byte> server;
+		TranslationSnapshotItem item;
+
+		switch (reader.Next(pool, server, item)) {
+		case TranslationSnapshotReader::Result::END:
+			return items;
+
+		case TranslationSnapshotReader::Result::SERVER:
+			EXPECT_EQ(ToStringView(server), "server"sv);
+			break;
+
+		case TranslationSnapshotReader::Result::ITEM:
+			items.push_back(item);
+			break;
+		}
+	}
+}
+
+TEST(TranslationCache, SnapshotFormat)
+{
+	Instance instance;
+	struct pool &pool = instance.root_pool;
+
+	TranslationSnapshotItem item{
+		.key = "/foo",
+		.expires = std::chrono::system_clock::from_time_t(1700000000),
+		.request = {},
+		.response = AsBytes("raw"sv),
+	};
+
+	item.request.uri = "/foo";
+	item.request.host = "example.com";
+	item.request.query_string = "a=b";
+	item.request.session = AsBytes("session"sv);
+
+	TranslationMarshaller m;
+	TranslationSnapshotWriteHeader(m);
+	TranslationSnapshotWriteServer(m, AsBytes("server"sv));
+	TranslationSnapshotWriteItem(m, item);
+	const auto data = ToVector(m.Commit());
+
+	const auto items = ReadSnapshot(pool, data);
+	ASSERT_EQ(items.size(), 1U);
+
+	const auto &i = items.front();
+	EXPECT_STREQ(i.key, "/foo");
+	EXPECT_EQ(i.expires, item.expires);
+	EXPECT_STREQ(i.request.uri, "/foo");
+	EXPECT_STREQ(i.request.host, "example.com");
+	EXPECT_STREQ(i.request.query_string, "a=b");
+	EXPECT_EQ(ToStringView(i.request.session), "session"sv);
+	EXPECT_EQ(i.request.param, nullptr);
+	EXPECT_EQ(i.request.user_agent, nullptr);
+	EXPECT_EQ(i.request.realm_session.data(), nullptr);
+	EXPECT_EQ(ToStringView(i.response), "raw"sv);
+
+	/* truncated */
+	EXPECT_THROW(ReadSnapshot(pool, std::span{data}.first(data.size() - 1)),
+		     std::runtime_error);
+
+	/* not a snapshot */
+	EXPECT_THROW(ReadSnapshot(pool, AsBytes("garbage!"sv)),
+		     std::runtime_error);
+}
+
+TEST(TranslationCache, SnapshotRestore)
+{
+	Instance instance;
+	struct pool &pool = instance.root_pool;
+	auto &cache = instance.cache;
+	cache.EnableSnapshot();
+
+	const auto response = MakeResponse(pool).File("/var/www/index.html");
+	const auto raw = MakeRawResponse(nullptr, "/var/www/index.html");
+	next_raw_response = raw;
+	Feed(pool, cache, MakeRequest("/"), response);
+	next_raw_response = {};
+
+	std::size_t n_items;
+	const auto data = SaveSnapshot(cache, n_items);
+	EXPECT_EQ(n_items, 1U);
+
+	cache.Flush();
+	CachedError(pool, cache, MakeRequest("/"));
+
+	auto items = ReadSnapshot(pool, data);
+	ASSERT_EQ(items.size(), 1U);
+	auto &item = items.front();
+
+	/* an item which has expired while the process was not
+	   running is not restored */
+	const auto expires = item.expires;
+	item.expires = std::chrono::system_clock::now() - std::chrono::seconds{1};
+	EXPECT_FALSE(cache.RestoreSnapshotItem(item));
+	CachedError(pool, cache, MakeRequest("/"));
+
+	item.expires = expires;
+	EXPECT_TRUE(cache.RestoreSnapshotItem(item));
+	Cached(pool, cache, MakeRequest("/"), response);
+
+	/* the restored item is saved again */
+	SaveSnapshot(cache, n_items);
+	EXPECT_EQ(n_items, 1U);
+}
+
+/**
+ * A BASE item is restored under its BASE key, not under the key of
+ * the request which created it.
+ */
+TEST(TranslationCache, SnapshotBase)
+{
+	Instance instance;
+	struct pool &pool = instance.root_pool;
+	auto &cache = instance.cache;
+	cache.EnableSnapshot();
+
+	const auto raw = MakeRawResponse("/snap/", "/srv/snap/bar.html");
+	next_raw_response = raw;
+	Feed(pool, cache, MakeRequest("/snap/bar.html"),
+	     MakeResponse(pool).Base("/snap/")
+	     .File("bar.html", "/srv/snap/"));
+	next_raw_response = {};
+
+	std::size_t n_items;
+	const auto data = SaveSnapshot(cache, n_items);
+	EXPECT_EQ(n_items, 1U);
+
+	cache.Flush();
+
+	for (const auto &item : ReadSnapshot(pool, data))
+		EXPECT_TRUE(cache.RestoreSnapshotItem(item));
+
+	Cached(pool, cache, MakeRequest("/snap/index.html"),
+	       MakeResponse(pool).Base("/snap/")
+	       .File("index.html", "/srv/snap/"));
+
+	Cached(pool, cache, MakeRequest("/snap/bar.html"),
+	       MakeResponse(pool).Base("/snap/")
+	       .File("bar.html", "/srv/snap/"));
+
+	CachedError(pool, cache, MakeRequest("/other/index.html"));
+}
+
+/**
+ * A response whose extension packets don't fit into the cache item is
+ * not cached at all.
+ */
+TEST(TranslationCache, TooManyExtensions)
+{
+	Instance instance;
+	struct pool &pool = instance.root_pool;
+	auto &cache = instance.cache;
+
+	const std::vector<std::byte> payload(MAX_TRANSLATION_EXTENSION_PAYLOAD);
+	next_extension_command = TRANSLATE_WIDGET_FRAGMENT_CACHE;
+	next_extension_payload = payload;
+
+	next_extension_count = 1;
+	Feed(pool, cache, MakeRequest("/one"),
+	     MakeResponse(pool).File("/var/www/one.html"));
+
+	next_extension_count = 16;
+	Feed(pool, cache, MakeRequest("/many"),
+	     MakeResponse(pool).File("/var/www/many.html"));
+
+	next_extension_count = 0;
+
+	Cached(pool, cache, MakeRequest("/one"),
+	       MakeResponse(pool).File("/var/www/one.html"));
+	CachedError(pool, cache, MakeRequest("/many"));
+}
@@ -7,6 +7,8 @@
 #include "was/Client.hxx"
 #include "was/Server.hxx"
 #include "was/Lease.hxx"
+#include "was/IdleConnection.hxx"
+#include "was/Shm.hxx"
 #include "was/async/Socket.hxx"
 #include "lease.hxx"
 #include "istream/UnusedPtr.hxx"
@@ -14,7 +16,9 @@
 #include "event/FineTimerEvent.hxx"
 #include "strmap.hxx"
 
+#include <array>
 #include <functional>
+#include <memory>
 #include <optional>
 
 static void
@@ -273,6 +277,12 @@ class WasConnection final
 	WasSocket socket;
 	std::optional<Was::Control> control;
 
+	/**
+	 * The shared memory area offered to the server, or nullptr
+	 * if bodies are transferred through the pipes.
+	 */
+	std::unique_ptr<WasShm> shm;
+
 	WasServer *server = nullptr;
 
 	MalformedPrematureWasServer *server2 = nullptr;
@@ -288,25 +298,32 @@ class WasConnection final
 
 public:
 	WasConnection(struct pool &pool, EventLoop &_event_loop,
-		      Callback &&_callback)
+		      bool enable_shm, Callback &&_callback)
 		:event_loop(_event_loop),
 		 callback(std::move(_callback))
 	{
 		WasServerHandler &handler = *this;
 		server = NewFromPool<WasServer>(pool, pool, event_loop,
-						MakeWasSocket(),
+						MakeWasSocket(enable_shm),
 						handler);
+
+		if (shm)
+			WaitShmAccepted();
 	}
 
 	struct MalformedPremature{};
 
+	/**
+	 * This server ignores a shared memory offer, which means the
+	 * client falls back to the pipes.
+	 */
 	WasConnection(struct pool &pool, EventLoop &_event_loop,
-		      MalformedPremature)
+		      bool enable_shm, MalformedPremature)
 		:event_loop(_event_loop)
 	{
 		WasServerHandler &handler = *this;
 		server2 = NewFromPool<MalformedPrematureWasServer>(pool, event_loop,
-								   MakeWasSocket(),
+								   MakeWasSocket(enable_shm),
 								   handler);
 	}
 
@@ -321,6 +338,10 @@ public:
 		return event_loop;
 	}
 
+	bool IsShmAccepted() const noexcept {
+		return shm && shm->IsAccepted();
+	}
+
 	void Request(struct pool &pool,
 		     Lease &_lease,
 		     HttpMethod method, const char *uri,
@@ -331,6 +352,7 @@ public:
 		lease = &_lease;
 		was_client_request(pool, nullptr,
 				   *control, socket.input, socket.output,
+				   shm.get(),
 				   *this,
 				   nullptr,
 				   method, uri, uri, nullptr, nullptr,
@@ -358,12 +380,20 @@ public:
 	}
 
 private:
-	WasSocket MakeWasSocket() {
+	WasSocket MakeWasSocket(bool enable_shm) {
 		auto s = WasSocket::CreatePair();
 
 		socket = std::move(s.first);
 		socket.input.SetNonBlocking();
 		socket.output.SetNonBlocking();
+
+		if (enable_shm) {
+			/* the offer must be in the socket buffer before
+			   the server is constructed */
+			shm = WasShm::Create();
+			shm->SendOffer(socket.control);
+		}
+
 		control.emplace(event_loop, socket.control, static_cast<Was::ControlHandler &>(*this));
 
 		s.second.input.SetNonBlocking();
@@ -371,6 +401,15 @@ private:
 		return std::move(s.second);
 	}
 
+	/**
+	 * Wait for the ACCEPT packet, so even the first request body
+	 * is sent through the ring.
+	 */
+	void WaitShmAccepted() noexcept {
+		while (!shm->IsAccepted())
+			event_loop.Run();
+	}
+
 	void OnCloseTimer() noexcept {
 		if (server != nullptr)
 			std::exchange(server, nullptr)->Free();
@@ -388,8 +427,14 @@ private:
 	}
 
 	/* virtual methods from class WasControlHandler */
-	bool OnWasControlPacket(enum was_command,
-				std::span<const std::byte>) noexcept override {
+	bool OnWasControlPacket(enum was_command cmd,
+				std::span<const std::byte> payload) noexcept override {
+		if (cmd == WAS_COMMAND_NOP && shm &&
+		    WasShmParsePacket(payload) == WasShmPacket::ACCEPT) {
+			shm->SetAccepted();
+			event_loop.Break();
+		}
+
 		return true;
 	}
 	bool OnWasControlDrained() noexcept override {
@@ -400,7 +445,12 @@ private:
 	void OnWasControlError(std::exception_ptr) noexcept override {}
 };
 
-struct WasFactory {
+/**
+ * @param enable_shm transfer the bodies through a #WasShm instead of
+ * the pipes
+ */
+template<bool enable_shm>
+struct BasicWasFactory {
 	static constexpr ClientTestOptions options{
 		.have_chunked_request_body = true,
 		.can_cancel_request_body = true,
@@ -409,54 +459,54 @@ struct WasFactory {
 		.no_early_release_socket = true, // TODO: improve the WAS client
 	};
 
-	explicit WasFactory(EventLoop &) noexcept {}
+	explicit BasicWasFactory(EventLoop &) noexcept {}
 
 	auto *NewMirror(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunMirror);
+		return new WasConnection(pool, event_loop, enable_shm, RunMirror);
 	}
 
 	auto *NewNull(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunNull);
+		return new WasConnection(pool, event_loop, enable_shm, RunNull);
 	}
 
 	auto *NewDummy(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunHello);
+		return new WasConnection(pool, event_loop, enable_shm, RunHello);
 	}
 
 	auto *NewFixed(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunHello);
+		return new WasConnection(pool, event_loop, enable_shm, RunHello);
 	}
 
 	auto *NewTiny(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunHello);
+		return new WasConnection(pool, event_loop, enable_shm, RunHello);
 	}
 
 	auto *NewHuge(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunHuge);
+		return new WasConnection(pool, event_loop, enable_shm, RunHuge);
 	}
 
 	auto *NewHold(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunHold);
+		return new WasConnection(pool, event_loop, enable_shm, RunHold);
 	}
 
 	auto *NewBlock(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunBlock);
+		return new WasConnection(pool, event_loop, enable_shm, RunBlock);
 	}
 
 	auto *NewNop(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunNop);
+		return new WasConnection(pool, event_loop, enable_shm, RunNop);
 	}
 
 	auto *NewMalformedHeaderName(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunMalformedHeaderName);
+		return new WasConnection(pool, event_loop, enable_shm, RunMalformedHeaderName);
 	}
 
 	auto *NewMalformedHeaderValue(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunMalformedHeaderValue);
+		return new WasConnection(pool, event_loop, enable_shm, RunMalformedHeaderValue);
 	}
 
 	auto *NewValidPremature(struct pool &pool, EventLoop &event_loop) {
-		return new WasConnection(pool, event_loop, RunValidPremature);
+		return new WasConnection(pool, event_loop, enable_shm, RunValidPremature);
 	}
 
 	auto *NewMalformedPremature(struct pool &pool, EventLoop &event_loop) {
@@ -465,7 +515,11 @@ struct WasFactory {
 	}
 };
 
+using WasFactory = BasicWasFactory<false>;
+using WasShmFactory = BasicWasFactory<true>;
+
 INSTANTIATE_TYPED_TEST_SUITE_P(WasClient, ClientTest, WasFactory);
+INSTANTIATE_TYPED_TEST_SUITE_P(WasShmClient, ClientTest, WasShmFactory);
 
 TEST(WasClient, MalformedHeaderName)
 {
@@ -508,3 +562,156 @@ TEST(WasClient, MalformedHeaderValue)
 	EXPECT_TRUE(c.request_error);
 	EXPECT_TRUE(c.released);
 }
+
+/**
+ * A request body which is larger than the ring, i.e. the
+ * #WasOutput has to wait for the server to make room.
+ */
+TEST(WasShmClient, LargeBody)
+{
+	static constexpr off_t size = 4 * 1024 * 1024;
+
+	Instance instance;
+	WasShmFactory factory{instance.event_loop};
+	Context c{instance};
+
+	auto *connection = factory.NewMirror(*c.pool, c.event_loop);
+	c.connection = connection;
+	ASSERT_TRUE(connection->IsShmAccepted());
+
+	c.connection->Request(c.pool, c,
+			      HttpMethod::POST, "/foo", {},
+			      istream_head_new(*c.pool,
+					       istream_zero_new(*c.pool),
+					       size, true),
+			      false,
+			      c, c.cancel_ptr);
+
+	c.WaitForEnd();
+	c.WaitReleased();
+
+	EXPECT_EQ(c.status, HttpStatus::OK);
+	EXPECT_FALSE(c.request_error);
+	EXPECT_EQ(c.available, size);
+	EXPECT_TRUE(c.body_eof);
+	EXPECT_EQ(c.body_data, size);
+	EXPECT_EQ(c.body_error, nullptr);
+	EXPECT_EQ(c.lease_action, PutAction::REUSE);
+}
+
+namespace {
+
+class NullControlHandler final : public Was::ControlHandler {
+public:
+	/* virtual methods from class Was::ControlHandler */
+	bool OnWasControlPacket(enum was_command,
+				std::span<const std::byte>) noexcept override {
+		return true;
+	}
+
+	bool OnWasControlDrained() noexcept override {
+		return true;
+	}
+
+	void OnWasControlDone() noexcept override {}
+	void OnWasControlHangup() noexcept override {}
+	void OnWasControlError(std::exception_ptr) noexcept override {}
+};
+
+/**
+ * A #WasIdleConnection which has sent STOP while the response body
+ * was being transferred through the ring.
+ */
+struct IdleShmContext final : WasIdleConnectionHandler {
+	Instance instance;
+
+	std::unique_ptr<WasShm> server_shm;
+	WasSocket server_socket;
+	NullControlHandler server_control_handler;
+	std::optional<Was::Control> server_control;
+
+	WasShmChannel *input;
+	std::optional<WasIdleConnection> idle;
+
+	bool clean = false;
+	std::exception_ptr error;
+
+	IdleShmContext() {
+		auto s = WasSocket::CreatePair();
+
+		auto shm = WasShm::Create();
+		shm->SendOffer(s.first.control);
+
+		server_shm = WasShm::ReceiveOffer(s.second.control);
+		server_socket = std::move(s.second);
+		server_control.emplace(instance.event_loop,
+				       server_socket.control,
+				       server_control_handler);
+
+		input = &shm->GetInput();
+		idle.emplace(instance.event_loop, std::move(s.first),
+			     std::move(shm), *this);
+	}
+
+	/**
+	 * The server has appended #sent bytes to the ring, the client
+	 * has consumed #received bytes of them and has sent STOP;
+	 * now the server replies with PREMATURE.
+	 */
+	void Run(std::size_t sent, std::size_t received,
+		 uint64_t premature) noexcept {
+		input->SetActive(true);
+
+		std::array<std::byte, 4096> buffer{};
+		ASSERT_LE(sent, buffer.size());
+		EXPECT_EQ(server_shm->GetOutput().Write(std::span{buffer}.first(sent)),
+			  sent);
+
+		input->Consume(received);
+		idle->Stop(received);
+
+		server_control->SendUint64(WAS_COMMAND_PREMATURE, premature);
+		instance.event_loop.Run();
+	}
+
+	/* virtual methods from class WasIdleConnectionHandler */
+	void OnWasIdleConnectionClean() noexcept override {
+		clean = true;
+		instance.event_loop.Break();
+	}
+
+	void OnWasIdleConnectionError(std::exception_ptr e) noexcept override {
+		error = std::move(e);
+		instance.event_loop.Break();
+	}
+};
+
+} // anonymous namespace
+
+TEST(WasShmClient, IdleDiscard)
+{
+	IdleShmContext c;
+	ASSERT_TRUE(c.server_shm);
+
+	c.Run(1000, 200, 1000);
+
+	EXPECT_TRUE(c.clean);
+	EXPECT_FALSE(c.error);
+	EXPECT_FALSE(c.idle->IsStopping());
+	EXPECT_FALSE(c.input->IsActive());
+	EXPECT_EQ(c.input->GetRing().GetAvailable(), 0U);
+}
+
+/**
+ * The PREMATURE packet claims more data than the ring contains.
+ */
+TEST(WasShmClient, IdleDiscardBogus)
+{
+	IdleShmContext c;
+	ASSERT_TRUE(c.server_shm);
+
+	c.Run(1000, 200, 2000);
+
+	EXPECT_FALSE(c.clean);
+	EXPECT_TRUE(c.error);
+}
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "TestPool.hxx"
+#include "parser/XmlParser.hxx"
+#include "parser/HtmlScan.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using std::string_view_literals::operator""sv;
+using std::string_literals::operator""s;
+
+namespace {
+
+static const char *
+ToString(XmlParserTagType type) noexcept
+{
+	switch (type) {
+	case XmlParserTagType::OPEN:
+		return "OPEN";
+
+	case XmlParserTagType::CLOSE:
+		return "CLOSE";
+
+	case XmlParserTagType::SHORT:
+		return "SHORT";
+
+	case XmlParserTagType::PI:
+		return "PI";
+	}
+
+	return "?";
+}
+
+/**
+ * Records all parser callbacks as strings.  Consecutive CDATA
+ * callbacks are merged, because their boundaries depend on how the
+ * input was split into chunks.
+ */
+class RecordingXmlParserHandler final : public XmlParserHandler {
+public:
+	std::vector<std::string> events;
+
+private:
+	bool last_cdata = false, last_escaped;
+
+	void Add(std::string &&s) noexcept {
+		events.emplace_back(std::move(s));
+		last_cdata = false;
+	}
+
+public:
+	/* virtual methods from class XmlParserHandler */
+	bool OnXmlTagStart(const XmlParserTag &tag) noexcept override {
+		Add("start "s + ToString(tag.type) + " " +
+		    std::to_string(tag.start) + " " + std::string{tag.name});
+
+		/* "b" elements are "boring", to check how the
+		   parser skips them */
+		return tag.name != "b"sv;
+	}
+
+	bool OnXmlTagFinished(const XmlParserTag &tag) noexcept override {
+		Add("finish "s + ToString(tag.type) + " " +
+		    std::to_string(tag.start) + " " +
+		    std::to_string(tag.end) + " " + std::string{tag.name});
+		return true;
+	}
+
+	void OnXmlAttributeFinished(const XmlParserAttribute &attr) noexcept override {
+		Add("attr "s + std::to_string(attr.name_start) + " " +
+		    std::to_string(attr.value_start) + " " +
+		    std::to_string(attr.value_end) + " " +
+		    std::to_string(attr.end) + " " +
+		    std::string{attr.name} + "=" + std::string{attr.value});
+	}
+
+	size_t OnXmlCdata(std::string_view text, bool escaped,
+			  off_t start) noexcept override {
+		if (last_cdata && escaped == last_escaped) {
+			events.back().append(text);
+		} else {
+			Add("cdata "s + std::to_string(start) +
+			    (escaped ? " e " : " r ") + std::string{text});
+			last_cdata = true;
+			last_escaped = escaped;
+		}
+
+		return text.size();
+	}
+};
+
+}
+
+static std::vector<std::string>
+Parse(std::string_view src, std::size_t chunk_size)
+{
+	TestPool pool;
+	RecordingXmlParserHandler handler;
+	XmlParser parser(pool, handler);
+
+	while (!src.empty()) {
+		const auto chunk = src.substr(0, chunk_size);
+		EXPECT_EQ(parser.Feed(chunk.data(), chunk.size()), chunk.size());
+		src.remove_prefix(chunk.size());
+	}
+
+	return std::move(handler.events);
+}
+
+/**
+ * Generate a pseudo-random document from a mix of well-formed and
+ * malformed snippets.
+ */
+static std::string
+GenerateDocument(unsigned seed, std::size_t n)
+{
+	static constexpr std::string_view snippets[] = {
+		"<p>", "</p>", "<div class=\"a b c\" id='x'>", "</DIV>",
+		"<img src=foo.png alt=\"\"/>", "<br/>", "<br />",
+		"<a href=\"/x?y=1&amp;z=2\" c:base=widget>", "</a>",
+		"<b>", "</b>", "<b x=\"<y>\">",
+		"<c:widget id=\"w1\" type=\"t\"/>",
+		"<!-- comment -->", "<!-- - -- --->", "<!DOCTYPE html>",
+		"<![CDATA[ x ] y ]] z ]]]>", "<?xml version=\"1.0\"?>",
+		"<script>if (a < b) x = \"</div>\";</script>",
+		"<input disabled value=unquoted>", "<x a b=c d>",
+		"text ", "more text\n", "\t\r\n", "&c:path; ", "&amp;",
+		"<", ">", "< p>", "<>", "</>", "<a/ >", "<a =b>",
+		"<very-long.name_with:all-0123456789-chars>",
+		"<\xc3\xa4>", "\xc3\xa4\xc3\xb6\xc3\xbc", "\0"sv,
+		"<p STYLE=\"color:red\" Title='it''s'>",
+	};
+
+	std::string result;
+	unsigned state = seed;
+	for (std::size_t i = 0; i < n; ++i) {
+		state = state * 1103515245 + 12345;
+		result.append(snippets[(state >> 16) % std::size(snippets)]);
+	}
+
+	return result;
+}
+
+TEST(XmlParser, Basic)
+{
+	const std::vector<std::string> expected{
+		"start OPEN 0 a",
+		"attr 3 9 10 11 href=x",
+		"attr 12 14 15 15 b=y",
+		"finish OPEN 0 16 a",
+		"cdata 16 e t",
+		"start CLOSE 17 a",
+		"finish CLOSE 17 21 a",
+	};
+
+	EXPECT_EQ(Parse("<A HREF=\"x\" b=y>t</a>", 1024), expected);
+	EXPECT_EQ(Parse("<A HREF=\"x\" b=y>t</a>", 1), expected);
+}
+
+/**
+ * Feed the same documents in differently sized chunks; the bulk
+ * scanners handle long runs within one chunk, while tiny chunks take
+ * the byte-wise paths.  All of them must produce the same callbacks.
+ */
+TEST(XmlParser, Chunks)
+{
+	std::vector<std::string> corpus{
+		"<html><head><title>Test</title></head><body></body></html>",
+		"<p class=\"___foo\" id=__bar>hello</p>",
+		"<![CDATA[a]b]]c]]]>tail",
+		"<!-- a -- b --- c --->after",
+		"<script>var s = '<p>' + \"</b>\";</script><b>x</b>",
+		"<?cm4all-rewrite-uri c:base=\"widget\"?>",
+		"<"s + std::string(100, 'n') + " a=b>text",
+		"<p " + std::string(100, 'n') + "=x y=z>",
+		"<p a=" + std::string(10000, 'v') + " b=c>",
+		"<p a=" + std::string(8192, 'v') + ">",
+		"<p\xff a=\x01\x7f\x80\xff b>",
+	};
+
+	for (unsigned seed = 1; seed <= 16; ++seed)
+		corpus.emplace_back(GenerateDocument(seed, 2000));
+
+	for (const auto &doc : corpus) {
+		const auto expected = Parse(doc, doc.size());
+
+		for (std::size_t chunk_size : {1, 2, 3, 7, 15, 16, 17, 31, 64, 4096})
+			EXPECT_EQ(Parse(doc, chunk_size), expected)
+				<< "chunk_size=" << chunk_size;
+	}
+}
+
+/**
+ * Compare the vectorized scanners with a trivial implementation for
+ * all byte values at all positions within a 16 byte block.
+ */
+TEST(XmlParser, Scan)
+{
+	char buffer[48];
+
+	for (unsigned ch = 0; ch < 256; ++ch) {
+		for (std::size_t i = 0; i < sizeof(buffer); ++i) {
+			std::fill_n(buffer, sizeof(buffer), 'a');
+			buffer[i] = (char)ch;
+
+			const char *const begin = buffer;
+			const char *const end = buffer + sizeof(buffer);
+
+			EXPECT_EQ(FindNonHtmlNameChar(begin, end),
+				  std::find_if_not(begin, end,
+						   is_html_name_char));
+
+			std::fill_n(buffer, sizeof(buffer), 'x');
+			buffer[i] = (char)ch;
+
+			EXPECT_EQ(FindUnquotedAttributeValueEnd(begin, end),
+				  std::find_if(begin, end, [](char c){
+					  return IsWhitespaceOrNull(c) || c == '>';
+				  }));
+		}
+	}
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "../TestInstance.hxx"
+#include "widget/FragmentCache.hxx"
+#include "translation/Extension.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/istream_string.hxx"
+#include "istream/StringSink.hxx"
+#include "pool/pool.hxx"
+#include "util/Cancellable.hxx"
+#include "util/SpanCast.hxx"
+#include "AllocatorPtr.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+using std::string_view_literals::operator""sv;
+
+namespace {
+
+class MyStringSinkHandler final : public StringSinkHandler {
+	EventLoop &event_loop;
+
+public:
+	std::string value;
+	std::exception_ptr error;
+	bool finished = false;
+
+	explicit MyStringSinkHandler(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	/* virtual methods from class StringSinkHandler */
+	void OnStringSinkSuccess(std::string &&_value) noexcept override {
+		value = std::move(_value);
+		finished = true;
+		event_loop.Break();
+	}
+
+	void OnStringSinkError(std::exception_ptr ep) noexcept override {
+		error = std::move(ep);
+		finished = true;
+		event_loop.Break();
+	}
+};
+
+} // anonymous namespace
+
+static std::string
+ReadAll(TestInstance &instance, struct pool &pool, UnusedIstreamPtr input)
+{
+	MyStringSinkHandler handler{instance.event_loop};
+	CancellablePointer cancel_ptr;
+	auto &sink = NewStringSink(pool, std::move(input),
+				   handler, cancel_ptr);
+	ReadStringSink(sink);
+
+	if (!handler.finished)
+		instance.event_loop.Run();
+
+	EXPECT_TRUE(handler.finished);
+	EXPECT_FALSE(handler.error);
+	return std::move(handler.value);
+}
+
+static const char *
+MakeKey(AllocatorPtr alloc, const char *class_name,
+	const char *path_info, const char *query_string) noexcept
+{
+	return WidgetFragmentCache::MakeKey(alloc, class_name,
+					    path_info, query_string,
+					    "w", "__w__",
+					    "http://example.com/page");
+}
+
+TEST(WidgetFragmentCache, Key)
+{
+	TestInstance instance;
+	auto pool = pool_new_linear(instance.root_pool, "test", 8192);
+	const AllocatorPtr alloc{pool};
+
+	EXPECT_STREQ(MakeKey(alloc, "foo", "/bar", nullptr),
+		     "foo|/bar|w|__w__|http://example.com/page");
+	EXPECT_STREQ(MakeKey(alloc, "foo", "/bar", "a=b"),
+		     "foo|/bar?a=b|w|__w__|http://example.com/page");
+	EXPECT_STREQ(MakeKey(alloc, "foo", nullptr, nullptr),
+		     "foo||w|__w__|http://example.com/page");
+	EXPECT_STREQ(WidgetFragmentCache::MakeKey(alloc, "foo", nullptr, nullptr,
+						  nullptr, nullptr, nullptr),
+		     "foo||||");
+
+	/* an empty query string is different from none */
+	EXPECT_STRNE(MakeKey(alloc, "foo", "/bar", ""),
+		     MakeKey(alloc, "foo", "/bar", nullptr));
+
+	/* different classes never share a fragment */
+	EXPECT_STRNE(MakeKey(alloc, "foo", "", nullptr),
+		     MakeKey(alloc, "foo2", "", nullptr));
+
+	/* the processors rewrite ids and URIs for each instance and
+	   each page */
+	EXPECT_STRNE(WidgetFragmentCache::MakeKey(alloc, "foo", "", nullptr,
+						  "a", "__a__", "/page"),
+		     WidgetFragmentCache::MakeKey(alloc, "foo", "", nullptr,
+						  "b", "__b__", "/page"));
+	EXPECT_STRNE(WidgetFragmentCache::MakeKey(alloc, "foo", "", nullptr,
+						  "a", "__a__", "/page1"),
+		     WidgetFragmentCache::MakeKey(alloc, "foo", "", nullptr,
+						  "a", "__a__", "/page2"));
+}
+
+TEST(WidgetFragmentCache, MaxAge)
+{
+	EXPECT_TRUE(IsTranslationExtension(TRANSLATE_WIDGET_FRAGMENT_CACHE));
+	EXPECT_FALSE(IsTranslationExtension(TranslationCommand::BEGIN));
+
+	const uint32_t sixty = 60;
+	EXPECT_EQ(ParseWidgetFragmentCache(ReferenceAsBytes(sixty)),
+		  std::chrono::seconds{60});
+
+	/* clipped to the upper limit */
+	const uint32_t huge = 0xffffffff;
+	EXPECT_EQ(ParseWidgetFragmentCache(ReferenceAsBytes(huge)),
+		  MAX_WIDGET_FRAGMENT_MAX_AGE);
+
+	/* zero and malformed payloads are rejected */
+	const uint32_t zero = 0;
+	EXPECT_THROW(ParseWidgetFragmentCache(ReferenceAsBytes(zero)),
+		     std::runtime_error);
+
+	const uint16_t short_value = 60;
+	EXPECT_THROW(ParseWidgetFragmentCache(ReferenceAsBytes(short_value)),
+		     std::runtime_error);
+	EXPECT_THROW(ParseWidgetFragmentCache({}), std::runtime_error);
+}
+
+TEST(WidgetFragmentCache, HitMiss)
+{
+	static constexpr std::string_view fragment = "<p>hello world</p>"sv;
+
+	TestInstance instance;
+	WidgetFragmentCache cache{instance.event_loop, 1024 * 1024};
+
+	{
+		auto pool = pool_new_linear(instance.root_pool, "test", 8192);
+		EXPECT_FALSE(cache.Get(pool, "foo|"));
+	}
+
+	EXPECT_EQ(cache.GetStats().misses, 1U);
+	EXPECT_EQ(cache.GetStats().hits, 0U);
+
+	/* store it; the caller receives the fragment, too */
+	{
+		auto pool = pool_new_linear(instance.root_pool, "test", 8192);
+		const char *key = p_strdup(pool, "foo|");
+		EXPECT_EQ(ReadAll(instance, pool,
+				  cache.Put(pool, key,
+					    istream_string_new(pool, fragment),
+					    std::chrono::minutes{1})),
+			  fragment);
+	}
+
+	EXPECT_EQ(cache.GetStats().stores, 1U);
+
+	/* hit */
+	{
+		auto pool = pool_new_linear(instance.root_pool, "test", 8192);
+		auto cached = cache.Get(pool, "foo|");
+		ASSERT_TRUE(cached);
+		EXPECT_EQ(ReadAll(instance, pool, std::move(cached)), fragment);
+	}
+
+	EXPECT_EQ(cache.GetStats().hits, 1U);
+
+	/* a different key misses */
+	{
+		auto pool = pool_new_linear(instance.root_pool, "test", 8192);
+		EXPECT_FALSE(cache.Get(pool, "foo|?a=b"));
+		EXPECT_FALSE(cache.Get(pool, "bar|"));
+	}
+
+	EXPECT_EQ(cache.GetStats().misses, 3U);
+
+	/* after a flush, it's a miss again */
+	cache.Flush();
+
+	{
+		auto pool = pool_new_linear(instance.root_pool, "test", 8192);
+		EXPECT_FALSE(cache.Get(pool, "foo|"));
+	}
+
+	EXPECT_EQ(cache.GetStats().misses, 4U);
+	EXPECT_EQ(cache.GetStats().hits, 1U);
+}
@@ -9,6 +9,7 @@
 #include "widget/Request.hxx"
 #include "widget/Resolver.hxx"
 #include "widget/Context.hxx"
+#include "widget/FragmentCache.hxx"
 #include "bp/XmlProcessor.hxx"
 #include "uri/Dissect.hxx"
 #include "http/ResponseHandler.hxx"
@@ -80,6 +81,28 @@ Widget::LoadFromSession([[maybe_unused]] RealmSession &session) noexcept
 {
 }
 
+const char *
+WidgetFragmentCache::MakeKey(AllocatorPtr, const char *class_name,
+			     const char *, const char *,
+			     const char *, const char *,
+			     const char *) noexcept
+{
+	return class_name;
+}
+
+UnusedIstreamPtr
+WidgetFragmentCache::Get(struct pool &, const char *) noexcept
+{
+	return {};
+}
+
+UnusedIstreamPtr
+WidgetFragmentCache::Put(struct pool &, const char *,
+			 UnusedIstreamPtr src, std::chrono::seconds) noexcept
+{
+	return src;
+}
+
 void
 widget_http_request([[maybe_unused]] struct pool &pool,
 		    [[maybe_unused]] Widget &widget,
@@ -3,6 +3,7 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "widget/Registry.hxx"
+#include "widget/Prefetch.hxx"
 #include "widget/Widget.hxx"
 #include "widget/View.hxx"
 #include "widget/Class.hxx"
@@ -25,8 +26,12 @@
 
 class MyTranslationService final : public TranslationService, Cancellable {
 public:
+	unsigned n_requests = 0;
 	bool aborted = false;
 
+	struct pool *blocked_pool = nullptr;
+	TranslateHandler *blocked_handler = nullptr;
+
 	/* virtual methods from class TranslationService */
 	void SendRequest(AllocatorPtr alloc,
 			 const TranslateRequest &request,
@@ -34,12 +39,27 @@ public:
 			 TranslateHandler &handler,
 			 CancellablePointer &cancel_ptr) noexcept override;
 
+	/**
+	 * Finish the pending "block" request.
+	 */
+	void Unblock() noexcept;
+
 	/* virtual methods from class Cancellable */
 	void Cancel() noexcept override {
 		aborted = true;
 	}
 };
 
+struct RegistryResult {
+	bool got_class = false;
+	const WidgetClass *cls = nullptr;
+
+	void RegistryCallback(const WidgetClass *_cls) noexcept {
+		got_class = true;
+		cls = _cls;
+	}
+};
+
 struct Context : PInstance {
 	bool got_class = false;
 	const WidgetClass *cls = nullptr;
@@ -55,6 +75,16 @@ struct Context : PInstance {
  *
  */
 
+static UniquePoolPtr<TranslateResponse>
+MakeResponse(AllocatorPtr alloc) noexcept
+{
+	auto response = UniquePoolPtr<TranslateResponse>::Make(alloc.GetPool());
+	response->address = *http_address_parse(alloc, "http://foo/");
+	response->views.push_front(*alloc.New<WidgetView>(nullptr));
+	response->views.front().address = {ShallowCopy(), response->address};
+	return response;
+}
+
 void
 MyTranslationService::SendRequest(AllocatorPtr alloc,
 				  const TranslateRequest &request,
@@ -69,18 +99,27 @@ MyTranslationService::SendRequest(AllocatorPtr alloc,
 	assert(request.session.data() == nullptr);
 	assert(request.param == NULL);
 
+	++n_requests;
+
 	if (strcmp(request.widget_type, "sync") == 0) {
-		auto response = UniquePoolPtr<TranslateResponse>::Make(alloc.GetPool());
-		response->address = *http_address_parse(alloc, "http://foo/");
-		response->views.push_front(*alloc.New<WidgetView>(nullptr));
-		response->views.front().address = {ShallowCopy(), response->address};
-		handler.OnTranslateResponse(std::move(response));
+		handler.OnTranslateResponse(MakeResponse(alloc));
 	} else if (strcmp(request.widget_type, "block") == 0) {
+		blocked_pool = &alloc.GetPool();
+		blocked_handler = &handler;
 		cancel_ptr = *this;
 	} else
 		assert(0);
 }
 
+void
+MyTranslationService::Unblock() noexcept
+{
+	assert(blocked_handler != nullptr);
+
+	auto &handler = *std::exchange(blocked_handler, nullptr);
+	handler.OnTranslateResponse(MakeResponse(*blocked_pool));
+}
+
 
 /*
  * tests
@@ -91,7 +130,7 @@ TEST(WidgetRegistry, Normal)
 {
 	MyTranslationService ts;
 	Context data;
-	WidgetRegistry registry(data.root_pool, ts);
+	WidgetRegistry registry(data.event_loop, data.root_pool, ts);
 	CancellablePointer cancel_ptr;
 
 	auto pool = pool_new_linear(data.root_pool, "test", 8192);
@@ -111,6 +150,18 @@ TEST(WidgetRegistry, Normal)
 	ASSERT_EQ(std::next(data.cls->views.begin()), data.cls->views.end());
 	ASSERT_TRUE(view.transformations.empty());
 
+	/* the second lookup is served by the cache */
+	RegistryResult second;
+	registry.LookupWidgetClass(pool, pool, "sync",
+				   BIND_METHOD(second, &RegistryResult::RegistryCallback),
+				   cancel_ptr);
+	ASSERT_TRUE(second.got_class);
+	ASSERT_NE(second.cls, nullptr);
+	ASSERT_NE(second.cls, data.cls);
+	ASSERT_EQ(ts.n_requests, 1U);
+	ASSERT_EQ(registry.GetStats().hits, 1U);
+	ASSERT_EQ(registry.GetStats().misses, 1U);
+
 	pool.reset();
 	pool_commit();
 }
@@ -120,7 +171,7 @@ TEST(WidgetRegistry, Abort)
 {
 	MyTranslationService ts;
 	Context data;
-	WidgetRegistry registry(data.root_pool, ts);
+	WidgetRegistry registry(data.event_loop, data.root_pool, ts);
 	CancellablePointer cancel_ptr;
 
 	auto pool = pool_new_linear(data.root_pool, "test", 8192);
@@ -139,3 +190,153 @@ TEST(WidgetRegistry, Abort)
 	pool.reset();
 	pool_commit();
 }
+
+/** concurrent lookups of the same class are coalesced */
+TEST(WidgetRegistry, Coalesce)
+{
+	MyTranslationService ts;
+	Context data;
+	WidgetRegistry registry(data.event_loop, data.root_pool, ts);
+	CancellablePointer cancel_ptr1, cancel_ptr2;
+	RegistryResult first, second;
+
+	auto pool = pool_new_linear(data.root_pool, "test", 8192);
+
+	registry.LookupWidgetClass(pool, pool, "block",
+				   BIND_METHOD(first, &RegistryResult::RegistryCallback),
+				   cancel_ptr1);
+	registry.LookupWidgetClass(pool, pool, "block",
+				   BIND_METHOD(second, &RegistryResult::RegistryCallback),
+				   cancel_ptr2);
+	ASSERT_EQ(ts.n_requests, 1U);
+	ASSERT_FALSE(first.got_class);
+	ASSERT_FALSE(second.got_class);
+
+	ts.Unblock();
+
+	ASSERT_FALSE(ts.aborted);
+	ASSERT_TRUE(first.got_class);
+	ASSERT_TRUE(second.got_class);
+	ASSERT_NE(first.cls, nullptr);
+	ASSERT_NE(second.cls, nullptr);
+	ASSERT_NE(first.cls, second.cls);
+	ASSERT_STREQ(second.cls->views.front().address.GetHttp().host_and_port, "foo");
+
+	pool.reset();
+	pool_commit();
+}
+
+/** one of several coalesced callers aborts */
+TEST(WidgetRegistry, CoalesceAbort)
+{
+	MyTranslationService ts;
+	Context data;
+	WidgetRegistry registry(data.event_loop, data.root_pool, ts);
+	CancellablePointer cancel_ptr1, cancel_ptr2;
+	RegistryResult first, second;
+
+	auto pool = pool_new_linear(data.root_pool, "test", 8192);
+
+	registry.LookupWidgetClass(pool, pool, "block",
+				   BIND_METHOD(first, &RegistryResult::RegistryCallback),
+				   cancel_ptr1);
+	registry.LookupWidgetClass(pool, pool, "block",
+				   BIND_METHOD(second, &RegistryResult::RegistryCallback),
+				   cancel_ptr2);
+
+	/* the translation request continues as long as somebody
+	   waits for it */
+	cancel_ptr1.Cancel();
+	ASSERT_FALSE(ts.aborted);
+
+	ts.Unblock();
+
+	ASSERT_FALSE(first.got_class);
+	ASSERT_TRUE(second.got_class);
+	ASSERT_NE(second.cls, nullptr);
+
+	/* now both callers abort */
+	registry.FlushCache();
+
+	registry.LookupWidgetClass(pool, pool, "block",
+				   BIND_METHOD(first, &RegistryResult::RegistryCallback),
+				   cancel_ptr1);
+	registry.LookupWidgetClass(pool, pool, "block",
+				   BIND_METHOD(second, &RegistryResult::RegistryCallback),
+				   cancel_ptr2);
+	ASSERT_EQ(ts.n_requests, 2U);
+
+	cancel_ptr2.Cancel();
+	ASSERT_FALSE(ts.aborted);
+	cancel_ptr1.Cancel();
+	ASSERT_TRUE(ts.aborted);
+
+	pool.reset();
+	pool_commit();
+}
+
+/** a prefetch is used by a later lookup */
+TEST(WidgetRegistry, Prefetch)
+{
+	MyTranslationService ts;
+	Context data;
+	WidgetRegistry registry(data.event_loop, data.root_pool, ts);
+	CancellablePointer cancel_ptr;
+	RegistryResult result;
+
+	auto pool = pool_new_linear(data.root_pool, "test", 8192);
+
+	{
+		WidgetClassPrefetch prefetch(data.event_loop, pool, registry);
+		prefetch.Add("block");
+		ASSERT_EQ(ts.n_requests, 1U);
+		ASSERT_FALSE(prefetch.IsEmpty());
+
+		/* the real lookup attaches to the prefetch */
+		registry.LookupWidgetClass(pool, pool, "block",
+					   BIND_METHOD(result, &RegistryResult::RegistryCallback),
+					   cancel_ptr);
+		ASSERT_EQ(ts.n_requests, 1U);
+
+		ts.Unblock();
+
+		ASSERT_TRUE(result.got_class);
+		ASSERT_NE(result.cls, nullptr);
+		ASSERT_TRUE(prefetch.IsEmpty());
+
+		/* cached classes are not prefetched again */
+		prefetch.Add("block");
+		ASSERT_TRUE(prefetch.IsEmpty());
+		ASSERT_EQ(ts.n_requests, 1U);
+	}
+
+	ASSERT_FALSE(ts.aborted);
+
+	pool.reset();
+	pool_commit();
+}
+
+/** destroying the #WidgetClassPrefetch cancels the lookups */
+TEST(WidgetRegistry, PrefetchAbort)
+{
+	MyTranslationService ts;
+	Context data;
+	WidgetRegistry registry(data.event_loop, data.root_pool, ts);
+
+	auto pool = pool_new_linear(data.root_pool, "test", 8192);
+
+	{
+		WidgetClassPrefetch prefetch(data.event_loop, pool, registry);
+		prefetch.Add("sync");
+		ASSERT_TRUE(prefetch.IsEmpty());
+
+		prefetch.Add("block");
+		ASSERT_EQ(ts.n_requests, 2U);
+		ASSERT_FALSE(ts.aborted);
+	}
+
+	ASSERT_TRUE(ts.aborted);
+
+	pool.reset();
+	pool_commit();
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+#
+# Convert a binary stopwatch dump (see "The Stopwatch" in
+# doc/bp.rst) to the Chrome trace event format.
+#
+# Author: Max Kellermann <mk@cm4all.com>
+#
+
+import json
+import struct
+import sys
+
+MAGIC = 0x31545753
+
+HEADER = struct.Struct('=II')
+NODE = struct.Struct('=QHBBxxxx')
+EVENT = struct.Struct('=IHxx')
+
+def parse_trace(data):
+    """Parse the nodes of one trace, yielding (depth, start_us, name,
+    events) tuples."""
+
+    pos = 0
+    while pos < len(data):
+        start_us, name_length, depth, n_events = NODE.unpack_from(data, pos)
+        pos += NODE.size
+        name = data[pos:pos + name_length].decode('utf-8', 'replace')
+        pos += name_length
+
+        events = []
+        for i in range(n_events):
+            offset_us, event_name_length = EVENT.unpack_from(data, pos)
+            pos += EVENT.size
+            event_name = data[pos:pos + event_name_length].decode('utf-8', 'replace')
+            pos += event_name_length
+            events.append((offset_us, event_name))
+
+        yield depth, start_us, name, events
+
+def parse_dump(f):
+    """Parse a binary stopwatch dump, yielding one list of nodes per
+    trace."""
+
+    while True:
+        header = f.read(HEADER.size)
+        if len(header) < HEADER.size:
+            break
+
+        magic, size = HEADER.unpack(header)
+        if magic != MAGIC:
+            raise ValueError('Bad magic')
+
+        data = f.read(size)
+        if len(data) < size:
+            break
+
+        yield list(parse_trace(data))
+
+def to_chrome_events(traces):
+    result = []
+
+    for tid, nodes in enumerate(traces, 1):
+        for depth, start_us, name, events in nodes:
+            duration = max((offset for offset, _ in events), default=0)
+            result.append({
+                'name': name,
+                'ph': 'X',
+                'ts': start_us,
+                'dur': duration,
+                'pid': 1,
+                'tid': tid,
+                'args': {'depth': depth},
+            })
+
+            for offset, event_name in events:
+                result.append({
+                    'name': event_name,
+                    'ph': 'i',
+                    's': 't',
+                    'ts': start_us + offset,
+                    'pid': 1,
+                    'tid': tid,
+                })
+
+    return result
+
+if __name__ == '__main__':
+    traces = parse_dump(sys.stdin.buffer)
+    json.dump({'traceEvents': to_chrome_events(traces)}, sys.stdout)